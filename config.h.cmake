@@ -7,9 +7,24 @@
 /* Defined if MQTT handling is enabled. */
 #cmakedefine HAVE_MQTT
 
+/* Defined if zlib is available for gzip compression of HTTP responses and the binary raw log. */
+#cmakedefine HAVE_ZLIB
+
+/* Defined if epoll is available. */
+#cmakedefine HAVE_EPOLL
+
+/* Defined if eventfd() is available. */
+#cmakedefine HAVE_EVENTFD
+
 /* Defined if ppoll() is available. */
 #cmakedefine HAVE_PPOLL
 
+/* Defined if recvmmsg() is available. */
+#cmakedefine HAVE_RECVMMSG
+
+/* Defined if timerfd_create() is available. */
+#cmakedefine HAVE_TIMERFD
+
 /* Defined if pselect() is available. */
 #cmakedefine HAVE_PSELECT
 
@@ -19,6 +34,12 @@
 /* Defined if pthread_setname_np is available. */
 #cmakedefine HAVE_PTHREAD_SETNAME_NP
 
+/* Defined if pthread_setaffinity_np is available. */
+#cmakedefine HAVE_PTHREAD_SETAFFINITY_NP
+
+/* Defined if mlockall() is available. */
+#cmakedefine HAVE_MLOCKALL
+
 /* The name of package. */
 #cmakedefine PACKAGE "${PACKAGE_NAME}"
 
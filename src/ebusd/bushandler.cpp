@@ -92,10 +92,21 @@ bool PollRequest::notify(result_t result, const SlaveSymbolString& slave) {
 
 
 result_t ScanRequest::prepare(symbol_t ownMasterAddress) {
+  if (m_pipelined) {
+    while (selectNext()) {
+      if (prepareMaster(ownMasterAddress, m_dstAddress) >= RESULT_OK) {
+        return m_result;
+      }
+    }
+    return RESULT_ERR_EOF;
+  }
   if (m_slaves.empty()) {
     return RESULT_ERR_EOF;
   }
-  symbol_t dstAddress = m_slaves.front();
+  return prepareMaster(ownMasterAddress, m_slaves.front());
+}
+
+result_t ScanRequest::prepareMaster(symbol_t ownMasterAddress, symbol_t dstAddress) {
   istringstream input;
   m_result = m_message->prepareMaster(m_index, ownMasterAddress, dstAddress, UI_FIELD_SEPARATOR, &input, &m_master);
   if (m_result >= RESULT_OK) {
@@ -104,6 +115,38 @@ result_t ScanRequest::prepare(symbol_t ownMasterAddress) {
   return m_result;
 }
 
+void ScanRequest::addIdentified(symbol_t slave) {
+  for (auto& followUps : m_followUps) {
+    followUps.push_back(slave);
+  }
+}
+
+bool ScanRequest::selectNext() {
+  // alternate between identifying the next slave and a secondary message of an already identified slave, with the
+  // secondary messages taken round robin over the identified slaves
+  size_t index = 0;
+  while (index < m_followUps.size() && m_followUps[index].empty()) {
+    index++;
+  }
+  bool followUp = index < m_followUps.size();
+  m_index = 0;
+  if (followUp && (m_identifying || m_slaves.empty())) {
+    m_dstAddress = m_followUps[index].front();
+    m_followUps[index].pop_front();
+    m_message = m_allMessages[index];
+    m_identifying = false;
+    return true;
+  }
+  if (m_slaves.empty()) {
+    return false;
+  }
+  m_dstAddress = m_slaves.front();
+  m_slaves.pop_front();
+  m_message = m_messageMap->getScanMessage();
+  m_identifying = true;
+  return true;
+}
+
 bool ScanRequest::notify(result_t result, const SlaveSymbolString& slave) {
   symbol_t dstAddress = m_master[1];
   if (result == RESULT_OK) {
@@ -121,7 +164,7 @@ bool ScanRequest::notify(result_t result, const SlaveSymbolString& slave) {
     result = m_message->storeLastData(m_index, slave);
     if (result >= RESULT_OK && m_index+1 < m_message->getCount()) {
       m_index++;
-      result = prepare(m_master[0]);
+      result = prepareMaster(m_master[0], dstAddress);
       if (result >= RESULT_OK) {
         return true;
       }
@@ -130,8 +173,33 @@ bool ScanRequest::notify(result_t result, const SlaveSymbolString& slave) {
       ostringstream output;
       result = m_message->decodeLastData(true, nullptr, -1, 0, &output);  // decode data
       string str = output.str();
-      m_busHandler->setScanResult(dstAddress, m_notifyIndex+m_index, str);
+      if (m_pipelined) {
+        m_busHandler->setScanResult(dstAddress, (m_identifying ? 0 : 1)+m_index, str);
+        if (m_identifying) {
+          addIdentified(dstAddress);
+        }
+      } else {
+        m_busHandler->setScanResult(dstAddress, m_notifyIndex+m_index, str);
+      }
+    }
+  }
+  if (m_pipelined) {
+    if (result < RESULT_OK) {
+      if (result == RESULT_ERR_TIMEOUT) {
+        logNotice(lf_bus, "scan %2.2x timed out (%d slaves left)", dstAddress, m_slaves.size());
+      } else {
+        logError(lf_bus, "scan %2.2x failed (%d slaves left): %s", dstAddress, m_slaves.size(), getResultCode(result));
+      }
+    } else if (m_identifying) {
+      logNotice(lf_bus, "scan %2.2x identified (%d slaves left)", dstAddress, m_slaves.size());
     }
+    if (result == RESULT_ERR_NO_SIGNAL || prepare(m_master[0]) < RESULT_OK) {
+      logNotice(lf_bus, "scan finished");
+      m_result = result;
+      m_busHandler->setScanFinished();
+      return false;
+    }
+    return true;
   }
   if (result < RESULT_OK) {
     if (!m_slaves.empty()) {
@@ -188,15 +256,265 @@ bool ActiveBusRequest::notify(result_t result, const SlaveSymbolString& slave) {
   return false;
 }
 
+/**
+ * Return the elapsed time between two points in time.
+ * @param start the start time.
+ * @param end the end time.
+ * @return the elapsed time in microseconds, or -1 on clock skew.
+ */
+static long long getElapsedMicros(const struct timespec& start, const struct timespec& end) {
+  long long micros = (end.tv_sec*1000000000LL + end.tv_nsec - start.tv_sec*1000000000LL - start.tv_nsec)/1000;
+  return micros < 0 ? -1 : micros;
+}
 
-void GrabbedMessage::setLastData(const MasterSymbolString& master, const SlaveSymbolString& slave) {
-  time(&m_lastTime);
-  m_lastMaster = master;
-  m_lastSlave = slave;
+/**
+ * Add the elapsed time since the specified start to the @a Histogram.
+ * @param start the start time.
+ * @param histogram the @a Histogram to add to.
+ */
+static void addElapsedMicros(const struct timespec& start, Histogram* histogram) {
+  struct timespec now;
+  clockGettime(&now);
+  long long micros = getElapsedMicros(start, now);
+  if (micros >= 0) {
+    histogram->add(micros > UINT32_MAX ? UINT32_MAX : static_cast<unsigned int>(micros));
+  }
+}
+
+void BusRequestQueue::push(BusRequest* request) {
+  m_mutex.lock();
+  clockGettime(&request->m_queuedTime);
+  m_lanes[request->m_lane].push_back(request);
+  RequestLaneStats& stats = m_stats[request->m_lane];
+  if (++stats.m_depth > stats.m_maxDepth) {
+    stats.m_maxDepth = stats.m_depth;
+  }
+  m_mutex.unlock();
+}
+
+BusRequest* BusRequestQueue::pop() {
+  BusRequest* request = nullptr;
+  m_mutex.lock();
+  for (auto& lane : m_lanes) {
+    if (!lane.empty()) {
+      request = lane.front();
+      lane.pop_front();
+      taken(request);
+      break;
+    }
+  }
+  m_mutex.unlock();
+  return request;
+}
+
+BusRequest* BusRequestQueue::peek() {
+  BusRequest* request = nullptr;
+  m_mutex.lock();
+  for (const auto& lane : m_lanes) {
+    if (!lane.empty()) {
+      request = lane.front();
+      break;
+    }
+  }
+  m_mutex.unlock();
+  return request;
+}
+
+bool BusRequestQueue::remove(BusRequest* request) {
+  bool result = false;
+  m_mutex.lock();
+  list<BusRequest*>& lane = m_lanes[request->m_lane];
+  for (auto it = lane.begin(); it != lane.end(); it++) {
+    if (*it == request) {
+      lane.erase(it);
+      taken(request);
+      result = true;
+      break;
+    }
+  }
+  m_mutex.unlock();
+  return result;
+}
+
+void BusRequestQueue::taken(const BusRequest* request) {
+  RequestLaneStats& stats = m_stats[request->m_lane];
+  stats.m_depth--;
+  stats.m_count++;
+  struct timespec now;
+  clockGettime(&now);
+  long long micros = getElapsedMicros(request->m_queuedTime, now);
+  if (micros > 0) {
+    stats.m_waitMicros += static_cast<uint64_t>(micros);
+    if (static_cast<uint64_t>(micros) > stats.m_maxWaitMicros) {
+      stats.m_maxWaitMicros = static_cast<uint64_t>(micros);
+    }
+  }
+}
+
+void BusRequestQueue::getStats(RequestLaneStats* stats) {
+  m_mutex.lock();
+  memcpy(stats, m_stats, sizeof(m_stats));
+  m_mutex.unlock();
+}
+
+void BusRequestQueue::resetStats() {
+  m_mutex.lock();
+  for (auto& stats : m_stats) {
+    stats.m_maxDepth = stats.m_depth;
+    stats.m_count = 0;
+    stats.m_waitMicros = 0;
+    stats.m_maxWaitMicros = 0;
+  }
+  m_mutex.unlock();
+}
+
+
+
+void GrabbedMessage::reset() {
+  m_firstTime = m_lastTime = 0;
+  m_lastMaster.clear();
+  m_lastSlave.clear();
+  m_count = m_interval = 0;
+  m_decodeValid = false;
+}
+
+void GrabbedMessage::setLastData(const MasterSymbolString& master, const SlaveSymbolString& slave, time_t now) {
+  if (m_count == 0) {
+    m_firstTime = now;
+  } else if (now >= m_lastTime) {
+    unsigned int interval = static_cast<unsigned int>(now - m_lastTime);
+    m_interval = m_count == 1 ? interval : (m_interval*3 + interval)/4;
+  }
+  m_lastTime = now;
+  if (master.compareTo(m_lastMaster) != 0 || slave.compareTo(m_lastSlave) != 0) {
+    m_lastMaster = master;
+    m_lastSlave = slave;
+    m_decodeValid = false;
+  }
   m_count++;
 }
 
 
+void GrabTable::add(uint64_t key, const MasterSymbolString& master, const SlaveSymbolString& slave, time_t now) {
+  if (m_slots.empty()) {
+    size_t slots = 16;
+    while (slots < m_capacity*2) {
+      slots <<= 1;
+    }
+    m_slots.assign(slots, 0);
+    m_entries.reserve(m_capacity);
+  }
+  size_t slot = findSlot(key);
+  uint32_t pos;
+  if (m_slots[slot] != 0) {
+    pos = m_slots[slot]-1;
+    if (pos != m_head) {
+      unlink(pos);
+      linkFront(pos);
+    }
+  } else {
+    if (m_entries.size() < m_capacity) {
+      pos = static_cast<uint32_t>(m_entries.size());
+      m_entries.push_back(GrabbedMessage());
+    } else {
+      // reuse the storage of the least recently received entry
+      pos = m_tail;
+      eraseSlot(findSlot(m_entries[pos].m_key));
+      unlink(pos);
+      m_entries[pos].reset();
+      m_evicted++;
+      slot = findSlot(key);
+    }
+    m_slots[slot] = pos+1;
+    m_entries[pos].m_key = key;
+    linkFront(pos);
+  }
+  m_entries[pos].setLastData(master, slave, now);
+}
+
+void GrabTable::clear() {
+  m_entries.clear();
+  m_slots.clear();
+  m_head = m_tail = GRAB_END;
+  m_evicted = 0;
+}
+
+void GrabTable::addMemoryUsage(MemoryUsage* usage) const {
+  size_t bytes = m_entries.capacity()*sizeof(GrabbedMessage) + m_slots.capacity()*sizeof(uint32_t);
+  for (const auto& entry : m_entries) {
+    bytes += entry.m_lastMaster.getHeapSize() + entry.m_lastSlave.getHeapSize()
+        + MemoryUsage::getHeapSize(entry.m_decodeHints);
+  }
+  usage->add(mk_grabbed, bytes, m_entries.size());
+}
+
+void GrabTable::keepDecodeHints(const GrabbedMessage& formatted) const {
+  if (!formatted.m_decodeValid || m_slots.empty()) {
+    return;
+  }
+  size_t slot = findSlot(formatted.m_key);
+  if (m_slots[slot] == 0) {
+    return;  // evicted meanwhile
+  }
+  const GrabbedMessage& entry = m_entries[m_slots[slot]-1];
+  if (!entry.m_decodeValid && entry.m_lastMaster.compareTo(formatted.m_lastMaster) == 0
+      && entry.m_lastSlave.compareTo(formatted.m_lastSlave) == 0) {
+    entry.m_decodeHints = formatted.m_decodeHints;
+    entry.m_decodeValid = true;
+  }
+}
+
+size_t GrabTable::findSlot(uint64_t key) const {
+  size_t mask = m_slots.size()-1;
+  size_t slot = hash(key) & mask;
+  while (m_slots[slot] != 0 && m_entries[m_slots[slot]-1].m_key != key) {
+    slot = (slot+1) & mask;
+  }
+  return slot;
+}
+
+void GrabTable::eraseSlot(size_t slot) {
+  size_t mask = m_slots.size()-1;
+  size_t hole = slot;
+  for (size_t check = (slot+1) & mask; m_slots[check] != 0; check = (check+1) & mask) {
+    size_t home = hash(m_entries[m_slots[check]-1].m_key) & mask;
+    if (((check-home) & mask) >= ((check-hole) & mask)) {
+      // the entry may be moved to the hole without getting out of reach from its home slot
+      m_slots[hole] = m_slots[check];
+      hole = check;
+    }
+  }
+  m_slots[hole] = 0;
+}
+
+void GrabTable::unlink(uint32_t pos) {
+  GrabbedMessage& entry = m_entries[pos];
+  if (entry.m_prev == GRAB_END) {
+    m_head = entry.m_next;
+  } else {
+    m_entries[entry.m_prev].m_next = entry.m_next;
+  }
+  if (entry.m_next == GRAB_END) {
+    m_tail = entry.m_prev;
+  } else {
+    m_entries[entry.m_next].m_prev = entry.m_prev;
+  }
+  entry.m_prev = entry.m_next = GRAB_END;
+}
+
+void GrabTable::linkFront(uint32_t pos) {
+  GrabbedMessage& entry = m_entries[pos];
+  entry.m_prev = GRAB_END;
+  entry.m_next = m_head;
+  if (m_head == GRAB_END) {
+    m_tail = pos;
+  } else {
+    m_entries[m_head].m_prev = pos;
+  }
+  m_head = pos;
+}
+
+
 /**
  * Decode the input @a SymbolString with the specified @a DataType and length.
  * @param type the @a DataType.
@@ -266,53 +584,67 @@ bool GrabbedMessage::dump(bool unknown, MessageMap* messages, bool first, bool d
   }
   if (!isDirectMode) {
     *output << " = " << m_count;
+    if (m_interval > 0) {
+      *output << " every " << m_interval << "s";
+    }
     if (message) {
       *output << ": " << message->getCircuit() << " " << message->getName();
     }
   }
   if (decode) {
-    DataTypeList *types = DataTypeList::getInstance();
-    if (!types) {
-      return true;
-    }
-    bool master = isMaster(dstAddress) || dstAddress == BROADCAST || m_lastSlave.getDataSize() <= 0;
-    size_t remain = master ? m_lastMaster.getDataSize() : m_lastSlave.getDataSize();
-    if (remain == 0) {
-      return true;
-    }
-    for (const auto it : *types) {
-      const DataType* baseType = it.second;
-      if ((baseType->getBitCount() % 8) != 0 || baseType->isIgnored()) {  // skip bit and ignored types
-        continue;
-      }
-      size_t maxLength = baseType->getBitCount()/8;
-      bool firstOnly = maxLength >= 8;
-      if (maxLength > remain) {
-        maxLength = remain;
-      }
-      if (baseType->isAdjustableLength()) {
-        for (size_t length = maxLength; length >= 1; length--) {
-          const DataType* type = types->get(baseType->getId(), length);
-          bool decoded;
-          if (master) {
-            decoded = decodeType(type, m_lastMaster, length, remain-length, firstOnly, output);
-          } else {
-            decoded = decodeType(type, m_lastSlave, length, remain-length, firstOnly, output);
-          }
-          if (decoded && firstOnly) {
-            break;  // only a single offset with maximum length when adjustable maximum size is at least 8 bytes
-          }
-        }
-      } else if (maxLength > 0) {
+    if (!m_decodeValid) {
+      ostringstream hints;
+      formatDecodeHints(&hints);
+      m_decodeHints = hints.str();
+      m_decodeValid = true;
+    }
+    *output << m_decodeHints;
+  }
+  return true;
+}
+
+void GrabbedMessage::formatDecodeHints(ostringstream* output) const {
+  symbol_t dstAddress = m_lastMaster[1];
+  DataTypeList *types = DataTypeList::getInstance();
+  if (!types) {
+    return;
+  }
+  bool master = isMaster(dstAddress) || dstAddress == BROADCAST || m_lastSlave.getDataSize() <= 0;
+  size_t remain = master ? m_lastMaster.getDataSize() : m_lastSlave.getDataSize();
+  if (remain == 0) {
+    return;
+  }
+  for (const auto& it : *types) {
+    const DataType* baseType = it.second;
+    if ((baseType->getBitCount() % 8) != 0 || baseType->isIgnored()) {  // skip bit and ignored types
+      continue;
+    }
+    size_t maxLength = baseType->getBitCount()/8;
+    bool firstOnly = maxLength >= 8;
+    if (maxLength > remain) {
+      maxLength = remain;
+    }
+    if (baseType->isAdjustableLength()) {
+      for (size_t length = maxLength; length >= 1; length--) {
+        const DataType* type = types->get(baseType->getId(), length);
+        bool decoded;
         if (master) {
-          decodeType(baseType, m_lastMaster, maxLength, remain-maxLength, false, output);
+          decoded = decodeType(type, m_lastMaster, length, remain-length, firstOnly, output);
         } else {
-          decodeType(baseType, m_lastSlave, maxLength, remain-maxLength, false, output);
+          decoded = decodeType(type, m_lastSlave, length, remain-length, firstOnly, output);
         }
+        if (decoded && firstOnly) {
+          break;  // only a single offset with maximum length when adjustable maximum size is at least 8 bytes
+        }
+      }
+    } else if (maxLength > 0) {
+      if (master) {
+        decodeType(baseType, m_lastMaster, maxLength, remain-maxLength, false, output);
+      } else {
+        decodeType(baseType, m_lastSlave, maxLength, remain-maxLength, false, output);
       }
     }
   }
-  return true;
 }
 
 
@@ -322,10 +654,30 @@ void BusHandler::clear() {
   m_scanResults.clear();
 }
 
-result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave) {
+result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave, bool coalesce) {
   result_t result = RESULT_ERR_NO_SIGNAL;
   slave->clear();
+  struct timespec startTime;
+  clockGettime(&startTime);
   ActiveBusRequest request(master, slave);
+  string key;
+  if (coalesce) {
+    key = master.getStr();
+    m_pendingReadsMutex.lock();
+    const auto it = m_pendingReads.find(key);
+    if (it != m_pendingReads.end()) {
+      // wait for the identical pending request to finish
+      it->second->m_attached.push_back(&request);
+      m_coalescedReads.add();
+      m_pendingReadsMutex.unlock();
+      logInfo(lf_bus, "attach to pending message: %s", key.c_str());
+      bool success = m_finishedRequests.remove(&request, true);
+      addElapsedMicros(startTime, &m_sendAndWaitHist);
+      return success ? request.m_result : RESULT_ERR_TIMEOUT;
+    }
+    m_pendingReads[key] = &request;
+    m_pendingReadsMutex.unlock();
+  }
   logInfo(lf_bus, "send message: %s", master.getStr().c_str());
 
   for (int sendRetries = m_failedSendRetries + 1; sendRetries >= 0; sendRetries--) {
@@ -342,6 +694,17 @@ result_t BusHandler::sendAndWait(const MasterSymbolString& master, SlaveSymbolSt
     logError(lf_bus, "send to %2.2x: %s%s", master[1], getResultCode(result), sendRetries > 0 ? ", retry" : "");
     request.m_busLostRetries = 0;
   }
+  if (coalesce) {
+    m_pendingReadsMutex.lock();
+    m_pendingReads.erase(key);
+    m_pendingReadsMutex.unlock();
+    for (auto attached : request.m_attached) {
+      attached->m_result = result;
+      *attached->m_slave = *slave;
+      m_finishedRequests.push(attached);
+    }
+  }
+  addElapsedMicros(startTime, &m_sendAndWaitHist);
   return result;
 }
 
@@ -349,6 +712,7 @@ result_t BusHandler::readFromBus(Message* message, const string& inputStr, symbo
     symbol_t srcAddress) {
   symbol_t masterAddress = srcAddress == SYN ? m_ownMasterAddress : srcAddress;
   result_t ret = RESULT_EMPTY;
+  m_busReads.add();
   MasterSymbolString master;
   SlaveSymbolString slave;
   for (size_t index = 0; index < message->getCount(); index++) {
@@ -359,7 +723,7 @@ result_t BusHandler::readFromBus(Message* message, const string& inputStr, symbo
       break;
     }
     // send message
-    ret = sendAndWait(master, &slave);
+    ret = sendAndWait(master, &slave, !message->isWrite());
     if (ret != RESULT_OK) {
       logError(lf_bus, "send message part %d: %s", index, getResultCode(ret));
       break;
@@ -373,15 +737,118 @@ result_t BusHandler::readFromBus(Message* message, const string& inputStr, symbo
   return ret;
 }
 
+void BusHandler::writeBatch(const string& levels, symbol_t srcAddress, vector<BatchWrite>* writes) {
+  symbol_t masterAddress = srcAddress == SYN ? m_ownMasterAddress : srcAddress;
+  deque<MasterSymbolString> masters;
+  vector<size_t> owners, parts;
+  for (size_t pos = 0; pos < writes->size(); pos++) {
+    BatchWrite& write = (*writes)[pos];
+    write.message = m_messages->find(write.circuit, write.name, levels, true);
+    if (write.message == nullptr) {
+      write.result = RESULT_ERR_NOTFOUND;
+      continue;
+    }
+    if (write.message->getDstAddress() == SYN) {
+      write.result = RESULT_ERR_INVALID_ADDR;
+      continue;
+    }
+    write.result = RESULT_OK;
+    size_t first = masters.size();
+    for (size_t index = 0; index < write.message->getCount(); index++) {
+      istringstream input(write.input);
+      masters.emplace_back();
+      write.result = write.message->prepareMaster(index, masterAddress, SYN, UI_FIELD_SEPARATOR, &input,
+          &masters.back());
+      if (write.result != RESULT_OK) {
+        logError(lf_bus, "prepare %s %s part %d: %s", write.circuit.c_str(), write.name.c_str(), index,
+            getResultCode(write.result));
+        break;
+      }
+      owners.push_back(pos);
+      parts.push_back(index);
+    }
+    if (write.result != RESULT_OK) {
+      masters.resize(first);
+      owners.resize(first);
+      parts.resize(first);
+    }
+  }
+  if (masters.empty()) {
+    return;
+  }
+  logInfo(lf_bus, "send batch of %d messages", masters.size());
+  deque<SlaveSymbolString> slaves(masters.size());
+  deque<ActiveBusRequest> requests;
+  for (size_t pos = 0; pos < masters.size(); pos++) {
+    requests.emplace_back(masters[pos], &slaves[pos]);
+  }
+  // queue the first one of each message at once so that each one is started right after the SYN of the previous
+  // one, while a further one for the same message is queued only after the previous one (including retries) is
+  // done in order to keep the order per message
+  vector<size_t> nextOfMessage(requests.size(), requests.size());
+  map<const Message*, size_t> lastOfMessage;
+  for (size_t pos = 0; pos < requests.size(); pos++) {
+    const Message* message = (*writes)[owners[pos]].message;
+    const auto it = lastOfMessage.find(message);
+    if (it == lastOfMessage.end()) {
+      m_nextRequests.push(&requests[pos]);
+    } else {
+      nextOfMessage[it->second] = pos;
+    }
+    lastOfMessage[message] = pos;
+  }
+  m_busReads.add(requests.size());
+  for (size_t pos = 0; pos < requests.size(); pos++) {
+    ActiveBusRequest& request = requests[pos];
+    BatchWrite& write = (*writes)[owners[pos]];
+    result_t result;
+    for (int sendRetries = m_failedSendRetries + 1; true; sendRetries--) {
+      bool success = m_finishedRequests.remove(&request, true);
+      result = success ? request.m_result : RESULT_ERR_TIMEOUT;
+      if (result == RESULT_OK || !success || result == RESULT_ERR_NO_SIGNAL || result == RESULT_ERR_SEND
+          || result == RESULT_ERR_DEVICE || sendRetries <= 0) {
+        break;
+      }
+      logError(lf_bus, "send to %2.2x: %s, retry", masters[pos][1], getResultCode(result));
+      request.m_busLostRetries = 0;
+      m_nextRequests.push(&request);
+    }
+    if (nextOfMessage[pos] < requests.size()) {
+      m_nextRequests.push(&requests[nextOfMessage[pos]]);
+    }
+    if (result == RESULT_OK) {
+      result = write.message->storeLastData(parts[pos], slaves[pos]);
+    }
+    if (result < RESULT_OK) {
+      logError(lf_bus, "write %s %s part %d: %s", write.circuit.c_str(), write.name.c_str(), parts[pos],
+          getResultCode(result));
+      if (write.result == RESULT_OK) {
+        write.result = result;
+      }
+    }
+  }
+  for (const auto& write : *writes) {
+    if (write.result == RESULT_OK) {
+      logNotice(lf_bus, "write %s %s: done", write.circuit.c_str(), write.name.c_str());
+    }
+  }
+}
+
 void BusHandler::run() {
   unsigned int symCount = 0;
   time_t now, lastTime;
   time(&lastTime);
   lastTime += 2;
-  logNotice(lf_bus, "bus started with own address %2.2x/%2.2x%s", m_ownMasterAddress, m_ownSlaveAddress,
-      m_answer?" in answer mode":"");
-
+  logNotice(lf_bus, "bus started on %s with own address %2.2x/%2.2x%s", m_device->getName(), m_ownMasterAddress,
+      m_ownSlaveAddress, m_answer?" in answer mode":"");
+  size_t readerSlot = m_messages->registerReader();
   do {
+    if (m_currentRequest == nullptr && m_nextRequests.peek() == nullptr) {
+      m_messages->passQuiescentState(readerSlot);  // no longer referencing any retired message
+    }
+    if (m_answer && (m_state == bs_skip || m_state == bs_ready || m_state == bs_noSignal)) {
+      refreshAnswers();  // before a retired message could be referenced by a prepared answer
+    }
     if (m_device->isValid() && !m_reconnect) {
       result_t result = handleSymbol();
       time(&now);
@@ -390,6 +857,10 @@ void BusHandler::run() {
       }
       if (now > lastTime) {
         m_symPerSec = symCount / (unsigned int)(now-lastTime);
+        m_savedReadsPerSec = m_device->takeSavedReads() / (unsigned int)(now-lastTime);
+        unsigned int utilization = m_dataSymbols*100 / (BUS_SYMBOL_CAPACITY*(unsigned int)(now-lastTime));
+        m_utilization = (m_utilization*3 + (utilization > 100 ? 100 : utilization)) / 4;  // smooth over seconds
+        m_dataSymbols = 0;
         if (m_symPerSec > m_maxSymPerSec) {
           m_maxSymPerSec = m_symPerSec;
           if (m_maxSymPerSec > 100) {
@@ -415,11 +886,14 @@ void BusHandler::run() {
         setState(bs_noSignal, result);
       }
       symCount = 0;
+      m_dataSymbols = 0;
+      m_utilization = 0;
       m_symbolLatencyMin = m_symbolLatencyMax = m_arbitrationDelayMin = m_arbitrationDelayMax = -1;
       time(&lastTime);
       lastTime += 2;
     }
   } while (isRunning());
+  m_messages->unregisterReader(readerSlot);
 }
 
 result_t BusHandler::handleSymbol() {
@@ -443,10 +917,27 @@ result_t BusHandler::handleSymbol() {
       setState(bs_ready, RESULT_ERR_TIMEOUT);  // just to be sure an old BusRequest is cleaned up
     } else if (m_remainLockCount == 0) {
       startRequest = m_nextRequests.peek();
-      if (startRequest == nullptr && m_pollInterval > 0) {  // check for poll/scan
+      // polls and scans stay behind while the bus is busy (for a limited time only), client requests may use the
+      // reserved share and beyond, and a request somebody waits for (i.e. not deleted on finish) is never deferred
+      bool admitBackground = m_utilizationTarget == 0
+        || m_utilization < m_utilizationTarget - m_utilizationReserve;
+      bool deferred = false;
+      if (startRequest != nullptr && startRequest->m_lane != rl_active && startRequest->m_deleteOnFinish
+          && !admitBackground) {
+        struct timespec now;
+        clockGettime(&now);
+        if (getElapsedMicros(startRequest->m_queuedTime, now) < MAX_DEFERRAL*1000000LL) {
+          startRequest = nullptr;  // keep queued until the utilization dropped
+          deferred = true;
+        }
+      }
+      if ((startRequest == nullptr || startRequest->m_lane > rl_poll) && m_pollInterval > 0) {  // check for poll
         time_t now;
         time(&now);
-        if (m_lastPoll == 0 || difftime(now, m_lastPoll) > m_pollInterval) {
+        bool due = m_lastPoll == 0 || difftime(now, m_lastPoll) > m_pollInterval;
+        if (due && !admitBackground && m_lastPoll != 0 && difftime(now, m_lastPoll) < m_pollInterval + MAX_DEFERRAL) {
+          deferred = true;
+        } else if (due) {
           Message* message = m_messages->getNextPoll();
           if (message != nullptr) {
             m_lastPoll = now;
@@ -458,13 +949,19 @@ result_t BusHandler::handleSymbol() {
             } else {
               startRequest = request;
               m_nextRequests.push(request);
+              m_pollsSent.add();
             }
           }
         }
       }
+      if (deferred) {
+        m_deferredRequests.add();
+      }
       if (startRequest != nullptr) {  // initiate arbitration
         sendSymbol = startRequest->m_master[0];
         sending = true;
+      } else if (m_device->isArbitrating()) {
+        m_device->startArbitration(SYN);  // request vanished in the meantime
       }
     }
     break;
@@ -528,7 +1025,7 @@ result_t BusHandler::handleSymbol() {
 
   case bs_sendResCrc:
     if (m_answer) {
-      sendSymbol = m_crc;
+      sendSymbol = m_currentAnswer ? m_currentAnswer->m_crc : m_crc;
       sending = true;
     }
     break;
@@ -542,7 +1039,41 @@ result_t BusHandler::handleSymbol() {
   // send symbol if necessary
   result_t result;
   struct timespec sentTime, recvTime;
-  if (sending) {
+  bool sentAhead = m_sentAhead > 0;
+  bool adapterArbitration = sending && m_state == bs_ready && m_device->isEnhancedProto();
+  if (adapterArbitration) {
+    result = m_device->startArbitration(sendSymbol);  // done by the adapter on the next SYN
+    clockGettime(&sentTime);
+    if (result == RESULT_OK) {
+      timeout = SYN_TIMEOUT;
+    } else {
+      sending = false;
+      timeout = SYN_TIMEOUT;
+      if (startRequest != nullptr && m_nextRequests.remove(startRequest)) {
+        m_currentRequest = startRequest;  // force the failed request to be notified
+      }
+      setState(bs_skip, result);
+    }
+  } else if (sending) {
+    if (m_state == bs_sendCmd && m_sentAhead == 0 && m_escape == 0 && m_device->canSendBatch()) {
+      // send the remaining escaped master part including the CRC at once and check the echo symbol by symbol
+      symbol_t batch[2*(SYMBOL_STRING_MAX_SIZE+1)];
+      size_t count = m_currentRequest->m_master.escapeFrom(m_nextSendPos, batch);
+      symbol_t crc = m_currentRequest->m_master.calcCrc();
+      count += SymbolString::escape(&crc, 1, batch+count);
+      result = m_device->send(batch, count);
+      if (result == RESULT_OK) {
+        m_sentAhead = count;
+      }
+    }
+    if (m_state == bs_sendRes && m_nextSendPos == 0 && m_sentAhead == 0 && m_escape == 0 && m_currentAnswer
+        && m_device->canSendBatch()) {
+      // send the prepared escaped slave part including the CRC at once and check the echo symbol by symbol
+      result = m_device->send(m_currentAnswer->m_escaped, m_currentAnswer->m_escapedLength);
+      if (result == RESULT_OK) {
+        m_sentAhead = m_currentAnswer->m_escapedLength;
+      }
+    }
     if (m_state != bs_sendSyn && (sendSymbol == ESC || sendSymbol == SYN)) {
       if (m_escape) {
         sendSymbol = sendSymbol == ESC ? 0x00 : 0x01;
@@ -551,8 +1082,19 @@ result_t BusHandler::handleSymbol() {
         sendSymbol = ESC;
       }
     }
-    result = m_device->send(sendSymbol);
+    if (m_sentAhead > 0) {
+      m_sentAhead--;  // already sent with the batch
+      result = RESULT_OK;
+    } else {
+      result = m_device->send(sendSymbol);
+    }
     clockGettime(&sentTime);
+    // only replies to a received symbol have a deadline (ACK, response, and symbols sent after their echo)
+    bool isReply = m_state != bs_ready && m_state != bs_sendSyn;
+    if (isReply && !sentAhead && result == RESULT_OK && m_lastSymbolReceiveTime.tv_sec != 0
+        && getElapsedMicros(m_lastSymbolReceiveTime, sentTime) > SEND_DEADLINE) {
+      m_missedDeadlines++;  // e.g. delayed by other activity on the host
+    }
     if (result == RESULT_OK) {
       if (m_state == bs_ready) {
         timeout = m_transferLatency+m_busAcquireTimeout;
@@ -571,11 +1113,25 @@ result_t BusHandler::handleSymbol() {
 
   // receive next symbol (optionally check reception of sent symbol)
   symbol_t recvSymbol;
+  ArbitrationState arbitrationState = as_none;
   bool isAutoSyn = !sending && m_generateSynInterval == SYN_TIMEOUT && (m_state == bs_noSignal || m_state == bs_skip);
-  result = m_device->recv(timeout+(isAutoSyn ? 0 : m_transferLatency), &recvSymbol);
+  result = m_device->recv(timeout+(isAutoSyn ? 0 : m_transferLatency), &recvSymbol, &arbitrationState);
   if (sending) {
     clockGettime(&recvTime);
   }
+  if (arbitrationState == as_won || arbitrationState == as_lost) {
+    if (!adapterArbitration || !sending) {
+      if (arbitrationState == as_won) {
+        return setState(bs_skip, RESULT_ERR_INVALID_ARG);  // no request to continue with
+      }
+      sending = false;  // just the start of another telegram
+    }
+  } else if (adapterArbitration) {
+    if (result != RESULT_OK) {
+      m_device->startArbitration(SYN);  // cancel for starting again later
+    }
+    sending = false;  // still waiting for the arbitration: plain symbol received in the meantime
+  }
   if (!sending && result == RESULT_ERR_TIMEOUT && m_generateSynInterval > 0
   && timeout >= m_generateSynInterval && (m_state == bs_noSignal || m_state == bs_skip)) {
     // check if acting as AUTO-SYN generator is required
@@ -621,7 +1177,19 @@ result_t BusHandler::handleSymbol() {
   }
 
   m_lastReceive = now;
+  m_receivedSymbols++;
+  if (recvSymbol != SYN) {
+    m_dataSymbols++;
+  }
+  if (sending) {
+    m_lastSymbolReceiveTime = recvTime;
+  } else {
+    clockGettime(&m_lastSymbolReceiveTime);
+  }
   if ((recvSymbol == SYN) && (m_state != bs_sendSyn)) {
+    if (m_state != bs_ready && m_state != bs_skip && m_state != bs_noSignal) {
+      m_interruptedTelegrams++;
+    }
     if (!sending && m_remainLockCount > 0 && m_command.size() != 1) {
       m_remainLockCount--;
     } else if (!sending && m_remainLockCount == 0 && m_command.size() == 1) {
@@ -635,15 +1203,15 @@ result_t BusHandler::handleSymbol() {
     if (recvSymbol != sendSymbol) {
       return setState(bs_skip, RESULT_ERR_SYMBOL);
     }
-    measureLatency(&sentTime, &recvTime);
+    if (!sentAhead) {
+      measureLatency(&sentTime, &recvTime);
+    }
   }
 
   switch (m_state) {
   case bs_ready:
   case bs_recvCmd:
   case bs_recvRes:
-  case bs_sendCmd:
-  case bs_sendRes:
     SymbolString::updateCrc(recvSymbol, &m_crc);
     break;
   default:
@@ -685,11 +1253,12 @@ result_t BusHandler::handleSymbol() {
       m_currentRequest = startRequest;
       // check arbitration
       if (recvSymbol == sendSymbol) {  // arbitration successful
-        // measure arbitration delay
-        long long latencyLong = (sentTime.tv_sec*1000000000 + sentTime.tv_nsec
-        - m_lastSynReceiveTime.tv_sec*1000000000 - m_lastSynReceiveTime.tv_nsec)/1000;
+        addElapsedMicros(startRequest->m_queuedTime, &m_queueWaitHist);
+        // measure arbitration delay (unless done by the adapter)
+        long long latencyLong = adapterArbitration ? -1 : getElapsedMicros(m_lastSynReceiveTime, sentTime);
         if (latencyLong >= 0 && latencyLong <= 10000) {  // skip clock skew or out of reasonable range
           int latency = static_cast<int>(latencyLong);
+          m_arbitrationDelayHist.add(latency);
           logDebug(lf_bus, "arbitration delay %d micros", latency);
           if (m_arbitrationDelayMin < 0 || (latency < m_arbitrationDelayMin || latency > m_arbitrationDelayMax)) {
             if (m_arbitrationDelayMin == -1 || latency < m_arbitrationDelayMin) {
@@ -726,6 +1295,9 @@ result_t BusHandler::handleSymbol() {
 
   case bs_recvCmdCrc:
     m_crcValid = recvSymbol == m_crc;
+    if (!m_crcValid) {
+      m_crcErrors.add();
+    }
     if (m_command[1] == BROADCAST) {
       if (m_crcValid) {
         addSeenAddress(m_command[0]);
@@ -773,6 +1345,7 @@ result_t BusHandler::handleSymbol() {
       return setState(bs_recvRes, RESULT_OK);
     }
     if (recvSymbol == NAK) {
+      m_nakReceived.add();
       if (!m_repeat) {
         m_repeat = true;
         m_crc = 0;
@@ -788,6 +1361,9 @@ result_t BusHandler::handleSymbol() {
     return setState(bs_skip, RESULT_ERR_ACK);
 
   case bs_recvRes:
+    if (m_response.size() == 0) {
+      addElapsedMicros(m_responseStartTime, &m_slaveResponseHist);
+    }
     m_response.push_back(recvSymbol);
     if (m_response.isComplete()) {  // all data received
       return setState(bs_recvResCrc, RESULT_OK);
@@ -796,6 +1372,9 @@ result_t BusHandler::handleSymbol() {
 
   case bs_recvResCrc:
     m_crcValid = recvSymbol == m_crc;
+    if (!m_crcValid) {
+      m_crcErrors.add();
+    }
     if (m_crcValid) {
       if (m_currentRequest != nullptr) {
         return setState(bs_sendResAck, RESULT_OK);
@@ -822,6 +1401,7 @@ result_t BusHandler::handleSymbol() {
       return setState(bs_skip, RESULT_OK);
     }
     if (recvSymbol == NAK) {
+      m_nakReceived.add();
       if (!m_repeat) {
         m_repeat = true;
         if (m_currentAnswering) {
@@ -841,6 +1421,7 @@ result_t BusHandler::handleSymbol() {
     }
     m_nextSendPos++;
     if (m_nextSendPos >= m_currentRequest->m_master.size()) {
+      m_crc = m_currentRequest->m_master.calcCrc();  // calculated over the whole frame at once
       return setState(bs_sendCmdCrc, RESULT_OK);
     }
     return RESULT_OK;
@@ -901,16 +1482,13 @@ result_t BusHandler::handleSymbol() {
         // don't know this request or definition has wrong direction, deny
         return setState(bs_skip, RESULT_ERR_INVALID_ARG);
       }
-      istringstream input;  // TODO create input from database of internal variables
-      if (message == m_messages->getScanMessage() || message == m_messages->getScanMessage(m_ownSlaveAddress)) {
-        input.str(SCAN_ANSWER);
-      }
-      // build response and store in m_response for sending back to requesting master
-      m_response.clear();
-      result = message->prepareSlave(&input, &m_response);
-      if (result != RESULT_OK) {
-        return setState(bs_skip, result);
+      // take the prepared response for sending back to requesting master
+      const PreparedAnswer* answer = getAnswer(message);
+      if (answer->m_result != RESULT_OK) {
+        return setState(bs_skip, answer->m_result);
       }
+      m_response = answer->m_response;
+      m_currentAnswer = answer;
     }
     return setState(bs_sendRes, RESULT_OK);
 
@@ -921,6 +1499,7 @@ result_t BusHandler::handleSymbol() {
     m_nextSendPos++;
     if (m_nextSendPos >= m_response.size()) {
       // slave data completely sent
+      m_crc = m_currentAnswer ? m_currentAnswer->m_crc : m_response.calcCrc();
       return setState(bs_sendResCrc, RESULT_OK);
     }
     return RESULT_OK;
@@ -980,6 +1559,9 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
   }
 
   m_escape = 0;
+  if (state != bs_sendCmd && state != bs_sendCmdCrc && state != bs_sendRes && state != bs_sendResCrc) {
+    m_sentAhead = 0;  // drop the remainder of a batch after an error
+  }
   if (state == m_state) {
     return result;
   }
@@ -992,6 +1574,7 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
     logDebug(lf_bus, "switching from %s to %s", getStateCode(m_state), getStateCode(state));
   }
   if (state == bs_noSignal) {
+    m_signalLosses++;
     logError(lf_bus, "signal lost");
   } else if (m_state == bs_noSignal) {
     logNotice(lf_bus, "signal acquired");
@@ -1005,19 +1588,23 @@ result_t BusHandler::setState(BusState state, result_t result, bool firstRepetit
     m_response.clear();
     m_nextSendPos = 0;
     m_currentAnswering = false;
+    m_currentAnswer = nullptr;
   } else if (state == bs_recvRes || state == bs_sendRes) {
     m_crc = 0;
+    if (state == bs_recvRes) {
+      clockGettime(&m_responseStartTime);
+    }
   }
   return result;
 }
 
 void BusHandler::measureLatency(struct timespec* sentTime, struct timespec* recvTime) {
-  long long latencyLong = (recvTime->tv_sec*1000000000 + recvTime->tv_nsec
-      - sentTime->tv_sec*1000000000 - sentTime->tv_nsec)/1000000;
-  if (latencyLong < 0 || latencyLong > 1000) {
+  long long latencyMicros = getElapsedMicros(*sentTime, *recvTime);
+  if (latencyMicros < 0 || latencyMicros > 1000000) {
     return;  // clock skew or out of reasonable range
   }
-  int latency = static_cast<int>(latencyLong);
+  m_symbolLatencyHist.add(static_cast<unsigned int>(latencyMicros));
+  int latency = static_cast<int>(latencyMicros/1000);
   logDebug(lf_bus, "send/receive symbol latency %d ms", latency);
   if (m_symbolLatencyMin >= 0 && (latency >= m_symbolLatencyMin && latency <= m_symbolLatencyMax)) {
     return;
@@ -1031,6 +1618,107 @@ void BusHandler::measureLatency(struct timespec* sentTime, struct timespec* recv
   logInfo(lf_bus, "send/receive symbol latency %d - %d ms", m_symbolLatencyMin, m_symbolLatencyMax);
 }
 
+void BusHandler::formatTimings(ostringstream* output, bool asJson) const {
+  const char* names[] = {"symbollatency", "arbitrationdelay", "slaveresponse", "queuewait", "sendandwait"};
+  const char* titles[] = {"symbol latency", "arbitration delay", "slave response", "queue wait", "send and wait"};
+  const Histogram* histograms[] = {&m_symbolLatencyHist, &m_arbitrationDelayHist, &m_slaveResponseHist,
+      &m_queueWaitHist, &m_sendAndWaitHist};
+  for (size_t index = 0; index < sizeof(names)/sizeof(names[0]); index++) {
+    const Histogram* histogram = histograms[index];
+    if (asJson) {
+      *output << (index == 0 ? "" : ",") << "\n    \"" << names[index] << "\": {\"count\": " << histogram->getCount()
+              << ", \"p50\": " << histogram->getPercentile(50) << ", \"p90\": " << histogram->getPercentile(90)
+              << ", \"p99\": " << histogram->getPercentile(99) << ", \"max\": " << histogram->getMax() << "}";
+    } else if (histogram->getCount() > 0) {
+      *output << "\n" << titles[index] << ": p50 " << histogram->getPercentile(50)
+              << ", p90 " << histogram->getPercentile(90) << ", p99 " << histogram->getPercentile(99)
+              << ", max " << histogram->getMax() << " micros (" << histogram->getCount() << " samples)";
+    }
+  }
+}
+
+void BusHandler::formatMetrics(MetricsWriter* writer) const {
+  writer->family("ebusd_telegrams_total", true, "telegrams");
+  const char* directions[] = {"received", "sent"};
+  const char* types[] = {"bc", "mm", "ms"};
+  for (size_t direction = 0; direction < 2; direction++) {
+    for (size_t type = 0; type < 3; type++) {
+      writer->sample(m_telegrams[direction][type].get(), "direction", directions[direction], "type", types[type]);
+    }
+  }
+  writer->family("ebusd_crc_errors_total", true, "crc errors");
+  writer->sample(m_crcErrors.get());
+  writer->family("ebusd_nak_received_total", true, "nak received");
+  writer->sample(m_nakReceived.get());
+  writer->family("ebusd_polls_total", true, "poll slots used");
+  writer->sample(m_pollsSent.get());
+  writer->family("ebusd_deferred_requests_total", true, "polls and scans deferred due to bus utilization");
+  writer->sample(m_deferredRequests.get());
+  writer->family("ebusd_bus_reads_total", true, "bus served reads");
+  writer->sample(m_busReads.get());
+  writer->family("ebusd_coalesced_reads_total", true, "coalesced reads");
+  writer->sample(m_coalescedReads.get());
+  if (!writer->isPrometheus()) {
+    return;  // the remainder is part of the "info" output already
+  }
+  writer->family("ebusd_received_symbols_total", true, "received symbols");
+  writer->sample(m_receivedSymbols);
+  writer->family("ebusd_interrupted_telegrams_total", true, "interrupted telegrams");
+  writer->sample(static_cast<uint64_t>(m_interruptedTelegrams));
+  writer->family("ebusd_signal_losses_total", true, "signal losses");
+  writer->sample(static_cast<uint64_t>(m_signalLosses));
+  writer->family("ebusd_missed_deadlines_total", true, "missed deadlines");
+  writer->sample(static_cast<uint64_t>(m_missedDeadlines));
+  writer->family("ebusd_signal", false, "signal acquired");
+  writer->sample(static_cast<uint64_t>(hasSignal() ? 1 : 0));
+  writer->family("ebusd_symbol_rate", false, "symbol rate");
+  writer->sample(static_cast<uint64_t>(m_symPerSec));
+  writer->family("ebusd_bus_utilization_percent", false, "estimated bus utilization");
+  writer->sample(static_cast<uint64_t>(m_utilization));
+  const char* names[] = {"symbollatency", "arbitrationdelay", "slaveresponse", "queuewait", "sendandwait"};
+  const Histogram* histograms[] = {&m_symbolLatencyHist, &m_arbitrationDelayHist, &m_slaveResponseHist,
+      &m_queueWaitHist, &m_sendAndWaitHist};
+  writer->family("ebusd_timing_micros", false, "timing percentiles in microseconds");
+  for (size_t index = 0; index < sizeof(names)/sizeof(names[0]); index++) {
+    const Histogram* histogram = histograms[index];
+    writer->sample(static_cast<uint64_t>(histogram->getPercentile(50)), "timing", names[index], "quantile", "0.5");
+    writer->sample(static_cast<uint64_t>(histogram->getPercentile(90)), "timing", names[index], "quantile", "0.9");
+    writer->sample(static_cast<uint64_t>(histogram->getPercentile(99)), "timing", names[index], "quantile", "0.99");
+  }
+  writer->family("ebusd_timing_samples_total", true, "timing samples");
+  for (size_t index = 0; index < sizeof(names)/sizeof(names[0]); index++) {
+    writer->sample(histograms[index]->getCount(), "timing", names[index]);
+  }
+}
+
+void BusHandler::resetTimings() {
+  m_symbolLatencyHist.reset();
+  m_arbitrationDelayHist.reset();
+  m_slaveResponseHist.reset();
+  m_queueWaitHist.reset();
+  m_sendAndWaitHist.reset();
+  m_nextRequests.resetStats();
+}
+
+void BusHandler::formatLanes(ostringstream* output, bool asJson) {
+  const char* names[] = {"active", "poll", "scan"};
+  RequestLaneStats stats[rl_COUNT];
+  m_nextRequests.getStats(stats);
+  for (size_t lane = 0; lane < rl_COUNT; lane++) {
+    const RequestLaneStats& laneStats = stats[lane];
+    uint64_t avgWait = laneStats.m_count == 0 ? 0 : laneStats.m_waitMicros/laneStats.m_count;
+    if (asJson) {
+      *output << (lane == 0 ? "" : ",") << "\n    \"" << names[lane] << "\": {\"depth\": " << laneStats.m_depth
+              << ", \"maxdepth\": " << laneStats.m_maxDepth << ", \"count\": " << laneStats.m_count
+              << ", \"avgwait\": " << avgWait << ", \"maxwait\": " << laneStats.m_maxWaitMicros << "}";
+    } else {
+      *output << "\n" << names[lane] << " queue: depth " << laneStats.m_depth << ", max depth " << laneStats.m_maxDepth
+              << ", wait avg " << avgWait << ", max " << laneStats.m_maxWaitMicros << " micros ("
+              << laneStats.m_count << " requests)";
+    }
+  }
+}
+
 bool BusHandler::addSeenAddress(symbol_t address) {
   if (!isValidAddress(address, false)) {
     return false;
@@ -1067,6 +1755,53 @@ bool BusHandler::addSeenAddress(symbol_t address) {
   return m_addressConflict && !hadConflict;
 }
 
+void BusHandler::refreshAnswers() {
+  size_t generation = m_messages->getGeneration();
+  if (generation == m_answersGeneration && !m_answers.empty()) {
+    return;
+  }
+  m_answers.clear();
+  m_answersGeneration = generation;
+  // the identification is requested most often, so have it ready before the first request
+  Message* message = m_messages->getScanMessage();
+  if (message) {
+    getAnswer(message);
+  }
+  message = m_messages->getScanMessage(m_ownSlaveAddress);
+  if (message) {
+    getAnswer(message);
+  }
+}
+
+const PreparedAnswer* BusHandler::getAnswer(Message* message) {
+  uint64_t key = message->getKey();
+  auto it = m_answers.find(key);
+  if (it != m_answers.end() && it->second.m_message == message) {
+    m_servedAnswers++;
+    return &it->second;
+  }
+  // not prepared yet (or another message with the same key)
+  PreparedAnswer& answer = m_answers[key];
+  answer.m_message = message;
+  answer.m_response.clear();
+  answer.m_crc = 0;
+  answer.m_escapedLength = 0;
+  // the answered values are constant as long as there is no database of internal variables providing them, so the
+  // prepared answer only needs to be rebuilt with the definitions
+  istringstream input;  // TODO create input from database of internal variables and rebuild on their change
+  if (message == m_messages->getScanMessage() || message == m_messages->getScanMessage(m_ownSlaveAddress)) {
+    input.str(SCAN_ANSWER);
+  }
+  answer.m_result = message->prepareSlave(&input, &answer.m_response);
+  if (answer.m_result == RESULT_OK) {
+    answer.m_crc = answer.m_response.calcCrc();  // calculated over the whole frame at once
+    answer.m_escapedLength = answer.m_response.escapeFrom(0, answer.m_escaped);
+    answer.m_escapedLength += SymbolString::escape(&answer.m_crc, 1, answer.m_escaped + answer.m_escapedLength);
+  }
+  m_preparedAnswers++;
+  return &answer;
+}
+
 void BusHandler::messageCompleted() {
   const char* prefix = m_currentRequest ? "sent" : "received";
   if (m_currentRequest) {
@@ -1082,6 +1817,7 @@ void BusHandler::messageCompleted() {
   }
 
   bool master = isMaster(dstAddress);
+  m_telegrams[m_currentRequest ? 1 : 0][dstAddress == BROADCAST ? 0 : master ? 1 : 2].add();
   if (dstAddress == BROADCAST) {
     logInfo(lf_update, "%s BC cmd: %s", prefix, m_command.getStr().c_str());
     if (m_command.getDataSize() >= 10 && m_command[2] == 0x07 && m_command[3] == 0x04) {
@@ -1141,7 +1877,9 @@ void BusHandler::messageCompleted() {
     } else {
       key = Message::createKey(m_command, m_command[1] == BROADCAST ? 1 : 4);  // up to 4 DD bytes (1 for broadcast)
     }
-    m_grabbedMessages[key].setLastData(m_command, m_response);
+    m_grabMutex.lock();
+    m_grabbedMessages.add(key, m_command, m_response, time(nullptr));
+    m_grabMutex.unlock();
   }
   if (message == nullptr) {
     if (dstAddress == BROADCAST) {
@@ -1212,7 +1950,8 @@ result_t BusHandler::prepareScan(symbol_t slave, bool full, const string& levels
     }
   }
 
-  deque<symbol_t> slaves;
+  deque<symbol_t> slaves, unseen, identified;
+  bool multiple = slave == SYN, pipelined = multiple && m_pipelinedScan;
   if (slave != SYN) {
     slaves.push_back(slave);
     if (!*reload) {
@@ -1233,16 +1972,38 @@ result_t BusHandler::prepareScan(symbol_t slave, bool full, const string& levels
           continue;
         }
       }
-      slaves.push_back(slave);
+      if (pipelined && isScanIdentified(slave)) {
+        Message* message = m_messages->getScanMessage(slave);
+        if (message && message->getLastSlaveData().getDataSize() >= 10) {
+          identified.push_back(slave);  // e.g. from broadcast ident, so only the secondary messages are needed
+          continue;
+        }
+      }
+      if (pipelined && (m_seenAddresses[slave]&SEEN) == 0) {
+        unseen.push_back(slave);  // identify the seen ones first as these are most likely to answer
+      } else {
+        slaves.push_back(slave);
+      }
     }
+    slaves.insert(slaves.end(), unseen.begin(), unseen.end());
   }
-  if (*reload) {
-    messages.push_front(scanMessage);
-  }
-  if (messages.empty()) {
-    return RESULT_OK;
+  if (pipelined) {
+    if (slaves.empty() && (identified.empty() || messages.empty())) {
+      return RESULT_OK;
+    }
+    *request = new ScanRequest(true, m_messages, messages, slaves, this, 0, true);
+    for (const auto address : identified) {
+      (*request)->addIdentified(address);
+    }
+  } else {
+    if (*reload) {
+      messages.push_front(scanMessage);
+    }
+    if (messages.empty()) {
+      return RESULT_OK;
+    }
+    *request = new ScanRequest(multiple, m_messages, messages, slaves, this, *reload ? 0 : 1);
   }
-  *request = new ScanRequest(slave == SYN, m_messages, messages, slaves, this, *reload ? 0 : 1);
   result_t result = (*request)->prepare(m_ownMasterAddress);
   if (result < RESULT_OK) {
     delete *request;
@@ -1263,9 +2024,19 @@ result_t BusHandler::startScan(bool full, const string& levels) {
     return result;
   }
   if (!request) {
-    return RESULT_ERR_NOTFOUND;
+    return m_pipelinedScan ? RESULT_OK : RESULT_ERR_NOTFOUND;  // all participants identified already
+  }
+  if (m_pipelinedScan) {
+    for (auto it = m_scanResults.begin(); it != m_scanResults.end(); ) {
+      if (isScanIdentified(it->first)) {
+        it++;  // kept for the follow-up messages
+      } else {
+        it = m_scanResults.erase(it);
+      }
+    }
+  } else {
+    m_scanResults.clear();
   }
-  m_scanResults.clear();
   m_runningScans++;
   m_nextRequests.push(request);
   return RESULT_OK;
@@ -1280,6 +2051,23 @@ void BusHandler::setScanResult(symbol_t dstAddress, size_t index, const string&
       result.resize(index+1);
     }
     result[index] = str;
+    const auto restored = index == 0 ? m_restoredScanResults.find(dstAddress) : m_restoredScanResults.end();
+    if (restored != m_restoredScanResults.end()) {
+      if (!restored->second.empty() && restored->second[0] == str) {
+        // same identification as before the restart: take over the secondary results not scanned yet
+        if (restored->second.size() > result.size()) {
+          result.resize(restored->second.size());
+        }
+        for (size_t pos = 1; pos < restored->second.size(); pos++) {
+          if (result[pos].empty()) {
+            result[pos] = restored->second[pos];
+          }
+        }
+      } else {
+        logNotice(lf_bus, "scan %2.2x: identification changed, discarding restored results", dstAddress);
+      }
+      m_restoredScanResults.erase(restored);
+    }
     logNotice(lf_bus, "scan %2.2x: %s", dstAddress, str.c_str());
   }
 }
@@ -1409,12 +2197,13 @@ void BusHandler::formatUpdateInfo(ostringstream* output) const {
           << ",\"co\":" << (m_addressConflict ? 1 : 0);
   if (m_grabMessages) {
     size_t unknownCnt = 0;
-    for (auto it : m_grabbedMessages) {
-      Message* message = m_messages->find(it.second.getLastMasterData());
-      if (!message) {
+    m_grabMutex.lock();
+    for (size_t pos = m_grabbedMessages.getFirst(); pos != GRAB_END; pos = m_grabbedMessages.getNext(pos)) {
+      if (!m_messages->find(m_grabbedMessages.get(pos).getLastMasterData())) {
         unknownCnt++;
       }
     }
+    m_grabMutex.unlock();
     *output << ",\"gu\":" << unknownCnt;
   }
   unsigned char address = 0;
@@ -1517,6 +2306,7 @@ result_t BusHandler::scanAndWait(symbol_t dstAddress, bool loadScanConfig, bool
     bool timedOut = result == RESULT_ERR_TIMEOUT;
     bool loadFailed = false;
     if (timedOut || result == RESULT_OK) {
+      // locks the messages only for merging the parsed file
       result = loadScanConfigFile(m_messages, dstAddress, false, &file);  // try to load even if one message timed out
       loadFailed = result != RESULT_OK;
       if (timedOut && loadFailed) {
@@ -1524,7 +2314,9 @@ result_t BusHandler::scanAndWait(symbol_t dstAddress, bool loadScanConfig, bool
       }
     }
     if (result == RESULT_OK) {
-      executeInstructions(m_messages);
+      m_messages->lock();
+      executeInstructions(m_messages, this);
+      m_messages->unlock();
       setScanConfigLoaded(dstAddress, file);
       if (!hasAdditionalScanMessages && m_messages->hasAdditionalScanMessages()) {
         // additional scan messages now available
@@ -1537,12 +2329,37 @@ result_t BusHandler::scanAndWait(symbol_t dstAddress, bool loadScanConfig, bool
   return result;
 }
 
+result_t BusHandler::loadScanConfig(symbol_t dstAddress) {
+  if (!isValidAddress(dstAddress, false) || isMaster(dstAddress)) {
+    return RESULT_ERR_INVALID_ADDR;
+  }
+  bool hasAdditionalScanMessages = m_messages->hasAdditionalScanMessages();
+  string file;
+  // locks the messages only for merging the parsed file
+  result_t result = loadScanConfigFile(m_messages, dstAddress, false, &file);
+  if (result != RESULT_OK) {
+    setScanConfigLoaded(dstAddress, "");
+    return result;
+  }
+  m_messages->lock();
+  executeInstructions(m_messages, this);
+  m_messages->unlock();
+  setScanConfigLoaded(dstAddress, file);
+  if (!hasAdditionalScanMessages && m_messages->hasAdditionalScanMessages()) {
+    // additional scan messages now available
+    scanAndWait(dstAddress, false, false);
+  }
+  return result;
+}
+
 bool BusHandler::enableGrab(bool enable) {
   if (enable == m_grabMessages) {
     return false;
   }
   if (!enable) {
+    m_grabMutex.lock();
     m_grabbedMessages.clear();
+    m_grabMutex.unlock();
   }
   m_grabMessages = enable;
   return true;
@@ -1556,21 +2373,138 @@ void BusHandler::formatGrabResult(bool unknown, bool decode, ostringstream* outp
     }
     return;
   }
-  bool first = true;
-  for (const auto& it : m_grabbedMessages) {
-    if (since > 0 && it.second.getLastTime() < since
-    ||  until > 0 && it.second.getLastTime() >= until) {
-      continue;
+  // copy the selected entries so that the bus is not blocked by formatting and decoding
+  vector<GrabbedMessage> selected;
+  m_grabMutex.lock();
+  if (isDirectMode) {
+    // most recently received first, so that only the messages within the time range are visited
+    for (size_t pos = m_grabbedMessages.getFirst(); pos != GRAB_END; pos = m_grabbedMessages.getNext(pos)) {
+      const GrabbedMessage& grabbed = m_grabbedMessages.get(pos);
+      if (since > 0 && grabbed.getLastTime() < since) {
+        break;
+      }
+      if (until > 0 && grabbed.getLastTime() >= until) {
+        continue;
+      }
+      selected.push_back(grabbed);
+    }
+  } else {
+    map<uint64_t, size_t> byKey;
+    for (size_t pos = m_grabbedMessages.getFirst(); pos != GRAB_END; pos = m_grabbedMessages.getNext(pos)) {
+      const GrabbedMessage& grabbed = m_grabbedMessages.get(pos);
+      if ((since == 0 || grabbed.getLastTime() >= since) && (until == 0 || grabbed.getLastTime() < until)) {
+        byKey[m_grabbedMessages.getKey(pos)] = pos;
+      }
+    }
+    selected.reserve(byKey.size());
+    for (const auto& it : byKey) {
+      selected.push_back(m_grabbedMessages.get(it.second));
     }
-    if (it.second.dump(unknown, m_messages, first, decode, output, isDirectMode)) {
+  }
+  m_grabMutex.unlock();
+  bool first = true;
+  for (const auto& grabbed : selected) {
+    if (grabbed.dump(unknown, m_messages, first, decode, output, isDirectMode)) {
       first = false;
     }
   }
+  if (decode && !selected.empty()) {
+    m_grabMutex.lock();
+    for (const auto& grabbed : selected) {
+      m_grabbedMessages.keepDecodeHints(grabbed);
+    }
+    m_grabMutex.unlock();
+  }
   if (isDirectMode && !first) {
     *output << endl;
   }
 }
 
+size_t BusHandler::getGrabbedCount(size_t* evicted) const {
+  m_grabMutex.lock();
+  size_t count = m_grabbedMessages.size();
+  *evicted = m_grabbedMessages.getEvicted();
+  m_grabMutex.unlock();
+  return count;
+}
+
+void BusHandler::addMemoryUsage(MemoryUsage* usage) {
+  m_grabMutex.lock();
+  m_grabbedMessages.addMemoryUsage(usage);
+  m_grabMutex.unlock();
+  size_t bytes = 0, count = 0;
+  for (const auto& it : m_scanResults) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + it.second.capacity()*sizeof(string);
+    for (const auto& result : it.second) {
+      bytes += MemoryUsage::getHeapSize(result);
+    }
+    count += it.second.size();
+  }
+  usage->add(mk_scanResults, bytes, count);
+  RequestLaneStats stats[rl_COUNT];
+  m_nextRequests.getStats(stats);
+  count = m_finishedRequests.size();
+  for (const auto& lane : stats) {
+    count += lane.m_depth;
+  }
+  usage->add(mk_queues, count*(MEMORY_NODE_OVERHEAD + sizeof(ActiveBusRequest)), count);
+}
+
+void BusHandler::storeState(StateFile* stateFile) const {
+  vector<string> seen, scan;
+  char str[5];
+  symbol_t address = 0;
+  for (int index = 0; index < 256; index++, address++) {
+    symbol_t state = static_cast<symbol_t>(m_seenAddresses[address]&SEEN);
+    if (state != 0) {
+      snprintf(str, sizeof(str), "%2.2x%2.2x", address, state);
+      seen.push_back(str);
+    }
+  }
+  for (const auto& it : m_scanResults) {
+    snprintf(str, sizeof(str), "%2.2x", it.first);
+    for (const auto& result : it.second) {
+      scan.push_back(str + result);
+    }
+  }
+  stateFile->setValues("seen", seen);
+  stateFile->setValues("scan", scan);
+}
+
+size_t BusHandler::restoreState(StateFile* stateFile) {
+  vector<string> values;
+  size_t count = 0;
+  if (stateFile->getValues("seen", &values)) {
+    for (const auto& value : values) {
+      unsigned int address, state;
+      if (value.length() != 4 || sscanf(value.c_str(), "%2x%2x", &address, &state) != 2) {
+        continue;
+      }
+      symbol_t symbol = static_cast<symbol_t>(address);
+      bool ownAddress = !m_device->isReadOnly() && (symbol == m_ownMasterAddress || symbol == m_ownSlaveAddress);
+      if (ownAddress || !isValidAddress(symbol, false)) {
+        continue;
+      }
+      if ((state&SEEN) != 0 && (m_seenAddresses[symbol]&SEEN) == 0) {
+        addSeenAddress(symbol);
+        count++;
+      }
+    }
+  }
+  if (stateFile->getValues("scan", &values)) {
+    for (const auto& value : values) {
+      unsigned int address;
+      if (value.length() < 2 || sscanf(value.c_str(), "%2x", &address) != 1) {
+        continue;
+      }
+      // only provisional until confirmed by a fresh identification, as the participant might have been replaced
+      m_restoredScanResults[static_cast<symbol_t>(address)].push_back(value.substr(2));
+    }
+    m_scanResults = m_restoredScanResults;
+  }
+  return count;
+}
+
 symbol_t BusHandler::getNextScanAddress(symbol_t lastAddress) const {
   if (lastAddress == SYN) {
     return SYN;
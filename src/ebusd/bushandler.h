@@ -25,13 +25,18 @@
 #include <vector>
 #include <map>
 #include <deque>
+#include <list>
+#include <unordered_map>
 #include "lib/ebus/message.h"
 #include "lib/ebus/data.h"
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/device.h"
+#include "lib/ebus/statefile.h"
 #include "lib/utils/queue.h"
 #include "lib/utils/thread.h"
+#include "lib/utils/histogram.h"
+#include "lib/utils/metrics.h"
 
 namespace ebusd {
 
@@ -44,6 +49,7 @@ namespace ebusd {
  */
 
 using std::string;
+using std::unordered_map;
 
 /** the default time [us] for retrieving a symbol from an addressed slave. */
 #define SLAVE_RECV_TIMEOUT 15000
@@ -60,6 +66,15 @@ using std::string;
 /** the maximum allowed time [us] for retrieving back a sent symbol (2x symbol duration). */
 #define SEND_TIMEOUT (2*SYMBOL_DURATION)
 
+/** the maximum time [us] between receiving a symbol and sending the next one before counting a missed deadline. */
+#define SEND_DEADLINE SYMBOL_DURATION
+
+/** the maximum number of symbols per second the bus is able to transfer (2400 Baud with 10 bits per symbol). */
+#define BUS_SYMBOL_CAPACITY 240
+
+/** the maximum time [s] polling or a queued background request is deferred due to the bus utilization. */
+#define MAX_DEFERRAL 60
+
 /** the possible bus states. */
 enum BusState {
   bs_noSignal,  //!< no signal on the bus
@@ -80,6 +95,14 @@ enum BusState {
   bs_sendSyn,     //!< send SYN for completed transfer [active set+get]
 };
 
+/** the priority lanes of @a BusRequest instances (lower value is preferred). */
+enum RequestLane {
+  rl_active,  //!< interactive requests from clients
+  rl_poll,    //!< background poll requests
+  rl_scan,    //!< scan requests
+  rl_COUNT    //!< number of available lanes
+};
+
 /** bit for the seen state: seen. */
 #define SEEN 0x01
 
@@ -102,16 +125,20 @@ class BusHandler;
  */
 class BusRequest {
   friend class BusHandler;
+  friend class BusRequestQueue;
 
  public:
   /**
    * Constructor.
    * @param master the master data @a MasterSymbolString to send.
    * @param deleteOnFinish whether to automatically delete this @a BusRequest when finished.
+   * @param lane the @a RequestLane for queuing this @a BusRequest.
    */
-  BusRequest(const MasterSymbolString& master, bool deleteOnFinish)
+  BusRequest(const MasterSymbolString& master, bool deleteOnFinish, RequestLane lane)
     : m_master(master), m_busLostRetries(0),
-      m_deleteOnFinish(deleteOnFinish) {}
+      m_deleteOnFinish(deleteOnFinish), m_lane(lane) {
+    clockGettime(&m_queuedTime);
+  }
 
   /**
    * Destructor.
@@ -136,6 +163,12 @@ class BusRequest {
 
   /** whether to automatically delete this @a BusRequest when finished. */
   const bool m_deleteOnFinish;
+
+  /** the @a RequestLane for queuing this @a BusRequest. */
+  const RequestLane m_lane;
+
+  /** the time when this @a BusRequest was added to the queue. */
+  struct timespec m_queuedTime;
 };
 
 
@@ -151,7 +184,7 @@ class PollRequest : public BusRequest {
    * @param message the associated @a Message.
    */
   explicit PollRequest(Message* message)
-    : BusRequest(m_master, true), m_message(message), m_index(0) {}
+    : BusRequest(m_master, true, rl_poll), m_message(message), m_index(0) {}
 
   /**
    * Destructor.
@@ -165,11 +198,31 @@ class PollRequest : public BusRequest {
    */
   result_t prepare(symbol_t masterAddress);
 
+  /**
+   * Queue the secondary messages for a slave that is already identified (only for pipelined mode).
+   * @param slave the identified slave address.
+   */
+  void addIdentified(symbol_t slave);
+
   // @copydoc
   bool notify(result_t result, const SlaveSymbolString& slave) override;
 
 
  private:
+  /**
+   * Prepare the master data of the current part of @a m_message.
+   * @param masterAddress the master bus address to use.
+   * @param dstAddress the destination slave address.
+   * @return the result code.
+   */
+  result_t prepareMaster(symbol_t masterAddress, symbol_t dstAddress);
+
+  /**
+   * Select the next slave and @a Message to query in pipelined mode.
+   * @return true when selected, false when nothing is left.
+   */
+  bool selectNext();
+
   /** the master data @a MasterSymbolString. */
   MasterSymbolString m_master;
 
@@ -196,14 +249,21 @@ class ScanRequest : public BusRequest {
    * @param slaves the slave addresses to scan.
    * @param busHandler the @a BusHandler instance to notify of final scan result.
    * @param notifyIndex the offset to the index for notifying the scan result.
+   * @param pipelined true to first identify all slaves and to interleave the secondary messages (not containing
+   * the primary one in this case) of the identified slaves with the identification of the remaining ones.
    */
   ScanRequest(bool deleteOnFinish, MessageMap* messageMap, const deque<Message*>& messages,
-      const deque<symbol_t>& slaves, BusHandler* busHandler, size_t notifyIndex = 0)
-    : BusRequest(m_master, deleteOnFinish), m_messageMap(messageMap), m_index(0), m_allMessages(messages),
-      m_messages(messages), m_slaves(slaves), m_busHandler(busHandler), m_notifyIndex(notifyIndex),
-      m_result(RESULT_ERR_NO_SIGNAL) {
-    m_message = m_messages.front();
-    m_messages.pop_front();
+      const deque<symbol_t>& slaves, BusHandler* busHandler, size_t notifyIndex = 0, bool pipelined = false)
+    : BusRequest(m_master, deleteOnFinish, rl_scan), m_messageMap(messageMap), m_message(nullptr), m_index(0),
+      m_allMessages(messages), m_messages(messages), m_slaves(slaves), m_busHandler(busHandler),
+      m_notifyIndex(notifyIndex), m_result(RESULT_ERR_NO_SIGNAL), m_pipelined(pipelined), m_dstAddress(SYN),
+      m_identifying(false) {
+    if (pipelined) {
+      m_followUps.resize(messages.size());
+    } else {
+      m_message = m_messages.front();
+      m_messages.pop_front();
+    }
   }
 
   /**
@@ -221,8 +281,28 @@ class ScanRequest : public BusRequest {
   // @copydoc
   bool notify(result_t result, const SlaveSymbolString& slave) override;
 
+  /**
+   * Add an identified slave address for querying the secondary messages (only for pipelined mode).
+   * @param slave the identified slave address.
+   */
+  void addIdentified(symbol_t slave);
+
 
  private:
+  /**
+   * Prepare the master data for the current part of @a m_message.
+   * @param ownMasterAddress the master bus address to use.
+   * @param dstAddress the destination slave address.
+   * @return the result code.
+   */
+  result_t prepareMaster(symbol_t ownMasterAddress, symbol_t dstAddress);
+
+  /**
+   * Select the next @a Message and slave address to query (only for pipelined mode).
+   * @return true when selected, false when nothing is left.
+   */
+  bool selectNext();
+
   /** the @a MessageMap instance. */
   MessageMap* m_messageMap;
 
@@ -252,6 +332,18 @@ class ScanRequest : public BusRequest {
 
   /** the overall result of handling the request. */
   result_t m_result;
+
+  /** whether to identify all slaves first and interleave the secondary messages. */
+  const bool m_pipelined;
+
+  /** the currently queried slave address (only for pipelined mode). */
+  symbol_t m_dstAddress;
+
+  /** whether the current query is the identification (only for pipelined mode). */
+  bool m_identifying;
+
+  /** the identified slave addresses still to query by index of the secondary @a Message in @a m_allMessages. */
+  vector<deque<symbol_t>> m_followUps;
 };
 
 
@@ -268,7 +360,7 @@ class ActiveBusRequest : public BusRequest {
    * @param slave reference to @a SlaveSymbolString for filling in the received slave data.
    */
   ActiveBusRequest(const MasterSymbolString& master, SlaveSymbolString* slave)
-    : BusRequest(master, false), m_result(RESULT_ERR_NO_SIGNAL), m_slave(slave) {}
+    : BusRequest(master, false, rl_active), m_result(RESULT_ERR_NO_SIGNAL), m_slave(slave) {}
 
   /**
    * Destructor.
@@ -285,34 +377,181 @@ class ActiveBusRequest : public BusRequest {
 
   /** reference to @a SlaveSymbolString for filling in the received slave data. */
   SlaveSymbolString* m_slave;
+
+  /** the identical @a ActiveBusRequest instances waiting for the result of this one. */
+  vector<ActiveBusRequest*> m_attached;
+};
+
+
+/** A single write of a batch for @a BusHandler::writeBatch(). */
+struct BatchWrite {
+  string circuit;  //!< the circuit name
+  string name;  //!< the message name
+  string input;  //!< the value(s) to write separated by @a UI_FIELD_SEPARATOR
+  Message* message;  //!< the resolved write @a Message, or nullptr if not found
+  result_t result;  //!< the result of the write
+};
+
+
+/**
+ * A response to a request addressed to us prepared ahead of the answer window.
+ */
+struct PreparedAnswer {
+  /** the answered @a Message. */
+  const Message* m_message;
+
+  /** the result of preparing the response (anything other than @a RESULT_OK denies the request). */
+  result_t m_result;
+
+  /** the unescaped slave data. */
+  SlaveSymbolString m_response;
+
+  /** the CRC of the slave data. */
+  symbol_t m_crc;
+
+  /** the number of symbols in @a m_escaped. */
+  size_t m_escapedLength;
+
+  /** the escaped slave data including the CRC. */
+  symbol_t m_escaped[2*(SYMBOL_STRING_MAX_SIZE+1)];
+};
+
+
+/**
+ * Statistics of a single @a RequestLane.
+ */
+struct RequestLaneStats {
+  /** the number of currently queued @a BusRequest instances. */
+  size_t m_depth;
+
+  /** the maximum number of queued @a BusRequest instances. */
+  size_t m_maxDepth;
+
+  /** the number of @a BusRequest instances taken from the lane. */
+  uint64_t m_count;
+
+  /** the total time in microseconds the taken @a BusRequest instances spent in the lane. */
+  uint64_t m_waitMicros;
+
+  /** the maximum time in microseconds a taken @a BusRequest spent in the lane. */
+  uint64_t m_maxWaitMicros;
+};
+
+
+/**
+ * Thread safe queue of @a BusRequest instances with one FIFO per @a RequestLane.
+ * Requests in a lower lane are always taken before those in a higher lane, so that e.g. a running scan (which is
+ * re-queued after each transaction) yields to interactive requests and polls.
+ */
+class BusRequestQueue {
+ public:
+  /**
+   * Constructor.
+   */
+  BusRequestQueue() {
+    memset(m_stats, 0, sizeof(m_stats));
+  }
+
+  /**
+   * Add a @a BusRequest to the end of its lane.
+   * @param request the @a BusRequest to add.
+   */
+  void push(BusRequest* request);
+
+  /**
+   * Remove the first @a BusRequest of the most preferred non-empty lane.
+   * @return the @a BusRequest, or nullptr if all lanes are empty.
+   */
+  BusRequest* pop();
+
+  /**
+   * Return the first @a BusRequest of the most preferred non-empty lane without removing it.
+   * @return the @a BusRequest, or nullptr if all lanes are empty.
+   */
+  BusRequest* peek();
+
+  /**
+   * Remove the specified @a BusRequest.
+   * @param request the @a BusRequest to remove.
+   * @return whether the @a BusRequest was removed.
+   */
+  bool remove(BusRequest* request);
+
+  /**
+   * Get the statistics of all lanes.
+   * @param stats the array in which to store the @a RequestLaneStats for each @a RequestLane.
+   */
+  void getStats(RequestLaneStats* stats);
+
+  /**
+   * Reset the maximum depth and the wait time statistics of all lanes.
+   */
+  void resetStats();
+
+
+ private:
+  /**
+   * Update the statistics for a @a BusRequest taken from its lane (only to be called while locked).
+   * @param request the taken @a BusRequest.
+   */
+  void taken(const BusRequest* request);
+
+  /** the queued @a BusRequest instances by @a RequestLane. */
+  list<BusRequest*> m_lanes[rl_COUNT];
+
+  /** the @a RequestLaneStats by @a RequestLane. */
+  RequestLaneStats m_stats[rl_COUNT];
+
+  /** the @a Mutex for exclusive access. */
+  Mutex m_mutex;
 };
 
 
+/** the default maximum number of @a GrabbedMessage instances kept in a @a GrabTable. */
+#define GRAB_CAPACITY 1024
+
+/** the position returned by @a GrabTable when there is no (further) @a GrabbedMessage. */
+#define GRAB_END 0xffffffff
+
+class GrabTable;
+
 /**
  * Helper class for keeping track of grabbed messages.
  */
 class GrabbedMessage {
+  friend class GrabTable;
  public:
   /**
    * Construct a new instance.
    */
-  GrabbedMessage() : m_lastTime(0), m_count(0) {}
+  GrabbedMessage() : m_key(0), m_prev(GRAB_END), m_next(GRAB_END), m_firstTime(0), m_lastTime(0), m_count(0),
+    m_interval(0), m_decodeValid(false) {}
 
   /**
-   * Copy constructor.
-   * @param other the @a GrabbedMessage to copy from.
+   * Copy constructor (e.g. for formatting while not holding the lock).
+   * @param src the @a GrabbedMessage to copy from.
    */
-  GrabbedMessage(const GrabbedMessage& other) : m_count(other.m_count) {
-    m_lastMaster = other.m_lastMaster;
-    m_lastSlave = other.m_lastSlave;
+  GrabbedMessage(const GrabbedMessage& src)
+    : m_key(src.m_key), m_prev(src.m_prev), m_next(src.m_next), m_firstTime(src.m_firstTime),
+    m_lastTime(src.m_lastTime), m_count(src.m_count), m_interval(src.m_interval), m_decodeHints(src.m_decodeHints),
+    m_decodeValid(src.m_decodeValid) {
+    m_lastMaster = src.m_lastMaster;
+    m_lastSlave = src.m_lastSlave;
   }
 
   /**
-   * Set the last received data.
+   * Set the last received data and update the statistics.
    * @param master the last @a MasterSymbolString.
    * @param slave the last @a SymbolString.
+   * @param now the current system time.
+   */
+  void setLastData(const MasterSymbolString& master, const SlaveSymbolString& slave, time_t now);
+
+  /**
+   * Get the first received time.
+   * @return the first received time.
    */
-  void setLastData(const MasterSymbolString& master, const SlaveSymbolString& slave);
+  time_t getFirstTime() const { return m_firstTime; }
 
   /**
    * Get the last received time.
@@ -320,18 +559,30 @@ class GrabbedMessage {
    */
   time_t getLastTime() const { return m_lastTime; }
 
+  /**
+   * Get the number of times this message was seen.
+   * @return the number of times this message was seen.
+   */
+  unsigned int getCount() const { return m_count; }
+
+  /**
+   * Get the estimated interval in seconds between two receptions.
+   * @return the estimated interval in seconds, or 0 if not known yet.
+   */
+  unsigned int getInterval() const { return m_interval; }
+
   /**
    * Get the last @a MasterSymbolString.
    * @return the last @a MasterSymbolString.
    */
-  MasterSymbolString& getLastMasterData() { return m_lastMaster; }
+  const MasterSymbolString& getLastMasterData() const { return m_lastMaster; }
 
   /**
    * Dump the last received data and message count to the output.
    * @param unknown whether to dump only if this message is unknown.
    * @param messages the @a MessageMap instance for resolving known @a Message instances.
    * @param first whether this is the first message to be added to the output.
-   * @param decode whether to add decoding hints.
+   * @param decode whether to add decoding hints (kept until the data changes).
    * @param output the @a ostringstream to format the messages to.
    * @param isDirectMode true for direct mode, false for grab command.
    * @return whether the message was added to the output.
@@ -341,6 +592,29 @@ class GrabbedMessage {
 
 
  private:
+  /**
+   * Clear the data and statistics while keeping the allocated storage.
+   */
+  void reset();
+
+  /**
+   * Format the decoding hints for the last received data.
+   * @param output the @a ostringstream to format the hints to.
+   */
+  void formatDecodeHints(ostringstream* output) const;
+
+  /** the key in the @a GrabTable. */
+  uint64_t m_key;
+
+  /** the position of the more recently received message in the @a GrabTable, or @a GRAB_END. */
+  uint32_t m_prev;
+
+  /** the position of the less recently received message in the @a GrabTable, or @a GRAB_END. */
+  uint32_t m_next;
+
+  /** the first received time. */
+  time_t m_firstTime;
+
   /** the last received time. */
   time_t m_lastTime;
 
@@ -352,6 +626,160 @@ class GrabbedMessage {
 
   /** the number of times this message was seen. */
   unsigned int m_count;
+
+  /** the moving average of the interval in seconds between two receptions. */
+  unsigned int m_interval;
+
+  /** the decoding hints formatted for the last received data. */
+  mutable string m_decodeHints;
+
+  /** whether @a m_decodeHints is valid for the last received data. */
+  mutable bool m_decodeValid;
+};
+
+
+/**
+ * A capacity bounded table of @a GrabbedMessage instances by key that evicts the least recently received one.
+ * The instances are kept in a single vector that is indexed by an open addressing hash and linked in the order of
+ * reception, so that a received message neither allocates nor walks the table.
+ */
+class GrabTable {
+ public:
+  /**
+   * Construct a new instance.
+   * @param capacity the maximum number of @a GrabbedMessage instances to keep.
+   */
+  explicit GrabTable(size_t capacity = GRAB_CAPACITY)
+    : m_capacity(capacity), m_head(GRAB_END), m_tail(GRAB_END), m_evicted(0) {}
+
+  /**
+   * Add received data for the key, evicting the least recently received @a GrabbedMessage if necessary.
+   * @param key the key of the message.
+   * @param master the received @a MasterSymbolString.
+   * @param slave the received @a SlaveSymbolString.
+   * @param now the current system time.
+   */
+  void add(uint64_t key, const MasterSymbolString& master, const SlaveSymbolString& slave, time_t now);
+
+  /**
+   * Remove all @a GrabbedMessage instances.
+   */
+  void clear();
+
+  /**
+   * Add the approximate memory used by the kept @a GrabbedMessage instances to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const;
+
+  /**
+   * Get the number of kept @a GrabbedMessage instances.
+   * @return the number of kept @a GrabbedMessage instances.
+   */
+  size_t size() const { return m_entries.size(); }
+
+  /**
+   * Get the maximum number of kept @a GrabbedMessage instances.
+   * @return the maximum number of kept @a GrabbedMessage instances.
+   */
+  size_t getCapacity() const { return m_capacity; }
+
+  /**
+   * Get the number of @a GrabbedMessage instances evicted since the last @a clear().
+   * @return the number of evicted @a GrabbedMessage instances.
+   */
+  size_t getEvicted() const { return m_evicted; }
+
+  /**
+   * Get the position of the most recently received @a GrabbedMessage.
+   * @return the position, or @a GRAB_END if empty.
+   */
+  size_t getFirst() const { return m_head; }
+
+  /**
+   * Get the position of the next less recently received @a GrabbedMessage.
+   * @param pos the current position.
+   * @return the next position, or @a GRAB_END if there is no further one.
+   */
+  size_t getNext(size_t pos) const { return m_entries[pos].m_next; }
+
+  /**
+   * Get the @a GrabbedMessage at the position.
+   * @param pos the position.
+   * @return the @a GrabbedMessage.
+   */
+  const GrabbedMessage& get(size_t pos) const { return m_entries[pos]; }
+
+  /**
+   * Get the key of the @a GrabbedMessage at the position.
+   * @param pos the position.
+   * @return the key.
+   */
+  uint64_t getKey(size_t pos) const { return m_entries[pos].m_key; }
+
+  /**
+   * Keep the decoding hints of a copy formatted while not holding the lock in the @a GrabbedMessage it was copied
+   * from, if that one still has the same data.
+   * @param formatted the formatted copy of a @a GrabbedMessage.
+   */
+  void keepDecodeHints(const GrabbedMessage& formatted) const;
+
+
+ private:
+  /**
+   * Calculate the hash of the key.
+   * @param key the key.
+   * @return the hash to use as start slot.
+   */
+  static size_t hash(uint64_t key) {
+    key ^= key >> 31;
+    key *= 0x7fb5d329728ea185ULL;
+    key ^= key >> 27;
+    return static_cast<size_t>(key);
+  }
+
+  /**
+   * Find the slot of the key in @a m_slots.
+   * @param key the key.
+   * @return the slot of the key, or the empty slot where to insert it.
+   */
+  size_t findSlot(uint64_t key) const;
+
+  /**
+   * Empty the slot in @a m_slots and move up the following colliding entries.
+   * @param slot the slot to empty.
+   */
+  void eraseSlot(size_t slot);
+
+  /**
+   * Unlink the entry from the reception order.
+   * @param pos the position of the entry.
+   */
+  void unlink(uint32_t pos);
+
+  /**
+   * Link the entry as most recently received.
+   * @param pos the position of the entry.
+   */
+  void linkFront(uint32_t pos);
+
+  /** the maximum number of kept @a GrabbedMessage instances. */
+  const size_t m_capacity;
+
+  /** the kept @a GrabbedMessage instances. */
+  vector<GrabbedMessage> m_entries;
+
+  /** the hash slots with the position+1 of the entry in @a m_entries, or 0 for an empty slot. */
+  vector<uint32_t> m_slots;
+
+  /** the position of the most recently received entry, or @a GRAB_END. */
+  uint32_t m_head;
+
+  /** the position of the least recently received entry, or @a GRAB_END. */
+  uint32_t m_tail;
+
+  /** the number of evicted entries. */
+  size_t m_evicted;
 };
 
 
@@ -374,13 +802,16 @@ class BusHandler : public WaitThread {
    * @param lockCount the number of AUTO-SYN symbols before sending is allowed after lost arbitration, or 0 for auto detection.
    * @param generateSyn whether to enable AUTO-SYN symbol generation.
    * @param pollInterval the interval in seconds in which poll messages are cycled, or 0 if disabled.
+   * @param utilizationTarget the bus utilization target in percent (polling and scanning nobody waits for is deferred
+   * for up to @a MAX_DEFERRAL seconds above the target less @p utilizationReserve), or 0 if disabled.
+   * @param utilizationReserve the share of @p utilizationTarget in percent reserved for client requests.
    */
   BusHandler(Device* device, MessageMap* messages,
       symbol_t ownAddress, bool answer,
       unsigned int busLostRetries, unsigned int failedSendRetries,
       unsigned int transferLatency, unsigned int busAcquireTimeout, unsigned int slaveRecvTimeout,
       unsigned int lockCount, bool generateSyn,
-      unsigned int pollInterval)
+      unsigned int pollInterval, unsigned int utilizationTarget, unsigned int utilizationReserve)
     : WaitThread(), m_device(device), m_reconnect(false), m_messages(messages),
       m_ownMasterAddress(ownAddress), m_ownSlaveAddress(getSlaveAddress(ownAddress)),
       m_answer(answer), m_addressConflict(false),
@@ -389,15 +820,27 @@ class BusHandler : public WaitThread {
       m_masterCount(device->isReadOnly()?0:1), m_autoLockCount(lockCount == 0),
       m_lockCount(lockCount <= 3 ? 3 : lockCount), m_remainLockCount(m_autoLockCount ? 1 : 0),
       m_generateSynInterval(generateSyn ? SYN_TIMEOUT*getMasterNumber(ownAddress)+SYMBOL_DURATION : 0),
-      m_pollInterval(pollInterval), m_symbolLatencyMin(-1), m_symbolLatencyMax(-1), m_arbitrationDelayMin(-1),
+      m_pollInterval(pollInterval), m_utilizationTarget(utilizationTarget),
+      m_utilizationReserve(utilizationReserve < utilizationTarget ? utilizationReserve
+        : utilizationTarget > 0 ? utilizationTarget-1 : 0),
+      m_symbolLatencyMin(-1), m_symbolLatencyMax(-1), m_arbitrationDelayMin(-1),
       m_arbitrationDelayMax(-1), m_lastReceive(0), m_lastPoll(0),
       m_currentRequest(nullptr), m_currentAnswering(false), m_runningScans(0), m_nextSendPos(0),
-      m_symPerSec(0), m_maxSymPerSec(0),
-      m_state(bs_noSignal), m_escape(0), m_crc(0), m_crcValid(false), m_repeat(false),
-      m_grabMessages(true) {
+      m_symPerSec(0), m_maxSymPerSec(0), m_dataSymbols(0), m_utilization(0), m_savedReadsPerSec(0),
+      m_receivedSymbols(0), m_interruptedTelegrams(0), m_signalLosses(0), m_missedDeadlines(0),
+      m_state(bs_noSignal), m_escape(0),
+      m_sentAhead(0), m_crc(0), m_answersGeneration(0), m_currentAnswer(nullptr), m_preparedAnswers(0),
+      m_servedAnswers(0),
+      m_crcValid(false), m_repeat(false),
+      m_grabMessages(true), m_pipelinedScan(false) {
     memset(m_seenAddresses, 0, sizeof(m_seenAddresses));
+    if (pollInterval > 0) {
+      messages->setPollInterval(pollInterval);
+    }
     m_lastSynReceiveTime.tv_sec = 0;
     m_lastSynReceiveTime.tv_nsec = 0;
+    m_responseStartTime = m_lastSynReceiveTime;
+    m_lastSymbolReceiveTime = m_lastSynReceiveTime;
   }
 
   /**
@@ -443,9 +886,11 @@ class BusHandler : public WaitThread {
    * Send a message on the bus and wait for the answer.
    * @param master the @a MasterSymbolString with the master data to send.
    * @param slave the @a SlaveSymbolString that will be filled with retrieved slave data.
+   * @param coalesce true to attach to an identical pending request instead of sending the master data again
+   * (only suitable for reading).
    * @return the result code.
    */
-  result_t sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave);
+  result_t sendAndWait(const MasterSymbolString& master, SlaveSymbolString* slave, bool coalesce = false);
 
   /**
    * Prepare the master part for the @a Message, send it to the bus and wait for the answer.
@@ -458,6 +903,16 @@ class BusHandler : public WaitThread {
   result_t readFromBus(Message* message, const string& inputStr, symbol_t dstAddress = SYN,
       symbol_t srcAddress = SYN);
 
+  /**
+   * Prepare the master parts of all writes up front, queue them for sending them back to back without waiting for
+   * each single result in between (except for further parts of the same @a Message being queued only after the
+   * previous one including its retries in order to keep their order), and store the received answers.
+   * @param levels the access levels to match the write @a Message instances.
+   * @param srcAddress the source address to set, or @a SYN for the own master address.
+   * @param writes the @a BatchWrite instances to resolve and send, updated with the @a Message and result.
+   */
+  void writeBatch(const string& levels, symbol_t srcAddress, vector<BatchWrite>* writes);
+
   /**
    * Main thread entry.
    */
@@ -471,6 +926,39 @@ class BusHandler : public WaitThread {
    */
   result_t startScan(bool full, const string& levels);
 
+  /**
+   * Set whether to pipeline the scans started by @a startScan().
+   * @param pipelined true to skip the identification of slaves already identified by broadcast, to interleave the
+   * secondary scan messages and to allow loading the config files of identified slaves while the scan continues.
+   */
+  void setPipelinedScan(bool pipelined) { m_pipelinedScan = pipelined; }
+
+  /**
+   * Return whether the scans started by @a startScan() are pipelined.
+   * @return whether the scans started by @a startScan() are pipelined.
+   */
+  bool isPipelinedScan() const { return m_pipelinedScan; }
+
+  /**
+   * Return whether a scan started by @a startScan() is still running.
+   * @return whether a scan is still running.
+   */
+  bool isScanRunning() const { return m_runningScans > 0; }
+
+  /**
+   * Return whether the slave address was already identified by a scan or broadcast ident message.
+   * @param address the slave address.
+   * @return whether the slave address was already identified.
+   */
+  bool isScanIdentified(symbol_t address) const { return (m_seenAddresses[address]&SCAN_DONE) != 0; }
+
+  /**
+   * Load the message definitions matching the scan result of an already identified slave without scanning again.
+   * @param dstAddress the identified slave address.
+   * @return the result code.
+   */
+  result_t loadScanConfig(symbol_t dstAddress);
+
   /**
    * Set the scan result @a string for a scanned slave address.
    * @param dstAddress the scanned slave address.
@@ -505,6 +993,21 @@ class BusHandler : public WaitThread {
    */
   void formatSeenInfo(ostringstream* output) const;
 
+  /**
+   * Store the seen participants and the scan results in the @a StateFile for the next write.
+   * @param stateFile the @a StateFile to store to.
+   */
+  void storeState(StateFile* stateFile) const;
+
+  /**
+   * Restore the seen participants and the scan results from the @a StateFile (before starting the thread).
+   * The restored scan results are kept only for display until a fresh identification of the same participant
+   * confirms them, so that a restart always scans the participants again.
+   * @param stateFile the @a StateFile to restore from.
+   * @return the number of restored seen participants.
+   */
+  size_t restoreState(StateFile* stateFile);
+
   /**
    * Format information for running the update check to the @a ostringstream.
    * @param output the @a ostringstream to append the info to.
@@ -568,6 +1071,93 @@ class BusHandler : public WaitThread {
    */
   unsigned int getMaxSymbolRate() const { return m_maxSymPerSec; }
 
+  /**
+   * Return the estimated bus utilization.
+   * @return the estimated bus utilization in percent derived from the smoothed rate of received non-SYN symbols.
+   */
+  unsigned int getUtilization() const { return m_utilization; }
+
+  /**
+   * Return the bus utilization above which polling and scanning is deferred.
+   * @return the bus utilization in percent above which polling and scanning is deferred, or 0 if disabled.
+   */
+  unsigned int getUtilizationLimit() const { return m_utilizationTarget - m_utilizationReserve; }
+
+  /**
+   * Return the number of read system calls saved by the device read-ahead buffer.
+   * @return the number of symbols delivered from the device read-ahead buffer in the last second.
+   */
+  unsigned int getSavedReadRate() const { return m_savedReadsPerSec; }
+
+  /**
+   * Return the number of reads answered by attaching to an identical pending request.
+   * @return the number of reads answered by attaching to an identical pending request.
+   */
+  uint64_t getCoalescedReads() const { return m_coalescedReads.get(); }
+
+  /**
+   * Return the total number of received symbols.
+   * @return the total number of received symbols.
+   */
+  uint64_t getReceivedSymbols() const { return m_receivedSymbols; }
+
+  /**
+   * Return the number of telegrams interrupted by an unexpected SYN symbol.
+   * @return the number of telegrams interrupted by an unexpected SYN symbol.
+   */
+  unsigned int getInterruptedTelegrams() const { return m_interruptedTelegrams; }
+
+  /**
+   * Return the number of times the signal was lost.
+   * @return the number of times the signal was lost.
+   */
+  unsigned int getSignalLosses() const { return m_signalLosses; }
+
+  /**
+   * Return the number of symbols sent later than @a SEND_DEADLINE after receiving the previous one.
+   * @return the number of missed send deadlines.
+   */
+  unsigned int getMissedDeadlines() const { return m_missedDeadlines; }
+
+  /**
+   * Return the number of answers to requests addressed to us that were sent from a prepared response.
+   * @param prepared the variable in which to store the number of prepared responses.
+   * @return the number of answers sent from a prepared response.
+   */
+  unsigned int getServedAnswers(unsigned int* prepared) const {
+    *prepared = m_preparedAnswers;
+    return m_servedAnswers;
+  }
+
+  /**
+   * Format the bus counters as metrics.
+   * @param writer the @a MetricsWriter to write to.
+   */
+  void formatMetrics(MetricsWriter* writer) const;
+
+  /**
+   * Add the approximate memory used by the grabbed messages, the scan results, and the queued requests to the
+   * @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage);
+
+  /**
+   * Preallocate the buffers used for receiving and sending symbols in order to avoid memory allocation in the symbol
+   * loop (to be called before starting the thread).
+   */
+  void preallocate() {
+    m_command.preallocate();
+    m_response.preallocate();
+  }
+
+  /**
+   * Get the number of grabbed messages.
+   * @param evicted the variable in which to store the number of grabbed messages evicted due to the capacity limit.
+   * @return the number of grabbed messages.
+   */
+  size_t getGrabbedCount(size_t* evicted) const;
+
   /**
    * Return the minimal measured latency between send and receive of a symbol.
    * @return the minimal measured latency between send and receive of a symbol in milliseconds, -1 if not yet known.
@@ -592,6 +1182,25 @@ class BusHandler : public WaitThread {
    */
   int getMaxArbitrationDelay() const { return m_arbitrationDelayMax; }
 
+  /**
+   * Format the percentiles of the measured bus timings.
+   * @param output the @a ostringstream to append the timings to.
+   * @param asJson whether to format as JSON object fields instead of info lines.
+   */
+  void formatTimings(ostringstream* output, bool asJson) const;
+
+  /**
+   * Reset the measured bus timings.
+   */
+  void resetTimings();
+
+  /**
+   * Format the depth and wait time statistics of the request lanes.
+   * @param output the @a ostringstream to append the statistics to.
+   * @param asJson whether to format as JSON object fields instead of info lines.
+   */
+  void formatLanes(ostringstream* output, bool asJson);
+
   /**
    * Return the number of masters already seen.
    * @return the number of masters already seen (including ebusd itself).
@@ -643,6 +1252,19 @@ class BusHandler : public WaitThread {
    */
   void measureLatency(struct timespec* sentTime, struct timespec* recvTime);
 
+  /**
+   * Drop the prepared answers if the definitions changed and prepare the answers to scan requests again
+   * (only called from the bus thread outside of a telegram).
+   */
+  void refreshAnswers();
+
+  /**
+   * Get the prepared answer for a @a Message, or prepare and keep it if not done yet.
+   * @param message the answered @a Message.
+   * @return the @a PreparedAnswer.
+   */
+  const PreparedAnswer* getAnswer(Message* message);
+
   /**
    * Called when a message sending or reception was successfully completed.
    */
@@ -713,6 +1335,12 @@ class BusHandler : public WaitThread {
   /** the interval in seconds in which poll messages are cycled, or 0 if disabled. */
   const unsigned int m_pollInterval;
 
+  /** the bus utilization target in percent, or 0 if disabled. */
+  const unsigned int m_utilizationTarget;
+
+  /** the share of @a m_utilizationTarget in percent reserved for client requests. */
+  const unsigned int m_utilizationReserve;
+
   /** the minimal measured latency between send and receive of a symbol in milliseconds, -1 if not yet known. */
   int m_symbolLatencyMin;
 
@@ -731,17 +1359,38 @@ class BusHandler : public WaitThread {
    */
   int m_arbitrationDelayMax;
 
+  /** the histogram of the latency between send and receive of a symbol in microseconds. */
+  Histogram m_symbolLatencyHist;
+
+  /** the histogram of the delay between received SYN and sent own master address in microseconds. */
+  Histogram m_arbitrationDelayHist;
+
+  /** the histogram of the delay between end of command and first response symbol in microseconds. */
+  Histogram m_slaveResponseHist;
+
+  /** the histogram of the time a @a BusRequest spent in the queue before winning arbitration in microseconds. */
+  Histogram m_queueWaitHist;
+
+  /** the histogram of the duration of @a sendAndWait in microseconds. */
+  Histogram m_sendAndWaitHist;
+
+  /** the time when the command was acknowledged and the response started to be expected. */
+  struct timespec m_responseStartTime;
+
   /** the time of the last received SYN symbol, or 0 for never. */
   struct timespec m_lastSynReceiveTime;
 
+  /** the time of the last received symbol of any kind, or 0 for never. */
+  struct timespec m_lastSymbolReceiveTime;
+
   /** the time of the last received symbol, or 0 for never. */
   time_t m_lastReceive;
 
   /** the time of the last poll, or 0 for never. */
   time_t m_lastPoll;
 
-  /** the queue of @a BusRequests that shall be handled. */
-  Queue<BusRequest*> m_nextRequests;
+  /** the queue of @a BusRequests that shall be handled by @a RequestLane. */
+  BusRequestQueue m_nextRequests;
 
   /** the currently handled BusRequest, or nullptr. */
   BusRequest* m_currentRequest;
@@ -765,15 +1414,81 @@ class BusHandler : public WaitThread {
   /** the maximum number of received symbols per second ever seen. */
   unsigned int m_maxSymPerSec;
 
+  /** the number of received non-SYN symbols in the current second. */
+  unsigned int m_dataSymbols;
+
+  /** the smoothed bus utilization in percent. */
+  unsigned int m_utilization;
+
+  /** the number of symbols delivered from the device read-ahead buffer in the last second. */
+  unsigned int m_savedReadsPerSec;
+
+  /** the pending coalescable @a ActiveBusRequest instances by master data. */
+  map<string, ActiveBusRequest*> m_pendingReads;
+
+  /** the @a Mutex for @a m_pendingReads. */
+  Mutex m_pendingReadsMutex;
+
+  /** the number of reads answered by attaching to an identical pending request (by any thread). */
+  SharedCounter m_coalescedReads;
+
+  /** the total number of received symbols. */
+  uint64_t m_receivedSymbols;
+
+  /** the number of telegrams interrupted by an unexpected SYN symbol. */
+  unsigned int m_interruptedTelegrams;
+
+  /** the number of times the signal was lost. */
+  unsigned int m_signalLosses;
+
+  /** the number of symbols sent later than @a SEND_DEADLINE after receiving the previous one. */
+  unsigned int m_missedDeadlines;
+
+  /** the number of completed telegrams by received/sent and broadcast/master-master/master-slave. */
+  Counter m_telegrams[2][3];
+
+  /** the number of received master or slave parts with invalid CRC. */
+  Counter m_crcErrors;
+
+  /** the number of received NAK symbols. */
+  Counter m_nakReceived;
+
+  /** the number of poll slots used for sending a poll message. */
+  Counter m_pollsSent;
+
+  /** the number of bus slots in which a due poll or a queued scan was deferred due to a high bus utilization. */
+  Counter m_deferredRequests;
+
+  /** the number of reads sent to the bus via @a readFromBus() (by any thread). */
+  SharedCounter m_busReads;
+
   /** the current @a BusState. */
   BusState m_state;
 
   /** 0 when not escaping/unescaping, or @a ESC when receiving, or the original value when sending. */
   symbol_t m_escape;
 
+  /** the number of symbols already sent ahead in a batch with the echo still to be checked. */
+  size_t m_sentAhead;
+
   /** the calculated CRC. */
   symbol_t m_crc;
 
+  /** the prepared answers to requests addressed to us by the key of the answered @a Message. */
+  unordered_map<uint64_t, PreparedAnswer> m_answers;
+
+  /** the @a MessageMap generation @a m_answers were prepared for. */
+  size_t m_answersGeneration;
+
+  /** the @a PreparedAnswer currently being sent, or nullptr. */
+  const PreparedAnswer* m_currentAnswer;
+
+  /** the number of prepared answers. */
+  unsigned int m_preparedAnswers;
+
+  /** the number of answers served from @a m_answers. */
+  unsigned int m_servedAnswers;
+
   /** whether the CRC matched. */
   bool m_crcValid;
 
@@ -792,11 +1507,20 @@ class BusHandler : public WaitThread {
   /** the scan results by slave address and index. */
   map<symbol_t, vector<string>> m_scanResults;
 
+  /** the scan results restored from the @a StateFile by slave address and index, not confirmed by a scan yet. */
+  map<symbol_t, vector<string>> m_restoredScanResults;
+
   /** whether to grab messages. */
   bool m_grabMessages;
 
-  /** the grabbed messages by key.*/
-  map<uint64_t, GrabbedMessage> m_grabbedMessages;
+  /** whether to pipeline the scans started by @a startScan(). */
+  bool m_pipelinedScan;
+
+  /** the @a GrabTable with the grabbed messages by key. */
+  GrabTable m_grabbedMessages;
+
+  /** the @a Mutex for access to @a m_grabbedMessages. */
+  mutable Mutex m_grabMutex;
 };
 
 }  // namespace ebusd
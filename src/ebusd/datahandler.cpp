@@ -50,11 +50,11 @@ const struct argp_child* datahandler_getargs() {
   return nullptr;
 }
 
-bool datahandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+bool datahandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus,
     list<DataHandler*>* handlers) {
   bool success = true;
 #ifdef HAVE_MQTT
-  if (!mqtthandler_register(userInfo, busHandler, messages, handlers)) {
+  if (!mqtthandler_register(userInfo, busHandler, messages, bus, handlers)) {
     success = false;
   }
 #endif
@@ -25,6 +25,7 @@
 #include <string>
 #include "ebusd/bushandler.h"
 #include "lib/ebus/message.h"
+#include "lib/utils/metrics.h"
 
 namespace ebusd {
 
@@ -47,14 +48,15 @@ class DataHandler;
 const struct argp_child* datahandler_getargs();
 
 /**
- * Registration function that is called once during initialization.
+ * Registration function that is called once for each bus during initialization.
  * @param userInfo the @a UserInfo instance.
  * @param busHandler the @a BusHandler instance.
  * @param messages the @a MessageMap instance.
+ * @param bus the index of the bus (0 for the first one).
  * @param handlers the @a list to which new @a DataHandler instances shall be added.
  * @return true if registration was successful.
  */
-bool datahandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+bool datahandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus,
     list<DataHandler*>* handlers);
 
 
@@ -123,6 +125,18 @@ class DataHandler {
    * @return whether this is a @a DataSource instance.
    */
   virtual bool isDataSource() const { return false; }
+
+  /**
+   * Format handler specific information for the "info" command.
+   * @param output the @a ostringstream to append the information lines to (each starting with a newline).
+   */
+  virtual void formatInfo(ostringstream* output) {}
+
+  /**
+   * Format handler specific counters as metrics.
+   * @param writer the @a MetricsWriter to write to.
+   */
+  virtual void formatMetrics(MetricsWriter* writer) {}
 };
 
 
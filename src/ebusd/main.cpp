@@ -23,13 +23,19 @@
 #include "ebusd/main.h"
 #include <dirent.h>
 #include <sys/stat.h>
+#ifdef HAVE_MLOCKALL
+#  include <sys/mman.h>
+#endif
+#include <unistd.h>
 #include <argp.h>
 #include <csignal>
 #include <iostream>
 #include <algorithm>
 #include <iomanip>
 #include <map>
+#include <set>
 #include <vector>
+#include <atomic>
 #include "ebusd/mainloop.h"
 #include "lib/utils/log.h"
 #include "lib/utils/httpclient.h"
@@ -49,6 +55,8 @@ using std::setfill;
 using std::setw;
 using std::nouppercase;
 using std::cout;
+using std::atomic;
+using std::set;
 
 /** the path and name of the PID file. */
 #ifdef PACKAGE_PIDFILE
@@ -76,6 +84,8 @@ static bool isDaemon = false;
 /** the program options. */
 static struct options opt = {
   "/dev/ttyUSB0",  // device
+  {},  // extraDevices
+  0,  // extraDeviceCount
   false,  // noDeviceCheck
   false,  // readOnly
   false,  // initialSend
@@ -87,6 +97,10 @@ static struct options opt = {
   getenv("LANG"),  // preferLanguage
   false,  // checkConfig
   false,  // dumpConfig
+  "",  // configSnapshot
+  0,  // configThreads
+  "",  // configCache
+  false,  // scanPipeline
   5,  // pollInterval
   false,  // injectMessages
 
@@ -98,6 +112,11 @@ static struct options opt = {
   SLAVE_RECV_TIMEOUT*5/3,  // receiveTimeout
   0,  // masterCount
   false,  // generateSyn
+  60,  // busUtilization
+  10,  // busReserve
+  0,  // rtPriority
+  false,  // rtRoundRobin
+  -1,  // rtCpu
 
   "",  // accessLevel
   "",  // aclFile
@@ -109,12 +128,17 @@ static struct options opt = {
   false,  // localOnly
   0,  // httpPort
   "/var/" PACKAGE "/html",  // htmlPath
+  2,  // workerThreads
   true,  // updateCheck
+  "",  // stateFile
+  "",  // history
+  HISTORY_BUDGET/1024,  // historySize
 
   PACKAGE_LOGFILE,  // logFile
   -1,  // logAreas
   ll_COUNT,  // logLevel
   false,  // multiLog
+  false,  // logAsync
 
   0,  // logRaw
   PACKAGE_LOGFILE,  // logRawFile
@@ -123,6 +147,7 @@ static struct options opt = {
   false,  // dump
   "/tmp/" PACKAGE "_dump.bin",  // dumpFile
   100,  // dumpSize
+  false,  // dumpTimed
 };
 
 /** the @a MessageMap instance, or nullptr. */
@@ -131,6 +156,18 @@ static MessageMap* s_messageMap = nullptr;
 /** the @a MainLoop instance, or nullptr. */
 static MainLoop* s_mainLoop = nullptr;
 
+/** the @a MessageMap instances of the further buses. */
+static vector<MessageMap*> s_extraMessageMaps;
+
+/** the @a MainLoop instances of the further buses. */
+static vector<MainLoop*> s_extraMainLoops;
+
+/** whether the device was explicitly set (further ones are then used for additional buses). */
+static bool s_deviceSet = false;
+
+/** the @a BusHandler for reading messages needed by instructions in @a executeInstructions(), or nullptr. */
+static BusHandler* s_instructionBusHandler = nullptr;
+
 /** the path prefix (including trailing "/") for retrieving configuration files from local files (empty for HTTP). */
 static string s_configLocalPrefix;
 
@@ -140,6 +177,15 @@ static string s_configUriPrefix;
 /** the @a HttpClient for retrieving configuration files from HTTP. */
 static HttpClient s_configHttpClient;
 
+/** the @a Mutex for loading configuration files into any @a MessageMap (templates, snapshot, and config server). */
+static Mutex s_configMutex;
+
+/** the @a Mutex for access to @a s_configHttpClient while parsing configuration files in parallel. */
+static Mutex s_configHttpMutex;
+
+/** the @a ConfigSnapshot of parsed local configuration files. */
+static ConfigSnapshot s_configSnapshot;
+
 /** the documentation of the program. */
 static const char argpdoc[] =
   "A daemon for communication with eBUS heating systems.";
@@ -149,7 +195,11 @@ static const char argpdoc[] =
 #define O_CFGLNG (O_DEVLAT+1)
 #define O_CHKCFG (O_CFGLNG+1)
 #define O_DMPCFG (O_CHKCFG+1)
-#define O_POLINT (O_DMPCFG+1)
+#define O_CFGSNP (O_DMPCFG+1)
+#define O_CFGTHR (O_CFGSNP+1)
+#define O_CFGCAC (O_CFGTHR+1)
+#define O_SCNPIP (O_CFGCAC+1)
+#define O_POLINT (O_SCNPIP+1)
 #define O_ANSWER (O_POLINT+1)
 #define O_ACQTIM (O_ANSWER+1)
 #define O_ACQRET (O_ACQTIM+1)
@@ -157,7 +207,12 @@ static const char argpdoc[] =
 #define O_RCVTIM (O_SNDRET+1)
 #define O_MASCNT (O_RCVTIM+1)
 #define O_GENSYN (O_MASCNT+1)
-#define O_ACLDEF (O_GENSYN+1)
+#define O_BUSUTL (O_GENSYN+1)
+#define O_BUSRES (O_BUSUTL+1)
+#define O_RTPRIO (O_BUSRES+1)
+#define O_RTPOLI (O_RTPRIO+1)
+#define O_RTCPU (O_RTPOLI+1)
+#define O_ACLDEF (O_RTCPU+1)
 #define O_ACLFIL (O_ACLDEF+1)
 #define O_HEXCMD (O_ACLFIL+1)
 #define O_DEFCMD (O_HEXCMD+1)
@@ -165,20 +220,28 @@ static const char argpdoc[] =
 #define O_LOCAL  (O_PIDFIL+1)
 #define O_HTTPPT (O_LOCAL+1)
 #define O_HTMLPA (O_HTTPPT+1)
-#define O_UPDCHK (O_HTMLPA+1)
-#define O_LOG    (O_UPDCHK+1)
+#define O_WORKER (O_HTMLPA+1)
+#define O_UPDCHK (O_WORKER+1)
+#define O_STATEF (O_UPDCHK+1)
+#define O_HISTRY (O_STATEF+1)
+#define O_HISSIZ (O_HISTRY+1)
+#define O_LOG    (O_HISSIZ+1)
 #define O_LOGARE (O_LOG+1)
 #define O_LOGLEV (O_LOGARE+1)
-#define O_RAW    (O_LOGLEV+1)
+#define O_LOGASY (O_LOGLEV+1)
+#define O_RAW    (O_LOGASY+1)
 #define O_RAWFIL (O_RAW+1)
 #define O_RAWSIZ (O_RAWFIL+1)
 #define O_DMPFIL (O_RAWSIZ+1)
 #define O_DMPSIZ (O_DMPFIL+1)
+#define O_DMPTIM (O_DMPSIZ+1)
 
 /** the definition of the known program arguments. */
 static const struct argp_option argpoptions[] = {
   {nullptr,          0,        nullptr,    0, "Device options:", 1 },
-  {"device",         'd',      "DEV",      0, "Use DEV as eBUS device (serial or [udp:]ip:port) [/dev/ttyUSB0]", 0 },
+  {"device",         'd',      "DEV",      0, "Use DEV as eBUS device (serial or [udp:]ip:port, prefixed with \"enh:\" "
+      "for the enhanced protocol, or \"sim:\" followed by a scenario file for a simulated bus), repeat for "
+      "handling further buses with own state and ports [/dev/ttyUSB0]", 0 },
   {"nodevicecheck",  'n',      nullptr,    0, "Skip serial eBUS device test", 0 },
   {"readonly",       'r',      nullptr,    0, "Only read from device, never write to it", 0 },
   {"initsend",       O_INISND, nullptr,    0, "Send an initial escape symbol after connecting device", 0 },
@@ -195,6 +258,12 @@ static const struct argp_option argpoptions[] = {
       "Prefer LANG in multilingual configuration files [system default language]", 0 },
   {"checkconfig",    O_CHKCFG, nullptr,    0, "Check CSV config files, then stop", 0 },
   {"dumpconfig",     O_DMPCFG, nullptr,    0, "Check and dump CSV config files, then stop", 0 },
+  {"configsnapshot", O_CFGSNP, "FILE",     0, "Keep a binary snapshot of parsed CSV config files in FILE "
+      "for faster startup [\"\"]", 0 },
+  {"configthreads",  O_CFGTHR, "COUNT",    0, "Parse CSV config files with COUNT threads (0 for number of CPUs) [0]",
+      0 },
+  {"configcache",    O_CFGCAC, "DIR",      0, "Cache CSV config files from HTTP in DIR for revalidation [\"\"]", 0 },
+  {"scanpipeline",   O_SCNPIP, nullptr,    0, "Load config files of slaves identified during a running full scan", 0 },
   {"pollinterval",   O_POLINT, "SEC",      0, "Poll for data every SEC seconds (0=disable) [5]", 0 },
   {"inject",         'i',      nullptr,    0, "Inject remaining arguments as already seen messages (e.g. "
       "\"FF08070400/0AB5454850303003277201\")", 0 },
@@ -208,6 +277,14 @@ static const struct argp_option argpoptions[] = {
   {"receivetimeout", O_RCVTIM, "USEC",     0, "Expect a slave to answer within USEC us [25000]", 0 },
   {"numbermasters",  O_MASCNT, "COUNT",    0, "Expect COUNT masters on the bus, 0 for auto detection [0]", 0 },
   {"generatesyn",    O_GENSYN, nullptr,    0, "Enable AUTO-SYN symbol generation", 0 },
+  {"busutil",        O_BUSUTL, "PERCENT",  0, "Defer polling and background scanning for up to a minute while the "
+      "bus utilization exceeds PERCENT less the reserved share (0=disable) [60]", 0 },
+  {"busreserve",     O_BUSRES, "PERCENT",  0, "Keep PERCENT of the bus utilization target reserved for client "
+      "requests [10]", 0 },
+  {"rtprio",         O_RTPRIO, "PRIO",     0, "Run the bus thread with real-time priority PRIO (1-99) and lock the "
+      "memory, 0 to disable [0]", 0 },
+  {"rtpolicy",       O_RTPOLI, "POLICY",   0, "Use real-time scheduling POLICY fifo or rr [fifo]", 0 },
+  {"rtcpu",          O_RTCPU,  "CPU",      0, "Pin the bus thread to CPU, -1 for any [-1]", 0 },
 
   {nullptr,          0,        nullptr,    0, "Daemon options:", 4 },
   {"accesslevel",    O_ACLDEF, "LEVEL",    0, "Set default access level to LEVEL (\"*\" for everything) [\"\"]", 0 },
@@ -220,7 +297,14 @@ static const struct argp_option argpoptions[] = {
   {"localhost",      O_LOCAL,  nullptr,    0, "Listen for command line connections on 127.0.0.1 interface only", 0 },
   {"httpport",       O_HTTPPT, "PORT",     0, "Listen for HTTP connections on PORT, 0 to disable [0]", 0 },
   {"htmlpath",       O_HTMLPA, "PATH",     0, "Path for HTML files served by HTTP port [/var/ebusd/html]", 0 },
+  {"workers",        O_WORKER, "COUNT",    0, "Handle client requests needing cached data only in COUNT threads "
+      "(0=all in main loop) [2]", 0 },
   {"updatecheck",    O_UPDCHK, "MODE",     0, "Set automatic update check to MODE (on|off) [on]", 0 },
+  {"statefile",      O_STATEF, "FILE",     0, "Keep the last seen data and scan results in FILE for a warm restart "
+      "[\"\"]", 0 },
+  {"history",        O_HISTRY, "FIELDS",   0, "Keep the recent values of FIELDS in memory for \"/data?history=\" "
+      "(comma separated CIRCUIT/NAME[/FIELD]) [\"\"]", 0 },
+  {"historysize",    O_HISSIZ, "SIZE",     0, "Use at most SIZE kB for the history of all fields [1024]", 0 },
 
   {nullptr,          0,        nullptr,    0, "Log options:", 5 },
   {"logfile",        'l',      "FILE",     0, "Write log to FILE (only for daemon) [" PACKAGE_LOGFILE "]", 0 },
@@ -230,10 +314,12 @@ static const struct argp_option argpoptions[] = {
       " [all]", 0 },
   {"loglevel",       O_LOGLEV, "LEVEL",    0, "Only write log below or equal to LEVEL: error|notice|info|debug"
       " [notice]", 0 },
+  {"logasync",       O_LOGASY, nullptr,    0, "Write log asynchronously from a separate thread", 0 },
 
   {nullptr,          0,        nullptr,    0, "Raw logging options:", 6 },
-  {"lograwdata",     O_RAW,    "bytes", OPTION_ARG_OPTIONAL,
-      "Log messages or all received/sent bytes on the bus", 0 },
+  {"lograwdata",     O_RAW,    "bytes|binary", OPTION_ARG_OPTIONAL,
+      "Log messages or all received/sent bytes on the bus, or the telegrams to an indexed and compressed binary"
+      " FILE for 'ebuslog'", 0 },
   {"lograwdatafile", O_RAWFIL, "FILE",     0, "Write raw log to FILE [" PACKAGE_LOGFILE "]", 0 },
   {"lograwdatasize", O_RAWSIZ, "SIZE",     0, "Make raw log file no larger than SIZE kB [100]", 0 },
 
@@ -241,6 +327,8 @@ static const struct argp_option argpoptions[] = {
   {"dump",           'D',      nullptr,    0, "Enable binary dump of received bytes", 0 },
   {"dumpfile",       O_DMPFIL, "FILE",     0, "Dump received bytes to FILE [/tmp/" PACKAGE "_dump.bin]", 0 },
   {"dumpsize",       O_DMPSIZ, "SIZE",     0, "Make dump file no larger than SIZE kB [100]", 0 },
+  {"dumptimed",      O_DMPTIM, nullptr,    0, "Include the delay to the previous byte in the dump "
+      "(for 'ebusfeed -T')", 0 },
 
   {nullptr,          0,        nullptr,    0, nullptr, 0 },
 };
@@ -271,7 +359,15 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       argp_error(state, "invalid device");
       return EINVAL;
     }
-    opt->device = arg;
+    if (!s_deviceSet) {
+      s_deviceSet = true;
+      opt->device = arg;
+    } else if (opt->extraDeviceCount < MAX_BUSES-1) {
+      opt->extraDevices[opt->extraDeviceCount++] = arg;
+    } else {
+      argp_error(state, "too many devices");
+      return EINVAL;
+    }
     break;
   case 'n':  // --nodevicecheck
     opt->noDeviceCheck = true;
@@ -342,6 +438,30 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     opt->checkConfig = true;
     opt->dumpConfig = true;
     break;
+  case O_CFGSNP:  // --configsnapshot=FILE
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid configsnapshot");
+      return EINVAL;
+    }
+    opt->configSnapshot = arg;
+    break;
+  case O_CFGCAC:  // --configcache=DIR
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid configcache");
+      return EINVAL;
+    }
+    opt->configCache = arg;
+    break;
+  case O_CFGTHR:  // --configthreads=0
+    opt->configThreads = parseInt(arg, 10, 0, 64, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid configthreads");
+      return EINVAL;
+    }
+    break;
+  case O_SCNPIP:  // --scanpipeline
+    opt->scanPipeline = true;
+    break;
   case O_POLINT:  // --pollinterval=5
     opt->pollInterval = parseInt(arg, 10, 0, 3600, &result);
     if (result != RESULT_OK) {
@@ -414,6 +534,41 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->generateSyn = true;
     break;
+  case O_BUSUTL:  // --busutil=60
+    opt->busUtilization = parseInt(arg, 10, 0, 100, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid busutil");
+      return EINVAL;
+    }
+    break;
+  case O_BUSRES:  // --busreserve=10
+    opt->busReserve = parseInt(arg, 10, 0, 100, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid busreserve");
+      return EINVAL;
+    }
+    break;
+  case O_RTPRIO:  // --rtprio=0
+    opt->rtPriority = parseInt(arg, 10, 0, 99, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid rtprio");
+      return EINVAL;
+    }
+    break;
+  case O_RTPOLI:  // --rtpolicy=fifo
+    if (arg == nullptr || (strcmp("fifo", arg) != 0 && strcmp("rr", arg) != 0)) {
+      argp_error(state, "invalid rtpolicy");
+      return EINVAL;
+    }
+    opt->rtRoundRobin = strcmp("rr", arg) == 0;
+    break;
+  case O_RTCPU:  // --rtcpu=-1
+    opt->rtCpu = parseSignedInt(arg, 10, -1, 1023, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid rtcpu");
+      return EINVAL;
+    }
+    break;
 
   // Daemon options:
   case O_ACLDEF:  // --accesslevel=*
@@ -470,6 +625,13 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->htmlPath = arg;
     break;
+  case O_WORKER:  // --workers=2
+    opt->workerThreads = parseInt(arg, 10, 0, 16, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid workers");
+      return EINVAL;
+    }
+    break;
   case O_UPDCHK:  // --updatecheck=on
     if (arg == nullptr || arg[0] == 0) {
       argp_error(state, "invalid updatecheck");
@@ -484,6 +646,27 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case O_STATEF:  // --statefile=FILE
+    if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
+      argp_error(state, "invalid statefile");
+      return EINVAL;
+    }
+    opt->stateFile = arg;
+    break;
+  case O_HISTRY:  // --history=CIRCUIT/NAME[/FIELD],...
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid history");
+      return EINVAL;
+    }
+    opt->history = arg;
+    break;
+  case O_HISSIZ:  // --historysize=1024
+    opt->historySize = parseInt(arg, 10, 1, 1000000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid historysize");
+      return EINVAL;
+    }
+    break;
 
   // Log options:
   case 'l':  // --logfile=/var/log/ebusd.log
@@ -541,10 +724,13 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case O_LOGASY:  // --logasync
+    opt->logAsync = true;
+    break;
 
   // Raw logging options:
   case O_RAW:  // --lograwdata
-    opt->logRaw = arg && strcmp("bytes", arg) == 0 ? 2 : 1;
+    opt->logRaw = arg && strcmp("bytes", arg) == 0 ? 2 : arg && strcmp("binary", arg) == 0 ? 3 : 1;
     break;
   case O_RAWFIL:  // --lograwdatafile=/var/log/ebusd.log
     if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
@@ -580,6 +766,9 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case O_DMPTIM:  // --dumptimed
+    opt->dumpTimed = true;
+    break;
 
   case ARGP_KEY_ARG:
     if (opt->injectMessages || (opt->checkConfig && opt->scanConfig)) {
@@ -662,11 +851,22 @@ void closePidFile() {
  * Helper method performing shutdown.
  */
 void shutdown() {
-  // stop main loop and all dependent components
+  // stop main loops and all dependent components
+  for (const auto mainLoop : s_extraMainLoops) {
+    mainLoop->shutdown();
+  }
+  for (const auto mainLoop : s_extraMainLoops) {
+    delete mainLoop;
+  }
+  s_extraMainLoops.clear();
   if (s_mainLoop) {
     delete s_mainLoop;
     s_mainLoop = nullptr;
   }
+  for (const auto messages : s_extraMessageMaps) {
+    delete messages;
+  }
+  s_extraMessageMaps.clear();
   if (s_messageMap) {
     delete s_messageMap;
     s_messageMap = nullptr;
@@ -688,6 +888,7 @@ void shutdown() {
   closePidFile();
 
   logNotice(lf_main, "ebusd stopped");
+  setLogAsync(false);
   closeLogFile();
 
   exit(EXIT_SUCCESS);
@@ -709,6 +910,9 @@ void signalHandler(int sig) {
   case SIGINT:
     logNotice(lf_main, "SIGINT received");
     if (s_mainLoop) {
+      for (const auto mainLoop : s_extraMainLoops) {
+        mainLoop->shutdown();
+      }
       s_mainLoop->shutdown();
     } else {
       shutdown();
@@ -717,6 +921,9 @@ void signalHandler(int sig) {
   case SIGTERM:
     logNotice(lf_main, "SIGTERM received");
     if (s_mainLoop) {
+      for (const auto mainLoop : s_extraMainLoops) {
+        mainLoop->shutdown();
+      }
       s_mainLoop->shutdown();
     } else {
       shutdown();
@@ -833,6 +1040,17 @@ DataFieldTemplates* getTemplates(const string& filename) {
   return &s_globalTemplates;
 }
 
+void addTemplatesMemoryUsage(MemoryUsage* usage) {
+  set<const DataFieldTemplates*> templates;
+  templates.insert(&s_globalTemplates);
+  for (const auto& it : s_templatesByPath) {
+    templates.insert(it.second);
+  }
+  for (const auto it : templates) {
+    it->addMemoryUsage(usage);
+  }
+}
+
 /**
  * Read the @a DataFieldTemplates for the specified path if necessary.
  * @param relPath the relative path from which to read the files (without trailing "/").
@@ -872,6 +1090,143 @@ static bool readTemplates(const string relPath, const string extension, bool ava
   return false;
 }
 
+/**
+ * Helper class for a configuration file parsed into a staging @a MessageMap.
+ */
+class StagedConfigFile {
+ public:
+  /** the relative name of the file. */
+  string m_name;
+
+  /** the staging @a MessageMap, or nullptr to read the file directly. */
+  MessageMap* m_staging;
+
+  /** the result code of reading the file. */
+  result_t m_result;
+
+  /** the error description of reading the file. */
+  string m_errorDescription;
+};
+
+/**
+ * Helper class for parsing @a StagedConfigFile instances in a separate thread.
+ */
+class ConfigParserThread : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param files the @a StagedConfigFile instances to parse.
+   * @param next the index of the next @a StagedConfigFile to parse (shared by all threads).
+   */
+  ConfigParserThread(vector<StagedConfigFile>* files, atomic<size_t>* next)
+    : Thread(), m_files(files), m_next(next) {}
+
+  /**
+   * Parse the remaining @a StagedConfigFile instances.
+   * @param files the @a StagedConfigFile instances to parse.
+   * @param next the index of the next @a StagedConfigFile to parse (shared by all threads).
+   */
+  static void parse(vector<StagedConfigFile>* files, atomic<size_t>* next) {
+    size_t index;
+    while ((index = next->fetch_add(1)) < files->size()) {
+      StagedConfigFile& file = (*files)[index];
+      file.m_result = loadDefinitionsFromConfigPath(file.m_staging, file.m_name, false, nullptr,
+          &file.m_errorDescription);
+    }
+  }
+
+
+ protected:
+  // @copydoc
+  void run() override {
+    parse(m_files, m_next);
+  }
+
+
+ private:
+  /** the @a StagedConfigFile instances to parse. */
+  vector<StagedConfigFile>* m_files;
+
+  /** the index of the next @a StagedConfigFile to parse. */
+  atomic<size_t>* m_next;
+};
+
+/**
+ * Parse the specified configuration files in parallel into staging @a MessageMap instances (if more than one thread
+ * is available).
+ * @param messages the @a MessageMap to load the messages into later on.
+ * @param names the relative names of the files to parse.
+ * @param files the @a StagedConfigFile list to fill in the same order.
+ * @param stage whether to parse into staging @a MessageMap instances even with a single thread (e.g. for not
+ * holding the lock of the @a MessageMap while parsing).
+ */
+static void parseConfigFiles(MessageMap* messages, const vector<string>& names, vector<StagedConfigFile>* files,
+    bool stage = false) {
+  size_t threads = opt.configThreads;
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? static_cast<size_t>(cpus) : 1;
+  }
+  if (threads > names.size()) {
+    threads = names.size();
+  }
+  files->clear();
+  for (const auto& name : names) {
+    files->push_back({name, threads > 1 || stage ? messages->createStaging() : nullptr, RESULT_OK, ""});
+  }
+  if (threads <= 1 && !stage) {
+    return;  // read directly later on
+  }
+  atomic<size_t> next(0);
+  vector<ConfigParserThread*> parsers;
+  for (size_t index = 1; index < threads; index++) {
+    ConfigParserThread* parser = new ConfigParserThread(files, &next);
+    parsers.push_back(parser);
+    parser->start("cfgparser");
+  }
+  ConfigParserThread::parse(files, &next);
+  for (const auto parser : parsers) {
+    parser->join();
+    delete parser;
+  }
+}
+
+/**
+ * Load the messages of a configuration file previously passed to @a parseConfigFiles().
+ * @param messages the @a MessageMap to load the messages into.
+ * @param file the @a StagedConfigFile (the staging @a MessageMap is freed afterwards).
+ * @param verbose whether to verbosely log problems.
+ * @param errorDescription a string in which to store the error description in case of error.
+ * @return the result code.
+ */
+static result_t loadStagedConfigFile(MessageMap* messages, StagedConfigFile* file, bool verbose,
+    string* errorDescription) {
+  if (!file->m_staging) {
+    return loadDefinitionsFromConfigPath(messages, file->m_name, verbose, nullptr, errorDescription);
+  }
+  *errorDescription = file->m_errorDescription;
+  messages->lock();
+  result_t result = messages->mergeStaged(file->m_staging, file->m_name, file->m_result, verbose, errorDescription);
+  messages->unlock();
+  delete file->m_staging;
+  file->m_staging = nullptr;
+  return result;
+}
+
+/**
+ * Free the staging @a MessageMap instances of configuration files not loaded.
+ * @param files the @a StagedConfigFile list.
+ */
+static void freeStagedConfigFiles(vector<StagedConfigFile>* files) {
+  for (auto& file : *files) {
+    if (file.m_staging) {
+      delete file.m_staging;
+      file.m_staging = nullptr;
+    }
+  }
+  files->clear();
+}
+
 /**
  * Read the configuration files from the specified path.
  * @param relPath the relative path from which to read the files (without trailing "/").
@@ -891,13 +1246,16 @@ static result_t readConfigFiles(const string& relPath, const string& extension,
     return result;
   }
   readTemplates(relPath, extension, hasTemplates, verbose);
-  for (const auto& name : files) {
-    logInfo(lf_main, "reading file %s", name.c_str());
-    result_t result = loadDefinitionsFromConfigPath(messages, name, verbose, nullptr, errorDescription);
+  vector<StagedConfigFile> staged;
+  parseConfigFiles(messages, files, &staged);
+  for (auto& file : staged) {
+    logInfo(lf_main, "reading file %s", file.m_name.c_str());
+    result_t result = loadStagedConfigFile(messages, &file, verbose, errorDescription);
     if (result != RESULT_OK) {
+      freeStagedConfigFiles(&staged);
       return result;
     }
-    logInfo(lf_main, "successfully read file %s", name.c_str());
+    logInfo(lf_main, "successfully read file %s", file.m_name.c_str());
   }
   if (recursive) {
     for (const auto& name : dirs) {
@@ -917,18 +1275,27 @@ static result_t readConfigFiles(const string& relPath, const string& extension,
  * @param message the @a Message to read.
  */
 void readMessage(Message* message) {
-  if (!s_mainLoop || !message) {
+  if (!s_instructionBusHandler || !message) {
     return;
   }
-  BusHandler* busHandler = s_mainLoop->getBusHandler();
-  result_t result = busHandler->readFromBus(message, "");
+  result_t result = s_instructionBusHandler->readFromBus(message, "");
   if (result != RESULT_OK) {
     logError(lf_main, "error reading message %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
         getResultCode(result));
   }
 }
 
-void executeInstructions(MessageMap* messages, bool verbose) {
+void lockConfig() {
+  s_configMutex.lock();
+}
+
+void unlockConfig() {
+  s_configMutex.unlock();
+}
+
+void executeInstructions(MessageMap* messages, BusHandler* busHandler, bool verbose) {
+  s_configMutex.lock();
+  s_instructionBusHandler = busHandler;
   string errorDescription;
   result_t result = messages->resolveConditions(verbose, &errorDescription);
   if (result != RESULT_OK) {
@@ -945,42 +1312,83 @@ void executeInstructions(MessageMap* messages, bool verbose) {
   }
   logNotice(lf_main, "found messages: %d (%d conditional on %d conditions, %d poll, %d update)", messages->size(),
       messages->sizeConditional(), messages->sizeConditions(), messages->sizePoll(), messages->sizePassive());
+  if (s_configSnapshot.write() != RESULT_OK) {
+    logError(lf_main, "unable to write config snapshot %s", opt.configSnapshot);
+  }
+  if (!s_configUriPrefix.empty()) {
+    logInfo(lf_main, "config server: %d requests, %d connects, %d not modified", s_configHttpClient.getRequests(),
+        s_configHttpClient.getConnects(), s_configHttpClient.getNotModified());
+  }
+  s_instructionBusHandler = nullptr;
+  s_configMutex.unlock();
 }
 
 result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
     map<string, string>* defaults, string* errorDescription, bool replace) {
   istream* stream = nullptr;
   time_t mtime = 0;
+  size_t fileSize = 0;
+  SnapshotFile snapshotFile;
+  bool replay = false;
+  string snapshotName = (s_configUriPrefix.empty() ? s_configLocalPrefix : s_configUriPrefix) + filename;
   if (s_configUriPrefix.empty()) {
-    stream = FileReader::openFile(s_configLocalPrefix + filename, errorDescription, &mtime);
+    struct stat st;
+    if (s_configSnapshot.isEnabled() && stat(snapshotName.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      // an unchanged file is replayed from the snapshot without reading it at all
+      mtime = st.st_mtime;
+      fileSize = static_cast<size_t>(st.st_size);
+      replay = s_configSnapshot.get(snapshotName, mtime, fileSize, &snapshotFile);
+    }
+    if (!replay) {
+      stream = FileReader::openFile(snapshotName, errorDescription, &mtime);
+    }
   } else {
     string content;
-    if (s_configHttpClient.get(s_configUriPrefix + filename, "", &content, &mtime)) {
-      stream = new istringstream(content);
+    s_configHttpMutex.lock();
+    bool found = s_configHttpClient.get(s_configUriPrefix + filename, "", &content, &mtime);
+    s_configHttpMutex.unlock();
+    if (found) {
+      fileSize = content.length();
+      replay = s_configSnapshot.isEnabled() && s_configSnapshot.get(snapshotName, mtime, fileSize, &snapshotFile);
+      if (!replay) {
+        stream = new istringstream(content);
+      }
     }
   }
-  result_t result;
+  if (!stream && !replay) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  if (s_configSnapshot.isEnabled()) {
+    reader->setSnapshotFile(&snapshotFile, replay);
+  }
+  result_t result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
+  if (s_configSnapshot.isEnabled() && !replay && result == RESULT_OK) {
+    snapshotFile.m_mtime = mtime;
+    snapshotFile.m_fileSize = fileSize;
+    s_configSnapshot.set(snapshotName, snapshotFile);
+  }
   if (stream) {
-    result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace);
     delete(stream);
-  } else {
-    result = RESULT_ERR_NOTFOUND;
   }
   return result;
 }
 
-result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive) {
+result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive, bool keepTemplates) {
   logInfo(lf_main, "loading configuration files from %s", opt.configPath);
+  s_configMutex.lock();
   messages->lock();
   messages->clear();
-  s_globalTemplates.clear();
-  for (auto& it : s_templatesByPath) {
-    if (it.second != &s_globalTemplates) {
-      delete it.second;
+  StringPool::resetRequestedBytes();  // only count the definitions read from now on
+  if (!keepTemplates) {
+    s_globalTemplates.clear();
+    for (auto& it : s_templatesByPath) {
+      if (it.second != &s_globalTemplates) {
+        delete it.second;
+      }
+      it.second = nullptr;
     }
-    it.second = nullptr;
+    s_templatesByPath.clear();
   }
-  s_templatesByPath.clear();
 
   string errorDescription;
   result_t result = readConfigFiles("", ".csv",
@@ -991,16 +1399,40 @@ result_t loadConfigFiles(MessageMap* messages, bool verbose, bool denyRecursive)
     logError(lf_main, "error reading config files: %s, last error: %s", getResultCode(result),
         errorDescription.c_str());
   }
+  messages->discardRetainedStates();  // states saved before the load were restored by now if at all
+  size_t internCount, internBytes, internRequestedBytes;
+  StringPool::getStats(&internCount, &internBytes, &internRequestedBytes);
+  logInfo(lf_main, "%d interned names and attribute values use %d bytes instead of %d", internCount, internBytes,
+      internRequestedBytes);
+  size_t sharedFieldCount, sharedFieldReferences;
+  DataFieldPool::getStats(&sharedFieldCount, &sharedFieldReferences);
+  logInfo(lf_main, "%d distinct message fields shared by %d references", sharedFieldCount, sharedFieldReferences);
   messages->unlock();
+  s_configMutex.unlock();
   return RESULT_OK;
 }
 
-result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile) {
+/**
+ * Load the message definitions from a configuration file matching the scan result while holding the config lock.
+ * The files are parsed into staging instances so that the lock of the @a MessageMap is only held for merging.
+ * @param messages the @a MessageMap to load the messages into.
+ * @param address the address of the scan participant
+ * (either master for broadcast master data or slave for read slave data).
+ * @param verbose whether to verbosely log problems.
+ * @param relativeFile the string in which the name of the configuration file is stored on success.
+ * @return the result code.
+ */
+static result_t loadScanConfigFileLocked(MessageMap* messages, symbol_t address, bool verbose,
+    string* relativeFile) {
+  messages->lock();
   Message* message = messages->getScanMessage(address);
+  messages->unlock();
   if (!message || message->getLastUpdateTime() == 0) {
     return RESULT_ERR_NOTFOUND;
   }
-  const SlaveSymbolString& data = message->getLastSlaveData();
+  MasterSymbolString master;
+  SlaveSymbolString data;
+  message->getLastData(&master, &data);
   if (data.getDataSize() < 1+5+2+2) {
     logError(lf_main, "unable to load scan config %2.2x: slave part too short (%d)", address, data.getDataSize());
     return RESULT_EMPTY;
@@ -1135,30 +1567,44 @@ result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose
 
   // found the right file. load the templates if necessary, then load the file itself
   bool readCommon = readTemplates(manufStr, ".csv", hasTemplates, opt.checkConfig);
-  if (readCommon) {
+  // the templates are shared by all buses, so the common files might already be loaded for another bus only
+  if (readCommon || opt.extraDeviceCount > 0) {
     result = collectConfigFiles(manufStr, "", ".csv", &files, true, "&a=-");
     if (result == RESULT_OK && !files.empty()) {
+      vector<string> commonFiles;
       for (const auto& name : files) {
         string baseName = name.substr(manufStr.length()+1, name.length()-manufStr.length()-strlen(".csv"));  // *.
         if (baseName == "_templates.") {  // skip templates
           continue;
         }
-        if (baseName.length() < 3 || baseName.find_first_of('.') != 2) {  // different from the scheme "ZZ."
-          string errorDescription;
-          result = loadDefinitionsFromConfigPath(messages, name, verbose, nullptr, &errorDescription);
-          if (result == RESULT_OK) {
-            logNotice(lf_main, "read common config file %s", name.c_str());
-          } else {
-            logError(lf_main, "error reading common config file %s: %s, %s", name.c_str(), getResultCode(result),
-                errorDescription.c_str());
-          }
+        string comment;
+        if ((baseName.length() < 3 || baseName.find_first_of('.') != 2)  // different from the scheme "ZZ."
+            && !messages->getLoadedFileInfo(name, &comment)) {
+          commonFiles.push_back(name);
+        }
+      }
+      vector<StagedConfigFile> staged;
+      parseConfigFiles(messages, commonFiles, &staged, true);
+      for (auto& file : staged) {
+        string errorDescription;
+        result = loadStagedConfigFile(messages, &file, verbose, &errorDescription);
+        if (result == RESULT_OK) {
+          logNotice(lf_main, "read common config file %s", file.m_name.c_str());
+        } else {
+          logError(lf_main, "error reading common config file %s: %s, %s", file.m_name.c_str(),
+              getResultCode(result), errorDescription.c_str());
         }
       }
     }
   }
   bestDefaults["name"] = ident;
   string errorDescription;
-  result = loadDefinitionsFromConfigPath(messages, best, verbose, &bestDefaults, &errorDescription);
+  MessageMap* staging = messages->createStaging();
+  result = loadDefinitionsFromConfigPath(staging, best, verbose, &bestDefaults, &errorDescription);
+  messages->lock();
+  result = messages->mergeStaged(staging, best, result, verbose, &errorDescription);
+  messages->unlock();
+  delete staging;
   if (result != RESULT_OK) {
     logError(lf_main, "error reading scan config file %s for ID \"%s\", SW%4.4d, HW%4.4d: %s, %s", best.c_str(),
         ident.c_str(), sw, hw, getResultCode(result), errorDescription.c_str());
@@ -1169,6 +1615,24 @@ result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose
   return RESULT_OK;
 }
 
+result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile) {
+  s_configMutex.lock();
+  result_t result = loadScanConfigFileLocked(messages, address, verbose, relativeFile);
+  if (s_configSnapshot.write() != RESULT_OK) {
+    logError(lf_main, "unable to write config snapshot %s", opt.configSnapshot);
+  }
+  s_configMutex.unlock();
+  return result;
+}
+
+result_t reloadConfigFiles(MessageMap* messages, BusHandler* busHandler, MessageMap** replacement) {
+  *replacement = messages->createReplacement();
+  result_t result = loadConfigFiles(*replacement);
+  executeInstructions(*replacement, busHandler);
+  (*replacement)->matchStates(messages);
+  return result;
+}
+
 /**
  * Helper method for parsing a master/slave message pair from a command line argument.
  * @param arg the argument to parse.
@@ -1221,6 +1685,10 @@ int main(int argc, char* argv[]) {
     logError(lf_main, "invalid arguments");
     return EINVAL;
   }
+  if (opt.logRaw == 3 && strcmp(opt.logRawFile, opt.logFile) == 0) {
+    logError(lf_main, "binary raw log requires a separate lograwdatafile");
+    return EINVAL;
+  }
 
   string configPath = string(opt.configPath);
   if (configPath.find("://") == string::npos) {
@@ -1241,6 +1709,16 @@ int main(int argc, char* argv[]) {
       return EINVAL;
     }
     s_configHttpClient.disconnect();
+    if (opt.configCache[0] && !s_configHttpClient.setCacheDir(opt.configCache)) {
+      logError(lf_main, "unable to use config cache %s", opt.configCache);
+    }
+  }
+  if (opt.configSnapshot[0]) {
+    if (s_configSnapshot.open(opt.configSnapshot) == RESULT_OK) {
+      logInfo(lf_main, "read config snapshot %s with %d files", opt.configSnapshot, s_configSnapshot.size());
+    } else {
+      logNotice(lf_main, "config snapshot %s not available, rebuilding it", opt.configSnapshot);
+    }
   }
   if (!opt.readOnly && opt.scanConfig && opt.initialScan == 0) {
     opt.initialScan = BROADCAST;
@@ -1255,7 +1733,7 @@ int main(int argc, char* argv[]) {
     logNotice(lf_main, PACKAGE_STRING "." REVISION " performing configuration check...");
 
     result_t result = loadConfigFiles(s_messageMap, true, opt.scanConfig && arg_index < argc);
-    executeInstructions(s_messageMap, true);
+    executeInstructions(s_messageMap, nullptr, true);
     MasterSymbolString master;
     SlaveSymbolString slave;
     while (result == RESULT_OK && opt.scanConfig && arg_index < argc) {
@@ -1271,7 +1749,7 @@ int main(int argc, char* argv[]) {
         message->storeLastData(master, slave);
         string file;
         result_t res = loadScanConfigFile(s_messageMap, address, true, &file);
-        executeInstructions(s_messageMap, true);
+        executeInstructions(s_messageMap, nullptr, true);
         if (res == RESULT_OK) {
           logInfo(lf_main, "scan config %2.2x: file %s loaded", address, file.c_str());
         }
@@ -1291,11 +1769,27 @@ int main(int argc, char* argv[]) {
     logError(lf_main, "unable to create device %s", opt.device);
     return EINVAL;
   }
+  vector<Device*> extraDevices;
+  for (unsigned int bus = 0; bus < opt.extraDeviceCount; bus++) {
+    Device *extraDevice = Device::create(opt.extraDevices[bus], !opt.noDeviceCheck, opt.readOnly, opt.initialSend);
+    if (extraDevice == nullptr) {
+      logError(lf_main, "unable to create device %s", opt.extraDevices[bus]);
+      delete device;
+      for (const auto created : extraDevices) {
+        delete created;
+      }
+      return EINVAL;
+    }
+    extraDevices.push_back(extraDevice);
+  }
 
   if (!opt.foreground) {
     setLogFile(opt.logFile);
     daemonize();  // make me daemon
   }
+  if (opt.logAsync) {
+    setLogAsync(true);
+  }
 
   // trap signals that we expect to receive
   signal(SIGHUP, signalHandler);
@@ -1309,9 +1803,18 @@ int main(int argc, char* argv[]) {
 
   // load configuration files
   loadConfigFiles(s_messageMap);
+  for (size_t bus = 0; bus < extraDevices.size(); bus++) {
+    // each further bus has its own messages with their last data, but shares the templates
+    MessageMap* messages = new MessageMap(false);
+    loadConfigFiles(messages, false, false, true);
+    s_extraMessageMaps.push_back(messages);
+  }
 
-  // create the MainLoop and start it
+  // create the MainLoops and start them
   s_mainLoop = new MainLoop(opt, device, s_messageMap);
+  for (size_t bus = 0; bus < extraDevices.size(); bus++) {
+    s_extraMainLoops.push_back(new MainLoop(opt, extraDevices[bus], s_extraMessageMaps[bus], bus+1));
+  }
   if (opt.injectMessages) {
     BusHandler* busHandler = s_mainLoop->getBusHandler();
     MasterSymbolString master;
@@ -1325,6 +1828,22 @@ int main(int argc, char* argv[]) {
     }
   }
   s_mainLoop->start("mainloop");
+  for (const auto mainLoop : s_extraMainLoops) {
+    mainLoop->start("mainloop");
+  }
+#ifdef HAVE_MLOCKALL
+  if (opt.rtPriority > 0) {
+    // lock the memory after loading the config files, but only the pages actually used (e.g. not the whole stacks)
+#ifdef MCL_ONFAULT
+    int flags = MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT;
+#else
+    int flags = MCL_CURRENT;
+#endif
+    if (mlockall(flags) != 0) {
+      logError(lf_main, "unable to lock memory: %s", strerror(errno));
+    }
+  }
+#endif
 
   // wait for end of MainLoop
   s_mainLoop->join();
@@ -29,13 +29,20 @@
 
 namespace ebusd {
 
+class BusHandler;
+
 /** \file ebusd/main.h
  * The main entry method doing all the startup handling.
  */
 
+/** the maximum number of buses handled by a single daemon instance. */
+#define MAX_BUSES 4
+
 /** A structure holding all program options. */
 struct options {
   const char* device;  //!< eBUS device (serial device or [udp:]ip:port) [/dev/ttyUSB0]
+  const char* extraDevices[MAX_BUSES-1];  //!< eBUS devices of the further buses
+  unsigned int extraDeviceCount;  //!< number of eBUS devices in @a extraDevices
   bool noDeviceCheck;  //!< skip serial eBUS device test
   bool readOnly;  //!< read-only access to the device
   bool initialSend;  //!< send an initial escape symbol after connecting device
@@ -49,6 +56,10 @@ struct options {
   const char* preferLanguage;  //!< preferred language in configuration files
   bool checkConfig;  //!< check CSV config files, then stop
   bool dumpConfig;   //!< dump CSV config files, then stop
+  const char* configSnapshot;  //!< binary snapshot file of parsed local CSV config files, or empty
+  unsigned int configThreads;  //!< number of threads for parsing CSV config files, 0 for number of CPUs [0]
+  const char* configCache;  //!< directory for caching CSV config files retrieved via HTTP, or empty
+  bool scanPipeline;  //!< pipeline the full scan and load config files of identified slaves meanwhile
   unsigned int pollInterval;  //!< poll interval in seconds, 0 to disable [5]
   bool injectMessages;  //!< inject remaining arguments as already seen messages
 
@@ -60,6 +71,11 @@ struct options {
   unsigned int receiveTimeout;  //!< timeout for receiving answer from slave in us [25000]
   unsigned int masterCount;  //!< expected number of masters for arbitration [0]
   bool generateSyn;  //!< enable AUTO-SYN symbol generation
+  unsigned int busUtilization;  //!< bus utilization target in percent for polling and scanning, 0 to disable [60]
+  unsigned int busReserve;  //!< share of the bus utilization target in percent reserved for client requests [10]
+  unsigned int rtPriority;  //!< real-time priority of the bus thread, 0 to disable [0]
+  bool rtRoundRobin;  //!< true for SCHED_RR, false for SCHED_FIFO real-time scheduling of the bus thread [false]
+  int rtCpu;  //!< the CPU to pin the bus thread to, or -1 [-1]
 
   const char* accessLevel;  //!< default access level
   const char* aclFile;  //!< ACL file name
@@ -71,20 +87,26 @@ struct options {
   bool localOnly;  //!< listen on 127.0.0.1 interface only
   uint16_t httpPort;  //!< optional port to listen for HTTP connections, 0 to disable [0]
   const char* htmlPath;  //!< path for HTML files served by the HTTP port [/var/ebusd/html]
+  unsigned int workerThreads;  //!< number of threads for handling client requests needing cached data only [2]
   bool updateCheck;  //!< perform automatic update check
+  const char* stateFile;  //!< file for keeping the last seen data and scan results across a restart, or empty
+  const char* history;  //!< comma separated fields to keep the recent values of in memory, or empty
+  unsigned int historySize;  //!< maximum size of the history of all fields in kB [1024]
 
   const char* logFile;  //!< log file name [/var/log/ebusd.log]
   int logAreas;  //!< log areas [all]
   LogLevel logLevel;  //!< log level [notice]
   bool multiLog;  //!< multiple log levels adjusted with --log=...
+  bool logAsync;  //!< write log asynchronously from a separate thread
 
-  unsigned int logRaw;  //!< raw log each received/sent byte on the bus (1=messages, 2=bytes)
+  unsigned int logRaw;  //!< raw log each received/sent byte on the bus (1=messages, 2=bytes, 3=binary)
   const char* logRawFile;  //!< name of raw log file [/var/log/ebusd.log]
   unsigned int logRawSize;  //!< maximum size of raw log file in kB [100]
 
   bool dump;  //!< binary dump received bytes
   const char* dumpFile;  //!< name of dump file [/tmp/ebusd_dump.bin]
   unsigned int dumpSize;  //!< maximum size of dump file in kB [100]
+  bool dumpTimed;  //!< write timed dump records including the delay to the previous received byte
 };
 
 /**
@@ -95,14 +117,23 @@ struct options {
  */
 DataFieldTemplates* getTemplates(const string& filename);
 
+/**
+ * Add the approximate memory used by all loaded @a DataFieldTemplates to the @a MemoryUsage.
+ * @param usage the @a MemoryUsage to add to.
+ */
+void addTemplatesMemoryUsage(MemoryUsage* usage);
+
 /**
  * Load the message definitions from configuration files.
  * @param messages the @a MessageMap to load the messages into.
  * @param verbose whether to verbosely log problems.
  * @param denyRecursive whether to avoid loading all files recursively (e.g. for scan config check).
+ * @param keepTemplates whether to keep the templates already loaded (e.g. for the further buses), otherwise they
+ * are read again.
  * @return the result code.
  */
-result_t loadConfigFiles(MessageMap* messages, bool verbose = false, bool denyRecursive = false);
+result_t loadConfigFiles(MessageMap* messages, bool verbose = false, bool denyRecursive = false,
+    bool keepTemplates = false);
 
 /**
  * Load the message definitions from a configuration file matching the scan result.
@@ -116,12 +147,34 @@ result_t loadConfigFiles(MessageMap* messages, bool verbose = false, bool denyRe
  */
 result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile);
 
+/**
+ * Load the message definitions from configuration files into a replacement for the @a MessageMap and execute the
+ * instructions on it (without modifying the current @a MessageMap).
+ * @param messages the current @a MessageMap.
+ * @param busHandler the @a BusHandler for reading messages needed by the instructions.
+ * @param replacement the variable in which to store the replacement @a MessageMap to pass to MessageMap#swap().
+ * @return the result code.
+ */
+result_t reloadConfigFiles(MessageMap* messages, BusHandler* busHandler, MessageMap** replacement);
+
+/**
+ * Lock the global state for loading configuration files (e.g. templates) against simultaneous loading in another
+ * thread.
+ */
+void lockConfig();
+
+/**
+ * Unlock the global state for loading configuration files.
+ */
+void unlockConfig();
+
 /**
  * Helper method for executing all loaded and resolvable instructions.
  * @param messages the @a MessageMap instance.
+ * @param busHandler the @a BusHandler for reading messages needed by conditions of instructions, or nullptr.
  * @param verbose whether to verbosely log all problems.
  */
-void executeInstructions(MessageMap* messages, bool verbose = false);
+void executeInstructions(MessageMap* messages, BusHandler* busHandler, bool verbose = false);
 
 /**
  * Helper method for loading definitions from a relative file from the config path/URL.
@@ -21,11 +21,17 @@
 #endif
 
 #include "ebusd/mainloop.h"
+#include <string.h>
 #include <iomanip>
 #include <deque>
 #include <algorithm>
+#include <functional>
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
 #include "ebusd/main.h"
 #include "lib/utils/log.h"
+#include "lib/utils/clock.h"
 #include "lib/utils/httpclient.h"
 #include "lib/ebus/data.h"
 
@@ -41,6 +47,12 @@ using std::ifstream;
 /** the number of seconds of permanent missing signal after which to reconnect the device. */
 #define RECONNECT_MISSING_SIGNAL 60
 
+/** the minimum size of the HTTP response body to pass on to the client while it is still being produced. */
+#define HTTP_CHUNK_SIZE 16384
+
+/** the time in seconds without any events client after which older updates are not passed on as events. */
+#define EVENTS_IDLE_TIME 10
+
 
 result_t UserList::getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const {
   // name,secret,level[,level]*
@@ -98,10 +110,14 @@ result_t UserList::addFromFile(const string& filename, unsigned int lineNo, map<
 }
 
 
-MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messages)
-  : Thread(), m_device(device), m_reconnectCount(0), m_userList(opt.accessLevel), m_messages(messages),
+MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messages, size_t bus)
+  : Thread(), m_device(device), m_reconnectCount(0), m_dumpTimed(opt.dumpTimed),
+    m_deviceData(DEVICE_DATA_RING_SIZE),
+    m_userList(opt.accessLevel), m_messages(messages), m_bus(bus),
     m_address(opt.address), m_scanConfig(opt.scanConfig), m_initialScan(opt.readOnly ? ESC : opt.initialScan),
-    m_polling(opt.pollInterval > 0), m_enableHex(opt.enableHex), m_shutdown(false), m_runUpdateCheck(opt.updateCheck) {
+    m_polling(opt.pollInterval > 0), m_enableHex(opt.enableHex), m_shutdown(false),
+    m_runUpdateCheck(opt.updateCheck && bus == 0),
+    m_nextEventId(1), m_eventCursor(0), m_lastEventCollect(0) {
   // open Device
   result_t result = m_device->open();
   if (result != RESULT_OK) {
@@ -110,15 +126,25 @@ MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messag
     logError(lf_bus, "device %s not available", m_device->getName());
   }
   m_device->setListener(this);
+  // the further buses use own dump and raw log files as well as own ports
+  string fileSuffix = bus == 0 ? "" : "." + std::to_string(bus+1);
   if (opt.dumpFile[0]) {
-    m_dumpFile = new RotateFile(opt.dumpFile, opt.dumpSize);
+    m_dumpFile = new RotateFile(opt.dumpFile + fileSuffix, opt.dumpSize);
     m_dumpFile->setEnabled(opt.dump);
   } else {
     m_dumpFile = nullptr;
   }
-  m_logRawEnabled = opt.logRaw != 0;
-  if (opt.logRawFile[0] && strcmp(opt.logRawFile, opt.logFile) != 0) {
-    m_logRawFile = new RotateFile(opt.logRawFile, opt.logRawSize, true);
+  m_dumpLastTime.tv_sec = 0;
+  m_dumpLastTime.tv_nsec = 0;
+  m_logRawEnabled = opt.logRaw != 0 && opt.logRaw != 3;
+  if (opt.logRaw == 3) {
+    m_logRawBinary = new RawLogWriter(opt.logRawFile + fileSuffix, opt.logRawSize);
+    m_logRawBinary->setEnabled(true);
+  } else {
+    m_logRawBinary = nullptr;
+  }
+  if (!m_logRawBinary && opt.logRawFile[0] && strcmp(opt.logRawFile, opt.logFile) != 0) {
+    m_logRawFile = new RotateFile(opt.logRawFile + fileSuffix, opt.logRawSize, true);
     m_logRawFile->setEnabled(m_logRawEnabled);
   } else {
     m_logRawFile = nullptr;
@@ -126,6 +152,8 @@ MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messag
   m_logRawBytes = opt.logRaw == 2;
   m_logRawLastReceived = true;
   m_logRawLastSymbol = SYN;
+  m_deviceDataWriter = new DeviceDataWriter(this);
+  m_deviceDataWriter->start("devicedata");
   if (opt.aclFile[0]) {
     string errorDescription;
     time_t mtime = 0;
@@ -152,30 +180,104 @@ MainLoop::MainLoop(const struct options& opt, Device *device, MessageMap* messag
       opt.acquireRetries, opt.sendRetries,
       latency, opt.acquireTimeout, opt.receiveTimeout,
       opt.masterCount, opt.generateSyn,
-      opt.pollInterval);
+      opt.pollInterval, opt.busUtilization, opt.busReserve);
+  m_busHandler->setPipelinedScan(opt.scanPipeline);
+  if (opt.stateFile[0]) {
+    // restore before starting the bus so that cached values and the scan results are available right away
+    string stateFileName = opt.stateFile + fileSuffix;
+    result = m_stateFile.open(stateFileName);
+    if (result == RESULT_OK) {
+      size_t seen = m_busHandler->restoreState(&m_stateFile);
+      size_t restored = m_messages->setStateFile(&m_stateFile);
+      logNotice(lf_main, "read state file %s: %d messages and %d participants restored, %d pending",
+          stateFileName.c_str(), restored, seen, m_stateFile.getStoredCount());
+    } else {
+      logNotice(lf_main, "state file %s not available: %s", stateFileName.c_str(), getResultCode(result));
+    }
+  }
+  if (opt.history[0]) {
+    result = m_historyStore.configure(opt.history, opt.historySize*1024);
+    if (result == RESULT_OK) {
+      size_t attached = m_messages->setHistoryStore(&m_historyStore);
+      logNotice(lf_main, "keeping history of %d fields, %d messages already available", m_historyStore.size(),
+          attached);
+    } else {
+      logError(lf_main, "invalid history %s: %s", opt.history, getResultCode(result));
+    }
+  }
+  if (opt.rtPriority > 0) {
+    m_busHandler->preallocate();
+  }
   m_busHandler->start("bushandler");
+  if (opt.rtPriority > 0) {
+    int error = m_busHandler->setRealtime(opt.rtRoundRobin, static_cast<int>(opt.rtPriority));
+    if (error != 0) {
+      logError(lf_main, "unable to set real-time priority of bus thread: %s", strerror(error));
+    } else {
+      logNotice(lf_main, "bus thread running with real-time priority %d", opt.rtPriority);
+    }
+  }
+  if (opt.rtCpu >= 0) {
+    int error = m_busHandler->setAffinity(opt.rtCpu);
+    if (error != 0) {
+      logError(lf_main, "unable to pin bus thread to CPU %d: %s", opt.rtCpu, strerror(error));
+    }
+  }
 
   // create network
   m_htmlPath = opt.htmlPath;
-  m_network = new Network(opt.localOnly, opt.port, opt.httpPort, &m_netQueue);
+  m_network = new Network(opt.localOnly, opt.port == 0 ? 0 : static_cast<uint16_t>(opt.port + bus),
+      opt.httpPort == 0 ? 0 : static_cast<uint16_t>(opt.httpPort + bus), &m_netQueue);
   m_network->start("network");
   logInfo(lf_main, "registering data handlers");
-  if (datahandler_register(&m_userList, m_busHandler, messages, &m_dataHandlers)) {
+  if (datahandler_register(&m_userList, m_busHandler, messages, bus, &m_dataHandlers)) {
     logInfo(lf_main, "registered data handlers");
   } else {
     logError(lf_main, "error registering data handlers");
   }
+  m_configReloader = nullptr;
   m_newlyDefinedMessages = opt.enableDefine ? new MessageMap(true, "", false) : nullptr;
+  for (unsigned int i = 0; i < opt.workerThreads; i++) {
+    CommandWorker* worker = new CommandWorker(this);
+    if (worker->start("cmdworker")) {
+      m_workers.push_back(worker);
+    } else {
+      delete worker;
+    }
+  }
 }
 
 MainLoop::~MainLoop() {
   m_shutdown = true;
   join();
+  if (m_configReloader) {
+    m_configReloader->join();
+    delete m_configReloader;
+    m_configReloader = nullptr;
+  }
+  for (const auto worker : m_workers) {
+    worker->stop();
+  }
+  for (const auto worker : m_workers) {
+    worker->join();
+    delete worker;
+  }
+  m_workers.clear();
+  NetMessage* netMessage;
+  while ((netMessage = m_mainQueue.pop()) != nullptr) {
+    netMessage->setResult("ERR: shutdown", "", cm_normal, 0, 0, true);
+  }
 
   for (const auto dataHandler : m_dataHandlers) {
     delete dataHandler;
   }
   m_dataHandlers.clear();
+  if (m_deviceDataWriter) {
+    m_deviceDataWriter->stop();
+    m_deviceDataWriter->join();
+    delete m_deviceDataWriter;
+    m_deviceDataWriter = nullptr;
+  }
   if (m_dumpFile) {
     delete m_dumpFile;
     m_dumpFile = nullptr;
@@ -184,6 +286,10 @@ MainLoop::~MainLoop() {
     delete m_logRawFile;
     m_logRawFile = nullptr;
   }
+  if (m_logRawBinary) {
+    delete m_logRawBinary;
+    m_logRawBinary = nullptr;
+  }
   if (m_network != nullptr) {
     delete m_network;
     m_network = nullptr;
@@ -212,18 +318,24 @@ MainLoop::~MainLoop() {
 /** the initial delay for running the update check. */
 #define CHECK_INITIAL_DELAY (2*60)
 
+/** the delay for writing the state file. */
+#define STATE_WRITE_DELAY (5*60)
+
 void MainLoop::run() {
   bool reload = true;
-  time_t lastTaskRun, now, start, lastSignal = 0, since, sinkSince = 1, nextCheckRun;
+  time_t lastTaskRun, now, start, lastSignal = 0, sinkSince = 1, nextCheckRun, nextStateWrite;
+  uint64_t sinkCursor = 0;
   int taskDelay = 5;
   symbol_t lastScanAddress = 0;  // 0 is known to be a master
   time(&now);
   start = now;
   lastTaskRun = now;
   nextCheckRun = now + CHECK_INITIAL_DELAY;
+  nextStateWrite = now + STATE_WRITE_DELAY;
   ostringstream updates;
   list<DataSink*> dataSinks;
   deque<Message*> messages;
+  list<NetMessage*> netMessages;
 
   for (const auto dataHandler : m_dataHandlers) {
     if (dataHandler->isDataSink()) {
@@ -232,8 +344,12 @@ void MainLoop::run() {
     dataHandler->start();
   }
   while (!m_shutdown) {
-    // pick the next message to handle
-    NetMessage* netMessage = m_netQueue.pop(taskDelay);
+    // pick all messages to handle that arrived meanwhile
+    netMessages.clear();
+    (m_workers.empty() ? m_netQueue : m_mainQueue).popAll(&netMessages, taskDelay);
+    if (m_configReloader && m_configReloader->isFinished() && finishReload()) {
+      reload = true;
+    }
     time(&now);
     if (now < lastTaskRun) {
       // clock skew
@@ -289,6 +405,26 @@ void MainLoop::run() {
             reload = false;
           }
         }
+        if (!loadDelay && m_busHandler->isPipelinedScan()) {
+          // load the participants identified meanwhile without waiting for the running scan to finish
+          symbol_t address = 0;
+          while ((address = m_busHandler->getNextScanAddress(address)) != SYN) {
+            if (!m_busHandler->isScanIdentified(address)) {
+              continue;
+            }
+            nextCheckRun = now + CHECK_INITIAL_DELAY;
+            result_t result = m_busHandler->loadScanConfig(address);
+            if (result != RESULT_OK) {
+              logError(lf_main, "scan config %2.2x: %s", address, getResultCode(result));
+            } else {
+              logInfo(lf_main, "scan config %2.2x loaded", address);
+            }
+          }
+          if (m_busHandler->isScanRunning()) {
+            loadDelay = true;  // the remaining ones are scanned separately only after the scan finished
+            taskDelay = 1;
+          }
+        }
         if (!loadDelay) {
           lastScanAddress = m_busHandler->getNextScanAddress(lastScanAddress);
           if (lastScanAddress == SYN) {
@@ -308,7 +444,9 @@ void MainLoop::run() {
       } else if (reload && m_busHandler->hasSignal()) {
         reload = false;
         // execute initial instructions
-        executeInstructions(m_messages);
+        m_messages->lock();
+        executeInstructions(m_messages, m_busHandler);
+        m_messages->unlock();
         if (m_messages->sizeConditions() > 0 && !m_polling) {
           logError(lf_main, "conditions require a poll interval > 0");
         }
@@ -354,12 +492,21 @@ void MainLoop::run() {
         }
         nextCheckRun = now + CHECK_DELAY;
       }
+      if (m_stateFile.isEnabled() && now > nextStateWrite) {
+        writeState();
+        nextStateWrite = now + STATE_WRITE_DELAY;
+      }
+      m_messages->reclaimRetired();
       time(&lastTaskRun);
     }
     time(&now);
     if (!dataSinks.empty()) {
       messages.clear();
-      m_messages->findAll("", "", "*", false, true, true, true, true, true, sinkSince, now, false, &messages);
+      if (!m_messages->findUpdates("*", false, &sinkCursor, &messages)) {
+        // update journal overrun: fall back to checking all messages
+        messages.clear();
+        m_messages->findAll("", "", "*", false, true, true, true, true, true, sinkSince, 0, false, &messages);
+      }
       for (const auto message : messages) {
         for (const auto dataSink : dataSinks) {
           dataSink->notifyUpdate(message);
@@ -367,70 +514,260 @@ void MainLoop::run() {
       }
       sinkSince = now;
     }
-    if (netMessage == nullptr) {
+    for (const auto netMessage : netMessages) {
+      if (netMessage == nullptr) {
+        continue;  // just a wakeup
+      }
+      if (m_shutdown) {
+        netMessage->setResult("ERR: shutdown", "", cm_normal, now, 0, true);
+        continue;
+      }
+      handleNetMessage(netMessage);
+    }
+  }
+  if (m_stateFile.isEnabled()) {
+    writeState();
+  }
+}
+
+void MainLoop::writeState() {
+  size_t count = m_messages->storeStates(&m_stateFile);
+  m_busHandler->storeState(&m_stateFile);
+  result_t result = m_stateFile.write();
+  if (result != RESULT_OK) {
+    logError(lf_main, "unable to write state file %s: %s", m_stateFile.getFilename().c_str(),
+        getResultCode(result));
+  } else {
+    logDebug(lf_main, "wrote state file with %d messages", count);
+  }
+}
+
+bool MainLoop::isCacheOnly(NetMessage* netMessage) const {
+  if (netMessage->isListeningMode()) {
+    return false;
+  }
+  const string& request = netMessage->getRequest();
+  if (netMessage->isHttp()) {
+    if (request.compare(0, 4, "GET ") != 0 || request.compare(4, 7, "/events") == 0
+        || request.compare(4, 7, "/memory") == 0) {
+      return false;  // events are streamed, memory usage locks the config
+    }
+    size_t pos = request.find('?');
+    if (pos == string::npos) {
+      return true;
+    }
+    // these let the request read from the bus or modify the poll messages
+    string query = "&" + request.substr(pos + 1);
+    return query.find("&required") == string::npos && query.find("&maxage") == string::npos
+        && query.find("&poll") == string::npos;
+  }
+  istringstream lines(request);
+  string line;
+  while (getline(lines, line)) {
+    istringstream stream(line);
+    string cmd, arg;
+    stream >> cmd >> arg;
+    transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    if (cmd.empty() || cmd == "F" || cmd == "FIND" || cmd == "?" || cmd == "H" || cmd == "HELP") {
       continue;
     }
-    if (m_shutdown) {
-      netMessage->setResult("ERR: shutdown", "", cm_normal, now, true);
-      break;
+    if ((cmd == "I" || cmd == "INFO") && arg.empty()) {
+      continue;
     }
-    string request = netMessage->getRequest();
-    string user = netMessage->getUser();
-    ClientMode mode = netMessage->getMode(&since);
-    if (!netMessage->isListeningMode()) {
-      since = now;
-    }
-    ostringstream ostream;
-    bool connected = true;
-    if (request.length() > 0) {
-      logDebug(lf_main, ">>> %s", request.c_str());
-      result_t result = decodeMessage(request, netMessage->isHttp(), &connected, &mode, &user, &reload, &ostream);
-      if (!netMessage->isHttp() && (ostream.tellp() == 0 || result != RESULT_OK)) {
-        if (mode != cm_direct) {
-          ostream.str("");
-        }
-        ostream << getResultCode(result);
-      }
-      if (ostream.tellp() > 100) {
-        logDebug(lf_main, "<<< %s ...", ostream.str().substr(0, 100).c_str());
-      } else {
-        logDebug(lf_main, "<<< %s", ostream.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+void MainLoop::handleNetMessage(NetMessage* netMessage) {
+  time_t now, since;
+  uint64_t cursor;
+  time(&now);
+  deque<Message*> messages;
+  string request = netMessage->getRequest();
+  string user = netMessage->getUser();
+  ClientMode mode = netMessage->getMode(&since, &cursor);
+  if (!netMessage->isListeningMode()) {
+    since = now;
+    cursor = m_messages->getUpdateCursor();
+  }
+  ostringstream ostream;
+  bool connected = true;
+  // a client may send several lines at once that are handled in order, passing on the result of each line
+  // already while handling the next one
+  istringstream lines(request);
+  bool firstLine = true;
+  while (connected && getline(lines, request)) {
+    if (request.empty()) {
+      continue;
+    }
+    if (!firstLine) {
+      netMessage->addResultChunk(ostream.str());
+      ostream.str("");
+    }
+    firstLine = false;
+    logDebug(lf_main, ">>> %s", request.c_str());
+    result_t result = decodeMessage(request, netMessage->isHttp() ? netMessage : nullptr, &connected, &mode, &user,
+        &ostream);
+    if (!netMessage->isHttp() && (ostream.tellp() == 0 || result != RESULT_OK)) {
+      if (mode != cm_direct) {
+        ostream.str("");
       }
-      if (ostream.tellp() == 0) {
-        ostream << "\n";  // only for HTTP
-      } else if (!netMessage->isHttp()) {
-        ostream << (mode == cm_direct ? "\n" : "\n\n");
+      ostream << getResultCode(result);
+    }
+    if (ostream.tellp() > 100) {
+      logDebug(lf_main, "<<< %s ...", ostream.str().substr(0, 100).c_str());
+    } else {
+      logDebug(lf_main, "<<< %s", ostream.str().c_str());
+    }
+    if (ostream.tellp() == 0) {
+      ostream << "\n";  // only for HTTP
+    } else if (!netMessage->isHttp()) {
+      ostream << (mode == cm_direct ? "\n" : "\n\n");
+    }
+    if (mode == cm_events) {
+      // start with the events following the last one known to the client
+      collectEvents(now);
+      cursor = m_nextEventId;
+      string lastId = netMessage->getHttpHeader("last-event-id");
+      if (!lastId.empty()) {
+        uint64_t id = strtoull(lastId.c_str(), nullptr, 10);
+        if (id > 0 && id < m_nextEventId) {
+          cursor = id + 1;
+        }
       }
     }
-    if (mode == cm_listen) {
-      string levels = getUserLevels(user);
+  }
+  if (mode == cm_listen) {
+    string levels = getUserLevels(user);
+    messages.clear();
+    if (!m_messages->findUpdates(levels, true, &cursor, &messages)) {
+      // update journal overrun: fall back to checking all messages
       messages.clear();
-      m_messages->findAll("", "", levels, false, true, true, true, true, true, since, now, true, &messages);
-      for (const auto message : messages) {
-        ostream << message->getCircuit() << " " << message->getName() << " = " << dec;
-        message->decodeLastData(false, nullptr, -1, 0, &ostream);
-        ostream << endl;
-      }
-    } else if (mode == cm_direct) {
-      if (m_busHandler->isGrabEnabled()) {
-        m_busHandler->formatGrabResult(false, false, &ostream, true, since, now);
-      }
+      m_messages->findAll("", "", levels, false, true, true, true, true, true, since, 0, true, &messages);
     }
-    // send result to client
-    netMessage->setResult(ostream.str(), user, mode, now, !connected);
+    for (const auto message : messages) {
+      ostream << message->getCircuit() << " " << message->getName() << " = " << dec;
+      message->decodeLastData(false, nullptr, -1, 0, &ostream);
+      ostream << endl;
+    }
+  } else if (mode == cm_events) {
+    collectEvents(now);
+    formatEvents(netMessage, &cursor, &ostream);
+  } else if (mode == cm_direct) {
+    if (m_busHandler->isGrabEnabled()) {
+      m_busHandler->formatGrabResult(false, false, &ostream, true, since, now);
+    }
+  }
+  // send result to client
+  netMessage->setResult(ostream.str(), user, mode, now, cursor, !connected);
+}
+
+void CommandWorker::run() {
+  while (isRunning()) {
+    NetMessage* netMessage = m_mainLoop->m_netQueue.pop(1);
+    if (netMessage == nullptr) {
+      continue;
+    }
+    if (m_mainLoop->m_shutdown) {
+      netMessage->setResult("ERR: shutdown", "", cm_normal, 0, 0, true);
+      continue;
+    }
+    if (!m_mainLoop->isCacheOnly(netMessage)) {
+      m_mainLoop->m_mainQueue.push(netMessage);
+      continue;
+    }
+    m_mainLoop->m_messages->lockShared();
+    m_mainLoop->handleNetMessage(netMessage);
+    m_mainLoop->m_messages->unlockShared();
+  }
+}
+
+void ConfigReloader::run() {
+  m_result = reloadConfigFiles(m_messages, m_busHandler, &m_replacement);
+  m_finished.store(true, std::memory_order_release);
+  m_wakeQueue->push(nullptr);  // let the main loop swap in the replacement right away
+}
+
+void DeviceDataWriter::run() {
+  while (Wait(0, 100)) {
+    m_mainLoop->writeDeviceData();
   }
+  m_mainLoop->writeDeviceData();
 }
 
 void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
+  // only pass the symbol to the writer thread here in order to not delay the bus thread
+  if (!(received && m_dumpFile && m_dumpFile->isEnabled())
+      && !(m_logRawFile ? m_logRawFile->isEnabled() : m_logRawEnabled)
+      && !(m_logRawBinary && m_logRawBinary->isEnabled())) {
+    return;
+  }
+  DeviceData data;
+  data.symbol = symbol;
+  data.received = received;
+  clockGettime(&data.time);
+  m_deviceData.push(data);
+}
+
+void MainLoop::writeDeviceData() {
+  DeviceData data;
+  m_deviceDataMutex.lock();
+  while (m_deviceData.pop(&data)) {
+    writeDeviceData(data);
+  }
+  if (m_logRawBinary) {
+    struct timespec now;
+    clockGettime(&now);
+    m_logRawBinary->checkFlush(now);
+  }
+  m_deviceDataMutex.unlock();
+}
+
+void MainLoop::writeDeviceData(const DeviceData& data) {
+  symbol_t symbol = data.symbol;
+  bool received = data.received;
   if (received && m_dumpFile) {
-    m_dumpFile->write(&symbol, 1);
+    if (m_dumpTimed) {
+      unsigned int delay = 0;
+      if (m_dumpLastTime.tv_sec != 0) {
+        int64_t diff = (data.time.tv_sec-m_dumpLastTime.tv_sec)*1000000LL
+          + (data.time.tv_nsec-m_dumpLastTime.tv_nsec)/1000;
+        delay = diff < 0 ? 0 : diff > TIMED_DUMP_MAX_DELAY ? TIMED_DUMP_MAX_DELAY : static_cast<unsigned int>(diff);
+      }
+      m_dumpLastTime = data.time;
+      unsigned char record[TIMED_DUMP_RECORD_SIZE];
+      encodeTimedDumpRecord(symbol, delay, record);
+      m_dumpFile->write(record, TIMED_DUMP_RECORD_SIZE);
+    } else {
+      m_dumpFile->write(&symbol, 1);
+    }
+  }
+  if (m_logRawBinary) {
+    if (symbol != SYN) {
+      if (received && !m_logRawLastReceived && symbol == m_logRawLastSymbol) {
+        return;  // skip received echo of previously sent symbol
+      }
+      if (m_logRawSymbols.empty()) {
+        m_logRawTime = data.time;
+      }
+      m_logRawSymbols.push_back(symbol);
+      m_logRawSent.push_back(!received);
+      m_logRawLastReceived = received;
+      m_logRawLastSymbol = symbol;
+    } else if (!m_logRawSymbols.empty()) {
+      m_logRawBinary->write(m_logRawSymbols, m_logRawSent, m_logRawTime);
+      m_logRawSymbols.clear();
+      m_logRawSent.clear();
+    }
+    return;
   }
   if (!m_logRawFile && !m_logRawEnabled) {
     return;
   }
   if (m_logRawBytes) {
     if (m_logRawFile) {
-      m_logRawFile->write(&symbol, 1, received);
+      m_logRawFile->write(&symbol, 1, received, true, &data.time);
     } else if (m_logRawEnabled) {
       if (received) {
         logNotice(lf_bus, "<%02x", symbol);
@@ -454,7 +791,7 @@ void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
   if (symbol == SYN && m_logRawBuffer.tellp() > 0) {  // flush
     if (m_logRawFile) {
       const char* str = m_logRawBuffer.str().c_str();
-      m_logRawFile->write((const unsigned char*)str, strlen(str), received, false);
+      m_logRawFile->write((const unsigned char*)str, strlen(str), received, false, &data.time);
     } else {
       logNotice(lf_bus, m_logRawBuffer.str().c_str());
     }
@@ -462,8 +799,37 @@ void MainLoop::notifyDeviceData(symbol_t symbol, bool received) {
   }
 }
 
-result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connected, ClientMode* mode,
-    string* user, bool* reload, ostringstream* ostream) {
+/** the counted commands (label, upper case name, and optional short name, the last one being used for unknown). */
+static const char* s_countedCommands[][3] = {
+  {"http", "GET", nullptr}, {"auth", "AUTH", "A"}, {"read", "READ", "R"}, {"write", "WRITE", "W"},
+  {"hex", "HEX", nullptr}, {"find", "FIND", "F"}, {"listen", "LISTEN", "L"}, {"direct", "DIRECT", nullptr},
+  {"state", "STATE", "S"}, {"grab", "GRAB", "G"}, {"define", "DEFINE", nullptr}, {"decode", "DECODE", "D"},
+  {"encode", "ENCODE", "E"}, {"scan", "SCAN", nullptr}, {"log", "LOG", nullptr}, {"raw", "RAW", nullptr},
+  {"dump", "DUMP", nullptr}, {"reload", "RELOAD", nullptr}, {"quit", "QUIT", "Q"}, {"info", "INFO", "I"},
+  {"help", "HELP", "H"}, {"other", "", nullptr},
+};
+
+static_assert(sizeof(s_countedCommands)/sizeof(s_countedCommands[0]) == COUNTED_COMMANDS,
+    "mismatching counted commands");
+
+/**
+ * Get the index of a command in @a s_countedCommands.
+ * @param cmd the upper case command.
+ * @return the index of the command in @a s_countedCommands.
+ */
+static size_t getCountedCommand(const string& cmd) {
+  for (size_t index = 0; index < COUNTED_COMMANDS-1; index++) {
+    const char** names = s_countedCommands[index];
+    if (cmd == names[1] || (names[2] && cmd == names[2])) {
+      return index;
+    }
+  }
+  return COUNTED_COMMANDS-1;
+}
+
+result_t MainLoop::decodeMessage(const string &data, NetMessage* httpMessage, bool* connected, ClientMode* mode,
+    string* user, ostringstream* ostream) {
+  bool isHttp = httpMessage != nullptr;
   string token, previous;
   istringstream stream(data);
   vector<string> args;
@@ -498,6 +864,7 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
   }
 
   if (isHttp) {
+    m_commandRequests[0].add();
     if (args.size() < 2) {
       *connected = false;
       *ostream << "HTTP/1.0 400 Bad Request\r\n\r\n";
@@ -505,7 +872,10 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
     }
     const char* str = args.size() > 0 ? args[0].c_str() : "";
     if (strcmp(str, "GET") == 0) {
-      return executeGet(args, connected, ostream);
+      return executeGet(args, httpMessage, connected, mode, ostream);
+    }
+    if (strcmp(str, "POST") == 0) {
+      return executePost(args, httpMessage, connected, ostream);
     }
     *connected = false;
     *ostream << "HTTP/1.0 405 Method Not Allowed\r\n\r\n";
@@ -514,6 +884,7 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
 
   string cmd = args.size() > 0 ? args[0] : "";
   transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+  m_commandRequests[getCountedCommand(*mode == cm_direct ? "DIRECT" : cmd == "?" ? "HELP" : cmd)].add();
   if (cmd == "?" || cmd == "H" || cmd == "HELP") {
     // found "HELP CMD"
     cmd = args.size() > 1 ? args[1] : "";
@@ -590,7 +961,6 @@ result_t MainLoop::decodeMessage(const string &data, bool isHttp, bool* connecte
     return executeDump(args, ostream);
   }
   if (cmd == "RELOAD") {
-    *reload = true;
     return executeReload(args, ostream);
   }
   if (cmd == "Q" || cmd == "QUIT") {
@@ -820,7 +1190,10 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
     if (srcAddress == SYN
         && (message->getLastUpdateTime() + maxAge > now
             || (message->isPassive() && message->getLastUpdateTime() != 0))) {
-      const SlaveSymbolString& slave = message->getLastSlaveData();
+      MasterSymbolString lastMaster;
+      SlaveSymbolString slave;
+      message->getLastData(&lastMaster, &slave);
+      m_cacheReads.add();
       logNotice(lf_main, "hex read %s %s from cache", message->getCircuit().c_str(), message->getName().c_str());
       *ostream << slave.getStr();
       return RESULT_OK;
@@ -828,7 +1201,7 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
 
     // send message
     SlaveSymbolString slave;
-    ret = m_busHandler->sendAndWait(master, &slave);
+    ret = m_busHandler->sendAndWait(master, &slave, true);
 
     if (ret == RESULT_OK) {
       ret = message->storeLastData(master, slave);
@@ -916,6 +1289,7 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
       }
       return ret;
     }
+    m_cacheReads.add();
     logInfo(lf_main, "read %s %s cached: %s", cacheMessage->getCircuit().c_str(), cacheMessage->getName().c_str(),
         ostream->str().c_str());
     return RESULT_OK;
@@ -956,14 +1330,35 @@ result_t MainLoop::executeRead(const vector<string>& args, const string& levels,
   return ret;
 }
 
+/**
+ * Parse a single entry of a batch write.
+ * @param entry the entry in the form "[CIRCUIT/]NAME[=VALUE[;VALUE]*]".
+ * @param circuit the circuit to use if not specified in the entry.
+ * @param write the @a BatchWrite to fill.
+ * @return true on success, false if the entry is invalid.
+ */
+static bool parseBatchWrite(const string& entry, const string& circuit, BatchWrite* write) {
+  size_t pos = entry.find('=');
+  string key = entry.substr(0, pos);
+  write->input = pos == string::npos ? "" : entry.substr(pos + 1);
+  pos = key.find('/');
+  write->circuit = pos == string::npos ? circuit : key.substr(0, pos);
+  write->name = pos == string::npos ? key : key.substr(pos + 1);
+  write->message = nullptr;
+  write->result = RESULT_ERR_INVALID_ARG;
+  return !write->circuit.empty() && !write->name.empty();
+}
+
 result_t MainLoop::executeWrite(const vector<string>& args, const string levels, ostringstream* ostream) {
   size_t argPos = 1;
-  bool hex = false, newDefinition = false;
+  bool hex = false, newDefinition = false, batch = false;
   string circuit;
   symbol_t srcAddress = SYN, dstAddress = SYN;
   while (args.size() > argPos && args[argPos][0] == '-') {
     if (args[argPos] == "-h") {
       hex = true;
+    } else if (args[argPos] == "-b") {
+      batch = true;
     } else if (args[argPos] == "-def") {
       if (!m_newlyDefinedMessages) {
         *ostream << "ERR: option not enabled";
@@ -1002,20 +1397,24 @@ result_t MainLoop::executeWrite(const vector<string>& args, const string levels,
   }
 
   if ((hex && (newDefinition || dstAddress != SYN || !circuit.empty() || args.size() < argPos + 1))
-  || (newDefinition && (hex || !circuit.empty() || args.size() < argPos + 1 || args.size() > argPos + 2))) {
+  || (newDefinition && (hex || !circuit.empty() || args.size() < argPos + 1 || args.size() > argPos + 2))
+  || (batch && (hex || newDefinition || dstAddress != SYN || args.size() < argPos + 1))) {
     argPos = 0;  // print usage
   }
 
-  if (argPos == 0 || (!newDefinition && (circuit.empty() || (args.size() != argPos+2 && args.size() != argPos+1)))) {
+  if (argPos == 0 || (!newDefinition && !batch
+      && (circuit.empty() || (args.size() != argPos+2 && args.size() != argPos+1)))) {
     *ostream << "usage: write [-s QQ] [-d ZZ] -c CIRCUIT NAME [VALUE[;VALUE]*]\n"
         "  or:  write [-s QQ] [-d ZZ] -def DEFINITION [VALUE[;VALUE]*] (only if enabled)\n"
         "  or:  write [-s QQ] [-c CIRCUIT] -h ZZPBSBNN[DD]*\n"
+        "  or:  write [-s QQ] [-c CIRCUIT] -b [CIRCUIT/]NAME[=VALUE[;VALUE]*]...\n"
         " Write value(s) or hex message.\n"
         "  -s QQ        override source address QQ\n"
         "  -d ZZ        override destination address ZZ\n"
         "  -c CIRCUIT   CIRCUIT of the message to send\n"
         "  NAME         NAME of the message to send\n"
         "  VALUE        a single field VALUE\n"
+        "  -b           write several messages back to back (reporting the result of each in a separate line)\n"
         "  -def         write with explicit message definition (only if enabled):\n"
         "    DEFINITION message definition to use instead of known definition\n"
         "  -h           send hex write message:\n"
@@ -1026,6 +1425,18 @@ result_t MainLoop::executeWrite(const vector<string>& args, const string levels,
     return RESULT_OK;
   }
 
+  if (batch) {
+    vector<BatchWrite> writes(args.size() - argPos);
+    for (size_t pos = 0; pos < writes.size(); pos++) {
+      if (!parseBatchWrite(args[argPos + pos], circuit, &writes[pos])) {
+        return RESULT_ERR_INVALID_ARG;
+      }
+    }
+    m_busHandler->writeBatch(levels, srcAddress, &writes);
+    formatBatchResult(writes, false, ostream);
+    return RESULT_OK;
+  }
+
   if (hex && argPos > 0) {
     MasterSymbolString master;
     result_t ret = parseHexMaster(args, argPos, srcAddress, &master);
@@ -1119,7 +1530,10 @@ result_t MainLoop::executeWrite(const vector<string>& args, const string levels,
         getResultCode(ret));
     return ret;
   }
-  dstAddress = message->getLastMasterData().dataAt(1);
+  MasterSymbolString lastMaster;
+  SlaveSymbolString lastSlave;
+  message->getLastData(&lastMaster, &lastSlave);
+  dstAddress = lastMaster.dataAt(1);
   if (dstAddress == BROADCAST || isMaster(dstAddress)) {
     logNotice(lf_main, "write %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
         getResultCode(ret));
@@ -1147,6 +1561,32 @@ result_t MainLoop::executeWrite(const vector<string>& args, const string levels,
   return RESULT_OK;
 }
 
+void MainLoop::formatBatchResult(const vector<BatchWrite>& writes, bool asJson, ostringstream* ostream) {
+  if (asJson) {
+    *ostream << "{";
+  }
+  bool first = true;
+  for (const auto& write : writes) {
+    if (asJson) {
+      *ostream << (first ? "\n" : ",\n") << " \"" << write.circuit << "/" << write.name << "\": \"";
+    } else {
+      *ostream << (first ? "" : "\n") << write.circuit << " " << write.name << ": ";
+    }
+    first = false;
+    if (write.result != RESULT_OK) {
+      *ostream << getResultCode(write.result);
+    } else {
+      *ostream << "done";
+    }
+    if (asJson) {
+      *ostream << "\"";
+    }
+  }
+  if (asJson) {
+    *ostream << "\n}";
+  }
+}
+
 result_t MainLoop::parseHexAndSend(const vector<string>& args, size_t& argPos, bool isDirectMode,
     ostringstream* ostream) {
   symbol_t srcAddress = SYN;
@@ -1401,6 +1841,8 @@ result_t MainLoop::executeFind(const vector<string>& args, const string& levels,
 
   bool found = false;
   char str[32];
+  MasterSymbolString lastMaster;
+  SlaveSymbolString lastSlave;
   for (const auto message : messages) {
     if (!id.empty() && !message->checkIdPrefix(id)) {
       continue;
@@ -1430,23 +1872,28 @@ result_t MainLoop::executeFind(const vector<string>& args, const string& levels,
           *ostream << " (message not available due to condition)";
         }
       } else if (hexFormat) {
-        *ostream << message->getLastMasterData().getStr() << " / " << message->getLastSlaveData().getStr();
+        message->getLastData(&lastMaster, &lastSlave);
+        *ostream << lastMaster.getStr() << " / " << lastSlave.getStr();
       } else {
         result_t ret = message->decodeLastData(false, nullptr, -1, verbosity, ostream);
         if (ret != RESULT_OK) {
-          *ostream << " (" << getResultCode(ret)
-                   << " for " << message->getLastMasterData().getStr()
-                   << " / " << message->getLastSlaveData().getStr() << ")";
+          message->getLastData(&lastMaster, &lastSlave);
+          *ostream << " (" << getResultCode(ret) << " for " << lastMaster.getStr() << " / " << lastSlave.getStr()
+                   << ")";
         }
       }
       if ((verbosity & (OF_NAMES|OF_UNITS|OF_COMMENTS)) == (OF_NAMES|OF_UNITS|OF_COMMENTS)) {
         symbol_t dstAddress = message->getDstAddress();
         if (dstAddress != SYN) {
           snprintf(str, sizeof(str), "%02x", dstAddress);
-        } else if (lastup != 0 && message->getLastMasterData().size() > 1) {
-          snprintf(str, sizeof(str), "%02x", message->getLastMasterData().dataAt(1));
         } else {
           snprintf(str, sizeof(str), "any");
+          if (lastup != 0) {
+            message->getLastData(&lastMaster, &lastSlave);
+            if (lastMaster.size() > 1) {
+              snprintf(str, sizeof(str), "%02x", lastMaster.dataAt(1));
+            }
+          }
         }
         if (lastup != 0) {
           struct tm td;
@@ -1565,7 +2012,12 @@ result_t MainLoop::executeDefine(const vector<string>& args, ostringstream* ostr
   time(&now);
   string errorDescription;
   istringstream defstr("#\n" + args[argPos]);  // ensure first line is not used for determining col names
-  return m_messages->readFromStream(&defstr, "temporary", now, true, nullptr, &errorDescription, replace);
+  lockConfig();  // the templates are shared with a reload in the background
+  m_messages->lock();
+  result_t result = m_messages->readFromStream(&defstr, "temporary", now, true, nullptr, &errorDescription, replace);
+  m_messages->unlock();
+  unlockConfig();
+  return result;
 }
 
 
@@ -1758,14 +2210,19 @@ result_t MainLoop::executeRaw(const vector<string>& args, ostringstream* ostream
     return RESULT_OK;
   }
   bool enabled;
+  m_deviceDataMutex.lock();
   m_logRawBytes = bytes;
-  if (m_logRawFile) {
+  if (m_logRawBinary) {
+    enabled = !m_logRawBinary->isEnabled();
+    m_logRawBinary->setEnabled(enabled);
+  } else if (m_logRawFile) {
     enabled = !m_logRawFile->isEnabled();
     m_logRawFile->setEnabled(enabled);
   } else {
     enabled = !m_logRawEnabled;
     m_logRawEnabled = enabled;
   }
+  m_deviceDataMutex.unlock();
   *ostream << (enabled ? "raw logging enabled" : "raw logging disabled");
   return RESULT_OK;
 }
@@ -1780,8 +2237,10 @@ result_t MainLoop::executeDump(const vector<string>& args, ostringstream* ostrea
     *ostream << "dump not configured";
     return RESULT_OK;
   }
+  m_deviceDataMutex.lock();
   bool enabled = !m_dumpFile->isEnabled();
   m_dumpFile->setEnabled(enabled);
+  m_deviceDataMutex.unlock();
   *ostream << (enabled ? "dump enabled" : "dump disabled");
   return RESULT_OK;
 }
@@ -1789,20 +2248,64 @@ result_t MainLoop::executeDump(const vector<string>& args, ostringstream* ostrea
 result_t MainLoop::executeReload(const vector<string>& args, ostringstream* ostream) {
   if (args.size() != 1) {
     *ostream << "usage: reload\n"
-                " Reload CSV config files.";
+                " Reload CSV config files (keeping the last data of messages with unchanged definition).";
     return RESULT_OK;
   }
+  if (m_configReloader) {
+    *ostream << "reload already in progress";
+    return RESULT_ERR_DUPLICATE;
+  }
+  // load into a replacement in the background and swap it in from the main loop when done
+  m_configReloader = new ConfigReloader(m_messages, m_busHandler, m_workers.empty() ? &m_netQueue : &m_mainQueue);
+  if (!m_configReloader->start("reload")) {
+    delete m_configReloader;
+    m_configReloader = nullptr;
+    return RESULT_ERR_GENERIC_IO;
+  }
+  *ostream << "reload started";
+  return RESULT_OK;
+}
+
+bool MainLoop::finishReload() {
+  m_configReloader->join();
+  result_t result = m_configReloader->getResult();
+  MessageMap* replacement = m_configReloader->takeReplacement();
+  delete m_configReloader;
+  m_configReloader = nullptr;
+  if (result != RESULT_OK) {
+    logError(lf_main, "error reloading config files: %s", getResultCode(result));
+    delete replacement;
+    return false;
+  }
+  size_t restored = m_messages->swap(replacement);
   m_busHandler->clear();
-  return loadConfigFiles(m_messages);
+  logInfo(lf_main, "reloaded config files, restored %d messages with data", restored);
+  return true;
 }
 
 result_t MainLoop::executeInfo(const vector<string>& args, const string& user, ostringstream* ostream) {
-  if (args.size() == 0) {
-    *ostream << "usage: info\n"
-                " Report information about the daemon, the configuration, and seen devices.";
+  if (args.size() == 0 || args.size() > 2 || (args.size() == 2 && args[1] != "reset" && args[1] != "memory")) {
+    *ostream << "usage: info [reset|memory]\n"
+                " Report information about the daemon, the configuration, and seen devices.\n"
+                "  reset   reset the bus timing percentiles and request lane statistics\n"
+                "  memory  report the approximate memory used by the configuration and runtime state";
+    return RESULT_OK;
+  }
+  if (args.size() == 2 && args[1] == "memory") {
+    MemoryUsage usage;
+    addMemoryUsage(&usage);
+    usage.formatInfo(ostream);
+    return RESULT_OK;
+  }
+  if (args.size() == 2) {
+    m_busHandler->resetTimings();
+    *ostream << "done";
     return RESULT_OK;
   }
   *ostream << "version: " << PACKAGE_STRING "." REVISION "\n";
+  if (m_bus > 0) {
+    *ostream << "bus: " << (m_bus+1) << ", " << m_device->getName() << "\n";
+  }
   if (!m_updateCheck.empty()) {
     *ostream << "update check: " << m_updateCheck << "\n";
   }
@@ -1816,7 +2319,14 @@ result_t MainLoop::executeInfo(const vector<string>& args, const string& user, o
   if (m_busHandler->hasSignal()) {
     *ostream << "signal: acquired\n"
              << "symbol rate: " << m_busHandler->getSymbolRate() << "\n"
-             << "max symbol rate: " << m_busHandler->getMaxSymbolRate() << "\n";
+             << "max symbol rate: " << m_busHandler->getMaxSymbolRate() << "\n"
+             << "bus utilization: " << m_busHandler->getUtilization() << "%";
+    if (m_busHandler->getUtilizationLimit() > 0) {
+      *ostream << " (background limit " << m_busHandler->getUtilizationLimit() << "%)";
+    }
+    *ostream << "\n"
+             << "saved read calls: " << m_busHandler->getSavedReadRate() << "\n"
+             << "coalesced reads: " << m_busHandler->getCoalescedReads() << "\n";
     if (m_busHandler->getMinArbitrationDelay() >= 0) {
       *ostream << "min arbitration micros: " << m_busHandler->getMinArbitrationDelay() << "\n"
                << "max arbitration micros: " << m_busHandler->getMaxArbitrationDelay() << "\n";
@@ -1825,19 +2335,104 @@ result_t MainLoop::executeInfo(const vector<string>& args, const string& user, o
       *ostream << "min symbol latency: " << m_busHandler->getMinSymbolLatency() << "\n"
                << "max symbol latency: " << m_busHandler->getMaxSymbolLatency() << "\n";
     }
+    ostringstream timings;
+    m_busHandler->formatTimings(&timings, false);
+    m_busHandler->formatLanes(&timings, false);
+    *ostream << timings.str().substr(1) << "\n";
   } else {
     *ostream << "signal: no signal\n";
   }
+  size_t evicted = 0;
+  unsigned int preparedAnswers = 0;
+  unsigned int servedAnswers = m_busHandler->getServedAnswers(&preparedAnswers);
   *ostream << "reconnects: " << m_reconnectCount << "\n"
+           << "received symbols: " << m_busHandler->getReceivedSymbols() << "\n"
+           << "interrupted telegrams: " << m_busHandler->getInterruptedTelegrams() << "\n"
+           << "signal losses: " << m_busHandler->getSignalLosses() << "\n"
+           << "missed deadlines: " << m_busHandler->getMissedDeadlines() << "\n"
+           << "answers: " << servedAnswers << " served, " << preparedAnswers << " prepared\n"
+           << "dropped raw symbols: " << getDroppedDeviceData() << "\n"
+           << "grabbed: " << m_busHandler->getGrabbedCount(&evicted) << ", " << evicted << " evicted\n"
            << "masters: " << m_busHandler->getMasterCount() << "\n"
            << "messages: " << m_messages->size() << "\n"
            << "conditional: " << m_messages->sizeConditional() << "\n"
            << "poll: " << m_messages->sizePoll() << "\n"
-           << "update: " << m_messages->sizePassive();
+           << "update: " << m_messages->sizePassive() << "\n"
+           << "message lock contentions: " << m_messages->getLockContentions() << "\n"
+           << "data read retries: " << Message::getLastDataRetries() << "\n";
+  size_t internCount, internBytes, internRequestedBytes;
+  StringPool::getStats(&internCount, &internBytes, &internRequestedBytes);
+  *ostream << "interned: " << internCount << "\n"
+           << "interned bytes: " << internBytes << "\n"
+           << "uninterned bytes: " << internRequestedBytes << "\n";
+  size_t sharedFieldCount, sharedFieldReferences;
+  DataFieldPool::getStats(&sharedFieldCount, &sharedFieldReferences);
+  *ostream << "shared fields: " << sharedFieldCount << ", " << sharedFieldReferences << " references";
+  MetricsWriter writer(false, ostream);
+  formatMetrics(&writer);
+  for (const auto dataHandler : m_dataHandlers) {
+    dataHandler->formatInfo(ostream);
+  }
   m_busHandler->formatSeenInfo(ostream);
   return RESULT_OK;
 }
 
+void MainLoop::formatMetrics(MetricsWriter* writer) {
+  bool prometheus = writer->isPrometheus();
+  m_busHandler->formatMetrics(writer);
+  writer->family("ebusd_cache_reads_total", true, "cache served reads");
+  writer->sample(m_cacheReads.get());
+  writer->family("ebusd_message_lookups_total", true, "message lookups");
+  writer->sample(MessageMap::getFindHits(), "result", "hit");
+  writer->sample(MessageMap::getFindMisses(), "result", "miss");
+  writer->family("ebusd_decode_calls_total", true, "decode calls");
+  writer->sample(Message::getDecodeCalls());
+  writer->family("ebusd_decode_seconds_total", true, "decode seconds");
+  writer->sample(static_cast<double>(Message::getDecodeNanos())/1000000000.0);
+  writer->family("ebusd_requests_total", true, "requests");
+  for (size_t index = 0; index < COUNTED_COMMANDS; index++) {
+    uint64_t count = m_commandRequests[index].get();
+    if (prometheus || count > 0) {
+      writer->sample(count, "command", s_countedCommands[index][0]);
+    }
+  }
+  writer->family("ebusd_queue_depth", false, "queue depth");
+  writer->sample(static_cast<uint64_t>(m_netQueue.size()), "queue", "network");
+  if (!m_workers.empty()) {
+    writer->sample(static_cast<uint64_t>(m_mainQueue.size()), "queue", "main");
+  }
+  if (!prometheus) {
+    return;  // the remainder is part of the "info" output already
+  }
+  writer->family("ebusd_reconnects_total", true, "reconnects");
+  writer->sample(static_cast<uint64_t>(m_reconnectCount));
+  writer->family("ebusd_messages", false, "messages");
+  writer->sample(static_cast<uint64_t>(m_messages->size()));
+  writer->family("ebusd_message_lock_contentions_total", true, "message lock contentions");
+  writer->sample(static_cast<uint64_t>(m_messages->getLockContentions()));
+  for (const auto dataHandler : m_dataHandlers) {
+    dataHandler->formatMetrics(writer);
+  }
+}
+
+void MainLoop::addMemoryUsage(MemoryUsage* usage) {
+  lockConfig();  // the templates are shared with a reload in the background
+  addTemplatesMemoryUsage(usage);
+  unlockConfig();
+  m_messages->lockShared();
+  m_messages->addMemoryUsage(usage);
+  m_messages->unlockShared();
+  StringPool::addMemoryUsage(usage);
+  DataFieldPool::addMemoryUsage(usage);
+  m_historyStore.addMemoryUsage(usage);
+  m_busHandler->addMemoryUsage(usage);
+  if (m_network) {
+    m_network->addMemoryUsage(usage);
+  }
+  size_t count = m_netQueue.size() + m_mainQueue.size();
+  usage->add(mk_queues, count*(MEMORY_NODE_OVERHEAD + sizeof(NetMessage*)), count);
+}
+
 result_t MainLoop::executeQuit(const vector<string>& args, bool *connected, ostringstream* ostream) {
   if (args.size() == 1) {
     *connected = false;
@@ -1859,6 +2454,7 @@ result_t MainLoop::executeHelp(ostringstream* ostream) {
       " write|w   Write value(s):        write [-s QQ] [-d ZZ] -c CIRCUIT NAME [VALUE[;VALUE]*]\n"
       "           Write by new def.:     write [-s QQ] [-d ZZ] -def DEFINITION [VALUE[;VALUE]*] (if enabled)\n"
       "           Write hex message:     write [-s QQ] [-c CIRCUIT] -h ZZPBSBNN[DD]*\n"
+      "           Write batch:           write [-s QQ] [-c CIRCUIT] -b [CIRCUIT/]NAME[=VALUE[;VALUE]*]...\n"
       " auth|a    Authenticate user:     auth USER SECRET\n"
       " hex       Send hex data:         hex [-s QQ] ZZPBSBNN[DD]* (if enabled)\n"
       " find|f    Find message(s):       find [-v|-V] [-r] [-w] [-p] [-a] [-d] [-h] [-i ID] [-f] [-F COL[,COL]*] [-e]"
@@ -1866,7 +2462,7 @@ result_t MainLoop::executeHelp(ostringstream* ostream) {
       " listen|l  Listen for updates:    listen [stop]\n"
       " direct    Enter direct mode\n"
       " state|s   Report bus state\n"
-      " info|i    Report information about the daemon, the configuration, and seen devices.\n"
+      " info|i    Report information about the daemon, the configuration, and seen devices: info [reset|memory]\n"
       " grab|g    Grab messages:         grab [stop]\n"
       "           Report the messages:   grab result [all]\n"
       " define    Define new message:    define [-r] DEFINITION\n"
@@ -1892,7 +2488,113 @@ bool parseBoolQuery(const string& value) {
   return value.length() == 0 || value == "1" || value == "true";
 }
 
-result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostringstream* ostream) {
+/**
+ * Helper for encoding the body of a HTTP response with optional gzip compression and chunked transfer encoding.
+ */
+class HttpBodyEncoder {
+ public:
+  /**
+   * Constructor.
+   * @param chunked whether to use chunked transfer encoding.
+   * @param gzip whether to compress the body with gzip (ignored if not available).
+   */
+  HttpBodyEncoder(bool chunked, bool gzip)
+    : m_chunked(chunked), m_gzip(false) {
+#ifdef HAVE_ZLIB
+    if (gzip) {
+      memset(&m_stream, 0, sizeof(m_stream));
+      // window bits 15 plus 16 for the gzip wrapper
+      m_gzip = deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+#endif
+  }
+
+  /**
+   * Destructor.
+   */
+  ~HttpBodyEncoder() {
+#ifdef HAVE_ZLIB
+    if (m_gzip) {
+      deflateEnd(&m_stream);
+    }
+#endif
+  }
+
+  /**
+   * Return whether the body is gzip compressed.
+   * @return whether the body is gzip compressed.
+   */
+  bool isCompressed() const { return m_gzip; }
+
+  /**
+   * Encode the next part of the body.
+   * @param data the plain data of the next part.
+   * @param final true when this is the last part of the body.
+   * @param output the string to append the encoded part to.
+   */
+  void encode(const string& data, bool final, string* output) {
+    string compressed;
+#ifdef HAVE_ZLIB
+    if (m_gzip) {
+      char buffer[HTTP_CHUNK_SIZE];
+      m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+      m_stream.avail_in = static_cast<uInt>(data.size());
+      do {
+        m_stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        m_stream.avail_out = sizeof(buffer);
+        deflate(&m_stream, final ? Z_FINISH : Z_SYNC_FLUSH);
+        compressed.append(buffer, sizeof(buffer)-m_stream.avail_out);
+      } while (m_stream.avail_out == 0);
+    }
+#endif
+    const string& body = m_gzip ? compressed : data;
+    if (!m_chunked) {
+      output->append(body);
+      return;
+    }
+    if (!body.empty()) {
+      ostringstream size;
+      size << hex << body.size() << "\r\n";
+      output->append(size.str());
+      output->append(body);
+      output->append("\r\n");
+    }
+    if (final) {
+      output->append("0\r\n\r\n");
+    }
+  }
+
+
+ private:
+  /** whether to use chunked transfer encoding. */
+  const bool m_chunked;
+
+  /** whether the body is gzip compressed. */
+  bool m_gzip;
+
+#ifdef HAVE_ZLIB
+  /** the zlib stream for compression. */
+  z_stream m_stream;
+#endif
+};
+
+/**
+ * Return whether the HTTP client accepts a gzip compressed body.
+ * @param httpMessage the @a NetMessage of the HTTP request.
+ * @return whether the HTTP client accepts a gzip compressed body.
+ */
+static bool acceptsGzip(const NetMessage* httpMessage) {
+#ifdef HAVE_ZLIB
+  string encodings = httpMessage->getHttpHeader("accept-encoding");
+  transform(encodings.begin(), encodings.end(), encodings.begin(), ::tolower);
+  return encodings.find("gzip") != string::npos;
+#else
+  return false;
+#endif
+}
+
+result_t MainLoop::executeGet(const vector<string>& args, NetMessage* httpMessage, bool* connected,
+    ClientMode* mode, ostringstream* ostream) {
   bool numeric = false, valueName = false, required = false, full = false, withWrite = false, raw = false;
   bool withDefinition = false;
   OutputFormat verbosity = OF_NAMES;
@@ -1910,7 +2612,7 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
       circuit = uri.substr(6, pos - 6);
       name = uri.substr(pos + 1);
     }
-    time_t since = 0;
+    time_t since = 0, history = -1;
     size_t pollPriority = 0;
     bool exact = false;
     string user;
@@ -1959,6 +2661,8 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
           raw = parseBoolQuery(value);
         } else if (qname == "def") {
           withDefinition = parseBoolQuery(value);
+        } else if (qname == "history") {
+          history = value.empty() ? 0 : parseInt(value.c_str(), 10, 0, 0xffffffff, &ret);
         } else if (qname == "user") {
           user = value;
         } else if (qname == "secret") {
@@ -1973,12 +2677,90 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
       }
     }
 
+    if (ret != RESULT_OK) {
+      return formatHttpResult(ret, type, httpMessage, "", connected, ostream);
+    }
+    if (history >= 0) {
+      // the recent values of the selected fields kept in memory for the last number of seconds (or all)
+      time_t now;
+      time(&now);
+      time_t start = history > 0 && history < now ? now - history : 0;
+      vector<const MessageHistory*> histories;
+      m_historyStore.findAll(circuit, name, &histories);
+      string levels = getUserLevels(user);
+      string lastCircuit, lastName;
+      *ostream << "{";
+      for (const auto entry : histories) {
+        deque<Message*> messages;
+        m_messages->findAll(entry->getCircuit(), entry->getName(), levels, true, true, true, true, true, false, 0, 0,
+            false, &messages);
+        if (messages.empty()) {
+          continue;  // not accessible
+        }
+        bool sameCircuit = entry->getCircuit() == lastCircuit;
+        if (!sameCircuit) {
+          if (!lastCircuit.empty()) {
+            *ostream << "\n    }\n   }\n  }\n },";
+          }
+          lastCircuit = entry->getCircuit();
+          *ostream << "\n \"" << lastCircuit << "\": {\n  \"messages\": {";
+        }
+        if (!sameCircuit || entry->getName() != lastName) {
+          if (sameCircuit) {
+            *ostream << "\n    }\n   },";
+          }
+          lastName = entry->getName();
+          *ostream << "\n   \"" << lastName << "\": {\n    \"history\": {";
+        } else {
+          *ostream << ",";
+        }
+        *ostream << "\n     \"" << (entry->getField().empty() ? "value" : entry->getField()) << "\": ";
+        entry->formatJson(start, ostream);
+      }
+      if (!lastCircuit.empty()) {
+        *ostream << "\n    }\n   }\n  }\n },";
+      }
+      *ostream << "\n \"global\": {"
+               << "\n  \"version\": \"" << PACKAGE_VERSION "." REVISION "\""
+               << ",\n  \"since\": " << static_cast<unsigned>(start)
+               << "\n }"
+               << "\n}";
+      return formatHttpResult(ret, 6, httpMessage, "", connected, ostream);
+    }
+    string etag;
+    if (!required && pollPriority == 0) {
+      // the entity tag changes with every message update and configuration reload
+      ostringstream tag;
+      tag << "\"" << hex << m_messages->getGeneration() << "-" << m_messages->getUpdateCursor() << "-"
+          << std::hash<string>()(uri + "?" + (args.size() > argPos ? args[argPos] : ""))
+          << (m_busHandler->hasSignal() ? "s" : "") << "\"";
+      etag = tag.str();
+    }
+    bool keepAlive = httpMessage->isHttpKeepAlive();
+    if (!etag.empty() && httpMessage->getHttpHeader("if-none-match") == etag) {
+      *connected = keepAlive;
+      formatHttpHeader("304 Not Modified", -1, httpMessage, etag, keepAlive, false, ostream);
+      *ostream << "\r\n\r\n";
+      return RESULT_OK;
+    }
+    // stream the body while it is produced unless the length is needed for keeping a HTTP/1.0 connection
+    bool streamed = httpMessage->isHttp11() || !keepAlive;
+    HttpBodyEncoder encoder(httpMessage->isHttp11(), acceptsGzip(httpMessage));
+    string output;
+    bool outputSent = false;
+    if (streamed) {
+      ostringstream header;
+      formatHttpHeader("200 OK", 6, httpMessage, etag, keepAlive, encoder.isCompressed(), &header);
+      header << (httpMessage->isHttp11() ? "\r\nTransfer-Encoding: chunked" : "") << "\r\n\r\n";
+      output = header.str();
+    }
     *ostream << "{";
     string lastCircuit;
     time_t now;
     time(&now);
     time_t maxLastUp = 0;
-    if (ret == RESULT_OK) {
+    size_t emitted = 0;
+    {
       bool first = true;
       verbosity |= (valueName ? OF_VALUENAME : numeric ? OF_NUMERIC : 0) | OF_JSON | (full ? OF_ALL_ATTRS : 0)
                    | (withDefinition ? OF_DEFINTION : 0);
@@ -2035,6 +2817,23 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
         message->decodeJson(!first, same, raw, verbosity, ostream);
         lastName = name;
         first = false;
+        emitted++;
+        if (streamed && ostream->tellp() >= HTTP_CHUNK_SIZE) {
+          encoder.encode(ostream->str(), false, &output);
+          ostream->str("");
+          httpMessage->addResultChunk(output);
+          output.clear();
+          outputSent = true;
+        }
+      }
+      if (since > 0 && !required && emitted == 0 && !outputSent
+          && !httpMessage->getHttpHeader("if-none-match").empty()) {
+        // nothing changed since the time the client already knows (only for a conditional request with cached data)
+        ostream->str("");
+        *connected = keepAlive;
+        formatHttpHeader("304 Not Modified", -1, httpMessage, etag, keepAlive, false, ostream);
+        *ostream << "\r\n\r\n";
+        return RESULT_OK;
       }
 
       if (lastCircuit.length() > 0) {
@@ -2055,7 +2854,9 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
       *ostream << ",\n  \"signal\": " << (m_busHandler->hasSignal() ? "true" : "false");
       if (m_busHandler->hasSignal()) {
         *ostream << ",\n  \"symbolrate\": " << m_busHandler->getSymbolRate()
-                 << ",\n  \"maxsymbolrate\": " << m_busHandler->getMaxSymbolRate();
+                 << ",\n  \"maxsymbolrate\": " << m_busHandler->getMaxSymbolRate()
+                 << ",\n  \"savedreadcalls\": " << m_busHandler->getSavedReadRate()
+                 << ",\n  \"coalescedreads\": " << m_busHandler->getCoalescedReads();
         if (m_busHandler->getMinArbitrationDelay() >= 0) {
           *ostream << ",\n  \"minarbitrationmicros\": " << m_busHandler->getMinArbitrationDelay()
                    << ",\n  \"minarbitrationmicros\": " << m_busHandler->getMaxArbitrationDelay();
@@ -2064,6 +2865,11 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
           *ostream << ",\n  \"minsymbollatency\": " << m_busHandler->getMinSymbolLatency()
                    << ",\n  \"maxsymbollatency\": " << m_busHandler->getMaxSymbolLatency();
         }
+        *ostream << ",\n  \"timing\": {";
+        m_busHandler->formatTimings(ostream, true);
+        *ostream << "\n  },\n  \"lanes\": {";
+        m_busHandler->formatLanes(ostream, true);
+        *ostream << "\n  }";
       }
       if (!m_device->isReadOnly()) {
         *ostream << ",\n  \"qq\": " << static_cast<unsigned>(m_address);
@@ -2076,10 +2882,65 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
                << "\n}";
       type = 6;
     }
-    *connected = false;
-    return formatHttpResult(ret, type, ostream);
+    if (!streamed) {
+      return formatHttpResult(ret, type, httpMessage, etag, connected, ostream);
+    }
+    encoder.encode(ostream->str(), true, &output);
+    ostream->str("");
+    *ostream << output;
+    *connected = keepAlive;
+    return RESULT_OK;
   }  // request for "/data..."
 
+  if (uri == "/metrics") {
+    MetricsWriter writer(true, ostream);
+    formatMetrics(&writer);
+    return formatHttpResult(RESULT_OK, 11, httpMessage, "", connected, ostream);
+  }
+
+  if (uri == "/memory") {
+    MemoryUsage usage;
+    addMemoryUsage(&usage);
+    MetricsWriter writer(true, ostream);
+    usage.formatMetrics(&writer);
+    return formatHttpResult(RESULT_OK, 11, httpMessage, "", connected, ostream);
+  }
+
+  if (uri.substr(0, 7) == "/events" && (uri.length() == 7 || uri[7] == '/')) {
+    string circuit, name;
+    size_t pos = uri.find('/', 8);
+    if (pos == string::npos) {
+      circuit = uri.length() == 7 ? "" : uri.substr(8);
+    } else {
+      circuit = uri.substr(8, pos - 8);
+      name = uri.substr(pos + 1);
+    }
+    string user, secret;
+    if (args.size() > argPos) {
+      istringstream stream(args[argPos]);
+      string token;
+      while (getline(stream, token, '&')) {
+        pos = token.find('=');
+        string qname = token.substr(0, pos);
+        string value = pos == string::npos ? "" : token.substr(pos + 1);
+        if (qname == "user") {
+          user = value;
+        } else if (qname == "secret") {
+          secret = value;
+        }
+      }
+    }
+    if ((!user.empty() || !secret.empty()) && !m_userList.checkSecret(user, secret)) {
+      return formatHttpResult(RESULT_ERR_NOTAUTHORIZED, type, httpMessage, "", connected, ostream);
+    }
+    // the stream has neither length nor chunks and ends with closing the connection
+    httpMessage->setEventFilter(circuit, name, getUserLevels(user));
+    *mode = cm_events;
+    formatHttpHeader("200 OK", 10, httpMessage, "", false, false, ostream);
+    *ostream << "\r\nCache-Control: no-cache\r\n\r\nretry: 2000\n\n";
+    return RESULT_OK;
+  }  // request for "/events..."
+
   if (uri.length() < 1 || uri[0] != '/' || uri.find("//") != string::npos || uri.find("..") != string::npos) {
     ret = RESULT_ERR_INVALID_ARG;
   } else {
@@ -2123,18 +2984,189 @@ result_t MainLoop::executeGet(const vector<string>& args, bool* connected, ostri
       }
     }
   }
-  *connected = false;
-  return formatHttpResult(ret, type, ostream);
+  return formatHttpResult(ret, type, httpMessage, "", connected, ostream);
+}
+
+result_t MainLoop::executePost(const vector<string>& args, NetMessage* httpMessage, bool* connected,
+    ostringstream* ostream) {
+  const string& uri = args[1];
+  if (uri.substr(0, 5) != "/data" || (uri.length() > 5 && uri[5] != '/')) {
+    return formatHttpResult(RESULT_ERR_NOTFOUND, 6, httpMessage, "", connected, ostream);
+  }
+  string circuit = uri.length() > 6 ? uri.substr(6) : "";
+  string user, secret;
+  if (args.size() > 2) {
+    istringstream stream(args[2]);
+    string token;
+    while (getline(stream, token, '&')) {
+      size_t pos = token.find('=');
+      string qname = token.substr(0, pos);
+      string value = pos == string::npos ? "" : token.substr(pos + 1);
+      if (qname == "user") {
+        user = value;
+      } else if (qname == "secret") {
+        secret = value;
+      }
+    }
+  }
+  if ((!user.empty() || !secret.empty()) && !m_userList.checkSecret(user, secret)) {
+    return formatHttpResult(RESULT_ERR_NOTAUTHORIZED, 6, httpMessage, "", connected, ostream);
+  }
+  const string& body = httpMessage->getHttpBody();
+  if (body.length() != strtoul(httpMessage->getHttpHeader("content-length").c_str(), nullptr, 10)) {
+    // refused due to the size
+    formatHttpResult(RESULT_ERR_INVALID_ARG, 6, httpMessage, "", connected, ostream);
+    *connected = false;
+    return RESULT_OK;
+  }
+  // one entry per line, or additionally separated by "&" when form encoded
+  bool form = httpMessage->getHttpHeader("content-type").find("application/x-www-form-urlencoded") == 0;
+  vector<BatchWrite> writes;
+  string lines = body;
+  if (form) {
+    std::replace(lines.begin(), lines.end(), '&', '\n');
+  }
+  istringstream stream(lines);
+  string entry;
+  while (getline(stream, entry)) {
+    if (!entry.empty() && entry[entry.length() - 1] == '\r') {
+      entry.erase(entry.length() - 1);
+    }
+    if (entry.empty()) {
+      continue;
+    }
+    if (form) {
+      string decoded;
+      for (size_t pos = 0; pos < entry.length(); pos++) {
+        char ch = entry[pos];
+        if (ch == '+') {
+          ch = ' ';
+        } else if (ch == '%' && pos + 2 < entry.length() && isxdigit(static_cast<unsigned char>(entry[pos + 1]))
+            && isxdigit(static_cast<unsigned char>(entry[pos + 2]))) {
+          ch = static_cast<char>(strtoul(entry.substr(pos + 1, 2).c_str(), nullptr, 16));
+          pos += 2;
+        }
+        decoded.push_back(ch);
+      }
+      entry = decoded;
+    }
+    writes.resize(writes.size() + 1);
+    if (!parseBatchWrite(entry, circuit, &writes.back())) {
+      return formatHttpResult(RESULT_ERR_INVALID_ARG, 6, httpMessage, "", connected, ostream);
+    }
+  }
+  if (writes.empty()) {
+    return formatHttpResult(RESULT_ERR_INVALID_ARG, 6, httpMessage, "", connected, ostream);
+  }
+  m_busHandler->writeBatch(getUserLevels(user), SYN, &writes);
+  formatBatchResult(writes, true, ostream);
+  return formatHttpResult(RESULT_OK, 6, httpMessage, "", connected, ostream);
+}
+
+void MainLoop::collectEvents(time_t now) {
+  if (m_eventCursor == 0 || now > m_lastEventCollect + EVENTS_IDLE_TIME) {
+    // skip the updates from the time without any events client
+    m_eventCursor = m_messages->getUpdateCursor();
+  }
+  m_lastEventCollect = now;
+  deque<Message*> messages;
+  if (!m_messages->findUpdates("*", true, &m_eventCursor, &messages)) {
+    logDebug(lf_main, "update journal overrun, some events got lost");
+  }
+  for (const auto message : messages) {
+    ostringstream json;
+    message->decodeJson(false, false, false, OF_NAMES | OF_JSON, &json);
+    string data = json.str();
+    // make it a single line as required for the event data
+    string compact;
+    compact.reserve(data.length());
+    for (size_t pos = 0; pos < data.length(); pos++) {
+      if (data[pos] != '\n') {
+        compact.push_back(data[pos]);
+        continue;
+      }
+      while (pos + 1 < data.length() && data[pos + 1] == ' ') {
+        pos++;
+      }
+    }
+    UpdateEvent event;
+    event.id = m_nextEventId++;
+    event.circuit = &message->getCircuit();
+    event.name = &message->getName();
+    event.level = &message->getLevel();
+    ostringstream payload;
+    payload << "id: " << dec << event.id << "\ndata: {\"" << *event.circuit << "\": {\"messages\": {" << compact
+            << "}}}\n\n";
+    event.payload = payload.str();
+    m_events.push_back(event);
+    if (m_events.size() > UPDATE_EVENTS_SIZE) {
+      m_events.pop_front();
+    }
+  }
 }
 
-result_t MainLoop::formatHttpResult(result_t ret, int type, ostringstream* ostream) {
+void MainLoop::formatEvents(const NetMessage* netMessage, uint64_t* cursor, ostringstream* ostream) const {
+  if (!m_events.empty() && *cursor < m_nextEventId) {
+    const string& circuit = netMessage->getEventCircuit();
+    const string& name = netMessage->getEventName();
+    const string& levels = netMessage->getEventLevels();
+    uint64_t firstId = m_events.front().id;
+    for (size_t pos = *cursor > firstId ? (size_t)(*cursor - firstId) : 0; pos < m_events.size(); pos++) {
+      const UpdateEvent& event = m_events[pos];
+      if ((!circuit.empty() && strcasecmp(circuit.c_str(), event.circuit->c_str()) != 0)
+          || (!name.empty() && strcasecmp(name.c_str(), event.name->c_str()) != 0)
+          || (!event.level->empty() && !Message::checkLevel(*event.level, levels))) {
+        continue;
+      }
+      *ostream << event.payload;
+    }
+  }
+  *cursor = m_nextEventId;
+}
+
+result_t MainLoop::formatHttpResult(result_t ret, int type, const NetMessage* httpMessage, const string& etag,
+    bool* connected, ostringstream* ostream) {
   string data = ret == RESULT_OK ? ostream->str() : "";
   ostream->str("");
   ostream->clear();
-  *ostream << "HTTP/1.0 ";
+  const char* status;
   switch (ret) {
   case RESULT_OK:
-    *ostream << "200 OK\r\nContent-Type: ";
+    status = "200 OK";
+    break;
+  case RESULT_ERR_NOTFOUND:
+    status = "404 Not Found";
+    break;
+  case RESULT_ERR_INVALID_ARG:
+  case RESULT_ERR_INVALID_NUM:
+  case RESULT_ERR_OUT_OF_RANGE:
+    status = "400 Bad Request";
+    break;
+  case RESULT_ERR_NOTAUTHORIZED:
+    status = "403 Forbidden";
+    break;
+  default:
+    status = "500 Internal Server Error";
+    break;
+  }
+  bool keepAlive = httpMessage->isHttpKeepAlive();
+  *connected = keepAlive;
+  // images are compressed already
+  HttpBodyEncoder encoder(false, !data.empty() && type != 3 && type != 4 && acceptsGzip(httpMessage));
+  string body;
+  encoder.encode(data, true, &body);
+  formatHttpHeader(status, ret == RESULT_OK ? type : -1, httpMessage, etag, keepAlive, encoder.isCompressed(),
+      ostream);
+  *ostream << "\r\nContent-Length: " << setw(0) << dec << static_cast<unsigned>(body.length()) << "\r\n\r\n"
+           << body;
+  return RESULT_OK;
+}
+
+void MainLoop::formatHttpHeader(const char* status, int type, const NetMessage* httpMessage, const string& etag,
+    bool keepAlive, bool compressed, ostringstream* ostream) {
+  *ostream << (httpMessage->isHttp11() ? "HTTP/1.1 " : "HTTP/1.0 ") << status;
+  if (type >= 0) {
+    *ostream << "\r\nContent-Type: ";
     switch (type) {
     case 1:
       *ostream << "text/css";
@@ -2160,29 +3192,25 @@ result_t MainLoop::formatHttpResult(result_t ret, int type, ostringstream* ostre
     case 9:
       *ostream << "text/comma-separated-values";
       break;
+    case 10:
+      *ostream << "text/event-stream;charset=utf-8";
+      break;
+    case 11:
+      *ostream << "text/plain;version=0.0.4;charset=utf-8";
+      break;
     default:
       *ostream << "text/html";
       break;
     }
-    *ostream << "\r\nContent-Length: " << setw(0) << dec << static_cast<unsigned>(data.length());
-    break;
-  case RESULT_ERR_NOTFOUND:
-    *ostream << "404 Not Found";
-    break;
-  case RESULT_ERR_INVALID_ARG:
-  case RESULT_ERR_INVALID_NUM:
-  case RESULT_ERR_OUT_OF_RANGE:
-    *ostream << "400 Bad Request";
-    break;
-  case RESULT_ERR_NOTAUTHORIZED:
-    *ostream << "403 Forbidden";
-    break;
-  default:
-    *ostream << "500 Internal Server Error";
-    break;
   }
-  *ostream << "\r\nServer: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n\r\n" << data;
-  return RESULT_OK;
+  if (compressed) {
+    *ostream << "\r\nContent-Encoding: gzip";
+  }
+  if (!etag.empty()) {
+    *ostream << "\r\nETag: " << etag;
+  }
+  *ostream << "\r\nConnection: " << (keepAlive ? "keep-alive" : "close")
+           << "\r\nServer: " PACKAGE_NAME "/" PACKAGE_VERSION;
 }
 
 }  // namespace ebusd
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <list>
+#include <deque>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -29,7 +30,13 @@
 #include "ebusd/network.h"
 #include "lib/ebus/filereader.h"
 #include "lib/ebus/message.h"
+#include "lib/ebus/statefile.h"
+#include "lib/ebus/history.h"
+#include "lib/utils/rawlog.h"
 #include "lib/utils/rotatefile.h"
+#include "lib/utils/ringbuffer.h"
+#include "lib/utils/thread.h"
+#include "lib/utils/metrics.h"
 
 namespace ebusd {
 
@@ -94,18 +101,180 @@ class UserList : public UserInfo, public MappedFileReader {
 };
 
 
+/** the capacity of the ring for passing sent/received symbols from the bus thread to the @a DeviceDataWriter. */
+#define DEVICE_DATA_RING_SIZE 4096
+
+/** A symbol sent or received by the @a Device. */
+struct DeviceData {
+  symbol_t symbol;  //!< the sent/received symbol
+  bool received;  //!< true on reception, false on sending
+  struct timespec time;  //!< the time of reception/sending
+};
+
+/** the maximum number of value update events kept for the server-sent events clients. */
+#define UPDATE_EVENTS_SIZE 1024
+
+/** the number of command types counted separately for the metrics (including HTTP and unknown ones). */
+#define COUNTED_COMMANDS 22
+
+/** A value update event formatted once for all server-sent events clients. */
+struct UpdateEvent {
+  uint64_t id;  //!< the event ID
+  const string* circuit;  //!< the (interned) circuit name of the updated message
+  const string* name;  //!< the (interned) name of the updated message
+  const string* level;  //!< the (interned) access level of the updated message
+  string payload;  //!< the formatted event
+};
+
+class MainLoop;
+
+/**
+ * Helper thread for writing the sent/received symbols to the dump and raw log files outside of the bus thread.
+ */
+class DeviceDataWriter : public WaitThread {
+ public:
+  /**
+   * Constructor.
+   * @param mainLoop the @a MainLoop owning the data to write.
+   */
+  explicit DeviceDataWriter(MainLoop* mainLoop) : WaitThread(), m_mainLoop(mainLoop) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~DeviceDataWriter() {}
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /** the @a MainLoop owning the data to write. */
+  MainLoop* m_mainLoop;
+};
+
+
+/**
+ * Helper thread for handling client requests that only need the cached data in parallel to the @a MainLoop and
+ * passing on all other requests to the @a MainLoop.
+ */
+class CommandWorker : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param mainLoop the @a MainLoop passing the requests.
+   */
+  explicit CommandWorker(MainLoop* mainLoop) : Thread(), m_mainLoop(mainLoop) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~CommandWorker() {}
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /** the @a MainLoop passing the requests. */
+  MainLoop* m_mainLoop;
+};
+
+
+/**
+ * Helper thread for loading the configuration files into a replacement @a MessageMap in the background, while the
+ * current one remains in use by the @a MainLoop, the bus, and the data handlers.
+ */
+class ConfigReloader : public Thread {
+ public:
+  /**
+   * Constructor.
+   * @param messages the current @a MessageMap.
+   * @param busHandler the @a BusHandler for reading messages needed by the instructions.
+   * @param wakeQueue the @a Queue of the @a MainLoop to wake up when done.
+   */
+  ConfigReloader(MessageMap* messages, BusHandler* busHandler, Queue<NetMessage*>* wakeQueue)
+    : Thread(), m_messages(messages), m_busHandler(busHandler), m_wakeQueue(wakeQueue), m_replacement(nullptr),
+      m_result(RESULT_OK), m_finished(false) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~ConfigReloader() {
+    if (m_replacement) {
+      delete m_replacement;
+    }
+  }
+
+  /**
+   * Return whether loading the replacement finished.
+   * @return whether loading the replacement finished.
+   */
+  bool isFinished() const { return m_finished.load(std::memory_order_acquire); }
+
+  /**
+   * Take over the replacement @a MessageMap after @a isFinished() returned true.
+   * @return the replacement @a MessageMap (now owned by the caller).
+   */
+  MessageMap* takeReplacement() {
+    MessageMap* replacement = m_replacement;
+    m_replacement = nullptr;
+    return replacement;
+  }
+
+  /**
+   * Get the result code of loading the replacement after @a isFinished() returned true.
+   * @return the result code.
+   */
+  result_t getResult() const { return m_result; }
+
+
+ protected:
+  // @copydoc
+  void run() override;
+
+
+ private:
+  /** the current @a MessageMap. */
+  MessageMap* m_messages;
+
+  /** the @a BusHandler for reading messages needed by the instructions. */
+  BusHandler* m_busHandler;
+
+  /** the @a Queue of the @a MainLoop to wake up when done. */
+  Queue<NetMessage*>* m_wakeQueue;
+
+  /** the replacement @a MessageMap, or nullptr. */
+  MessageMap* m_replacement;
+
+  /** the result code of loading the replacement. */
+  result_t m_result;
+
+  /** set to true when loading the replacement finished. */
+  atomic<bool> m_finished;
+};
+
+
 /**
  * The main loop handling requests from connected clients.
  */
 class MainLoop : public Thread, DeviceListener {
+  friend class DeviceDataWriter;
+  friend class CommandWorker;
  public:
   /**
    * Construct the main loop and create network and bus handling components.
    * @param opt the program options.
    * @param device the @a Device instance.
    * @param messages the @a MessageMap instance.
+   * @param bus the index of the bus (0 for the first one, further ones use own ports and dump files with an offset
+   * by the index).
    */
-  MainLoop(const struct options& opt, Device *device, MessageMap* messages);
+  MainLoop(const struct options& opt, Device *device, MessageMap* messages, size_t bus = 0);
 
   /**
    * Destructor.
@@ -132,6 +301,12 @@ class MainLoop : public Thread, DeviceListener {
   // @copydoc
   void notifyDeviceData(symbol_t symbol, bool received) override;
 
+  /**
+   * Get the number of sent/received symbols dropped from dump and raw logging due to a full ring.
+   * @return the number of dropped symbols.
+   */
+  size_t getDroppedDeviceData() const { return m_deviceData.getDropped(); }
+
 
  protected:
   // @copydoc
@@ -139,19 +314,43 @@ class MainLoop : public Thread, DeviceListener {
 
 
  private:
+  /**
+   * Return whether the request of the @a NetMessage can be handled from the cached data only (i.e. without accessing
+   * the bus or modifying anything) and thus by a @a CommandWorker.
+   * @param netMessage the @a NetMessage to check.
+   * @return whether the request can be handled from the cached data only.
+   */
+  bool isCacheOnly(NetMessage* netMessage) const;
+
+  /**
+   * Handle the request of the @a NetMessage and set the result.
+   * @param netMessage the @a NetMessage to handle.
+   */
+  void handleNetMessage(NetMessage* netMessage);
+
+  /**
+   * Swap in the replacement @a MessageMap of a finished @a ConfigReloader.
+   * @return true when the configuration files were reloaded.
+   */
+  bool finishReload();
+
+  /**
+   * Store the last seen data, the seen participants, and the scan results in the @a StateFile and write it.
+   */
+  void writeState();
+
   /**
    * Decode and execute client message.
    * @param data the data string to decode (may be empty).
    * @param connected set to false when the client connection shall be closed.
-   * @param isHttp true for HTTP message.
+   * @param httpMessage the @a NetMessage of a HTTP request, or nullptr for a client message.
    * @param mode set to the new client mode.
    * @param user set to the new user name when changed by authentication.
-   * @param reload set to true when the configuration files were reloaded.
    * @param ostream the @a ostringstream to format the result string to.
    * @return the result code.
    */
-  result_t decodeMessage(const string& data, bool isHttp, bool* connected, ClientMode* mode,
-      string* user, bool* reload, ostringstream* ostream);
+  result_t decodeMessage(const string& data, NetMessage* httpMessage, bool* connected, ClientMode* mode,
+      string* user, ostringstream* ostream);
 
   /**
    * Parse the hex master message from the remaining arguments.
@@ -209,6 +408,14 @@ class MainLoop : public Thread, DeviceListener {
    */
   result_t parseHexAndSend(const vector<string>& args, size_t& argPos, bool isDirectMode, ostringstream* ostream);
 
+  /**
+   * Format the results of a batch write.
+   * @param writes the @a BatchWrite instances passed to @a BusHandler::writeBatch().
+   * @param asJson true for a JSON object, false for one line per write.
+   * @param ostream the @a ostringstream to format the results to.
+   */
+  void formatBatchResult(const vector<BatchWrite>& writes, bool asJson, ostringstream* ostream);
+
   /**
    * Execute the hex command.
    * @param args the arguments passed to the command (starting with the command itself), or empty for help.
@@ -334,6 +541,18 @@ class MainLoop : public Thread, DeviceListener {
    */
   result_t executeInfo(const vector<string>& args, const string& user, ostringstream* ostream);
 
+  /**
+   * Format the performance counters of all subsystems as metrics.
+   * @param writer the @a MetricsWriter to write to.
+   */
+  void formatMetrics(MetricsWriter* writer);
+
+  /**
+   * Collect the approximate memory used by the configuration and runtime state.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage);
+
   /**
    * Execute the quit command.
    * @param args the arguments passed to the command (starting with the command itself), or empty for help.
@@ -353,20 +572,76 @@ class MainLoop : public Thread, DeviceListener {
   /**
    * Execute the HTTP GET command.
    * @param args the arguments passed to the command (starting with the command itself).
+   * @param httpMessage the @a NetMessage of the HTTP request (used for the headers and for streaming the result).
+   * @param connected set to false when the client connection shall be closed.
+   * @param mode set to the new client mode.
+   * @param ostream the @a ostringstream to format the result string to.
+   * @return the result code.
+   */
+  result_t executeGet(const vector<string>& args, NetMessage* httpMessage, bool* connected, ClientMode* mode,
+      ostringstream* ostream);
+
+  /**
+   * Execute the HTTP POST command for writing several messages back to back.
+   * @param args the arguments passed to the command (starting with the command itself).
+   * @param httpMessage the @a NetMessage of the HTTP request (used for the headers and the body).
    * @param connected set to false when the client connection shall be closed.
    * @param ostream the @a ostringstream to format the result string to.
    * @return the result code.
    */
-  result_t executeGet(const vector<string>& args, bool* connected, ostringstream* ostream);
+  result_t executePost(const vector<string>& args, NetMessage* httpMessage, bool* connected,
+      ostringstream* ostream);
+
+  /**
+   * Format the value updates of all messages updated since the last call into the shared server-sent events.
+   * @param now the current time.
+   */
+  void collectEvents(time_t now);
+
+  /**
+   * Add the server-sent events matching the filter of the @a NetMessage to the result.
+   * @param netMessage the @a NetMessage of the server-sent events client.
+   * @param cursor the ID of the next event to add, updated to the ID following the last available event.
+   * @param ostream the @a ostringstream to format the events to.
+   */
+  void formatEvents(const NetMessage* netMessage, uint64_t* cursor, ostringstream* ostream) const;
+
+  /**
+   * Write all pending sent/received symbols to the dump and raw log (called by @a m_deviceDataWriter).
+   */
+  void writeDeviceData();
+
+  /**
+   * Write a single sent/received symbol to the dump and raw log.
+   * @param data the @a DeviceData to write.
+   */
+  void writeDeviceData(const DeviceData& data);
 
   /**
    * Format the HTTP answer to the result string.
    * @param ret the result code of handling the request.
    * @param type the content type.
-   * @param ostream the @a ostringstream to format the result string to.
+   * @param httpMessage the @a NetMessage of the HTTP request.
+   * @param etag the entity tag of the result, or empty.
+   * @param connected set to false when the client connection shall be closed.
+   * @param ostream the @a ostringstream containing the body and to format the result string to.
    * @return the result code.
    */
-  result_t formatHttpResult(result_t ret, int type, ostringstream* ostream);
+  result_t formatHttpResult(result_t ret, int type, const NetMessage* httpMessage, const string& etag,
+      bool* connected, ostringstream* ostream);
+
+  /**
+   * Format the HTTP status line and headers (without the terminating empty line and the length of the body).
+   * @param status the HTTP status code and reason phrase.
+   * @param type the content type, or -1 for none.
+   * @param httpMessage the @a NetMessage of the HTTP request.
+   * @param etag the entity tag of the result, or empty.
+   * @param keepAlive whether the connection is kept open for further requests.
+   * @param compressed whether the body is gzip compressed.
+   * @param ostream the @a ostringstream to format the headers to.
+   */
+  void formatHttpHeader(const char* status, int type, const NetMessage* httpMessage, const string& etag,
+      bool keepAlive, bool compressed, ostringstream* ostream);
 
   /** the @a Device instance. */
   Device* m_device;
@@ -374,6 +649,12 @@ class MainLoop : public Thread, DeviceListener {
   /** the number of reconnects requested from the @a Device. */
   unsigned int m_reconnectCount;
 
+  /** the number of reads answered from the cache (by any thread). */
+  SharedCounter m_cacheReads;
+
+  /** the number of client requests by command (by any thread). */
+  SharedCounter m_commandRequests[COUNTED_COMMANDS];
+
   /** the @a RotateFile for writing sent/received bytes in log format, or nullptr. */
   RotateFile* m_logRawFile;
 
@@ -392,15 +673,51 @@ class MainLoop : public Thread, DeviceListener {
   /** the last sent/received symbol.*/
   symbol_t m_logRawLastSymbol;
 
+  /** the @a RawLogWriter for writing sent/received telegrams in binary format, or nullptr. */
+  RawLogWriter* m_logRawBinary;
+
+  /** the symbols since the last SYN for @a m_logRawBinary. */
+  vector<uint8_t> m_logRawSymbols;
+
+  /** whether the symbol at the same position in @a m_logRawSymbols was sent. */
+  vector<bool> m_logRawSent;
+
+  /** the time of the first symbol in @a m_logRawSymbols. */
+  struct timespec m_logRawTime;
+
   /** the @a RotateFile for dumping received data, or nullptr. */
   RotateFile* m_dumpFile;
 
+  /** whether to write timed dump records to @a m_dumpFile. */
+  const bool m_dumpTimed;
+
+  /** the time of the last symbol written to @a m_dumpFile (tv_sec 0 if none yet). */
+  struct timespec m_dumpLastTime;
+
+  /** the @a StateFile for keeping the last seen data across a restart. */
+  StateFile m_stateFile;
+
+  /** the @a HistoryStore for keeping the recent values of the selected fields. */
+  HistoryStore m_historyStore;
+
+  /** the sent/received symbols passed from the bus thread to @a m_deviceDataWriter. */
+  RingBuffer<DeviceData> m_deviceData;
+
+  /** the @a DeviceDataWriter for writing the dump and raw log. */
+  DeviceDataWriter* m_deviceDataWriter;
+
+  /** the @a Mutex for exclusive access to the dump and raw log settings. */
+  Mutex m_deviceDataMutex;
+
   /** the @a UserList instance. */
   UserList m_userList;
 
   /** the @a MessageMap instance. */
   MessageMap* m_messages;
 
+  /** the index of the bus (0 for the first one). */
+  const size_t m_bus;
+
   /** the own master address for sending on the bus. */
   const symbol_t m_address;
 
@@ -417,6 +734,9 @@ class MainLoop : public Thread, DeviceListener {
   /** whether to enable the hex command. */
   const bool m_enableHex;
 
+  /** the @a ConfigReloader currently loading the configuration files in the background, or nullptr. */
+  ConfigReloader* m_configReloader;
+
   /** the MessageMap for handling newly defined messages for testing (if enabled), or nullptr. */
   MessageMap* m_newlyDefinedMessages;
 
@@ -435,6 +755,12 @@ class MainLoop : public Thread, DeviceListener {
   /** the @a NetMessage @a Queue. */
   Queue<NetMessage*> m_netQueue;
 
+  /** the @a CommandWorker instances. */
+  vector<CommandWorker*> m_workers;
+
+  /** the @a Queue of @a NetMessage instances passed on by the @a CommandWorker instances to the main loop itself. */
+  Queue<NetMessage*> m_mainQueue;
+
   /** the path for HTML files served by the HTTP port. */
   string m_htmlPath;
 
@@ -443,6 +769,18 @@ class MainLoop : public Thread, DeviceListener {
 
   /** the result of the last update check, or empty. */
   string m_updateCheck;
+
+  /** the formatted value update events for the server-sent events clients (oldest first). */
+  deque<UpdateEvent> m_events;
+
+  /** the ID of the next value update event. */
+  uint64_t m_nextEventId;
+
+  /** the update journal cursor from which to collect the next value update events. */
+  uint64_t m_eventCursor;
+
+  /** the time of the last collection of value update events. */
+  time_t m_lastEventCollect;
 };
 
 }  // namespace ebusd
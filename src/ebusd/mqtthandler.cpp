@@ -22,11 +22,14 @@
 
 #include "ebusd/mqtthandler.h"
 #include <csignal>
+#include <cctype>
+#include <cstring>
 #include "lib/utils/log.h"
 
 namespace ebusd {
 
 using std::dec;
+using std::make_pair;
 
 #define O_HOST 1
 #define O_PORT (O_HOST+1)
@@ -40,7 +43,8 @@ using std::dec;
 #define O_VERS (O_LOGL+1)
 #define O_IGIN (O_VERS+1)
 #define O_CHGS (O_IGIN+1)
-#define O_CAFI (O_CHGS+1)
+#define O_QUEU (O_CHGS+1)
+#define O_CAFI (O_QUEU+1)
 #define O_CERT (O_CAFI+1)
 #define O_KEYF (O_CERT+1)
 #define O_KEPA (O_KEYF+1)
@@ -67,6 +71,7 @@ static const struct argp_option g_mqtt_argp_options[] = {
   {"mqttignoreinvalid", O_IGIN, nullptr, 0,
    "Ignore invalid parameters during init (e.g. for DNS not resolvable yet)", 0 },
   {"mqttchanges", O_CHGS, nullptr,       0, "Whether to only publish changed messages instead of all received", 0 },
+  {"mqttqueue",   O_QUEU, "COUNT",       0, "Queue at most COUNT topic updates for publishing [1000]", 0 },
 
 #if (LIBMOSQUITTO_MAJOR >= 1)
   {"mqttca",      O_CAFI, "CA",          0, "Use CA file or dir (ending with '/') for MQTT TLS (no default)", 0 },
@@ -97,6 +102,7 @@ static int g_version = MQTT_PROTOCOL_V31;  //!< protocol version to use
 #endif
 static bool g_ignoreInvalidParams = false;  //!< ignore invalid parameters during init
 static bool g_onlyChanges = false;        //!< whether to only publish changed messages instead of all received
+static size_t g_maxQueue = 1000;          //!< the maximum number of queued topic updates
 
 #if (LIBMOSQUITTO_MAJOR >= 1)
 static const char* g_cafile = nullptr;    //!< CA file for TLS
@@ -200,6 +206,14 @@ static error_t mqtt_parse_opt(int key, char *arg, struct argp_state *state) {
     g_onlyChanges = true;
     break;
 
+  case O_QUEU:  // --mqttqueue=1000
+    g_maxQueue = parseInt(arg, 10, 1, 1000000, &result);
+    if (result != RESULT_OK) {
+      argp_error(state, "invalid mqttqueue");
+      return EINVAL;
+    }
+    break;
+
 #if (LIBMOSQUITTO_MAJOR >= 1)
     case O_CAFI:  // --mqttca=file or --mqttca=dir/
       if (arg == nullptr || arg[0] == 0) {
@@ -276,7 +290,7 @@ bool check(int code, const char* method) {
   return false;
 }
 
-bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus,
     list<DataHandler*>* handlers) {
   if (g_port > 0) {
     int major = -1;
@@ -289,7 +303,7 @@ bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap
     }
     logOtherInfo("mqtt", "mosquitto version %d.%d.%d (compiled with %d.%d.%d)", major, minor, revision,
       LIBMOSQUITTO_MAJOR, LIBMOSQUITTO_MINOR, LIBMOSQUITTO_REVISION);
-    handlers->push_back(new MqttHandler(userInfo, busHandler, messages));
+    handlers->push_back(new MqttHandler(userInfo, busHandler, messages, bus));
   }
   return true;
 }
@@ -423,9 +437,11 @@ void on_message(
 }
 
 
-MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages)
+MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus)
   : DataSink(userInfo, "mqtt"), DataSource(busHandler), WaitThread(), m_messages(messages), m_connected(false),
-    m_initialConnectFailed(false), m_lastUpdateCheckResult("."), m_lastErrorLogTime(0) {
+    m_initialConnectFailed(false), m_lastUpdateCheckResult("."), m_lastErrorLogTime(0), m_topicGeneration(0),
+    m_maxQueueDepth(0),
+    m_publishedTopics(0), m_mergedTopics(0), m_droppedTopics(0) {
   m_publishByField = false;
   m_mosquitto = nullptr;
   if (g_topicFields.empty()) {
@@ -448,6 +464,10 @@ MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap*
       }
     }
   }
+  m_topicStrs = g_topicStrs;
+  if (bus > 0) {
+    m_topicStrs[0] += "bus" + std::to_string(bus+1) + "/";  // separate namespace for the further buses
+  }
   m_globalTopic = getTopic(nullptr, "global/");
   m_subscribeTopic = getTopic(nullptr, "#");
   if (check(mosquitto_lib_init(), "unable to initialize")) {
@@ -458,6 +478,9 @@ MqttHandler::MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap*
     } else {
       clientId << PACKAGE_NAME << '_' << PACKAGE_VERSION << '_' << static_cast<unsigned>(getpid());
     }
+    if (bus > 0) {
+      clientId << '_' << static_cast<unsigned>(bus+1);
+    }
 #if (LIBMOSQUITTO_MAJOR >= 1)
     m_mosquitto = mosquitto_new(clientId.str().c_str(), true, this);
 #else
@@ -553,6 +576,10 @@ void MqttHandler::notifyConnected() {
 }
 
 void MqttHandler::notifyTopic(const string& topic, const string& data) {
+  if (topic == m_globalTopic+"set") {
+    notifyBatchTopic(data);
+    return;
+  }
   size_t pos = topic.rfind('/');
   if (pos == string::npos) {
     return;
@@ -568,61 +595,20 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
   }
 
   logOtherDebug("mqtt", "received topic %s with data %s", topic.c_str(), data.c_str());
-  string remain = topic.substr(0, pos);
-  size_t last = 0;
+  Message* message = nullptr;
   string circuit, name;
-  bool finalField = false;
-  for (size_t idx = 0; idx < g_topicStrs.size()+1 && !finalField; idx++) {
-    string field;
-    string chk;
-    if (idx < g_topicStrs.size()) {
-      chk = g_topicStrs[idx];
-      pos = remain.find(chk, last);
-      if (pos == string::npos) {
-        if (!isList) {
-          return;
-        }
-        if (idx == 0 && remain+"/" == chk) {  // check for only first prefix, e.g. "ebusd/"
-          break;
-        }
-        pos = remain.size();
-        finalField = true;
-      }
-    } else if (idx-1 < g_topicFields.size()) {
-      pos = remain.size();
-    } else if (last < remain.size()) {
-      if (!isList) {
-        return;
-      }
-      break;
-    } else {
-      break;
-    }
-    field = remain.substr(last, pos-last);
-    last = pos+chk.size();
-    if (idx == 0) {
-      if (pos > 0) {
-        return;
-      }
-    } else {
-      if (field.empty()) {
-        if (!isList) {
-          return;
-        }
-        continue;
-      }
-      string fieldName = g_topicFields[idx-1];
-      if (fieldName == "circuit") {
-        circuit = field;
-      } else if (fieldName == "name") {
-        name = field;
-      } else if (fieldName == "field") {
-        // field = field;  // TODO add support for writing a single field
-      } else {
-        return;
-      }
+  if (!isList) {
+    checkTopicCache();
+    const auto it = m_topicMessages.find(topic);
+    if (it != m_topicMessages.end()) {
+      message = it->second;
+      circuit = message->getCircuit();
+      name = message->getName();
     }
   }
+  if (!message && !parseTopicNames(topic.substr(0, pos), isList, &circuit, &name)) {
+    return;
+  }
   if (isList) {
     logOtherInfo("mqtt", "received list topic for %s %s", circuit.c_str(), name.c_str());
     deque<Message*> messages;
@@ -642,13 +628,16 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
     return;
   }
   logOtherInfo("mqtt", "received %s topic for %s %s", direction.c_str(), circuit.c_str(), name.c_str());
-  Message* message = m_messages->find(circuit, name, m_levels, isWrite);
-  if (message == nullptr) {
-    message = m_messages->find(circuit, name, m_levels, isWrite, true);
-  }
   if (message == nullptr) {
-    logOtherError("mqtt", "%s message %s %s not found", isWrite?"write":"read", circuit.c_str(), name.c_str());
-    return;
+    message = m_messages->find(circuit, name, m_levels, isWrite);
+    if (message == nullptr) {
+      message = m_messages->find(circuit, name, m_levels, isWrite, true);
+    }
+    if (message == nullptr) {
+      logOtherError("mqtt", "%s message %s %s not found", isWrite?"write":"read", circuit.c_str(), name.c_str());
+      return;
+    }
+    m_topicMessages[topic] = message;
   }
   if (!message->isPassive()) {
     string useData = data;
@@ -681,6 +670,234 @@ void MqttHandler::notifyTopic(const string& topic, const string& data) {
   publishMessage(message, &ostream);
 }
 
+/**
+ * Skip the whitespace in a JSON string.
+ * @param str the JSON string.
+ * @param pos the position in the string, updated to the next non whitespace character.
+ */
+static void skipJsonSpace(const string& str, size_t* pos) {
+  while (*pos < str.length() && isspace(static_cast<unsigned char>(str[*pos]))) {
+    (*pos)++;
+  }
+}
+
+/**
+ * Parse a JSON string or a plain JSON value (number, boolean, or null).
+ * @param str the JSON string.
+ * @param pos the position in the string, updated to the character after the value.
+ * @param value the variable in which to store the (unquoted) value.
+ * @return true on success, false if no valid value was found.
+ */
+static bool parseJsonValue(const string& str, size_t* pos, string* value) {
+  skipJsonSpace(str, pos);
+  value->clear();
+  if (*pos >= str.length()) {
+    return false;
+  }
+  if (str[*pos] != '"') {
+    while (*pos < str.length() && strchr(",}] \t\r\n", str[*pos]) == nullptr) {
+      value->push_back(str[(*pos)++]);
+    }
+    return !value->empty() && *value != "null";
+  }
+  for ((*pos)++; *pos < str.length(); (*pos)++) {
+    char ch = str[*pos];
+    if (ch == '"') {
+      (*pos)++;
+      return true;
+    }
+    if (ch == '\\' && *pos+1 < str.length()) {
+      ch = str[++(*pos)];
+      if (ch == 'n') {
+        ch = '\n';
+      } else if (ch == 't') {
+        ch = '\t';
+      }
+    }
+    value->push_back(ch);
+  }
+  return false;
+}
+
+/**
+ * Parse a JSON object with "CIRCUIT/NAME": VALUE or "CIRCUIT": {"NAME": VALUE} members into @a BatchWrite instances.
+ * Multiple field values can be passed as JSON array.
+ * @param str the JSON string.
+ * @param pos the position in the string, updated to the character after the object.
+ * @param circuit the circuit name of a nested object, or empty for the outer object.
+ * @param writes the @a BatchWrite instances to add to.
+ * @return true on success, false on invalid JSON.
+ */
+static bool parseBatchJson(const string& str, size_t* pos, const string& circuit, vector<BatchWrite>* writes) {
+  skipJsonSpace(str, pos);
+  if (*pos >= str.length() || str[*pos] != '{') {
+    return false;
+  }
+  (*pos)++;
+  skipJsonSpace(str, pos);
+  if (*pos < str.length() && str[*pos] == '}') {
+    (*pos)++;
+    return true;
+  }
+  while (*pos < str.length()) {
+    string key;
+    skipJsonSpace(str, pos);
+    if (*pos >= str.length() || str[*pos] != '"' || !parseJsonValue(str, pos, &key)) {
+      return false;
+    }
+    skipJsonSpace(str, pos);
+    if (*pos >= str.length() || str[*pos] != ':') {
+      return false;
+    }
+    (*pos)++;
+    skipJsonSpace(str, pos);
+    if (*pos >= str.length()) {
+      return false;
+    }
+    if (str[*pos] == '{') {
+      if (!circuit.empty() || !parseBatchJson(str, pos, key, writes)) {
+        return false;
+      }
+    } else {
+      BatchWrite write;
+      write.message = nullptr;
+      write.result = RESULT_ERR_INVALID_ARG;
+      write.circuit = circuit;
+      write.name = key;
+      if (circuit.empty()) {
+        size_t sep = key.find('/');
+        if (sep == string::npos) {
+          return false;
+        }
+        write.circuit = key.substr(0, sep);
+        write.name = key.substr(sep+1);
+      }
+      if (str[*pos] == '[') {
+        (*pos)++;
+        string value;
+        while (parseJsonValue(str, pos, &value)) {
+          if (!write.input.empty()) {
+            write.input += UI_FIELD_SEPARATOR;
+          }
+          write.input += value;
+          skipJsonSpace(str, pos);
+          if (*pos >= str.length() || str[*pos] != ',') {
+            break;
+          }
+          (*pos)++;
+        }
+        skipJsonSpace(str, pos);
+        if (*pos >= str.length() || str[*pos] != ']') {
+          return false;
+        }
+        (*pos)++;
+      } else if (!parseJsonValue(str, pos, &write.input)) {
+        return false;
+      }
+      writes->push_back(write);
+    }
+    skipJsonSpace(str, pos);
+    if (*pos >= str.length()) {
+      return false;
+    }
+    if (str[*pos] == '}') {
+      (*pos)++;
+      return true;
+    }
+    if (str[*pos] != ',') {
+      return false;
+    }
+    (*pos)++;
+  }
+  return false;
+}
+
+void MqttHandler::notifyBatchTopic(const string& data) {
+  logOtherDebug("mqtt", "received batch topic with data %s", data.c_str());
+  vector<BatchWrite> writes;
+  size_t pos = 0;
+  if (!parseBatchJson(data, &pos, "", &writes) || writes.empty()) {
+    logOtherError("mqtt", "invalid batch write data %s", data.c_str());
+    return;
+  }
+  m_busHandler->writeBatch(m_levels, SYN, &writes);
+  ostringstream result;
+  result << "{";
+  bool first = true;
+  for (const auto& write : writes) {
+    result << (first ? "" : ",") << "\"" << write.circuit << "/" << write.name << "\":\"";
+    first = false;
+    if (write.result == RESULT_OK) {
+      result << "done\"";
+      ostringstream ostream;
+      publishMessage(write.message, &ostream);
+    } else {
+      result << getResultCode(write.result) << "\"";
+      logOtherError("mqtt", "write %s %s: %s", write.circuit.c_str(), write.name.c_str(),
+          getResultCode(write.result));
+    }
+  }
+  result << "}";
+  publishTopic(m_globalTopic+"set/result", result.str());
+}
+
+bool MqttHandler::parseTopicNames(const string& remain, bool isList, string* circuit, string* name) const {
+  size_t pos, last = 0;
+  bool finalField = false;
+  for (size_t idx = 0; idx < m_topicStrs.size()+1 && !finalField; idx++) {
+    string field;
+    string chk;
+    if (idx < m_topicStrs.size()) {
+      chk = m_topicStrs[idx];
+      pos = remain.find(chk, last);
+      if (pos == string::npos) {
+        if (!isList) {
+          return false;
+        }
+        if (idx == 0 && remain+"/" == chk) {  // check for only first prefix, e.g. "ebusd/"
+          break;
+        }
+        pos = remain.size();
+        finalField = true;
+      }
+    } else if (idx-1 < g_topicFields.size()) {
+      pos = remain.size();
+    } else if (last < remain.size()) {
+      if (!isList) {
+        return false;
+      }
+      break;
+    } else {
+      break;
+    }
+    field = remain.substr(last, pos-last);
+    last = pos+chk.size();
+    if (idx == 0) {
+      if (pos > 0) {
+        return false;
+      }
+    } else {
+      if (field.empty()) {
+        if (!isList) {
+          return false;
+        }
+        continue;
+      }
+      string fieldName = g_topicFields[idx-1];
+      if (fieldName == "circuit") {
+        *circuit = field;
+      } else if (fieldName == "name") {
+        *name = field;
+      } else if (fieldName == "field") {
+        // field = field;  // TODO add support for writing a single field
+      } else {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 void MqttHandler::notifyUpdateCheckResult(const string& checkResult) {
   if (checkResult != m_lastUpdateCheckResult) {
     m_lastUpdateCheckResult = checkResult;
@@ -689,6 +906,27 @@ void MqttHandler::notifyUpdateCheckResult(const string& checkResult) {
   }
 }
 
+void MqttHandler::formatInfo(ostringstream* output) {
+  m_queueMutex.lock();
+  *output << "\nmqtt queue: " << m_queuedTopics.size()
+          << "\nmqtt queue max: " << m_maxQueueDepth
+          << "\nmqtt published: " << m_publishedTopics
+          << "\nmqtt merged: " << m_mergedTopics
+          << "\nmqtt dropped: " << m_droppedTopics;
+  m_queueMutex.unlock();
+}
+
+void MqttHandler::formatMetrics(MetricsWriter* writer) {
+  m_queueMutex.lock();
+  writer->family("ebusd_mqtt_queue_depth", false, "mqtt queue");
+  writer->sample(static_cast<uint64_t>(m_queuedTopics.size()));
+  writer->family("ebusd_mqtt_topics_total", true, "mqtt topics");
+  writer->sample(static_cast<uint64_t>(m_publishedTopics), "result", "published");
+  writer->sample(static_cast<uint64_t>(m_mergedTopics), "result", "merged");
+  writer->sample(static_cast<uint64_t>(m_droppedTopics), "result", "dropped");
+  m_queueMutex.unlock();
+}
+
 void MqttHandler::run() {
   time_t lastTaskRun, now, start, lastSignal = 0, lastUpdates = 0;
   bool signal = false;
@@ -699,7 +937,9 @@ void MqttHandler::run() {
   time(&now);
   start = lastTaskRun = now;
   bool allowReconnect = false;
+  size_t readerSlot = m_messages->registerReader();
   while (isRunning()) {
+    m_messages->passQuiescentState(readerSlot);  // no longer referencing any retired message
     bool wasConnected = m_connected;
     bool needsWait = handleTraffic(allowReconnect);
     bool reconnected = !wasConnected && m_connected;
@@ -738,8 +978,9 @@ void MqttHandler::run() {
     }
     if (!m_updatedMessages.empty()) {
       if (m_connected) {
-        m_messages->lock();
-        for (auto it = m_updatedMessages.begin(); it != m_updatedMessages.end(); ) {
+        m_messages->lockShared();
+        // decode into the queue while holding the shared lock and keep remaining updates for later when it is full
+        for (auto it = m_updatedMessages.begin(); it != m_updatedMessages.end() && !isQueueFull(); ) {
           const vector<Message*>* messages = m_messages->getByKey(it->first);
           if (messages) {
             updates.str("");
@@ -754,17 +995,25 @@ void MqttHandler::run() {
           }
           it = m_updatedMessages.erase(it);
         }
-        m_messages->unlock();
-        time(&lastUpdates);
+        m_messages->unlockShared();
+        if (m_updatedMessages.empty()) {
+          // only advance once all deferred updates got checked against the previous time
+          time(&lastUpdates);
+        }
       } else {
         m_updatedMessages.clear();
       }
     }
+    if (m_connected) {
+      flushTopics();
+    }
     if ((!m_connected && !Wait(5)) || (needsWait && !Wait(1))) {
       break;
     }
   }
+  m_messages->unregisterReader(readerSlot);
   publishTopic(signalTopic, "false", true);
+  flushTopics();
 }
 
 bool MqttHandler::handleTraffic(bool allowReconnect) {
@@ -816,10 +1065,35 @@ bool MqttHandler::handleTraffic(bool allowReconnect) {
   return true;
 }
 
+void MqttHandler::checkTopicCache() {
+  size_t generation = m_messages->getGeneration();
+  if (generation != m_topicGeneration) {
+    m_topicGeneration = generation;
+    m_messageTopics.clear();
+    m_topicMessages.clear();
+  }
+}
+
+const vector<string>& MqttHandler::getMessageTopics(const Message* message) {
+  checkTopicCache();
+  const auto it = m_messageTopics.find(message);
+  if (it != m_messageTopics.end()) {
+    return it->second;
+  }
+  vector<string>& topics = m_messageTopics[message];
+  topics.push_back(getTopic(message));
+  if (m_publishByField) {
+    for (size_t index = 0; index < message->getFieldCount(); index++) {
+      topics.push_back(getTopic(message, "", message->getFieldName(index)));
+    }
+  }
+  return topics;
+}
+
 string MqttHandler::getTopic(const Message* message, const string& suffix, const string& fieldName) {
   ostringstream ret;
-  for (size_t i = 0; i < g_topicStrs.size(); i++) {
-    ret << g_topicStrs[i];
+  for (size_t i = 0; i < m_topicStrs.size(); i++) {
+    ret << m_topicStrs[i];
     if (!message) {
       break;
     }
@@ -841,9 +1115,10 @@ void MqttHandler::publishMessage(const Message* message, ostringstream* updates,
   OutputFormat outputFormat = g_publishFormat;
   bool json = outputFormat & OF_JSON;
   bool noData = includeWithoutData && message->getLastUpdateTime() == 0;
+  const vector<string>& topics = getMessageTopics(message);
   if (!m_publishByField) {
     if (noData) {
-      publishEmptyTopic(getTopic(message));  // alternatively: , json ? "null" : "");
+      publishEmptyTopic(topics[0]);  // alternatively: , json ? "null" : "");
       return;
     }
     if (json) {
@@ -858,43 +1133,88 @@ void MqttHandler::publishMessage(const Message* message, ostringstream* updates,
     if (json) {
       *updates << "}";
     }
-    publishTopic(getTopic(message), updates->str());
+    publishTopic(topics[0], updates->str());
     return;
   }
   if (json) {
     outputFormat |= OF_SHORT;
   }
-  for (size_t index = 0; index < message->getFieldCount(); index++) {
-    string name = message->getFieldName(index);
+  for (size_t index = 0; index < message->getFieldCount() && index+1 < topics.size(); index++) {
     if (noData) {
-      publishEmptyTopic(getTopic(message, "", name));  // alternatively: , json ? "null" : "");
+      publishEmptyTopic(topics[index+1]);  // alternatively: , json ? "null" : "");
       continue;
     }
     result_t result = message->decodeLastData(false, nullptr, index, outputFormat, updates);
     if (result != RESULT_OK) {
       logOtherError("mqtt", "decode %s %s %s: %s", message->getCircuit().c_str(), message->getName().c_str(),
-          name.c_str(), getResultCode(result));
+          message->getFieldName(index).c_str(), getResultCode(result));
       return;
     }
-    publishTopic(getTopic(message, "", name), updates->str());
+    publishTopic(topics[index+1], updates->str());
     updates->str("");
     updates->clear();
   }
 }
 
 void MqttHandler::publishTopic(const string& topic, const string& data, bool retain) {
-  const char* topicStr = topic.c_str();
-  const char* dataStr = data.c_str();
-  const size_t len = strlen(dataStr);
-  logOtherDebug("mqtt", "publish %s %s", topicStr, dataStr);
-  check(mosquitto_publish(m_mosquitto, nullptr, topicStr, (uint32_t)len,
-      reinterpret_cast<const uint8_t*>(dataStr), 0, g_retain || retain), "publish");
+  queueTopic(topic, data, g_retain || retain);
 }
 
 void MqttHandler::publishEmptyTopic(const string& topic) {
-  const char* topicStr = topic.c_str();
-  logOtherDebug("mqtt", "publish empty %s", topicStr);
-  check(mosquitto_publish(m_mosquitto, nullptr, topicStr, 0, nullptr, 0, g_retain), "publish empty");
+  queueTopic(topic, "", g_retain);
+}
+
+void MqttHandler::queueTopic(const string& topic, const string& data, bool retain) {
+  m_queueMutex.lock();
+  auto it = m_queuedData.find(topic);
+  if (it != m_queuedData.end()) {
+    it->second = make_pair(data, retain);  // newest value wins
+    m_mergedTopics++;
+    m_queueMutex.unlock();
+    return;
+  }
+  if (m_queuedTopics.size() >= g_maxQueue) {
+    m_queuedData.erase(m_queuedTopics.front());
+    m_queuedTopics.pop_front();
+    m_droppedTopics++;
+  }
+  m_queuedTopics.push_back(topic);
+  m_queuedData[topic] = make_pair(data, retain);
+  if (m_queuedTopics.size() > m_maxQueueDepth) {
+    m_maxQueueDepth = m_queuedTopics.size();
+  }
+  m_queueMutex.unlock();
+}
+
+bool MqttHandler::isQueueFull() {
+  m_queueMutex.lock();
+  bool ret = m_queuedTopics.size() >= g_maxQueue;
+  m_queueMutex.unlock();
+  return ret;
+}
+
+void MqttHandler::flushTopics() {
+  deque<string> topics;
+  map<string, pair<string, bool>> data;
+  m_queueMutex.lock();
+  topics.swap(m_queuedTopics);
+  data.swap(m_queuedData);
+  m_publishedTopics += topics.size();
+  m_queueMutex.unlock();
+  for (const auto& topic : topics) {
+    const pair<string, bool>& entry = data[topic];
+    const char* topicStr = topic.c_str();
+    const size_t len = entry.first.length();
+    if (len == 0) {
+      logOtherDebug("mqtt", "publish empty %s", topicStr);
+      check(mosquitto_publish(m_mosquitto, nullptr, topicStr, 0, nullptr, 0, entry.second), "publish empty");
+      continue;
+    }
+    const char* dataStr = entry.first.c_str();
+    logOtherDebug("mqtt", "publish %s %s", topicStr, dataStr);
+    check(mosquitto_publish(m_mosquitto, nullptr, topicStr, (uint32_t)len,
+        reinterpret_cast<const uint8_t*>(dataStr), 0, entry.second), "publish");
+  }
 }
 
 }  // namespace ebusd
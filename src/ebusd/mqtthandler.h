@@ -23,6 +23,8 @@
 #include <map>
 #include <string>
 #include <list>
+#include <deque>
+#include <utility>
 #include <vector>
 #include "ebusd/datahandler.h"
 #include "ebusd/bushandler.h"
@@ -34,7 +36,9 @@ namespace ebusd {
  * A data handler enabling MQTT support via mosquitto.
  */
 
+using std::deque;
 using std::map;
+using std::pair;
 using std::string;
 using std::vector;
 
@@ -45,14 +49,15 @@ using std::vector;
 const struct argp_child* mqtthandler_getargs();
 
 /**
- * Registration function that is called once during initialization.
+ * Registration function that is called once for each bus during initialization.
  * @param userInfo the @a UserInfo instance.
  * @param busHandler the @a BusHandler instance.
  * @param messages the @a MessageMap instance.
+ * @param bus the index of the bus (0 for the first one).
  * @param handlers the @a list to which new @a DataHandler instances shall be added.
  * @return true if registration was successful.
  */
-bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages,
+bool mqtthandler_register(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus,
     list<DataHandler*>* handlers);
 
 /**
@@ -65,8 +70,9 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
    * @param userInfo the @a UserInfo instance.
    * @param busHandler the @a BusHandler instance.
    * @param messages the @a MessageMap instance.
+   * @param bus the index of the bus (0 for the first one, further ones publish below an own topic prefix).
    */
-  MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages);
+  MqttHandler(UserInfo* userInfo, BusHandler* busHandler, MessageMap* messages, size_t bus);
 
   /**
    * Destructor.
@@ -91,6 +97,12 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   // @copydoc
   void notifyUpdateCheckResult(const string& checkResult) override;
 
+  // @copydoc
+  void formatInfo(ostringstream* output) override;
+
+  // @copydoc
+  void formatMetrics(MetricsWriter* writer) override;
+
  protected:
   // @copydoc
   void run() override;
@@ -104,6 +116,34 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
    */
   bool handleTraffic(bool allowReconnect);
 
+  /**
+   * Extract the circuit and message name from a received topic.
+   * @param remain the received topic without the direction suffix.
+   * @param isList whether this is a list topic (allowing partial topics).
+   * @param circuit the variable in which to store the circuit name.
+   * @param name the variable in which to store the message name.
+   * @return true on success, false if the topic does not match.
+   */
+  bool parseTopicNames(const string& remain, bool isList, string* circuit, string* name) const;
+
+  /**
+   * Handle a received global batch write topic carrying a JSON object with the values to write.
+   * @param data the data string.
+   */
+  void notifyBatchTopic(const string& data);
+
+  /**
+   * Clear the cached topics if @a Message instances were removed from the @a MessageMap (e.g. by a reload).
+   */
+  void checkTopicCache();
+
+  /**
+   * Get the cached MQTT topic strings for the @a Message (building them on first use).
+   * @param message the @a Message to get the topic strings for.
+   * @return the topic string of the message followed by the topic string of each field if publishing by field.
+   */
+  const vector<string>& getMessageTopics(const Message* message);
+
   /**
    * Build the MQTT topic string for the @a Message.
    * @param message the @a Message to build the topic string for.
@@ -122,7 +162,7 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   void publishMessage(const Message* message, ostringstream* updates, bool includeWithoutData = false);
 
   /**
-   * Publish a topic update to MQTT.
+   * Queue a topic update for publishing to MQTT.
    * @param topic the topic string.
    * @param data the data string.
    * @param retain whether the topic shall be retained.
@@ -130,14 +170,37 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
   void publishTopic(const string& topic, const string& data, bool retain = false);
 
   /**
-   * Publish a topic update to MQTT without any data.
+   * Queue a topic update for publishing to MQTT without any data.
    * @param topic the topic string.
    */
   void publishEmptyTopic(const string& topic);
 
+  /**
+   * Queue a topic update, replacing a not yet published update of the same topic, or dropping the oldest update
+   * when the queue is full.
+   * @param topic the topic string.
+   * @param data the data string.
+   * @param retain whether the topic shall be retained.
+   */
+  void queueTopic(const string& topic, const string& data, bool retain);
+
+  /**
+   * Return whether the queue of topic updates is full.
+   * @return whether the queue of topic updates is full.
+   */
+  bool isQueueFull();
+
+  /**
+   * Publish all queued topic updates to MQTT (without holding any lock during the publishing).
+   */
+  void flushTopics();
+
   /** the @a MessageMap instance. */
   MessageMap* m_messages;
 
+  /** the strings between the topic fields including the prefix of the bus. */
+  vector<string> m_topicStrs;
+
   /** the global topic prefix. */
   string m_globalTopic;
 
@@ -161,6 +224,36 @@ class MqttHandler : public DataSink, public DataSource, public WaitThread {
 
   /** the last system time when a communication error was logged. */
   time_t m_lastErrorLogTime;
+
+  /** the @a MessageMap generation the cached topics belong to. */
+  size_t m_topicGeneration;
+
+  /** the cached topic strings by @a Message (see @a getMessageTopics(), only used by the MQTT thread). */
+  map<const Message*, vector<string>> m_messageTopics;
+
+  /** the cached @a Message by received get/set topic (only used by the MQTT thread). */
+  map<string, Message*> m_topicMessages;
+
+  /** the @a Mutex for accessing the queued topic updates and the queue counters. */
+  Mutex m_queueMutex;
+
+  /** the queued topics in the order of queueing. */
+  deque<string> m_queuedTopics;
+
+  /** the queued data and retain flag by topic. */
+  map<string, pair<string, bool>> m_queuedData;
+
+  /** the maximum number of queued topic updates seen. */
+  size_t m_maxQueueDepth;
+
+  /** the number of published topic updates. */
+  size_t m_publishedTopics;
+
+  /** the number of topic updates replaced by a newer update of the same topic before publishing. */
+  size_t m_mergedTopics;
+
+  /** the number of topic updates dropped due to a full queue. */
+  size_t m_droppedTopics;
 };
 
 }  // namespace ebusd
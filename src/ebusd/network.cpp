@@ -21,34 +21,126 @@
 #endif
 
 #include "ebusd/network.h"
+#ifdef HAVE_EPOLL
+#  include <sys/epoll.h>
+#endif
 #ifdef HAVE_PPOLL
 #  include <poll.h>
 #endif
+#include <errno.h>
+#include <cstdlib>
 #include <cstring>
+#include <sstream>
+#include <vector>
 #include "lib/utils/log.h"
 
 namespace ebusd {
 
+using std::vector;
+using std::pair;
+using std::istringstream;
+
 int Connection::m_ids = 0;
 
 #ifndef POLLRDHUP
 #define POLLRDHUP 0
 #endif
 
+/** the maximum number of socket events to handle at once. */
+#define MAX_EVENTS 32
+
+/** the interval in seconds for passing an update request of a listening client to the @a MainLoop. */
+#define LISTEN_INTERVAL 2
+
+/** the interval in seconds for passing an update request of a server-sent events client to the @a MainLoop. */
+#define EVENTS_INTERVAL 1
+
+/** the time in seconds after which an idle kept alive HTTP connection is closed. */
+#define HTTP_KEEPALIVE_TIMEOUT 15
+
+/** the time in seconds after which a connection is closed when the client does not take the pending output. */
+#define SEND_TIMEOUT 30
+
+/** the socket event flag for new data. */
+#define EVENT_READ 1
+
+/** the socket event flag for a closed socket or an error. */
+#define EVENT_CLOSED 2
+
+/** the socket event flag for free output space. */
+#define EVENT_WRITE 4
+
+/** the maximum length of the body of a HTTP request being accepted. */
+#define HTTP_MAX_BODY 65536
+
+size_t NetMessage::getMemorySize() {
+  pthread_mutex_lock(&m_mutex);
+  size_t bytes = sizeof(NetMessage) + MemoryUsage::getHeapSize(m_request) + MemoryUsage::getHeapSize(m_pending)
+      + MemoryUsage::getHeapSize(m_httpBody) + MemoryUsage::getHeapSize(m_user) + MemoryUsage::getHeapSize(m_result)
+      + MemoryUsage::getHeapSize(m_eventCircuit) + MemoryUsage::getHeapSize(m_eventName)
+      + MemoryUsage::getHeapSize(m_eventLevels);
+  for (const auto& it : m_httpHeaders) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first)
+        + MemoryUsage::getHeapSize(it.second);
+  }
+  pthread_mutex_unlock(&m_mutex);
+  return bytes;
+}
+
 bool NetMessage::add(const char* request) {
+  if (m_httpBodyLength > m_httpBody.length()) {
+    // continue with the body of a HTTP request
+    if (request) {
+      m_httpBody.append(request);
+    }
+    return completeHttpBody();
+  }
   if (request && request[0]) {
-    string add = request;
-    add.erase(remove(add.begin(), add.end(), '\r'), add.end());
-    m_request.append(add);
+    if (m_isHttp) {
+      m_request.append(request);  // CR is removed from the header only as the body length is given in bytes
+    } else {
+      string add = request;
+      add.erase(remove(add.begin(), add.end(), '\r'), add.end());
+      m_request.append(add);
+    }
   }
   size_t pos = m_request.find(m_isHttp ? "\n\n" : "\n");
+  size_t endLength = 2;
+  if (m_isHttp) {
+    size_t crPos = m_request.find("\n\r\n");
+    if (crPos < pos) {
+      pos = crPos;
+      endLength = 3;
+    }
+  }
   if (pos != string::npos) {
     if (m_isHttp) {
+      m_httpBody = m_request.substr(pos+endLength);
+      m_pending.clear();
+      m_request.resize(pos);
+      m_request.erase(remove(m_request.begin(), m_request.end(), '\r'), m_request.end());
+      m_httpHeaders.clear();
       pos = m_request.find("\n");
-      m_request.resize(pos);  // reduce to first line
+      if (pos != string::npos) {
+        istringstream headers(m_request.substr(pos+1));
+        m_request.resize(pos);  // reduce to first line
+        string line;
+        while (getline(headers, line)) {
+          size_t colon = line.find(':');
+          if (colon == string::npos) {
+            continue;
+          }
+          string name = line.substr(0, colon);
+          transform(name.begin(), name.end(), name.begin(), ::tolower);
+          size_t start = line.find_first_not_of(" \t", colon+1);
+          m_httpHeaders[name] = start == string::npos ? "" : line.substr(start);
+        }
+      }
       // typical first line: GET /ehp/outsidetemp HTTP/1.1
       pos = m_request.rfind(" HTTP/");
+      m_http11 = false;
       if (pos != string::npos) {
+        m_http11 = m_request.compare(pos+6, string::npos, "1.0") != 0;
         m_request.resize(pos);  // remove "HTTP/x.x" suffix
       }
       pos = 0;
@@ -60,7 +152,15 @@ bool NetMessage::add(const char* request) {
         m_request[pos] = static_cast<char>(((value1&0x0f) << 4) | (value2&0x0f));
         m_request.erase(pos+1, 2);
       }
-    } else if (pos+1 == m_request.length()) {
+      m_httpBodyLength = strtoul(getHttpHeader("content-length").c_str(), nullptr, 10);
+      if (m_httpBodyLength > HTTP_MAX_BODY) {
+        m_httpBodyLength = 0;  // refused when handling the request
+      }
+      return completeHttpBody();
+    } else {
+      // keep an incomplete line for later and pass on all complete lines for handling them in order
+      pos = m_request.rfind('\n');
+      m_pending = m_request.substr(pos+1);
       m_request.resize(pos);  // reduce to complete lines
     }
     return true;
@@ -68,129 +168,143 @@ bool NetMessage::add(const char* request) {
   return m_request.length() == 0 && isListeningMode();
 }
 
+bool NetMessage::completeHttpBody() {
+  if (m_httpBody.length() < m_httpBodyLength) {
+    return false;  // wait for the remainder
+  }
+  m_pending = m_httpBody.substr(m_httpBodyLength);
+  m_httpBody.resize(m_httpBodyLength);
+  m_httpBodyLength = 0;
+  return true;
+}
 
-void Connection::run() {
-  int ret;
-  struct timespec tdiff;
-
-  // set timeout
-  tdiff.tv_sec = 2;
-  tdiff.tv_nsec = 0;
-  int notifyFD = m_notify.notifyFD();
-  int sockFD = m_socket->getFD();
-
-#ifdef HAVE_PPOLL
-  nfds_t nfds = 2;
-  struct pollfd fds[nfds];
-
-  memset(fds, 0, sizeof(fds));
-
-  fds[0].fd = notifyFD;
-  fds[0].events = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
-
-  fds[1].fd = sockFD;
-  fds[1].events = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
-#else
-#ifdef HAVE_PSELECT
-  int maxfd = (notifyFD > sockFD) ? notifyFD : sockFD;
-  fd_set checkfds, exceptfds;
-
-  FD_ZERO(&checkfds);
-  FD_SET(notifyFD, &checkfds);
-  FD_SET(sockFD, &checkfds);
+bool NetMessage::isHttpKeepAlive() const {
+  string connection = getHttpHeader("connection");
+  transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+  if (m_http11) {
+    return connection.find("close") == string::npos;
+  }
+  return connection.find("keep-alive") != string::npos;
+}
 
-  FD_ZERO(&exceptfds);
-  FD_SET(notifyFD, &exceptfds);
-  FD_SET(sockFD, &exceptfds);
-#endif
-#endif
 
-  bool closed = false;
-  NetMessage message(m_isHttp);
+bool Connection::receive() {
+  char data[256];
+  if (!m_socket->isValid()) {
+    return false;
+  }
+  ssize_t datalen = m_socket->recv(data, sizeof(data)-1);
+  if (datalen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return true;  // nothing to read right now
+  }
+  // remove closed socket
+  if (datalen <= 0) {
+    return false;
+  }
+  data[datalen] = '\0';
+  time(&m_lastActivity);
+
+  // decode client data
+  if (m_message.add(data)) {
+    m_waiting = true;
+    m_netQueue->push(&m_message);
+    logDebug(lf_network, "[%05d] wait for result", getID());
+  }
+  return true;
+}
 
-  while (!closed) {
-#ifdef HAVE_PPOLL
-    // wait for new fd event
-    ret = ppoll(fds, nfds, &tdiff, nullptr);
-#else
-#ifdef HAVE_PSELECT
-    // set readfds to inital checkfds
-    fd_set readfds = checkfds;
-    // wait for new fd event
-    ret = pselect(maxfd + 1, &readfds, nullptr, &exceptfds, &tdiff, nullptr);
-#endif
-#endif
-    bool newData = false;
-    if (ret != 0) {
-#ifdef HAVE_PPOLL
-      // new data from notify
-      if (ret < 0 || (fds[0].revents & (POLLIN | POLLERR | POLLHUP | POLLRDHUP))
-          || (fds[1].revents & (POLLERR | POLLHUP))) {
-        break;
-      }
-      // new data from socket
-      newData = fds[1].revents & POLLIN;
-      closed = fds[1].revents & POLLRDHUP;
-#else
-#ifdef HAVE_PSELECT
-      // new data from notify
-      if (ret < 0 || FD_ISSET(notifyFD, &readfds) || FD_ISSET(notifyFD, &exceptfds)) {
-        break;
-      }
-      // new data from socket
-      newData = FD_ISSET(sockFD, &readfds);
-      closed = FD_ISSET(sockFD, &exceptfds);
-#endif
-#endif
+bool Connection::sendResult() {
+  string result;
+  bool final = m_message.getResult(&result);
+  if (!m_socket->isValid()) {
+    if (final) {
+      m_waiting = false;
     }
+    return false;
+  }
+  if (!result.empty()) {
+    if (m_outputPos >= m_output.length()) {
+      m_output.swap(result);
+      m_outputPos = 0;
+    } else {
+      m_output.append(result);
+    }
+  }
+  bool sent = flush();
+  time(&m_lastActivity);
+  if (!final) {
+    return true;  // the MainLoop is still producing the result
+  }
+  m_waiting = false;
+  if (!sent) {
+    return false;
+  }
+  if (m_message.isDisconnect()) {
+    m_closing = true;
+    return hasOutput();  // close as soon as the pending output was sent
+  }
+  if (!m_message.isListeningMode() && m_message.add(nullptr)) {
+    // pipelined request already received completely
+    m_waiting = true;
+    m_netQueue->push(&m_message);
+  }
+  return true;
+}
 
-    if (newData || message.isListeningMode()) {
-      char data[256];
-
-      if (!m_socket->isValid()) {
-        break;
-      }
-      if (newData) {
-        ssize_t datalen = m_socket->recv(data, sizeof(data)-1);
-
-        // remove closed socket
-        if (datalen <= 0) {
-          break;
-        }
-        data[datalen] = '\0';
-      } else {
-        data[0] = '\0';
-      }
-
-      // decode client data
-      if (message.add(data)) {
-        m_netQueue->push(&message);
-
-        // wait for result
-        logDebug(lf_network, "[%05d] wait for result", getID());
-        string result;
-        message.getResult(&result);
+bool Connection::flush() {
+  while (m_outputPos < m_output.length()) {
+    ssize_t sent = m_socket->send(m_output.data()+m_outputPos, m_output.length()-m_outputPos);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;  // continue as soon as the socket accepts more data
+    }
+    if (sent <= 0) {
+      m_output.clear();
+      m_outputPos = 0;
+      m_closing = true;
+      return false;
+    }
+    m_outputPos += static_cast<size_t>(sent);
+    time(&m_lastActivity);
+  }
+  if (m_outputPos > 0) {
+    m_output.clear();
+    m_outputPos = 0;
+  }
+  return true;
+}
 
-        if (!m_socket->isValid()) {
-          break;
-        }
-        m_socket->send(result.c_str(), result.size());
-      }
+void Connection::abort() {
+  shutdown(m_socket->getFD(), SHUT_RDWR);
+  m_output.clear();
+  m_outputPos = 0;
+  m_closing = true;
+}
 
-      if (message.isDisconnect() || !m_socket->isValid()) {
-        break;
-      }
-    }
+bool Connection::isIdle(time_t now) const {
+  if (hasOutput()) {
+    return now > m_lastActivity + SEND_TIMEOUT;
   }
+  return m_isHttp && !m_waiting && now > m_lastActivity + HTTP_KEEPALIVE_TIMEOUT;
+}
 
-  delete m_socket;
-  m_socket = nullptr;
-  logInfo(lf_network, "[%05d] connection closed", getID());
+void Connection::checkListen(time_t now) {
+  if (m_waiting || m_closing || !m_message.isListeningMode()
+      || now < m_lastListen + (m_message.getMode() == cm_events ? EVENTS_INTERVAL : LISTEN_INTERVAL)) {
+    return;
+  }
+  m_lastListen = now;
+  if (m_message.add(nullptr)) {
+    m_waiting = true;
+    m_netQueue->push(&m_message);
+  }
 }
 
 
 Network::Network(const bool local, const uint16_t port, const uint16_t httpPort, Queue<NetMessage*>* netQueue)
-  : Thread(), m_netQueue(netQueue), m_listening(false) {
+  : Thread(), m_netQueue(netQueue), m_epollFD(-1), m_listening(false), m_connectionCount(0), m_connectionBytes(0) {
   m_tcpServer = new TCPServer(port, local ? "127.0.0.1" : "0.0.0.0");
 
   if (m_tcpServer != nullptr && m_tcpServer->start() == 0) {
@@ -202,146 +316,286 @@ Network::Network(const bool local, const uint16_t port, const uint16_t httpPort,
   } else {
     m_httpServer = nullptr;
   }
+#ifdef HAVE_EPOLL
+  if (m_listening) {
+    m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+    int fds[] = {m_notify.notifyFD(), m_resultNotify.notifyFD(), m_tcpServer->getFD(),
+                 m_httpServer ? m_httpServer->getFD() : -1};
+    for (const auto fd : fds) {
+      if (m_epollFD < 0 || fd < 0) {
+        continue;
+      }
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(m_epollFD);
+        m_epollFD = -1;
+      }
+    }
+    if (m_epollFD < 0) {
+      logError(lf_network, "unable to create epoll instance, falling back to poll");
+    }
+  }
+#endif
 }
 
 Network::~Network() {
   stop();
+  join();
   NetMessage* netMsg;
   while ((netMsg = m_netQueue->pop()) != nullptr) {
-    netMsg->setResult("ERR: shutdown", "", cm_normal, 0, true);
+    netMsg->setResult("ERR: shutdown", "", cm_normal, 0, 0, true);
   }
-  while (!m_connections.empty()) {
-    Connection* connection = m_connections.back();
-    m_connections.pop_back();
-    connection->stop();
-    connection->join();
-    delete connection;
+  for (auto it : m_connections) {
+    delete it.second;
+  }
+  m_connections.clear();
+  if (m_epollFD >= 0) {
+    close(m_epollFD);
+    m_epollFD = -1;
   }
-
   if (m_tcpServer != nullptr) {
     delete m_tcpServer;
   }
   if (m_httpServer != nullptr) {
     delete m_httpServer;
   }
-  join();
 }
 
 void Network::run() {
   if (!m_listening) {
     return;
   }
-  int ret;
-  struct timespec tdiff;
-
-  // set timeout
-  tdiff.tv_sec = 1;
-  tdiff.tv_nsec = 0;
-#ifdef HAVE_PPOLL
-  int socketCount = m_httpServer ? 2 : 1;
-  nfds_t nfds = 1+socketCount;
-  struct pollfd fds[nfds];
-
-  memset(fds, 0, sizeof(fds));
-
-  fds[0].fd = m_notify.notifyFD();
-  fds[0].events = POLLIN;
-
-  fds[1].fd = m_tcpServer->getFD();
-  fds[1].events = POLLIN;
-
-  if (m_httpServer) {
-    fds[2].fd = m_httpServer->getFD();
-    fds[2].events = POLLIN;
-  }
-#else
-#ifdef HAVE_PSELECT
-  int maxfd;
-  fd_set checkfds;
-
-  FD_ZERO(&checkfds);
-  FD_SET(m_notify.notifyFD(), &checkfds);
-  FD_SET(m_tcpServer->getFD(), &checkfds);
-  if (m_httpServer) {
-    FD_SET(m_httpServer->getFD(), &checkfds);
-  }
-
-  maxfd = (m_notify.notifyFD() > m_tcpServer->getFD()) ?
-    m_notify.notifyFD() : m_tcpServer->getFD();
-  if (m_httpServer && m_httpServer->getFD() > maxfd) {
-    maxfd = m_httpServer->getFD();
-  }
-#endif
-#endif
+  int notifyFD = m_notify.notifyFD();
+  int resultFD = m_resultNotify.notifyFD();
+  int tcpFD = m_tcpServer->getFD();
+  int httpFD = m_httpServer ? m_httpServer->getFD() : -1;
+  // the ready file descriptors with the EVENT_* flags
+  vector<pair<int, int>> ready;
   while (true) {
-#ifdef HAVE_PPOLL
-    // wait for new fd event
-    ret = ppoll(fds, nfds, &tdiff, nullptr);
-#else
-#ifdef HAVE_PSELECT
-    // set readfds to inital checkfds
-    fd_set readfds = checkfds;
-    // wait for new fd event
-    ret = pselect(maxfd + 1, &readfds, nullptr, nullptr, &tdiff, nullptr);
-#endif
+    int ret = 0;
+    ready.clear();
+#ifdef HAVE_EPOLL
+    if (m_epollFD >= 0) {
+      struct epoll_event events[MAX_EVENTS];
+      ret = epoll_wait(m_epollFD, events, MAX_EVENTS, 1000);
+      for (int i = 0; i < ret; i++) {
+        int fd = events[i].data.fd;
+        ready.push_back({fd, ((events[i].events & EPOLLIN) ? EVENT_READ : 0)
+                         | ((events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) ? EVENT_CLOSED : 0)
+                         | ((events[i].events & EPOLLOUT) ? EVENT_WRITE : 0)});
+      }
+    } else {
 #endif
-    if (ret == 0) {
-      cleanConnections();
-      continue;
-    }
-    bool newData = false, isHttp = false;
+    struct timespec tdiff;
+
+    // set timeout
+    tdiff.tv_sec = 1;
+    tdiff.tv_nsec = 0;
 #ifdef HAVE_PPOLL
-    // new data from notify
-    if (fds[0].revents & POLLIN) {
-      return;
+    vector<struct pollfd> fds;
+    struct pollfd pfd;
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.events = POLLIN;
+    for (const auto fd : {notifyFD, resultFD, tcpFD, httpFD}) {
+      if (fd >= 0) {
+        pfd.fd = fd;
+        fds.push_back(pfd);
+      }
     }
-    // new data from socket
-    if (fds[1].revents & POLLIN) {
-      newData = true;
-    } else if (m_httpServer && fds[2].revents & POLLIN) {
-      newData = isHttp = true;
+    for (const auto& it : m_connections) {
+      pfd.events = 0;
+      if (!it.second->isWaiting() && !it.second->isClosing()) {
+        pfd.events |= POLLIN | POLLERR | POLLHUP | POLLRDHUP;
+      }
+      if (it.second->hasOutput()) {
+        pfd.events |= POLLOUT | POLLERR | POLLHUP;
+      }
+      if (pfd.events) {
+        pfd.fd = it.first;
+        fds.push_back(pfd);
+      }
+    }
+    // wait for new fd event
+    ret = ppoll(fds.data(), fds.size(), &tdiff, nullptr);
+    for (size_t i = 0; ret > 0 && i < fds.size(); i++) {
+      if (fds[i].revents) {
+        ready.push_back({fds[i].fd, ((fds[i].revents & POLLIN) ? EVENT_READ : 0)
+                         | ((fds[i].revents & (POLLERR | POLLHUP | POLLRDHUP)) ? EVENT_CLOSED : 0)
+                         | ((fds[i].revents & POLLOUT) ? EVENT_WRITE : 0)});
+      }
     }
 #else
 #ifdef HAVE_PSELECT
-    // new data from notify
-    if (FD_ISSET(m_notify.notifyFD(), &readfds)) {
-      return;
+    int maxfd = -1;
+    fd_set readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    for (const auto fd : {notifyFD, resultFD, tcpFD, httpFD}) {
+      if (fd >= 0) {
+        FD_SET(fd, &readfds);
+        maxfd = fd > maxfd ? fd : maxfd;
+      }
+    }
+    for (const auto& it : m_connections) {
+      bool read = !it.second->isWaiting() && !it.second->isClosing();
+      if (read) {
+        FD_SET(it.first, &readfds);
+      }
+      if (it.second->hasOutput()) {
+        FD_SET(it.first, &writefds);
+      }
+      if (read || it.second->hasOutput()) {
+        FD_SET(it.first, &exceptfds);
+        maxfd = it.first > maxfd ? it.first : maxfd;
+      }
     }
-    // new data from socket
-    if (FD_ISSET(m_tcpServer->getFD(), &readfds)) {
-      newData = true;
-    } else if (m_httpServer && FD_ISSET(m_httpServer->getFD(), &readfds)) {
-      newData = isHttp = true;
+    // wait for new fd event
+    ret = pselect(maxfd + 1, &readfds, &writefds, &exceptfds, &tdiff, nullptr);
+    for (int fd = 0; ret > 0 && fd <= maxfd; fd++) {
+      int flags = (FD_ISSET(fd, &readfds) ? EVENT_READ : 0) | (FD_ISSET(fd, &exceptfds) ? EVENT_CLOSED : 0)
+          | (FD_ISSET(fd, &writefds) ? EVENT_WRITE : 0);
+      if (flags) {
+        ready.push_back({fd, flags});
+      }
     }
 #endif
 #endif
-    if (newData) {
-      TCPSocket* socket = (isHttp ? m_httpServer : m_tcpServer)->newSocket();
-      if (socket == nullptr) {
-        continue;
+#ifdef HAVE_EPOLL
+    }
+#endif
+    for (const auto& it : ready) {
+      if (it.first == notifyFD) {
+        return;
+      }
+      if (it.first == resultFD) {
+        m_resultNotify.clear();
+      } else if (it.first == tcpFD || it.first == httpFD) {
+        acceptConnection(it.first == httpFD);
+      } else {
+        handleConnection(it.first, (it.second & EVENT_READ) != 0, (it.second & EVENT_WRITE) != 0,
+            (it.second & EVENT_CLOSED) != 0);
       }
-      Connection* connection = new Connection(socket, isHttp, m_netQueue);
-      connection->start("connection");
-      m_connections.push_back(connection);
-      string ip = socket->getIP();
-      logInfo(lf_network, "[%05d] %s connection opened %s", connection->getID(), isHttp ? "HTTP" : "client",
-          ip.c_str());
     }
+    checkConnections();
+  }
+}
+
+void Network::acceptConnection(bool isHttp) {
+  TCPSocket* socket = (isHttp ? m_httpServer : m_tcpServer)->newSocket();
+  if (socket == nullptr) {
+    return;
   }
+  socket->setNonBlocking();  // results are buffered instead of blocking the other connections
+  Connection* connection = new Connection(socket, isHttp, m_netQueue, &m_resultNotify);
+  m_connections[connection->getFD()] = connection;
+  watch(connection);
+  string ip = socket->getIP();
+  logInfo(lf_network, "[%05d] %s connection opened %s", connection->getID(), isHttp ? "HTTP" : "client",
+      ip.c_str());
 }
 
-void Network::cleanConnections() {
-  auto it = m_connections.begin();
-  while (it != m_connections.end()) {
-    if (!(*it)->isRunning()) {
-      Connection* connection = *it;
-      it = m_connections.erase(it);
-      delete connection;
-      logDebug(lf_network, "dead connection removed - %d", m_connections.size());
+void Network::handleConnection(int fd, bool readable, bool writable, bool closed) {
+  auto it = m_connections.find(fd);
+  if (it == m_connections.end()) {
+    return;
+  }
+  Connection* connection = it->second;
+  if (connection->hasOutput() && (writable || closed)) {
+    connection->flush();  // a failure is handled below as the connection is closing then
+  }
+  if (connection->isClosing() && !connection->hasOutput()) {
+    closeConnection(connection);  // refused while waiting for the result
+    if (m_connections.find(fd) != m_connections.end()) {
+      watch(connection);
+    }
+    return;
+  }
+  if (connection->isWaiting() || connection->isClosing()) {
+    watch(connection);
+    return;  // socket is not read while waiting for the result or closing
+  }
+  // read pending data even when the client closed the connection already
+  if ((readable && !connection->receive()) || (closed && !connection->isWaiting())) {
+    if (connection->hasOutput()) {
+      connection->closeAfterOutput();
+      watch(connection);
     } else {
-      it++;
+      closeConnection(connection);
+    }
+    return;
+  }
+  watch(connection);
+}
+
+void Network::checkConnections() {
+  time_t now;
+  time(&now);
+  // collect first as closing modifies the map
+  vector<Connection*> done;
+  for (const auto& it : m_connections) {
+    Connection* connection = it.second;
+    if (connection->hasResult() && !connection->sendResult()) {
+      done.push_back(connection);
+      continue;
+    }
+    if (connection->isIdle(now)) {
+      connection->abort();
+      done.push_back(connection);
+      continue;
     }
+    connection->checkListen(now);
+    watch(connection);
+  }
+  for (const auto connection : done) {
+    closeConnection(connection);
+  }
+  size_t bytes = 0;
+  for (const auto& it : m_connections) {
+    bytes += MEMORY_NODE_OVERHEAD + it.second->getMemorySize();
+  }
+  m_connectionCount.store(m_connections.size(), std::memory_order_relaxed);
+  m_connectionBytes.store(bytes, std::memory_order_relaxed);
+}
+
+void Network::watch(Connection* connection, bool enable) {
+  if (m_epollFD < 0) {
+    return;
+  }
+#ifdef HAVE_EPOLL
+  unsigned int events = 0;
+  if (enable && !connection->isWaiting() && !connection->isClosing()) {
+    events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (enable && connection->hasOutput()) {
+    events |= EPOLLOUT;
+  }
+  unsigned int watched = connection->getWatchedEvents();
+  if (events == watched) {
+    return;
+  }
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = connection->getFD();
+  epoll_ctl(m_epollFD, events == 0 ? EPOLL_CTL_DEL : watched == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+      connection->getFD(), &event);
+  connection->setWatchedEvents(events);
+#endif
+}
+
+void Network::closeConnection(Connection* connection) {
+  if (connection->isWaiting()) {
+    return;  // the NetMessage is still in use by the MainLoop
   }
+  watch(connection, false);
+  m_connections.erase(connection->getFD());
+  logInfo(lf_network, "[%05d] connection closed", connection->getID());
+  delete connection;
+  logDebug(lf_network, "connection removed - %d", m_connections.size());
 }
 
 }  // namespace ebusd
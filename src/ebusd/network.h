@@ -22,16 +22,27 @@
 #include <string>
 #include <cstdio>
 #include <algorithm>
-#include <list>
+#include <map>
+#include <atomic>
 #include "lib/utils/tcpsocket.h"
 #include "lib/utils/queue.h"
 #include "lib/utils/notify.h"
 #include "lib/utils/thread.h"
+#include "lib/utils/metrics.h"
 
 namespace ebusd {
 
+using std::map;
+using std::atomic;
+
 /** \file ebusd/network.h
  * The TCP and HTTP client request handling.
+ *
+ * All client sockets are owned by the single @a Network thread that waits for
+ * socket events (using epoll if available) and hands complete requests as
+ * @a NetMessage to the @a MainLoop. The sockets are non-blocking and each
+ * @a Connection buffers the result data not yet taken by its socket, so that a
+ * slow client never stalls the others.
  */
 
 /** Forward declaration for @a Connection. */
@@ -42,6 +53,7 @@ enum ClientMode {
   cm_normal,  //!< normal mode
   cm_listen,  //!< listening mode
   cm_direct,  //!< direct mode
+  cm_events,  //!< HTTP server-sent events mode
 };
 
 /**
@@ -52,9 +64,11 @@ class NetMessage {
   /**
    * Constructor.
    * @param isHttp whether this is a HTTP message.
+   * @param resultNotify the @a Notify to trigger when the result was set, or nullptr.
    */
-  explicit NetMessage(bool isHttp)
-    : m_isHttp(isHttp), m_resultSet(false), m_disconnect(false), m_mode(cm_normal), m_listenSince(0) {
+  explicit NetMessage(bool isHttp, const Notify* resultNotify = nullptr)
+    : m_isHttp(isHttp), m_resultNotify(resultNotify), m_httpBodyLength(0), m_http11(false), m_resultSet(false),
+      m_resultFinal(false), m_disconnect(false), m_mode(cm_normal), m_listenSince(0), m_listenCursor(0) {
     pthread_mutex_init(&m_mutex, nullptr);
     pthread_cond_init(&m_cond, nullptr);
   }
@@ -91,33 +105,100 @@ class NetMessage {
    */
   bool isHttp() const { return m_isHttp; }
 
+  /**
+   * Return the approximate number of bytes used by this instance and its buffers.
+   * @return the approximate number of bytes used by this instance and its buffers.
+   */
+  size_t getMemorySize();
+
   /**
    * Return the request string.
    * @return the request string.
    */
   const string& getRequest() const { return m_request; }
 
+  /**
+   * Return the value of a header of the HTTP request.
+   * @param name the lower case name of the header.
+   * @return the header value, or empty.
+   */
+  string getHttpHeader(const string& name) const {
+    const auto it = m_httpHeaders.find(name);
+    return it == m_httpHeaders.end() ? "" : it->second;
+  }
+
+  /**
+   * Return the body of the HTTP request.
+   * @return the body of the HTTP request (empty if not available or too large).
+   */
+  const string& getHttpBody() const { return m_httpBody; }
+
+  /**
+   * Return whether the HTTP request was sent with protocol version 1.1 or higher.
+   * @return whether the HTTP request was sent with protocol version 1.1 or higher.
+   */
+  bool isHttp11() const { return m_http11; }
+
+  /**
+   * Return whether the client wants to keep the HTTP connection open for further requests.
+   * @return whether the client wants to keep the HTTP connection open for further requests.
+   */
+  bool isHttpKeepAlive() const;
+
   /**
    * Return the current user name.
    * @return the current user name.
    */
   const string& getUser() const { return m_user; }
 
+  /**
+   * Return whether the result was already set.
+   * @return whether the result was already set.
+   */
+  bool hasResult() {
+    pthread_mutex_lock(&m_mutex);
+    bool ret = m_resultSet;
+    pthread_mutex_unlock(&m_mutex);
+    return ret;
+  }
+
   /**
    * Wait for the result being set and return the result string.
    * @param result the variable in which to store the result string.
+   * @return true when the result is complete, false when only a part of it was added so far.
    */
-  void getResult(string* result) {
+  bool getResult(string* result) {
     pthread_mutex_lock(&m_mutex);
 
     if (!m_resultSet) {
       pthread_cond_wait(&m_cond, &m_mutex);
     }
-    m_request.clear();
-    *result = m_result;
+    bool final = m_resultFinal;
+    if (final) {
+      m_request.swap(m_pending);  // continue with a pipelined request
+      m_pending.clear();
+    }
+    result->swap(m_result);
     m_result.clear();
     m_resultSet = false;
+    m_resultFinal = false;
+    pthread_mutex_unlock(&m_mutex);
+    return final;
+  }
+
+  /**
+   * Add a part of the result string and notify the waiting thread without finishing the result.
+   * @param chunk the part of the result string.
+   */
+  void addResultChunk(const string& chunk) {
+    pthread_mutex_lock(&m_mutex);
+    m_result.append(chunk);
+    m_resultSet = true;
+    const Notify* resultNotify = m_resultNotify;
     pthread_mutex_unlock(&m_mutex);
+    if (resultNotify) {
+      resultNotify->notify();
+    }
   }
 
   /**
@@ -126,29 +207,41 @@ class NetMessage {
    * @param user the new user name.
    * @param mode the new client mode.
    * @param listenUntil the end time to which to updates were added (exclusive).
+   * @param listenCursor the update journal cursor to which updates were added.
    * @param disconnect true when the client shall be disconnected.
    */
-  void setResult(const string& result, const string& user, ClientMode mode, time_t listenUntil, bool disconnect) {
+  void setResult(const string& result, const string& user, ClientMode mode, time_t listenUntil,
+      uint64_t listenCursor, bool disconnect) {
     pthread_mutex_lock(&m_mutex);
-    m_result = result;
+    m_result.append(result);
     m_user = user;
     m_disconnect = disconnect;
     m_mode = mode;
     m_listenSince = listenUntil;
+    m_listenCursor = listenCursor;
     m_resultSet = true;
+    m_resultFinal = true;
+    const Notify* resultNotify = m_resultNotify;  // this instance might be gone right after unlocking
     pthread_cond_signal(&m_cond);
     pthread_mutex_unlock(&m_mutex);
+    if (resultNotify) {
+      resultNotify->notify();
+    }
   }
 
   /**
    * Return the client mode.
    * @param listenSince set listening to the specified start time from which to add updates (inclusive).
+   * @param listenCursor set to the update journal cursor from which to add updates.
    * @return the client mode.
    */
-  ClientMode getMode(time_t* listenSince = nullptr) {
+  ClientMode getMode(time_t* listenSince = nullptr, uint64_t* listenCursor = nullptr) {
     if (listenSince) {
       *listenSince = m_listenSince;
     }
+    if (listenCursor) {
+      *listenCursor = m_listenCursor;
+    }
     return m_mode;
   }
 
@@ -156,7 +249,37 @@ class NetMessage {
    * Return whether this instance is in one of the listening modes.
    * @return whether this instance is in one of the listening modes.
    */
-  bool isListeningMode() { return m_mode == cm_listen || m_mode == cm_direct; }
+  bool isListeningMode() { return m_mode == cm_listen || m_mode == cm_direct || m_mode == cm_events; }
+
+  /**
+   * Set the filter for the server-sent events.
+   * @param circuit the circuit name to match, or empty for all.
+   * @param name the message name to match, or empty for all.
+   * @param levels the access levels to match.
+   */
+  void setEventFilter(const string& circuit, const string& name, const string& levels) {
+    m_eventCircuit = circuit;
+    m_eventName = name;
+    m_eventLevels = levels;
+  }
+
+  /**
+   * Return the circuit name to match for the server-sent events.
+   * @return the circuit name to match, or empty for all.
+   */
+  const string& getEventCircuit() const { return m_eventCircuit; }
+
+  /**
+   * Return the message name to match for the server-sent events.
+   * @return the message name to match, or empty for all.
+   */
+  const string& getEventName() const { return m_eventName; }
+
+  /**
+   * Return the access levels to match for the server-sent events.
+   * @return the access levels to match.
+   */
+  const string& getEventLevels() const { return m_eventLevels; }
 
   /**
    * Return whether the client shall be disconnected.
@@ -166,18 +289,45 @@ class NetMessage {
 
 
  private:
+  /**
+   * Check whether the body of the HTTP request was completely received and move the excess data to the pending part.
+   * @return true when the body was completely received.
+   */
+  bool completeHttpBody();
+
   /** whether this is a HTTP message. */
   const bool m_isHttp;
 
+  /** the @a Notify to trigger when the result was set, or nullptr. */
+  const Notify* m_resultNotify;
+
   /** the request string. */
   string m_request;
 
+  /** the data received after the end of the current request (i.e. the start of a pipelined request). */
+  string m_pending;
+
+  /** the headers of the HTTP request by lower case name. */
+  map<string, string> m_httpHeaders;
+
+  /** the (partially received) body of the HTTP request. */
+  string m_httpBody;
+
+  /** the length of the body of the HTTP request while it is still being received, or 0. */
+  size_t m_httpBodyLength;
+
+  /** whether the HTTP request was sent with protocol version 1.1 or higher. */
+  bool m_http11;
+
   /** the current user name. */
   string m_user;
 
-  /** whether the result was already set. */
+  /** whether the result (or a part of it) was already set. */
   bool m_resultSet;
 
+  /** whether the result is complete. */
+  bool m_resultFinal;
+
   /** the result string. */
   string m_result;
 
@@ -195,40 +345,143 @@ class NetMessage {
 
   /** start timestamp of listening update. */
   time_t m_listenSince;
+
+  /** the update journal cursor of listening update (or the next event ID in events mode). */
+  uint64_t m_listenCursor;
+
+  /** the circuit name to match for the server-sent events, or empty for all. */
+  string m_eventCircuit;
+
+  /** the message name to match for the server-sent events, or empty for all. */
+  string m_eventName;
+
+  /** the access levels to match for the server-sent events. */
+  string m_eventLevels;
 };
 
 /**
- * class connection which handle client and baseloop communication.
+ * A single client connection handled by the @a Network thread.
  */
-class Connection : public Thread {
+class Connection {
  public:
   /**
    * Constructor.
    * @param socket the @a TCPSocket for communication.
    * @param isHttp whether this is a HTTP message.
    * @param netQueue the reference to the @a NetMessage @a Queue.
+   * @param resultNotify the @a Notify to trigger when the result of a request was set.
    */
-  Connection(TCPSocket* socket, const bool isHttp, Queue<NetMessage*>* netQueue)
-    : Thread(), m_isHttp(isHttp), m_socket(socket), m_netQueue(netQueue) {
+  Connection(TCPSocket* socket, const bool isHttp, Queue<NetMessage*>* netQueue, const Notify* resultNotify)
+    : m_isHttp(isHttp), m_socket(socket), m_netQueue(netQueue), m_message(isHttp, resultNotify),
+      m_waiting(false), m_outputPos(0), m_closing(false), m_lastListen(0), m_lastActivity(time(nullptr)),
+      m_watchedEvents(0) {
     m_id = ++m_ids;
   }
 
+  /**
+   * Destructor.
+   */
   virtual ~Connection() { if (m_socket) delete m_socket; }
+
   /**
-   * endless loop for connection instance.
+   * Return the ID of this connection.
+   * @return the ID of this connection.
    */
-  virtual void run();
+  int getID() { return m_id; }
 
   /**
-   * Stop this connection.
+   * Return the socket file descriptor.
+   * @return the socket file descriptor.
    */
-  virtual void stop() { m_notify.notify(); Thread::stop(); }
+  int getFD() const { return m_socket->getFD(); }
 
   /**
-   * Return the ID of this connection.
-   * @return the ID of this connection.
+   * Return the approximate number of bytes used by this instance and its buffers.
+   * @return the approximate number of bytes used by this instance and its buffers.
    */
-  int getID() { return m_id; }
+  size_t getMemorySize() {
+    return sizeof(Connection) - sizeof(NetMessage) + sizeof(TCPSocket) + MemoryUsage::getHeapSize(m_output)
+        + m_message.getMemorySize();
+  }
+
+  /**
+   * Return whether a request was passed to the @a MainLoop and the result is still outstanding.
+   * @return whether the result of a request is still outstanding.
+   */
+  bool isWaiting() const { return m_waiting; }
+
+  /**
+   * Return whether the result of an outstanding request was set.
+   * @return whether the result of an outstanding request was set.
+   */
+  bool hasResult() { return m_waiting && !hasOutput() && m_message.hasResult(); }
+
+  /**
+   * Return whether a part of the result was not yet sent to the client.
+   * @return whether a part of the result was not yet sent to the client.
+   */
+  bool hasOutput() const { return m_outputPos < m_output.length(); }
+
+  /**
+   * Return whether the connection shall be closed as soon as the pending output was sent.
+   * @return whether the connection shall be closed as soon as the pending output was sent.
+   */
+  bool isClosing() const { return m_closing; }
+
+  /**
+   * Stop reading from the client and close the connection as soon as the pending output was sent.
+   */
+  void closeAfterOutput() { m_closing = true; }
+
+  /**
+   * Shut down the socket and drop the pending output, so that the connection can be closed once the result of an
+   * outstanding request was set.
+   */
+  void abort();
+
+  /**
+   * Return the socket events currently watched by the @a Network.
+   * @return the socket events currently watched by the @a Network.
+   */
+  unsigned int getWatchedEvents() const { return m_watchedEvents; }
+
+  /**
+   * Set the socket events currently watched by the @a Network.
+   * @param events the socket events currently watched by the @a Network.
+   */
+  void setWatchedEvents(unsigned int events) { m_watchedEvents = events; }
+
+  /**
+   * Read the available data from the socket and pass the request to the @a MainLoop when complete.
+   * @return false when the connection shall be closed.
+   */
+  bool receive();
+
+  /**
+   * Send the result (or the available part of it) of the outstanding request to the client.
+   * @return false when the connection shall be closed.
+   */
+  bool sendResult();
+
+  /**
+   * Send as much of the pending output to the client as the socket accepts without blocking.
+   * @return false when sending failed (the pending output is dropped then).
+   */
+  bool flush();
+
+  /**
+   * Return whether a kept alive HTTP connection was idle for too long, or the client did not take the pending
+   * output for too long, so that the connection shall be closed.
+   * @param now the current time.
+   * @return whether the connection shall be closed.
+   */
+  bool isIdle(time_t now) const;
+
+  /**
+   * Pass an empty request to the @a MainLoop for collecting updates when in listening mode.
+   * @param now the current time.
+   */
+  void checkListen(time_t now);
 
 
  private:
@@ -241,8 +494,29 @@ class Connection : public Thread {
   /** the reference to the @a NetMessage @a Queue. */
   Queue<NetMessage*>* m_netQueue;
 
-  /** notification object for shutdown procedure. */
-  Notify m_notify;
+  /** the @a NetMessage for passing the requests to the @a MainLoop. */
+  NetMessage m_message;
+
+  /** whether the @a NetMessage was passed to the @a MainLoop and the result is still outstanding. */
+  bool m_waiting;
+
+  /** the result data not yet taken by the socket (starting at @a m_outputPos). */
+  string m_output;
+
+  /** the position in @a m_output of the first byte not yet sent. */
+  size_t m_outputPos;
+
+  /** whether the connection shall be closed as soon as the pending output was sent. */
+  bool m_closing;
+
+  /** the time of the last update request in listening mode. */
+  time_t m_lastListen;
+
+  /** the time of the last request or sent result data. */
+  time_t m_lastActivity;
+
+  /** the socket events currently watched by the @a Network. */
+  unsigned int m_watchedEvents;
 
   /** the ID of this connection. */
   int m_id;
@@ -252,7 +526,7 @@ class Connection : public Thread {
 };
 
 /**
- * class network which listening on tcp socket for incoming connections.
+ * class network which listening on tcp socket for incoming connections and handles all client sockets.
  */
 class Network : public Thread {
  public:
@@ -280,10 +554,54 @@ class Network : public Thread {
    */
   void stop() const { m_notify.notify(); usleep(100000); }
 
+  /**
+   * Add the approximate memory used by the connections and their buffers to the @a MemoryUsage (as of the last
+   * check of the connections).
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const {
+    usage->add(mk_connections, m_connectionBytes.load(std::memory_order_relaxed),
+        m_connectionCount.load(std::memory_order_relaxed));
+  }
+
 
  private:
-  /** the list of active @a Connection instances. */
-  list<Connection*> m_connections;
+  /**
+   * Accept a new client connection.
+   * @param isHttp whether this is a HTTP connection.
+   */
+  void acceptConnection(bool isHttp);
+
+  /**
+   * Handle an event on a client socket.
+   * @param fd the socket file descriptor.
+   * @param readable whether data can be read from the socket.
+   * @param writable whether data can be written to the socket.
+   * @param closed whether the socket was closed or an error occurred.
+   */
+  void handleConnection(int fd, bool readable, bool writable, bool closed);
+
+  /**
+   * Send the results that were set in the meantime and pass listening requests to the @a MainLoop.
+   */
+  void checkConnections();
+
+  /**
+   * Update the watched events of the socket of a @a Connection according to its state (new data unless waiting
+   * for the result or closing, and free output space while output is pending).
+   * @param connection the @a Connection.
+   * @param enable false to stop watching the socket at all.
+   */
+  void watch(Connection* connection, bool enable = true);
+
+  /**
+   * Close a @a Connection and free it.
+   * @param connection the @a Connection.
+   */
+  void closeConnection(Connection* connection);
+
+  /** the active @a Connection instances by socket file descriptor. */
+  map<int, Connection*> m_connections;
 
   /** the reference to the @a NetMessage @a Queue. */
   Queue<NetMessage*>* m_netQueue;
@@ -297,13 +615,20 @@ class Network : public Thread {
   /** @a Notify object for shutdown procedure. */
   Notify m_notify;
 
+  /** @a Notify object triggered by the @a MainLoop when a result was set. */
+  Notify m_resultNotify;
+
+  /** the epoll file descriptor, or -1 if not available. */
+  int m_epollFD;
+
   /** true if this instance is listening. */
   bool m_listening;
 
-  /**
-   * clean inactive connections from container.
-   */
-  void cleanConnections();
+  /** the number of @a Connection instances as of the last check. */
+  atomic<size_t> m_connectionCount;
+
+  /** the approximate number of bytes used by the @a Connection instances as of the last check. */
+  atomic<size_t> m_connectionBytes;
 };
 
 }  // namespace ebusd
@@ -0,0 +1,390 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ebusd/bushandler.h"
+#include "ebusd/main.h"
+#include "lib/utils/notify.h"
+#include "lib/utils/queue.h"
+
+using namespace std;
+using namespace ebusd;
+
+namespace ebusd {
+
+/** the global @a DataFieldTemplates. */
+static DataFieldTemplates templates;
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  return &templates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace) {
+  return RESULT_ERR_NOTFOUND;  // not needed by the tests
+}
+
+result_t loadScanConfigFile(MessageMap* messages, symbol_t address, bool verbose, string* relativeFile) {
+  return RESULT_ERR_NOTFOUND;  // not needed by the tests
+}
+
+void executeInstructions(MessageMap* messages, BusHandler* busHandler, bool verbose) {
+  // not needed by the tests
+}
+
+}  // namespace ebusd
+
+static bool error = false;
+
+/**
+ * A @a Device receiving the scripted symbols of other participants and the echo of everything sent.
+ */
+class ScriptedDevice : public Device {
+ public:
+  /**
+   * Construct a new instance.
+   * @param script the hex symbols to receive from other participants (after the echo of anything sent).
+   */
+  explicit ScriptedDevice(const string& script)
+    : Device("scripted", false, false, false, false), m_done(false) {
+    vector<symbol_t> values(script.length()/2);
+    size_t written = 0;
+    SymbolString::parseHex(script.c_str(), script.length(), values.data(), &written);
+    m_script.assign(values.begin(), values.begin()+written);
+  }
+
+  // @copydoc
+  result_t open() override {
+    m_fd = ::open("/dev/null", O_RDONLY);
+    return m_fd < 0 ? RESULT_ERR_DEVICE : RESULT_OK;
+  }
+
+  // @copydoc
+  bool canSendBatch() const override { return true; }
+
+  /**
+   * Return whether the script was completely received.
+   * @return whether the script was completely received.
+   */
+  bool isDone() const { return m_done; }
+
+  /**
+   * Get the symbols sent so far.
+   * @return the symbols sent so far as hex string.
+   */
+  const string& getSent() const { return m_sent; }
+
+  /**
+   * Add an answer to receive each time after the sent symbols ended with the specified ones.
+   * @param sent the hex symbols that trigger the answer.
+   * @param answer the hex symbols to receive as answer.
+   */
+  void addAnswer(const string& sent, const string& answer) { m_answers.emplace_back(sent, answer); }
+
+
+ protected:
+  // @copydoc
+  void checkDevice() override {}
+
+  // @copydoc
+  bool available() override { return true; }
+
+  // @copydoc
+  ssize_t write(symbol_t value) override { return write(&value, 1); }
+
+  // @copydoc
+  ssize_t write(const symbol_t* values, size_t count) override {
+    for (size_t pos = 0; pos < count; pos++) {
+      char out[3];
+      SymbolString::formatHex(values+pos, 1, out);
+      m_sent += string(out, 2);
+      m_echo.push_back(values[pos]);
+      for (const auto& answer : m_answers) {
+        if (m_sent.length() >= answer.first.length()
+            && m_sent.compare(m_sent.length()-answer.first.length(), answer.first.length(), answer.first) == 0) {
+          vector<symbol_t> symbols(answer.second.length()/2);
+          size_t written = 0;
+          SymbolString::parseHex(answer.second.c_str(), answer.second.length(), symbols.data(), &written);
+          m_script.insert(m_script.end(), symbols.begin(), symbols.begin()+written);
+        }
+      }
+    }
+    return static_cast<ssize_t>(count);
+  }
+
+  // @copydoc
+  ssize_t read(symbol_t* value) override {
+    if (!m_echo.empty()) {
+      *value = m_echo.front();
+      m_echo.pop_front();
+    } else if (!m_script.empty()) {
+      *value = m_script.front();
+      m_script.pop_front();
+    } else {
+      m_done = true;
+      usleep(10000);
+      *value = SYN;  // idle bus
+    }
+    return 1;
+  }
+
+
+ private:
+  /** the symbols still to receive from other participants. */
+  deque<symbol_t> m_script;
+
+  /** the echo of the sent symbols still to receive. */
+  deque<symbol_t> m_echo;
+
+  /** the sent symbols as hex string. */
+  string m_sent;
+
+  /** the answers to receive by the hex symbols sent before. */
+  vector<pair<string, string>> m_answers;
+
+  /** whether the script was completely received. */
+  atomic<bool> m_done;
+};
+
+/**
+ * Append the CRC to the unescaped hex symbols and optionally escape them.
+ * @param hex the unescaped hex symbols.
+ * @param escape whether to escape the symbols including the CRC.
+ * @return the (escaped) hex symbols with the CRC appended.
+ */
+static string withCrc(const string& hex, bool escape = false) {
+  vector<symbol_t> values(hex.length()/2+1);
+  size_t written = 0;
+  SymbolString::parseHex(hex.c_str(), hex.length(), values.data(), &written);
+  symbol_t crc = 0;
+  SymbolString::updateCrcUnescaped(values.data(), written, &crc);
+  values[written++] = crc;
+  vector<symbol_t> escaped(2*written);
+  if (escape) {
+    written = SymbolString::escape(values.data(), written, escaped.data());
+  } else {
+    escaped = values;
+  }
+  vector<char> out(2*written+1);
+  SymbolString::formatHex(escaped.data(), written, out.data());
+  return string(out.data(), 2*written);
+}
+
+void verify(const string& type, const string& expectStr, const string& gotStr) {
+  if (gotStr == expectStr) {
+    cout << "  " << type << " >" << gotStr << "< OK" << endl;
+  } else {
+    cout << "  " << type << " error: got >" << gotStr << "<, expected >" << expectStr << "<" << endl;
+    error = true;
+  }
+}
+
+/** the @a Queue to wait on in @a delayedPush(). */
+static Queue<int*> s_queue;
+
+/** the item to push in @a delayedPush(). */
+static int s_item = 0;
+
+/**
+ * Push @a s_item to @a s_queue after a short delay.
+ * @param arg unused.
+ * @return nullptr.
+ */
+static void* delayedPush(void* arg) {
+  usleep(50000);
+  s_queue.push(&s_item);
+  return nullptr;
+}
+
+/**
+ * The arguments and result for @a concurrentRead().
+ */
+struct ConcurrentRead {
+  /** the @a BusHandler to read with. */
+  BusHandler* busHandler;
+
+  /** the @a Message to read or write. */
+  Message* message;
+
+  /** the input for the @a Message. */
+  string input;
+
+  /** the result code. */
+  result_t result;
+};
+
+/**
+ * Read or write the @a Message via the @a BusHandler.
+ * @param arg the @a ConcurrentRead.
+ * @return nullptr.
+ */
+static void* concurrentRead(void* arg) {
+  ConcurrentRead* read = reinterpret_cast<ConcurrentRead*>(arg);
+  read->result = read->busHandler->readFromBus(read->message, read->input);
+  return nullptr;
+}
+
+/**
+ * Count the occurrences of a string.
+ * @param str the string to search in.
+ * @param find the string to count.
+ * @return the number of occurrences.
+ */
+static size_t countOf(const string& str, const string& find) {
+  size_t count = 0;
+  for (size_t pos = str.find(find); pos != string::npos; pos = str.find(find, pos+find.length())) {
+    count++;
+  }
+  return count;
+}
+
+int main() {
+  // check the notification consumed at once
+  {
+    Notify notify;
+    notify.notify();
+    notify.notify();
+    bool pending = notify.notifyFD() >= 0;
+#ifdef HAVE_EVENTFD
+    // eventfd: the counter accumulates all notifications
+    uint64_t value = 0;
+    pending = pending && read(notify.notifyFD(), &value, sizeof(value)) == sizeof(value) && value == 2;
+    notify.notify();
+#endif
+    bool cleared = notify.clear();
+    if (!pending || !cleared || notify.clear()) {
+      cout << "  notify error" << endl;
+      error = true;
+    } else {
+      cout << "  notify OK" << endl;
+    }
+  }
+
+  // check waiting for a particular item to appear in the queue
+  {
+    pthread_t thread;
+    bool created = pthread_create(&thread, nullptr, delayedPush, nullptr) == 0;
+    bool removed = created && s_queue.remove(&s_item, true);
+    if (created) {
+      pthread_join(thread, nullptr);
+    }
+    if (!removed || s_queue.size() != 0) {
+      cout << "  queue remove error" << endl;
+      error = true;
+    } else {
+      cout << "  queue remove OK" << endl;
+    }
+  }
+
+  MessageMap messages;
+  // the identification of the own slave address 36 requested by master 10
+  Message* message = messages.getScanMessage(0x36);
+  SlaveSymbolString response;
+  istringstream input("ebusd.eu;" PACKAGE_NAME ";" SCAN_VERSION ";100");
+  result_t result = message->prepareSlave(&input, &response);
+  if (result != RESULT_OK) {
+    cout << "prepare answer: " << getResultCode(result) << endl;
+    return 1;
+  }
+  ScriptedDevice device("aaaa" + withCrc("1036070400") + "00aa");
+  device.open();
+  BusHandler busHandler(&device, &messages, 0x31, true, 2, 2, 0, 10000, 15000, 1, false, 0, 0, 0);
+  busHandler.start("bushandler");
+  for (int count = 0; count < 200 && !device.isDone(); count++) {
+    usleep(10000);
+  }
+  usleep(50000);
+  busHandler.stop();
+  busHandler.join();
+  // ACK of the command followed by the prepared escaped response including the escaped CRC sent exactly once
+  verify("answer", "00" + withCrc(response.getStr(), true), device.getSent());
+  unsigned int prepared = 0;
+  unsigned int served = busHandler.getServedAnswers(&prepared);
+  if (served != 1) {
+    cout << "  answer statistics error: " << served << "/" << prepared << endl;
+    error = true;
+  } else {
+    cout << "  answer statistics OK" << endl;
+  }
+
+  // check identical reads pending at the same time sharing a single transfer and identical writes sent each
+  {
+    istringstream stream("type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,get,,,15,b509,0d2800,value,,uch\n"
+      "w,cir,set,,,15,b509,0e2800,value,,uch\n");
+    string errorDescription;
+    result = messages.readFromStream(&stream, __FILE__, 0, false, nullptr, &errorDescription);
+    Message* readMessage = messages.find("cir", "get", "", false);
+    Message* writeMessage = messages.find("cir", "set", "", true);
+    if (result != RESULT_OK || !readMessage || !writeMessage) {
+      cout << "  coalesce definitions error: " << getResultCode(result) << " " << errorDescription << endl;
+      return 1;
+    }
+    string readMaster = withCrc("3115b509030d2800"), writeMaster = withCrc("3115b509040e280005");
+    ScriptedDevice coalesceDevice("aa");
+    coalesceDevice.addAnswer(readMaster, "00" + withCrc("0105"));
+    coalesceDevice.addAnswer(writeMaster, "00" + withCrc("00"));
+    coalesceDevice.open();
+    BusHandler coalesceHandler(&coalesceDevice, &messages, 0x31, false, 2, 2, 0, 10000, 15000, 1, false, 0, 0, 0);
+    ConcurrentRead reads[] = {
+      {&coalesceHandler, readMessage, "", RESULT_EMPTY},
+      {&coalesceHandler, readMessage, "", RESULT_EMPTY},
+      {&coalesceHandler, writeMessage, "5", RESULT_EMPTY},
+      {&coalesceHandler, writeMessage, "5", RESULT_EMPTY},
+    };
+    pthread_t threads[4];
+    bool created = true;
+    for (size_t index = 0; index < 4; index++) {
+      created = pthread_create(&threads[index], nullptr, concurrentRead, &reads[index]) == 0 && created;
+    }
+    usleep(50000);  // all requests pending before the bus is processed
+    coalesceHandler.start("coalesce");
+    for (size_t index = 0; index < 4; index++) {
+      pthread_join(threads[index], nullptr);
+    }
+    coalesceHandler.stop();
+    coalesceHandler.join();
+    const string& sent = coalesceDevice.getSent();
+    size_t readCount = countOf(sent, readMaster), writeCount = countOf(sent, writeMaster);
+    if (!created || reads[0].result != RESULT_OK || reads[1].result != RESULT_OK || reads[2].result != RESULT_OK
+        || reads[3].result != RESULT_OK) {
+      cout << "  coalesce error: " << getResultCode(reads[0].result) << ", " << getResultCode(reads[1].result)
+           << ", " << getResultCode(reads[2].result) << ", " << getResultCode(reads[3].result) << endl;
+      error = true;
+    } else if (readCount != 1 || writeCount != 2 || coalesceHandler.getCoalescedReads() != 1) {
+      cout << "  coalesce error: " << readCount << " reads, " << writeCount << " writes, "
+           << coalesceHandler.getCoalescedReads() << " coalesced" << endl;
+      error = true;
+    } else {
+      cout << "  coalesce OK" << endl;
+    }
+  }
+  return error ? 1 : 0;
+}
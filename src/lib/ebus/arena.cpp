@@ -0,0 +1,252 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/ebus/arena.h"
+#include <stdint.h>
+#include <new>
+#include <utility>
+
+namespace ebusd {
+
+/**
+ * The header in front of each @a ArenaObject.
+ */
+struct ArenaHeader {
+  /** the @a ArenaFreeList to return the memory to, or nullptr if allocated from the heap. */
+  ArenaFreeList* m_freeList;
+
+  /** the size of the memory including the header, or 0 if not to be reused. */
+  size_t m_size;
+};
+
+static_assert(sizeof(ArenaHeader) <= ARENA_ALIGNMENT, "arena header too large");
+
+/** the maximum size of an allocation served from the current block (larger ones get a block of their own). */
+#define ARENA_MAX_SMALL (ARENA_BLOCK_SIZE/4)
+
+/**
+ * The memory of deleted @a ArenaObject instances by size class (i.e. the number of @a ARENA_ALIGNMENT units).
+ */
+class ArenaFreeList {
+ public:
+  /**
+   * Constructor.
+   */
+  ArenaFreeList() : m_forward(nullptr), m_bytes(0) {}
+
+  /**
+   * Get the @a ArenaFreeList that actually takes the memory.
+   * @return the @a ArenaFreeList at the end of the forwarding chain.
+   */
+  ArenaFreeList* resolve() {
+    ArenaFreeList* list = this;
+    while (list->m_forward) {
+      list = list->m_forward;
+    }
+    return list;
+  }
+
+  /**
+   * Add memory to the list.
+   * @param memory the memory to add (at least pointer sized).
+   * @param size the size of the memory.
+   */
+  void push(void* memory, size_t size) {
+    size_t index = size/ARENA_ALIGNMENT;
+    if (index >= m_heads.size()) {
+      m_heads.resize(index+1, nullptr);
+    }
+    *static_cast<void**>(memory) = m_heads[index];
+    m_heads[index] = memory;
+    m_bytes += size;
+  }
+
+  /**
+   * Remove memory of the size from the list.
+   * @param size the size of the memory.
+   * @return the memory, or nullptr if none of that size is available.
+   */
+  void* pop(size_t size) {
+    size_t index = size/ARENA_ALIGNMENT;
+    if (index >= m_heads.size() || m_heads[index] == nullptr) {
+      return nullptr;
+    }
+    void* memory = m_heads[index];
+    m_heads[index] = *static_cast<void**>(memory);
+    m_bytes -= size;
+    return memory;
+  }
+
+  /**
+   * Move all memory to another list and forward further additions to it.
+   * @param target the @a ArenaFreeList to move to.
+   */
+  void forwardTo(ArenaFreeList* target) {
+    for (size_t index = 0; index < m_heads.size(); index++) {
+      while (void* memory = pop(index*ARENA_ALIGNMENT)) {
+        target->push(memory, index*ARENA_ALIGNMENT);
+      }
+    }
+    m_heads.clear();
+    m_forward = target;
+  }
+
+  /**
+   * Get the number of bytes in the list.
+   * @return the number of bytes in the list.
+   */
+  size_t getBytes() const { return m_bytes; }
+
+
+ private:
+  /** the @a ArenaFreeList to forward to, or nullptr. */
+  ArenaFreeList* m_forward;
+
+  /** the first free memory by size class, each one linked to the next one in its first word. */
+  vector<void*> m_heads;
+
+  /** the number of bytes in the list. */
+  size_t m_bytes;
+};
+
+thread_local Arena* ArenaScope::s_current = nullptr;
+
+void* Arena::allocate(size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (size > ARENA_MAX_SMALL) {
+    // large allocations get a block of their own so that the current block is continued afterwards
+    char* block = static_cast<char*>(::operator new(size));
+    m_blocks.push_back(block);
+    m_bytes += size;
+    return block;
+  }
+  if (m_pos == nullptr || static_cast<size_t>(m_end - m_pos) < size) {
+    char* block = static_cast<char*>(::operator new(ARENA_BLOCK_SIZE));
+    m_blocks.push_back(block);
+    m_pos = block;
+    m_end = block + ARENA_BLOCK_SIZE;
+  }
+  void* ret = m_pos;
+  m_pos += size;
+  m_bytes += size;
+  return ret;
+}
+
+void* Arena::allocateObject(size_t size) {
+  size = (ARENA_ALIGNMENT + size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (m_freeLists.empty()) {
+    m_freeLists.push_back(new ArenaFreeList());
+  }
+  bool small = size <= ARENA_MAX_SMALL;
+  void* memory = small ? m_freeLists.front()->pop(size) : nullptr;
+  if (!memory) {
+    memory = allocate(size);
+  }
+  ArenaHeader* header = static_cast<ArenaHeader*>(memory);
+  header->m_freeList = m_freeLists.front();
+  header->m_size = small ? size : 0;
+  return static_cast<char*>(memory) + ARENA_ALIGNMENT;
+}
+
+void Arena::freeObject(void* header) {
+  ArenaHeader* arenaHeader = static_cast<ArenaHeader*>(header);
+  size_t size = arenaHeader->m_size;
+  if (size > 0) {
+    arenaHeader->m_freeList->resolve()->push(header, size);
+  }
+  // the memory of a large instance is freed together with the arena
+}
+
+size_t Arena::getFreeBytes() const {
+  return m_freeLists.empty() ? 0 : m_freeLists.front()->getBytes();
+}
+
+void Arena::clear() {
+  for (const auto block : m_blocks) {
+    ::operator delete(block);
+  }
+  m_blocks.clear();
+  for (const auto list : m_freeLists) {
+    delete list;
+  }
+  m_freeLists.clear();
+  m_pos = m_end = nullptr;
+  m_bytes = 0;
+}
+
+void Arena::adopt(Arena* other) {
+  if (other->m_blocks.empty()) {
+    return;
+  }
+  // the own current block is continued afterwards
+  m_blocks.insert(m_blocks.end(), other->m_blocks.begin(), other->m_blocks.end());
+  m_bytes += other->m_bytes;
+  if (!other->m_freeLists.empty()) {
+    // the adopted instances keep referencing their free lists, so these forward to the own one
+    if (m_freeLists.empty()) {
+      m_freeLists.push_back(new ArenaFreeList());
+    }
+    for (const auto list : other->m_freeLists) {
+      if (list->resolve() != m_freeLists.front()) {
+        list->forwardTo(m_freeLists.front());
+      }
+    }
+    m_freeLists.insert(m_freeLists.end(), other->m_freeLists.begin(), other->m_freeLists.end());
+    other->m_freeLists.clear();
+  }
+  other->m_blocks.clear();
+  other->m_pos = other->m_end = nullptr;
+  other->m_bytes = 0;
+}
+
+void Arena::swap(Arena* other) {
+  m_blocks.swap(other->m_blocks);
+  std::swap(m_pos, other->m_pos);
+  std::swap(m_end, other->m_end);
+  std::swap(m_bytes, other->m_bytes);
+  m_freeLists.swap(other->m_freeLists);
+}
+
+void* ArenaObject::operator new(size_t size) {
+  Arena* arena = ArenaScope::getCurrent();
+  if (arena) {
+    return arena->allocateObject(size);
+  }
+  ArenaHeader* header = static_cast<ArenaHeader*>(::operator new(ARENA_ALIGNMENT + size));
+  header->m_freeList = nullptr;
+  header->m_size = 0;
+  return reinterpret_cast<char*>(header) + ARENA_ALIGNMENT;
+}
+
+void ArenaObject::operator delete(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  ArenaHeader* header = reinterpret_cast<ArenaHeader*>(static_cast<char*>(ptr) - ARENA_ALIGNMENT);
+  if (header->m_freeList == nullptr) {
+    ::operator delete(header);
+  } else {
+    Arena::freeObject(header);
+  }
+}
+
+}  // namespace ebusd
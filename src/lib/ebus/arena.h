@@ -0,0 +1,208 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_ARENA_H_
+#define LIB_EBUS_ARENA_H_
+
+#include <stddef.h>
+#include <cstddef>
+#include <vector>
+
+namespace ebusd {
+
+/** @file lib/ebus/arena.h
+ * Arena allocation of the objects belonging to one loaded configuration generation.
+ *
+ * An @a Arena hands out memory from large blocks by just advancing a pointer,
+ * so that objects allocated one after the other (e.g. the fields of a message)
+ * sit together in memory, and frees all blocks at once when it is cleared.
+ * An @a ArenaObject allocates from the @a Arena of the innermost @a ArenaScope
+ * of the calling thread, or from the heap when there is none. Deleting an
+ * @a ArenaObject runs the destructor as usual and puts its arena memory on a
+ * free list by size class, from which the @a Arena serves the next allocation
+ * of the same size (e.g. when a definition is replaced), so that repeatedly
+ * replaced objects do not grow the @a Arena until it is cleared.
+ */
+
+using std::vector;
+
+/** the size of a block allocated by an @a Arena. */
+#define ARENA_BLOCK_SIZE (64*1024)
+
+/** the alignment of each allocation (also the size of the header in front of an @a ArenaObject). */
+#define ARENA_ALIGNMENT (alignof(std::max_align_t))
+
+class ArenaFreeList;
+
+/**
+ * A bump allocator freeing all its memory at once.
+ * Note: an instance is not thread safe and has to be used by a single thread at a time (including the deletion of
+ * the @a ArenaObject instances allocated from it).
+ */
+class Arena {
+ public:
+  /**
+   * Constructor.
+   */
+  Arena() : m_pos(nullptr), m_end(nullptr), m_bytes(0) {}
+
+  /**
+   * Destructor.
+   */
+  ~Arena() { clear(); }
+
+  /**
+   * Allocate memory.
+   * @param size the number of bytes to allocate.
+   * @return the allocated memory aligned to @a ARENA_ALIGNMENT.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Allocate memory for an @a ArenaObject with the header in front that allows returning it to the free list.
+   * @param size the size of the @a ArenaObject.
+   * @return the memory for the @a ArenaObject behind the header.
+   */
+  void* allocateObject(size_t size);
+
+  /**
+   * Return the memory of a deleted @a ArenaObject to the free list of the @a Arena it was allocated from.
+   * @param header the header in front of the @a ArenaObject as written by @a allocateObject().
+   */
+  static void freeObject(void* header);
+
+  /**
+   * Free all blocks.
+   * Note: the objects allocated from this instance have to be destructed before.
+   */
+  void clear();
+
+  /**
+   * Take over all blocks of another instance (e.g. when its objects were moved to the owner of this instance).
+   * @param other the @a Arena to take the blocks from (empty afterwards).
+   */
+  void adopt(Arena* other);
+
+  /**
+   * Swap the blocks with another instance (e.g. together with the objects of the owners).
+   * @param other the @a Arena to swap with.
+   */
+  void swap(Arena* other);
+
+  /**
+   * Get the number of allocated blocks.
+   * @return the number of allocated blocks.
+   */
+  size_t getBlockCount() const { return m_blocks.size(); }
+
+  /**
+   * Get the number of bytes handed out.
+   * @return the number of bytes handed out.
+   */
+  size_t getBytes() const { return m_bytes; }
+
+  /**
+   * Get the number of bytes of deleted @a ArenaObject instances kept for reuse.
+   * @return the number of bytes kept for reuse.
+   */
+  size_t getFreeBytes() const;
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  Arena(const Arena& src);
+
+  /** the allocated blocks. */
+  vector<char*> m_blocks;
+
+  /** the next free position in the current block, or nullptr. */
+  char* m_pos;
+
+  /** the end of the current block, or nullptr. */
+  char* m_end;
+
+  /** the number of bytes handed out. */
+  size_t m_bytes;
+
+  /** the @a ArenaFreeList instances referenced by the allocated @a ArenaObject instances (the first one serving
+   * the allocations, further ones taken over from other instances and forwarding to the first one). */
+  vector<ArenaFreeList*> m_freeLists;
+};
+
+
+/**
+ * Lets the @a ArenaObject instances created by the calling thread within the scope be allocated from an @a Arena.
+ */
+class ArenaScope {
+ public:
+  /**
+   * Constructor.
+   * @param arena the @a Arena to allocate from, or nullptr to allocate from the heap.
+   */
+  explicit ArenaScope(Arena* arena) : m_previous(s_current) {
+    s_current = arena;
+  }
+
+  /**
+   * Destructor.
+   */
+  ~ArenaScope() {
+    s_current = m_previous;
+  }
+
+  /**
+   * Get the @a Arena of the innermost scope of the calling thread.
+   * @return the @a Arena of the innermost scope of the calling thread, or nullptr.
+   */
+  static Arena* getCurrent() { return s_current; }
+
+
+ private:
+  /** the @a Arena of the enclosing scope, or nullptr. */
+  Arena* const m_previous;
+
+  /** the @a Arena of the innermost scope of the calling thread, or nullptr. */
+  static thread_local Arena* s_current;
+};
+
+
+/**
+ * Base class for objects allocated from the @a Arena of the current @a ArenaScope.
+ */
+class ArenaObject {
+ public:
+  /**
+   * Allocate an instance from the @a Arena of the current @a ArenaScope or from the heap.
+   * @param size the size of the instance.
+   * @return the allocated memory.
+   */
+  static void* operator new(size_t size);
+
+  /**
+   * Free an instance (or return it to the free list of its @a Arena).
+   * @param ptr the memory of the instance.
+   */
+  static void operator delete(void* ptr);
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_ARENA_H_
@@ -28,12 +28,27 @@
 #include <vector>
 #include <cstring>
 #include <algorithm>
+#include <typeinfo>
+#include <functional>
+#include <unordered_map>
 
 namespace ebusd {
 
 using std::dec;
 using std::hex;
 using std::setw;
+using std::hash;
+using std::unordered_multimap;
+
+/**
+ * Combine a hash value into another one.
+ * @param seed the hash value to combine into.
+ * @param value the hash value to combine.
+ * @return the combined hash value.
+ */
+static size_t combineHash(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
 
 /** the week day names. */
 static const char* dayNames[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
@@ -108,11 +123,35 @@ void AttributedItem::appendJson(bool prependFieldSeparator, const string& name,
   }
 }
 
+AttributedItem::~AttributedItem() {
+  for (const auto& entry : m_attributes) {
+    StringPool::release(*entry.first);
+    StringPool::release(*entry.second);
+  }
+  StringPool::release(m_name);
+}
+
+void AttributedItem::internAttributes(const map<string, string>& attributes) {
+  m_attributes.reserve(attributes.size());
+  for (const auto& entry : attributes) {
+    m_attributes.emplace_back(&StringPool::intern(entry.first), &StringPool::intern(entry.second));
+  }
+}
+
+size_t AttributedItem::getAttributesHash() const {
+  size_t ret = m_attributes.size();
+  for (const auto& entry : m_attributes) {
+    ret = combineHash(ret, hash<const void*>()(entry.first));
+    ret = combineHash(ret, hash<const void*>()(entry.second));
+  }
+  return ret;
+}
+
 void AttributedItem::mergeAttributes(map<string, string>* attributes) const {
   for (const auto& entry : m_attributes) {
-    const auto it = attributes->find(entry.first);
+    const auto it = attributes->find(*entry.first);
     if (it == attributes->end() || it->second.empty()) {
-      (*attributes)[entry.first] = entry.second;
+      (*attributes)[*entry.first] = *entry.second;
     }
   }
 }
@@ -128,8 +167,7 @@ void AttributedItem::dumpAttribute(bool prependFieldSeparator, bool asJson, cons
 
 bool AttributedItem::appendAttribute(OutputFormat outputFormat, const string& name, bool onlyIfNonEmpty,
     const string& prefix, const string& suffix, ostream* output) const {
-  const auto it = m_attributes.find(name);
-  string value = it == m_attributes.end() ? "" : it->second;
+  string value = getAttribute(name);
   if (onlyIfNonEmpty && value.empty()) {
     return false;
   }
@@ -150,22 +188,23 @@ bool AttributedItem::appendAttributes(OutputFormat outputFormat, ostream* output
     ret = appendAttribute(outputFormat, "comment", true, "[", "]", output) || ret;
   }
   if (outputFormat & OF_ALL_ATTRS) {
-    for (const auto entry : m_attributes) {
+    for (const auto& entry : m_attributes) {
       ret = true;
-      if (!entry.second.empty() && entry.first != "unit" && entry.first != "comment") {
-        const string& key = entry.first;
+      const string& key = *entry.first;
+      const string& value = *entry.second;
+      if (!value.empty() && key != "unit" && key != "comment") {
         if (outputFormat & OF_JSON) {
           if (key == "zz" || key == "qq") {
             result_t result = RESULT_EMPTY;
-            size_t addr = parseInt(entry.second.c_str(), 16, 0, 255, &result);
+            size_t addr = parseInt(value.c_str(), 16, 0, 255, &result);
             if (result == RESULT_OK) {
               *output << FIELD_SEPARATOR << " \"" << key << "\": " << addr;
               continue;
             }
           }
-          appendJson(true, key, entry.second, false, output);
+          appendJson(true, key, value, false, output);
         } else {
-          *output << " " << key << "=" << entry.second;
+          *output << " " << key << "=" << value;
         }
       }
     }
@@ -174,11 +213,20 @@ bool AttributedItem::appendAttributes(OutputFormat outputFormat, ostream* output
 }
 
 string AttributedItem::getAttribute(const string& name) const {
-  const auto it = m_attributes.find(name);
-  return it == m_attributes.end() ? "" : it->second;
+  for (const auto& entry : m_attributes) {
+    if (*entry.first == name) {
+      return *entry.second;
+    }
+  }
+  return "";
 }
 
 
+void* DataField::operator new(size_t size) {
+  ArenaScope heapScope(nullptr);
+  return ArenaObject::operator new(size);
+}
+
 result_t DataField::create(bool isWriteMessage, bool isTemplate, bool isBroadcastOrMasterDestination,
     size_t maxFieldLength, const DataFieldTemplates* templates, vector< map<string, string> >* rows,
     string* errorDescription, const DataField** returnField) {
@@ -497,6 +545,28 @@ void SingleDataField::dump(bool prependFieldSeparator, bool asJson, ostream* out
   dumpSuffix(asJson, output);
 }
 
+void SingleDataField::addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const {
+  usage->add(kind, sizeof(SingleDataField) + getAttributesSize());
+}
+
+bool SingleDataField::isIdentical(const DataField& other) const {
+  if (typeid(other) != typeid(*this)) {
+    return false;
+  }
+  const SingleDataField& field = static_cast<const SingleDataField&>(other);
+  // names and attributes are interned, data types are shared
+  return &field.m_name == &m_name && hasSameAttributes(field) && field.m_partType == m_partType
+      && field.m_dataType == m_dataType && field.m_length == m_length;
+}
+
+size_t SingleDataField::getStructureHash() const {
+  size_t ret = hash<const void*>()(&m_name);
+  ret = combineHash(ret, getAttributesHash());
+  ret = combineHash(ret, hash<const void*>()(m_dataType));
+  ret = combineHash(ret, static_cast<size_t>(m_partType));
+  return combineHash(ret, m_length);
+}
+
 result_t SingleDataField::read(const SymbolString& data, size_t offset,
     const char* fieldName, ssize_t fieldIndex, unsigned int* output) const {
   if (m_partType == pt_any) {
@@ -516,6 +586,33 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
   return res;
 }
 
+result_t SingleDataField::read(const SymbolString& data, size_t offset,
+    const char* fieldName, ssize_t fieldIndex, float* output) const {
+  if (m_partType == pt_any) {
+    return RESULT_ERR_INVALID_PART;
+  }
+  if ((data.isMaster() ? pt_masterData : pt_slaveData) != m_partType) {
+    return RESULT_EMPTY;
+  }
+  bool remainder = m_length == REMAIN_LEN && m_dataType->isAdjustableLength();
+  if (offset + (remainder?1:m_length) > data.getDataSize()) {
+    return RESULT_ERR_INVALID_POS;
+  }
+  if (isIgnored() || (fieldName != nullptr && m_name != fieldName) || fieldIndex > 0) {
+    return RESULT_EMPTY;
+  }
+  if (!m_dataType->isNumeric()) {
+    return RESULT_ERR_INVALID_NUM;
+  }
+  const NumberDataType* numType = reinterpret_cast<const NumberDataType*>(m_dataType);
+  unsigned int value = 0;
+  result_t res = numType->readRawValue(offset, m_length, data, &value);
+  if (res != RESULT_OK) {
+    return res;
+  }
+  return numType->convertRawValue(value, output);
+}
+
 result_t SingleDataField::read(const SymbolString& data, size_t offset,
     bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
     OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
@@ -532,6 +629,74 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
   if (isIgnored() || (fieldName != nullptr && m_name != fieldName) || fieldIndex > 0) {
     return RESULT_EMPTY;
   }
+  writeValuePrefix(leadingSeparator, fieldIndex, outputFormat, outputIndex, output);
+  result_t result = readSymbols(data, offset, outputFormat, output);
+  if (result != RESULT_OK) {
+    return result;
+  }
+  writeValueSuffix(outputFormat, output);
+  return RESULT_OK;
+}
+
+result_t SingleDataField::readCompiled(const DecodeOp& op, const SymbolString& data, size_t offset,
+    bool leadingSeparator, OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
+  writeValuePrefix(leadingSeparator, -1, outputFormat, outputIndex, output);
+  result_t result;
+  if (op.m_specialized) {
+    result = op.m_number->readSymbols(offset, op.m_length, data, outputFormat, output);
+  } else if (op.m_number) {
+    unsigned int value = 0;
+    if (op.m_reverse) {
+      for (size_t i = 0; i < op.m_length; i++) {
+        value = (value << 8) | data.dataAt(offset + i);
+      }
+    } else {
+      for (size_t i = op.m_length; i > 0; i--) {
+        value = (value << 8) | data.dataAt(offset + i - 1);
+      }
+    }
+    value = (value >> op.m_shift) & op.m_mask;
+    result = op.m_number->formatRawValue(value, op.m_length, outputFormat, output);
+  } else {
+    result = readSymbols(data, offset, outputFormat, output);
+  }
+  if (result != RESULT_OK) {
+    return result;
+  }
+  writeValueSuffix(outputFormat, output);
+  return RESULT_OK;
+}
+
+bool SingleDataField::compile(size_t offset, DecodeOp* op) const {
+  if (m_length == REMAIN_LEN || m_partType == pt_any) {
+    return false;
+  }
+  op->m_field = this;
+  op->m_number = nullptr;
+  op->m_offset = offset;
+  op->m_length = m_length;
+  op->m_reverse = m_dataType->hasFlag(REV);
+  op->m_shift = 0;
+  op->m_mask = 0;
+  op->m_ignored = isIgnored();
+  op->m_specialized = false;
+  const NumberDataType* num = typeid(*this) == typeid(SingleDataField) && m_length > 0 && m_length <= 4
+      ? dynamic_cast<const NumberDataType*>(m_dataType) : nullptr;
+  if (num != nullptr && num->hasSpecializedDecoder(m_length)) {
+    // number with a decoder specialized at compile time
+    op->m_number = num;
+    op->m_specialized = true;
+  } else if (num != nullptr && !num->hasFlag(BCD)) {
+    // plain number that can be decoded directly
+    op->m_number = num;
+    op->m_shift = num->getFirstBit() > 0 ? num->getFirstBit() : 0;
+    op->m_mask = num->getBitCount() < 8 ? (1 << num->getBitCount()) - 1 : ~0U;
+  }
+  return true;
+}
+
+void SingleDataField::writeValuePrefix(bool leadingSeparator, ssize_t fieldIndex, OutputFormat outputFormat,
+    ssize_t outputIndex, ostream* output) const {
   bool shortFormat = outputFormat & OF_SHORT;
   if (outputFormat & OF_JSON) {
     if (leadingSeparator) {
@@ -563,18 +728,16 @@ result_t SingleDataField::read(const SymbolString& data, size_t offset,
       *output << m_name << "=";
     }
   }
+}
 
-  result_t result = readSymbols(data, offset, outputFormat, output);
-  if (result != RESULT_OK) {
-    return result;
-  }
-  if (!shortFormat) {
-    appendAttributes(outputFormat, output);
+void SingleDataField::writeValueSuffix(OutputFormat outputFormat, ostream* output) const {
+  if (outputFormat & OF_SHORT) {
+    return;
   }
-  if (!shortFormat && (outputFormat & OF_JSON)) {
+  appendAttributes(outputFormat, output);
+  if (outputFormat & OF_JSON) {
     *output << "}";
   }
-  return RESULT_OK;
 }
 
 result_t SingleDataField::write(char separator, size_t offset, istringstream* input,
@@ -724,6 +887,28 @@ void ValueListDataField::dump(bool prependFieldSeparator, bool asJson, ostream*
   dumpSuffix(asJson, output);
 }
 
+void ValueListDataField::addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const {
+  size_t bytes = sizeof(ValueListDataField) + getAttributesSize();
+  for (const auto& it : m_values) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.second);
+  }
+  usage->add(kind, bytes);
+}
+
+bool ValueListDataField::isIdentical(const DataField& other) const {
+  return SingleDataField::isIdentical(other)
+      && static_cast<const ValueListDataField&>(other).m_values == m_values;
+}
+
+size_t ValueListDataField::getStructureHash() const {
+  size_t ret = SingleDataField::getStructureHash();
+  for (const auto& it : m_values) {
+    ret = combineHash(ret, it.first);
+    ret = combineHash(ret, hash<string>()(it.second));
+  }
+  return ret;
+}
+
 result_t ValueListDataField::readSymbols(const SymbolString& input, size_t offset,
     OutputFormat outputFormat, ostream* output) const {
   unsigned int value = 0;
@@ -800,11 +985,7 @@ result_t ConstantDataField::derive(const string& name, PartType partType, int di
     return RESULT_ERR_INVALID_PART;  // cannot create a template from a concrete instance
   }
   string useName = name.empty() ? m_name : name;
-  for (const auto entry : m_attributes) {  // merge with this attributes
-    if ((*attributes)[entry.first].empty()) {
-      (*attributes)[entry.first] = entry.second;
-    }
-  }
+  mergeAttributes(attributes);
   if (divisor != 0) {
     return RESULT_ERR_INVALID_ARG;  // cannot use other than current divisor for constant value field
   }
@@ -827,6 +1008,22 @@ void ConstantDataField::dump(bool prependFieldSeparator, bool asJson, ostream* o
   dumpSuffix(asJson, output);
 }
 
+void ConstantDataField::addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const {
+  usage->add(kind, sizeof(ConstantDataField) + getAttributesSize() + MemoryUsage::getHeapSize(m_value));
+}
+
+bool ConstantDataField::isIdentical(const DataField& other) const {
+  if (!SingleDataField::isIdentical(other)) {
+    return false;
+  }
+  const ConstantDataField& field = static_cast<const ConstantDataField&>(other);
+  return field.m_value == m_value && field.m_verify == m_verify;
+}
+
+size_t ConstantDataField::getStructureHash() const {
+  return combineHash(combineHash(SingleDataField::getStructureHash(), hash<string>()(m_value)), m_verify ? 1 : 0);
+}
+
 result_t ConstantDataField::readSymbols(const SymbolString& input, size_t offset,
     OutputFormat outputFormat, ostream* output) const {
   ostringstream coutput;
@@ -1007,8 +1204,51 @@ void DataFieldSet::dump(bool prependFieldSeparator, bool asJson, ostream* output
   }
 }
 
+void DataFieldSet::addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const {
+  usage->add(kind, sizeof(DataFieldSet) + getAttributesSize() + m_fields.capacity()*sizeof(SingleDataField*)
+      + (m_masterOps.capacity() + m_slaveOps.capacity())*sizeof(DecodeOp));
+  for (const auto field : m_fields) {
+    field->addMemoryUsage(kind, usage);
+  }
+}
+
+bool DataFieldSet::isIdentical(const DataField& other) const {
+  if (typeid(other) != typeid(*this)) {
+    return false;
+  }
+  const DataFieldSet& set = static_cast<const DataFieldSet&>(other);
+  if (&set.m_name != &m_name || !hasSameAttributes(set) || set.m_fields.size() != m_fields.size()) {
+    return false;
+  }
+  for (size_t index = 0; index < m_fields.size(); index++) {
+    if (!m_fields[index]->isIdentical(*set.m_fields[index])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t DataFieldSet::getStructureHash() const {
+  size_t ret = combineHash(hash<const void*>()(&m_name), getAttributesHash());
+  for (const auto field : m_fields) {
+    ret = combineHash(ret, field->getStructureHash());
+  }
+  return ret;
+}
+
 result_t DataFieldSet::read(const SymbolString& data, size_t offset,
     const char* fieldName, ssize_t fieldIndex, unsigned int* output) const {
+  return readNumeric(data, offset, fieldName, fieldIndex, output);
+}
+
+result_t DataFieldSet::read(const SymbolString& data, size_t offset,
+    const char* fieldName, ssize_t fieldIndex, float* output) const {
+  return readNumeric(data, offset, fieldName, fieldIndex, output);
+}
+
+template <typename T>
+result_t DataFieldSet::readNumeric(const SymbolString& data, size_t offset,
+    const char* fieldName, ssize_t fieldIndex, T* output) const {
   bool previousFullByteOffset = true, found = false, findFieldIndex = fieldIndex >= 0;
   PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
   for (const auto field : m_fields) {
@@ -1045,6 +1285,62 @@ result_t DataFieldSet::read(const SymbolString& data, size_t offset,
   return RESULT_OK;
 }
 
+void DataFieldSet::compile() {
+  m_compiled = false;
+  m_masterOps.clear();
+  m_slaveOps.clear();
+  for (const auto partType : {pt_masterData, pt_slaveData}) {
+    vector<DecodeOp>* ops = partType == pt_masterData ? &m_masterOps : &m_slaveOps;
+    bool previousFullByteOffset = true;
+    size_t offset = 0;
+    ssize_t outputIndex = 0;
+    for (const auto field : m_fields) {
+      if (field->getPartType() == partType) {
+        if (!previousFullByteOffset && !field->hasFullByteOffset(false)) {
+          offset--;
+        }
+        DecodeOp op;
+        if (!field->compile(offset, &op)) {
+          m_masterOps.clear();
+          m_slaveOps.clear();
+          return;
+        }
+        op.m_outputIndex = outputIndex;
+        ops->push_back(op);
+        offset += op.m_length;
+        previousFullByteOffset = field->hasFullByteOffset(true);
+      }
+      if (!field->isIgnored()) {
+        outputIndex++;
+      }
+    }
+  }
+  m_compiled = true;
+}
+
+result_t DataFieldSet::readCompiled(const SymbolString& data, size_t offset, bool leadingSeparator,
+    OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
+  const vector<DecodeOp>& ops = data.isMaster() ? m_masterOps : m_slaveOps;
+  size_t dataSize = data.getDataSize();
+  bool found = false;
+  for (const auto& op : ops) {
+    if (offset + op.m_offset + op.m_length > dataSize) {
+      return RESULT_ERR_INVALID_POS;
+    }
+    if (op.m_ignored) {
+      continue;
+    }
+    result_t result = op.m_field->readCompiled(op, data, offset + op.m_offset, leadingSeparator, outputFormat,
+        outputIndex < 0 ? -1 : outputIndex + op.m_outputIndex, output);
+    if (result != RESULT_OK) {
+      return result;
+    }
+    found = true;
+    leadingSeparator = true;
+  }
+  return found ? RESULT_OK : RESULT_EMPTY;
+}
+
 result_t DataFieldSet::read(const SymbolString& data, size_t offset,
     bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
     OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const {
@@ -1052,6 +1348,9 @@ result_t DataFieldSet::read(const SymbolString& data, size_t offset,
   if (outputIndex < 0 && (!m_uniqueNames || ((outputFormat & OF_JSON) && !(outputFormat & OF_NAMES)))) {
     outputIndex = 0;
   }
+  if (m_compiled && fieldName == nullptr && fieldIndex < 0) {
+    return readCompiled(data, offset, leadingSeparator, outputFormat, outputIndex, output);
+  }
   PartType partType = data.isMaster() ? pt_masterData : pt_slaveData;
   for (const auto field : m_fields) {
     if (field->getPartType() != partType) {
@@ -1248,6 +1547,7 @@ result_t LoadableDataFieldSet::addFromFile(const string& filename, unsigned int
       }
     }
   }
+  compile();
   return result;
 }
 
@@ -1285,6 +1585,14 @@ result_t DataFieldTemplates::add(const DataField* field, string name, bool repla
   return RESULT_OK;
 }
 
+void DataFieldTemplates::addMemoryUsage(MemoryUsage* usage) const {
+  usage->add(mk_templates, sizeof(DataFieldTemplates), 0);
+  for (const auto& it : m_fieldsByName) {
+    usage->add(mk_templates, MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first), 0);
+    it.second->addMemoryUsage(mk_templates, usage);
+  }
+}
+
 result_t DataFieldTemplates::getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription)
     const {
   // name[:usename],basetype[:len]|template[:usename][,[divisor|values][,[unit][,[comment]]]]
@@ -1412,4 +1720,113 @@ const DataField* DataFieldTemplates::get(const string& name) const {
   return ref->second;
 }
 
+
+
+/** a pooled @a DataField with its number of references. */
+struct PooledField {
+  /** the shared @a DataField. */
+  const DataField* field;
+
+  /** the number of references to the shared @a DataField. */
+  size_t references;
+};
+
+/** the content of the @a DataFieldPool (constructed on first use). */
+struct FieldPoolContent {
+  /** the @a Mutex for accessing the pool. */
+  Mutex mutex;
+
+  /** the pooled fields by structure hash. */
+  unordered_multimap<size_t, PooledField> fields;
+
+  /** the total number of references to the pooled fields. */
+  size_t references = 0;
+};
+
+/**
+ * Return the content of the @a DataFieldPool.
+ * @return the content of the @a DataFieldPool.
+ */
+static FieldPoolContent& getFieldPoolContent() {
+  static FieldPoolContent content;
+  return content;
+}
+
+const DataField* DataFieldPool::intern(const DataField* field) {
+  FieldPoolContent& content = getFieldPoolContent();
+  size_t key = field->getStructureHash();
+  content.mutex.lock();
+  content.references++;
+  auto range = content.fields.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.field == field || it->second.field->isIdentical(*field)) {
+      it->second.references++;
+      const DataField* shared = it->second.field;
+      content.mutex.unlock();
+      if (shared != field) {
+        delete field;
+      }
+      return shared;
+    }
+  }
+  content.fields.emplace(key, PooledField{field, 1});
+  content.mutex.unlock();
+  return field;
+}
+
+void DataFieldPool::release(const DataField* field) {
+  if (!field) {
+    return;
+  }
+  FieldPoolContent& content = getFieldPoolContent();
+  size_t key = field->getStructureHash();
+  content.mutex.lock();
+  auto range = content.fields.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.field != field) {
+      continue;
+    }
+    content.references--;
+    if (--it->second.references > 0) {
+      content.mutex.unlock();
+      return;
+    }
+    content.fields.erase(it);
+    break;
+  }
+  content.mutex.unlock();
+  delete field;
+}
+
+bool DataFieldPool::contains(const DataField* field) {
+  FieldPoolContent& content = getFieldPoolContent();
+  size_t key = field->getStructureHash();
+  content.mutex.lock();
+  bool found = false;
+  auto range = content.fields.equal_range(key);
+  for (auto it = range.first; it != range.second && !found; ++it) {
+    found = it->second.field == field;
+  }
+  content.mutex.unlock();
+  return found;
+}
+
+void DataFieldPool::getStats(size_t* count, size_t* references) {
+  FieldPoolContent& content = getFieldPoolContent();
+  content.mutex.lock();
+  *count = content.fields.size();
+  *references = content.references;
+  content.mutex.unlock();
+}
+
+void DataFieldPool::addMemoryUsage(MemoryUsage* usage) {
+  FieldPoolContent& content = getFieldPoolContent();
+  content.mutex.lock();
+  usage->add(mk_fields, content.fields.size()*(MEMORY_NODE_OVERHEAD + sizeof(size_t) + sizeof(PooledField)), 0);
+  for (const auto& it : content.fields) {
+    it.second.field->addMemoryUsage(mk_fields, usage);
+  }
+  content.mutex.unlock();
+}
+
 }  // namespace ebusd
@@ -25,11 +25,14 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <utility>
 #include <climits>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/filereader.h"
 #include "lib/ebus/datatype.h"
+#include "lib/ebus/stringpool.h"
+#include "lib/ebus/arena.h"
 
 namespace ebusd {
 
@@ -49,14 +52,16 @@ namespace ebusd {
  * class.
  */
 
+using std::pair;
 
 class DataFieldTemplates;
 class SingleDataField;
 
 /**
- * Base class for named items with optional named attributes.
+ * Base class for named items with optional named attributes (allocated from the @a Arena of the current
+ * @a ArenaScope).
  */
-class AttributedItem {
+class AttributedItem : public ArenaObject {
  public:
   /**
    * Constructs a new instance.
@@ -64,19 +69,33 @@ class AttributedItem {
    * @param attributes the additional named attributes.
    */
   AttributedItem(const string& name, const map<string, string>& attributes)
-    : m_name(name), m_attributes(attributes) {}
+    : m_name(StringPool::intern(name)) {
+    internAttributes(attributes);
+  }
 
   /**
    * Constructs a new instance (without additional attributes).
    * @param name the field name.
    */
   explicit AttributedItem(const string& name)
-    : m_name(name) {}
+    : m_name(StringPool::intern(name)) {}
+
+  /**
+   * Copy constructor.
+   * @param other the @a AttributedItem to copy from.
+   */
+  AttributedItem(const AttributedItem& other)
+    : m_name(StringPool::intern(other.m_name)) {
+    m_attributes.reserve(other.m_attributes.size());
+    for (const auto& entry : other.m_attributes) {
+      m_attributes.emplace_back(&StringPool::intern(*entry.first), &StringPool::intern(*entry.second));
+    }
+  }
 
   /**
    * Destructor.
    */
-  virtual ~AttributedItem() {}
+  virtual ~AttributedItem();
 
 
   /**
@@ -164,19 +183,60 @@ class AttributedItem {
 
 
  protected:
-  /** the field name. */
-  const string m_name;
+  /**
+   * Return whether the additional named attributes are the same as those of the other instance.
+   * @param other the other @a AttributedItem.
+   * @return whether the additional named attributes are the same.
+   */
+  bool hasSameAttributes(const AttributedItem& other) const { return other.m_attributes == m_attributes; }
+
+  /**
+   * Calculate the hash of the additional named attributes.
+   * @return the hash of the additional named attributes.
+   */
+  size_t getAttributesHash() const;
+
+  /**
+   * Get the number of bytes allocated for the additional named attributes (the interned strings not included).
+   * @return the number of bytes allocated for the additional named attributes.
+   */
+  size_t getAttributesSize() const { return m_attributes.capacity()*sizeof(m_attributes[0]); }
+
+  /** the field name (interned). */
+  const string& m_name;
 
-  /** the additional named attributes. */
-  const map<string, string> m_attributes;
+  /** the additional named attributes ordered by name as pairs of interned name and interned value. */
+  vector<pair<const string*, const string*>> m_attributes;
+
+
+ private:
+  /**
+   * Set the additional named attributes from the map using interned names and values.
+   * @param attributes the additional named attributes.
+   */
+  void internAttributes(const map<string, string>& attributes);
 };
 
 
 /**
- * Base class for all kinds of data fields.
+ * Base class for all kinds of data fields (always allocated from the heap, as they are shared via the
+ * @a DataFieldPool and the @a DataFieldTemplates beyond a single configuration generation).
  */
 class DataField : public AttributedItem {
  public:
+  /**
+   * Allocate an instance from the heap regardless of the current @a ArenaScope.
+   * @param size the size of the instance.
+   * @return the allocated memory.
+   */
+  static void* operator new(size_t size);
+
+  /**
+   * Free an instance.
+   * @param ptr the memory of the instance.
+   */
+  static void operator delete(void* ptr) { ArenaObject::operator delete(ptr); }
+
   /**
    * Constructs a new instance.
    * @param name the field name.
@@ -278,6 +338,27 @@ class DataField : public AttributedItem {
    */
   virtual void dump(bool prependFieldSeparator, bool asJson, ostream* output) const = 0;
 
+  /**
+   * Add the approximate memory used by this field to the @a MemoryUsage.
+   * @param kind the @a MemoryKind to add to.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  virtual void addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const = 0;
+
+  /**
+   * Return whether this field is structurally identical to another one, i.e. it has the same kind, names,
+   * attributes, types, and values, so that it reads and writes the same way.
+   * @param other the @a DataField to compare with.
+   * @return true if this field is structurally identical to @a other.
+   */
+  virtual bool isIdentical(const DataField& other) const = 0;
+
+  /**
+   * Calculate the hash of the structure compared by @a isIdentical().
+   * @return the hash of the structure.
+   */
+  virtual size_t getStructureHash() const = 0;
+
   /**
    * Return whether the field is available.
    * @param fieldName the name of the field to find, or nullptr for any.
@@ -301,6 +382,21 @@ class DataField : public AttributedItem {
   virtual result_t read(const SymbolString& data, size_t offset,
       const char* fieldName, ssize_t fieldIndex, unsigned int* output) const = 0;
 
+  /**
+   * Reads the numeric value from the @a SymbolString and convert it to the value it represents.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param fieldName the name of the field to read, or nullptr for the first field.
+   * @param fieldIndex the optional index of the field (either named or overall), or -1.
+   * @param output the variable in which to store the value (including divisor).
+   * @return @a RESULT_OK on success,
+   * or @a RESULT_EMPTY if the field was skipped (either if the partType does
+   * not match or ignored, or due to @a fieldName or @a fieldIndex, or the value is the replacement value),
+   * or an error code.
+   */
+  virtual result_t read(const SymbolString& data, size_t offset,
+      const char* fieldName, ssize_t fieldIndex, float* output) const = 0;
+
   /**
    * Reads the value from the @a SymbolString.
    * @param data the data @a SymbolString for reading binary data.
@@ -333,6 +429,42 @@ class DataField : public AttributedItem {
 };
 
 
+/**
+ * A compiled decode operation for a single field within a @a DataFieldSet.
+ */
+struct DecodeOp {
+  /** the @a SingleDataField to decode. */
+  const SingleDataField* m_field;
+
+  /** the @a NumberDataType for decoding the raw value directly, or nullptr to use the field. */
+  const NumberDataType* m_number;
+
+  /** the offset in the message part relative to the offset of the @a DataFieldSet. */
+  size_t m_offset;
+
+  /** the number of symbols to read. */
+  size_t m_length;
+
+  /** whether the most significant byte comes first. */
+  bool m_reverse;
+
+  /** the number of bits to shift the raw value right. */
+  int16_t m_shift;
+
+  /** the mask to apply to the shifted raw value. */
+  unsigned int m_mask;
+
+  /** whether the field is ignored. */
+  bool m_ignored;
+
+  /** whether @a m_number decodes the whole value with its specialized @a DataType::readSymbols(). */
+  bool m_specialized;
+
+  /** the index of the field within the non-ignored fields of the @a DataFieldSet. */
+  ssize_t m_outputIndex;
+};
+
+
 /**
  * A single @a DataField holding a value.
  */
@@ -432,6 +564,15 @@ class SingleDataField : public DataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const override;
+
+  // @copydoc
+  bool isIdentical(const DataField& other) const override;
+
+  // @copydoc
+  size_t getStructureHash() const override;
+
   // @copydoc
   bool hasField(const char* fieldName, bool numeric) const override;
 
@@ -439,6 +580,10 @@ class SingleDataField : public DataField {
   result_t read(const SymbolString& data, size_t offset,
       const char* fieldName, ssize_t fieldIndex, unsigned int* output) const override;
 
+  // @copydoc
+  result_t read(const SymbolString& data, size_t offset,
+      const char* fieldName, ssize_t fieldIndex, float* output) const override;
+
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
@@ -448,6 +593,28 @@ class SingleDataField : public DataField {
   result_t write(char separator, size_t offset, istringstream* input,
       SymbolString* data, size_t* usedLength) const override;
 
+  /**
+   * Build the @a DecodeOp for this field.
+   * @param offset the offset of this field relative to the offset of the @a DataFieldSet.
+   * @param op the @a DecodeOp to fill (except for the index).
+   * @return true on success, false if this field can not be compiled (e.g. due to a remainder length).
+   */
+  bool compile(size_t offset, DecodeOp* op) const;
+
+  /**
+   * Reads the value from the @a SymbolString using a compiled @a DecodeOp (without any range checks).
+   * @param op the @a DecodeOp of this field.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the offset of this field in the data (i.e. including the offset of the @a DecodeOp).
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a ostream to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t readCompiled(const DecodeOp& op, const SymbolString& data, size_t offset,
+      bool leadingSeparator, OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const;
+
 
  protected:
   /**
@@ -480,6 +647,26 @@ class SingleDataField : public DataField {
 
   /** the number of symbols in the message part in which the field is stored. */
   const size_t m_length;
+
+
+ private:
+  /**
+   * Write the formatted prefix of the value to the output (separator and name).
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldIndex the optional index of the field to limit the output to, or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a ostream to append the formatted prefix to.
+   */
+  void writeValuePrefix(bool leadingSeparator, ssize_t fieldIndex, OutputFormat outputFormat,
+      ssize_t outputIndex, ostream* output) const;
+
+  /**
+   * Write the formatted suffix of the value to the output (attributes).
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a ostream to append the formatted suffix to.
+   */
+  void writeValueSuffix(OutputFormat outputFormat, ostream* output) const;
 };
 
 
@@ -518,6 +705,15 @@ class ValueListDataField : public SingleDataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const override;
+
+  // @copydoc
+  bool isIdentical(const DataField& other) const override;
+
+  // @copydoc
+  size_t getStructureHash() const override;
+
 
  protected:
   // @copydoc
@@ -571,6 +767,15 @@ class ConstantDataField : public SingleDataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const override;
+
+  // @copydoc
+  bool isIdentical(const DataField& other) const override;
+
+  // @copydoc
+  size_t getStructureHash() const override;
+
 
  protected:
   // @copydoc
@@ -633,6 +838,7 @@ class DataFieldSet : public DataField {
     }
     m_uniqueNames = uniqueNames;
     m_ignoredCount = ignoredCount;
+    compile();
   }
 
   /**
@@ -684,10 +890,23 @@ class DataFieldSet : public DataField {
   // @copydoc
   void dump(bool prependFieldSeparator, bool asJson, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryKind kind, MemoryUsage* usage) const override;
+
+  // @copydoc
+  bool isIdentical(const DataField& other) const override;
+
+  // @copydoc
+  size_t getStructureHash() const override;
+
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       const char* fieldName, ssize_t fieldIndex, unsigned int* output) const override;
 
+  // @copydoc
+  result_t read(const SymbolString& data, size_t offset,
+      const char* fieldName, ssize_t fieldIndex, float* output) const override;
+
   // @copydoc
   result_t read(const SymbolString& data, size_t offset,
       bool leadingSeparator, const char* fieldName, ssize_t fieldIndex,
@@ -699,10 +918,41 @@ class DataFieldSet : public DataField {
 
 
  private:
+  /**
+   * Reads all values from the @a SymbolString using the compiled @a DecodeOp instances.
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param outputIndex the optional index of the field when using an indexed output format, or -1.
+   * @param output the @a ostream to append the formatted value to.
+   * @return @a RESULT_OK on success, or @a RESULT_EMPTY if no field was read, or an error code.
+   */
+  result_t readCompiled(const SymbolString& data, size_t offset, bool leadingSeparator,
+      OutputFormat outputFormat, ssize_t outputIndex, ostream* output) const;
+
+  /**
+   * Reads the numeric value from the @a SymbolString (shared by the numeric @a read() variants).
+   * @param data the data @a SymbolString for reading binary data.
+   * @param offset the additional offset to add for reading binary data.
+   * @param fieldName the name of the field to read, or nullptr for the first field.
+   * @param fieldIndex the optional index of the field (either named or overall), or -1.
+   * @param output the variable in which to store the value.
+   * @return @a RESULT_OK on success, or @a RESULT_EMPTY if the field was skipped, or an error code.
+   */
+  template <typename T>
+  result_t readNumeric(const SymbolString& data, size_t offset,
+      const char* fieldName, ssize_t fieldIndex, T* output) const;
+
   /** the @a DataFieldSet containing the ident message @a SingleDataField instances, or nullptr. */
   static DataFieldSet* s_identFields;
 
  protected:
+  /**
+   * Build the compiled @a DecodeOp instances from the fields.
+   */
+  void compile();
+
   /** the @a vector of @a SingleDataField instances part of this set. */
   vector<const SingleDataField*> m_fields;
 
@@ -711,6 +961,15 @@ class DataFieldSet : public DataField {
 
   /** the number of ignored fields. */
   size_t m_ignoredCount;
+
+  /** whether the fields were compiled to @a m_masterOps and @a m_slaveOps (i.e. all fields have a fixed length). */
+  bool m_compiled;
+
+  /** the compiled @a DecodeOp instances for the master data. */
+  vector<DecodeOp> m_masterOps;
+
+  /** the compiled @a DecodeOp instances for the slave data. */
+  vector<DecodeOp> m_slaveOps;
 };
 
 
@@ -779,6 +1038,12 @@ class DataFieldTemplates : public MappedFileReader {
    */
   result_t add(const DataField* field, string name = "", bool replace = false);
 
+  /**
+   * Add the approximate memory used by the templates to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const;
+
   // @copydoc
   result_t getFieldMap(const string& preferLanguage, vector<string>* row, string* errorDescription) const override;
 
@@ -800,6 +1065,48 @@ class DataFieldTemplates : public MappedFileReader {
   map<string, const DataField*> m_fieldsByName;
 };
 
+
+/**
+ * Process wide pool of structurally identical message @a DataField instances shared by reference counting (like
+ * the @a DataFieldSet of the identification message is shared by all scan messages).
+ * The pooled instances are owned by the pool and therefore allocated from the heap (see @a DataField).
+ */
+class DataFieldPool {
+ public:
+  /**
+   * Return the shared instance structurally identical to the field.
+   * @param field the @a DataField to intern (deleted if an identical instance is already pooled).
+   * @return the shared instance to use instead of @a field (to be released with @a release()).
+   */
+  static const DataField* intern(const DataField* field);
+
+  /**
+   * Release a reference to a shared instance and delete it together with the last reference.
+   * @param field the @a DataField returned by @a intern(), or any other unpooled instance to delete directly.
+   */
+  static void release(const DataField* field);
+
+  /**
+   * Return whether the instance is pooled.
+   * @param field the @a DataField to check.
+   * @return true if the instance is pooled.
+   */
+  static bool contains(const DataField* field);
+
+  /**
+   * Get the statistics of the pool.
+   * @param count the variable in which to store the number of distinct pooled instances.
+   * @param references the variable in which to store the number of references to the pooled instances.
+   */
+  static void getStats(size_t* count, size_t* references);
+
+  /**
+   * Add the pooled instances to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  static void addMemoryUsage(MemoryUsage* usage);
+};
+
 }  // namespace ebusd
 
 #endif  // LIB_EBUS_DATA_H_
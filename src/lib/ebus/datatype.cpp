@@ -580,15 +580,49 @@ result_t NumberDataType::derive(int divisor, size_t bitCount, const NumberDataTy
   } else {
     return RESULT_ERR_INVALID_ARG;
   }
+  const NumberDataType* baseType = m_baseType ? m_baseType : this;
+  if (divisor == baseType->m_divisor && bitCount == baseType->m_bitCount) {
+    *derived = baseType;
+    return RESULT_OK;
+  }
+  DataTypeList* list = DataTypeList::getInstance();
+  *derived = list->getDerived(baseType, divisor, bitCount);
+  if (*derived == nullptr) {
+    *derived = list->addDerived(baseType, divisor, bitCount, createDerived(divisor, bitCount, baseType));
+  }
+  return RESULT_OK;
+}
+
+NumberDataType* NumberDataType::createDerived(int divisor, size_t bitCount, const NumberDataType* baseType) const {
   if (m_bitCount < 8) {
-    *derived = new NumberDataType(m_id, bitCount, m_flags, m_replacement,
-      m_firstBit, divisor, m_baseType ? m_baseType : this);
+    return new NumberDataType(m_id, bitCount, m_flags, m_replacement, m_firstBit, divisor, baseType);
+  }
+  return new NumberDataType(m_id, bitCount, m_flags, m_replacement, m_minValue, m_maxValue, divisor, baseType);
+}
+
+void NumberDataType::writeInteger(int value, ostream* output) {
+  char buffer[12];
+  char* pos = buffer + sizeof(buffer);
+  unsigned int remain = value < 0 ? 0U - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+  do {
+    *--pos = static_cast<char>('0' + remain % 10);
+    remain /= 10;
+  } while (remain > 0);
+  if (value < 0) {
+    *--pos = '-';
+  }
+  output->write(pos, buffer + sizeof(buffer) - pos);
+}
+
+void NumberDataType::writeFixed(float value, size_t precision, ostream* output) {
+  *output << setprecision(static_cast<int>(precision)) << fixed;
+  char buffer[32];
+  int length = snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(precision), static_cast<double>(value));
+  if (length > 0 && static_cast<size_t>(length) < sizeof(buffer)) {
+    output->write(buffer, length);
   } else {
-    *derived = new NumberDataType(m_id, bitCount, m_flags, m_replacement,
-      m_minValue, m_maxValue, divisor, m_baseType ? m_baseType : this);
+    *output << value;
   }
-  DataTypeList::getInstance()->addCleanup(*derived);
-  return RESULT_OK;
 }
 
 result_t NumberDataType::readRawValue(size_t offset, size_t length, const SymbolString& input,
@@ -642,12 +676,16 @@ result_t NumberDataType::readRawValue(size_t offset, size_t length, const Symbol
 result_t NumberDataType::readSymbols(size_t offset, size_t length, const SymbolString& input,
     OutputFormat outputFormat, ostream* output) const {
   unsigned int value = 0;
-  int signedValue;
-
   result_t result = readRawValue(offset, length, input, &value);
   if (result != RESULT_OK) {
     return result;
   }
+  return formatRawValue(value, length, outputFormat, output);
+}
+
+result_t NumberDataType::formatRawValue(unsigned int value, size_t length, OutputFormat outputFormat,
+    ostream* output) const {
+  int signedValue;
   *output << setw(0) << dec;  // initialize output
 
   if (!hasFlag(REQ) && value == m_replacement) {
@@ -756,6 +794,65 @@ result_t NumberDataType::readSymbols(size_t offset, size_t length, const SymbolS
   return RESULT_OK;
 }
 
+result_t NumberDataType::convertRawValue(unsigned int value, float* output) const {
+  if (!hasFlag(REQ) && value == m_replacement) {
+    return RESULT_EMPTY;
+  }
+  bool negative;
+  if (hasFlag(SIG)) {  // signed value
+    negative = (value & (1 << (m_bitCount - 1))) != 0;
+    if (negative) {  // negative signed value
+      if (value < m_minValue) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      }
+    } else if (value > m_maxValue) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+  } else if (value < m_minValue || value > m_maxValue) {
+    return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+  } else {
+    negative = false;
+  }
+  float val;
+  if (m_bitCount == 32 && hasFlag(EXP)) {  // IEEE 754 binary32
+#ifdef HAVE_DIRECT_FLOAT_FORMAT
+#  if HAVE_DIRECT_FLOAT_FORMAT == 2
+    value = __builtin_bswap32(value);
+#  endif
+    symbol_t* pval = reinterpret_cast<symbol_t*>(&value);
+    val = *reinterpret_cast<float*>(pval);
+#else
+    int exp = (value >> 23) & 0xff;  // 8 bits, signed
+    if (exp == 0) {
+      val = 0.0;
+    } else {
+      exp -= 127;
+      unsigned int sig = value & ((1 << 23) - 1);
+      val = (1.0f + static_cast<float>(sig / exp2(23))) * static_cast<float>(exp2(exp));
+      if (negative) {
+        val = -val;
+      }
+    }
+#endif
+    if (val != val) {  // isnan(val)
+      return RESULT_EMPTY;
+    }
+  } else if (!negative) {
+    val = static_cast<float>(value);
+  } else if (m_bitCount == 32) {
+    val = static_cast<float>(static_cast<int>(value));
+  } else {
+    val = static_cast<float>(static_cast<int>(value) - (1 << m_bitCount));
+  }
+  if (m_divisor < 0) {
+    val *= static_cast<float>(-m_divisor);
+  } else if (m_divisor > 1) {
+    val /= static_cast<float>(m_divisor);
+  }
+  *output = val;
+  return RESULT_OK;
+}
+
 result_t NumberDataType::writeRawValue(unsigned int value, size_t offset, size_t length,
     SymbolString* output, size_t* usedLength) const {
   size_t start = 0, count = length;
@@ -917,11 +1014,11 @@ bool DataTypeList::s_contrib_initialized = libebus_contrib_register();
 #endif
 
 
-DataTypeList::DataTypeList() {
+DataTypeList::DataTypeList() : m_tableUsed(0) {
   add(new StringDataType("STR", MAX_LEN*8, ADJ, ' '));  // >= 1 byte character string filled up with space
   // unsigned decimal in BCD, 0000 - 9999 (fixed length)
   add(new NumberDataType("PIN", 16, FIX|BCD|REV, 0xffff, 0, 0x9999, 1));
-  add(new NumberDataType("UCH", 8, 0, 0xff, 0, 0xfe, 1));  // unsigned integer, 0 - 254
+  add(new FixedNumberDataType<8, 0>("UCH", 0xff, 0, 0xfe, 1));  // unsigned integer, 0 - 254
   add(new StringDataType("IGN", MAX_LEN*8, IGN|ADJ, 0));  // >= 1 byte ignored data
   // >= 1 byte character string filled up with 0x00 (null terminated string)
   add(new StringDataType("NTS", MAX_LEN*8, ADJ, 0));
@@ -961,7 +1058,7 @@ DataTypeList::DataTypeList() {
   add(new DateTimeDataType("TTQ", 7, 0, 0, false, true, 15));
   add(new NumberDataType("BDY", 8, DAY, 0x07, 0, 6, 1));  // weekday, "Mon" - "Sun" (0x00 - 0x06) [eBUS type]
   add(new NumberDataType("HDY", 8, DAY, 0x00, 1, 7, 1));  // weekday, "Mon" - "Sun" (0x01 - 0x07) [Vaillant type]
-  add(new NumberDataType("BCD", 8, BCD, 0xff, 0, 99, 1));  // unsigned decimal in BCD, 0 - 99
+  add(new FixedNumberDataType<8, BCD>("BCD", 0xff, 0, 99, 1));  // unsigned decimal in BCD, 0 - 99
   add(new NumberDataType("BCD", 16, BCD, 0xffff, 0, 9999, 1));  // unsigned decimal in BCD, 0 - 9999
   add(new NumberDataType("BCD", 24, BCD, 0xffffff, 0, 999999, 1));  // unsigned decimal in BCD, 0 - 999999
   add(new NumberDataType("BCD", 32, BCD, 0xffffffff, 0, 99999999, 1));  // unsigned decimal in BCD, 0 - 99999999
@@ -969,16 +1066,16 @@ DataTypeList::DataTypeList() {
   add(new NumberDataType("HCD", 8, HCD|BCD|REQ, 0, 0, 99, 1));  // unsigned decimal in HCD, 0 - 99
   add(new NumberDataType("HCD", 16, HCD|BCD|REQ, 0, 0, 9999, 1));  // unsigned decimal in HCD, 0 - 9999
   add(new NumberDataType("HCD", 24, HCD|BCD|REQ, 0, 0, 999999, 1));  // unsigned decimal in HCD, 0 - 999999
-  add(new NumberDataType("SCH", 8, SIG, 0x80, 0x81, 0x7f, 1));  // signed integer, -127 - +127
-  add(new NumberDataType("D1B", 8, SIG, 0x80, 0x81, 0x7f, 1));  // signed integer, -127 - +127
+  add(new FixedNumberDataType<8, SIG>("SCH", 0x80, 0x81, 0x7f, 1));  // signed integer, -127 - +127
+  add(new FixedNumberDataType<8, SIG>("D1B", 0x80, 0x81, 0x7f, 1));  // signed integer, -127 - +127
   // unsigned number (fraction 1/2), 0 - 100 (0x00 - 0xc8, replacement 0xff)
-  add(new NumberDataType("D1C", 8, 0, 0xff, 0x00, 0xc8, 2));
+  add(new FixedNumberDataType<8, 0>("D1C", 0xff, 0x00, 0xc8, 2));
   // signed number (fraction 1/256), -127.99 - +127.99
-  add(new NumberDataType("D2B", 16, SIG, 0x8000, 0x8001, 0x7fff, 256));
+  add(new FixedNumberDataType<16, SIG>("D2B", 0x8000, 0x8001, 0x7fff, 256));
   // signed number (fraction 1/16), -2047.9 - +2047.9
-  add(new NumberDataType("D2C", 16, SIG, 0x8000, 0x8001, 0x7fff, 16));
+  add(new FixedNumberDataType<16, SIG>("D2C", 0x8000, 0x8001, 0x7fff, 16));
   // signed number (fraction 1/1000), -32.767 - +32.767, little endian
-  add(new NumberDataType("FLT", 16, SIG, 0x8000, 0x8001, 0x7fff, 1000));
+  add(new FixedNumberDataType<16, SIG>("FLT", 0x8000, 0x8001, 0x7fff, 1000));
   // signed number (fraction 1/1000), -32.767 - +32.767, big endian
   add(new NumberDataType("FLR", 16, SIG|REV, 0x8000, 0x8001, 0x7fff, 1000));
   // signed number (IEEE 754 binary32: 1 bit sign, 8 bits exponent, 23 bits significand), little endian
@@ -986,11 +1083,11 @@ DataTypeList::DataTypeList() {
   // signed number (IEEE 754 binary32: 1 bit sign, 8 bits exponent, 23 bits significand), big endian
   add(new NumberDataType("EXR", 32, SIG|EXP|REV, 0x7f800000, 0x00000000, 0xffffffff, 1));
   // unsigned integer, 0 - 65534, little endian
-  add(new NumberDataType("UIN", 16, 0, 0xffff, 0, 0xfffe, 1));
+  add(new FixedNumberDataType<16, 0>("UIN", 0xffff, 0, 0xfffe, 1));
   // unsigned integer, 0 - 65534, big endian
   add(new NumberDataType("UIR", 16, REV, 0xffff, 0, 0xfffe, 1));
   // signed integer, -32767 - +32767, little endian
-  add(new NumberDataType("SIN", 16, SIG, 0x8000, 0x8001, 0x7fff, 1));
+  add(new FixedNumberDataType<16, SIG>("SIN", 0x8000, 0x8001, 0x7fff, 1));
   // signed integer, -32767 - +32767, big endian
   add(new NumberDataType("SIR", 16, SIG|REV, 0x8000, 0x8001, 0x7fff, 1));
   // unsigned 3 bytes int, 0 - 16777214, little endian
@@ -1028,48 +1125,113 @@ void DataTypeList::clear() {
     delete it;
   }
   m_cleanupTypes.clear();
-  m_typesByIdLength.clear();
+  m_derivedTypes.clear();
+  m_table.clear();
+  m_tableUsed = 0;
   m_typesById.clear();
 }
 
 result_t DataTypeList::add(const DataType* dataType) {
+  const string& id = dataType->getId();
   if (!dataType->isAdjustableLength()) {
-    ostringstream str;
     size_t bitCount = dataType->getBitCount();
-    str << dataType->getId() << LENGTH_SEPARATOR << static_cast<unsigned>(bitCount >= 8?bitCount/8:bitCount);
-    if (m_typesByIdLength.find(str.str()) != m_typesByIdLength.end()) {
+    size_t length = bitCount >= 8 ? bitCount/8 : bitCount;
+    if (find(id, length)) {
       return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
     }
-    m_typesByIdLength[str.str()] = dataType;
-    if (m_typesById.find(dataType->getId()) != m_typesById.end()) {
+    insert(dataType, length);
+    if (find(id, 0)) {
       m_cleanupTypes.push_back(dataType);
       return RESULT_OK;  // only store first one as default
     }
-  } else if (m_typesById.find(dataType->getId()) != m_typesById.end()) {
+  } else if (find(id, 0)) {
     return RESULT_ERR_DUPLICATE_NAME;  // duplicate key
   }
-  m_typesById[dataType->getId()] = dataType;
+  m_typesById[id] = dataType;
+  insert(dataType, 0);
   m_cleanupTypes.push_back(dataType);
   return RESULT_OK;
 }
 
+const NumberDataType* DataTypeList::getDerived(const NumberDataType* baseType, int divisor, size_t bitCount) {
+  const NumberDataType* derived = nullptr;
+  m_cleanupMutex.lock();
+  auto it = m_derivedTypes.find(std::make_tuple(baseType, divisor, bitCount));
+  if (it != m_derivedTypes.end()) {
+    derived = it->second;
+  }
+  m_cleanupMutex.unlock();
+  return derived;
+}
+
+const NumberDataType* DataTypeList::addDerived(const NumberDataType* baseType, int divisor, size_t bitCount,
+    const NumberDataType* derived) {
+  m_cleanupMutex.lock();
+  auto inserted = m_derivedTypes.insert(std::make_pair(std::make_tuple(baseType, divisor, bitCount), derived));
+  if (inserted.second) {
+    m_cleanupTypes.push_back(derived);
+  }
+  const NumberDataType* shared = inserted.first->second;
+  m_cleanupMutex.unlock();
+  if (shared != derived) {
+    delete derived;
+  }
+  return shared;
+}
+
 const DataType* DataTypeList::get(const string& id, size_t length) const {
   if (length > 0) {
-    ostringstream str;
-    str << id << LENGTH_SEPARATOR << static_cast<unsigned>(length);
-    auto it = m_typesByIdLength.find(str.str());
-    if (it != m_typesByIdLength.end()) {
-      return it->second;
+    const DataType* dataType = find(id, length);
+    if (dataType) {
+      return dataType;
     }
   }
-  auto it = m_typesById.find(id);
-  if (it == m_typesById.end()) {
+  const DataType* dataType = find(id, 0);
+  if (!dataType) {
+    return nullptr;
+  }
+  if (length > 0 && !dataType->isAdjustableLength()) {
     return nullptr;
   }
-  if (length > 0 && !it->second->isAdjustableLength()) {
+  return dataType;
+}
+
+const DataType* DataTypeList::find(const string& id, size_t length) const {
+  if (m_table.empty()) {
     return nullptr;
   }
-  return it->second;
+  uint32_t hash = hashKey(id, length);
+  size_t mask = m_table.size()-1;
+  for (size_t index = hash & mask; m_table[index].m_dataType; index = (index+1) & mask) {
+    const TableEntry& entry = m_table[index];
+    if (entry.m_hash == hash && entry.m_length == length && entry.m_dataType->getId() == id) {
+      return entry.m_dataType;
+    }
+  }
+  return nullptr;
+}
+
+void DataTypeList::insert(const DataType* dataType, size_t length) {
+  if ((m_tableUsed+1)*2 > m_table.size()) {
+    // keep the load below 1/2 for short probe sequences
+    vector<TableEntry> old;
+    old.swap(m_table);
+    m_table.resize(old.empty() ? 128 : old.size()*2, TableEntry{0, 0, nullptr});
+    m_tableUsed = 0;
+    for (const auto& entry : old) {
+      if (entry.m_dataType) {
+        insert(entry.m_dataType, entry.m_length);
+      }
+    }
+  }
+  uint32_t hash = hashKey(dataType->getId(), length);
+  size_t mask = m_table.size()-1;
+  size_t index = hash & mask;
+  while (m_table[index].m_dataType) {
+    index = (index+1) & mask;
+  }
+  m_table[index] = TableEntry{hash, length, dataType};
+  m_tableUsed++;
 }
 
 }  // namespace ebusd
@@ -20,13 +20,17 @@
 #define LIB_EBUS_DATATYPE_H_
 
 #include <stdint.h>
+#include <math.h>
+#include <cstdlib>
 #include <string>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <vector>
 #include <list>
 #include <map>
+#include <tuple>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/filereader.h"
@@ -181,7 +185,7 @@ class DataType {
   /**
    * @return the type identifier.
    */
-  string getId() const { return m_id; }
+  const string& getId() const { return m_id; }
 
   /**
    * @return the number of bits (maximum length if #ADJ flag is set).
@@ -483,6 +487,31 @@ class NumberDataType : public DataType {
   result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
       const OutputFormat outputFormat, ostream* output) const override;
 
+  /**
+   * Internal method for formatting a numeric raw value read via @a readRawValue().
+   * @param value the numeric raw value.
+   * @param length the number of symbols the value was read from.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the ostream to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t formatRawValue(unsigned int value, size_t length, OutputFormat outputFormat, ostream* output) const;
+
+  /**
+   * Convert a numeric raw value read via @a readRawValue() to the value it represents (without formatting).
+   * @param value the numeric raw value.
+   * @param output the variable in which to store the value.
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY for the replacement value, or an error code.
+   */
+  result_t convertRawValue(unsigned int value, float* output) const;
+
+  /**
+   * Return whether @a readSymbols() uses a decoder specialized at compile time for the length.
+   * @param length the number of symbols to read.
+   * @return whether @a readSymbols() uses a specialized decoder for the length.
+   */
+  virtual bool hasSpecializedDecoder(size_t length) const { return false; }
+
   /**
    * Internal method for writing the numeric raw value to a @a SymbolString.
    * @param value the numeric raw value to write.
@@ -501,6 +530,33 @@ class NumberDataType : public DataType {
       SymbolString* output, size_t* usedLength) const override;
 
 
+ protected:
+  /**
+   * Create a new instance derived from this (called by @a derive()).
+   * @param divisor the divisor (negative for reciprocal).
+   * @param bitCount the number of bits.
+   * @param baseType the base @a NumberDataType of the derived instance.
+   * @return the new @a NumberDataType.
+   */
+  virtual NumberDataType* createDerived(int divisor, size_t bitCount, const NumberDataType* baseType) const;
+
+  /**
+   * Write a signed integer like the ostream operator does (with the default flags) but with less overhead.
+   * @param value the value to write.
+   * @param output the ostream to write to.
+   */
+  static void writeInteger(int value, ostream* output);
+
+  /**
+   * Write a value like "setprecision(precision) << fixed << value" does but with less overhead (leaving the same
+   * flags set in the ostream).
+   * @param value the value to write.
+   * @param precision the number of decimal places.
+   * @param output the ostream to write to.
+   */
+  static void writeFixed(float value, size_t precision, ostream* output);
+
+
  private:
   /** the minimum raw value. */
   const unsigned int m_minValue;
@@ -522,8 +578,188 @@ class NumberDataType : public DataType {
 };
 
 
+/**
+ * A @a NumberDataType with the bit count and flags fixed at compile time for the most common types (whole bytes in
+ * little endian order), which are decoded and encoded without the generic loops over bytes and flags.
+ * @tparam BITS the number of bits (8 or 16).
+ * @tparam FLAGS the combination of flags (0, #SIG, or #BCD with 8 bits).
+ */
+template <size_t BITS, uint16_t FLAGS>
+class FixedNumberDataType : public NumberDataType {
+ public:
+  /**
+   * Constructs a new instance.
+   * @param id the type identifier.
+   * @param replacement the replacement value.
+   * @param minValue the minimum raw value.
+   * @param maxValue the maximum raw value.
+   * @param divisor the divisor (negative for reciprocal).
+   * @param baseType the base @a NumberDataType for derived instances, or nullptr.
+   */
+  FixedNumberDataType(const string& id, unsigned int replacement, unsigned int minValue, unsigned int maxValue,
+      int divisor, const NumberDataType* baseType = nullptr)
+    : NumberDataType(id, BITS, FLAGS, replacement, minValue, maxValue, divisor, baseType) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~FixedNumberDataType() {}
+
+  // @copydoc
+  result_t readRawValue(size_t offset, size_t length, const SymbolString& input,
+      unsigned int* value) const override {
+    if (length != BITS/8) {
+      return NumberDataType::readRawValue(offset, length, input, value);
+    }
+    if (offset + length > input.getDataSize()) {
+      return RESULT_ERR_INVALID_POS;  // not enough data available
+    }
+    symbol_t symbol = input.dataAt(offset);
+    if (FLAGS & BCD) {
+      if (symbol == (m_replacement & 0xff)) {
+        *value = m_replacement;
+        return RESULT_OK;
+      }
+      if ((symbol & 0xf0) > 0x90 || (symbol & 0x0f) > 0x09) {
+        return RESULT_ERR_OUT_OF_RANGE;  // invalid BCD
+      }
+      *value = static_cast<unsigned int>((symbol >> 4) * 10 + (symbol & 0x0f));
+      return RESULT_OK;
+    }
+    *value = symbol;
+    if (BITS == 16) {
+      *value |= static_cast<unsigned int>(input.dataAt(offset + 1)) << 8;
+    }
+    return RESULT_OK;
+  }
+
+  // @copydoc
+  result_t readSymbols(size_t offset, size_t length, const SymbolString& input,
+      const OutputFormat outputFormat, ostream* output) const override {
+    unsigned int value = 0;
+    result_t result = FixedNumberDataType::readRawValue(offset, length, input, &value);
+    if (result != RESULT_OK) {
+      return result;
+    }
+    if (length != BITS/8) {
+      return formatRawValue(value, length, outputFormat, output);
+    }
+    *output << std::setw(0) << std::dec;  // initialize output
+    if (value == m_replacement) {
+      if (outputFormat & OF_JSON) {
+        *output << "null";
+      } else {
+        *output << nullptr_VALUE;
+      }
+      return RESULT_OK;
+    }
+    int signedValue;
+    if ((FLAGS & SIG) && (value & (1 << (BITS - 1))) != 0) {  // negative signed value
+      if (value < getMinValue()) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      }
+      signedValue = static_cast<int>(value) - (1 << BITS);
+    } else {
+      if ((!(FLAGS & SIG) && value < getMinValue()) || value > getMaxValue()) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      }
+      signedValue = static_cast<int>(value);
+    }
+    int divisor = getDivisor();
+    if (divisor < 0) {
+      *output << std::fixed << std::setprecision(0)
+          << (static_cast<float>(signedValue) * static_cast<float>(-divisor));
+    } else if (divisor <= 1) {
+      writeInteger(signedValue, output);
+    } else {
+      writeFixed(static_cast<float>(signedValue) / static_cast<float>(divisor), getPrecision(), output);
+    }
+    return RESULT_OK;
+  }
+
+  // @copydoc
+  bool hasSpecializedDecoder(size_t length) const override { return length == BITS/8; }
+
+  // @copydoc
+  result_t writeSymbols(size_t offset, size_t length, istringstream* input,
+      SymbolString* output, size_t* usedLength) const override {
+    const string inputStr = input->str();
+    if (length != BITS/8 || isIgnored() || inputStr.empty() || inputStr == nullptr_VALUE) {
+      return NumberDataType::writeSymbols(offset, length, input, output, usedLength);
+    }
+    const char* str = inputStr.c_str();
+    char* strEnd = nullptr;
+    unsigned int value;
+    int divisor = getDivisor();
+    if (divisor == 1) {
+      if (FLAGS & SIG) {
+        long signedValue = strtol(str, &strEnd, 10);
+        value = static_cast<unsigned int>(signedValue < 0 ? signedValue + (1 << BITS) : signedValue);
+      } else {
+        value = static_cast<unsigned int>(strtoul(str, &strEnd, 10));
+      }
+      if (strEnd == nullptr || strEnd == str || (*strEnd != 0 && *strEnd != '.')) {
+        return RESULT_ERR_INVALID_NUM;  // invalid value
+      }
+    } else {
+      double dvalue = strtod(str, &strEnd);
+      if (strEnd == nullptr || strEnd == str || *strEnd != 0) {
+        return RESULT_ERR_INVALID_NUM;  // invalid value
+      }
+      if (divisor < 0) {
+        dvalue = round(dvalue / -divisor);
+      } else {
+        dvalue = round(dvalue * divisor);
+      }
+      if (FLAGS & SIG) {
+        if (dvalue < -static_cast<double>(1 << (BITS - 1)) || dvalue >= static_cast<double>(1 << (BITS - 1))) {
+          return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+        }
+        value = static_cast<unsigned int>(static_cast<int>(dvalue < 0 ? dvalue + (1 << BITS) : dvalue));
+      } else {
+        if (dvalue < 0.0 || dvalue >= static_cast<double>(1 << BITS)) {
+          return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+        }
+        value = static_cast<unsigned int>(dvalue);
+      }
+    }
+    if ((FLAGS & SIG) && (value & (1 << (BITS - 1))) != 0) {  // negative signed value
+      if (value < getMinValue()) {
+        return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+      }
+    } else if ((!(FLAGS & SIG) && value < getMinValue()) || value > getMaxValue()) {
+      return RESULT_ERR_OUT_OF_RANGE;  // value out of range
+    }
+    if (FLAGS & BCD) {
+      output->dataAt(offset) = static_cast<symbol_t>(((value % 100 / 10) << 4) | (value % 10));
+    } else {
+      output->dataAt(offset) = static_cast<symbol_t>(value & 0xff);
+      if (BITS == 16) {
+        output->dataAt(offset + 1) = static_cast<symbol_t>((value >> 8) & 0xff);
+      }
+    }
+    if (usedLength != nullptr) {
+      *usedLength = length;
+    }
+    return RESULT_OK;
+  }
+
+
+ protected:
+  // @copydoc
+  NumberDataType* createDerived(int divisor, size_t bitCount, const NumberDataType* baseType) const override {
+    if (bitCount != BITS) {
+      return NumberDataType::createDerived(divisor, bitCount, baseType);
+    }
+    return new FixedNumberDataType(m_id, m_replacement, getMinValue(), getMaxValue(), divisor, baseType);
+  }
+};
+
+
 /**
  * A map of base @a DataType instances.
+ * The base types are looked up by ID and length in a flat open addressing hash table, so that no key string needs
+ * to be built per lookup. Derived @a NumberDataType instances are shared for identical derivations.
  */
 class DataTypeList {
  public:
@@ -559,10 +795,36 @@ class DataTypeList {
   result_t add(const DataType* dataType);
 
   /**
-   * Adds a @a DataType instance for later cleanup.
+   * Adds a @a DataType instance for later cleanup (may be called from different threads while parsing).
    * @param dataType the @a DataType instance to add.
    */
-  void addCleanup(const DataType* dataType) { m_cleanupTypes.push_back(dataType); }
+  void addCleanup(const DataType* dataType) {
+    m_cleanupMutex.lock();
+    m_cleanupTypes.push_back(dataType);
+    m_cleanupMutex.unlock();
+  }
+
+  /**
+   * Gets the shared derived @a NumberDataType instance (may be called from different threads while parsing).
+   * @param baseType the base @a NumberDataType the instance was derived from.
+   * @param divisor the divisor of the derived instance.
+   * @param bitCount the number of bits of the derived instance.
+   * @return the shared derived @a NumberDataType instance, or nullptr if not available yet.
+   */
+  const NumberDataType* getDerived(const NumberDataType* baseType, int divisor, size_t bitCount);
+
+  /**
+   * Adds a derived @a NumberDataType instance for sharing and later cleanup (may be called from different threads
+   * while parsing).
+   * @param baseType the base @a NumberDataType the instance was derived from.
+   * @param divisor the divisor of the derived instance.
+   * @param bitCount the number of bits of the derived instance.
+   * @param derived the derived @a NumberDataType instance to add.
+   * @return the shared derived @a NumberDataType instance, i.e. @p derived or the instance added meanwhile by
+   * another thread (in which case @p derived is freed).
+   */
+  const NumberDataType* addDerived(const NumberDataType* baseType, int divisor, size_t bitCount,
+      const NumberDataType* derived);
 
   /**
    * Gets the @a DataType instance with the specified ID.
@@ -586,16 +848,67 @@ class DataTypeList {
   map<string, const DataType*>::const_iterator end() const { return m_typesById.end(); }
 
  private:
-  /** the known @a DataType instances by ID only. */
+  /**
+   * Calculate the hash of a lookup key.
+   * @param id the ID string.
+   * @param length the length in bytes (or bits for types with less than 8 bits), or 0 for the default by ID only.
+   * @return the hash of the key.
+   */
+  static uint32_t hashKey(const string& id, size_t length) {
+    uint32_t hash = 2166136261U;  // FNV-1a
+    for (const auto ch : id) {
+      hash = (hash ^ static_cast<uint8_t>(ch)) * 16777619U;
+    }
+    return (hash ^ static_cast<uint32_t>(length)) * 16777619U;
+  }
+
+  /**
+   * Find a @a DataType instance in @a m_table.
+   * @param id the ID string.
+   * @param length the length in bytes (or bits for types with less than 8 bits), or 0 for the default by ID only.
+   * @return the @a DataType instance, or nullptr if not available.
+   */
+  const DataType* find(const string& id, size_t length) const;
+
+  /**
+   * Insert a @a DataType instance into @a m_table (growing it if necessary).
+   * @param dataType the @a DataType instance to insert.
+   * @param length the length in bytes (or bits for types with less than 8 bits), or 0 for the default by ID only.
+   */
+  void insert(const DataType* dataType, size_t length);
+
+  /** an entry of @a m_table. */
+  struct TableEntry {
+    /** the hash of the key. */
+    uint32_t m_hash;
+
+    /** the length of the key, or 0 for the default by ID only. */
+    size_t m_length;
+
+    /** the @a DataType instance, or nullptr for an empty entry. */
+    const DataType* m_dataType;
+  };
+
+  /** the known @a DataType instances by ID only (for iterating in ID order). */
   map<string, const DataType*> m_typesById;
 
-  /** the known @a DataType instances by ID and length (i.e. "ID:BITS").
+  /** the open addressing hash table with linear probing of the known @a DataType instances by ID and length, and by
+   * ID only with length 0 (the size is always a power of two).
    * Note: adjustable length types are stored by ID only. */
-  map<string, const DataType*> m_typesByIdLength;
+  vector<TableEntry> m_table;
+
+  /** the number of used entries in @a m_table. */
+  size_t m_tableUsed;
+
+  /** the shared derived @a NumberDataType instances by base type, divisor, and bit count. */
+  map<std::tuple<const NumberDataType*, int, size_t>, const NumberDataType*> m_derivedTypes;
 
   /** the @a DataType instances to cleanup. */
   list<const DataType*> m_cleanupTypes;
 
+  /** the @a Mutex for access to @a m_cleanupTypes and @a m_derivedTypes. */
+  Mutex m_cleanupMutex;
+
   /** the singleton instance. */
   static DataTypeList s_instance;
 
@@ -34,24 +34,128 @@
 #ifdef HAVE_PPOLL
 #  include <poll.h>
 #endif
+#ifdef HAVE_TIMERFD
+#  include <sys/timerfd.h>
+#endif
+#include <time.h>
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include "lib/ebus/data.h"
+#include "lib/ebus/filereader.h"
 
 namespace ebusd {
 
+using std::ifstream;
+
 #define MTU 1540
 
+/** the maximum number of datagrams to receive at once (only for UDP). */
+#define UDP_RECV_BATCH 8
+
+/** the enhanced protocol request for initializing the adapter (value: requested features). */
+#define ENH_REQ_INIT 0x0
+
+/** the enhanced protocol request for sending a data byte (value: data byte). */
+#define ENH_REQ_SEND 0x1
+
+/** the enhanced protocol request for starting the arbitration (value: master address, or @a SYN to cancel). */
+#define ENH_REQ_START 0x2
+
+/** the enhanced protocol response after a reset of the adapter (value: supported features). */
+#define ENH_RES_RESETTED 0x0
+
+/** the enhanced protocol response for a received data byte (value: data byte). */
+#define ENH_RES_RECEIVED 0x1
+
+/** the enhanced protocol response for a won arbitration (value: master address). */
+#define ENH_RES_STARTED 0x2
+
+/** the enhanced protocol response with adapter information (value: info byte). */
+#define ENH_RES_INFO 0x3
+
+/** the enhanced protocol response for a lost arbitration (value: winning master address). */
+#define ENH_RES_FAILED 0xa
+
+/** the enhanced protocol response for an error on the eBUS side (value: error code). */
+#define ENH_RES_ERROR_EBUS 0xb
+
+/** the enhanced protocol response for an error on the host side (value: error code). */
+#define ENH_RES_ERROR_HOST 0xc
+
+/** the flag marking a byte of an enhanced protocol command pair. */
+#define ENH_BYTE_FLAG 0x80
+
+/** the mask for distinguishing the first and second byte of an enhanced protocol command pair. */
+#define ENH_BYTE_MASK 0xc0
+
+/** the first byte of an enhanced protocol command pair (with the command and the upper 2 bits of the value). */
+#define ENH_BYTE1 0xc0
+
+/** the second byte of an enhanced protocol command pair (with the lower 6 bits of the value). */
+#define ENH_BYTE2 0x80
+
+/**
+ * Encode an enhanced protocol command pair.
+ * @param command the command.
+ * @param value the value.
+ * @param output the buffer of 2 bytes to fill.
+ */
+static void encodeEnhanced(symbol_t command, symbol_t value, symbol_t* output) {
+  output[0] = static_cast<symbol_t>(ENH_BYTE1 | (command << 2) | ((value & 0xc0) >> 6));
+  output[1] = static_cast<symbol_t>(ENH_BYTE2 | (value & 0x3f));
+}
+
+/**
+ * Encode a data byte for sending with the enhanced protocol.
+ * @param value the data byte.
+ * @param output the buffer of up to 2 bytes to fill.
+ * @return the number of bytes stored in @a output.
+ */
+static size_t encodeEnhancedData(symbol_t value, symbol_t* output) {
+  if ((value & ENH_BYTE_FLAG) == 0) {
+    output[0] = value;  // short form
+    return 1;
+  }
+  encodeEnhanced(ENH_REQ_SEND, value, output);
+  return 2;
+}
+
 #ifndef POLLRDHUP
 #define POLLRDHUP 0
 #endif
 
+void encodeTimedDumpRecord(symbol_t symbol, unsigned int delay, unsigned char* record) {
+  if (delay > TIMED_DUMP_MAX_DELAY) {
+    delay = TIMED_DUMP_MAX_DELAY;
+  }
+  record[0] = static_cast<unsigned char>(delay & 0xff);
+  record[1] = static_cast<unsigned char>((delay >> 8) & 0xff);
+  record[2] = static_cast<unsigned char>((delay >> 16) & 0xff);
+  record[3] = symbol;
+}
+
+symbol_t decodeTimedDumpRecord(const unsigned char* record, unsigned int* delay) {
+  *delay = record[0] | (record[1] << 8) | (record[2] << 16);
+  return record[3];
+}
+
 Device::~Device() {
   close();
 }
 
 Device* Device::create(const char* name, bool checkDevice, bool readOnly, bool initialSend) {
+  if (strncmp(name, "sim:", 4) == 0) {
+    if (name[4] == 0) {
+      return nullptr;  // missing scenario file
+    }
+    return new SimulatedDevice(name, name+4, readOnly, initialSend);
+  }
+  bool enhancedProto = strncmp(name, "enh:", 4) == 0;
+  if (enhancedProto) {
+    name += 4;
+  }
   if (strchr(name, '/') == nullptr && strchr(name, ':') != nullptr) {
     char* in = strdup(name);
     bool udp = false;
@@ -85,9 +189,9 @@ Device* Device::create(const char* name, bool checkDevice, bool readOnly, bool i
     free(in);
     address.sin_family = AF_INET;
     address.sin_port = (in_port_t)htons((uint16_t)port);
-    return new NetworkDevice(name, address, readOnly, initialSend, udp);
+    return new NetworkDevice(name, address, readOnly, initialSend, enhancedProto, udp);
   }
-  return new SerialDevice(name, checkDevice, readOnly, initialSend);
+  return new SerialDevice(name, checkDevice, readOnly, initialSend, enhancedProto);
 }
 
 void Device::close() {
@@ -107,11 +211,35 @@ bool Device::isValid() {
   return m_fd != -1;
 }
 
+result_t Device::afterOpen() {
+  m_arbitrationMaster = SYN;
+  if (m_enhancedProto) {
+    symbol_t init[2];
+    encodeEnhanced(ENH_REQ_INIT, 0x00, init);  // no extra features needed
+    if (write(init, 2) != 2) {
+      return RESULT_ERR_SEND;
+    }
+  }
+  if (m_initialSend && !writeData(ESC)) {
+    return RESULT_ERR_SEND;
+  }
+  return RESULT_OK;
+}
+
+bool Device::writeData(symbol_t value) {
+  if (!m_enhancedProto) {
+    return write(value) == 1;
+  }
+  symbol_t encoded[2];
+  ssize_t count = static_cast<ssize_t>(encodeEnhancedData(value, encoded));
+  return write(encoded, count) == count;
+}
+
 result_t Device::send(symbol_t value) {
   if (!isValid()) {
     return RESULT_ERR_DEVICE;
   }
-  if (m_readOnly || write(value) != 1) {
+  if (m_readOnly || !writeData(value)) {
     return RESULT_ERR_SEND;
   }
   if (m_listener != nullptr) {
@@ -120,7 +248,108 @@ result_t Device::send(symbol_t value) {
   return RESULT_OK;
 }
 
-result_t Device::recv(unsigned int timeout, symbol_t* value) {
+result_t Device::send(const symbol_t* values, size_t count) {
+  if (!isValid()) {
+    return RESULT_ERR_DEVICE;
+  }
+  if (m_readOnly) {
+    return RESULT_ERR_SEND;
+  }
+  if (!m_enhancedProto) {
+    if (write(values, count) != static_cast<ssize_t>(count)) {
+      return RESULT_ERR_SEND;
+    }
+  } else {
+    symbol_t encoded[2*64];
+    for (size_t pos = 0; pos < count; ) {
+      ssize_t length = 0;
+      for (; pos < count && length < static_cast<ssize_t>(sizeof(encoded))-1; pos++) {
+        length += static_cast<ssize_t>(encodeEnhancedData(values[pos], encoded+length));
+      }
+      if (write(encoded, length) != length) {
+        return RESULT_ERR_SEND;
+      }
+    }
+  }
+  if (m_listener != nullptr) {
+    for (size_t pos = 0; pos < count; pos++) {
+      m_listener->notifyDeviceData(values[pos], false);
+    }
+  }
+  return RESULT_OK;
+}
+
+result_t Device::startArbitration(symbol_t masterAddress) {
+  if (!m_enhancedProto) {
+    return RESULT_ERR_INVALID_ARG;
+  }
+  if (masterAddress == m_arbitrationMaster) {
+    return RESULT_OK;  // already running or nothing to cancel
+  }
+  if (!isValid()) {
+    return RESULT_ERR_DEVICE;
+  }
+  symbol_t start[2];
+  encodeEnhanced(ENH_REQ_START, masterAddress, start);
+  if (m_readOnly || write(start, 2) != 2) {
+    return RESULT_ERR_SEND;
+  }
+  m_arbitrationMaster = masterAddress;
+  return RESULT_OK;
+}
+
+result_t Device::recv(unsigned int timeout, symbol_t* value, ArbitrationState* arbitrationState) {
+  ArbitrationState state = as_none;
+  result_t result;
+  while (true) {
+    result = recvRaw(timeout, value);
+    if (result != RESULT_OK || !m_enhancedProto || (*value & ENH_BYTE_FLAG) == 0) {
+      break;  // plain data byte (short form for the enhanced protocol)
+    }
+    symbol_t first = *value;
+    if ((first & ENH_BYTE_MASK) != ENH_BYTE1) {
+      continue;  // skip unexpected second byte
+    }
+    result = recvRaw(timeout, value);
+    if (result != RESULT_OK) {
+      break;
+    }
+    if ((*value & ENH_BYTE_MASK) != ENH_BYTE2) {
+      result = RESULT_ERR_SYMBOL;
+      break;
+    }
+    symbol_t command = static_cast<symbol_t>((first >> 2) & 0x0f);
+    *value = static_cast<symbol_t>(((first & 0x03) << 6) | (*value & 0x3f));
+    if (command == ENH_RES_RECEIVED) {
+      break;
+    }
+    if (command == ENH_RES_STARTED || command == ENH_RES_FAILED) {
+      if (m_arbitrationMaster == SYN) {
+        continue;  // result of an already cancelled arbitration
+      }
+      m_arbitrationMaster = SYN;
+      state = command == ENH_RES_STARTED ? as_won : as_lost;
+      break;
+    }
+    if (command == ENH_RES_RESETTED || command == ENH_RES_ERROR_EBUS || command == ENH_RES_ERROR_HOST) {
+      m_arbitrationMaster = SYN;  // arbitration needs to be started again
+      if (command != ENH_RES_RESETTED) {
+        result = RESULT_ERR_DEVICE;
+        break;
+      }
+    }
+    // ignore other responses like ENH_RES_INFO
+  }
+  if (arbitrationState) {
+    *arbitrationState = state == as_none && m_arbitrationMaster != SYN ? as_running : state;
+  }
+  if (result == RESULT_OK && m_listener != nullptr) {
+    m_listener->notifyDeviceData(*value, true);
+  }
+  return result;
+}
+
+result_t Device::recvRaw(unsigned int timeout, symbol_t* value) {
   if (!isValid()) {
     return RESULT_ERR_DEVICE;
   }
@@ -178,9 +407,6 @@ result_t Device::recv(unsigned int timeout, symbol_t* value) {
     close();
     return RESULT_ERR_DEVICE;
   }
-  if (m_listener != nullptr) {
-    m_listener->notifyDeviceData(*value, true);
-  }
   return RESULT_OK;
 }
 
@@ -239,13 +465,19 @@ result_t SerialDevice::open() {
   // set serial device into blocking mode
   fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
 
-  if (m_initialSend && write(ESC) != 1) {
-    return RESULT_ERR_SEND;
+  if (m_bufSize == 0) {
+    m_bufSize = MAX_LEN+1;
+    m_buffer = reinterpret_cast<symbol_t*>(malloc(m_bufSize));
+    if (!m_buffer) {
+      m_bufSize = 0;
+    }
   }
-  return RESULT_OK;
+  m_bufLen = 0;
+  return afterOpen();
 }
 
 void SerialDevice::close() {
+  m_bufLen = 0;  // flush read buffer
   if (m_fd != -1) {
     // empty device buffer
     tcflush(m_fd, TCIOFLUSH);
@@ -263,6 +495,32 @@ void SerialDevice::checkDevice() {
   }
 }
 
+bool SerialDevice::available() {
+  return m_buffer && m_bufLen > 0;
+}
+
+ssize_t SerialDevice::read(symbol_t* value) {
+  if (available()) {
+    *value = m_buffer[m_bufPos];
+    m_bufPos = (m_bufPos+1)%m_bufSize;
+    m_bufLen--;
+    m_savedReads++;
+    return 1;
+  }
+  if (m_bufSize > 0) {
+    // VMIN=1 and VTIME=0: returns as soon as at least one byte is available with everything already received
+    ssize_t size = ::read(m_fd, m_buffer, m_bufSize);
+    if (size <= 0) {
+      return size;
+    }
+    *value = m_buffer[0];
+    m_bufPos = 1;
+    m_bufLen = size-1;
+    return 1;
+  }
+  return Device::read(value);
+}
+
 
 result_t NetworkDevice::open() {
   if (m_fd != -1) {
@@ -303,17 +561,15 @@ result_t NetworkDevice::open() {
     }
   }
   if (m_bufSize == 0) {
-    m_bufSize = MAX_LEN+1;
+    // room for one slot per datagram when receiving several at once
+    m_bufSize = m_udp ? UDP_RECV_BATCH*(MAX_LEN+1) : MAX_LEN+1;
     m_buffer = reinterpret_cast<symbol_t*>(malloc(m_bufSize));
     if (!m_buffer) {
       m_bufSize = 0;
     }
   }
   m_bufLen = 0;
-  if (m_initialSend && write(ESC) != 1) {
-    return RESULT_ERR_SEND;
-  }
-  return RESULT_OK;
+  return afterOpen();
 }
 
 void NetworkDevice::close() {
@@ -337,15 +593,49 @@ ssize_t NetworkDevice::write(symbol_t value) {
   return Device::write(value);
 }
 
+ssize_t NetworkDevice::write(const symbol_t* values, size_t count) {
+  m_bufLen = 0;  // flush read buffer
+  return Device::write(values, count);  // a single datagram for UDP
+}
+
+ssize_t NetworkDevice::readDatagrams() {
+#ifdef HAVE_RECVMMSG
+  // each adapter datagram usually carries a single symbol only, so receive all pending ones with a single call
+  struct mmsghdr msgs[UDP_RECV_BATCH];
+  struct iovec iovs[UDP_RECV_BATCH];
+  size_t slotSize = m_bufSize/UDP_RECV_BATCH;
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t index = 0; index < UDP_RECV_BATCH; index++) {
+    iovs[index].iov_base = m_buffer+index*slotSize;
+    iovs[index].iov_len = slotSize;
+    msgs[index].msg_hdr.msg_iov = &iovs[index];
+    msgs[index].msg_hdr.msg_iovlen = 1;
+  }
+  int count = recvmmsg(m_fd, msgs, UDP_RECV_BATCH, MSG_WAITFORONE, nullptr);
+  if (count <= 0) {
+    return count;
+  }
+  size_t size = msgs[0].msg_len;
+  for (int index = 1; index < count; index++) {
+    memmove(m_buffer+size, m_buffer+index*slotSize, msgs[index].msg_len);  // close the gaps between the slots
+    size += msgs[index].msg_len;
+  }
+  return static_cast<ssize_t>(size);
+#else
+  return ::read(m_fd, m_buffer, m_bufSize);
+#endif
+}
+
 ssize_t NetworkDevice::read(symbol_t* value) {
   if (available()) {
     *value = m_buffer[m_bufPos];
     m_bufPos = (m_bufPos+1)%m_bufSize;
     m_bufLen--;
+    m_savedReads++;
     return 1;
   }
   if (m_bufSize > 0) {
-    ssize_t size = ::read(m_fd, m_buffer, m_bufSize);
+    ssize_t size = m_udp ? readDatagrams() : ::read(m_fd, m_buffer, m_bufSize);
     if (size <= 0) {
       return size;
     }
@@ -357,4 +647,511 @@ ssize_t NetworkDevice::read(symbol_t* value) {
   return Device::read(value);
 }
 
+
+
+/**
+ * Return whether a master address wins the arbitration against another one. The symbols are sent with the least
+ * significant bit first and a 0 bit overrides a 1 bit on the wire, so that the sender of the first 1 bit differing
+ * from the other one stops sending.
+ * @param address the master address.
+ * @param other the other master address.
+ * @return true if @a address wins against @a other.
+ */
+static bool winsArbitration(symbol_t address, symbol_t other) {
+  unsigned int diff = address ^ other;
+  return diff != 0 && (address & diff & (~diff+1)) == 0;
+}
+
+/**
+ * Parse a scenario field of hex digits.
+ * @param str the hex digits.
+ * @param values the @a vector in which to store the parsed values.
+ * @return the @a result_t code.
+ */
+static result_t parseScenarioHex(const string& str, vector<symbol_t>* values) {
+  if (str.length() % 2 != 0) {
+    return RESULT_ERR_INVALID_NUM;
+  }
+  values->resize(str.length() / 2);
+  size_t written = 0;
+  result_t result = SymbolString::parseHex(str.c_str(), str.length(), values->data(), &written);
+  values->resize(written);
+  return result;
+}
+
+result_t SimulatedDevice::readScenario() {
+  ifstream stream(m_scenario.c_str(), ifstream::in);
+  if (!stream.is_open()) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  m_masters.clear();
+  m_answers.clear();
+  m_response = nullptr;
+  unsigned int speed = 1, synInterval = SIM_SYN_INTERVAL;
+  vector<string> row;
+  unsigned int lineNo = 0;
+  bool more;
+  do {
+    row.clear();
+    more = FileReader::splitFields(&stream, &row, &lineNo);
+    if (row.empty()) {
+      continue;
+    }
+    string type = row[0];
+    FileReader::tolower(&type);
+    result_t result = RESULT_OK;
+    if (type == "speed" && row.size() == 2) {
+      speed = parseInt(row[1].c_str(), 10, 1, 100000, &result);
+    } else if (type == "syn" && row.size() == 2) {
+      synInterval = parseInt(row[1].c_str(), 10, 0, 10000, &result);
+    } else if (type == "master" && row.size() == 4) {
+      SimulatedMaster master;
+      master.address = (symbol_t)parseInt(row[1].c_str(), 16, 0, 0xff, &result);
+      if (result == RESULT_OK && !isMaster(master.address)) {
+        result = RESULT_ERR_INVALID_ADDR;
+      }
+      if (result == RESULT_OK) {
+        master.interval = parseInt(row[2].c_str(), 10, 1, 86400000, &result);
+      }
+      vector<symbol_t> command;
+      if (result == RESULT_OK) {
+        result = parseScenarioHex(row[3], &command);
+      }
+      if (result == RESULT_OK && (command.size() < 4 || command[3] != command.size()-4)) {
+        result = RESULT_ERR_INVALID_ARG;  // missing header or wrong length
+      }
+      if (result == RESULT_OK && (!isValidAddress(command[0]) || command[0] == master.address)) {
+        result = RESULT_ERR_INVALID_ADDR;
+      }
+      if (result == RESULT_OK) {
+        master.command.push_back(master.address);
+        master.command.insert(master.command.end(), command.begin(), command.end());
+        m_masters.push_back(master);
+      }
+    } else if (type == "slave" && (row.size() == 3 || row.size() == 4)) {
+      SimulatedAnswer answer;
+      answer.address = (symbol_t)parseInt(row[1].c_str(), 16, 0, 0xff, &result);
+      if (result == RESULT_OK && !isValidAddress(answer.address, false)) {
+        result = RESULT_ERR_INVALID_ADDR;
+      }
+      if (result == RESULT_OK) {
+        result = parseScenarioHex(row[2], &answer.request);
+      }
+      vector<symbol_t> response;
+      if (result == RESULT_OK && row.size() == 4) {
+        result = parseScenarioHex(row[3], &response);
+      }
+      if (result == RESULT_OK && (isMaster(answer.address) ? !response.empty()
+          : (response.empty() || response[0] != response.size()-1))) {
+        result = RESULT_ERR_INVALID_ARG;  // response for a master or missing/wrong length of the response
+      }
+      if (result == RESULT_OK && !response.empty()) {
+        symbol_t crc = 0;
+        SymbolString::updateCrcUnescaped(response.data(), response.size(), &crc);
+        response.push_back(crc);
+        answer.response.resize(2*response.size());
+        answer.response.resize(SymbolString::escape(response.data(), response.size(), answer.response.data()));
+      }
+      if (result == RESULT_OK) {
+        m_answers.push_back(answer);
+      }
+    } else {
+      result = RESULT_ERR_INVALID_ARG;
+    }
+    if (result != RESULT_OK) {
+      m_masters.clear();
+      m_answers.clear();
+      return result;
+    }
+  } while (more);
+  m_symbolTime = std::max(SIM_SYMBOL_DURATION/speed, 1u);
+  m_synInterval = synInterval == 0 ? 0 : std::max(static_cast<uint64_t>(synInterval)*1000/speed, m_symbolTime);
+  for (auto& master : m_masters) {
+    master.interval = std::max(master.interval*1000/speed, m_symbolTime);
+  }
+  return RESULT_OK;
+}
+
+result_t SimulatedDevice::open() {
+  if (m_fd != -1) {
+    close();
+  }
+  result_t result = readScenario();
+  if (result != RESULT_OK) {
+    return result;
+  }
+#ifdef HAVE_TIMERFD
+  m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (m_fd < 0) {
+    m_fd = -1;
+    return RESULT_ERR_GENERIC_IO;
+  }
+#else
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return RESULT_ERR_GENERIC_IO;
+  }
+  m_fd = fds[0];
+  m_pipeFd = fds[1];
+#endif
+  uint64_t now = getNow();
+  m_wire.clear();
+  m_lastTime = now;
+  m_arbitrationTime = 0;
+  m_phase = sp_skip;
+  m_escaped = false;
+  m_part.clear();
+  m_command.clear();
+  for (auto& master : m_masters) {
+    master.due = now;
+  }
+  armTimer();
+  return afterOpen();
+}
+
+void SimulatedDevice::close() {
+  m_wire.clear();
+  if (m_pipeFd != -1) {
+    ::close(m_pipeFd);
+    m_pipeFd = -1;
+  }
+  Device::close();
+}
+
+uint64_t SimulatedDevice::getNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec)*1000000 + static_cast<uint64_t>(now.tv_nsec/1000);
+}
+
+uint64_t SimulatedDevice::getNextEventTime() const {
+  if (!m_wire.empty()) {
+    return m_wire.front().due;
+  }
+  if (m_arbitrationTime != 0) {
+    return m_arbitrationTime;
+  }
+  if (m_synInterval > 0) {
+    return m_lastTime + m_synInterval;
+  }
+  return 0;
+}
+
+void SimulatedDevice::armTimer() {
+#ifdef HAVE_TIMERFD
+  uint64_t next = getNextEventTime();
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));  // disarmed without any event
+  spec.it_value.tv_sec = static_cast<time_t>(next/1000000);
+  spec.it_value.tv_nsec = static_cast<long>((next%1000000)*1000);  // NOLINT(runtime/int)
+  timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+#endif
+}
+
+bool SimulatedDevice::available() {
+  uint64_t now = getNow();
+  if (advance(now)) {
+    armTimer();
+  }
+#ifdef HAVE_TIMERFD
+  return !m_wire.empty() && m_wire.front().due <= now;
+#else
+  return getNextEventTime() != 0;  // read() waits for the next symbol as the pipe never gets readable
+#endif
+}
+
+ssize_t SimulatedDevice::write(symbol_t value) {
+  uint64_t now = getNow();
+  advance(now);
+  for (const auto& wire : m_wire) {
+    if (!wire.host) {
+      m_collisions++;  // lost in a collision with a sending simulated participant
+      armTimer();
+      return 1;
+    }
+  }
+  if (m_phase == sp_idle && isMaster(value)) {
+    arbitrate(value, now);
+  } else {
+    transmit(&value, 1, true, now+m_symbolTime);
+  }
+  while (react()) {
+    // continue with the next step of the simulated participants
+  }
+  armTimer();
+  return 1;
+}
+
+ssize_t SimulatedDevice::write(const symbol_t* values, size_t count) {
+  for (size_t pos = 0; pos < count; pos++) {
+    write(values[pos]);
+  }
+  return static_cast<ssize_t>(count);
+}
+
+ssize_t SimulatedDevice::read(symbol_t* value) {
+#ifdef HAVE_TIMERFD
+  uint64_t expirations;
+  if (::read(m_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+    return -1;
+  }
+#endif
+  uint64_t now = getNow();
+  while (true) {
+    advance(now);
+    if (!m_wire.empty() && m_wire.front().due <= now) {
+      break;
+    }
+    uint64_t next = getNextEventTime();
+    if (next == 0) {
+      armTimer();
+      return 0;  // nothing pending on the simulated bus
+    }
+    struct timespec delay;
+    delay.tv_sec = static_cast<time_t>((next-now)/1000000);
+    delay.tv_nsec = static_cast<long>(((next-now)%1000000)*1000);  // NOLINT(runtime/int)
+    nanosleep(&delay, nullptr);
+    now = getNow();
+  }
+  *value = m_wire.front().symbol;
+  m_wire.pop_front();
+  if (m_wire.empty()) {
+    m_lastTime = std::max(m_lastTime, now);
+    if (*value == SYN && m_phase == sp_idle) {
+      for (const auto& master : m_masters) {
+        if (master.due <= now) {
+          // give the host the chance to take part in the arbitration
+          m_arbitrationTime = now + std::max(m_symbolTime, static_cast<uint64_t>(SIM_REACTION_TIME));
+          break;
+        }
+      }
+    }
+  }
+  armTimer();
+  return 1;
+}
+
+bool SimulatedDevice::advance(uint64_t now) {
+  if (!m_wire.empty()) {
+    return false;
+  }
+  if (m_arbitrationTime != 0) {
+    if (now < m_arbitrationTime) {
+      return false;
+    }
+    arbitrate(SYN, m_arbitrationTime);
+  } else if (m_synInterval > 0 && now >= m_lastTime + m_synInterval) {
+    symbol_t syn = SYN;
+    transmit(&syn, 1, false, m_lastTime + m_synInterval);
+  } else {
+    return false;
+  }
+  while (react()) {
+    // continue with the next step of the simulated participants
+  }
+  return true;
+}
+
+void SimulatedDevice::arbitrate(symbol_t hostAddress, uint64_t now) {
+  m_arbitrationTime = 0;
+  symbol_t winner = hostAddress;
+  for (const auto& master : m_masters) {
+    if (master.due <= now && (winner == SYN || winsArbitration(master.address, winner))) {
+      winner = master.address;
+    }
+  }
+  if (hostAddress != SYN) {
+    m_arbitrations++;
+    if (winner != hostAddress) {
+      m_lostArbitrations++;
+    }
+  }
+  if (winner == hostAddress) {
+    if (winner != SYN) {
+      transmit(&winner, 1, true, now+m_symbolTime);
+    }
+    return;
+  }
+  SimulatedMaster* master = findMaster(winner, now);
+  master->due = now + master->interval;
+  symbol_t crc = 0;
+  SymbolString::updateCrcUnescaped(master->command.data(), master->command.size(), &crc);
+  symbol_t escaped[2*(SYMBOL_STRING_MAX_SIZE+1)];
+  size_t count = SymbolString::escape(master->command.data(), master->command.size(), escaped);
+  count += SymbolString::escape(&crc, 1, escaped+count);
+  transmit(escaped, count, false, hostAddress == SYN ? now : now+m_symbolTime);
+}
+
+void SimulatedDevice::transmit(const symbol_t* values, size_t count, bool host, uint64_t due) {
+  for (size_t pos = 0; pos < count; pos++, due += m_symbolTime) {
+    due = std::max(due, m_lastTime + m_symbolTime);
+    m_wire.push_back({due, values[pos], host});
+    m_lastTime = due;
+    process(values[pos]);
+  }
+}
+
+void SimulatedDevice::process(symbol_t symbol) {
+  if (symbol == SYN) {
+    m_phase = sp_idle;
+    m_escaped = false;
+    return;
+  }
+  if (m_phase == sp_command || m_phase == sp_response) {
+    if (m_escaped) {
+      m_escaped = false;
+      if (symbol > 0x01) {
+        m_phase = sp_skip;  // invalid escape sequence
+        return;
+      }
+      symbol = symbol == 0x00 ? ESC : SYN;
+    } else if (symbol == ESC) {
+      m_escaped = true;
+      return;
+    }
+  }
+  symbol_t crc = 0;
+  switch (m_phase) {
+  case sp_idle:
+    if (!isMaster(symbol)) {
+      m_phase = sp_skip;
+      break;
+    }
+    m_repeated = false;
+    m_part.clear();
+    m_part.push_back(symbol);
+    m_phase = sp_command;
+    break;
+  case sp_command:
+    m_part.push_back(symbol);
+    if (m_part.size() < 6 || m_part.size() < 6u + m_part[4]) {
+      break;  // QQ ZZ PB SB NN DD CRC not yet complete
+    }
+    SymbolString::updateCrcUnescaped(m_part.data(), m_part.size()-1, &crc);
+    m_partValid = crc == m_part.back();
+    m_command.swap(m_part);
+    m_part.clear();
+    if (m_command[1] == BROADCAST) {
+      m_telegrams++;
+      m_phase = sp_end;
+    } else {
+      m_phase = sp_commandAck;
+    }
+    break;
+  case sp_commandAck:
+    if (symbol == ACK) {
+      if (isMaster(m_command[1])) {
+        m_telegrams++;
+        m_phase = sp_end;
+      } else {
+        m_repeated = false;
+        m_phase = sp_response;
+      }
+    } else if (symbol == NAK) {
+      // the command is repeated once starting with QQ
+      m_phase = m_repeated ? sp_end : sp_command;
+      m_repeated = true;
+    } else {
+      m_phase = sp_skip;
+    }
+    break;
+  case sp_response:
+    m_part.push_back(symbol);
+    if (m_part.size() < 2 || m_part.size() < 2u + m_part[0]) {
+      break;  // NN DD CRC not yet complete
+    }
+    SymbolString::updateCrcUnescaped(m_part.data(), m_part.size()-1, &crc);
+    m_partValid = crc == m_part.back();
+    m_phase = sp_responseAck;
+    break;
+  case sp_responseAck:
+    if (symbol == ACK) {
+      m_telegrams++;
+      m_phase = sp_end;
+    } else if (symbol == NAK) {
+      // the response is repeated once
+      m_part.clear();
+      m_phase = m_repeated ? sp_end : sp_response;
+      m_repeated = true;
+    } else {
+      m_phase = sp_skip;
+    }
+    break;
+  default:  // sp_skip, sp_end
+    m_phase = sp_skip;
+    break;
+  }
+}
+
+bool SimulatedDevice::react() {
+  symbol_t symbol;
+  switch (m_phase) {
+  case sp_command:
+    if (!m_part.empty() || !m_repeated || findMaster(m_command[0], 0) == nullptr) {
+      return false;
+    }
+    {
+      // repeat the command after a NAK
+      symbol_t escaped[2*(SYMBOL_STRING_MAX_SIZE+1)];
+      size_t count = SymbolString::escape(m_command.data(), m_command.size(), escaped);
+      transmit(escaped, count, false, 0);
+    }
+    return true;
+  case sp_commandAck: {
+    symbol_t dstAddress = m_command[1];
+    bool simulated = isMaster(dstAddress) && findMaster(dstAddress, 0) != nullptr;
+    m_response = nullptr;
+    for (const auto& answer : m_answers) {
+      if (answer.address != dstAddress) {
+        continue;
+      }
+      simulated = true;
+      if (answer.request.size() <= m_command.size()-3
+          && std::equal(answer.request.begin(), answer.request.end(), m_command.begin()+2)) {
+        m_response = &answer;
+        break;
+      }
+    }
+    if (!simulated || (m_partValid && m_response == nullptr && !isMaster(dstAddress))) {
+      return false;  // not simulated at all or unknown request
+    }
+    symbol = m_partValid ? ACK : NAK;
+    break;
+  }
+  case sp_response:
+    if (!m_part.empty() || m_response == nullptr || m_response->response.empty()) {
+      return false;
+    }
+    transmit(m_response->response.data(), m_response->response.size(), false, 0);
+    return true;
+  case sp_responseAck:
+    if (findMaster(m_command[0], 0) == nullptr) {
+      return false;
+    }
+    symbol = m_partValid ? ACK : NAK;
+    break;
+  case sp_end:
+    if (findMaster(m_command[0], 0) == nullptr) {
+      return false;
+    }
+    symbol = SYN;
+    break;
+  default:
+    return false;
+  }
+  transmit(&symbol, 1, false, 0);
+  return true;
+}
+
+SimulatedDevice::SimulatedMaster* SimulatedDevice::findMaster(symbol_t address, uint64_t now) {
+  SimulatedMaster* found = nullptr;
+  for (auto& master : m_masters) {
+    if (master.address == address && (now == 0 || master.due <= now)
+        && (found == nullptr || master.due < found->due)) {
+      found = &master;
+    }
+  }
+  return found;
+}
+
 }  // namespace ebusd
@@ -23,8 +23,12 @@
 #include <termios.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <stdint.h>
 #include <iostream>
 #include <fstream>
+#include <deque>
+#include <string>
+#include <vector>
 #include "lib/ebus/result.h"
 #include "lib/ebus/symbol.h"
 
@@ -37,8 +41,67 @@ namespace ebusd {
  * port or a remote @a NetworkDevice handled via a TCP socket. It allows to
  * send and receive bytes to/from the eBUS while optionally dumping the data
  * to a file and/or forwarding it to a logging function.
+ *
+ * With the enhanced protocol (device name prefixed with "enh:"), each byte
+ * from/to the adapter is either a plain data byte below 0x80 or a pair of
+ * bytes carrying a 4 bit command and an 8 bit value. This allows the adapter
+ * to do the timing critical arbitration itself and to only report the result.
+ *
+ * A @a SimulatedDevice (device name prefixed with "sim:" followed by the name
+ * of a scenario file) does not access any hardware but models a whole bus
+ * with the symbol timing, AUTO-SYN generation, echo of sent symbols,
+ * arbitration against simulated masters, and simulated slaves answering
+ * requests. Its time may be scaled in order to run much faster than real
+ * time (e.g. for load tests).
+ *
+ * A timed dump file consists of records of @a TIMED_DUMP_RECORD_SIZE bytes,
+ * each holding the delay in microseconds since the previous received symbol
+ * (24 bit little endian) followed by the symbol itself.
  */
 
+using std::deque;
+using std::string;
+using std::vector;
+
+/** the size of a record in a timed dump file. */
+#define TIMED_DUMP_RECORD_SIZE 4
+
+/** the maximum delay in microseconds storable in a timed dump record (larger ones are capped). */
+#define TIMED_DUMP_MAX_DELAY 0xffffff
+
+/**
+ * Encode a received symbol into a record for a timed dump file.
+ * @param symbol the received symbol.
+ * @param delay the delay in microseconds since the previous received symbol (capped to @a TIMED_DUMP_MAX_DELAY).
+ * @param record the buffer of @a TIMED_DUMP_RECORD_SIZE bytes to fill.
+ */
+void encodeTimedDumpRecord(symbol_t symbol, unsigned int delay, unsigned char* record);
+
+/**
+ * Decode a record from a timed dump file.
+ * @param record the buffer of @a TIMED_DUMP_RECORD_SIZE bytes to decode.
+ * @param delay the variable in which to store the delay in microseconds since the previous received symbol.
+ * @return the received symbol.
+ */
+symbol_t decodeTimedDumpRecord(const unsigned char* record, unsigned int* delay);
+
+/** the duration of a symbol on a simulated bus in microseconds of simulated time (2400 Baud with 10 bits each). */
+#define SIM_SYMBOL_DURATION 4167
+
+/** the default AUTO-SYN interval of a simulated bus in milliseconds of simulated time. */
+#define SIM_SYN_INTERVAL 40
+
+/** the minimum real time in microseconds a simulated bus waits for the host to start the arbitration after a SYN. */
+#define SIM_REACTION_TIME 500
+
+/** the state of an arbitration done by the adapter with the enhanced protocol. */
+enum ArbitrationState {
+  as_none,     //!< no arbitration result available
+  as_running,  //!< arbitration requested and not finished yet
+  as_won,      //!< arbitration won
+  as_lost,     //!< arbitration lost
+};
+
 /**
  * Interface for listening to data received on/sent to a device.
  */
@@ -69,10 +132,11 @@ class Device {
    * @param checkDevice whether to regularly check the device availability (only for serial devices).
    * @param readOnly whether to allow read access to the device only.
    * @param initialSend whether to send an initial @a ESC symbol in @a open().
+   * @param enhancedProto whether to use the enhanced protocol.
    */
-  Device(const char* name, bool checkDevice, bool readOnly, bool initialSend)
-    : m_name(name), m_checkDevice(checkDevice), m_readOnly(readOnly), m_initialSend(initialSend), m_fd(-1),
-      m_listener(nullptr) {}
+  Device(const char* name, bool checkDevice, bool readOnly, bool initialSend, bool enhancedProto)
+    : m_name(name), m_checkDevice(checkDevice), m_readOnly(readOnly), m_initialSend(initialSend),
+      m_enhancedProto(enhancedProto), m_fd(-1), m_savedReads(0), m_listener(nullptr), m_arbitrationMaster(SYN) {}
 
   /**
    * Destructor.
@@ -81,7 +145,8 @@ class Device {
 
   /**
    * Factory method for creating a new instance.
-   * @param name the device name (e.g. "/dev/ttyUSB0" for serial, "127.0.0.1:1234" for network).
+   * @param name the device name (e.g. "/dev/ttyUSB0" for serial, "127.0.0.1:1234" for network), optionally prefixed
+   * with "enh:" for the enhanced protocol.
    * @param checkDevice whether to regularly check the device availability (only for serial devices).
    * @param readOnly whether to allow read access to the device only.
    * @param initialSend whether to send an initial @a ESC symbol in @a open().
@@ -115,13 +180,50 @@ class Device {
    */
   result_t send(symbol_t value);
 
+  /**
+   * Write multiple bytes to the device at once.
+   * @param values the byte values to write.
+   * @param count the number of bytes to write.
+   * @return the @a result_t code.
+   */
+  result_t send(const symbol_t* values, size_t count);
+
+  /**
+   * Return whether multiple bytes may be written at once with @a send(const symbol_t*, size_t) before checking the
+   * echo of each.
+   * @return whether multiple bytes may be written at once.
+   */
+  virtual bool canSendBatch() const { return false; }
+
   /**
    * Read a single byte from the device.
    * @param timeout maximum time to wait for the byte in microseconds, or 0 for infinite.
-   * @param value the reference in which the received byte value is stored.
+   * @param value the reference in which the received byte value is stored (the winning master address on
+   * arbitration result).
+   * @param arbitrationState the optional variable in which to store the @a ArbitrationState.
    * @return the result_t code.
    */
-  result_t recv(unsigned int timeout, symbol_t* value);
+  result_t recv(unsigned int timeout, symbol_t* value, ArbitrationState* arbitrationState = nullptr);
+
+  /**
+   * Return whether the enhanced protocol is used.
+   * @return whether the enhanced protocol is used.
+   */
+  bool isEnhancedProto() const { return m_enhancedProto; }
+
+  /**
+   * Let the adapter start the arbitration on the next @a SYN (only for the enhanced protocol), with the result
+   * being delivered by @a recv(). Repeated calls with the same address while the arbitration is running are ignored.
+   * @param masterAddress the master address to arbitrate with, or @a SYN to cancel a running arbitration.
+   * @return the @a result_t code.
+   */
+  result_t startArbitration(symbol_t masterAddress);
+
+  /**
+   * Return whether an arbitration is currently running in the adapter.
+   * @return whether an arbitration is currently running in the adapter.
+   */
+  bool isArbitrating() const { return m_arbitrationMaster != SYN; }
 
   /**
    * Return the device name.
@@ -147,6 +249,16 @@ class Device {
    */
   void setListener(DeviceListener* listener) { m_listener = listener; }
 
+  /**
+   * Return the number of symbols delivered from the read-ahead buffer since the last call and reset it.
+   * @return the number of read system calls saved since the last call.
+   */
+  unsigned int takeSavedReads() {
+    unsigned int ret = m_savedReads;
+    m_savedReads = 0;
+    return ret;
+  }
+
 
  protected:
   /**
@@ -154,6 +266,13 @@ class Device {
    */
   virtual void checkDevice() = 0;  // abstract
 
+  /**
+   * Finish opening the file descriptor, i.e. initialize the enhanced protocol and send the initial @a ESC symbol
+   * if necessary.
+   * @return the @a result_t code.
+   */
+  result_t afterOpen();
+
   /**
    * Check whether a byte is available immediately (without waiting).
    * @return true when a a byte is available immediately.
@@ -167,6 +286,14 @@ class Device {
    */
   virtual ssize_t write(symbol_t value) { return ::write(m_fd, &value, 1); }
 
+  /**
+   * Write multiple bytes.
+   * @param values the byte values to write.
+   * @param count the number of bytes to write.
+   * @return the number of bytes written, or -1 on error.
+   */
+  virtual ssize_t write(const symbol_t* values, size_t count) { return ::write(m_fd, values, count); }
+
   /**
    * Read a single byte.
    * @param value the reference in which the read byte value is stored.
@@ -186,13 +313,37 @@ class Device {
   /** whether to send an initial @a ESC symbol in @a open(). */
   const bool m_initialSend;
 
+  /** whether to use the enhanced protocol. */
+  const bool m_enhancedProto;
+
   /** the opened file descriptor, or -1. */
   int m_fd;
 
+  /** the number of symbols delivered from a read-ahead buffer without a read() system call. */
+  unsigned int m_savedReads;
+
 
  private:
+  /**
+   * Write a single data byte (encoded for the enhanced protocol if necessary).
+   * @param value the byte value to write.
+   * @return true on success.
+   */
+  bool writeData(symbol_t value);
+
+  /**
+   * Read a single byte without decoding the enhanced protocol.
+   * @param timeout maximum time to wait for the byte in microseconds, or 0 for infinite.
+   * @param value the reference in which the received byte value is stored.
+   * @return the result_t code.
+   */
+  result_t recvRaw(unsigned int timeout, symbol_t* value);
+
   /** the @a DeviceListener, or nullptr. */
   DeviceListener* m_listener;
+
+  /** the master address of the arbitration running in the adapter, or @a SYN. */
+  symbol_t m_arbitrationMaster;
 };
 
 /**
@@ -206,9 +357,20 @@ class SerialDevice : public Device {
    * @param checkDevice whether to regularly check the device availability (only for serial devices).
    * @param readOnly whether to allow read access to the device only.
    * @param initialSend whether to send an initial @a ESC symbol in @a open().
+   * @param enhancedProto whether to use the enhanced protocol.
    */
-  SerialDevice(const char* name, bool checkDevice, bool readOnly, bool initialSend)
-    : Device(name, checkDevice, readOnly, initialSend) {}
+  SerialDevice(const char* name, bool checkDevice, bool readOnly, bool initialSend, bool enhancedProto)
+    : Device(name, checkDevice, readOnly, initialSend, enhancedProto),
+      m_buffer(nullptr), m_bufSize(0), m_bufLen(0), m_bufPos(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~SerialDevice() {
+    if (m_buffer) {
+      free(m_buffer);
+    }
+  }
 
   // @copydoc
   result_t open() override;
@@ -221,10 +383,28 @@ class SerialDevice : public Device {
   // @copydoc
   void checkDevice() override;
 
+  // @copydoc
+  bool available() override;
+
+  // @copydoc
+  ssize_t read(symbol_t* value) override;
+
 
  private:
   /** the previous settings of the device for restoring. */
   termios m_oldSettings;
+
+  /** the read-ahead buffer memory, or nullptr. */
+  symbol_t* m_buffer;
+
+  /** the buffer size. */
+  size_t m_bufSize;
+
+  /** the buffer fill length. */
+  size_t m_bufLen;
+
+  /** the buffer read position. */
+  size_t m_bufPos;
 };
 
 /**
@@ -238,11 +418,12 @@ class NetworkDevice : public Device {
    * @param address the socket address of the device.
    * @param readOnly whether to allow read access to the device only.
    * @param initialSend whether to send an initial @a ESC symbol in @a open().
+   * @param enhancedProto whether to use the enhanced protocol.
    * @param udp true for UDP, false to TCP.
    */
   NetworkDevice(const char* name, const struct sockaddr_in& address, bool readOnly, bool initialSend,
-    bool udp)
-    : Device(name, true, readOnly, initialSend), m_address(address), m_udp(udp),
+    bool enhancedProto, bool udp)
+    : Device(name, true, readOnly, initialSend, enhancedProto), m_address(address), m_udp(udp),
       m_buffer(nullptr), m_bufSize(0), m_bufLen(0), m_bufPos(0) {}
 
   /**
@@ -257,6 +438,9 @@ class NetworkDevice : public Device {
   // @copydoc
   unsigned int getLatency() const override { return 10000; }
 
+  // @copydoc
+  bool canSendBatch() const override { return m_udp; }  // TCP peers might delay the echo due to Nagle's algorithm
+
   // @copydoc
   result_t open() override;
 
@@ -273,11 +457,20 @@ class NetworkDevice : public Device {
   // @copydoc
   ssize_t write(symbol_t value) override;
 
+  // @copydoc
+  ssize_t write(const symbol_t* values, size_t count) override;
+
   // @copydoc
   ssize_t read(symbol_t* value) override;
 
 
  private:
+  /**
+   * Fill the empty buffer with all datagrams already received (only for UDP).
+   * @return the number of bytes read, or -1 on error.
+   */
+  ssize_t readDatagrams();
+
   /** the socket address of the device. */
   const struct sockaddr_in m_address;
 
@@ -297,6 +490,254 @@ class NetworkDevice : public Device {
   size_t m_bufPos;
 };
 
+/**
+ * The @a Device simulating a whole bus with masters and slaves described in a scenario file.
+ *
+ * Each non-empty line of the scenario file consists of comma separated fields:
+ * - "speed,FACTOR": the time scale factor, i.e. the simulated time runs FACTOR times faster than real time [1].
+ * - "syn,MILLIS": the AUTO-SYN interval in milliseconds of simulated time, or 0 for none [40].
+ * - "master,QQ,MILLIS,ZZPBSBNNDD": a simulated master QQ sending the hex telegram every MILLIS milliseconds of
+ *   simulated time.
+ * - "slave,ZZ,PBSBNNDD,NNDD": a simulated slave (or master) ZZ answering requests starting with the hex prefix
+ *   PBSBNNDD with the hex response NNDD (empty for a master).
+ *
+ * The simulation is driven by the calls from the host only and runs within the same thread. A symbol sent by the
+ * host while a simulated participant is sending is lost in the collision, i.e. the host sees the other symbol
+ * instead of the echo. Without AUTO-SYN, reading with an infinite timeout while nothing is pending on the simulated
+ * bus reports the end of input.
+ */
+class SimulatedDevice : public Device {
+ public:
+  /**
+   * Construct a new instance.
+   * @param name the device name (e.g. "sim:scenario.csv").
+   * @param scenario the name of the scenario file.
+   * @param readOnly whether to allow read access to the device only.
+   * @param initialSend whether to send an initial @a ESC symbol in @a open().
+   */
+  SimulatedDevice(const char* name, const char* scenario, bool readOnly, bool initialSend)
+    : Device(name, false, readOnly, initialSend, false), m_scenario(scenario), m_symbolTime(SIM_SYMBOL_DURATION),
+      m_synInterval(SIM_SYN_INTERVAL*1000), m_pipeFd(-1), m_lastTime(0), m_arbitrationTime(0), m_phase(sp_skip),
+      m_escaped(false), m_partValid(false), m_repeated(false), m_response(nullptr), m_telegrams(0),
+      m_arbitrations(0), m_lostArbitrations(0), m_collisions(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~SimulatedDevice() {
+    close();
+  }
+
+  // @copydoc
+  result_t open() override;
+
+  // @copydoc
+  void close() override;
+
+  /**
+   * Get the number of telegrams completed on the simulated bus.
+   * @return the number of telegrams completed on the simulated bus.
+   */
+  unsigned int getTelegramCount() const { return m_telegrams; }
+
+  /**
+   * Get the number of arbitrations started by the host.
+   * @return the number of arbitrations started by the host.
+   */
+  unsigned int getArbitrationCount() const { return m_arbitrations; }
+
+  /**
+   * Get the number of arbitrations lost by the host against a simulated master.
+   * @return the number of arbitrations lost by the host against a simulated master.
+   */
+  unsigned int getLostArbitrationCount() const { return m_lostArbitrations; }
+
+  /**
+   * Get the number of symbols sent by the host that were lost in a collision.
+   * @return the number of symbols sent by the host that were lost in a collision.
+   */
+  unsigned int getCollisionCount() const { return m_collisions; }
+
+
+ protected:
+  // @copydoc
+  void checkDevice() override {}
+
+  // @copydoc
+  bool available() override;
+
+  // @copydoc
+  ssize_t write(symbol_t value) override;
+
+  // @copydoc
+  ssize_t write(const symbol_t* values, size_t count) override;
+
+  // @copydoc
+  ssize_t read(symbol_t* value) override;
+
+
+ private:
+  /** the phase of the telegram on the simulated bus. */
+  enum SimulatedPhase {
+    sp_skip,         //!< skip all symbols until the next @a SYN
+    sp_idle,         //!< @a SYN seen, waiting for the arbitration
+    sp_command,      //!< receiving the command (QQ ZZ PB SB NN DD CRC)
+    sp_commandAck,   //!< waiting for the command ACK/NAK
+    sp_response,     //!< receiving the response (NN DD CRC)
+    sp_responseAck,  //!< waiting for the response ACK/NAK
+    sp_end,          //!< waiting for the final @a SYN
+  };
+
+  /** A symbol on the simulated wire. */
+  struct WireSymbol {
+    uint64_t due;  //!< the real time in microseconds when the symbol is completely transferred
+    symbol_t symbol;  //!< the symbol
+    bool host;  //!< whether the symbol was sent by the host
+  };
+
+  /** A telegram regularly sent by a simulated master. */
+  struct SimulatedMaster {
+    symbol_t address;  //!< the master address
+    uint64_t interval;  //!< the send interval in microseconds of real time
+    uint64_t due;  //!< the real time in microseconds when the telegram is to be sent next
+    vector<symbol_t> command;  //!< the unescaped command without the CRC
+  };
+
+  /** An answer of a simulated slave. */
+  struct SimulatedAnswer {
+    symbol_t address;  //!< the destination address
+    vector<symbol_t> request;  //!< the unescaped prefix of the request starting with PB
+    vector<symbol_t> response;  //!< the escaped response including the CRC, or empty for a master
+  };
+
+  /**
+   * Read the scenario file.
+   * @return the @a result_t code.
+   */
+  result_t readScenario();
+
+  /**
+   * Get the current real time.
+   * @return the current real time in microseconds.
+   */
+  static uint64_t getNow();
+
+  /**
+   * Get the real time of the next event on the simulated bus.
+   * @return the real time of the next event on the simulated bus in microseconds, or 0 for none.
+   */
+  uint64_t getNextEventTime() const;
+
+  /**
+   * Arm the timer for the next event on the simulated bus.
+   */
+  void armTimer();
+
+  /**
+   * Let the simulated bus do everything due until the specified time while the wire is idle, i.e. resolve the
+   * arbitration of the simulated masters or send the AUTO-SYN.
+   * @param now the current real time in microseconds.
+   * @return true if anything was done.
+   */
+  bool advance(uint64_t now);
+
+  /**
+   * Resolve the arbitration of the host and/or the due simulated masters and send the winner's command.
+   * @param hostAddress the master address sent by the host, or @a SYN if the host does not take part.
+   * @param now the current real time in microseconds.
+   */
+  void arbitrate(symbol_t hostAddress, uint64_t now);
+
+  /**
+   * Put symbols onto the simulated wire after the ones already being transferred.
+   * @param values the escaped symbols.
+   * @param count the number of symbols.
+   * @param host whether the symbols are sent by the host.
+   * @param due the earliest real time in microseconds when the first symbol is completely transferred.
+   */
+  void transmit(const symbol_t* values, size_t count, bool host, uint64_t due);
+
+  /**
+   * Follow the telegram on the simulated wire with the next symbol.
+   * @param symbol the next symbol put onto the simulated wire.
+   */
+  void process(symbol_t symbol);
+
+  /**
+   * Let the simulated participants react on the current phase of the telegram.
+   * @return true if a simulated participant sent something.
+   */
+  bool react();
+
+  /**
+   * Find the due @a SimulatedMaster with the specified address sending next.
+   * @param address the master address.
+   * @param now the current real time in microseconds, or 0 for any regardless of being due.
+   * @return the @a SimulatedMaster, or nullptr.
+   */
+  SimulatedMaster* findMaster(symbol_t address, uint64_t now);
+
+  /** the name of the scenario file. */
+  const string m_scenario;
+
+  /** the duration of a symbol in microseconds of real time. */
+  uint64_t m_symbolTime;
+
+  /** the AUTO-SYN interval in microseconds of real time, or 0 for none. */
+  uint64_t m_synInterval;
+
+  /** the writing end of the pipe replacing the timer, or -1. */
+  int m_pipeFd;
+
+  /** the real time in microseconds when the last symbol was completely transferred or received by the host. */
+  uint64_t m_lastTime;
+
+  /** the real time in microseconds when the arbitration of the due simulated masters is resolved, or 0. */
+  uint64_t m_arbitrationTime;
+
+  /** the symbols on the simulated wire not yet received by the host. */
+  deque<WireSymbol> m_wire;
+
+  /** the telegrams sent by the simulated masters. */
+  vector<SimulatedMaster> m_masters;
+
+  /** the answers of the simulated slaves. */
+  vector<SimulatedAnswer> m_answers;
+
+  /** the phase of the telegram on the simulated wire. */
+  SimulatedPhase m_phase;
+
+  /** whether the last symbol on the simulated wire was an @a ESC. */
+  bool m_escaped;
+
+  /** the unescaped symbols of the current part of the telegram (including the CRC). */
+  vector<symbol_t> m_part;
+
+  /** whether the CRC of the last completed part of the telegram was valid. */
+  bool m_partValid;
+
+  /** whether the current part of the telegram is already repeated. */
+  bool m_repeated;
+
+  /** the unescaped command of the current telegram (including QQ and the CRC). */
+  vector<symbol_t> m_command;
+
+  /** the @a SimulatedAnswer for the current telegram, or nullptr. */
+  const SimulatedAnswer* m_response;
+
+  /** the number of telegrams completed on the simulated bus. */
+  unsigned int m_telegrams;
+
+  /** the number of arbitrations started by the host. */
+  unsigned int m_arbitrations;
+
+  /** the number of arbitrations lost by the host against a simulated master. */
+  unsigned int m_lostArbitrations;
+
+  /** the number of symbols sent by the host that were lost in a collision. */
+  unsigned int m_collisions;
+};
+
 }  // namespace ebusd
 
 #endif  // LIB_EBUS_DEVICE_H_
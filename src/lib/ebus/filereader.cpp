@@ -18,6 +18,10 @@
 
 #include "lib/ebus/filereader.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -25,10 +29,16 @@
 #include <climits>
 #include <fstream>
 #include <functional>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
 
 namespace ebusd {
 
 using std::ifstream;
+using std::ofstream;
 using std::ostringstream;
 using std::cout;
 using std::endl;
@@ -67,35 +77,92 @@ result_t FileReader::readFromStream(istream* stream, const string& filename, con
   if (size) {
     *size = 0;
   }
-  unsigned int lineNo = 0;
+  SnapshotFile* snapshotFile = m_snapshotFile;
+  m_snapshotFile = nullptr;
   vector<string> row;
   result_t result = RESULT_OK;
-  while (stream->peek() != EOF && result == RESULT_OK) {
-    result = readLineFromStream(stream, filename, verbose, &lineNo, &row, errorDescription, replace, hash, size);
+  if (snapshotFile && m_snapshotReplay) {
+    if (hash) {
+      *hash = snapshotFile->m_hash;
+    }
+    if (size) {
+      *size = snapshotFile->m_size;
+    }
+    for (size_t index = 0; index < snapshotFile->m_rows.size() && result == RESULT_OK; index++) {
+      row = snapshotFile->m_rows[index];
+      unsigned int lineNo = snapshotFile->m_lineNos[index];
+      *errorDescription = "";
+      result = finishLine(filename, verbose, lineNo, addFromFile(filename, lineNo, &row, errorDescription, replace),
+          errorDescription);
+    }
+    return result;
+  }
+  size_t localHash = 0, localSize = 0;
+  if (snapshotFile) {
+    snapshotFile->m_lineNos.clear();
+    snapshotFile->m_rows.clear();
+    if (!hash) {
+      hash = &localHash;
+    }
+    if (!size) {
+      size = &localSize;
+    }
+  }
+  SnapshotFile* previousRecordFile = m_recordFile;
+  m_recordFile = snapshotFile;
+  string buffer;
+  readBuffer(stream, &buffer);
+  const char* pos = buffer.data();
+  const char* end = pos + buffer.size();
+  unsigned int lineNo = 0;
+  while (pos < end && result == RESULT_OK) {
+    if (!splitFields(&pos, end, &row, &lineNo, hash, size)) {
+      *errorDescription = "blank line";
+      result = finishLine(filename, verbose, lineNo, RESULT_ERR_EOF, errorDescription);
+    } else {
+      result = addSplitLine(filename, verbose, lineNo, &row, errorDescription, replace);
+    }
+  }
+  m_recordFile = previousRecordFile;
+  if (snapshotFile) {
+    snapshotFile->m_hash = *hash;
+    snapshotFile->m_size = *size;
   }
   return result;
 }
 
 result_t FileReader::readLineFromStream(istream* stream, const string& filename, bool verbose,
     unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size) {
-  result_t result;
   if (!splitFields(stream, row, lineNo, hash, size)) {
     *errorDescription = "blank line";
-    result = RESULT_ERR_EOF;
-  } else {
-    *errorDescription = "";
-    result = addFromFile(filename, *lineNo, row, errorDescription, replace);
+    return finishLine(filename, verbose, *lineNo, RESULT_ERR_EOF, errorDescription);
   }
+  return addSplitLine(filename, verbose, *lineNo, row, errorDescription, replace);
+}
+
+result_t FileReader::addSplitLine(const string& filename, bool verbose, unsigned int lineNo, vector<string>* row,
+    string* errorDescription, bool replace) {
+  if (m_recordFile) {
+    m_recordFile->m_lineNos.push_back(lineNo);
+    m_recordFile->m_rows.push_back(*row);
+  }
+  *errorDescription = "";
+  return finishLine(filename, verbose, lineNo, addFromFile(filename, lineNo, row, errorDescription, replace),
+      errorDescription);
+}
+
+result_t FileReader::finishLine(const string& filename, bool verbose, unsigned int lineNo, result_t result,
+    string* errorDescription) {
   if (result != RESULT_OK) {
     if (!errorDescription->empty()) {
       string error;
-      formatError(filename, *lineNo, result, *errorDescription, &error);
+      formatError(filename, lineNo, result, *errorDescription, &error);
       *errorDescription = error;
       if (verbose) {
         cout << error << endl;
       }
     } else if (!verbose) {
-      return formatError(filename, *lineNo, result, "", errorDescription);
+      return formatError(filename, lineNo, result, "", errorDescription);
     }
   } else if (!verbose) {
     *errorDescription = "";
@@ -118,14 +185,18 @@ void FileReader::tolower(string* str) {
   transform(str->begin(), str->end(), str->begin(), ::tolower);
 }
 
-static size_t hashFunction(const string& str) {
+static size_t hashFunction(const char* str, size_t length) {
   size_t hash = 0;
-  for (unsigned char c : str) {
-    hash = (31 * hash) ^ c;
+  for (size_t pos = 0; pos < length; pos++) {
+    hash = (31 * hash) ^ static_cast<unsigned char>(str[pos]);
   }
   return hash;
 }
 
+static size_t hashFunction(const string& str) {
+  return hashFunction(str.data(), str.length());
+}
+
 bool FileReader::splitFields(istream* stream, vector<string>* row, unsigned int* lineNo,
     size_t* hash, size_t* size) {
   row->clear();
@@ -206,6 +277,193 @@ bool FileReader::splitFields(istream* stream, vector<string>* row, unsigned int*
   return true;
 }
 
+/**
+ * Find the next character with a special meaning within a line.
+ * @param pos the position to start at.
+ * @param end the end of the line.
+ * @return the position of the next @a FIELD_SEPARATOR, @a TEXT_SEPARATOR, or carriage return, or @p end.
+ */
+static const char* findSpecial(const char* pos, const char* end) {
+#if defined(__SSE2__)
+  const __m128i fieldSep = _mm_set1_epi8(FIELD_SEPARATOR);
+  const __m128i textSep = _mm_set1_epi8(TEXT_SEPARATOR);
+  const __m128i cr = _mm_set1_epi8('\r');
+  for (; end - pos >= 16; pos += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, fieldSep),
+        _mm_cmpeq_epi8(chunk, textSep)), _mm_cmpeq_epi8(chunk, cr)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(static_cast<unsigned int>(mask));
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t fieldSep = vdupq_n_u8(FIELD_SEPARATOR);
+  const uint8x16_t textSep = vdupq_n_u8(TEXT_SEPARATOR);
+  const uint8x16_t cr = vdupq_n_u8('\r');
+  for (; end - pos >= 16; pos += 16) {
+    uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(pos));
+    uint64x2_t match = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(vceqq_u8(chunk, fieldSep), vceqq_u8(chunk, textSep)),
+        vceqq_u8(chunk, cr)));
+    if ((vgetq_lane_u64(match, 0) | vgetq_lane_u64(match, 1)) != 0) {
+      break;  // the exact position is determined below
+    }
+  }
+#endif
+  while (pos < end && *pos != FIELD_SEPARATOR && *pos != TEXT_SEPARATOR && *pos != '\r') {
+    pos++;
+  }
+  return pos;
+}
+
+/**
+ * Determine the range of a string trimmed the same way as by @a FileReader::trim().
+ * @param start pointer to the start of the string (updated to the trimmed start).
+ * @param end pointer to the end of the string (updated to the trimmed end).
+ */
+static void trimRange(const char** start, const char** end) {
+  const char* first = *start;
+  while (first < *end && (*first == ' ' || *first == '\t')) {
+    first++;
+  }
+  if (first == *end) {
+    return;  // nothing but blanks is kept as is
+  }
+  const char* last = *end;
+  while (last[-1] == ' ' || last[-1] == '\t') {
+    last--;
+  }
+  *start = first;
+  *end = last;
+}
+
+/**
+ * Assign the trimmed field to the next string of the row.
+ * @param field the field as collected.
+ * @param row the @a vector of fields.
+ * @param count the number of fields already assigned (incremented).
+ * @return true if the trimmed field is empty.
+ */
+static bool assignField(const string& field, vector<string>* row, size_t* count) {
+  const char* start = field.data();
+  const char* end = start + field.length();
+  trimRange(&start, &end);
+  if (*count < row->size()) {
+    (*row)[*count].assign(start, end - start);
+  } else {
+    row->emplace_back(start, end - start);
+  }
+  (*count)++;
+  return start == end;
+}
+
+bool FileReader::splitFields(const char** pos, const char* end, vector<string>* row, unsigned int* lineNo,
+    size_t* hash, size_t* size) {
+  size_t count = 0;
+  string field;
+  bool quotedText = false, wasQuoted = false;
+  char prev = FIELD_SEPARATOR;
+  bool empty = true, read = false;
+  const char* next = *pos;
+  while (next < end) {
+    const char* start = next;
+    const char* stop = static_cast<const char*>(memchr(start, '\n', end - start));
+    if (stop) {
+      next = stop + 1;
+    } else {
+      next = stop = end;
+    }
+    read = true;
+    ++(*lineNo);
+    trimRange(&start, &stop);
+    size_t length = stop - start;
+    if (size) {
+      *size += length + 1;  // normalized with trailing endl
+    }
+    if (hash) {
+      *hash ^= (hashFunction(start, length) ^ (length << (7 * (*lineNo % 5)))) & 0xffffffff;
+    }
+    if (!quotedText && (length == 0 || start[0] == '#' || (length > 1 && start[0] == '/' && start[1] == '/'))) {
+      if (*lineNo == 1) {
+        break;  // keep empty first line for applying default header
+      }
+      continue;  // skip empty lines and comments
+    }
+    for (const char* chPos = start; chPos < stop; ) {
+      char ch = *chPos;
+      switch (ch) {
+      case FIELD_SEPARATOR:
+        if (quotedText) {
+          field += ch;
+        } else {
+          empty &= assignField(field, row, &count);
+          field.clear();
+          wasQuoted = false;
+        }
+        break;
+      case TEXT_SEPARATOR:
+        if (prev == TEXT_SEPARATOR && !quotedText) {  // double dquote
+          field += ch;
+          quotedText = true;
+        } else if (quotedText) {
+          quotedText = false;
+        } else if (prev == FIELD_SEPARATOR) {
+          quotedText = wasQuoted = true;
+        } else {
+          field += ch;
+        }
+        break;
+      case '\r':
+        break;
+      default: {
+        if (prev == TEXT_SEPARATOR && !quotedText && wasQuoted) {
+          field += TEXT_SEPARATOR;  // single dquote in the middle of formerly quoted text
+          quotedText = true;
+        } else if (quotedText && chPos == start && !field.empty() && field.back() != VALUE_SEPARATOR) {
+          field += VALUE_SEPARATOR;  // add separator in between multiline field parts
+        }
+        // the remaining plain characters up to the next special one are taken over at once
+        const char* runEnd = findSpecial(chPos + 1, stop);
+        field.append(chPos, runEnd - chPos);
+        prev = runEnd[-1];
+        chPos = runEnd;
+        continue;
+      }
+      }
+      prev = ch;
+      chPos++;
+    }
+    if (!quotedText) {
+      break;
+    }
+  }
+  *pos = next;
+  const char* fieldStart = field.data();
+  const char* fieldEnd = fieldStart + field.length();
+  trimRange(&fieldStart, &fieldEnd);
+  if (empty && fieldStart == fieldEnd) {
+    row->clear();
+    return read;
+  }
+  assignField(field, row, &count);
+  row->resize(count);
+  return true;
+}
+
+void FileReader::readBuffer(istream* stream, string* buffer) {
+  std::streambuf* streamBuffer = stream->rdbuf();
+  size_t used = 0;
+  buffer->resize(64*1024);
+  std::streamsize read;
+  while ((read = streamBuffer->sgetn(&(*buffer)[used], buffer->size() - used)) > 0) {
+    used += static_cast<size_t>(read);
+    if (used == buffer->size()) {
+      buffer->resize(buffer->size() * 2);
+    }
+  }
+  buffer->resize(used);
+  stream->setstate(std::ios::eofbit);
+}
+
 result_t FileReader::formatError(const string& filename, unsigned int lineNo, result_t result,
     const string& error, string* errorDescription) {
   ostringstream str;
@@ -343,4 +601,221 @@ const string MappedFileReader::combineRow(const map<string, string>& row) {
   return ostream.str();
 }
 
+
+/** the magic bytes at the start of a @a ConfigSnapshot file. */
+static const char SNAPSHOT_MAGIC[8] = {'e', 'b', 'u', 's', 'd', 'c', 'f', 'g'};
+
+/** the version of the @a ConfigSnapshot file format (to be increased with each format change). */
+#define SNAPSHOT_VERSION 2
+
+ConfigSnapshot::~ConfigSnapshot() {
+  unmap();
+}
+
+void ConfigSnapshot::unmap() {
+  if (m_mapped) {
+    munmap(m_mapped, m_mappedLength);
+    m_mapped = nullptr;
+    m_mappedLength = 0;
+  }
+}
+
+result_t ConfigSnapshot::open(const string& filename) {
+  m_mutex.lock();
+  m_filename = filename;
+  m_files.clear();
+  m_dirty = false;
+  unmap();
+  m_mutex.unlock();
+  if (filename.empty()) {
+    return RESULT_OK;
+  }
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return RESULT_ERR_NOTFOUND;
+  }
+  size_t length = static_cast<size_t>(st.st_size);
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return RESULT_ERR_DEVICE;
+  }
+  // only index the files here, their rows are deserialized on demand
+  SnapshotReader reader(reinterpret_cast<const char*>(mapped), length);
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  uint32_t version = 0, fileCount = 0;
+  bool valid = reader.read(&magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0
+    && reader.read(&version) && version == SNAPSHOT_VERSION && reader.read(&fileCount);
+  map<string, SnapshotEntry> files;
+  for (uint32_t fileIndex = 0; valid && fileIndex < fileCount; fileIndex++) {
+    string name;
+    uint64_t mtime, fileSize, hash, size, lastUsed, rowDataLength;
+    valid = reader.read(&name) && reader.read(&mtime) && reader.read(&fileSize) && reader.read(&hash)
+      && reader.read(&size) && reader.read(&lastUsed) && reader.read(&rowDataLength);
+    const char* rowData = reader.getData();
+    valid = valid && reader.skip(static_cast<size_t>(rowDataLength));
+    if (!valid) {
+      break;
+    }
+    SnapshotEntry& entry = files[name];
+    entry.m_file.m_mtime = static_cast<time_t>(mtime);
+    entry.m_file.m_fileSize = static_cast<size_t>(fileSize);
+    entry.m_file.m_hash = static_cast<size_t>(hash);
+    entry.m_file.m_size = static_cast<size_t>(size);
+    entry.m_rowData = rowData;
+    entry.m_rowDataLength = static_cast<size_t>(rowDataLength);
+    entry.m_lastUsed = static_cast<time_t>(lastUsed);
+  }
+  if (!valid) {
+    munmap(mapped, length);
+    return RESULT_ERR_INVALID_ARG;
+  }
+  m_mutex.lock();
+  m_files.swap(files);
+  m_mapped = mapped;
+  m_mappedLength = length;
+  m_mutex.unlock();
+  return RESULT_OK;
+}
+
+bool ConfigSnapshot::readRows(const char* data, size_t length, SnapshotFile* file) {
+  SnapshotReader reader(data, length);
+  uint32_t rowCount;
+  if (!reader.read(&rowCount) || !reader.canHold(rowCount, 2*sizeof(uint32_t))) {
+    return false;
+  }
+  file->m_lineNos.resize(rowCount);
+  file->m_rows.resize(rowCount);
+  for (uint32_t rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+    uint32_t fieldCount;
+    if (!reader.read(&file->m_lineNos[rowIndex]) || !reader.read(&fieldCount)
+        || !reader.canHold(fieldCount, sizeof(uint32_t))) {
+      return false;
+    }
+    vector<string>& row = file->m_rows[rowIndex];
+    row.resize(fieldCount);
+    for (auto& field : row) {
+      if (!reader.read(&field)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void ConfigSnapshot::writeRows(const SnapshotFile& file, string* output) {
+  ostringstream stream;
+  writeSnapshotValue(static_cast<uint32_t>(file.m_rows.size()), &stream);
+  for (size_t rowIndex = 0; rowIndex < file.m_rows.size(); rowIndex++) {
+    const vector<string>& row = file.m_rows[rowIndex];
+    writeSnapshotValue(static_cast<uint32_t>(file.m_lineNos[rowIndex]), &stream);
+    writeSnapshotValue(static_cast<uint32_t>(row.size()), &stream);
+    for (const auto& field : row) {
+      writeSnapshotString(field, &stream);
+    }
+  }
+  *output += stream.str();
+}
+
+bool ConfigSnapshot::get(const string& name, time_t mtime, size_t fileSize, SnapshotFile* file) {
+  m_mutex.lock();
+  auto it = m_files.find(name);
+  bool found = mtime != 0 && it != m_files.end() && it->second.m_file.m_mtime == mtime
+    && it->second.m_file.m_fileSize == fileSize;
+  if (found) {
+    SnapshotEntry& entry = it->second;
+    *file = entry.m_file;
+    if (entry.m_rowData) {
+      found = readRows(entry.m_rowData, entry.m_rowDataLength, file);
+    }
+    if (found) {
+      time(&entry.m_lastUsed);
+    } else {
+      m_files.erase(it);  // invalid rows
+      m_dirty = true;
+    }
+  }
+  m_mutex.unlock();
+  return found;
+}
+
+void ConfigSnapshot::set(const string& name, const SnapshotFile& file) {
+  m_mutex.lock();
+  SnapshotEntry& entry = m_files[name];
+  entry.m_file = file;
+  entry.m_rowData = nullptr;
+  entry.m_rowDataLength = 0;
+  time(&entry.m_lastUsed);
+  m_dirty = true;
+  m_mutex.unlock();
+}
+
+result_t ConfigSnapshot::write() {
+  m_mutex.lock();
+  if (m_filename.empty()) {
+    m_mutex.unlock();
+    return RESULT_OK;
+  }
+  time_t now;
+  time(&now);
+  for (auto it = m_files.begin(); it != m_files.end(); ) {
+    struct stat st;
+    if (difftime(now, it->second.m_lastUsed) > SNAPSHOT_MAX_AGE
+        || (it->first.find("://") == string::npos && stat(it->first.c_str(), &st) != 0)) {
+      it = m_files.erase(it);  // unused for too long or no longer existing local file
+      m_dirty = true;
+    } else {
+      ++it;
+    }
+  }
+  if (!m_dirty) {
+    m_mutex.unlock();
+    return RESULT_OK;
+  }
+  string tmpName = m_filename + ".tmp";
+  ofstream stream(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!stream.is_open()) {
+    m_mutex.unlock();
+    return RESULT_ERR_DEVICE;
+  }
+  stream.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  writeSnapshotValue(static_cast<uint32_t>(SNAPSHOT_VERSION), &stream);
+  writeSnapshotValue(static_cast<uint32_t>(m_files.size()), &stream);
+  string rows;
+  for (const auto& it : m_files) {
+    const SnapshotEntry& entry = it.second;
+    const SnapshotFile& file = entry.m_file;
+    writeSnapshotString(it.first, &stream);
+    writeSnapshotValue(static_cast<uint64_t>(file.m_mtime), &stream);
+    writeSnapshotValue(static_cast<uint64_t>(file.m_fileSize), &stream);
+    writeSnapshotValue(static_cast<uint64_t>(file.m_hash), &stream);
+    writeSnapshotValue(static_cast<uint64_t>(file.m_size), &stream);
+    writeSnapshotValue(static_cast<uint64_t>(entry.m_lastUsed), &stream);
+    if (entry.m_rowData) {
+      // unchanged since being mapped (the mapping stays valid when renaming the new file over it)
+      writeSnapshotValue(static_cast<uint64_t>(entry.m_rowDataLength), &stream);
+      stream.write(entry.m_rowData, static_cast<std::streamsize>(entry.m_rowDataLength));
+    } else {
+      rows.clear();
+      writeRows(file, &rows);
+      writeSnapshotValue(static_cast<uint64_t>(rows.length()), &stream);
+      stream.write(rows.data(), static_cast<std::streamsize>(rows.length()));
+    }
+  }
+  stream.close();
+  bool success = !stream.fail() && rename(tmpName.c_str(), m_filename.c_str()) == 0;
+  if (success) {
+    m_dirty = false;
+  } else {
+    unlink(tmpName.c_str());
+  }
+  m_mutex.unlock();
+  return success ? RESULT_OK : RESULT_ERR_DEVICE;
+}
+
 }  // namespace ebusd
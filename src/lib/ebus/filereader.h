@@ -20,9 +20,11 @@
 #define LIB_EBUS_FILEREADER_H_
 
 #include <algorithm>
+#include <ctime>
 #include <map>
 #include <string>
 #include <vector>
+#include <cstring>
 #include <iomanip>
 #include "lib/ebus/symbol.h"
 #include "lib/ebus/result.h"
@@ -38,6 +40,10 @@ namespace ebusd {
  * It also supports special treatment of comment lines starting with a "#", as
  * well as so called "default values" indicated by the first field starting
  * with a "*" symbol.
+ *
+ * The @a ConfigSnapshot keeps the split rows of read files in a binary file,
+ * so that files with unchanged modification time and size can be replayed
+ * without reading and splitting them again.
  */
 
 using std::string;
@@ -60,6 +66,247 @@ using std::istream;
 /** special marker string for skipping columns in @a MappedFileReader. */
 static const char SKIP_COLUMN[] = "\b";
 
+/**
+ * Helper class for reading from a memory mapped binary file (e.g. a @a ConfigSnapshot).
+ */
+class SnapshotReader {
+ public:
+  /**
+   * Constructor.
+   * @param data the mapped data.
+   * @param length the length of the mapped data.
+   */
+  SnapshotReader(const char* data, size_t length) : m_data(data), m_remain(length) {}
+
+  /**
+   * Read a fixed size value.
+   * @param value the variable in which to store the value.
+   * @return true on success, false if not enough data is left.
+   */
+  template <typename T>
+  bool read(T* value) {
+    if (m_remain < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, m_data, sizeof(T));
+    m_data += sizeof(T);
+    m_remain -= sizeof(T);
+    return true;
+  }
+
+  /**
+   * Read a length prefixed string.
+   * @param value the variable in which to store the string.
+   * @return true on success, false if not enough data is left.
+   */
+  bool read(string* value) {
+    uint32_t length;
+    if (!read(&length) || m_remain < length) {
+      return false;
+    }
+    value->assign(m_data, length);
+    m_data += length;
+    m_remain -= length;
+    return true;
+  }
+
+  /**
+   * Check whether the specified number of items of the minimum size might still be available.
+   * @param count the number of items.
+   * @param itemSize the minimum size of each item.
+   * @return true if the remaining data is large enough.
+   */
+  bool canHold(uint32_t count, size_t itemSize) const {
+    return count <= m_remain / itemSize;
+  }
+
+  /**
+   * Skip the specified number of bytes.
+   * @param length the number of bytes to skip.
+   * @return true on success, false if not enough data is left.
+   */
+  bool skip(size_t length) {
+    if (m_remain < length) {
+      return false;
+    }
+    m_data += length;
+    m_remain -= length;
+    return true;
+  }
+
+  /**
+   * Get the remaining mapped data.
+   * @return the remaining mapped data.
+   */
+  const char* getData() const { return m_data; }
+
+
+ private:
+  /** the remaining mapped data. */
+  const char* m_data;
+
+  /** the remaining length of the mapped data. */
+  size_t m_remain;
+};
+
+/**
+ * Write a fixed size value to the @a ostream.
+ * @param value the value to write.
+ * @param stream the @a ostream to write to.
+ */
+template <typename T>
+inline void writeSnapshotValue(T value, ostream* stream) {
+  stream->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/**
+ * Write a length prefixed string to the @a ostream.
+ * @param value the string to write.
+ * @param stream the @a ostream to write to.
+ */
+inline void writeSnapshotString(const string& value, ostream* stream) {
+  writeSnapshotValue(static_cast<uint32_t>(value.length()), stream);
+  stream->write(value.data(), value.length());
+}
+
+
+/**
+ * The split rows of a single file as stored in a @a ConfigSnapshot.
+ */
+struct SnapshotFile {
+  /** the modification time of the file, or 0 if unknown. */
+  time_t m_mtime;
+
+  /** the size of the file in bytes. */
+  size_t m_fileSize;
+
+  /** the hash of the file. */
+  size_t m_hash;
+
+  /** the normalized size of the file. */
+  size_t m_size;
+
+  /** the line number of each row. */
+  vector<unsigned int> m_lineNos;
+
+  /** the split rows. */
+  vector< vector<string> > m_rows;
+};
+
+
+/** the time in seconds after which an unused entry of a @a ConfigSnapshot is dropped (30 days). */
+#define SNAPSHOT_MAX_AGE (30*24*60*60)
+
+/**
+ * A versioned binary snapshot of the split rows of read files (in host byte order).
+ * The snapshot file stays mapped while in use and the rows of a file are only deserialized when requested.
+ */
+class ConfigSnapshot {
+ public:
+  /**
+   * Constructor.
+   */
+  ConfigSnapshot() : m_mapped(nullptr), m_mappedLength(0), m_dirty(false) {}
+
+  /**
+   * Destructor.
+   */
+  ~ConfigSnapshot();
+
+  /**
+   * Set the name of the snapshot file and map it if available.
+   * @param filename the name of the snapshot file, or empty to disable.
+   * @return @a RESULT_OK on success, or an error code if the file is not available or invalid.
+   */
+  result_t open(const string& filename);
+
+  /**
+   * Return whether the snapshot is enabled.
+   * @return whether the snapshot is enabled.
+   */
+  bool isEnabled() const { return !m_filename.empty(); }
+
+  /**
+   * Get the stored rows of a file.
+   * @param name the name of the file.
+   * @param mtime the current modification time of the file (never matching when 0).
+   * @param fileSize the current size of the file in bytes.
+   * @param file the @a SnapshotFile to fill with the stored rows.
+   * @return true when the file was found with matching modification time and size.
+   */
+  bool get(const string& name, time_t mtime, size_t fileSize, SnapshotFile* file);
+
+  /**
+   * Store the rows of a file.
+   * @param name the name of the file.
+   * @param file the @a SnapshotFile with the rows to store.
+   */
+  void set(const string& name, const SnapshotFile& file);
+
+  /**
+   * Write the snapshot file if it was changed since being loaded, dropping the entries of no longer existing local
+   * files and those unused for @a SNAPSHOT_MAX_AGE.
+   * @return @a RESULT_OK on success or if unchanged, or an error code.
+   */
+  result_t write();
+
+  /**
+   * Get the number of stored files.
+   * @return the number of stored files.
+   */
+  size_t size() const { return m_files.size(); }
+
+
+ private:
+  /** A single file kept in the snapshot. */
+  struct SnapshotEntry {
+    SnapshotFile m_file;  //!< the @a SnapshotFile (without the rows while @a m_rowData is set)
+    const char* m_rowData;  //!< the serialized rows within the mapped snapshot file, or nullptr
+    size_t m_rowDataLength;  //!< the length of @a m_rowData
+    time_t m_lastUsed;  //!< the system time when the entry was last used
+  };
+
+  /**
+   * Deserialize the rows of a file.
+   * @param data the serialized rows.
+   * @param length the length of the serialized rows.
+   * @param file the @a SnapshotFile to fill with the rows.
+   * @return true on success, false if the data is invalid.
+   */
+  static bool readRows(const char* data, size_t length, SnapshotFile* file);
+
+  /**
+   * Serialize the rows of a file.
+   * @param file the @a SnapshotFile with the rows.
+   * @param output the string to append the serialized rows to.
+   */
+  static void writeRows(const SnapshotFile& file, string* output);
+
+  /**
+   * Unmap the snapshot file if mapped.
+   */
+  void unmap();
+
+  /** the name of the snapshot file, or empty if disabled. */
+  string m_filename;
+
+  /** the @a SnapshotEntry instances by file name. */
+  map<string, SnapshotEntry> m_files;
+
+  /** the mapped snapshot file, or nullptr. */
+  void* m_mapped;
+
+  /** the length of @a m_mapped. */
+  size_t m_mappedLength;
+
+  /** whether the snapshot was changed since being loaded. */
+  bool m_dirty;
+
+  /** the @a Mutex for exclusive access. */
+  Mutex m_mutex;
+};
+
+
 /**
  * An abstract class that support reading definitions from a file.
  */
@@ -68,7 +315,7 @@ class FileReader {
   /**
    * Constructor.
    */
-  FileReader() {}
+  FileReader() : m_snapshotFile(nullptr), m_snapshotReplay(false), m_recordFile(nullptr) {}
 
   /**
    * Destructor.
@@ -117,6 +364,17 @@ class FileReader {
   virtual result_t readLineFromStream(istream* stream, const string& filename, bool verbose,
       unsigned int* lineNo, vector<string>* row, string* errorDescription, bool replace, size_t* hash, size_t* size);
 
+  /**
+   * Set the @a SnapshotFile for the next call to @a readFromStream().
+   * @param file the @a SnapshotFile to record the split rows to, or to replay instead of reading the stream.
+   * @param replay true to replay the rows of the @a SnapshotFile (the stream passed to @a readFromStream() may then be
+   * nullptr), false to record them.
+   */
+  void setSnapshotFile(SnapshotFile* file, bool replay) {
+    m_snapshotFile = file;
+    m_snapshotReplay = replay;
+  }
+
   /**
    * Add a definition that was read from a file.
    * @param filename the name of the file being read.
@@ -153,6 +411,28 @@ class FileReader {
   static bool splitFields(istream* stream, vector<string>* row, unsigned int* lineNo,
       size_t* hash = nullptr, size_t* size = nullptr);
 
+  /**
+   * Split the next line(s) from a buffer into fields the same way as from an @a istream.
+   * The separators and quotes are located with a vectorized scan where available, and each field is assigned to
+   * the existing strings of the row in order to reuse their capacity.
+   * @param pos pointer to the position in the buffer to read from (updated to the start of the next line).
+   * @param end the end of the buffer.
+   * @param row the @a vector to which to add the fields. This will be empty for completely empty and comment lines.
+   * @param lineNo the current line number (incremented with each line read).
+   * @param hash optional pointer to a @a size_t value for combining the hash of the line with, or nullptr.
+   * @param size optional pointer to a @a size_t value to add the trimmed line length to, or nullptr.
+   * @return true if there are more lines to read, false when there are no more lines left.
+   */
+  static bool splitFields(const char** pos, const char* end, vector<string>* row, unsigned int* lineNo,
+      size_t* hash = nullptr, size_t* size = nullptr);
+
+  /**
+   * Read the remainder of a stream into a buffer with a few bulk reads.
+   * @param stream the @a istream to read from.
+   * @param buffer the @a string to store the read data in.
+   */
+  static void readBuffer(istream* stream, string* buffer);
+
   /**
    * Format the specified hash as 8 hex digits to the output stream.
    * @param hash the hash code.
@@ -173,6 +453,42 @@ class FileReader {
    */
   static result_t formatError(const string& filename, unsigned int lineNo, result_t result,
       const string& error, string* errorDescription);
+
+  /**
+   * Complete the error description of a read line.
+   * @param filename the name of the file being read.
+   * @param verbose whether to verbosely log problems.
+   * @param lineNo the line number in the file.
+   * @param result the result code of adding the line.
+   * @param errorDescription a string in which to store the error description in case of error.
+   * @return the result code.
+   */
+  static result_t finishLine(const string& filename, bool verbose, unsigned int lineNo, result_t result,
+      string* errorDescription);
+
+
+ private:
+  /**
+   * Record and add a definition row split from a line.
+   * @param filename the name of the file being read.
+   * @param verbose whether to verbosely log problems.
+   * @param lineNo the line number in the file.
+   * @param row the definition row.
+   * @param errorDescription a string in which to store the error description in case of error.
+   * @param replace whether to replace an already existing entry.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t addSplitLine(const string& filename, bool verbose, unsigned int lineNo, vector<string>* row,
+      string* errorDescription, bool replace);
+
+  /** the @a SnapshotFile for the next call to @a readFromStream(), or nullptr. */
+  SnapshotFile* m_snapshotFile;
+
+  /** whether to replay @a m_snapshotFile instead of recording to it. */
+  bool m_snapshotReplay;
+
+  /** the @a SnapshotFile currently recorded to, or nullptr. */
+  SnapshotFile* m_recordFile;
 };
 
 
@@ -0,0 +1,243 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/ebus/history.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ebusd {
+
+using std::istringstream;
+
+/** the interval in seconds of each downsampling tier of a @a MessageHistory. */
+static const time_t historyIntervals[HISTORY_TIERS] = {5*60, 60*60};
+
+
+MessageHistory::MessageHistory(const string& circuit, const string& name, const string& field, size_t capacity)
+  : m_circuit(circuit), m_name(name), m_field(field) {
+  m_samples.setCapacity(capacity);
+  for (size_t tier = 0; tier < HISTORY_TIERS; tier++) {
+    m_buckets[tier].setCapacity(capacity);
+    m_currentCount[tier] = 0;
+  }
+}
+
+void MessageHistory::add(const Message* message) {
+  float value;
+  result_t result = message->decodeLastDataNumField(m_field.empty() ? nullptr : m_field.c_str(), -1, &value);
+  if (result != RESULT_OK) {
+    return;  // no numeric value (e.g. replacement value or non-numeric field)
+  }
+  add(message->getLastUpdateTime(), value);
+}
+
+void MessageHistory::add(time_t time, float value) {
+  m_mutex.lock();
+  HistorySample sample = {static_cast<uint32_t>(time), value};
+  if (m_samples.size() > 0 && m_samples.at(m_samples.size()-1).m_time == sample.m_time) {
+    m_samples.replaceLast(sample);  // keep at most one plain value per second
+  } else {
+    m_samples.push(sample);
+  }
+  for (size_t tier = 0; tier < HISTORY_TIERS; tier++) {
+    uint32_t start = static_cast<uint32_t>(time - time % historyIntervals[tier]);
+    HistoryBucket& current = m_current[tier];
+    if (m_currentCount[tier] > 0 && current.m_time != start) {
+      HistoryBucket completed = current;
+      completed.m_avg = current.m_avg / static_cast<float>(m_currentCount[tier]);
+      m_buckets[tier].push(completed);
+      m_currentCount[tier] = 0;
+    }
+    if (m_currentCount[tier] == 0) {
+      current = {start, value, value, value};
+    } else {
+      if (value < current.m_min) {
+        current.m_min = value;
+      }
+      if (value > current.m_max) {
+        current.m_max = value;
+      }
+      current.m_avg += value;
+    }
+    m_currentCount[tier]++;
+  }
+  m_mutex.unlock();
+}
+
+void MessageHistory::formatJson(time_t since, ostream* output) const {
+  vector<HistorySample> samples;
+  vector<HistoryBucket> buckets;
+  size_t tier = 0;
+  m_mutex.lock();
+  if (since > 0 && m_samples.size() == m_samples.getCapacity() && m_samples.at(0).m_time > since) {
+    // the plain values do not reach back far enough anymore: take the finest tier still covering the start
+    for (tier = 1; tier < HISTORY_TIERS; tier++) {
+      const HistoryRing<HistoryBucket>& tierBuckets = m_buckets[tier-1];
+      if (tierBuckets.size() < tierBuckets.getCapacity() || tierBuckets.at(0).m_time <= since) {
+        break;
+      }
+    }
+  }
+  if (tier == 0) {
+    samples.reserve(m_samples.size());
+    for (size_t index = 0; index < m_samples.size(); index++) {
+      const HistorySample& sample = m_samples.at(index);
+      if (sample.m_time >= since) {
+        samples.push_back(sample);
+      }
+    }
+  } else {
+    const HistoryRing<HistoryBucket>& tierBuckets = m_buckets[tier-1];
+    time_t interval = historyIntervals[tier-1];
+    buckets.reserve(tierBuckets.size()+1);
+    for (size_t index = 0; index < tierBuckets.size(); index++) {
+      const HistoryBucket& bucket = tierBuckets.at(index);
+      if (bucket.m_time + interval > since) {
+        buckets.push_back(bucket);
+      }
+    }
+    if (m_currentCount[tier-1] > 0 && m_current[tier-1].m_time + interval > since) {
+      HistoryBucket bucket = m_current[tier-1];
+      bucket.m_avg /= static_cast<float>(m_currentCount[tier-1]);
+      buckets.push_back(bucket);
+    }
+  }
+  m_mutex.unlock();
+  // format outside of the lock in order to not delay the bus thread adding new values
+  *output << "{\"interval\": " << (tier == 0 ? 0 : historyIntervals[tier-1]) << ", \"values\": [";
+  bool first = true;
+  for (const auto& sample : samples) {
+    *output << (first ? "" : ", ") << "[" << sample.m_time << ", " << sample.m_value << "]";
+    first = false;
+  }
+  for (const auto& bucket : buckets) {
+    *output << (first ? "" : ", ") << "[" << bucket.m_time << ", " << bucket.m_min << ", " << bucket.m_max << ", "
+            << bucket.m_avg << "]";
+    first = false;
+  }
+  *output << "]}";
+}
+
+size_t MessageHistory::size() const {
+  m_mutex.lock();
+  size_t ret = m_samples.size();
+  m_mutex.unlock();
+  return ret;
+}
+
+void MessageHistory::addMemoryUsage(MemoryUsage* usage) const {
+  size_t bytes = sizeof(MessageHistory) + MemoryUsage::getHeapSize(m_circuit) + MemoryUsage::getHeapSize(m_name)
+      + MemoryUsage::getHeapSize(m_field) + m_samples.getCapacity()*sizeof(HistorySample);
+  for (size_t tier = 0; tier < HISTORY_TIERS; tier++) {
+    bytes += m_buckets[tier].getCapacity()*sizeof(HistoryBucket);
+  }
+  usage->add(mk_history, bytes);
+}
+
+
+HistoryStore::~HistoryStore() {
+  for (const auto& it : m_histories) {
+    for (const auto history : it.second) {
+      delete history;
+    }
+  }
+  m_histories.clear();
+}
+
+result_t HistoryStore::configure(const string& selection, size_t budget) {
+  vector<vector<string>> fields;
+  istringstream stream(selection);
+  string item;
+  while (getline(stream, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    vector<string> parts;
+    istringstream itemStream(item);
+    string part;
+    while (getline(itemStream, part, '/')) {
+      parts.push_back(part);
+    }
+    if (parts.size() < 2 || parts.size() > 3 || parts[0].empty() || parts[1].empty()) {
+      return RESULT_ERR_INVALID_ARG;
+    }
+    if (parts.size() < 3) {
+      parts.push_back("");
+    }
+    fields.push_back(parts);
+  }
+  if (fields.empty()) {
+    return RESULT_ERR_INVALID_ARG;
+  }
+  size_t capacity = budget / fields.size() / (sizeof(HistorySample) + HISTORY_TIERS*sizeof(HistoryBucket));
+  if (capacity == 0) {
+    return RESULT_ERR_INVALID_NUM;
+  }
+  for (const auto& parts : fields) {
+    string key = parts[0] + "/" + parts[1];
+    FileReader::tolower(&key);
+    m_histories[key].push_back(new MessageHistory(parts[0], parts[1], parts[2], capacity));
+  }
+  return RESULT_OK;
+}
+
+size_t HistoryStore::size() const {
+  size_t count = 0;
+  for (const auto& it : m_histories) {
+    count += it.second.size();
+  }
+  return count;
+}
+
+const vector<MessageHistory*>* HistoryStore::find(const string& circuit, const string& name) const {
+  string key = circuit + "/" + name;
+  FileReader::tolower(&key);
+  const auto it = m_histories.find(key);
+  return it == m_histories.end() ? nullptr : &it->second;
+}
+
+void HistoryStore::findAll(const string& circuit, const string& name, vector<const MessageHistory*>* histories)
+    const {
+  string lcircuit = circuit;
+  FileReader::tolower(&lcircuit);
+  string lname = name;
+  FileReader::tolower(&lname);
+  for (const auto& it : m_histories) {
+    size_t pos = it.first.find('/');
+    if ((!lcircuit.empty() && it.first.substr(0, pos) != lcircuit)
+        || (!lname.empty() && it.first.substr(pos + 1) != lname)) {
+      continue;
+    }
+    histories->insert(histories->end(), it.second.begin(), it.second.end());
+  }
+}
+
+void HistoryStore::addMemoryUsage(MemoryUsage* usage) const {
+  for (const auto& it : m_histories) {
+    for (const auto history : it.second) {
+      history->addMemoryUsage(usage);
+    }
+  }
+}
+
+}  // namespace ebusd
@@ -0,0 +1,313 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_HISTORY_H_
+#define LIB_EBUS_HISTORY_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include "lib/ebus/message.h"
+#include "lib/ebus/result.h"
+#include "lib/utils/thread.h"
+#include "lib/utils/metrics.h"
+
+namespace ebusd {
+
+/** @file lib/ebus/history.h
+ * Classes for keeping the recent values of selected message fields in memory.
+ *
+ * A @a MessageHistory keeps the numeric values of a single field of a @a Message
+ * together with their time in a ring of fixed size, and additionally downsamples
+ * them into tiers with the minimum, maximum, and average value per interval, so
+ * that older values are still available at a coarser resolution.
+ * The @a HistoryStore owns the instances for the selected fields and divides its
+ * memory budget among them. The values are recorded whenever the @a Message
+ * stores new data.
+ */
+
+using std::string;
+using std::map;
+using std::vector;
+
+/** the number of downsampling tiers of a @a MessageHistory. */
+#define HISTORY_TIERS 2
+
+/** the default memory budget of a @a HistoryStore in bytes. */
+#define HISTORY_BUDGET (1024*1024)
+
+
+/** A single value kept by a @a MessageHistory. */
+struct HistorySample {
+  uint32_t m_time;  //!< the system time of the value
+  float m_value;  //!< the value
+};
+
+
+/** The values of a single interval of a downsampling tier of a @a MessageHistory. */
+struct HistoryBucket {
+  uint32_t m_time;  //!< the system time of the start of the interval
+  float m_min;  //!< the minimum value in the interval
+  float m_max;  //!< the maximum value in the interval
+  float m_avg;  //!< the average value in the interval
+};
+
+
+/**
+ * A ring of fixed size overwriting the oldest entry when full.
+ */
+template <typename T>
+class HistoryRing {
+ public:
+  /**
+   * Constructor.
+   */
+  HistoryRing() : m_next(0), m_count(0) {}
+
+  /**
+   * Set the capacity and remove all entries.
+   * @param capacity the maximum number of entries to keep.
+   */
+  void setCapacity(size_t capacity) {
+    m_entries.assign(capacity, T());
+    m_next = m_count = 0;
+  }
+
+  /**
+   * Get the maximum number of entries to keep.
+   * @return the maximum number of entries to keep.
+   */
+  size_t getCapacity() const { return m_entries.size(); }
+
+  /**
+   * Get the number of entries.
+   * @return the number of entries.
+   */
+  size_t size() const { return m_count; }
+
+  /**
+   * Add an entry and overwrite the oldest one when full.
+   * @param entry the entry to add.
+   */
+  void push(const T& entry) {
+    if (m_entries.empty()) {
+      return;
+    }
+    m_entries[m_next] = entry;
+    m_next = (m_next + 1) % m_entries.size();
+    if (m_count < m_entries.size()) {
+      m_count++;
+    }
+  }
+
+  /**
+   * Replace the newest entry.
+   * @param entry the entry to replace the newest one with (has to be non-empty).
+   */
+  void replaceLast(const T& entry) {
+    m_entries[(m_next + m_entries.size() - 1) % m_entries.size()] = entry;
+  }
+
+  /**
+   * Get an entry.
+   * @param index the index of the entry starting with 0 for the oldest one (has to be less than @a size()).
+   * @return the entry.
+   */
+  const T& at(size_t index) const {
+    return m_entries[(m_next + m_entries.size() - m_count + index) % m_entries.size()];
+  }
+
+
+ private:
+  /** the entries. */
+  vector<T> m_entries;
+
+  /** the index of the next entry to write. */
+  size_t m_next;
+
+  /** the number of entries. */
+  size_t m_count;
+};
+
+
+/**
+ * The recent values of a single numeric field of a @a Message.
+ */
+class MessageHistory {
+ public:
+  /**
+   * Constructor.
+   * @param circuit the circuit name of the @a Message.
+   * @param name the name of the @a Message.
+   * @param field the name of the field, or empty for the first field.
+   * @param capacity the maximum number of entries in each tier.
+   */
+  MessageHistory(const string& circuit, const string& name, const string& field, size_t capacity);
+
+  /**
+   * Get the circuit name of the @a Message.
+   * @return the circuit name of the @a Message.
+   */
+  const string& getCircuit() const { return m_circuit; }
+
+  /**
+   * Get the name of the @a Message.
+   * @return the name of the @a Message.
+   */
+  const string& getName() const { return m_name; }
+
+  /**
+   * Get the name of the field.
+   * @return the name of the field, or empty for the first field.
+   */
+  const string& getField() const { return m_field; }
+
+  /**
+   * Add the current value of the field from the last stored data of the @a Message.
+   * @param message the @a Message that stored new data.
+   */
+  void add(const Message* message);
+
+  /**
+   * Add a value (replacing the last plain value of the same second, while all values are downsampled).
+   * @param time the system time of the value (not before the last one).
+   * @param value the value.
+   */
+  void add(time_t time, float value);
+
+  /**
+   * Format the values from the finest tier still covering the start time as JSON object.
+   * @param since the system time of the first value to include, or 0 for all plain values.
+   * @param output the @a ostream to append the formatted values to.
+   */
+  void formatJson(time_t since, ostream* output) const;
+
+  /**
+   * Get the number of plain values kept.
+   * @return the number of plain values kept.
+   */
+  size_t size() const;
+
+  /**
+   * Add the approximate memory used by this instance to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const;
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  MessageHistory(const MessageHistory& src);
+
+  /** the circuit name of the @a Message. */
+  const string m_circuit;
+
+  /** the name of the @a Message. */
+  const string m_name;
+
+  /** the name of the field, or empty for the first field. */
+  const string m_field;
+
+  /** the plain values. */
+  HistoryRing<HistorySample> m_samples;
+
+  /** the completed intervals of each downsampling tier. */
+  HistoryRing<HistoryBucket> m_buckets[HISTORY_TIERS];
+
+  /** the incomplete current interval of each downsampling tier (with the sum instead of the average). */
+  HistoryBucket m_current[HISTORY_TIERS];
+
+  /** the number of values in the current interval of each downsampling tier. */
+  unsigned int m_currentCount[HISTORY_TIERS];
+
+  /** the @a Mutex for exclusive access. */
+  mutable Mutex m_mutex;
+};
+
+
+/**
+ * The @a MessageHistory instances of the selected fields sharing a memory budget.
+ */
+class HistoryStore {
+ public:
+  /**
+   * Constructor.
+   */
+  HistoryStore() {}
+
+  /**
+   * Destructor.
+   */
+  ~HistoryStore();
+
+  /**
+   * Select the fields to keep the history of.
+   * @param selection the comma separated list of fields as "CIRCUIT/NAME[/FIELD]".
+   * @param budget the memory budget in bytes to divide among all fields.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t configure(const string& selection, size_t budget);
+
+  /**
+   * Return whether any field is selected.
+   * @return whether any field is selected.
+   */
+  bool isEnabled() const { return !m_histories.empty(); }
+
+  /**
+   * Get the number of selected fields.
+   * @return the number of selected fields.
+   */
+  size_t size() const;
+
+  /**
+   * Find the @a MessageHistory instances of a @a Message.
+   * @param circuit the circuit name of the @a Message.
+   * @param name the name of the @a Message.
+   * @return the @a MessageHistory instances (remaining in possession of this instance), or nullptr.
+   */
+  const vector<MessageHistory*>* find(const string& circuit, const string& name) const;
+
+  /**
+   * Find all @a MessageHistory instances for the circuit and name.
+   * @param circuit the circuit name, or empty for any.
+   * @param name the message name, or empty for any.
+   * @param histories the vector to which to add the found @a MessageHistory instances.
+   */
+  void findAll(const string& circuit, const string& name, vector<const MessageHistory*>* histories) const;
+
+  /**
+   * Add the approximate memory used by this instance to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const;
+
+
+ private:
+  /** the @a MessageHistory instances by lower case "CIRCUIT/NAME". */
+  map<string, vector<MessageHistory*>> m_histories;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_HISTORY_H_
@@ -23,9 +23,14 @@
 #include <locale>
 #include <iomanip>
 #include <climits>
+#include <set>
+#include <algorithm>
+#include <iostream>
 #include "lib/ebus/data.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/symbol.h"
+#include "lib/ebus/statefile.h"
+#include "lib/ebus/history.h"
 
 namespace ebusd {
 
@@ -35,6 +40,11 @@ using std::nouppercase;
 using std::setfill;
 using std::setw;
 using std::endl;
+using std::cout;
+using std::set;
+using std::make_heap;
+using std::push_heap;
+using std::pop_heap;
 
 /** the maximum length of the command ID bytes (in addition to PB/SB) for which the key is distinct. */
 #define MAX_ID_KEYLEN 4
@@ -79,15 +89,20 @@ static const char* defaultMessageFieldMap[] = {  // access level not included in
     "*name", "part", "type", "divisor/values", "unit", "comment",
 };
 
-/** the m_pollOrder of the last polled message. */
-static unsigned int g_lastPollOrder = 0;
-
 extern DataFieldTemplates* getTemplates(const string& filename);
 
 extern result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
     map<string, string>* defaults, string* errorDescription, bool replace = false);
 
 
+Mutex Message::s_decodeCacheMutex;
+
+atomic<size_t> Message::s_lastDataRetries(0);
+
+SharedCounter Message::s_decodeCalls;
+
+SharedCounter Message::s_decodeNanos;
+
 Message::Message(const string& circuit, const string& level, const string& name,
     bool isWrite, bool isPassive, const map<string, string>& attributes,
     symbol_t srcAddress, symbol_t dstAddress,
@@ -95,14 +110,15 @@ Message::Message(const string& circuit, const string& level, const string& name,
     const DataField* data, bool deleteData,
     size_t pollPriority,
     Condition* condition)
-    : AttributedItem(name, attributes), m_circuit(circuit), m_level(level), m_isWrite(isWrite),
-      m_isPassive(isPassive),
+    : AttributedItem(name, attributes), m_circuit(StringPool::intern(circuit)), m_level(StringPool::intern(level)),
+      m_isWrite(isWrite), m_isPassive(isPassive),
       m_srcAddress(srcAddress), m_dstAddress(dstAddress),
       m_id(id), m_key(createKey(id, isWrite, isPassive, srcAddress, dstAddress)),
       m_data(data), m_deleteData(deleteData),
       m_pollPriority(pollPriority),
       m_usedByCondition(false), m_isScanMessage(false), m_condition(condition),
-      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0) {
+      m_lastUpdateTime(0), m_lastChangeTime(0), m_lastPollTime(0), m_updateJournal(nullptr), m_histories(nullptr),
+      m_lastDataSequence(0), m_decodeCacheSequence(0) {
   if (circuit == "scan") {
     setScanMessage();
     m_pollPriority = 0;
@@ -112,14 +128,23 @@ Message::Message(const string& circuit, const string& level, const string& name,
 Message::Message(const string& circuit, const string& level, const string& name,
     symbol_t pb, symbol_t sb,
     bool broadcast, const DataField* data, bool deleteData)
-    : AttributedItem(name), m_circuit(circuit), m_level(level), m_isWrite(broadcast),
-      m_isPassive(false),
+    : AttributedItem(name), m_circuit(StringPool::intern(circuit)), m_level(StringPool::intern(level)),
+      m_isWrite(broadcast), m_isPassive(false),
       m_srcAddress(SYN), m_dstAddress(broadcast ? BROADCAST : SYN),
       m_id({pb, sb}), m_key(createKey(pb, sb, broadcast)),
       m_data(data), m_deleteData(deleteData),
       m_pollPriority(0),
       m_usedByCondition(false), m_isScanMessage(true), m_condition(nullptr),
-      m_lastUpdateTime(0), m_lastChangeTime(0), m_pollOrder(0), m_lastPollTime(0) {
+      m_lastUpdateTime(0), m_lastChangeTime(0), m_lastPollTime(0), m_updateJournal(nullptr), m_histories(nullptr),
+      m_lastDataSequence(0), m_decodeCacheSequence(0) {
+}
+
+Message::~Message() {
+  if (m_deleteData) {
+    DataFieldPool::release(m_data);
+  }
+  StringPool::release(m_circuit);
+  StringPool::release(m_level);
 }
 
 
@@ -454,6 +479,7 @@ result_t Message::create(const string& filename, const DataFieldTemplates* templ
     *errorDescription = "data length";
     return RESULT_ERR_INVALID_POS;
   }
+  data = DataFieldPool::intern(data);
   unsigned int index = 0;
   bool multiple = dstAddresses.size() > 1;
   char num[10];
@@ -506,8 +532,10 @@ bool Message::extractFieldNames(const string& str, bool checkAbbreviated, vector
 }
 
 Message* Message::derive(symbol_t dstAddress, symbol_t srcAddress, const string& circuit) const {
+  map<string, string> attributes;
+  mergeAttributes(&attributes);
   Message* result = new Message(circuit.length() == 0 ? m_circuit : circuit, m_level, m_name,
-    m_isWrite, m_isPassive, m_attributes,
+    m_isWrite, m_isPassive, attributes,
     srcAddress == SYN ? m_srcAddress : srcAddress, dstAddress,
     m_id, m_data, false,
     m_pollPriority, m_condition);
@@ -599,29 +627,9 @@ bool Message::setPollPriority(size_t priority) {
   }
   bool ret = m_pollPriority == 0 && usePriority > 0;
   m_pollPriority = usePriority;
-  if (ret || m_pollOrder > g_lastPollOrder+(unsigned int)m_pollPriority) {
-    // ensure a later increased or newly set priority does not prefer that message before all others
-    m_pollOrder = g_lastPollOrder+(unsigned int)m_pollPriority;
-  }
   return ret;
 }
 
-bool Message::isLessPollWeight(const Message* other) const {
-  if (m_pollOrder > other->m_pollOrder) {
-    return true;
-  }
-  if (m_pollOrder < other->m_pollOrder) {
-    return false;
-  }
-  if (m_pollPriority > other->m_pollPriority) {
-    return true;
-  }
-  if (m_pollPriority < other->m_pollPriority) {
-    return false;
-  }
-  return m_lastPollTime > other->m_lastPollTime;
-}
-
 void Message::setUsedByCondition() {
   if (m_usedByCondition) {
     return;
@@ -632,6 +640,15 @@ void Message::setUsedByCondition() {
   }
 }
 
+void Message::addDependentCondition(Condition* condition) {
+  beginLastDataUpdate();  // the bus thread might walk through the dependent conditions at the same time
+  if (std::find(m_dependentConditions.begin(), m_dependentConditions.end(), condition)
+      == m_dependentConditions.end()) {
+    m_dependentConditions.push_back(condition);
+  }
+  endLastDataUpdate();
+}
+
 bool Message::isAvailable() {
   return (m_condition == nullptr) || m_condition->isTrue();
 }
@@ -696,9 +713,15 @@ result_t Message::prepareSlave(istringstream* input, SlaveSymbolString* slave) {
   }
   slave->adjustHeader();
   time(&m_lastUpdateTime);
-  if (*slave != m_lastSlaveData) {
+  bool changed = *slave != m_lastSlaveData;
+  if (changed) {
     m_lastChangeTime = m_lastUpdateTime;
-    m_lastSlaveData = *slave;
+    beginLastDataUpdate();
+    m_lastSlaveData.assignStable(*slave);
+    endLastDataUpdate();
+  }
+  if (m_updateJournal) {
+    m_updateJournal->add(this, changed);
   }
   return result;
 }
@@ -711,43 +734,115 @@ result_t Message::storeLastData(const MasterSymbolString& master, const SlaveSym
   return result;
 }
 
+string Message::getDefinitionKey() const {
+  ostringstream out;
+  out << m_level << FIELD_SEPARATOR << hex << m_key << dec << FIELD_SEPARATOR;
+  dump(nullptr, true, &out);
+  return out.str();
+}
+
+void Message::saveState(MessageState* state) const {
+  getLastData(&state->m_lastMasterData, &state->m_lastSlaveData);
+  state->m_lastUpdateTime = m_lastUpdateTime;
+  state->m_lastChangeTime = m_lastChangeTime;
+  state->m_lastPollTime = m_lastPollTime;
+}
+
+void Message::restoreState(const MessageState& state) {
+  m_lastUpdateTime = state.m_lastUpdateTime;
+  m_lastChangeTime = state.m_lastChangeTime;
+  m_lastPollTime = state.m_lastPollTime;
+  beginLastDataUpdate();
+  m_lastMasterData.assignStable(state.m_lastMasterData);
+  m_lastSlaveData.assignStable(state.m_lastSlaveData);
+  endLastDataUpdate();
+}
+
+void Message::addMemoryUsage(MemoryUsage* usage) const {
+  usage->add(mk_messages, sizeof(Message) - sizeof(m_lastMasterData) - sizeof(m_lastSlaveData)
+      + getAttributesSize() + m_id.capacity() + m_dependentConditions.capacity()*sizeof(Condition*));
+  if (m_deleteData && m_data && !DataFieldPool::contains(m_data)) {
+    // pooled fields are counted by the pool
+    m_data->addMemoryUsage(mk_fields, usage);
+  }
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  getLastData(&master, &slave);
+  size_t bytes = sizeof(m_lastMasterData) + sizeof(m_lastSlaveData) + master.getHeapSize() + slave.getHeapSize();
+  s_decodeCacheMutex.lock();
+  for (const auto& it : m_decodeCache) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.second.second);
+  }
+  s_decodeCacheMutex.unlock();
+  usage->add(mk_lastData, bytes, 2);
+}
+
 result_t Message::storeLastData(size_t index, const MasterSymbolString& data) {
+  bool updated = false, changed = false;
   if (data.size() > 0 && (m_isWrite || this->m_dstAddress == BROADCAST || isMaster(this->m_dstAddress)
       || data.getDataSize() + 2 > m_id.size())) {
     time(&m_lastUpdateTime);
+    updated = true;
   }
   switch (data.compareTo(m_lastMasterData)) {
   case 1:  // completely different
     m_lastChangeTime = m_lastUpdateTime;
-    m_lastMasterData = data;
-    break;
+    changed = true;
+    // fall through
   case 2:  // only master address is different
-    m_lastMasterData = data;
+    beginLastDataUpdate();
+    m_lastMasterData.assignStable(data);
+    endLastDataUpdate();
     break;
   // else: identical
   }
+  if (m_updateJournal && updated) {
+    m_updateJournal->add(this, changed);
+  }
+  if (m_histories && updated && data.size() > 1 && (data[1] == BROADCAST || isMaster(data[1]))) {
+    // no slave data following
+    for (const auto history : *m_histories) {
+      history->add(this);
+    }
+  }
   return RESULT_OK;
 }
 
 result_t Message::storeLastData(size_t index, const SlaveSymbolString& data) {
-  if (data.size() > 0) {
+  bool updated = data.size() > 0;
+  if (updated) {
     time(&m_lastUpdateTime);
   }
-  if (m_lastSlaveData != data) {
+  bool changed = m_lastSlaveData != data;
+  if (changed) {
     m_lastChangeTime = m_lastUpdateTime;
-    m_lastSlaveData = data;
+    beginLastDataUpdate();
+    m_lastSlaveData.assignStable(data);
+    endLastDataUpdate();
+  }
+  if (m_updateJournal && updated) {
+    m_updateJournal->add(this, changed);
+  }
+  if (m_histories && updated) {
+    for (const auto history : *m_histories) {
+      history->add(this);
+    }
   }
   return RESULT_OK;
 }
 
 result_t Message::decodeLastData(bool master, bool leadingSeparator, const char* fieldName,
     ssize_t fieldIndex, OutputFormat outputFormat, ostream* output) const {
+  MasterSymbolString masterData;
+  SlaveSymbolString slaveData;
+  getLastData(&masterData, &slaveData);
+  ScopeTimer timer(&s_decodeCalls, &s_decodeNanos);
   result_t result;
   if (master) {
-    result = m_data->read(m_lastMasterData, getIdLength(), leadingSeparator, fieldName, fieldIndex,
+    result = m_data->read(masterData, getIdLength(), leadingSeparator, fieldName, fieldIndex,
         outputFormat, -1, output);
   } else {
-    result = m_data->read(m_lastSlaveData, 0, leadingSeparator, fieldName, fieldIndex,
+    result = m_data->read(slaveData, 0, leadingSeparator, fieldName, fieldIndex,
         outputFormat, -1, output);
   }
   if (result < RESULT_OK) {
@@ -759,10 +854,85 @@ result_t Message::decodeLastData(bool master, bool leadingSeparator, const char*
   return result;
 }
 
+void Message::beginLastDataUpdate() {
+  uint32_t sequence = m_lastDataSequence.load(std::memory_order_relaxed);
+  do {
+    while (sequence & 1) {
+      // another writer is active (e.g. main loop preparing and bus thread receiving at the same time)
+      sequence = m_lastDataSequence.load(std::memory_order_relaxed);
+    }
+  } while (!m_lastDataSequence.compare_exchange_weak(sequence, sequence+1, std::memory_order_acquire,
+      std::memory_order_relaxed));
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Message::endLastDataUpdate() {
+  for (const auto condition : m_dependentConditions) {
+    condition->invalidate();
+  }
+  m_lastDataSequence.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t Message::getLastData(MasterSymbolString* master, SlaveSymbolString* slave) const {
+  while (true) {
+    uint32_t sequence = m_lastDataSequence.load(std::memory_order_acquire);
+    if ((sequence & 1) == 0) {
+      master->assignConcurrent(m_lastMasterData);
+      slave->assignConcurrent(m_lastSlaveData);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_lastDataSequence.load(std::memory_order_relaxed) == sequence) {
+        return sequence;
+      }
+    }
+    s_lastDataRetries.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
 result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
     ssize_t fieldIndex, const OutputFormat outputFormat, ostream* output) const {
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  if (fieldName != nullptr || fieldIndex >= 0) {
+    getLastData(&master, &slave);
+    return decodeLastDataUncached(master, slave, leadingSeparator, fieldName, fieldIndex, outputFormat, output);
+  }
+  // the decoded output of all fields only depends on the last data, the format, and the leading separator
+  OutputFormat cacheKey = (outputFormat << 1) | (leadingSeparator ? 1 : 0);
+  uint32_t sequence = m_lastDataSequence.load(std::memory_order_acquire);
+  s_decodeCacheMutex.lock();
+  if (m_decodeCacheSequence != sequence) {
+    m_decodeCache.clear();  // data was modified since the entries were stored
+    m_decodeCacheSequence = sequence;
+  }
+  const auto it = m_decodeCache.find(cacheKey);
+  if (it != m_decodeCache.end()) {
+    result_t result = it->second.first;
+    *output << it->second.second;
+    s_decodeCacheMutex.unlock();
+    return result;
+  }
+  s_decodeCacheMutex.unlock();
+  sequence = getLastData(&master, &slave);
+  ostringstream decoded;
+  result_t result = decodeLastDataUncached(master, slave, leadingSeparator, nullptr, -1, outputFormat, &decoded);
+  const string str = decoded.str();
+  *output << str;
+  if (result >= RESULT_OK) {
+    s_decodeCacheMutex.lock();
+    if (m_decodeCacheSequence == sequence) {  // skip storing when the data was modified in the meantime
+      m_decodeCache[cacheKey] = pair<result_t, string>(result, str);
+    }
+    s_decodeCacheMutex.unlock();
+  }
+  return result;
+}
+
+result_t Message::decodeLastDataUncached(const MasterSymbolString& master, const SlaveSymbolString& slave,
+    bool leadingSeparator, const char* fieldName, ssize_t fieldIndex, const OutputFormat outputFormat,
+    ostream* output) const {
+  ScopeTimer timer(&s_decodeCalls, &s_decodeNanos);
   ostream::pos_type startPos = output->tellp();
-  result_t result = m_data->read(m_lastMasterData, getIdLength(), leadingSeparator, fieldName, fieldIndex,
+  result_t result = m_data->read(master, getIdLength(), leadingSeparator, fieldName, fieldIndex,
       outputFormat, -1, output);
   if (result < RESULT_OK) {
     return result;
@@ -778,7 +948,7 @@ result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
   }
   if (!skipSlaveData) {
     bool useLeadingSeparator = leadingSeparator || output->tellp() > startPos;
-    result = m_data->read(m_lastSlaveData, 0, useLeadingSeparator, fieldName, fieldIndex, outputFormat, -1, output);
+    result = m_data->read(slave, 0, useLeadingSeparator, fieldName, fieldIndex, outputFormat, -1, output);
     if (result < RESULT_OK) {
       return result;
     }
@@ -793,12 +963,35 @@ result_t Message::decodeLastData(bool leadingSeparator, const char* fieldName,
 }
 
 result_t Message::decodeLastDataNumField(const char* fieldName, ssize_t fieldIndex, unsigned int* output) const {
-  result_t result = m_data->read(m_lastMasterData, getIdLength(), fieldName, fieldIndex, output);
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  getLastData(&master, &slave);
+  result_t result = m_data->read(master, getIdLength(), fieldName, fieldIndex, output);
   if (result < RESULT_OK) {
     return result;
   }
   if (result == RESULT_EMPTY) {
-    result = m_data->read(m_lastSlaveData, 0, fieldName, fieldIndex, output);
+    result = m_data->read(slave, 0, fieldName, fieldIndex, output);
+  }
+  if (result < RESULT_OK) {
+    return result;
+  }
+  if (result == RESULT_EMPTY) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  return result;
+}
+
+result_t Message::decodeLastDataNumField(const char* fieldName, ssize_t fieldIndex, float* output) const {
+  MasterSymbolString master;
+  SlaveSymbolString slave;
+  getLastData(&master, &slave);
+  result_t result = m_data->read(master, getIdLength(), fieldName, fieldIndex, output);
+  if (result < RESULT_OK) {
+    return result;
+  }
+  if (result == RESULT_EMPTY) {
+    result = m_data->read(slave, 0, fieldName, fieldIndex, output);
   }
   if (result < RESULT_OK) {
     return result;
@@ -973,8 +1166,11 @@ void Message::decodeJson(bool leadingSeparator, bool appendDirection, bool addRa
     appendAttributes(OF_JSON | outputFormat, output);
     if (hasData) {
       if (addRaw) {
-        addData(m_lastMasterData, output);
-        addData(m_lastSlaveData, output);
+        MasterSymbolString master;
+        SlaveSymbolString slave;
+        getLastData(&master, &slave);
+        addData(master, output);
+        addData(slave, output);
         *output << dec;
       }
       size_t pos = (size_t)output->tellp();
@@ -1037,8 +1233,10 @@ ChainedMessage::~ChainedMessage() {
 }
 
 Message* ChainedMessage::derive(symbol_t dstAddress, symbol_t srcAddress, const string& circuit) const {
+  map<string, string> attributes;
+  mergeAttributes(&attributes);
   ChainedMessage* result = new ChainedMessage(circuit.length() == 0 ? m_circuit : circuit, m_level, m_name,
-    m_isWrite, m_attributes,
+    m_isWrite, attributes,
     srcAddress == SYN ? m_srcAddress : srcAddress, dstAddress,
     m_id, m_ids, m_lengths, m_data, false,
     m_pollPriority, m_condition);
@@ -1147,6 +1345,51 @@ result_t ChainedMessage::prepareMasterPart(size_t index, char separator, istring
   return result;
 }
 
+void ChainedMessage::saveState(MessageState* state) const {
+  Message::saveState(state);
+  state->clearParts();
+  for (size_t index = 0; index < m_ids.size(); index++) {
+    MasterSymbolString* master = new MasterSymbolString();
+    *master = *m_lastMasterDatas[index];
+    state->m_lastMasterDatas.push_back(master);
+    SlaveSymbolString* slave = new SlaveSymbolString();
+    *slave = *m_lastSlaveDatas[index];
+    state->m_lastSlaveDatas.push_back(slave);
+    state->m_lastMasterUpdateTimes.push_back(m_lastMasterUpdateTimes[index]);
+    state->m_lastSlaveUpdateTimes.push_back(m_lastSlaveUpdateTimes[index]);
+  }
+}
+
+void ChainedMessage::restoreState(const MessageState& state) {
+  Message::restoreState(state);
+  if (state.m_lastMasterDatas.size() != m_ids.size()) {
+    return;
+  }
+  for (size_t index = 0; index < m_ids.size(); index++) {
+    *m_lastMasterDatas[index] = *state.m_lastMasterDatas[index];
+    *m_lastSlaveDatas[index] = *state.m_lastSlaveDatas[index];
+    m_lastMasterUpdateTimes[index] = state.m_lastMasterUpdateTimes[index];
+    m_lastSlaveUpdateTimes[index] = state.m_lastSlaveUpdateTimes[index];
+  }
+}
+
+void ChainedMessage::addMemoryUsage(MemoryUsage* usage) const {
+  Message::addMemoryUsage(usage);
+  size_t bytes = sizeof(ChainedMessage) - sizeof(Message) + m_ids.capacity()*sizeof(vector<symbol_t>)
+      + m_lengths.capacity()*sizeof(size_t);
+  for (const auto& id : m_ids) {
+    bytes += id.capacity();
+  }
+  usage->add(mk_messages, bytes, 0);
+  size_t cnt = m_ids.size();
+  bytes = cnt*(sizeof(MasterSymbolString*) + sizeof(SlaveSymbolString*) + 2*sizeof(time_t)
+      + sizeof(MasterSymbolString) + sizeof(SlaveSymbolString));
+  for (size_t index = 0; index < cnt; index++) {
+    bytes += m_lastMasterDatas[index]->getHeapSize() + m_lastSlaveDatas[index]->getHeapSize();
+  }
+  usage->add(mk_lastData, bytes, 2*cnt);
+}
+
 result_t ChainedMessage::storeLastData(const MasterSymbolString& master, const SlaveSymbolString& slave) {
   // determine index from master ID
   size_t index = 0;
@@ -1378,6 +1621,79 @@ result_t splitValues(const string& valueList, vector<unsigned int>* valueRanges)
   return RESULT_OK;
 }
 
+void PollScheduler::add(Message* message, bool toFront, time_t now) {
+  remove(message);
+  if (toFront) {
+    push(message, 0);
+    return;
+  }
+  // spread messages of the same slave by one poll interval each
+  symbol_t dstAddress = message->getDstAddress();
+  time_t slot = 0;
+  for (const auto& entry : m_entries) {
+    if (entry.m_message->getDstAddress() == dstAddress) {
+      slot++;
+    }
+  }
+  push(message, now+slot*m_pollInterval);
+}
+
+void PollScheduler::remove(const Message* message) {
+  for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+    if (it->m_message == message) {
+      m_entries.erase(it);
+      make_heap(m_entries.begin(), m_entries.end(), isLater);
+      break;
+    }
+  }
+}
+
+time_t PollScheduler::getTargetInterval(const Message* message) const {
+  size_t priority = message->getPollPriority();
+  if (priority == 0) {
+    return 0;
+  }
+  double weightSum = m_weightSum > 0 ? m_weightSum : 1.0/static_cast<double>(priority);
+  double interval = static_cast<double>(m_pollInterval*priority) * weightSum;
+  return interval < m_pollInterval ? m_pollInterval : static_cast<time_t>(interval+0.5);
+}
+
+Message* PollScheduler::getNext(time_t now) {
+  m_weightSum = 0;
+  for (const auto& entry : m_entries) {
+    size_t priority = entry.m_message->getPollPriority();
+    if (priority > 0) {
+      m_weightSum += 1.0/static_cast<double>(priority);
+    }
+  }
+  if (m_entries.empty() || m_entries.front().m_due > now) {
+    return nullptr;  // nothing due yet
+  }
+  // pop at most one entry per call so that skipping entries never walks the whole heap
+  pop_heap(m_entries.begin(), m_entries.end(), isLater);
+  PollEntry entry = m_entries.back();
+  m_entries.pop_back();
+  Message* message = entry.m_message;
+  if (message->getPollPriority() == 0) {
+    return nullptr;  // polling was disabled in the meantime
+  }
+  time_t interval = getTargetInterval(message);
+  time_t lastUpdate = message->getLastUpdateTime();
+  if (entry.m_due > 0 && lastUpdate > 0 && lastUpdate+interval > now) {
+    // recently updated by other traffic: check again when the value becomes stale
+    push(message, lastUpdate+interval);
+    return nullptr;
+  }
+  push(message, now+interval);
+  return message;
+}
+
+void PollScheduler::push(Message* message, time_t due) {
+  m_entries.push_back({due, m_nextSequence++, message});
+  push_heap(m_entries.begin(), m_entries.end(), isLater);
+}
+
+
 result_t Condition::create(const string& condName, const map<string, string>& rowDefaults,
     map<string, string>* row, SimpleCondition** returnValue) {
   // type=name,circuit,name=messagename,[comment],qq=[fieldname],[ZZ],pbsb=values
@@ -1492,6 +1808,13 @@ void SimpleCondition::dump(bool matched, ostream* output) const {
   }
 }
 
+void SimpleCondition::addMemoryUsage(MemoryUsage* usage) const {
+  usage->add(mk_conditions, sizeof(SimpleCondition) + MemoryUsage::getHeapSize(m_matchedValue)
+      + MemoryUsage::getHeapSize(m_condName) + MemoryUsage::getHeapSize(m_refName)
+      + MemoryUsage::getHeapSize(m_circuit) + MemoryUsage::getHeapSize(m_level) + MemoryUsage::getHeapSize(m_name)
+      + MemoryUsage::getHeapSize(m_field));
+}
+
 CombinedCondition* SimpleCondition::combineAnd(Condition* other) {
   CombinedCondition* ret = new CombinedCondition();
   return ret->combineAnd(this)->combineAnd(other);
@@ -1550,6 +1873,7 @@ result_t SimpleCondition::resolve(void (*readMessageFunc)(Message* message), Mes
     }
     m_message = message;
     message->setUsedByCondition();
+    message->addDependentCondition(this);  // also invalidates a result cached before resolving
     if (m_name.length() > 0 && !message->isScanMessage()) {
       messages->addPollMessage(true, message);
     }
@@ -1564,15 +1888,21 @@ bool SimpleCondition::isTrue() {
   if (!m_message) {
     return false;
   }
-  if (m_message->getLastChangeTime() > m_lastCheckTime) {
-    bool isTrue = !m_hasValues;  // for message seen check
-    if (!isTrue) {
+  // only re-evaluate after the data of the message changed (see Message::endLastDataUpdate())
+  if (m_dirty.exchange(false, std::memory_order_acq_rel)) {
+    bool isTrue = m_message->getLastChangeTime() != 0;  // for message seen check
+    if (isTrue && m_hasValues) {
       isTrue = checkValue(m_message, m_field);
     }
-    m_isTrue = isTrue;
-    m_lastCheckTime = m_message->getLastChangeTime();
+    m_isTrue.store(isTrue, std::memory_order_release);
+  }
+  return m_isTrue.load(std::memory_order_acquire);
+}
+
+void SimpleCondition::getDependencies(vector<Message*>* messages) const {
+  if (m_message) {
+    messages->push_back(m_message);
   }
-  return m_isTrue;
 }
 
 
@@ -1590,6 +1920,12 @@ bool SimpleNumericCondition::checkValue(const Message* message, const string& fi
   return false;
 }
 
+void SimpleNumericCondition::addMemoryUsage(MemoryUsage* usage) const {
+  SimpleCondition::addMemoryUsage(usage);
+  usage->add(mk_conditions, sizeof(SimpleNumericCondition) - sizeof(SimpleCondition)
+      + m_valueRanges.capacity()*sizeof(unsigned int), 0);
+}
+
 
 bool SimpleStringCondition::checkValue(const Message* message, const string& field) {
   ostringstream output;
@@ -1606,6 +1942,15 @@ bool SimpleStringCondition::checkValue(const Message* message, const string& fie
   return false;
 }
 
+void SimpleStringCondition::addMemoryUsage(MemoryUsage* usage) const {
+  SimpleCondition::addMemoryUsage(usage);
+  size_t bytes = sizeof(SimpleStringCondition) - sizeof(SimpleCondition) + m_values.capacity()*sizeof(string);
+  for (const auto& value : m_values) {
+    bytes += MemoryUsage::getHeapSize(value);
+  }
+  usage->add(mk_conditions, bytes, 0);
+}
+
 
 void CombinedCondition::dump(bool matched, ostream* output) const {
   for (const auto condition : m_conditions) {
@@ -1613,6 +1958,10 @@ void CombinedCondition::dump(bool matched, ostream* output) const {
   }
 }
 
+void CombinedCondition::addMemoryUsage(MemoryUsage* usage) const {
+  usage->add(mk_conditions, sizeof(CombinedCondition) + m_conditions.capacity()*sizeof(Condition*));
+}
+
 result_t CombinedCondition::resolve(void (*readMessageFunc)(Message* message), MessageMap* messages,
     ostringstream* errorMessage) {
   for (const auto condition : m_conditions) {
@@ -1623,16 +1972,36 @@ result_t CombinedCondition::resolve(void (*readMessageFunc)(Message* message), M
       return ret;
     }
   }
+  if (!m_dependenciesAdded) {
+    vector<Message*> dependencies;
+    getDependencies(&dependencies);
+    for (const auto message : dependencies) {
+      message->addDependentCondition(this);
+    }
+    m_dependenciesAdded = true;
+    invalidate();
+  }
   return RESULT_OK;
 }
 
 bool CombinedCondition::isTrue() {
-  for (const auto condition : m_conditions) {
-    if (!condition->isTrue()) {
-      return false;
+  if (m_dirty.exchange(false, std::memory_order_acq_rel)) {
+    bool isTrue = true;
+    for (const auto condition : m_conditions) {
+      if (!condition->isTrue()) {
+        isTrue = false;
+        break;
+      }
     }
+    m_isTrue.store(isTrue, std::memory_order_release);
+  }
+  return m_isTrue.load(std::memory_order_acquire);
+}
+
+void CombinedCondition::getDependencies(vector<Message*>* messages) const {
+  for (const auto condition : m_conditions) {
+    condition->getDependencies(messages);
   }
-  return true;
 }
 
 
@@ -1698,6 +2067,15 @@ void Instruction::getDestination(ostringstream* ostream) const {
   }
 }
 
+void Instruction::addMemoryUsage(MemoryUsage* usage) const {
+  size_t bytes = sizeof(Instruction);
+  for (const auto& it : m_defaults) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first)
+        + MemoryUsage::getHeapSize(it.second);
+  }
+  usage->add(mk_instructions, bytes);
+}
+
 result_t LoadInstruction::execute(MessageMap* messages, ostringstream* log) {
   string errorDescription;
   result_t result = loadDefinitionsFromConfigPath(messages, m_filename, false, &m_defaults, &errorDescription);
@@ -1733,9 +2111,147 @@ result_t LoadInstruction::execute(MessageMap* messages, ostringstream* log) {
   return result;
 }
 
+void LoadInstruction::addMemoryUsage(MemoryUsage* usage) const {
+  Instruction::addMemoryUsage(usage);
+  usage->add(mk_instructions, sizeof(LoadInstruction) - sizeof(Instruction) + MemoryUsage::getHeapSize(m_filename), 0);
+}
+
+
+void UpdateJournal::add(Message* message, bool changed) {
+  m_mutex.lock();
+  size_t pos = (size_t)(m_nextSequence % m_capacity);
+  m_messages[pos] = message;
+  m_changed[pos] = changed;
+  m_nextSequence++;
+  m_mutex.unlock();
+}
+
+uint64_t UpdateJournal::getNextSequence() const {
+  m_mutex.lock();
+  uint64_t ret = m_nextSequence;
+  m_mutex.unlock();
+  return ret;
+}
+
+bool UpdateJournal::getUpdates(bool changedOnly, uint64_t* cursor, deque<Message*>* messages) const {
+  m_mutex.lock();
+  uint64_t sequence = *cursor;
+  bool complete = sequence + m_capacity >= m_nextSequence;
+  if (!complete) {
+    sequence = m_nextSequence - m_capacity;
+  }
+  set<Message*> seen;
+  for (; sequence < m_nextSequence; sequence++) {
+    size_t pos = (size_t)(sequence % m_capacity);
+    Message* message = m_messages[pos];
+    if (message == nullptr || (changedOnly && !m_changed[pos])) {
+      continue;
+    }
+    if (seen.insert(message).second) {
+      messages->push_back(message);
+    }
+  }
+  *cursor = m_nextSequence;
+  m_mutex.unlock();
+  return complete;
+}
+
+void UpdateJournal::remove(const Message* message) {
+  m_mutex.lock();
+  for (auto& entry : m_messages) {
+    if (entry == message) {
+      entry = nullptr;
+    }
+  }
+  m_mutex.unlock();
+}
+
+void UpdateJournal::clear() {
+  m_mutex.lock();
+  for (auto& entry : m_messages) {
+    entry = nullptr;
+  }
+  m_mutex.unlock();
+}
+
+
+void MessageKeyIndex::set(uint64_t key, const vector<Message*>* messages) {
+  if ((m_size+1)*2 > m_entries.size()) {
+    // grow to keep the load factor below 50%
+    vector<Entry> entries;
+    entries.swap(m_entries);
+    m_entries.resize(entries.empty() ? 64 : entries.size()*2, {0, nullptr});
+    m_size = 0;
+    for (const auto& entry : entries) {
+      if (entry.m_messages) {
+        insert(entry.m_key, entry.m_messages);
+      }
+    }
+  }
+  insert(key, messages);
+  if (m_idLengths.empty()) {
+    m_idLengths.resize(256*256, 0);
+  }
+  m_idLengths[(key >> (8 * 4)) & 0xffff] |= (uint8_t)(1 << Message::getKeyLength(key));
+}
+
+void MessageKeyIndex::insert(uint64_t key, const vector<Message*>* messages) {
+  size_t mask = m_entries.size()-1;
+  for (size_t pos = hash(key) & mask; true; pos = (pos+1) & mask) {
+    Entry& entry = m_entries[pos];
+    if (entry.m_messages == nullptr) {
+      entry.m_key = key;
+      entry.m_messages = messages;
+      m_size++;
+      return;
+    }
+    if (entry.m_key == key) {
+      entry.m_messages = messages;
+      return;
+    }
+  }
+}
+
+void MessageKeyIndex::erase(uint64_t key) {
+  if (m_size == 0) {
+    return;
+  }
+  size_t mask = m_entries.size()-1;
+  size_t pos = hash(key) & mask;
+  while (m_entries[pos].m_key != key) {
+    if (m_entries[pos].m_messages == nullptr) {
+      return;  // not found
+    }
+    pos = (pos+1) & mask;
+  }
+  if (m_entries[pos].m_messages == nullptr) {
+    return;  // not found
+  }
+  // shift back following entries of the same probe sequence
+  for (size_t next = (pos+1) & mask; m_entries[next].m_messages != nullptr; next = (next+1) & mask) {
+    size_t home = hash(m_entries[next].m_key) & mask;
+    if (((next-home) & mask) >= ((next-pos) & mask)) {
+      m_entries[pos] = m_entries[next];
+      pos = next;
+    }
+  }
+  m_entries[pos].m_messages = nullptr;
+  m_size--;
+}
+
+void MessageKeyIndex::clear() {
+  m_entries.clear();
+  m_size = 0;
+  m_idLengths.clear();
+}
+
 
 vector<string> MessageMap::s_noFiles;
 
+SharedCounter MessageMap::s_findHits;
+
+SharedCounter MessageMap::s_findMisses;
+
 result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
   uint64_t key = message->getKey();
   bool conditional = message->isConditional();
@@ -1828,6 +2344,10 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
       m_passiveMessageCount++;
     }
     addPollMessage(false, message);
+    message->m_updateJournal = &m_updateJournal;
+    if (m_historyStore) {
+      message->m_histories = m_historyStore->find(message->getCircuit(), message->getName());
+    }
   }
   size_t idLength = message->getIdLength();
   if (message->getDstAddress() == BROADCAST && idLength > m_maxBroadcastIdLength) {
@@ -1836,15 +2356,105 @@ result_t MessageMap::add(bool storeByName, Message* message, bool replace) {
   if (idLength > m_maxIdLength) {
     m_maxIdLength = idLength;
   }
-  m_messagesByKey[key].push_back(message);
+  vector<Message*>* keyMessages = &m_messagesByKey[key];
+  keyMessages->push_back(message);
+  m_messageIndex.set(key, keyMessages);
+  bool restored = false;
+  if (!m_retainedStates.empty() && !message->isScanMessage()) {
+    const auto it = m_retainedStates.find(message->getDefinitionKey());
+    if (it != m_retainedStates.end()) {
+      message->restoreState(it->second);
+      m_retainedStates.erase(it);
+      m_restoredStates++;
+      restored = true;
+    }
+  }
+  if (!restored && m_stateFile) {
+    m_stateFile->restore(message, message->getDefinitionKey());
+  }
   return RESULT_OK;
 }
 
+size_t MessageMap::retainStates() {
+  lock();
+  m_retainedStates.clear();
+  m_restoredStates = 0;
+  for (const auto& it : m_messagesByKey) {
+    for (const auto message : it.second) {
+      if (message->getLastUpdateTime() == 0 || message->isScanMessage()) {
+        continue;
+      }
+      message->saveState(&m_retainedStates[message->getDefinitionKey()]);
+    }
+  }
+  size_t count = m_retainedStates.size();
+  unlock();
+  return count;
+}
+
+size_t MessageMap::discardRetainedStates() {
+  lock();
+  size_t count = m_retainedStates.size();
+  m_retainedStates.clear();
+  unlock();
+  return count;
+}
+
+size_t MessageMap::setHistoryStore(const HistoryStore* historyStore) {
+  lock();
+  m_historyStore = historyStore;
+  size_t count = 0;
+  for (const auto& it : m_messagesByKey) {
+    for (const auto message : it.second) {
+      message->m_histories = historyStore ? historyStore->find(message->getCircuit(), message->getName()) : nullptr;
+      if (message->m_histories) {
+        count++;
+      }
+    }
+  }
+  unlock();
+  return count;
+}
+
+size_t MessageMap::setStateFile(StateFile* stateFile) {
+  lock();
+  m_stateFile = stateFile;
+  size_t count = 0;
+  if (stateFile) {
+    for (const auto& it : m_messagesByKey) {
+      for (const auto message : it.second) {
+        if (message->getLastUpdateTime() == 0 && stateFile->restore(message, message->getDefinitionKey())) {
+          count++;
+        }
+      }
+    }
+  }
+  unlock();
+  return count;
+}
+
+size_t MessageMap::storeStates(StateFile* stateFile) {
+  lock();
+  size_t count = 0;
+  for (const auto& it : m_messagesByKey) {
+    for (const auto message : it.second) {
+      if (message->getLastUpdateTime() != 0) {
+        stateFile->store(message, message->getDefinitionKey());
+        count++;
+      }
+    }
+  }
+  unlock();
+  return count;
+}
+
 void MessageMap::remove(Message* message) {
   if (message == nullptr) {
     return;
   }
   lock();
+  m_generation++;
+  m_updateJournal.remove(message);
   uint64_t key = message->getKey();
   bool conditional = message->isConditional();
   const auto keyIt = m_messagesByKey.find(key);
@@ -1864,6 +2474,7 @@ void MessageMap::remove(Message* message) {
       }
     }
     if (messages.empty()) {
+      m_messageIndex.erase(key);
       m_messagesByKey.erase(keyIt);
     }
   }
@@ -2210,6 +2821,7 @@ result_t MessageMap::readFromStream(istream* stream, const string& filename, con
   if (!size) {
     size = &localSize;
   }
+  ArenaScope scope(&m_arena);
   result_t result
   = MappedFileReader::readFromStream(stream, filename, mtime, verbose, defaults, errorDescription, replace, hash, size);
   if (defaults) {
@@ -2232,6 +2844,7 @@ result_t MessageMap::readFromStream(istream* stream, const string& filename, con
 
 result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
     vector< map<string, string> >* subRows, string* errorDescription, bool replace) {
+  ArenaScope scope(&m_arena);
   Condition* condition = nullptr;
   string types = AttributedItem::pluck("type", row);
   result_t result = readConditions(filename, &types, errorDescription, &condition);
@@ -2251,6 +2864,10 @@ result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, ma
       *errorDescription = "invalid instruction";
       return result;
     }
+    if (m_staging) {
+      m_stagedEntries.push_back({lineNo, nullptr, instruction, false});
+      return RESULT_OK;
+    }
     auto it = m_instructions.find(filename);
     if (it == m_instructions.end()) {
       m_instructions[filename].push_back(instruction);
@@ -2284,6 +2901,10 @@ result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, ma
           row, subRows, errorDescription, &messages);
     }
     for (const auto message : messages) {
+      if (result == RESULT_OK && m_staging) {
+        m_stagedEntries.push_back({lineNo, message, nullptr, replace});
+        continue;
+      }
       if (result == RESULT_OK) {
         result = add(true, message, replace);
         if (result == RESULT_ERR_DUPLICATE_NAME) {
@@ -2303,6 +2924,197 @@ result_t MessageMap::addFromFile(const string& filename, unsigned int lineNo, ma
   return result;
 }
 
+MessageMap* MessageMap::createStaging() const {
+  MessageMap* staging = new MessageMap(m_addAll, "", false);
+  staging->m_staging = true;
+  return staging;
+}
+
+result_t MessageMap::mergeStaged(MessageMap* staging, const string& filename, result_t result, bool verbose,
+    string* errorDescription) {
+  // conditions are stored by filename and therefore always taken over
+  for (const auto& it : staging->m_conditions) {
+    m_conditions[it.first] = it.second;
+  }
+  staging->m_conditions.clear();
+  result_t mergeResult = RESULT_OK;
+  string mergeError;
+  for (const auto& entry : staging->m_stagedEntries) {
+    if (mergeResult != RESULT_OK) {
+      // delete all remaining entries on error
+      delete entry.m_message;
+      delete entry.m_instruction;
+      continue;
+    }
+    if (entry.m_instruction) {
+      m_instructions[filename].push_back(entry.m_instruction);
+      continue;
+    }
+    mergeResult = add(true, entry.m_message, entry.m_replace);
+    if (mergeResult == RESULT_OK) {
+      continue;
+    }
+    if (mergeResult == RESULT_ERR_DUPLICATE_NAME) {
+      mergeError = "invalid name";
+    } else if (mergeResult == RESULT_ERR_DUPLICATE) {
+      mergeError = "duplicate ID";
+    }
+    delete entry.m_message;
+    mergeResult = finishLine(filename, verbose, entry.m_lineNo, mergeResult, &mergeError);
+  }
+  staging->m_stagedEntries.clear();
+  for (const auto& it : staging->m_circuitData) {
+    const auto existing = m_circuitData.find(it.first);
+    if (existing != m_circuitData.end()) {
+      delete existing->second;
+    }
+    m_circuitData[it.first] = it.second;
+  }
+  staging->m_circuitData.clear();
+  m_arena.adopt(&staging->m_arena);
+  if (mergeResult != RESULT_OK) {
+    *errorDescription = mergeError;
+    return mergeResult;
+  }
+  if (result != RESULT_OK) {
+    if (verbose && !errorDescription->empty()) {
+      cout << *errorDescription << endl;
+    }
+    return result;
+  }
+  const auto info = staging->m_loadedFileInfos.find(filename);
+  if (info != staging->m_loadedFileInfos.end()) {
+    m_loadedFileInfos[filename] = info->second;
+  }
+  return RESULT_OK;
+}
+
+MessageMap* MessageMap::createReplacement() const {
+  MessageMap* replacement = new MessageMap(m_addAll, "", false);
+  replacement->m_historyStore = m_historyStore;
+  return replacement;
+}
+
+void MessageMap::matchStates(const MessageMap* current) {
+  current->lockShared();
+  m_stateMatches.clear();
+  m_stateMatchGeneration = current->m_generation;
+  for (const auto& it : m_messagesByKey) {
+    const auto currentIt = current->m_messagesByKey.find(it.first);
+    if (currentIt == current->m_messagesByKey.end()) {
+      continue;
+    }
+    for (const auto message : it.second) {
+      if (message->isScanMessage()) {
+        continue;
+      }
+      const string definitionKey = message->getDefinitionKey();
+      for (const auto currentMessage : currentIt->second) {
+        if (currentMessage->getLastUpdateTime() != 0 && currentMessage->getDefinitionKey() == definitionKey) {
+          m_stateMatches.push_back(pair<Message*, const Message*>(message, currentMessage));
+          break;
+        }
+      }
+    }
+  }
+  current->unlockShared();
+}
+
+size_t MessageMap::swap(MessageMap* replacement) {
+  lock();
+  if (replacement->m_stateMatchGeneration != m_generation) {
+    // instances were removed in the meantime
+    replacement->matchStates(this);
+  }
+  size_t carried = 0;
+  for (const auto& it : replacement->m_stateMatches) {
+    MessageState state;
+    it.second->saveState(&state);
+    it.first->restoreState(state);
+    carried++;
+  }
+  replacement->m_stateMatches.clear();
+  std::swap(m_loadedFiles, replacement->m_loadedFiles);
+  std::swap(m_loadedFileInfos, replacement->m_loadedFileInfos);
+  std::swap(m_additionalScanMessages, replacement->m_additionalScanMessages);
+  std::swap(m_maxIdLength, replacement->m_maxIdLength);
+  std::swap(m_maxBroadcastIdLength, replacement->m_maxBroadcastIdLength);
+  std::swap(m_messageCount, replacement->m_messageCount);
+  std::swap(m_conditionalMessageCount, replacement->m_conditionalMessageCount);
+  std::swap(m_passiveMessageCount, replacement->m_passiveMessageCount);
+  m_messagesByName.swap(replacement->m_messagesByName);
+  m_messagesByKey.swap(replacement->m_messagesByKey);
+  std::swap(m_messageIndex, replacement->m_messageIndex);
+  m_pollMessages.swapEntries(&replacement->m_pollMessages);
+  m_conditions.swap(replacement->m_conditions);
+  m_instructions.swap(replacement->m_instructions);
+  m_circuitData.swap(replacement->m_circuitData);
+  m_arena.swap(&replacement->m_arena);
+  // let each instance record its updates in the journal of the map it is stored in now
+  for (const auto& it : m_messagesByKey) {
+    for (const auto message : it.second) {
+      message->m_updateJournal = &m_updateJournal;
+    }
+  }
+  for (const auto& it : replacement->m_messagesByKey) {
+    for (const auto message : it.second) {
+      message->m_updateJournal = &replacement->m_updateJournal;
+    }
+  }
+  m_updateJournal.clear();
+  m_restoredStates = carried;
+  m_generation++;
+  uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+  unlock();
+  m_retiredMutex.lock();
+  m_retired.push_back(pair<uint64_t, MessageMap*>(epoch, replacement));
+  m_retiredMutex.unlock();
+  return carried;
+}
+
+size_t MessageMap::registerReader() {
+  uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+  for (size_t slot = 0; slot < MESSAGE_MAP_READERS; slot++) {
+    uint64_t unused = 0;
+    if (m_readerEpochs[slot].compare_exchange_strong(unused, epoch, std::memory_order_acq_rel)) {
+      return slot;
+    }
+  }
+  return MESSAGE_MAP_READERS;
+}
+
+void MessageMap::unregisterReader(size_t slot) {
+  if (slot < MESSAGE_MAP_READERS) {
+    m_readerEpochs[slot].store(0, std::memory_order_release);
+  }
+}
+
+size_t MessageMap::reclaimRetired() {
+  uint64_t passed = m_epoch.load(std::memory_order_acquire);
+  for (const auto& readerEpoch : m_readerEpochs) {
+    uint64_t epoch = readerEpoch.load(std::memory_order_acquire);
+    if (epoch != 0 && epoch < passed) {
+      passed = epoch;
+    }
+  }
+  vector<MessageMap*> reclaim;
+  m_retiredMutex.lock();
+  for (auto it = m_retired.begin(); it != m_retired.end(); ) {
+    if (it->first <= passed) {
+      reclaim.push_back(it->second);
+      it = m_retired.erase(it);
+    } else {
+      it++;
+    }
+  }
+  size_t remain = m_retired.size();
+  m_retiredMutex.unlock();
+  for (const auto retired : reclaim) {
+    delete retired;
+  }
+  return remain;
+}
+
 Message* MessageMap::getScanMessage(symbol_t dstAddress) {
   if (dstAddress == SYN) {
     return m_scanMessage;
@@ -2473,11 +3285,7 @@ bool MessageMap::getLoadedFileInfo(const string& filename, string* comment, size
 }
 
 const vector<Message*>* MessageMap::getByKey(uint64_t key) const {
-  const auto it = m_messagesByKey.find(key);
-  if (it != m_messagesByKey.end()) {
-    return &it->second;
-  }
-  return nullptr;
+  return m_messageIndex.find(key);
 }
 
 Message* MessageMap::find(const string& circuit, const string& name, const string& levels, bool isWrite,
@@ -2500,10 +3308,12 @@ Message* MessageMap::find(const string& circuit, const string& name, const strin
     if (it != m_messagesByName.end()) {
       Message* message = getFirstAvailable(it->second);
       if (message && message->hasLevel(levels)) {
+        s_findHits.add();
         return message;
       }
     }
   }
+  s_findMisses.add();
   return nullptr;
 }
 
@@ -2569,7 +3379,23 @@ void MessageMap::findAll(const string& circuit, const string& name, const string
   }
 }
 
-Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
+bool MessageMap::findUpdates(const string& levels, bool changedOnly, uint64_t* cursor,
+    deque<Message*>* messages) const {
+  deque<Message*> updated;
+  bool ret = m_updateJournal.getUpdates(changedOnly, cursor, &updated);
+  bool checkLevel = levels != "*";
+  for (const auto message : updated) {
+    if (message->getDstAddress() == SYN || (checkLevel && !message->hasLevel(levels))) {
+      continue;
+    }
+    if (message->isAvailable()) {
+      messages->push_back(message);
+    }
+  }
+  return ret;
+}
+
+Message* MessageMap::findByMaster(const MasterSymbolString& master, bool anyDestination,
   bool withRead, bool withWrite, bool withPassive, bool onlyAvailable) const {
   if (anyDestination && master.size() >= 5 && master[4] == 0 && master[2] == 0x07 && master[3] == 0x04) {
     return m_scanMessage;
@@ -2580,11 +3406,18 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
     return nullptr;
   }
   size_t maxIdLength = Message::getKeyLength(baseKey);
+  uint8_t idLengths = m_messageIndex.getIdLengths(master[2], master[3]);
   for (size_t idLength = maxIdLength; true; idLength--) {
+    if ((idLengths & (1 << idLength)) == 0) {
+      // no message with this ID length for PB/SB
+      if (idLength == 0) {
+        break;
+      }
+      continue;
+    }
     uint64_t key = baseKey;
-    if (idLength == maxIdLength) {
-      baseKey &= ~ID_LENGTH_AND_IDS_MASK;
-    } else {
+    if (idLength < maxIdLength) {
+      key &= ~ID_LENGTH_AND_IDS_MASK;
       key |= (uint64_t)idLength << (8 * 7 + 5);
       int exp = 3;
       for (size_t i = 0; i < idLength; i++) {
@@ -2594,20 +3427,20 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
         }
       }
     }
-    map<uint64_t, vector<Message*> >::const_iterator it;
+    const vector<Message*>* messages;
     if (withPassive) {
-      it = m_messagesByKey.find(key);
-      if (it != m_messagesByKey.end()) {
-        Message* message = getFirstAvailable(it->second, &master, onlyAvailable);
+      messages = m_messageIndex.find(key);
+      if (messages) {
+        Message* message = getFirstAvailable(*messages, &master, onlyAvailable);
         if (message) {
           return message;
         }
       }
       if ((key & ID_SOURCE_MASK) != 0) {
         key &= ~ID_SOURCE_MASK;
-        it = m_messagesByKey.find(key & ~ID_SOURCE_MASK);  // try again without specific source master
-        if (it != m_messagesByKey.end()) {
-          Message* message = getFirstAvailable(it->second, &master, onlyAvailable);
+        messages = m_messageIndex.find(key);  // try again without specific source master
+        if (messages) {
+          Message* message = getFirstAvailable(*messages, &master, onlyAvailable);
           if (message) {
             return message;
           }
@@ -2617,18 +3450,18 @@ Message* MessageMap::find(const MasterSymbolString& master, bool anyDestination,
       key &= ~ID_SOURCE_MASK;
     }
     if (withRead) {
-      it = m_messagesByKey.find(key | ID_SOURCE_ACTIVE_READ);  // try again with special value for active read
-      if (it != m_messagesByKey.end()) {
-        Message* message = getFirstAvailable(it->second, &master, onlyAvailable);
+      messages = m_messageIndex.find(key | ID_SOURCE_ACTIVE_READ);  // try again with special value for active read
+      if (messages) {
+        Message* message = getFirstAvailable(*messages, &master, onlyAvailable);
         if (message) {
           return message;
         }
       }
     }
     if (withWrite) {
-      it = m_messagesByKey.find(key | ID_SOURCE_ACTIVE_WRITE);  // try again with special value for active write
-      if (it != m_messagesByKey.end()) {
-        Message* message = getFirstAvailable(it->second, &master, onlyAvailable);
+      messages = m_messageIndex.find(key | ID_SOURCE_ACTIVE_WRITE);  // try again with special value for active write
+      if (messages) {
+        Message* message = getFirstAvailable(*messages, &master, onlyAvailable);
         if (message) {
           return message;
         }
@@ -2661,8 +3494,7 @@ void MessageMap::invalidateCache(Message* message) {
 void MessageMap::addPollMessage(bool toFront, Message* message) {
   if (message != nullptr && message->getPollPriority() > 0) {
     lock();
-    message->m_lastPollTime = toFront ? 0 : m_pollMessages.size();
-    m_pollMessages.push(message);
+    m_pollMessages.add(message, toFront, time(nullptr));
     unlock();
   }
 }
@@ -2681,13 +3513,12 @@ bool MessageMap::decodeCircuit(const string& circuit, OutputFormat outputFormat,
 }
 
 void MessageMap::clear() {
+  m_generation++;
+  m_updateJournal.clear();
   m_loadedFiles.clear();
   m_loadedFileInfos.clear();
   // clear poll messages
-  while (!m_pollMessages.empty()) {
-    m_pollMessages.top();
-    m_pollMessages.pop();
-  }
+  m_pollMessages.clear();
   // free message instances by name
   for (auto it : m_messagesByName) {
     vector<Message*> nameMessages = it.second;
@@ -2740,12 +3571,19 @@ void MessageMap::clear() {
   m_messagesByName.clear();
   // clear messages by key
   m_messagesByKey.clear();
+  m_messageIndex.clear();
   m_conditions.clear();
   m_instructions.clear();
   for (const auto it : m_circuitData) {
     delete it.second;
   }
   m_circuitData.clear();
+  for (const auto& entry : m_stagedEntries) {
+    delete entry.m_message;
+    delete entry.m_instruction;
+  }
+  m_stagedEntries.clear();
+  m_arena.clear();  // all instances from the arena were destructed above
   m_maxIdLength = m_maxBroadcastIdLength = 0;
   m_additionalScanMessages = false;
 }
@@ -2755,14 +3593,12 @@ Message* MessageMap::getNextPoll() {
     return nullptr;
   }
   lock();
-  Message* ret = m_pollMessages.top();
-  m_pollMessages.pop();
-  if (ret->m_pollOrder > g_lastPollOrder) {
-    g_lastPollOrder = ret->m_pollOrder;
-  }
-  ret->m_pollOrder += (unsigned int)ret->m_pollPriority;
-  time(&(ret->m_lastPollTime));
-  m_pollMessages.push(ret);  // re-insert at new position
+  time_t now;
+  time(&now);
+  Message* ret = m_pollMessages.getNext(now);
+  if (ret != nullptr) {
+    ret->m_lastPollTime = now;
+  }
   unlock();
   return ret;
 }
@@ -2805,4 +3641,44 @@ void MessageMap::dump(bool withConditions, ostream* output) const {
   }
 }
 
+void MessageMap::addMemoryUsage(MemoryUsage* usage) const {
+  set<const Message*> messages;
+  size_t bytes = m_messageIndex.getMemorySize() + m_pollMessages.getMemorySize();
+  for (const auto& it : m_messagesByName) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first)
+        + it.second.capacity()*sizeof(Message*);
+    if (it.first[0] != FIELD_SEPARATOR) {  // instances stored multiple times have a special key
+      messages.insert(it.second.begin(), it.second.end());
+    }
+  }
+  for (const auto& it : m_messagesByKey) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + it.second.capacity()*sizeof(Message*);
+    messages.insert(it.second.begin(), it.second.end());
+  }
+  for (const auto& it : m_circuitData) {
+    bytes += MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first) + sizeof(AttributedItem);
+  }
+  usage->add(mk_messages, bytes, 0);
+  if (m_scanMessage) {
+    messages.insert(m_scanMessage);
+  }
+  if (m_broadcastScanMessage) {
+    messages.insert(m_broadcastScanMessage);
+  }
+  for (const auto message : messages) {
+    message->addMemoryUsage(usage);
+  }
+  for (const auto& it : m_conditions) {
+    usage->add(mk_conditions, MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first), 0);
+    it.second->addMemoryUsage(usage);
+  }
+  for (const auto& it : m_instructions) {
+    usage->add(mk_instructions, MEMORY_NODE_OVERHEAD + sizeof(it) + MemoryUsage::getHeapSize(it.first)
+        + it.second.capacity()*sizeof(Instruction*), 0);
+    for (const auto instruction : it.second) {
+      instruction->addMemoryUsage(usage);
+    }
+  }
+}
+
 }  // namespace ebusd
@@ -20,15 +20,15 @@
 #define LIB_EBUS_MESSAGE_H_
 
 #include <stdint.h>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <deque>
 #include <map>
-#include <queue>
-#include <functional>
 #include "lib/ebus/data.h"
 #include "lib/ebus/result.h"
 #include "lib/ebus/symbol.h"
+#include "lib/utils/metrics.h"
 
 namespace ebusd {
 
@@ -56,17 +56,286 @@ namespace ebusd {
  * The @a MessageMap stores all @a Message and @a Condition instances by their
  * unique keys, and also keeps track of messages with polling enabled. It reads
  * the instances from configuration files by inheriting the @a FileReader
- * template class.
+ * template class. The messages to poll are scheduled by the @a PollScheduler
+ * earliest deadline first.
+ *
+ * Each update of a @a Message stored in a @a MessageMap is recorded in the
+ * @a UpdateJournal of the map, which allows consumers to retrieve the updated
+ * instances since their last check without iterating over all messages.
+ *
+ * A complete replacement of the definitions can be built in a separate
+ * @a MessageMap and then swapped in at once (see MessageMap#swap()). The
+ * previous instances are retired until all registered readers (see
+ * MessageMap#registerReader()) passed a quiescent state, i.e. dropped all
+ * pointers obtained before.
  */
 
-using std::binary_function;
-using std::priority_queue;
+using std::atomic;
 using std::deque;
+using std::pair;
 
 class Condition;
 class SimpleCondition;
 class CombinedCondition;
 class MessageMap;
+class Message;
+class StateFile;
+class MessageHistory;
+class HistoryStore;
+
+
+/** the default number of entries kept in the @a UpdateJournal. */
+#define UPDATE_JOURNAL_SIZE 1024
+
+/** the maximum number of threads using @a Message instances of a @a MessageMap without holding its lock. */
+#define MESSAGE_MAP_READERS 8
+
+/**
+ * An append-only journal of @a Message updates with sequence numbers kept in a ring of limited size.
+ */
+class UpdateJournal {
+ public:
+  /**
+   * Construct a new instance.
+   * @param capacity the maximum number of entries to keep.
+   */
+  explicit UpdateJournal(size_t capacity = UPDATE_JOURNAL_SIZE)
+    : m_capacity(capacity), m_messages(capacity, nullptr), m_changed(capacity, false), m_nextSequence(1) {}
+
+  /**
+   * Record an update of a @a Message.
+   * @param message the updated @a Message.
+   * @param changed whether the data of the @a Message was changed.
+   */
+  void add(Message* message, bool changed);
+
+  /**
+   * Get the sequence number of the next update to be recorded.
+   * @return the sequence number of the next update to be recorded.
+   */
+  uint64_t getNextSequence() const;
+
+  /**
+   * Get the updated @a Message instances since the cursor and advance the cursor.
+   * @param changedOnly true to include only updates with changed data.
+   * @param cursor the sequence number of the first update to retrieve, updated to the next sequence number.
+   * @param messages the @a deque to which to add the updated @a Message instances (each only once).
+   * @return true on success, false if the journal was overrun since the cursor (i.e. updates got lost).
+   */
+  bool getUpdates(bool changedOnly, uint64_t* cursor, deque<Message*>* messages) const;
+
+  /**
+   * Remove all entries of the @a Message (e.g. before it is deleted).
+   * @param message the @a Message to remove.
+   */
+  void remove(const Message* message);
+
+  /**
+   * Remove all entries while keeping the sequence numbers.
+   */
+  void clear();
+
+
+ private:
+  /** the maximum number of entries to keep. */
+  const size_t m_capacity;
+
+  /** the updated @a Message instances by sequence number modulo capacity (nullptr for removed entries). */
+  vector<Message*> m_messages;
+
+  /** whether the data was changed by sequence number modulo capacity. */
+  vector<bool> m_changed;
+
+  /** the sequence number of the next update to be recorded. */
+  uint64_t m_nextSequence;
+
+  /** the @a Mutex for exclusive access. */
+  mutable Mutex m_mutex;
+};
+
+
+/**
+ * An open addressing hash index of the @a Message instances by key for fast lookup on the receive path.
+ */
+class MessageKeyIndex {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  MessageKeyIndex() : m_size(0) {}
+
+  /**
+   * Set the @a Message instances for the key.
+   * @param key the key of the @a Message instances.
+   * @param messages the @a Message instances (owned by the caller and not to be moved while indexed).
+   */
+  void set(uint64_t key, const vector<Message*>* messages);
+
+  /**
+   * Remove the key.
+   * @param key the key to remove.
+   */
+  void erase(uint64_t key);
+
+  /**
+   * Find the @a Message instances for the key.
+   * @param key the key of the @a Message instances.
+   * @return the @a Message instances, or nullptr.
+   */
+  const vector<Message*>* find(uint64_t key) const {
+    if (m_size == 0) {
+      return nullptr;
+    }
+    size_t mask = m_entries.size()-1;
+    for (size_t pos = hash(key) & mask; true; pos = (pos+1) & mask) {
+      const Entry& entry = m_entries[pos];
+      if (entry.m_messages == nullptr) {
+        return nullptr;
+      }
+      if (entry.m_key == key) {
+        return entry.m_messages;
+      }
+    }
+  }
+
+  /**
+   * Get the bit mask of ID lengths (excluding PB and SB) that were ever set for the primary and secondary command.
+   * @param pb the primary command byte.
+   * @param sb the secondary command byte.
+   * @return the bit mask of ID lengths (bit n set for ID length n).
+   */
+  uint8_t getIdLengths(symbol_t pb, symbol_t sb) const {
+    return m_idLengths.empty() ? 0 : m_idLengths[(pb << 8) | sb];
+  }
+
+  /**
+   * Remove all entries.
+   */
+  void clear();
+
+  /**
+   * Get the number of keys.
+   * @return the number of keys.
+   */
+  size_t size() const { return m_size; }
+
+  /**
+   * Return the approximate number of bytes allocated by the index.
+   * @return the approximate number of bytes allocated by the index.
+   */
+  size_t getMemorySize() const { return m_entries.capacity()*sizeof(Entry) + m_idLengths.capacity(); }
+
+
+ private:
+  /**
+   * Calculate the hash of the key.
+   * @param key the key.
+   * @return the hash to use as start position.
+   */
+  static size_t hash(uint64_t key) {
+    key ^= key >> 31;
+    key *= 0x7fb5d329728ea185ULL;
+    key ^= key >> 27;
+    return static_cast<size_t>(key);
+  }
+
+  /**
+   * Insert an entry without checking the capacity.
+   * @param key the key.
+   * @param messages the @a Message instances.
+   */
+  void insert(uint64_t key, const vector<Message*>* messages);
+
+  /** an entry of the index. */
+  struct Entry {
+    /** the key. */
+    uint64_t m_key;
+
+    /** the @a Message instances, or nullptr for an empty slot. */
+    const vector<Message*>* m_messages;
+  };
+
+  /** the slots (power of two size, linear probing). */
+  vector<Entry> m_entries;
+
+  /** the number of used slots. */
+  size_t m_size;
+
+  /** the bit mask of ID lengths by primary and secondary command (allocated on first use). */
+  vector<uint8_t> m_idLengths;
+};
+
+
+/**
+ * The last seen data and update times of a @a Message for keeping them across a reload.
+ */
+class MessageState {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  MessageState() : m_lastUpdateTime(0), m_lastChangeTime(0), m_lastPollTime(0) {}
+
+  /**
+   * Destructor.
+   */
+  ~MessageState() {
+    clearParts();
+  }
+
+  /**
+   * Free the data of the parts of a @a ChainedMessage.
+   */
+  void clearParts() {
+    for (const auto data : m_lastMasterDatas) {
+      delete data;
+    }
+    m_lastMasterDatas.clear();
+    for (const auto data : m_lastSlaveDatas) {
+      delete data;
+    }
+    m_lastSlaveDatas.clear();
+    m_lastMasterUpdateTimes.clear();
+    m_lastSlaveUpdateTimes.clear();
+  }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  MessageState(const MessageState& src);
+
+
+ public:
+  /** the last seen @a MasterSymbolString. */
+  MasterSymbolString m_lastMasterData;
+
+  /** the last seen @a SlaveSymbolString. */
+  SlaveSymbolString m_lastSlaveData;
+
+  /** the system time when the message was last updated. */
+  time_t m_lastUpdateTime;
+
+  /** the system time when the message content was last changed. */
+  time_t m_lastChangeTime;
+
+  /** the system time when the message was last polled for. */
+  time_t m_lastPollTime;
+
+  /** the last seen @a MasterSymbolString of each part (only for @a ChainedMessage). */
+  vector<MasterSymbolString*> m_lastMasterDatas;
+
+  /** the last seen @a SlaveSymbolString of each part (only for @a ChainedMessage). */
+  vector<SlaveSymbolString*> m_lastSlaveDatas;
+
+  /** the system times when each part of the master data was last updated (only for @a ChainedMessage). */
+  vector<time_t> m_lastMasterUpdateTimes;
+
+  /** the system times when each part of the slave data was last updated (only for @a ChainedMessage). */
+  vector<time_t> m_lastSlaveUpdateTimes;
+};
 
 
 /**
@@ -122,7 +391,7 @@ class Message : public AttributedItem {
   /**
    * Destructor.
    */
-  virtual ~Message() { if (m_deleteData) { delete m_data; } }
+  virtual ~Message();
 
   /**
    * Calculate the key for the ID.
@@ -241,13 +510,13 @@ class Message : public AttributedItem {
    * Get the optional circuit name.
    * @return the optional circuit name.
    */
-  string getCircuit() const { return m_circuit; }
+  const string& getCircuit() const { return m_circuit; }
 
   /**
    * Get the optional access level.
    * @return the optional access level.
    */
-  string getLevel() const { return m_level; }
+  const string& getLevel() const { return m_level; }
 
   /**
    * Return whether one of the specified access levels allows access to this message.
@@ -377,6 +646,13 @@ class Message : public AttributedItem {
    */
   void setUsedByCondition();
 
+  /**
+   * Add a @a Condition depending on the last seen data of this message for invalidating its cached result whenever
+   * the data changes.
+   * @param condition the dependent @a Condition.
+   */
+  void addDependentCondition(Condition* condition);
+
   /**
    * Return whether this @a Message depends on a @a Condition.
    * @return true when this @a Message depends on a @a Condition.
@@ -445,6 +721,30 @@ class Message : public AttributedItem {
    */
   virtual result_t storeLastData(const MasterSymbolString& master, const SlaveSymbolString& slave);
 
+  /**
+   * Get a key identifying the definition of this message (i.e. everything except the seen data).
+   * @return the definition key.
+   */
+  string getDefinitionKey() const;
+
+  /**
+   * Save the last seen data and update times.
+   * @param state the @a MessageState to save to.
+   */
+  virtual void saveState(MessageState* state) const;
+
+  /**
+   * Restore the last seen data and update times previously saved by @a saveState() on an identical definition.
+   * @param state the @a MessageState to restore from.
+   */
+  virtual void restoreState(const MessageState& state);
+
+  /**
+   * Add the approximate memory used by this instance, its fields, and its last seen data to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  virtual void addMemoryUsage(MemoryUsage* usage) const;
+
   /**
    * Store last seen master data.
    * @param index the index of the part to store.
@@ -496,17 +796,53 @@ class Message : public AttributedItem {
   virtual result_t decodeLastDataNumField(const char* fieldName, ssize_t fieldIndex, unsigned int* output) const;
 
   /**
-   * Get the last seen master data.
+   * Decode a particular numeric field value from the last stored data and convert it to the value it represents.
+   * @param fieldName the name of the field to decode, or nullptr for the first field.
+   * @param fieldIndex the optional index of the field (either named or overall), or -1.
+   * @param output the variable in which to store the value (including divisor).
+   * @return @a RESULT_OK on success, @a RESULT_EMPTY for the replacement value, or an error code.
+   */
+  virtual result_t decodeLastDataNumField(const char* fieldName, ssize_t fieldIndex, float* output) const;
+
+  /**
+   * Get the last seen master data (only to be used by the thread storing the data, see @a getLastData() otherwise).
    * @return the last seen @a MasterSymbolString.
    */
   const MasterSymbolString& getLastMasterData() const { return m_lastMasterData; }
 
   /**
-   * Get the last seen slave data.
+   * Get the last seen slave data (only to be used by the thread storing the data, see @a getLastData() otherwise).
    * @return the last seen @a SlaveSymbolString.
    */
   const SlaveSymbolString& getLastSlaveData() const { return m_lastSlaveData; }
 
+  /**
+   * Get a consistent copy of the last seen master and slave data without ever delaying the thread storing the data.
+   * @param master the @a MasterSymbolString to copy the last seen master data to.
+   * @param slave the @a SlaveSymbolString to copy the last seen slave data to.
+   * @return the sequence number of the copied data (increased on every modification).
+   */
+  uint32_t getLastData(MasterSymbolString* master, SlaveSymbolString* slave) const;
+
+  /**
+   * Return the number of times reading the last seen data of any instance had to be repeated due to a concurrent
+   * modification.
+   * @return the number of repeated reads.
+   */
+  static size_t getLastDataRetries() { return s_lastDataRetries.load(std::memory_order_relaxed); }
+
+  /**
+   * Return the number of times the last seen data of any instance was decoded (without the decode cache hits).
+   * @return the number of decode calls.
+   */
+  static uint64_t getDecodeCalls() { return s_decodeCalls.get(); }
+
+  /**
+   * Return the time spent for decoding the last seen data of any instance.
+   * @return the decode time in nanoseconds.
+   */
+  static uint64_t getDecodeNanos() { return s_decodeNanos.get(); }
+
   /**
    * Get the time when this message was last seen with reasonable data.
    * @return the time when this message was last seen, or 0.
@@ -525,13 +861,6 @@ class Message : public AttributedItem {
    */
   time_t getLastPollTime() const { return m_lastPollTime; }
 
-  /**
-   * Return whether this @a Message needs to be polled after the other one.
-   * @param other the other @a Message to compare with.
-   * @return true if this @a Message needs to be polled after the other one.
-   */
-  bool isLessPollWeight(const Message* other) const;
-
   /**
    * Write the message definition header or parts of it to the @a ostream.
    * @param fieldNames the list of field names to write, or nullptr for all.
@@ -567,11 +896,37 @@ class Message : public AttributedItem {
       ostringstream* output) const;
 
  protected:
-  /** the optional circuit name. */
-  const string m_circuit;
+  /**
+   * Start modifying the last seen data (readers retry until @a endLastDataUpdate() was called, other writers wait).
+   */
+  void beginLastDataUpdate();
 
-  /** the optional access level. */
-  const string m_level;
+  /**
+   * Finish modifying the last seen data started with @a beginLastDataUpdate() (also invalidates the cached output of
+   * @a decodeLastData() and the cached results of the dependent @a Condition instances).
+   */
+  void endLastDataUpdate();
+
+  /**
+   * Decode the value from the copy of the last stored master and slave data without using the cached output.
+   * @param master the copy of the last seen @a MasterSymbolString.
+   * @param slave the copy of the last seen @a SlaveSymbolString.
+   * @param leadingSeparator whether to prepend a separator before the formatted value.
+   * @param fieldName the optional name of a field to limit the output to.
+   * @param fieldIndex the optional index of the field to limit the output to (either named or overall), or -1.
+   * @param outputFormat the @a OutputFormat options to use.
+   * @param output the @a ostream to append the formatted value to.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t decodeLastDataUncached(const MasterSymbolString& master, const SlaveSymbolString& slave,
+      bool leadingSeparator, const char* fieldName, ssize_t fieldIndex, OutputFormat outputFormat,
+      ostream* output) const;
+
+  /** the optional circuit name (interned). */
+  const string& m_circuit;
+
+  /** the optional access level (interned). */
+  const string& m_level;
 
   /** whether this is a write message. */
   const bool m_isWrite;
@@ -630,6 +985,9 @@ class Message : public AttributedItem {
   /** the @a Condition for this message, or nullptr. */
   Condition* m_condition;
 
+  /** the @a Condition instances depending on the last seen data (only modified while updating the last data). */
+  vector<Condition*> m_dependentConditions;
+
   /** the last seen @a MasterSymbolString. */
   MasterSymbolString m_lastMasterData;
 
@@ -642,11 +1000,35 @@ class Message : public AttributedItem {
   /** the system time when the message content was last changed, 0 for never. */
   time_t m_lastChangeTime;
 
-  /** the polling order of this message (roughly number of polls * priority). */
-  unsigned int m_pollOrder;
-
   /** the system time when this message was last polled for, 0 for never. */
   time_t m_lastPollTime;
+
+  /** the @a UpdateJournal of the @a MessageMap this message is stored in, or nullptr. */
+  UpdateJournal* m_updateJournal;
+
+  /** the @a MessageHistory instances to record the stored data in (in possession of a @a HistoryStore), or nullptr. */
+  const vector<MessageHistory*>* m_histories;
+
+  /** the sequence counter of the last seen data (odd while being modified, increased by two per modification). */
+  atomic<uint32_t> m_lastDataSequence;
+
+  /** the sequence number of the last seen data the entries in @a m_decodeCache were decoded from. */
+  mutable uint32_t m_decodeCacheSequence;
+
+  /** the cached output of @a decodeLastData() for all fields by output format and leading separator. */
+  mutable map<OutputFormat, pair<result_t, string>> m_decodeCache;
+
+  /** the @a Mutex for accessing @a m_decodeCache and @a m_decodeCacheSequence of all instances. */
+  static Mutex s_decodeCacheMutex;
+
+  /** the number of times reading the last seen data had to be repeated due to a concurrent modification. */
+  static atomic<size_t> s_lastDataRetries;
+
+  /** the number of times the last seen data was decoded. */
+  static SharedCounter s_decodeCalls;
+
+  /** the time spent for decoding the last seen data in nanoseconds. */
+  static SharedCounter s_decodeNanos;
 };
 
 
@@ -715,6 +1097,15 @@ class ChainedMessage : public Message {
   // @copydoc
   result_t storeLastData(size_t index, const SlaveSymbolString& data) override;
 
+  // @copydoc
+  void saveState(MessageState* state) const override;
+
+  // @copydoc
+  void restoreState(const MessageState& state) override;
+
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
   /**
    * Combine all last stored data.
    * @return the result code.
@@ -751,63 +1142,145 @@ class ChainedMessage : public Message {
 
 
 /**
- * A function that compares the weighted poll priority of two @a Message instances.
+ * An entry in the @a PollScheduler.
  */
-struct compareMessagePriority : binary_function<Message*, Message*, bool> {
-  /**
-   * Compare the weighted poll priority of the two @a Message instances.
-   * @param x the first @a Message.
-   * @param y the second @a Message.
-   * @return whether @a x is smaller than @a y with regard to their weighted poll priority.
-   */
-  bool operator() (Message* x, Message* y) const { return x->isLessPollWeight(y); }
+struct PollEntry {
+  /** the system time when the @a Message is due for polling. */
+  time_t m_due;
+
+  /** the sequence number for ordering entries with the same due time. */
+  uint64_t m_sequence;
+
+  /** the @a Message to poll. */
+  Message* m_message;
 };
 
 
 /**
- * Helper class extending @a priority_queue to hold distinct values only.
+ * Earliest deadline first scheduler for the @a Message instances to poll.
+ * Each @a Message gets a target interval derived from its poll priority, the poll interval, and the priorities of
+ * all other scheduled messages (i.e. the same share of the bus as with a plain weighted round robin). Messages of
+ * the same slave are spread out and messages recently updated by other traffic are skipped.
  */
-class MessagePriorityQueue
-  : public priority_queue<Message*, vector<Message*>, compareMessagePriority> {
+class PollScheduler {
  public:
   /**
-   * Add data to the queue and ensure it is contained only once.
-   * @param __x the element to add.
+   * Construct a new instance.
    */
-  void push(const value_type& __x) {
-    for (vector<Message*>::iterator it = c.begin(); it != c.end(); it++) {
-      if (*it == __x) {
-        c.erase(it);
-        break;
-      }
-    }
-    priority_queue<Message*, vector<Message*>, compareMessagePriority>::push(__x);
+  PollScheduler() : m_pollInterval(5), m_nextSequence(0), m_weightSum(0) {}
+
+  /**
+   * Set the interval in seconds between two polls.
+   * @param pollInterval the interval in seconds between two polls.
+   */
+  void setPollInterval(unsigned int pollInterval) { m_pollInterval = pollInterval == 0 ? 1 : pollInterval; }
+
+  /**
+   * Add a @a Message to the schedule (or reschedule it if already contained).
+   * @param message the @a Message to add.
+   * @param toFront whether the @a Message shall be polled as soon as possible.
+   * @param now the current system time.
+   */
+  void add(Message* message, bool toFront, time_t now);
+
+  /**
+   * Remove a @a Message from the schedule.
+   * @param message the @a Message to remove.
+   */
+  void remove(const Message* message);
+
+  /**
+   * Remove all entries.
+   */
+  void clear() { m_entries.clear(); }
+
+  /**
+   * Return the approximate number of bytes allocated by the scheduler.
+   * @return the approximate number of bytes allocated by the scheduler.
+   */
+  size_t getMemorySize() const { return m_entries.capacity()*sizeof(PollEntry); }
+
+  /**
+   * Exchange all entries with those of another instance (keeping the poll interval).
+   * @param other the other @a PollScheduler.
+   */
+  void swapEntries(PollScheduler* other) {
+    m_entries.swap(other->m_entries);
+    std::swap(m_nextSequence, other->m_nextSequence);
+    std::swap(m_weightSum, other->m_weightSum);
   }
+
   /**
-   * Remove data from the queue.
-   * @param __x the element to remove.
+   * Get the number of scheduled @a Message instances.
+   * @return the number of scheduled @a Message instances.
    */
-  void remove(const value_type& __x) {
-    for (vector<Message*>::iterator it = c.begin(); it != c.end(); it++) {
-      if (*it == __x) {
-        c.erase(it);
-        break;
-      }
-    }
+  size_t size() const { return m_entries.size(); }
+
+  /**
+   * Return whether no @a Message is scheduled.
+   * @return whether no @a Message is scheduled.
+   */
+  bool empty() const { return m_entries.empty(); }
+
+  /**
+   * Get the target interval between two polls of the @a Message.
+   * @param message the @a Message.
+   * @return the target interval in seconds.
+   */
+  time_t getTargetInterval(const Message* message) const;
+
+  /**
+   * Get the next @a Message to poll and reschedule it.
+   * Only the entry with the earliest deadline is checked, so that a skipped entry leaves the turn to the next call.
+   * @param now the current system time.
+   * @return the @a Message with the earliest deadline if due and not recently updated by other traffic, or nullptr.
+   */
+  Message* getNext(time_t now);
+
+
+ private:
+  /**
+   * Compare two @a PollEntry instances for the heap (earliest deadline on top).
+   * @param x the first @a PollEntry.
+   * @param y the second @a PollEntry.
+   * @return true if @a x is due after @a y.
+   */
+  static bool isLater(const PollEntry& x, const PollEntry& y) {
+    return x.m_due > y.m_due || (x.m_due == y.m_due && x.m_sequence > y.m_sequence);
   }
+
+  /**
+   * Push a new entry to the heap.
+   * @param message the @a Message to push.
+   * @param due the system time when the @a Message is due.
+   */
+  void push(Message* message, time_t due);
+
+  /** the interval in seconds between two polls. */
+  unsigned int m_pollInterval;
+
+  /** the sequence number of the next pushed entry. */
+  uint64_t m_nextSequence;
+
+  /** the sum of the reciprocal poll priorities of all entries (updated on each @a getNext). */
+  double m_weightSum;
+
+  /** the heap of @a PollEntry instances. */
+  vector<PollEntry> m_entries;
 };
 
 
 /**
- * An abstract condition based on the value of one or more @a Message instances.
+ * An abstract condition based on the value of one or more @a Message instances (allocated from the @a Arena of the
+ * current @a ArenaScope).
  */
-class Condition {
+class Condition : public ArenaObject {
  public:
   /**
    * Construct a new instance.
    */
   Condition()
-    : m_lastCheckTime(0), m_isTrue(false) { }
+    : m_dirty(true), m_isTrue(false) { }
 
   /**
    * Destructor.
@@ -839,6 +1312,12 @@ class Condition {
    */
   virtual void dump(bool matched, ostream* output) const = 0;
 
+  /**
+   * Add the approximate memory used by this instance to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  virtual void addMemoryUsage(MemoryUsage* usage) const = 0;
+
   /**
    * Combine this condition with another instance using a logical and.
    * @param other the @a Condition to combine with.
@@ -862,13 +1341,24 @@ class Condition {
    */
   virtual bool isTrue() = 0;
 
+  /**
+   * Add the resolved @a Message instances this condition depends on.
+   * @param messages the @a vector to add the @a Message instances to.
+   */
+  virtual void getDependencies(vector<Message*>* messages) const = 0;
+
+  /**
+   * Mark the cached result as outdated (called when the data of a @a Message this condition depends on changed).
+   */
+  void invalidate() { m_dirty.store(true, std::memory_order_release); }
+
 
  protected:
-  /** the system time when the condition was last checked, 0 for never. */
-  time_t m_lastCheckTime;
+  /** whether the cached result in @a m_isTrue is outdated and needs to be re-evaluated. */
+  atomic<bool> m_dirty;
 
-  /** whether the condition was @a true during the last check. */
-  bool m_isTrue;
+  /** whether the condition was @a true during the last evaluation. */
+  atomic<bool> m_isTrue;
 };
 
 
@@ -906,6 +1396,9 @@ class SimpleCondition : public Condition {
   // @copydoc
   void dump(bool matched, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
   // @copydoc
   CombinedCondition* combineAnd(Condition* other) override;
 
@@ -916,6 +1409,9 @@ class SimpleCondition : public Condition {
   // @copydoc
   bool isTrue() override;
 
+  // @copydoc
+  void getDependencies(vector<Message*>* messages) const override;
+
   /**
    * Return whether the condition is based on a numeric value.
    * @return whether the condition is based on a numeric value.
@@ -993,6 +1489,9 @@ class SimpleNumericCondition : public SimpleCondition {
    */
   virtual ~SimpleNumericCondition() {}
 
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
 
  protected:
   // @copydoc
@@ -1031,6 +1530,9 @@ class SimpleStringCondition : public SimpleCondition {
    */
   virtual ~SimpleStringCondition() {}
 
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
   // @copydoc
   bool isNumeric() const override { return false; }
 
@@ -1055,7 +1557,7 @@ class CombinedCondition : public Condition {
    * Construct a new instance.
    */
   CombinedCondition()
-    : Condition() { }
+    : Condition(), m_dependenciesAdded(false) { }
 
   /**
    * Destructor.
@@ -1065,6 +1567,9 @@ class CombinedCondition : public Condition {
   // @copydoc
   void dump(bool matched, ostream* output) const override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
   // @copydoc
   CombinedCondition* combineAnd(Condition* other) override { m_conditions.push_back(other); return this; }
 
@@ -1075,17 +1580,24 @@ class CombinedCondition : public Condition {
   // @copydoc
   bool isTrue() override;
 
+  // @copydoc
+  void getDependencies(vector<Message*>* messages) const override;
+
 
  private:
   /** the @a Condition instances used. */
   vector<Condition*> m_conditions;
+
+  /** whether this instance was added as dependent @a Condition to all @a Message instances it depends on. */
+  bool m_dependenciesAdded;
 };
 
 
 /**
- * An abstract instruction based on the value of one or more @a Message instances.
+ * An abstract instruction based on the value of one or more @a Message instances (allocated from the @a Arena of the
+ * current @a ArenaScope).
  */
-class Instruction {
+class Instruction : public ArenaObject {
  public:
   /**
    * Construct a new instance.
@@ -1144,6 +1656,12 @@ class Instruction {
    */
   virtual result_t execute(MessageMap* messages, ostringstream* log) = 0;
 
+  /**
+   * Add the approximate memory used by this instance to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  virtual void addMemoryUsage(MemoryUsage* usage) const;
+
 
  protected:
   /** the @a Condition this instruction requires, or null. */
@@ -1183,6 +1701,9 @@ class LoadInstruction : public Instruction {
   // @copydoc
   result_t execute(MessageMap* messages, ostringstream* log) override;
 
+  // @copydoc
+  void addMemoryUsage(MemoryUsage* usage) const override;
+
 
  private:
   /** the relative name of the file to load. */
@@ -1209,8 +1730,29 @@ class LoadedFileInfo {
 };
 
 
+/**
+ * Helper class for a @a Message or @a Instruction parsed by a staging @a MessageMap.
+ */
+class StagedEntry {
+ public:
+  /** the line number in the file. */
+  unsigned int m_lineNo;
+
+  /** the parsed @a Message, or nullptr. */
+  Message* m_message;
+
+  /** the parsed @a Instruction, or nullptr. */
+  Instruction* m_instruction;
+
+  /** whether to replace an already existing @a Message. */
+  bool m_replace;
+};
+
+
 /**
  * Holds a map of all known @a Message instances.
+ * The @a Message, @a DataField, @a Condition, and @a Instruction instances read from the configuration are
+ * allocated from an @a Arena kept together with them, so that they are freed at once with the generation.
  */
 class MessageMap : public MappedFileReader {
  public:
@@ -1222,16 +1764,24 @@ class MessageMap : public MappedFileReader {
    */
   explicit MessageMap(bool addAll = false, const string& preferLanguage = "", bool deleteData = true)
   : MappedFileReader::MappedFileReader(true),
-    m_addAll(addAll), m_additionalScanMessages(false), m_maxIdLength(0), m_maxBroadcastIdLength(0),
-    m_messageCount(0), m_conditionalMessageCount(0), m_passiveMessageCount(0) {
+    m_addAll(addAll), m_staging(false), m_additionalScanMessages(false), m_maxIdLength(0), m_maxBroadcastIdLength(0),
+    m_messageCount(0), m_conditionalMessageCount(0), m_passiveMessageCount(0), m_restoredStates(0),
+    m_stateFile(nullptr), m_historyStore(nullptr), m_generation(0), m_stateMatchGeneration(0), m_epoch(1) {
     m_scanMessage = Message::createScanMessage(false, deleteData);
     m_broadcastScanMessage = Message::createScanMessage(true, false);
+    for (auto& readerEpoch : m_readerEpochs) {
+      readerEpoch = 0;
+    }
   }
 
   /**
    * Destructor.
    */
   virtual ~MessageMap() {
+    for (const auto& it : m_retired) {
+      delete it.second;
+    }
+    m_retired.clear();
     clear();
     if (m_scanMessage) {
       delete m_scanMessage;
@@ -1290,6 +1840,128 @@ class MessageMap : public MappedFileReader {
   result_t addFromFile(const string& filename, unsigned int lineNo, map<string, string>* row,
       vector< map<string, string> >* subRows, string* errorDescription, bool replace) override;
 
+  /**
+   * Save the state of all @a Message instances with seen data in order to restore it when an identical definition
+   * is added again later on (e.g. after a reload of the configuration files).
+   * @return the number of saved @a MessageState instances.
+   */
+  size_t retainStates();
+
+  /**
+   * Get the number of @a Message instances restored from a @a MessageState saved by @a retainStates().
+   * @return the number of restored @a Message instances.
+   */
+  size_t getRestoredStates() const { return m_restoredStates; }
+
+  /**
+   * Discard the @a MessageState instances saved by @a retainStates() that were not restored (to be called once
+   * the configuration files were loaded again, so that they are not kept forever).
+   * @return the number of discarded @a MessageState instances.
+   */
+  size_t discardRetainedStates();
+
+  /**
+   * Set the @a StateFile to restore the state of the stored and of each further added @a Message instance from.
+   * @param stateFile the @a StateFile (remains in possession of the caller), or nullptr.
+   * @return the number of @a Message instances restored from the @a StateFile right away.
+   */
+  size_t setStateFile(StateFile* stateFile);
+
+  /**
+   * Set the @a HistoryStore to record the data of the stored and of each further added @a Message instance in.
+   * @param historyStore the @a HistoryStore (remains in possession of the caller), or nullptr.
+   * @return the number of @a Message instances recording their data.
+   */
+  size_t setHistoryStore(const HistoryStore* historyStore);
+
+  /**
+   * Store the state of all @a Message instances with seen data in the @a StateFile for the next write.
+   * @param stateFile the @a StateFile to store to.
+   * @return the number of stored @a Message instances.
+   */
+  size_t storeStates(StateFile* stateFile);
+
+  /**
+   * Get the generation of the stored @a Message instances that is increased whenever instances are removed (e.g.
+   * for invalidating data derived from @a Message pointers).
+   * @return the generation of the stored @a Message instances.
+   */
+  size_t getGeneration() const { return m_generation; }
+
+  /**
+   * Create a new instance for parsing a single file independently from this one (e.g. in a separate thread) that
+   * only stages the parsed @a Message and @a Instruction instances for @a mergeStaged() instead of adding them.
+   * Note: the templates have to be available before and the file may not have been loaded into this instance before.
+   * @return the new staging @a MessageMap (to be freed by the caller).
+   */
+  MessageMap* createStaging() const;
+
+  /**
+   * Merge everything parsed by a staging @a MessageMap from @a createStaging() into this instance in the order of
+   * parsing, so that duplicates and replacements are treated exactly as if the file was read by this instance.
+   * @param staging the staging @a MessageMap (emptied afterwards).
+   * @param filename the name of the staged file.
+   * @param result the result code of reading the staged file.
+   * @param verbose whether to verbosely log problems.
+   * @param errorDescription the error description of reading the staged file, replaced in case of a merge error.
+   * @return the first merge error, or @a result if everything was merged.
+   */
+  result_t mergeStaged(MessageMap* staging, const string& filename, result_t result, bool verbose,
+      string* errorDescription);
+
+  /**
+   * Create a new empty instance with the same settings for building a complete replacement of the definitions of
+   * this instance (e.g. in a separate thread) to be passed to @a swap() afterwards.
+   * @return the new @a MessageMap (to be passed to @a swap() or freed by the caller).
+   */
+  MessageMap* createReplacement() const;
+
+  /**
+   * Determine the @a Message instances of the current instance with the same key and an identical definition for
+   * carrying over their last seen data in @a swap() (to be called on the replacement without holding the lock).
+   * @param current the current @a MessageMap to be replaced by this instance.
+   */
+  void matchStates(const MessageMap* current);
+
+  /**
+   * Swap in all definitions of a replacement from @a createReplacement() while carrying over the last seen data of
+   * the @a Message instances matched by @a matchStates(), and retire the previous definitions until no registered
+   * reader uses them anymore (see @a reclaimRetired()).
+   * @param replacement the replacement @a MessageMap (owned by this instance afterwards).
+   * @return the number of @a Message instances with carried over data.
+   */
+  size_t swap(MessageMap* replacement);
+
+  /**
+   * Register the calling thread as reader using @a Message instances without holding the lock, so that retired
+   * definitions are kept until it passed a quiescent state.
+   * @return the reader slot for @a passQuiescentState() and @a unregisterReader(), or @a MESSAGE_MAP_READERS if
+   * none is available.
+   */
+  size_t registerReader();
+
+  /**
+   * Unregister a reader from @a registerReader().
+   * @param slot the reader slot.
+   */
+  void unregisterReader(size_t slot);
+
+  /**
+   * Mark a reader from @a registerReader() as no longer using any @a Message instance obtained before.
+   * @param slot the reader slot.
+   */
+  void passQuiescentState(size_t slot) {
+    if (slot < MESSAGE_MAP_READERS) {
+      m_readerEpochs[slot].store(m_epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+  }
+
+  /**
+   * Free the definitions retired by @a swap() as soon as all registered readers passed a quiescent state.
+   * @return the number of remaining retired replacements.
+   */
+  size_t reclaimRetired();
+
   /**
    * Get the scan @a Message instance for the specified address.
    * @param dstAddress the destination address, or @a SYN for the base scan @a Message.
@@ -1410,6 +2082,23 @@ class MessageMap : public MappedFileReader {
     bool completeMatch, bool withRead, bool withWrite, bool withPassive, bool includeEmptyLevel, bool onlyAvailable,
     time_t since, time_t until, bool changedSince, deque<Message*>* messages) const;
 
+  /**
+   * Get the cursor for retrieving all @a Message updates from now on via @a findUpdates().
+   * @return the cursor (sequence number of the next update to be recorded).
+   */
+  uint64_t getUpdateCursor() const { return m_updateJournal.getNextSequence(); }
+
+  /**
+   * Find all available @a Message instances with a particular destination that were updated since the cursor.
+   * @param levels the access levels to match, or "*" for any.
+   * @param changedOnly true to include only messages with changed data, false for all updated ones.
+   * @param cursor the cursor from the previous call or from @a getUpdateCursor(), updated to the current position.
+   * @param messages the @a deque to which to add the found @a Message instances (each only once).
+   * @return true on success, false if older updates got lost since the cursor (use @a findAll() with a time range
+   * instead).
+   */
+  bool findUpdates(const string& levels, bool changedOnly, uint64_t* cursor, deque<Message*>* messages) const;
+
   /**
    * Find the @a Message instance for the specified master data.
    * @param master the @a MasterSymbolString for identifying the @a Message.
@@ -1423,7 +2112,23 @@ class MessageMap : public MappedFileReader {
    * Note: the caller may not free the returned instance.
    */
   Message* find(const MasterSymbolString& master, bool anyDestination = false, bool withRead = true,
-      bool withWrite = true, bool withPassive = true, bool onlyAvailable = true) const;
+      bool withWrite = true, bool withPassive = true, bool onlyAvailable = true) const {
+    Message* message = findByMaster(master, anyDestination, withRead, withWrite, withPassive, onlyAvailable);
+    (message ? s_findHits : s_findMisses).add();
+    return message;
+  }
+
+  /**
+   * Return the number of @a find() calls (by name or master data) of any instance that found a @a Message.
+   * @return the number of @a find() hits.
+   */
+  static uint64_t getFindHits() { return s_findHits.get(); }
+
+  /**
+   * Return the number of @a find() calls of any instance that did not find a @a Message.
+   * @return the number of @a find() misses.
+   */
+  static uint64_t getFindMisses() { return s_findMisses.get(); }
 
   /**
    * Invalidate cached data of the @a Message and all other instances with a matching name key.
@@ -1448,14 +2153,30 @@ class MessageMap : public MappedFileReader {
   bool decodeCircuit(const string& circuit, OutputFormat outputFormat, ostringstream* output) const;
 
   /**
-   * Lock this instance against simultaneous modifying access.
+   * Lock this instance against simultaneous modifying access (exclusive and recursive).
    */
-  void lock() { m_mutex.lock(); }
+  void lock() { m_accessMutex.lock(); }
 
   /**
    * Unlock this instance against simultaneous modifying access.
    */
-  void unlock() { m_mutex.unlock(); }
+  void unlock() { m_accessMutex.unlock(); }
+
+  /**
+   * Lock this instance for reading access that may happen at the same time in several threads.
+   */
+  void lockShared() const { m_accessMutex.lockShared(); }
+
+  /**
+   * Unlock this instance from reading access.
+   */
+  void unlockShared() const { m_accessMutex.unlockShared(); }
+
+  /**
+   * Return the number of times a thread had to wait for getting access via @a lock() or @a lockShared().
+   * @return the number of times a thread had to wait for getting access.
+   */
+  size_t getLockContentions() const { return m_accessMutex.getContentions(); }
 
   /**
    * Removes all @a Message instances.
@@ -1487,7 +2208,13 @@ class MessageMap : public MappedFileReader {
   size_t sizePoll() const { return m_pollMessages.size(); }
 
   /**
-   * Get the next @a Message to poll.
+   * Set the interval in seconds between two polls used for deriving the target poll interval of each @a Message.
+   * @param pollInterval the interval in seconds between two polls.
+   */
+  void setPollInterval(unsigned int pollInterval) { m_pollMessages.setPollInterval(pollInterval); }
+
+  /**
+   * Get the next @a Message to poll (earliest deadline first, skipping recently updated messages).
    * @return the next @a Message to poll, or nullptr.
    * Note: the caller may not free the returned instance.
    */
@@ -1512,14 +2239,46 @@ class MessageMap : public MappedFileReader {
    */
   void dump(bool withConditions, ostream* output) const;
 
+  /**
+   * Add the approximate memory used by the messages, conditions, and instructions to the @a MemoryUsage.
+   * Note: the caller has to hold the shared lock.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  void addMemoryUsage(MemoryUsage* usage) const;
+
 
  private:
+  /**
+   * Find the @a Message instance for the specified master data (see @a find()).
+   * @param master the @a MasterSymbolString for identifying the @a Message.
+   * @param anyDestination true to only return messages without a particular destination.
+   * @param withRead true to include read messages.
+   * @param withWrite true to include write messages.
+   * @param withPassive true to include passive messages.
+   * @param onlyAvailable true to include only available messages.
+   * @return the @a Message instance, or nullptr.
+   */
+  Message* findByMaster(const MasterSymbolString& master, bool anyDestination, bool withRead, bool withWrite,
+      bool withPassive, bool onlyAvailable) const;
+
   /** empty vector for @a getLoadedFiles(). */
   static vector<string> s_noFiles;
 
+  /** the number of @a find() calls that found a @a Message. */
+  static SharedCounter s_findHits;
+
+  /** the number of @a find() calls that did not find a @a Message. */
+  static SharedCounter s_findMisses;
+
   /** whether to add all messages, even if duplicate. */
   const bool m_addAll;
 
+  /** whether this is a staging instance created by @a createStaging(). */
+  bool m_staging;
+
+  /** the @a StagedEntry list in order of parsing (only for staging instances). */
+  vector<StagedEntry> m_stagedEntries;
+
   /** the @a Message instance used for scanning a slave. */
   Message* m_scanMessage;
 
@@ -1550,14 +2309,20 @@ class MessageMap : public MappedFileReader {
   /** the number of distinct passive @a Message instances stored in @a m_messagesByKey. */
   size_t m_passiveMessageCount;
 
+  /** the @a Arena for the instances read from the configuration (moved along with them). */
+  Arena m_arena;
+
   /** the known @a Message instances by lowercase circuit (optional), name, and type. */
   map<string, vector<Message*> > m_messagesByName;
 
   /** the known @a Message instances by key. */
   map<uint64_t, vector<Message*> > m_messagesByKey;
 
-  /** the known @a Message instances to poll, by priority. */
-  MessagePriorityQueue m_pollMessages;
+  /** the index of @a m_messagesByKey for fast lookup. */
+  MessageKeyIndex m_messageIndex;
+
+  /** the @a PollScheduler for the known @a Message instances to poll. */
+  PollScheduler m_pollMessages;
 
   /** the @a Condition instances by filename and condition name. */
   map<string, Condition*> m_conditions;
@@ -1567,6 +2332,45 @@ class MessageMap : public MappedFileReader {
 
   /** additional attributes by circuit name. */
   map<string, AttributedItem*> m_circuitData;
+
+  /** the @a UpdateJournal of all @a Message instances stored by name. */
+  UpdateJournal m_updateJournal;
+
+  /** the @a MessageState instances saved by @a retainStates() by definition key. */
+  map<string, MessageState> m_retainedStates;
+
+  /** the number of @a Message instances restored from @a m_retainedStates. */
+  size_t m_restoredStates;
+
+  /** the @a StateFile to restore the state of added @a Message instances from, or nullptr. */
+  StateFile* m_stateFile;
+
+  /** the @a HistoryStore to record the data of the selected @a Message instances in, or nullptr. */
+  const HistoryStore* m_historyStore;
+
+  /** the generation of the stored @a Message instances (increased whenever instances are removed). */
+  atomic<size_t> m_generation;
+
+  /** the @a SharedMutex for reading access during modification of the stored instances. */
+  mutable SharedMutex m_accessMutex;
+
+  /** the matched pairs of @a Message instances (of this and the current instance) from @a matchStates(). */
+  vector<pair<Message*, const Message*>> m_stateMatches;
+
+  /** the generation of the current instance @a m_stateMatches was determined for. */
+  size_t m_stateMatchGeneration;
+
+  /** the epoch increased by @a swap(). */
+  atomic<uint64_t> m_epoch;
+
+  /** the epoch last seen by the registered readers in @a passQuiescentState(), or 0 for unused slots. */
+  atomic<uint64_t> m_readerEpochs[MESSAGE_MAP_READERS];
+
+  /** the previous definitions retired by @a swap() with the epoch from which on they are no longer in use. */
+  vector<pair<uint64_t, MessageMap*>> m_retired;
+
+  /** the @a Mutex for accessing @a m_retired. */
+  Mutex m_retiredMutex;
 };
 
 }  // namespace ebusd
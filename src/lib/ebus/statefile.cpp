@@ -0,0 +1,328 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/ebus/statefile.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ebusd {
+
+using std::ofstream;
+using std::ostringstream;
+
+/** the magic bytes at the start of a @a StateFile. */
+static const char STATE_MAGIC[8] = {'e', 'b', 'u', 's', 'd', 's', 't', 'a'};
+
+/** the version of the @a StateFile format (to be increased with each format change). */
+#define STATE_VERSION 1
+
+/**
+ * Write a @a SymbolString as length prefixed string to the @a ostream.
+ * @param value the @a SymbolString to write.
+ * @param stream the @a ostream to write to.
+ */
+static void writeStateSymbols(const SymbolString& value, ostream* stream) {
+  string str;
+  str.reserve(value.size());
+  for (size_t pos = 0; pos < value.size(); pos++) {
+    str.push_back(static_cast<char>(value[pos]));
+  }
+  writeSnapshotString(str, stream);
+}
+
+/**
+ * Read a length prefixed string into a @a SymbolString.
+ * @param reader the @a SnapshotReader to read from.
+ * @param value the @a SymbolString to fill.
+ * @return true on success, false if not enough data is left.
+ */
+static bool readStateSymbols(SnapshotReader* reader, SymbolString* value) {
+  string str;
+  if (!reader->read(&str)) {
+    return false;
+  }
+  value->clear();
+  for (const auto ch : str) {
+    value->push_back(static_cast<symbol_t>(ch));
+  }
+  return true;
+}
+
+/**
+ * Read a system time.
+ * @param reader the @a SnapshotReader to read from.
+ * @param value the variable in which to store the system time.
+ * @return true on success, false if not enough data is left.
+ */
+static bool readStateTime(SnapshotReader* reader, time_t* value) {
+  int64_t time;
+  if (!reader->read(&time)) {
+    return false;
+  }
+  *value = static_cast<time_t>(time);
+  return true;
+}
+
+/**
+ * Decode an encoded @a MessageState.
+ * @param data the encoded data.
+ * @param length the length of the encoded data.
+ * @param state the @a MessageState to fill.
+ * @return true on success, false if the encoded data is invalid.
+ */
+static bool decodeState(const char* data, size_t length, MessageState* state) {
+  SnapshotReader reader(data, length);
+  uint32_t partCount;
+  if (!readStateTime(&reader, &state->m_lastUpdateTime) || !readStateTime(&reader, &state->m_lastChangeTime)
+      || !readStateTime(&reader, &state->m_lastPollTime)
+      || !readStateSymbols(&reader, &state->m_lastMasterData) || !readStateSymbols(&reader, &state->m_lastSlaveData)
+      || !reader.read(&partCount) || !reader.canHold(partCount, 2*sizeof(uint32_t)+2*sizeof(int64_t))) {
+    return false;
+  }
+  state->clearParts();
+  for (uint32_t part = 0; part < partCount; part++) {
+    MasterSymbolString* master = new MasterSymbolString();
+    state->m_lastMasterDatas.push_back(master);
+    SlaveSymbolString* slave = new SlaveSymbolString();
+    state->m_lastSlaveDatas.push_back(slave);
+    time_t masterTime, slaveTime;
+    if (!readStateSymbols(&reader, master) || !readStateSymbols(&reader, slave)
+        || !readStateTime(&reader, &masterTime) || !readStateTime(&reader, &slaveTime)) {
+      return false;
+    }
+    state->m_lastMasterUpdateTimes.push_back(masterTime);
+    state->m_lastSlaveUpdateTimes.push_back(slaveTime);
+  }
+  return true;
+}
+
+StateFile::~StateFile() {
+  unmap();
+}
+
+void StateFile::unmap() {
+  m_mappedStates.clear();
+  if (m_mapped) {
+    munmap(m_mapped, m_length);
+    m_mapped = nullptr;
+    m_length = 0;
+  }
+}
+
+result_t StateFile::open(const string& filename) {
+  m_mutex.lock();
+  unmap();
+  m_filename = filename;
+  m_storedStates.clear();
+  m_values.clear();
+  m_restoredCount = 0;
+  m_mutex.unlock();
+  if (filename.empty()) {
+    return RESULT_OK;
+  }
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return RESULT_ERR_NOTFOUND;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return RESULT_ERR_NOTFOUND;
+  }
+  size_t length = static_cast<size_t>(st.st_size);
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return RESULT_ERR_DEVICE;
+  }
+  SnapshotReader reader(reinterpret_cast<const char*>(mapped), length);
+  char magic[sizeof(STATE_MAGIC)];
+  uint32_t version = 0, stateCount = 0, valueCount = 0;
+  bool valid = reader.read(&magic) && memcmp(magic, STATE_MAGIC, sizeof(magic)) == 0
+    && reader.read(&version) && version == STATE_VERSION && reader.read(&stateCount)
+    && reader.canHold(stateCount, 2*sizeof(uint32_t));
+  map<string, pair<const char*, uint32_t>> states;
+  for (uint32_t index = 0; valid && index < stateCount; index++) {
+    string key;
+    uint32_t stateLength;
+    valid = reader.read(&key) && reader.read(&stateLength);
+    if (valid) {
+      states[key] = pair<const char*, uint32_t>(reader.getData(), stateLength);
+      valid = reader.skip(stateLength);
+    }
+  }
+  map<string, vector<string>> values;
+  valid = valid && reader.read(&valueCount) && reader.canHold(valueCount, 2*sizeof(uint32_t));
+  for (uint32_t index = 0; valid && index < valueCount; index++) {
+    string name;
+    uint32_t count;
+    valid = reader.read(&name) && reader.read(&count) && reader.canHold(count, sizeof(uint32_t));
+    vector<string>& entries = values[name];
+    for (uint32_t entry = 0; valid && entry < count; entry++) {
+      string value;
+      valid = reader.read(&value);
+      entries.push_back(value);
+    }
+  }
+  if (!valid) {
+    munmap(mapped, length);
+    return RESULT_ERR_INVALID_ARG;
+  }
+  m_mutex.lock();
+  m_mapped = mapped;
+  m_length = length;
+  m_mappedStates.swap(states);
+  m_values.swap(values);
+  m_mutex.unlock();
+  return RESULT_OK;
+}
+
+bool StateFile::restore(Message* message, const string& definitionKey) {
+  m_mutex.lock();
+  const auto it = m_mappedStates.find(definitionKey);
+  if (it == m_mappedStates.end()) {
+    m_mutex.unlock();
+    return false;
+  }
+  MessageState state;
+  bool restored = decodeState(it->second.first, it->second.second, &state);
+  m_mappedStates.erase(it);
+  if (restored) {
+    m_restoredCount++;
+  }
+  m_mutex.unlock();
+  if (restored) {
+    message->restoreState(state);
+  }
+  return restored;
+}
+
+size_t StateFile::getStoredCount() {
+  m_mutex.lock();
+  size_t count = m_mappedStates.size();
+  m_mutex.unlock();
+  return count;
+}
+
+bool StateFile::getValues(const string& name, vector<string>* values) {
+  m_mutex.lock();
+  const auto it = m_values.find(name);
+  bool found = it != m_values.end();
+  if (found) {
+    *values = it->second;
+  }
+  m_mutex.unlock();
+  return found;
+}
+
+void StateFile::setValues(const string& name, const vector<string>& values) {
+  m_mutex.lock();
+  if (values.empty()) {
+    m_values.erase(name);
+  } else {
+    m_values[name] = values;
+  }
+  m_mutex.unlock();
+}
+
+void StateFile::store(const Message* message, const string& definitionKey) {
+  MessageState state;
+  message->saveState(&state);
+  ostringstream stream;
+  writeSnapshotValue(static_cast<int64_t>(state.m_lastUpdateTime), &stream);
+  writeSnapshotValue(static_cast<int64_t>(state.m_lastChangeTime), &stream);
+  writeSnapshotValue(static_cast<int64_t>(state.m_lastPollTime), &stream);
+  writeStateSymbols(state.m_lastMasterData, &stream);
+  writeStateSymbols(state.m_lastSlaveData, &stream);
+  writeSnapshotValue(static_cast<uint32_t>(state.m_lastMasterDatas.size()), &stream);
+  for (size_t part = 0; part < state.m_lastMasterDatas.size(); part++) {
+    writeStateSymbols(*state.m_lastMasterDatas[part], &stream);
+    writeStateSymbols(*state.m_lastSlaveDatas[part], &stream);
+    writeSnapshotValue(static_cast<int64_t>(state.m_lastMasterUpdateTimes[part]), &stream);
+    writeSnapshotValue(static_cast<int64_t>(state.m_lastSlaveUpdateTimes[part]), &stream);
+  }
+  m_mutex.lock();
+  m_storedStates[definitionKey] = stream.str();
+  m_mutex.unlock();
+}
+
+result_t StateFile::write() {
+  m_mutex.lock();
+  if (m_filename.empty()) {
+    m_mutex.unlock();
+    return RESULT_OK;
+  }
+  // keep the states not restored yet, e.g. for participants whose scan config file is not loaded yet
+  int64_t minTime = static_cast<int64_t>(time(nullptr)) - STATE_MAX_AGE;
+  map<string, pair<const char*, uint32_t>> keepStates;
+  for (const auto& it : m_mappedStates) {
+    int64_t updateTime;
+    if (m_storedStates.find(it.first) == m_storedStates.end() && it.second.second >= sizeof(updateTime)) {
+      memcpy(&updateTime, it.second.first, sizeof(updateTime));
+      if (updateTime >= minTime) {
+        keepStates[it.first] = it.second;
+      }
+    }
+  }
+  string tmpName = m_filename + ".tmp";
+  ofstream stream(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!stream.is_open()) {
+    m_mutex.unlock();
+    return RESULT_ERR_DEVICE;
+  }
+  stream.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+  writeSnapshotValue(static_cast<uint32_t>(STATE_VERSION), &stream);
+  writeSnapshotValue(static_cast<uint32_t>(m_storedStates.size() + keepStates.size()), &stream);
+  for (const auto& it : m_storedStates) {
+    writeSnapshotString(it.first, &stream);
+    writeSnapshotString(it.second, &stream);
+  }
+  for (const auto& it : keepStates) {
+    writeSnapshotString(it.first, &stream);
+    writeSnapshotValue(it.second.second, &stream);
+    stream.write(it.second.first, it.second.second);
+  }
+  writeSnapshotValue(static_cast<uint32_t>(m_values.size()), &stream);
+  for (const auto& it : m_values) {
+    writeSnapshotString(it.first, &stream);
+    writeSnapshotValue(static_cast<uint32_t>(it.second.size()), &stream);
+    for (const auto& value : it.second) {
+      writeSnapshotString(value, &stream);
+    }
+  }
+  stream.close();
+  // the replaced file stays mapped until being closed, so the states not restored yet remain valid
+  bool success = !stream.fail() && rename(tmpName.c_str(), m_filename.c_str()) == 0;
+  if (success) {
+    m_storedStates.clear();
+  } else {
+    unlink(tmpName.c_str());
+  }
+  m_mutex.unlock();
+  return success ? RESULT_OK : RESULT_ERR_DEVICE;
+}
+
+}  // namespace ebusd
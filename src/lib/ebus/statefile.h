@@ -0,0 +1,170 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_STATEFILE_H_
+#define LIB_EBUS_STATEFILE_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lib/ebus/message.h"
+#include "lib/ebus/result.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file lib/ebus/statefile.h
+ * Classes for keeping the last seen data across a restart.
+ *
+ * The @a StateFile keeps the @a MessageState of each @a Message with seen data
+ * by definition key in a versioned binary file (in host byte order), together
+ * with further named values (e.g. scan results).
+ * The file is memory mapped when being opened and only the keys are indexed,
+ * so that the state of a @a Message is decoded only when an identical
+ * definition is actually added (e.g. after loading a scan config file).
+ */
+
+using std::string;
+using std::map;
+using std::pair;
+using std::vector;
+
+/** the maximum age in seconds of a stored state not restored since opening the file for keeping it on write. */
+#define STATE_MAX_AGE (7*24*60*60)
+
+
+/**
+ * A memory mapped binary file with the last seen data of @a Message instances and further named values.
+ */
+class StateFile {
+ public:
+  /**
+   * Constructor.
+   */
+  StateFile() : m_mapped(nullptr), m_length(0), m_restoredCount(0) {}
+
+  /**
+   * Destructor.
+   */
+  ~StateFile();
+
+  /**
+   * Set the name of the state file and map it if available.
+   * @param filename the name of the state file, or empty to disable.
+   * @return @a RESULT_OK on success, or an error code if the file is not available or invalid.
+   */
+  result_t open(const string& filename);
+
+  /**
+   * Return whether the state file is enabled.
+   * @return whether the state file is enabled.
+   */
+  bool isEnabled() const { return !m_filename.empty(); }
+
+  /**
+   * Get the name of the state file.
+   * @return the name of the state file, or empty if disabled.
+   */
+  const string& getFilename() const { return m_filename; }
+
+  /**
+   * Restore the state stored for an identical definition into the @a Message (only once per stored state).
+   * @param message the @a Message to restore.
+   * @param definitionKey the definition key of the @a Message.
+   * @return true when the state was restored.
+   */
+  bool restore(Message* message, const string& definitionKey);
+
+  /**
+   * Get the number of stored states not restored yet.
+   * @return the number of stored states not restored yet.
+   */
+  size_t getStoredCount();
+
+  /**
+   * Get the number of states restored since opening the file.
+   * @return the number of restored states.
+   */
+  size_t getRestoredCount() const { return m_restoredCount; }
+
+  /**
+   * Get a named value list.
+   * @param name the name of the values.
+   * @param values the vector to fill with the values.
+   * @return true when the values were found.
+   */
+  bool getValues(const string& name, vector<string>* values);
+
+  /**
+   * Set a named value list to write with the next @a write().
+   * @param name the name of the values.
+   * @param values the values to store, or empty to remove them.
+   */
+  void setValues(const string& name, const vector<string>& values);
+
+  /**
+   * Store the state of a @a Message to write with the next @a write().
+   * @param message the @a Message to store.
+   * @param definitionKey the definition key of the @a Message.
+   */
+  void store(const Message* message, const string& definitionKey);
+
+  /**
+   * Write the stored states together with the states not restored yet (when not older than @a STATE_MAX_AGE) and the
+   * named values to the file and clear the stored states afterwards.
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  result_t write();
+
+
+ private:
+  /**
+   * Unmap the mapped file.
+   */
+  void unmap();
+
+  /** the name of the state file, or empty if disabled. */
+  string m_filename;
+
+  /** the mapped file data, or nullptr. */
+  void* m_mapped;
+
+  /** the length of the mapped file data. */
+  size_t m_length;
+
+  /** the encoded states in the mapped file data not restored yet by definition key. */
+  map<string, pair<const char*, uint32_t>> m_mappedStates;
+
+  /** the encoded states stored by @a store() by definition key. */
+  map<string, string> m_storedStates;
+
+  /** the named value lists. */
+  map<string, vector<string>> m_values;
+
+  /** the number of states restored since opening the file. */
+  size_t m_restoredCount;
+
+  /** the @a Mutex for exclusive access. */
+  Mutex m_mutex;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_STATEFILE_H_
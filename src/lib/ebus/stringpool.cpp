@@ -0,0 +1,105 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/ebus/stringpool.h"
+
+namespace ebusd {
+
+
+/** the content of the pool (constructed on first use as static instances may already intern values). */
+struct PoolContent {
+  /** the @a Mutex for accessing the pool. */
+  Mutex mutex;
+
+  /** the interned strings with the number of references to each. */
+  unordered_map<string, size_t> strings;
+
+  /** the approximate number of bytes used by the pool for the interned strings. */
+  size_t stringBytes = 0;
+
+  /** the approximate number of bytes the values interned since the last reset would have used without interning. */
+  size_t requestedBytes = 0;
+};
+
+/**
+ * Return the content of the pool.
+ * @return the content of the pool.
+ */
+static PoolContent& getContent() {
+  static PoolContent content;
+  return content;
+}
+
+const string& StringPool::intern(const string& str) {
+  PoolContent& content = getContent();
+  content.mutex.lock();
+  size_t size = getSize(str);
+  content.requestedBytes += size;
+  auto it = content.strings.find(str);
+  if (it == content.strings.end()) {
+    it = content.strings.emplace(str, 0).first;
+    content.stringBytes += size + sizeof(size_t) + MEMORY_NODE_OVERHEAD;
+  }
+  it->second++;
+  content.mutex.unlock();
+  return it->first;
+}
+
+void StringPool::release(const string& str) {
+  PoolContent& content = getContent();
+  content.mutex.lock();
+  auto it = content.strings.find(str);
+  if (it != content.strings.end() && --it->second == 0) {
+    content.stringBytes -= getSize(it->first) + sizeof(size_t) + MEMORY_NODE_OVERHEAD;
+    content.strings.erase(it);  // invalidates str
+  }
+  content.mutex.unlock();
+}
+
+void StringPool::getStats(size_t* count, size_t* poolBytes, size_t* requestedBytes) {
+  PoolContent& content = getContent();
+  content.mutex.lock();
+  *count = content.strings.size();
+  *poolBytes = content.stringBytes;
+  *requestedBytes = content.requestedBytes;
+  content.mutex.unlock();
+}
+
+void StringPool::resetRequestedBytes() {
+  PoolContent& content = getContent();
+  content.mutex.lock();
+  content.requestedBytes = 0;
+  content.mutex.unlock();
+}
+
+void StringPool::addMemoryUsage(MemoryUsage* usage) {
+  PoolContent& content = getContent();
+  content.mutex.lock();
+  usage->add(mk_strings, content.stringBytes, content.strings.size());
+  content.mutex.unlock();
+}
+
+size_t StringPool::getSize(const string& str) {
+  return sizeof(string) + MemoryUsage::getHeapSize(str);
+}
+
+}  // namespace ebusd
@@ -0,0 +1,93 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_EBUS_STRINGPOOL_H_
+#define LIB_EBUS_STRINGPOOL_H_
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include "lib/utils/metrics.h"
+#include "lib/utils/thread.h"
+
+namespace ebusd {
+
+/** @file lib/ebus/stringpool.h
+ * Pool for sharing equal immutable strings of message definitions (names and attribute names and values).
+ */
+
+using std::string;
+using std::unordered_map;
+
+/**
+ * Pool of immutable strings shared by all users of an equal value.
+ * Interned values are reference counted: each @a intern() has to be paired with a @a release() of the returned
+ * reference, which stays valid until then, and the value is removed from the pool with its last reference (e.g. for
+ * definitions replaced by a reload). Two interned values are equal exactly when their addresses are equal.
+ * Attribute maps are not interned as a whole but by their names and values, as the combination is often unique
+ * (e.g. due to the comment).
+ */
+class StringPool {
+ public:
+  /**
+   * Return the shared instance of the string.
+   * @param str the string to intern.
+   * @return the shared immutable instance equal to the string.
+   */
+  static const string& intern(const string& str);
+
+  /**
+   * Release a reference returned by @a intern() and remove the value from the pool when it was the last one.
+   * @param str the shared instance returned by @a intern().
+   */
+  static void release(const string& str);
+
+  /**
+   * Get the memory statistics of the pool.
+   * @param count the variable in which to store the number of distinct interned values.
+   * @param poolBytes the variable in which to store the approximate number of bytes used by the pool.
+   * @param requestedBytes the variable in which to store the approximate number of bytes the values interned since the
+   * last @a resetRequestedBytes() would have used without interning.
+   */
+  static void getStats(size_t* count, size_t* poolBytes, size_t* requestedBytes);
+
+  /**
+   * Restart counting the bytes the interned values would have used without interning (e.g. on a full reload of the
+   * definitions).
+   */
+  static void resetRequestedBytes();
+
+  /**
+   * Add the interned strings to the @a MemoryUsage.
+   * @param usage the @a MemoryUsage to add to.
+   */
+  static void addMemoryUsage(MemoryUsage* usage);
+
+
+ private:
+  /**
+   * Return the approximate number of bytes used by a string.
+   * @param str the string.
+   * @return the approximate number of bytes used by the string.
+   */
+  static size_t getSize(const string& str);
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_EBUS_STRINGPOOL_H_
@@ -25,12 +25,6 @@
 
 namespace ebusd {
 
-using std::ostringstream;
-using std::nouppercase;
-using std::setw;
-using std::hex;
-using std::setfill;
-
 /**
  * CRC8 lookup table for the polynom 0x9b = x^8 + x^7 + x^4 + x^3 + x^1 + 1.
  */
@@ -99,78 +93,212 @@ int parseSignedInt(const char* str, int base, int minValue, int maxValue,
 }
 
 
+/**
+ * The CRC8 lookup tables for slicing-by-4: table[n] is @a CRC_LOOKUP_TABLE applied n+1 times, so that (due to the
+ * linearity of the CRC) four values can be added at once.
+ */
+struct CrcSlicingTables {
+  /** the lookup tables. */
+  symbol_t table[4][256];
+
+  /**
+   * Constructor.
+   */
+  CrcSlicingTables() {
+    for (unsigned int value = 0; value < 256; value++) {
+      table[0][value] = CRC_LOOKUP_TABLE[value];
+      for (unsigned int n = 1; n < 4; n++) {
+        table[n][value] = CRC_LOOKUP_TABLE[table[n-1][value]];
+      }
+    }
+  }
+};
+
+/**
+ * Return the CRC8 slicing lookup tables.
+ * @return the @a CrcSlicingTables.
+ */
+static const CrcSlicingTables& getCrcSlicingTables() {
+  static const CrcSlicingTables tables;
+  return tables;
+}
+
+/** the hex digits for formatting. */
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+/**
+ * Return the value of a hex digit.
+ * @param digit the hex digit.
+ * @return the value of the hex digit, or -1 if it is not a hex digit.
+ */
+static inline int getHexDigitValue(char digit) {
+  if (digit >= '0' && digit <= '9') {
+    return digit - '0';
+  }
+  if (digit >= 'a' && digit <= 'f') {
+    return digit - 'a' + 10;
+  }
+  if (digit >= 'A' && digit <= 'F') {
+    return digit - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Return whether a value needs to be escaped.
+ * @param value the value to check.
+ * @return true if the value is @a ESC or @a SYN.
+ */
+static inline bool needsEscape(symbol_t value) {
+  return static_cast<symbol_t>(value-ESC) <= 1;  // ESC and SYN are adjacent
+}
+
 void SymbolString::updateCrc(symbol_t value, symbol_t* crc) {
   *crc = CRC_LOOKUP_TABLE[*crc]^value;
 }
 
-result_t SymbolString::parseHex(const string& str) {
-  result_t result;
-  for (size_t i = 0; i < str.size(); i += 2) {
-    symbol_t value = (symbol_t)parseInt(str.substr(i, 2).c_str(), 16, 0, 0xff, &result);
-    if (result != RESULT_OK) {
-      return result;
-    }
-    m_data.push_back(value);
+void SymbolString::updateCrc(const symbol_t* values, size_t count, symbol_t* crc) {
+  const CrcSlicingTables& tables = getCrcSlicingTables();
+  symbol_t current = *crc;
+  size_t pos = 0;
+  for (; pos+4 <= count; pos += 4) {
+    current = tables.table[3][current] ^ tables.table[2][values[pos]] ^ tables.table[1][values[pos+1]]
+      ^ tables.table[0][values[pos+2]] ^ values[pos+3];
+  }
+  for (; pos < count; pos++) {
+    current = CRC_LOOKUP_TABLE[current]^values[pos];
   }
-  return RESULT_OK;
+  *crc = current;
 }
 
-result_t SymbolString::parseHexEscaped(const string& str) {
-  result_t result;
-  bool inEscape = false;
-  for (size_t i = 0; i < str.size(); i += 2) {
-    symbol_t value = (symbol_t)parseInt(str.substr(i, 2).c_str(), 16, 0, 0xff, &result);
-    if (result != RESULT_OK) {
-      return result;
+void SymbolString::updateCrcUnescaped(const symbol_t* values, size_t count, symbol_t* crc) {
+  const CrcSlicingTables& tables = getCrcSlicingTables();
+  symbol_t current = *crc;
+  size_t pos = 0;
+  while (pos < count) {
+    if (pos+4 <= count && !needsEscape(values[pos]) && !needsEscape(values[pos+1]) && !needsEscape(values[pos+2])
+        && !needsEscape(values[pos+3])) {
+      // none of the four values needs to be escaped
+      current = tables.table[3][current] ^ tables.table[2][values[pos]] ^ tables.table[1][values[pos+1]]
+        ^ tables.table[0][values[pos+2]] ^ values[pos+3];
+      pos += 4;
+      continue;
     }
-    if (inEscape) {
-      if (value == 0x00) {
-        m_data.push_back(ESC);
-        inEscape = false;
-      } else if (value == 0x01) {
-        m_data.push_back(SYN);
-        inEscape = false;
-      } else {
-        return RESULT_ERR_ESC;  // invalid escape sequence
-      }
-    } else if (value == ESC) {
-      inEscape = true;
+    symbol_t value = values[pos++];
+    if (value == ESC) {
+      current = tables.table[0][CRC_LOOKUP_TABLE[current]^ESC];
     } else if (value == SYN) {
-      return RESULT_ERR_ESC;  // invalid escape sequence
+      current = tables.table[0][CRC_LOOKUP_TABLE[current]^ESC]^0x01;
     } else {
-      m_data.push_back(value);
+      current = CRC_LOOKUP_TABLE[current]^value;
     }
   }
-  return inEscape ? RESULT_ERR_ESC : RESULT_OK;
+  *crc = current;
 }
 
-const string SymbolString::getStr(size_t skipFirstSymbols) const {
-  ostringstream sstr;
-  for (size_t i = 0; i < m_data.size(); i++) {
-    if (skipFirstSymbols > 0) {
-      skipFirstSymbols--;
+size_t SymbolString::escape(const symbol_t* values, size_t count, symbol_t* output) {
+  symbol_t* out = output;
+  for (size_t pos = 0; pos < count; pos++) {
+    symbol_t value = values[pos];
+    if (needsEscape(value)) {
+      *out++ = ESC;
+      *out++ = value == ESC ? 0x00 : 0x01;
     } else {
-      sstr << nouppercase << setw(2) << hex
-          << setfill('0') << static_cast<unsigned>(m_data[i]);
+      *out++ = value;
     }
   }
-  return sstr.str();
+  return static_cast<size_t>(out-output);
 }
 
-symbol_t SymbolString::calcCrc() const {
-  symbol_t crc = 0;
-  for (size_t i = 0; i < m_data.size(); i++) {
-    symbol_t value = m_data[i];
-    if (value == ESC) {
-      updateCrc(ESC, &crc);
-      updateCrc(0x00, &crc);
-    } else if (value == SYN) {
-      updateCrc(ESC, &crc);
-      updateCrc(0x01, &crc);
-    } else {
-      updateCrc(value, &crc);
+result_t SymbolString::unescape(const symbol_t* values, size_t count, symbol_t* output, size_t* written) {
+  symbol_t* out = output;
+  result_t result = RESULT_OK;
+  for (size_t pos = 0; pos < count; pos++) {
+    symbol_t value = values[pos];
+    if (!needsEscape(value)) {
+      *out++ = value;
+      continue;
+    }
+    if (value == SYN) {
+      result = RESULT_ERR_ESC;  // invalid escape sequence
+      break;
+    }
+    if (++pos >= count) {
+      result = RESULT_CONTINUE;  // escape sequence not yet complete
+      break;
+    }
+    value = values[pos];
+    if (value > 0x01) {
+      result = RESULT_ERR_ESC;  // invalid escape sequence
+      break;
     }
+    *out++ = value == 0x00 ? ESC : SYN;
   }
+  *written = static_cast<size_t>(out-output);
+  return result;
+}
+
+void SymbolString::formatHex(const symbol_t* values, size_t count, char* output) {
+  for (size_t pos = 0; pos < count; pos++) {
+    *output++ = HEX_DIGITS[values[pos] >> 4];
+    *output++ = HEX_DIGITS[values[pos] & 0x0f];
+  }
+}
+
+result_t SymbolString::parseHex(const char* str, size_t length, symbol_t* output, size_t* written) {
+  result_t result = RESULT_OK;
+  size_t count = 0;
+  for (size_t pos = 0; pos < length; pos += 2) {
+    int high = getHexDigitValue(str[pos]);
+    int low = pos+1 < length ? getHexDigitValue(str[pos+1]) : 0;
+    if (high >= 0 && low >= 0) {
+      output[count++] = (symbol_t)(pos+1 < length ? (high << 4) | low : high);
+      continue;
+    }
+    // leave the uncommon cases to the generic parser for keeping its exact semantics
+    symbol_t value = (symbol_t)parseInt(string(str+pos, pos+1 < length ? 2 : 1).c_str(), 16, 0, 0xff, &result);
+    if (result != RESULT_OK) {
+      break;
+    }
+    output[count++] = value;
+  }
+  *written = count;
+  return result;
+}
+
+result_t SymbolString::parseHex(const string& str) {
+  reserve(m_size+(str.size()+1)/2);
+  size_t written = 0;
+  result_t result = parseHex(str.data(), str.size(), m_data+m_size, &written);
+  m_size += written;
+  return result;
+}
+
+result_t SymbolString::parseHexEscaped(const string& str) {
+  SymbolString escaped;
+  result_t result = escaped.parseHex(str);
+  size_t written = 0;
+  reserve(m_size+escaped.m_size);
+  result_t unescaped = unescape(escaped.m_data, escaped.m_size, m_data+m_size, &written);
+  m_size += written;
+  if (unescaped == RESULT_ERR_ESC || (unescaped == RESULT_CONTINUE && result == RESULT_OK)) {
+    return RESULT_ERR_ESC;  // invalid escape sequence
+  }
+  return result;
+}
+
+const string SymbolString::getStr(size_t skipFirstSymbols) const {
+  if (skipFirstSymbols >= m_size) {
+    return "";
+  }
+  string ret(2*(m_size-skipFirstSymbols), '0');
+  formatHex(m_data+skipFirstSymbols, m_size-skipFirstSymbols, &ret[0]);
+  return ret;
+}
+
+symbol_t SymbolString::calcCrc() const {
+  symbol_t crc = 0;
+  updateCrcUnescaped(m_data, m_size, &crc);
   return crc;
 }
 
@@ -86,6 +86,12 @@ typedef unsigned char symbol_t;
 /** the broadcast destination address. */
 #define BROADCAST 0xFE
 
+/** the number of symbols a @a SymbolString is able to hold without allocating heap memory. */
+#define SYMBOL_STRING_INLINE_SIZE 32
+
+/** the maximum number of symbols of a master or slave part (header, 255 data bytes, and CRC). */
+#define SYMBOL_STRING_MAX_SIZE 261
+
 /**
  * Parse an unsigned int value.
  * @param str the string to parse.
@@ -121,9 +127,54 @@ class SymbolString {
    * Creates a new empty instance.
    * @param isMaster whether this instance if for the master part.
    */
-  explicit SymbolString(bool isMaster = false) { m_isMaster = isMaster; }
+  explicit SymbolString(bool isMaster = false)
+    : m_data(m_inline), m_size(0), m_capacity(SYMBOL_STRING_INLINE_SIZE), m_isMaster(isMaster) {}
+
+  /**
+   * Move constructor.
+   * @param str the @a SymbolString to move from (left empty).
+   */
+  SymbolString(SymbolString&& str)
+    : m_data(m_inline), m_size(0), m_capacity(SYMBOL_STRING_INLINE_SIZE), m_isMaster(str.m_isMaster) {
+    take(&str);
+  }
 
  public:
+  /**
+   * Destructor.
+   */
+  ~SymbolString() {
+    if (m_data != m_inline) {
+      delete[] m_data;
+    }
+  }
+
+  /**
+   * Copy the symbols from the other instance.
+   * @param str the @a SymbolString to copy from.
+   * @return this instance.
+   */
+  SymbolString& operator=(const SymbolString& str) {
+    if (this != &str) {
+      m_isMaster = str.m_isMaster;
+      assign(str);
+    }
+    return *this;
+  }
+
+  /**
+   * Move the symbols from the other instance.
+   * @param str the @a SymbolString to move from (left empty).
+   * @return this instance.
+   */
+  SymbolString& operator=(SymbolString&& str) {
+    if (this != &str) {
+      m_isMaster = str.m_isMaster;
+      take(&str);
+    }
+    return *this;
+  }
+
   /**
    * Update the CRC by adding a value.
    * @param value the escaped value to add to the current CRC.
@@ -131,6 +182,61 @@ class SymbolString {
    */
   static void updateCrc(symbol_t value, symbol_t* crc);
 
+  /**
+   * Update the CRC by adding a whole span of values (processing four values at once with slicing lookup tables).
+   * @param values the escaped values to add to the current CRC.
+   * @param count the number of values.
+   * @param crc the current CRC to update.
+   */
+  static void updateCrc(const symbol_t* values, size_t count, symbol_t* crc);
+
+  /**
+   * Update the CRC by adding a whole span of unescaped values in their escaped form.
+   * @param values the unescaped values to add to the current CRC.
+   * @param count the number of values.
+   * @param crc the current CRC to update.
+   */
+  static void updateCrcUnescaped(const symbol_t* values, size_t count, symbol_t* crc);
+
+  /**
+   * Escape a whole span of values in one pass.
+   * @param values the unescaped values.
+   * @param count the number of values.
+   * @param output the buffer for the escaped values (capable of holding twice the @a count).
+   * @return the number of escaped values stored in @a output.
+   */
+  static size_t escape(const symbol_t* values, size_t count, symbol_t* output);
+
+  /**
+   * Unescape a whole span of values in one pass.
+   * @param values the escaped values.
+   * @param count the number of values.
+   * @param output the buffer for the unescaped values (capable of holding the @a count, may be the same as
+   * @a values).
+   * @param written the variable in which to store the number of unescaped values stored in @a output.
+   * @return @a RESULT_OK on success, @a RESULT_CONTINUE if the span ends with an incomplete escape sequence, or
+   * @a RESULT_ERR_ESC on an invalid escape sequence.
+   */
+  static result_t unescape(const symbol_t* values, size_t count, symbol_t* output, size_t* written);
+
+  /**
+   * Format a whole span of values as lower case hex digits.
+   * @param values the values to format.
+   * @param count the number of values.
+   * @param output the buffer for the hex digits (capable of holding twice the @a count, not terminated).
+   */
+  static void formatHex(const symbol_t* values, size_t count, char* output);
+
+  /**
+   * Parse a whole span of hex digits (a single last digit is taken as a value on its own).
+   * @param str the hex digits.
+   * @param length the number of hex digits.
+   * @param output the buffer for the parsed values (capable of holding half the @a length rounded up).
+   * @param written the variable in which to store the number of values stored in @a output (also on error).
+   * @return @a RESULT_OK on success, or an error code.
+   */
+  static result_t parseHex(const char* str, size_t length, symbol_t* output, size_t* written);
+
   /**
    * Return whether this instance if for the master part.
    * @return whether this instance if for the master part.
@@ -158,14 +264,30 @@ class SymbolString {
    */
   const string getStr(size_t skipFirstSymbols = 0) const;
 
+  /**
+   * Move to storage able to hold @a SYMBOL_STRING_MAX_SIZE symbols right away so that no further memory allocation
+   * happens when adding symbols.
+   */
+  void preallocate() { reserve(SYMBOL_STRING_MAX_SIZE); }
+
+  /**
+   * Escape the symbols starting at the specified index in one pass.
+   * @param index the index of the first symbol to escape.
+   * @param output the buffer for the escaped symbols (capable of holding twice the number of remaining symbols).
+   * @return the number of escaped symbols stored in @a output.
+   */
+  size_t escapeFrom(size_t index, symbol_t* output) const {
+    return index < m_size ? escape(m_data+index, m_size-index, output) : 0;
+  }
+
   /**
    * Return a reference to the symbol at the specified index.
    * @param index the index of the symbol to return.
    * @return the reference to the symbol at the specified index.
    */
   symbol_t& operator[](const size_t index) {
-    if (index >= m_data.size()) {
-      m_data.resize(index+1, 0);
+    if (index >= m_size) {
+      resize(index+1);
     }
     return m_data[index];
   }
@@ -176,7 +298,7 @@ class SymbolString {
    * @return the reference to the symbol at the specified index, or SYN if not available.
    */
   symbol_t operator[](size_t index) const {
-    if (index >= m_data.size()) {
+    if (index >= m_size) {
       return SYN;
     }
     return m_data[index];
@@ -188,7 +310,7 @@ class SymbolString {
    * @return true if this instance is equal to the other instance.
    */
   bool operator == (const SymbolString& other) {
-    return m_isMaster == other.m_isMaster && m_data == other.m_data;
+    return m_isMaster == other.m_isMaster && m_size == other.m_size && memcmp(m_data, other.m_data, m_size) == 0;
   }
 
   /**
@@ -197,7 +319,7 @@ class SymbolString {
    * @return true if this instance is different from the other instance.
    */
   bool operator != (const SymbolString& other) {
-    return m_isMaster != other.m_isMaster || m_data != other.m_data;
+    return m_isMaster != other.m_isMaster || m_size != other.m_size || memcmp(m_data, other.m_data, m_size) != 0;
   }
 
   /**
@@ -208,19 +330,19 @@ class SymbolString {
    * 2 if both instances are a master part and the data only differs in the first byte (the master address).
    */
   int compareTo(const SymbolString& other) const {
-    if (m_data.size() != other.m_data.size() || m_isMaster != other.m_isMaster) {
+    if (m_size != other.m_size || m_isMaster != other.m_isMaster) {
       return 1;
     }
-    if (m_data == other.m_data) {
+    if (memcmp(m_data, other.m_data, m_size) == 0) {
       return 0;
     }
     if (!m_isMaster) {
       return 1;
     }
-    if (m_data.size() == 1) {
+    if (m_size == 1) {
       return 2;
     }
-    if (equal(m_data.begin()+1, m_data.end(), other.m_data.begin()+1)) {
+    if (memcmp(m_data+1, other.m_data+1, m_size-1) == 0) {
       return 2;
     }
     return 1;
@@ -230,13 +352,24 @@ class SymbolString {
    * Append a symbol to the end of the symbol string.
    * @param value the symbol to append.
    */
-  void push_back(symbol_t value) { m_data.push_back(value); }
+  void push_back(symbol_t value) {
+    if (m_size >= m_capacity) {
+      reserve(m_size+1);
+    }
+    m_data[m_size++] = value;
+  }
 
   /**
    * Return the number of symbols in this symbol string.
    * @return the number of available symbols.
    */
-  size_t size() const { return m_data.size(); }
+  size_t size() const { return m_size; }
+
+  /**
+   * Return the number of bytes allocated on the heap in addition to the inline storage.
+   * @return the number of bytes allocated on the heap.
+   */
+  size_t getHeapSize() const { return m_data == m_inline ? 0 : m_capacity; }
 
   /**
    * Adjust the header NN field to the number of data bytes DD.
@@ -244,12 +377,12 @@ class SymbolString {
    */
   bool adjustHeader() {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
-      m_data.resize(lengthOffset+1);
-    } else if (m_data.size() >= lengthOffset+255) {
+    if (m_size <= lengthOffset) {
+      resize(lengthOffset+1);
+    } else if (m_size >= lengthOffset+255) {
       return false;
     }
-    m_data[lengthOffset] = (symbol_t)(m_data.size() - lengthOffset - 1);
+    m_data[lengthOffset] = (symbol_t)(m_size - lengthOffset - 1);
     return true;
   }
 
@@ -265,11 +398,11 @@ class SymbolString {
    */
   size_t getDataSize() const {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
+    if (m_size <= lengthOffset) {
       return 0;
     }
     size_t ret = m_data[lengthOffset];
-    return m_data.size() < lengthOffset + 1 + ret ? m_data.size() - lengthOffset - 1 : ret;
+    return m_size < lengthOffset + 1 + ret ? m_size - lengthOffset - 1 : ret;
   }
 
   /**
@@ -278,10 +411,10 @@ class SymbolString {
    */
   size_t getCalculatedDataSize() const {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() <= lengthOffset) {
+    if (m_size <= lengthOffset) {
       return 0;
     }
-    return m_data.size() - lengthOffset - 1;
+    return m_size - lengthOffset - 1;
   }
 
   /**
@@ -291,7 +424,7 @@ class SymbolString {
    */
   symbol_t dataAt(size_t index) const {
     size_t offset = (m_isMaster ? 5 : 1) + index;
-    if (offset < m_data.size()) {
+    if (offset < m_size) {
       return m_data[offset];
     }
     return 0;
@@ -304,8 +437,8 @@ class SymbolString {
    */
   symbol_t& dataAt(size_t index) {
     size_t offset = (m_isMaster ? 5 : 1) + index;
-    if (offset >= m_data.size()) {
-      m_data.resize(offset+1, 0);
+    if (offset >= m_size) {
+      resize(offset+1);
     }
     return m_data[offset];
   }
@@ -316,10 +449,10 @@ class SymbolString {
    */
   bool isComplete() {
     size_t lengthOffset = (m_isMaster ? 4 : 0);
-    if (m_data.size() < lengthOffset + 1) {
+    if (m_size < lengthOffset + 1) {
       return false;
     }
-    return m_data.size() >= lengthOffset + 1 + m_data[lengthOffset];
+    return m_size >= lengthOffset + 1 + m_data[lengthOffset];
   }
 
   /**
@@ -331,7 +464,40 @@ class SymbolString {
   /**
    * Clear the symbols.
    */
-  void clear() { m_data.clear(); }
+  void clear() { m_size = 0; }
+
+  /**
+   * Replace the symbols by a copy of those of the other instance while keeping the storage readable for
+   * @a assignConcurrent() in other threads, i.e. moving from the inline to heap memory at most once (symbols beyond
+   * @a SYMBOL_STRING_MAX_SIZE are dropped).
+   * @param str the @a SymbolString to copy from.
+   */
+  void assignStable(const SymbolString& str) {
+    size_t size = str.m_size > SYMBOL_STRING_MAX_SIZE ? SYMBOL_STRING_MAX_SIZE : str.m_size;
+    if (size > m_capacity) {
+      reserve(SYMBOL_STRING_MAX_SIZE);
+    }
+    memcpy(m_data, str.m_data, size);
+    m_size = size;
+  }
+
+  /**
+   * Replace the symbols by a copy of those of the other instance that is possibly modified by another thread at the
+   * same time via @a assignStable() only. The copy is only usable after verifying that no modification happened in
+   * the meantime (e.g. with a sequence counter).
+   * @param str the @a SymbolString to copy from.
+   */
+  void assignConcurrent(const SymbolString& str) {
+    const symbol_t* data = str.m_data;
+    size_t size = str.m_size;
+    size_t maxSize = data == str.m_inline ? SYMBOL_STRING_INLINE_SIZE : SYMBOL_STRING_MAX_SIZE;
+    if (size > maxSize) {
+      size = maxSize;
+    }
+    reserve(size);
+    memcpy(m_data, data, size);
+    m_size = size;
+  }
 
 
  private:
@@ -340,10 +506,83 @@ class SymbolString {
    * @param str the @a SymbolString to copy from.
    */
   SymbolString(const SymbolString& str)
-    : m_data(str.m_data), m_isMaster(str.m_isMaster) {}
+    : m_data(m_inline), m_size(0), m_capacity(SYMBOL_STRING_INLINE_SIZE), m_isMaster(str.m_isMaster) {
+    assign(str);
+  }
+
+  /**
+   * Make sure the storage is able to hold the specified number of symbols (moving to heap memory if necessary).
+   * @param capacity the minimum number of symbols to hold.
+   */
+  void reserve(size_t capacity) {
+    if (capacity <= m_capacity) {
+      return;
+    }
+    if (capacity < m_capacity*2) {
+      capacity = m_capacity*2;
+    }
+    symbol_t* data = new symbol_t[capacity];
+    memcpy(data, m_data, m_size);
+    if (m_data != m_inline) {
+      delete[] m_data;
+    }
+    m_data = data;
+    m_capacity = capacity;
+  }
+
+  /**
+   * Change the number of symbols (filling up with zero when growing).
+   * @param size the new number of symbols.
+   */
+  void resize(size_t size) {
+    if (size > m_size) {
+      reserve(size);
+      memset(m_data+m_size, 0, size-m_size);
+    }
+    m_size = size;
+  }
+
+  /**
+   * Replace the symbols by a copy of those of the other instance.
+   * @param str the @a SymbolString to copy from.
+   */
+  void assign(const SymbolString& str) {
+    reserve(str.m_size);
+    memcpy(m_data, str.m_data, str.m_size);
+    m_size = str.m_size;
+  }
+
+  /**
+   * Replace the symbols by those of the other instance and leave the other instance empty.
+   * @param str the @a SymbolString to take the symbols from.
+   */
+  void take(SymbolString* str) {
+    if (str->m_data == str->m_inline) {
+      assign(*str);
+    } else {
+      if (m_data != m_inline) {
+        delete[] m_data;
+      }
+      m_data = str->m_data;
+      m_capacity = str->m_capacity;
+      m_size = str->m_size;
+      str->m_data = str->m_inline;
+      str->m_capacity = SYMBOL_STRING_INLINE_SIZE;
+    }
+    str->m_size = 0;
+  }
+
+  /** the string of unescaped symbols (either @a m_inline or allocated heap memory). */
+  symbol_t* m_data;
+
+  /** the number of symbols in @a m_data. */
+  size_t m_size;
+
+  /** the number of symbols @a m_data is able to hold. */
+  size_t m_capacity;
 
-  /** the string of unescaped symbols. */
-  vector<symbol_t> m_data;
+  /** the inline storage for up to @a SYMBOL_STRING_INLINE_SIZE symbols. */
+  symbol_t m_inline[SYMBOL_STRING_INLINE_SIZE];
 
   /** whether this instance is for the master part. */
   bool m_isMaster;
@@ -0,0 +1,542 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "lib/ebus/message.h"
+
+using namespace ebusd;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+/**
+ * Microbenchmarks of the hot paths. Each benchmark is repeated a number of times with a fixed amount of work and
+ * the results are written as CSV to stdout (one line per benchmark) for tracking regressions between releases:
+ * name,operations,min ns/op,median ns/op,checksum
+ * The checksum is only there for keeping the compiler from optimizing the work away and for detecting a changed
+ * amount of work.
+ */
+
+DataFieldTemplates* templates = nullptr;
+
+namespace ebusd {
+
+DataFieldTemplates* getTemplates(const string& filename) {
+  if (filename == "") {  // avoid compiler warning
+    return templates;
+  }
+  return templates;
+}
+
+result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filename, bool verbose,
+    map<string, string>* defaults, string* errorDescription, bool replace = false) {
+  time_t mtime = 0;
+  istream* stream = FileReader::openFile(filename, errorDescription, &mtime);
+  result_t result;
+  if (stream) {
+    result = reader->readFromStream(stream, filename, mtime, verbose, defaults, errorDescription);
+    delete(stream);
+  } else {
+    result = RESULT_ERR_NOTFOUND;
+  }
+  return result;
+}
+
+}  // namespace ebusd
+
+/** the number of repetitions of each benchmark. */
+static unsigned int runs = 5;
+
+/** the slave addresses used for the generated configuration. */
+static const symbol_t slaveAddresses[] = {0x08, 0x15, 0x25, 0x26, 0x50, 0x52, 0x53, 0x64, 0x75, 0x76, 0xec, 0xf6};
+
+/** the field types with their data length used for the generated configuration. */
+static const struct {
+  const char* type;
+  size_t length;
+} fieldTypes[] = {
+  {"UCH", 1}, {"D1C", 1}, {"UIN", 2}, {"D2C", 2}, {"SIN", 2}, {"ULG", 4},
+  {"EXP", 4}, {"HTI", 3}, {"HDA:3", 3}, {"STR:8", 8}, {"D2B", 2}, {"BCD", 1},
+};
+
+/** the number of messages per slave address in the generated configuration. */
+#define MESSAGES_PER_SLAVE 96
+
+/**
+ * Run a benchmark and print the result line.
+ * @param name the name of the benchmark.
+ * @param operations the number of operations done by a single call of @a func.
+ * @param func the function doing the work and returning a checksum.
+ */
+template <typename F>
+static void bench(const string& name, size_t operations, F func) {
+  vector<double> nsPerOp;
+  uint64_t checksum = 0;
+  for (unsigned int run = 0; run < runs; run++) {
+    auto start = std::chrono::steady_clock::now();
+    checksum = func();
+    auto duration = std::chrono::steady_clock::now() - start;
+    nsPerOp.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count())
+      / static_cast<double>(operations));
+  }
+  std::sort(nsPerOp.begin(), nsPerOp.end());
+  cout << name << "," << operations << "," << std::fixed << std::setprecision(1) << nsPerOp[0] << ","
+       << nsPerOp[nsPerOp.size()/2] << "," << checksum << endl;
+}
+
+/**
+ * Generate the configuration with messages of all typical field types for all slave addresses.
+ * @return the CSV configuration.
+ */
+static string generateConfig() {
+  ostringstream config;
+  config << "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n";
+  for (const auto zz : slaveAddresses) {
+    for (unsigned int i = 0; i < MESSAGES_PER_SLAVE; i++) {
+      const auto& fieldType = fieldTypes[i % (sizeof(fieldTypes) / sizeof(fieldTypes[0]))];
+      config << (i % 8 == 7 ? "w" : "r") << ",circuit" << std::hex << static_cast<unsigned>(zz) << std::dec
+             << ",message" << i << ",comment of message " << i << ",," << std::hex << std::setw(2) << std::setfill('0')
+             << static_cast<unsigned>(zz) << ",b509,0d" << std::setw(2) << (i / 16) << std::setw(2) << (i % 16)
+             << std::dec << std::setw(0) << ",value,," << fieldType.type << (i % 3 == 0 ? ",sensor,,UCH" : "") << "\n";
+    }
+  }
+  return config.str();
+}
+
+/**
+ * Build the master and slave data for a read message of the generated configuration.
+ * @param zz the slave address.
+ * @param index the message index.
+ * @param variant the variant of the slave data.
+ * @param master the @a MasterSymbolString to fill.
+ * @param slave the @a SlaveSymbolString to fill.
+ */
+static void buildTelegram(symbol_t zz, unsigned int index, unsigned int variant, MasterSymbolString* master,
+    SlaveSymbolString* slave) {
+  master->clear();
+  master->push_back(0x31);
+  master->push_back(zz);
+  master->push_back(0xb5);
+  master->push_back(0x09);
+  master->push_back(3);
+  master->push_back(0x0d);
+  master->push_back((symbol_t)(index / 16));
+  master->push_back((symbol_t)(index % 16));
+  size_t length = fieldTypes[index % (sizeof(fieldTypes) / sizeof(fieldTypes[0]))].length + (index % 3 == 0 ? 1 : 0);
+  slave->clear();
+  slave->push_back((symbol_t)length);
+  for (size_t pos = 0; pos < length; pos++) {
+    // keep the values valid for all types (BCD, time, date, and string)
+    slave->push_back((symbol_t)(0x01 + ((variant + pos) % 9)));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  vector<string> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+      runs = (unsigned int)strtoul(argv[++i], nullptr, 10);
+      if (runs < 1) {
+        runs = 1;
+      }
+    } else if (argv[i][0] == '-') {
+      cerr << "usage: " << argv[0] << " [-r RUNS] [CSVFILE...]" << endl;
+      return 1;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  cout << "name,operations,min_ns_per_op,median_ns_per_op,checksum" << endl;
+
+  // CRC and escaping of symbols
+  {
+    vector<MasterSymbolString*> masters;
+    vector<string> escaped;
+    for (unsigned int i = 0; i < 64; i++) {
+      MasterSymbolString* master = new MasterSymbolString();
+      for (unsigned int pos = 0; pos < 16; pos++) {
+        master->push_back((symbol_t)(i * 16 + pos * 0x1d + (pos % 5 == 0 ? ESC : SYN) * (pos % 2)));
+      }
+      masters.push_back(master);
+      string str;
+      for (size_t pos = 0; pos < master->size(); pos++) {
+        symbol_t value = (*master)[pos];
+        ostringstream hex;
+        hex << std::hex << std::setw(2) << std::setfill('0');
+        if (value == ESC || value == SYN) {
+          hex << static_cast<unsigned>(ESC) << std::setw(2) << (value == ESC ? 0 : 1);
+        } else {
+          hex << static_cast<unsigned>(value);
+        }
+        str += hex.str();
+      }
+      escaped.push_back(str);
+    }
+    const unsigned int rounds = 2000;
+    bench("symbol_update_crc", rounds * 64 * 16, [&masters]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (const auto master : masters) {
+          symbol_t crc = 0;
+          for (size_t pos = 0; pos < master->size(); pos++) {
+            SymbolString::updateCrc((*master)[pos], &crc);
+          }
+          sum += crc;
+        }
+      }
+      return sum;
+    });
+    bench("symbol_calc_crc_escaped", rounds * 64, [&masters]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (const auto master : masters) {
+          sum += master->calcCrc();
+        }
+      }
+      return sum;
+    });
+    bench("symbol_parse_hex_escaped", rounds / 10 * 64, [&escaped]() {
+      uint64_t sum = 0;
+      MasterSymbolString master;
+      for (unsigned int round = 0; round < rounds / 10; round++) {
+        for (const auto& str : escaped) {
+          master.clear();
+          master.parseHexEscaped(str);
+          sum += master.size();
+        }
+      }
+      return sum;
+    });
+    bench("symbol_get_str", rounds / 10 * 64, [&masters]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < rounds / 10; round++) {
+        for (const auto master : masters) {
+          sum += master->getStr().length();
+        }
+      }
+      return sum;
+    });
+    for (auto master : masters) {
+      delete master;
+    }
+  }
+
+  // splitting of configuration files into fields
+  string config = generateConfig();
+  {
+    vector<string> contents;
+    if (files.empty()) {
+      contents.push_back(config);
+    }
+    for (const auto& file : files) {
+      std::ifstream stream(file);
+      if (!stream.is_open()) {
+        cerr << "unable to open " << file << endl;
+        return 1;
+      }
+      ostringstream content;
+      content << stream.rdbuf();
+      contents.push_back(content.str());
+    }
+    size_t lines = 0;
+    for (const auto& content : contents) {
+      lines += std::count(content.begin(), content.end(), '\n');
+    }
+    const unsigned int rounds = 20;
+    bench("filereader_split_fields", rounds * lines, [&contents]() {
+      uint64_t sum = 0;
+      vector<string> row;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (const auto& content : contents) {
+          istringstream stream(content);
+          unsigned int lineNo = 0;
+          size_t hash = 0, size = 0;
+          while (FileReader::splitFields(&stream, &row, &lineNo, &hash, &size)) {
+            sum += row.size();
+          }
+          sum += row.size() + lineNo;
+        }
+      }
+      return sum;
+    });
+    bench("filereader_split_buffer", rounds * lines, [&contents]() {
+      uint64_t sum = 0;
+      vector<string> row;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (const auto& content : contents) {
+          const char* pos = content.data();
+          const char* end = pos + content.size();
+          unsigned int lineNo = 0;
+          size_t hash = 0, size = 0;
+          while (FileReader::splitFields(&pos, end, &row, &lineNo, &hash, &size)) {
+            sum += row.size();
+          }
+          sum += row.size() + lineNo;
+        }
+      }
+      return sum;
+    });
+  }
+
+  // decoding and encoding of the common numeric types
+  {
+    static const char* numberTypes[] = {"UCH", "SCH", "D1C", "BCD", "D2B", "D2C", "FLT", "UIN", "SIN"};
+    const size_t typeCount = sizeof(numberTypes) / sizeof(numberTypes[0]);
+    vector<const DataType*> types;
+    vector<string> values;
+    SlaveSymbolString data;
+    data.parseHex("020c08");
+    for (const auto type : numberTypes) {
+      const DataType* dataType = DataTypeList::getInstance()->get(type);
+      types.push_back(dataType);
+      ostringstream value;
+      dataType->readSymbols(1, dataType->getBitCount() / 8, data, 0, &value);
+      values.push_back(value.str());
+    }
+    const unsigned int rounds = 20000;
+    bench("datatype_read_number", rounds * typeCount, [&types, &data]() {
+      uint64_t sum = 0;
+      ostringstream output;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (const auto dataType : types) {
+          output.str("");
+          dataType->readSymbols(1, dataType->getBitCount() / 8, data, 0, &output);
+          sum += output.tellp();
+        }
+      }
+      return sum;
+    });
+    bench("datatype_write_number", rounds * typeCount, [&types, &values]() {
+      uint64_t sum = 0;
+      SlaveSymbolString output;
+      output.parseHex("020000");
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (size_t index = 0; index < types.size(); index++) {
+          istringstream input(values[index]);
+          size_t used = 0;
+          types[index]->writeSymbols(1, types[index]->getBitCount() / 8, &input, &output, &used);
+          sum += output.dataAt(1) + used;
+        }
+      }
+      return sum;
+    });
+  }
+
+  // lookup of the base types and derivation of number types
+  {
+    DataTypeList* dataTypes = DataTypeList::getInstance();
+    const size_t typeCount = sizeof(fieldTypes) / sizeof(fieldTypes[0]);
+    vector<string> ids;
+    for (const auto& fieldType : fieldTypes) {
+      string id = fieldType.type;
+      ids.push_back(id.substr(0, id.find(':')));
+    }
+    const unsigned int rounds = 20000;
+    bench("datatype_get", rounds * typeCount * 2, [dataTypes, &ids]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (size_t index = 0; index < ids.size(); index++) {
+          sum += dataTypes->get(ids[index])->getBitCount();
+          sum += dataTypes->get(ids[index], fieldTypes[index].length)->getBitCount();
+        }
+      }
+      return sum;
+    });
+    const NumberDataType* uch = dynamic_cast<const NumberDataType*>(dataTypes->get("UCH"));
+    bench("datatype_derive", rounds * 4, [uch]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < rounds; round++) {
+        for (int divisor = 2; divisor <= 5; divisor++) {
+          const NumberDataType* derived = nullptr;
+          uch->derive(divisor, 0, &derived);
+          sum += derived->getDivisor();
+        }
+      }
+      return sum;
+    });
+  }
+
+  // loading of the configuration and lookup of received telegrams
+  templates = new DataFieldTemplates();
+  MessageMap* messages = new MessageMap(false, "", false);
+  string errorDescription;
+  {
+    istringstream stream(config);
+    result_t result = messages->readFromStream(&stream, "bench.csv", 0, false, nullptr, &errorDescription);
+    if (result != RESULT_OK || messages->size() == 0) {
+      cerr << "unable to read config: " << getResultCode(result) << ", " << errorDescription << endl;
+      return 1;
+    }
+  }
+  const size_t slaveCount = sizeof(slaveAddresses) / sizeof(slaveAddresses[0]);
+  const size_t telegramCount = slaveCount * MESSAGES_PER_SLAVE;
+  vector<MasterSymbolString*> masters;
+  vector<SlaveSymbolString*> slaves[2];
+  for (const auto zz : slaveAddresses) {
+    for (unsigned int i = 0; i < MESSAGES_PER_SLAVE; i++) {
+      for (unsigned int variant = 0; variant < 2; variant++) {
+        MasterSymbolString* master = new MasterSymbolString();
+        SlaveSymbolString* slave = new SlaveSymbolString();
+        buildTelegram(zz, i, variant, master, slave);
+        if (variant == 0) {
+          masters.push_back(master);
+        } else {
+          delete master;
+        }
+        slaves[variant].push_back(slave);
+      }
+    }
+  }
+  bench("messagemap_load", telegramCount, [&config]() {
+    MessageMap map(false, "", false);
+    istringstream stream(config);
+    string errorDescription;
+    map.readFromStream(&stream, "bench.csv", 0, false, nullptr, &errorDescription);
+    return static_cast<uint64_t>(map.size());
+  });
+  vector<Message*> found;
+  for (const auto master : masters) {
+    found.push_back(messages->find(*master));
+  }
+  bench("messagemap_find_master", 50 * telegramCount, [&messages, &masters]() {
+    uint64_t sum = 0;
+    for (unsigned int round = 0; round < 50; round++) {
+      for (const auto master : masters) {
+        sum += messages->find(*master) != nullptr ? 1 : 0;
+      }
+    }
+    return sum;
+  });
+  {
+    // an unknown telegram has to check all ID lengths
+    MasterSymbolString unknown;
+    unknown.parseHex("3108b5110101");
+    bench("messagemap_find_unknown", 50 * telegramCount, [&messages, &unknown]() {
+      uint64_t sum = 0;
+      for (unsigned int round = 0; round < 50 * telegramCount; round++) {
+        sum += messages->find(unknown) != nullptr ? 1 : 0;
+      }
+      return sum;
+    });
+  }
+
+  // storing and decoding of the last data
+  bench("message_store_decode", 10 * telegramCount, [&found, &masters, &slaves, telegramCount]() {
+    uint64_t sum = 0;
+    ostringstream output;
+    for (unsigned int round = 0; round < 10; round++) {
+      for (size_t i = 0; i < telegramCount; i++) {
+        Message* message = found[i];
+        if (!message) {
+          continue;
+        }
+        message->storeLastData(*masters[i], *slaves[round % 2][i]);
+        output.str("");
+        message->decodeLastData(false, nullptr, -1, 0, &output);
+        sum += output.tellp();
+      }
+    }
+    return sum;
+  });
+  bench("message_decode_cached", 10 * telegramCount, [&found, telegramCount]() {
+    uint64_t sum = 0;
+    ostringstream output;
+    for (unsigned int round = 0; round < 10; round++) {
+      for (size_t i = 0; i < telegramCount; i++) {
+        if (!found[i]) {
+          continue;
+        }
+        output.str("");
+        found[i]->decodeLastData(false, nullptr, -1, 0, &output);
+        sum += output.tellp();
+      }
+    }
+    return sum;
+  });
+
+  // JSON formatting of all messages as done for "/data"
+  bench("message_decode_json_data", 10 * telegramCount, [&found, telegramCount]() {
+    uint64_t sum = 0;
+    ostringstream output;
+    for (unsigned int round = 0; round < 10; round++) {
+      output.str("");
+      for (size_t i = 0; i < telegramCount; i++) {
+        if (found[i]) {
+          found[i]->decodeJson(i > 0, false, false, OF_NAMES | OF_JSON, &output);
+        }
+      }
+      sum += output.tellp();
+    }
+    return sum;
+  });
+  bench("message_decode_json_data_updated", 10 * telegramCount, [&found, &masters, &slaves, telegramCount]() {
+    uint64_t sum = 0;
+    ostringstream output;
+    for (unsigned int round = 0; round < 10; round++) {
+      output.str("");
+      for (size_t i = 0; i < telegramCount; i++) {
+        if (found[i]) {
+          found[i]->storeLastData(*masters[i], *slaves[round % 2][i]);
+          found[i]->decodeJson(i > 0, false, false, OF_NAMES | OF_JSON, &output);
+        }
+      }
+      sum += output.tellp();
+    }
+    return sum;
+  });
+
+  // MQTT topic of each message (the default "ebusd/%circuit/%name" as built by MqttHandler::getTopic())
+  bench("mqtt_topic", 10 * telegramCount, [&found, telegramCount]() {
+    uint64_t sum = 0;
+    for (unsigned int round = 0; round < 10; round++) {
+      for (size_t i = 0; i < telegramCount; i++) {
+        if (!found[i]) {
+          continue;
+        }
+        ostringstream topic;
+        topic << "ebusd/";
+        found[i]->dumpField("circuit", false, &topic);
+        topic << "/";
+        found[i]->dumpField("name", false, &topic);
+        sum += topic.tellp();
+      }
+    }
+    return sum;
+  });
+
+  for (auto master : masters) {
+    delete master;
+  }
+  for (auto& list : slaves) {
+    for (auto slave : list) {
+      delete slave;
+    }
+  }
+  delete messages;
+  delete templates;
+  return 0;
+}
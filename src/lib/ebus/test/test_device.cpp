@@ -16,14 +16,298 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <stdlib.h>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <vector>
 #include "lib/ebus/device.h"
 
 using namespace std;
 using namespace ebusd;
 
+static bool error = false;
+
+/**
+ * Append the CRC to the hex symbols.
+ * @param hex the unescaped hex symbols.
+ * @return the hex symbols with the CRC appended.
+ */
+static string withCrc(const string& hex) {
+  vector<symbol_t> values(hex.length()/2);
+  size_t written = 0;
+  SymbolString::parseHex(hex.c_str(), hex.length(), values.data(), &written);
+  symbol_t crc = 0;
+  SymbolString::updateCrcUnescaped(values.data(), written, &crc);
+  char out[3];
+  SymbolString::formatHex(&crc, 1, out);
+  return hex + string(out, 2);
+}
+
+/**
+ * Receive symbols from the device until a SYN was received.
+ * @param device the @a Device to receive from.
+ * @return the received symbols as hex string (including the SYN).
+ */
+static string receiveUntilSyn(Device* device) {
+  string ret;
+  symbol_t symbol = 0;
+  for (int count = 0; count < 300 && symbol != SYN; count++) {
+    result_t result = device->recv(1000000, &symbol);
+    if (result != RESULT_OK) {
+      ret += string("<") + getResultCode(result) + ">";
+      break;
+    }
+    char out[3];
+    SymbolString::formatHex(&symbol, 1, out);
+    ret += string(out, 2);
+  }
+  return ret;
+}
+
+/**
+ * Send hex symbols to the device and receive the same number of symbols (i.e. usually the echo).
+ * @param device the @a Device to send to.
+ * @param send the hex symbols to send.
+ * @return the received symbols as hex string.
+ */
+static string sendReceive(Device* device, const string& send) {
+  string ret;
+  for (size_t pos = 0; pos+1 < send.length(); pos += 2) {
+    symbol_t symbol = 0;
+    size_t written = 0;
+    SymbolString::parseHex(send.c_str()+pos, 2, &symbol, &written);
+    result_t result = device->send(symbol);
+    if (result == RESULT_OK) {
+      result = device->recv(1000000, &symbol);
+    }
+    if (result != RESULT_OK) {
+      return ret + string("<") + getResultCode(result) + ">";
+    }
+    char out[3];
+    SymbolString::formatHex(&symbol, 1, out);
+    ret += string(out, 2);
+  }
+  return ret;
+}
+
+/**
+ * Receive the specified number of symbols from the device.
+ * @param device the @a Device to receive from.
+ * @param count the number of symbols to receive.
+ * @return the received symbols as hex string.
+ */
+static string receive(Device* device, size_t count) {
+  string ret;
+  for (size_t pos = 0; pos < count; pos++) {
+    symbol_t symbol = 0;
+    result_t result = device->recv(1000000, &symbol);
+    if (result != RESULT_OK) {
+      return ret + string("<") + getResultCode(result) + ">";
+    }
+    char out[3];
+    SymbolString::formatHex(&symbol, 1, out);
+    ret += string(out, 2);
+  }
+  return ret;
+}
+
+void verify(const string& type, const string& expectStr, const string& gotStr) {
+  if (gotStr == expectStr) {
+    cout << "  " << type << " >" << gotStr << "< OK" << endl;
+  } else {
+    cout << "  " << type << " error: got >" << gotStr << "<, expected >" << expectStr << "<" << endl;
+    error = true;
+  }
+}
+
+/**
+ * A @a Device using the enhanced protocol that receives scripted raw bytes and records the raw bytes written.
+ */
+class EnhancedDevice : public Device {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  EnhancedDevice() : Device("enhanced", false, false, false, true) {}
+
+  // @copydoc
+  result_t open() override {
+    m_fd = ::open("/dev/null", O_RDONLY);
+    return m_fd < 0 ? RESULT_ERR_DEVICE : afterOpen();
+  }
+
+  /**
+   * Add raw bytes to receive.
+   * @param hex the raw hex bytes to receive.
+   */
+  void addReceive(const string& hex) { m_receive += hex; }
+
+  /**
+   * Take the raw bytes written so far.
+   * @return the raw bytes written so far as hex string.
+   */
+  string takeWritten() {
+    string ret = m_written;
+    m_written.clear();
+    return ret;
+  }
+
+
+ protected:
+  // @copydoc
+  void checkDevice() override {}
+
+  // @copydoc
+  bool available() override { return true; }
+
+  // @copydoc
+  ssize_t write(symbol_t value) override { return write(&value, 1); }
+
+  // @copydoc
+  ssize_t write(const symbol_t* values, size_t count) override {
+    for (size_t pos = 0; pos < count; pos++) {
+      char out[3];
+      SymbolString::formatHex(values+pos, 1, out);
+      m_written += string(out, 2);
+    }
+    return static_cast<ssize_t>(count);
+  }
+
+  // @copydoc
+  ssize_t read(symbol_t* value) override {
+    size_t written = 0;
+    if (m_receive.length() < 2
+        || SymbolString::parseHex(m_receive.c_str(), 2, value, &written) != RESULT_OK || written != 1) {
+      return 0;
+    }
+    m_receive.erase(0, 2);
+    return 1;
+  }
+
+
+ private:
+  /** the raw hex bytes still to receive. */
+  string m_receive;
+
+  /** the raw hex bytes written. */
+  string m_written;
+};
+
+/**
+ * Receive a single symbol with the enhanced protocol.
+ * @param device the @a EnhancedDevice to receive from.
+ * @param raw the raw hex bytes to receive.
+ * @return the received symbol as hex string and the arbitration state, or the error.
+ */
+static string receiveEnhanced(EnhancedDevice* device, const string& raw) {
+  device->addReceive(raw);
+  symbol_t symbol = 0;
+  ArbitrationState state = as_none;
+  result_t result = device->recv(0, &symbol, &state);
+  if (result != RESULT_OK) {
+    return string("<") + getResultCode(result) + ">";
+  }
+  char out[3];
+  SymbolString::formatHex(&symbol, 1, out);
+  const char* states[] = {"none", "running", "won", "lost"};
+  return string(out, 2) + "/" + states[state];
+}
+
+void testEnhanced() {
+  EnhancedDevice device;
+  result_t result = device.open();
+  // the initialization request without extra features
+  verify("enhanced init", "c080", result == RESULT_OK ? device.takeWritten() : getResultCode(result));
+  // data bytes below 0x80 in short form, the others escaped as send request
+  bool sent = device.send(0x31) == RESULT_OK && device.send(0xaa) == RESULT_OK && device.send(0x7f) == RESULT_OK;
+  verify("enhanced send single", "31c6aa7f", sent ? device.takeWritten() : "<send>");
+  symbol_t values[] = {0x10, 0x80, 0xff, 0x00};
+  sent = device.send(values, 4) == RESULT_OK;
+  verify("enhanced send multiple", "10c680c7bf00", sent ? device.takeWritten() : "<send>");
+  // received data bytes in short form and as received response
+  verify("enhanced received short", "15/none", receiveEnhanced(&device, "15"));
+  verify("enhanced received", "aa/none", receiveEnhanced(&device, "c6aa"));
+  verify("enhanced received high", "ff/none", receiveEnhanced(&device, "c7bf"));
+  // the arbitration started by the adapter and its result
+  sent = device.startArbitration(0x31) == RESULT_OK;
+  verify("enhanced start", "c8b1", sent ? device.takeWritten() : "<start>");
+  verify("enhanced running", "aa/running", receiveEnhanced(&device, "c6aa"));
+  verify("enhanced started", "31/won", receiveEnhanced(&device, "c8b1"));
+  sent = device.startArbitration(0x31) == RESULT_OK && device.takeWritten() == "c8b1";
+  verify("enhanced failed", "10/lost", sent ? receiveEnhanced(&device, "e890") : "<start>");
+  // a late result of a cancelled arbitration is skipped
+  sent = device.startArbitration(0x31) == RESULT_OK && device.startArbitration(SYN) == RESULT_OK;
+  verify("enhanced cancel", "c8b1caaa", sent ? device.takeWritten() : "<start>");
+  verify("enhanced cancelled", "aa/none", receiveEnhanced(&device, "c8b1c6aa"));
+  // an error on the eBUS side aborts a running arbitration
+  sent = device.startArbitration(0x31) == RESULT_OK && device.takeWritten() == "c8b1";
+  verify("enhanced error", "<ERR: generic device error>", sent ? receiveEnhanced(&device, "ec80") : "<start>");
+  verify("enhanced after error", "aa/none", receiveEnhanced(&device, "c6aa"));
+  // a malformed second byte is rejected and an unexpected second byte skipped
+  verify("enhanced malformed", "<ERR: wrong symbol received>", receiveEnhanced(&device, "c615"));
+  verify("enhanced unexpected", "15/none", receiveEnhanced(&device, "8015"));
+  device.close();
+}
+
+void testSimulated() {
+  char scenario[] = "/tmp/test_device_simXXXXXX";
+  int fd = mkstemp(scenario);
+  if (fd < 0) {
+    cout << "unable to create scenario file" << endl;
+    error = true;
+    return;
+  }
+  string content = "speed,2\nsyn,250\n# a master sending a broadcast once\nmaster,10,3600000,fe070002b400\n"
+    "slave,15,b509030d2800,02b400\n";
+  if (write(fd, content.c_str(), content.length()) != static_cast<ssize_t>(content.length())) {
+    error = true;
+  }
+  close(fd);
+  string name = string("sim:") + scenario;
+  Device* device = Device::create(name.c_str(), true, false, false);
+  result_t result = device == nullptr ? RESULT_ERR_INVALID_ARG : device->open();
+  if (result != RESULT_OK) {
+    cout << "open simulated failed: " << getResultCode(result) << endl;
+    error = true;
+  } else {
+    SimulatedDevice* simulated = dynamic_cast<SimulatedDevice*>(device);
+    verify("simulated auto-syn", "aa", receiveUntilSyn(device));
+    // the due simulated master wins the arbitration against 31
+    verify("simulated arbitration lost", "10", sendReceive(device, "31"));
+    verify("simulated master broadcast", withCrc("10fe070002b400").substr(2) + "aa", receiveUntilSyn(device));
+    // the simulated master is no longer due
+    verify("simulated arbitration won", "31", sendReceive(device, "31"));
+    string command = withCrc("3115b509030d2800").substr(2);
+    verify("simulated command echo", command, sendReceive(device, command));
+    verify("simulated slave response", "00" + withCrc("02b400"), receive(device, 5));
+    verify("simulated end", "00aa", sendReceive(device, "00aa"));
+    // the unknown slave does not answer, so the AUTO-SYN terminates the telegram
+    verify("simulated unknown slave", "31" + withCrc("3125b509030d2800").substr(2),
+        sendReceive(device, "31" + withCrc("3125b509030d2800").substr(2)));
+    verify("simulated unknown slave syn", "aa", receiveUntilSyn(device));
+    if (simulated->getArbitrationCount() != 3 || simulated->getLostArbitrationCount() != 1
+        || simulated->getTelegramCount() != 2 || simulated->getCollisionCount() != 0) {
+      cout << "  simulated statistics error: " << simulated->getArbitrationCount() << "/"
+           << simulated->getLostArbitrationCount() << "/" << simulated->getTelegramCount() << "/"
+           << simulated->getCollisionCount() << endl;
+      error = true;
+    } else {
+      cout << "  simulated statistics OK" << endl;
+    }
+    device->close();
+  }
+  delete device;
+  unlink(scenario);
+}
+
 int main() {
+  testEnhanced();
+  testSimulated();
+  if (error) {
+    return 1;
+  }
   Device* device = Device::create("/dev/ttyUSB20", true, false, false);
   if (device == nullptr) {
     cout << "unable to create device" << endl;
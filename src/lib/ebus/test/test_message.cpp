@@ -23,7 +23,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <chrono>
 #include "lib/ebus/message.h"
+#include "lib/ebus/statefile.h"
+#include "lib/ebus/history.h"
 
 using namespace ebusd;
 using std::cout;
@@ -78,6 +81,96 @@ result_t loadDefinitionsFromConfigPath(FileReader* reader, const string& filenam
 
 }  // namespace ebusd
 
+/**
+ * Benchmark the @a MessageKeyIndex against a plain map with the lookups done per received telegram.
+ */
+void benchmarkKeyIndex() {
+  const uint64_t sourceMask = 0x1fLL << (8 * 7), activeRead = 0x1eLL << (8 * 7);
+  map<uint64_t, vector<Message*> > byKey;
+  MessageKeyIndex index;
+  for (unsigned int i = 0; i < 1000; i++) {
+    vector<symbol_t> id = {(symbol_t)(0xb5 - (i % 8)), (symbol_t)(i / 8 % 64), (symbol_t)(i % 5)};
+    uint64_t key = Message::createKey(id, false, false, SYN, (symbol_t)(0x08 + (i % 3)));
+    byKey[key].push_back(nullptr);
+  }
+  for (const auto& it : byKey) {
+    index.set(it.first, &it.second);
+  }
+  vector<MasterSymbolString*> masters;
+  for (unsigned int i = 0; i < 256; i++) {
+    MasterSymbolString* master = new MasterSymbolString();
+    master->push_back(0x10);
+    master->push_back((symbol_t)(0x08 + (i % 4)));
+    master->push_back((symbol_t)(0xb5 - (i % 10)));
+    master->push_back((symbol_t)(i % 70));
+    master->push_back(3);
+    master->push_back((symbol_t)(i % 6));
+    master->push_back(0x11);
+    master->push_back(0x22);
+    masters.push_back(master);
+  }
+  const unsigned int rounds = 200;
+  size_t mapFound = 0, indexFound = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int round = 0; round < rounds; round++) {
+    for (const auto master : masters) {
+      for (size_t idLength = 3; true; idLength--) {
+        uint64_t key = Message::createKey(*master, idLength) & ~sourceMask;
+        mapFound += byKey.find(key) != byKey.end() ? 1 : 0;
+        mapFound += byKey.find(key | sourceMask) != byKey.end() ? 1 : 0;
+        mapFound += byKey.find(key | activeRead) != byKey.end() ? 1 : 0;
+        if (idLength == 0) {
+          break;
+        }
+      }
+    }
+  }
+  auto mapTime = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (unsigned int round = 0; round < rounds; round++) {
+    for (const auto master : masters) {
+      uint8_t idLengths = index.getIdLengths((*master)[2], (*master)[3]);
+      for (size_t idLength = 3; true; idLength--) {
+        if (idLengths & (1 << idLength)) {
+          uint64_t key = Message::createKey(*master, idLength) & ~sourceMask;
+          indexFound += index.find(key) ? 1 : 0;
+          indexFound += index.find(key | sourceMask) ? 1 : 0;
+          indexFound += index.find(key | activeRead) ? 1 : 0;
+        }
+        if (idLength == 0) {
+          break;
+        }
+      }
+    }
+  }
+  auto indexTime = std::chrono::steady_clock::now() - start;
+  size_t lookups = rounds * masters.size();
+  cout << "key index benchmark: map "
+       << std::chrono::duration_cast<std::chrono::nanoseconds>(mapTime).count() / lookups << " ns, index "
+       << std::chrono::duration_cast<std::chrono::nanoseconds>(indexTime).count() / lookups << " ns per telegram";
+  if (mapFound != indexFound || indexFound == 0) {
+    cout << " error: found " << indexFound << ", expected " << mapFound << endl;
+    error = true;
+  } else {
+    cout << " OK" << endl;
+  }
+  for (const auto& it : byKey) {
+    index.erase(it.first);
+    if (index.find(it.first)) {
+      cout << "key index erase error" << endl;
+      error = true;
+      break;
+    }
+  }
+  if (index.size() != 0) {
+    cout << "key index size error" << endl;
+    error = true;
+  }
+  for (auto master : masters) {
+    delete master;
+  }
+}
+
 int main() {
   // message:   [type],[circuit],name,[comment],[QQ[;QQ]*],[ZZ],[PBSB],[ID],fields...
   // field:     name,part,type[:len][,[divisor|values][,[unit][,[comment]]]]
@@ -213,7 +306,7 @@ int main() {
   mstrs.resize(1);
   sstrs.resize(1);
   for (unsigned int i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
-    string check[5] = checks[i];
+    string* check = checks[i];
     string inputStr = check[1];
     string flags = check[4];
     bool isTemplate = flags == "template";
@@ -478,6 +571,557 @@ int main() {
     }
   }
 
+  benchmarkKeyIndex();
+
+  // check update journal
+  messages->clear();
+  istringstream defstr("r,cir,name,,,25,B509,0d2800,,,tempsensor");
+  result_t result = messages->readLineFromStream(&defstr, __FILE__, false, &lineNo, &row, &errorDescription, false,
+      nullptr, nullptr);
+  deque<Message*> msgs;
+  messages->findAll("", "", "*", false, true, true, true, true, false, 0, 0, false, &msgs);
+  if (result != RESULT_OK || msgs.size() != 1) {
+    cout << "journal: create error: " << getResultCode(result) << ", " << errorDescription << endl;
+    error = true;
+  } else {
+    message = msgs.front();
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    master.parseHex("ff25b509030d2800");
+    slave.parseHex("0320ff00");
+    uint64_t cursor = messages->getUpdateCursor();
+    msgs.clear();
+    if (!messages->findUpdates("*", false, &cursor, &msgs) || !msgs.empty()) {
+      cout << "journal: unexpected update" << endl;
+      error = true;
+    } else {
+      cout << "journal: empty OK" << endl;
+    }
+    message->storeLastData(master, slave);
+    message->storeLastData(master, slave);
+    uint64_t changedCursor = cursor;
+    msgs.clear();
+    if (!messages->findUpdates("*", false, &cursor, &msgs) || msgs.size() != 1 || msgs.front() != message) {
+      cout << "journal: update error: " << msgs.size() << " messages" << endl;
+      error = true;
+    } else {
+      cout << "journal: update OK" << endl;
+    }
+    msgs.clear();
+    if (!messages->findUpdates("*", false, &cursor, &msgs) || !msgs.empty()) {
+      cout << "journal: consumed error" << endl;
+      error = true;
+    } else {
+      cout << "journal: consumed OK" << endl;
+    }
+    message->storeLastData(master, slave);  // unchanged
+    msgs.clear();
+    if (!messages->findUpdates("*", true, &changedCursor, &msgs) || msgs.size() != 1) {
+      cout << "journal: changed error: " << msgs.size() << " messages" << endl;
+      error = true;
+    } else {
+      cout << "journal: changed OK" << endl;
+    }
+    for (size_t i = 0; i <= UPDATE_JOURNAL_SIZE; i++) {
+      message->storeLastData(master, slave);
+    }
+    msgs.clear();
+    if (messages->findUpdates("*", false, &cursor, &msgs) || msgs.size() != 1) {
+      cout << "journal: overrun error" << endl;
+      error = true;
+    } else {
+      cout << "journal: overrun OK" << endl;
+    }
+    messages->clear();
+    msgs.clear();
+    if (!messages->findUpdates("*", false, &cursor, &msgs) || !msgs.empty()) {
+      cout << "journal: clear error" << endl;
+      error = true;
+    } else {
+      cout << "journal: clear OK" << endl;
+    }
+  }
+
+  // check poll scheduler
+  messages->clear();
+  const char* polldefs[] = {
+    "*r,,,,,,,",
+    "r1,cir,a,,,08,B509,0d2800,,,tempsensor",
+    "r1,cir,b,,,08,B509,0d2900,,,tempsensor",
+    "r1,cir,c,,,15,B509,0d2800,,,tempsensor",
+  };
+  for (const auto polldef : polldefs) {
+    istringstream polldefstr(polldef);
+    messages->readLineFromStream(&polldefstr, __FILE__, false, &lineNo, &row, &errorDescription, false,
+        nullptr, nullptr);
+  }
+  msgs.clear();
+  messages->findAll("cir", "", "*", false, true, false, false, true, false, 0, 0, false, &msgs);
+  Message* pollA = nullptr;
+  Message* pollB = nullptr;
+  Message* pollC = nullptr;
+  for (const auto msg : msgs) {
+    (msg->getName() == "a" ? pollA : msg->getName() == "b" ? pollB : pollC) = msg;
+  }
+  if (messages->sizePoll() != 3 || !pollA || !pollB || !pollC) {
+    cout << "poll: create error: " << errorDescription << endl;
+    error = true;
+  } else {
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    slave.parseHex("0320ff00");
+    PollScheduler scheduler;
+    time_t now = time(nullptr)-1;  // before the update times stored below
+    scheduler.add(pollA, false, now);
+    scheduler.add(pollB, false, now);
+    scheduler.add(pollC, false, now);
+    Message* first = scheduler.getNext(now);
+    Message* second = scheduler.getNext(now);
+    if (first != pollA || second != pollC || scheduler.getNext(now) != nullptr) {
+      cout << "poll: spread error" << endl;
+      error = true;
+    } else {
+      cout << "poll: spread OK" << endl;
+    }
+    time_t interval = scheduler.getTargetInterval(pollA);
+    master.parseHex("ff08b509030d2900");
+    pollB->storeLastData(master, slave);
+    if (scheduler.getNext(now+5) != nullptr || scheduler.getNext(now+interval) != pollA) {
+      cout << "poll: skip updated error" << endl;
+      error = true;
+    } else {
+      cout << "poll: skip updated OK" << endl;
+    }
+    master.parseHex("ff08b509030d2800");
+    pollA->storeLastData(master, slave);
+    master.parseHex("ff15b509030d2800");
+    pollC->storeLastData(master, slave);
+    bool found = false;
+    for (size_t cnt = 0; cnt < 3; cnt++) {
+      found = found || scheduler.getNext(now+interval) != nullptr;
+    }
+    if (found) {
+      cout << "poll: all updated error" << endl;
+      error = true;
+    } else {
+      cout << "poll: all updated OK" << endl;
+    }
+  }
+
+  // check retained states
+  {
+    size_t retained = messages->retainStates();
+    messages->clear();
+    const char* reloaddefs[] = {
+      "*r,,,,,,,",
+      "r1,cir,a,,,08,B509,0d2800,,,tempsensor",
+      "r1,cir,b,,,08,B509,0d2900,,,uch",
+      "r1,cir,c,,,15,B509,0d2800,,,tempsensor",
+    };
+    for (const auto reloaddef : reloaddefs) {
+      istringstream reloaddefstr(reloaddef);
+      messages->readLineFromStream(&reloaddefstr, __FILE__, false, &lineNo, &row, &errorDescription, false,
+          nullptr, nullptr);
+    }
+    Message* reloadA = messages->find("cir", "a", "", false);
+    Message* reloadB = messages->find("cir", "b", "", false);
+    if (reloadA) {
+      ostringstream first, second, changed;
+      reloadA->decodeLastData(false, nullptr, -1, 0, &first);
+      reloadA->decodeLastData(false, nullptr, -1, 0, &second);
+      MasterSymbolString master;
+      SlaveSymbolString slave;
+      master.parseHex("ff08b509030d2800");
+      slave.parseHex("0330ff00");
+      reloadA->storeLastData(master, slave);
+      reloadA->decodeLastData(false, nullptr, -1, 0, &changed);
+      if (first.str() != second.str() || changed.str() == first.str()) {
+        cout << "decode cache: error: " << first.str() << ", " << second.str() << ", " << changed.str() << endl;
+        error = true;
+      } else {
+        cout << "decode cache: OK" << endl;
+      }
+      MasterSymbolString lastMaster;
+      SlaveSymbolString lastSlave;
+      uint32_t sequence = reloadA->getLastData(&lastMaster, &lastSlave);
+      SlaveSymbolString longSlave;  // exceeding the inline storage
+      longSlave.parseHex("28000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627");
+      reloadA->storeLastData(master, longSlave);
+      MasterSymbolString longMaster;
+      SlaveSymbolString longLastSlave;
+      uint32_t longSequence = reloadA->getLastData(&longMaster, &longLastSlave);
+      if ((sequence & 1) != 0 || longSequence <= sequence || lastMaster.getStr() != master.getStr()
+          || lastSlave.getStr() != slave.getStr() || longLastSlave.getStr() != longSlave.getStr()) {
+        cout << "last data: error: " << lastSlave.getStr() << ", " << longLastSlave.getStr() << endl;
+        error = true;
+      } else {
+        cout << "last data: OK" << endl;
+      }
+      slave.clear();
+      slave.parseHex("0320ff00");
+      reloadA->storeLastData(master, slave);
+    }
+    size_t discarded = messages->discardRetainedStates();
+    if (retained != 3 || messages->getRestoredStates() != 2 || !reloadA || !reloadB
+        || reloadA->getLastUpdateTime() == 0 || reloadA->getLastSlaveData().getStr() != "0320ff00"
+        || reloadB->getLastUpdateTime() != 0 || discarded != 1 || messages->discardRetainedStates() != 0) {
+      cout << "retain: restore error: " << retained << " retained, " << messages->getRestoredStates() << " restored, "
+           << discarded << " discarded" << endl;
+      error = true;
+    } else {
+      cout << "retain: restore OK" << endl;
+    }
+  }
+
+  // check staged parsing
+  {
+    const char* stageddefs[] = {
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,first,,,08,b509,0d2a00,,,uch\n"
+      "r,cir,second,,,08,b509,0d2b00,,,uch\n",
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,third,,,08,b509,0d2c00,,,uch\n"
+      "r,cir,fourth,,,08,b509,0d2a00,,,uch\n"
+      "r,cir,fifth,,,08,b509,0d2d00,,,uch\n",
+    };
+    MessageMap* direct = new MessageMap(false, "", false);
+    MessageMap* merged = new MessageMap(false, "", false);
+    MessageMap* staging[2];
+    result_t results[2], directResults[2], mergedResults[2];
+    string errors[2], directErrors[2];
+    for (int index = 1; index >= 0; index--) {  // parse in reverse order
+      staging[index] = merged->createStaging();
+      istringstream stream(stageddefs[index]);
+      results[index] = staging[index]->readFromStream(&stream, __FILE__, 0, false, nullptr, &errors[index]);
+    }
+    for (int index = 0; index < 2; index++) {
+      istringstream stream(stageddefs[index]);
+      directResults[index] = direct->readFromStream(&stream, __FILE__, 0, false, nullptr, &directErrors[index]);
+      mergedResults[index] = merged->mergeStaged(staging[index], __FILE__, results[index], false, &errors[index]);
+      delete staging[index];
+    }
+    if (results[1] != RESULT_OK || mergedResults[0] != RESULT_OK || mergedResults[1] != RESULT_ERR_DUPLICATE
+        || mergedResults[1] != directResults[1] || errors[1] != directErrors[1]
+        || merged->size() != direct->size() || merged->size() != 3) {
+      cout << "staged: merge error: " << getResultCode(mergedResults[1]) << " " << errors[1] << ", expected "
+           << getResultCode(directResults[1]) << " " << directErrors[1] << endl;
+      error = true;
+    } else {
+      cout << "staged: merge OK" << endl;
+    }
+    delete merged;
+    delete direct;
+  }
+
+  // check swapping in a replacement
+  {
+    const char* swapdefs[] = {
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,kept,,,08,b509,0d3000,,,uch\n"
+      "r,cir,changed,,,08,b509,0d3100,,,uch\n",
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,kept,,,08,b509,0d3000,,,uch\n"
+      "r,cir,changed,,,08,b509,0d3100,,,uin\n"
+      "r,cir,added,,,08,b509,0d3200,,,uch\n",
+    };
+    MessageMap* current = new MessageMap(false, "", false);
+    MessageMap* replacement = current->createReplacement();
+    istringstream currentStream(swapdefs[0]), replacementStream(swapdefs[1]);
+    current->readFromStream(&currentStream, __FILE__, 0, false, nullptr, &errorDescription);
+    replacement->readFromStream(&replacementStream, __FILE__, 0, false, nullptr, &errorDescription);
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    master.parseHex("ff08b509030d3000");
+    slave.parseHex("0142");
+    Message* oldKept = current->find("cir", "kept", "", false);
+    Message* oldChanged = current->find("cir", "changed", "", false);
+    if (oldKept && oldChanged) {
+      oldKept->storeLastData(master, slave);
+      master.parseHex("ff08b509030d3100");
+      oldChanged->storeLastData(master, slave);
+    }
+    size_t reader = current->registerReader();
+    replacement->matchStates(current);
+    size_t generation = current->getGeneration();
+    size_t restored = current->swap(replacement);
+    Message* newKept = current->find("cir", "kept", "", false);
+    Message* newChanged = current->find("cir", "changed", "", false);
+    if (!oldKept || !newKept || newKept == oldKept || restored != 1 || current->size() != 3
+        || current->getGeneration() == generation || newKept->getLastSlaveData().getStr() != "0142"
+        || !newChanged || newChanged->getLastUpdateTime() != 0) {
+      cout << "swap: error: " << restored << " restored, " << current->size() << " messages" << endl;
+      error = true;
+    } else {
+      cout << "swap: OK" << endl;
+    }
+    // the old definitions stay alive until the registered reader passed a quiescent state
+    size_t beforeQuiescent = current->reclaimRetired();
+    bool oldAlive = oldKept && oldKept->getLastSlaveData().getStr() == "0142";
+    current->passQuiescentState(reader);
+    size_t afterQuiescent = current->reclaimRetired();
+    current->unregisterReader(reader);
+    if (reader >= MESSAGE_MAP_READERS || beforeQuiescent != 1 || !oldAlive || afterQuiescent != 0) {
+      cout << "swap: retire error: " << beforeQuiescent << ", " << afterQuiescent << endl;
+      error = true;
+    } else {
+      cout << "swap: retire OK" << endl;
+    }
+    delete current;
+  }
+
+  // check the cached condition results being invalidated by a change of the referenced message
+  {
+    const char* conddefs[] = {
+      "r,ehp,ident,,,08,b509,0d4301,,,UCH",
+      "*[hw],ehp,ident,,,,4;6",
+      "[hw]r,ehp,avail,,,08,b509,0d0100,,,UCH",
+    };
+    MessageMap* condMessages = new MessageMap(false, "", false);
+    dummystr.clear();
+    dummystr.str("#");
+    lineNo = 0;
+    condMessages->readLineFromStream(&dummystr, __FILE__, false, &lineNo, &row, &errorDescription, false, nullptr,
+        nullptr);
+    for (const auto def : conddefs) {
+      istringstream defstr(def);
+      condMessages->readLineFromStream(&defstr, __FILE__, false, &lineNo, &row, &errorDescription, false, nullptr,
+          nullptr);
+    }
+    result_t result = condMessages->resolveConditions(false, &errorDescription);
+    MasterSymbolString identMaster, availMaster;
+    SlaveSymbolString identSlave;
+    identMaster.parseHex("ff08b509030d4301");
+    availMaster.parseHex("ff08b509030d0100");
+    Message* ident = condMessages->find(identMaster);
+    bool before = condMessages->find(availMaster) != nullptr;
+    identSlave.parseHex("0104");
+    if (ident) {
+      ident->storeLastData(identMaster, identSlave);
+    }
+    bool matching = condMessages->find(availMaster) != nullptr;
+    identSlave.clear();
+    identSlave.parseHex("0105");  // changed within the same second
+    if (ident) {
+      ident->storeLastData(identMaster, identSlave);
+    }
+    bool changed = condMessages->find(availMaster) != nullptr;
+    if (result != RESULT_OK || !ident || before || !matching || changed) {
+      cout << "condition cache: error " << getResultCode(result) << ", " << errorDescription << ", " << before << ", "
+           << matching << ", " << changed << endl;
+      error = true;
+    } else {
+      cout << "condition cache: OK" << endl;
+    }
+    delete condMessages;
+  }
+
+  // check keeping the last seen data in a state file and restoring it lazily for identical definitions only
+  {
+    const char* statedefs[] = {
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,kept,,,08,b509,0d3000,,,uch\n"
+      "r,cir,changed,,,08,b509,0d3100,,,uch\n"
+      "r,cir,late,,,08,b509,0d3200,,,uch\n",
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,kept,,,08,b509,0d3000,,,uch\n"
+      "r,cir,changed,,,08,b509,0d3100,,,uin\n",
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,late,,,08,b509,0d3200,,,uch\n",
+    };
+    string stateFileName = "/tmp/test_message_state.bin";
+    unlink(stateFileName.c_str());
+    MessageMap* saved = new MessageMap(false, "", false);
+    istringstream savedStream(statedefs[0]);
+    saved->readFromStream(&savedStream, __FILE__, 0, false, nullptr, &errorDescription);
+    const char* ids[] = {"ff08b509030d3000", "ff08b509030d3100", "ff08b509030d3200"};
+    for (const auto id : ids) {
+      MasterSymbolString master;
+      SlaveSymbolString slave;
+      master.parseHex(id);
+      slave.parseHex("0142");
+      Message* message = saved->find(master);
+      if (message) {
+        message->storeLastData(master, slave);
+      }
+    }
+    StateFile writeFile;
+    writeFile.open(stateFileName);
+    writeFile.setValues("seen", vector<string>(1, "0801"));
+    size_t stored = saved->storeStates(&writeFile);
+    result_t writeResult = writeFile.write();
+    delete saved;
+    StateFile readFile;
+    result_t openResult = readFile.open(stateFileName);
+    vector<string> values;
+    bool hasValues = readFile.getValues("seen", &values) && values.size() == 1 && values[0] == "0801";
+    MessageMap* restored = new MessageMap(false, "", false);
+    istringstream restoredStream(statedefs[1]);
+    restored->readFromStream(&restoredStream, __FILE__, 0, false, nullptr, &errorDescription);
+    size_t restoredCount = restored->setStateFile(&readFile);
+    Message* kept = restored->find("cir", "kept", "", false);
+    Message* changed = restored->find("cir", "changed", "", false);
+    istringstream lateStream(statedefs[2]);
+    restored->readFromStream(&lateStream, __FILE__, 0, false, nullptr, &errorDescription);
+    Message* late = restored->find("cir", "late", "", false);
+    size_t pending = readFile.getStoredCount();
+    if (writeResult != RESULT_OK || openResult != RESULT_OK || stored != 3 || !hasValues || restoredCount != 1
+        || !kept || kept->getLastSlaveData().getStr() != "0142" || kept->getLastUpdateTime() == 0
+        || !changed || changed->getLastUpdateTime() != 0 || !late || late->getLastSlaveData().getStr() != "0142"
+        || pending != 1) {
+      cout << "state file: error " << getResultCode(writeResult) << ", " << getResultCode(openResult) << ", "
+           << stored << " stored, " << restoredCount << " restored, " << pending << " pending" << endl;
+      error = true;
+    } else {
+      cout << "state file: OK" << endl;
+    }
+    restored->setStateFile(nullptr);
+    delete restored;
+    unlink(stateFileName.c_str());
+  }
+
+  // check keeping the history of selected fields
+  {
+    HistoryStore store;
+    result_t configResult = store.configure("cir/hist/temp", 10*(sizeof(HistorySample)+2*sizeof(HistoryBucket)));
+    MessageMap* tracked = new MessageMap(false, "", false);
+    tracked->setHistoryStore(&store);
+    istringstream stream("type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+        "r,cir,hist,,,08,b509,0d4400,temp,,d1c\n");
+    tracked->readFromStream(&stream, __FILE__, 0, false, nullptr, &errorDescription);
+    Message* message = tracked->find("cir", "hist", "", false);
+    MasterSymbolString master;
+    SlaveSymbolString slave;
+    master.parseHex("ff08b509030d4400");
+    slave.parseHex("0142");
+    if (message) {
+      message->storeLastData(master, slave);
+    }
+    const vector<MessageHistory*>* histories = store.find("CIR", "hist");
+    size_t recorded = histories && histories->size() == 1 ? histories->front()->size() : 0;
+    ostringstream recordedValues;
+    if (recorded > 0) {
+      histories->front()->formatJson(0, &recordedValues);
+    }
+    string recordedStr = recordedValues.str();
+    bool recordedValue = recordedStr.length() > 7 && recordedStr.substr(recordedStr.length()-7) == ", 33]]}";
+    delete tracked;
+    MessageHistory history("cir", "down", "", 4);
+    for (int minute = 0; minute < 10; minute++) {
+      history.add(3600 + minute*60, static_cast<float>(minute));
+    }
+    ostringstream downsampled, plain;
+    history.formatJson(3600, &downsampled);
+    history.formatJson(0, &plain);
+    if (configResult != RESULT_OK || !message || recorded != 1 || !recordedValue
+        || downsampled.str() != "{\"interval\": 300, \"values\": [[3600, 0, 4, 2], [3900, 5, 9, 7]]}"
+        || plain.str() != "{\"interval\": 0, \"values\": [[3960, 6], [4020, 7], [4080, 8], [4140, 9]]}") {
+      cout << "history: error " << getResultCode(configResult) << ", " << recorded << " recorded, "
+           << recordedStr << ", " << downsampled.str() << ", " << plain.str() << endl;
+      error = true;
+    } else {
+      cout << "history: OK" << endl;
+    }
+  }
+
+  // check identical fields being shared across messages
+  {
+    const char* shareddefs =
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type\n"
+      "r,cir,one,,,08,b509,0d4000,temp,,d2c\n"
+      "r,cir,two,,,08,b509,0d4100,temp,,d2c\n"
+      "r,cir,three,,,08,b509,0d4200,temp,,d1c\n";
+    size_t countBefore, referencesBefore, count, references, countAfter, referencesAfter;
+    DataFieldPool::getStats(&countBefore, &referencesBefore);
+    MessageMap* shared = new MessageMap(false, "", false);
+    istringstream stream(shareddefs);
+    result_t result = shared->readFromStream(&stream, __FILE__, 0, false, nullptr, &errorDescription);
+    DataFieldPool::getStats(&count, &references);
+    delete shared;
+    DataFieldPool::getStats(&countAfter, &referencesAfter);
+    if (result != RESULT_OK || count != countBefore + 2 || references != referencesBefore + 3
+        || countAfter != countBefore || referencesAfter != referencesBefore) {
+      cout << "shared fields: error " << getResultCode(result) << ", " << (count - countBefore) << " distinct, "
+           << (references - referencesBefore) << " references" << endl;
+      error = true;
+    } else {
+      cout << "shared fields: OK" << endl;
+    }
+  }
+
+  // check interning of names and attribute values
+  {
+    const char* interndefs =
+      "type,circuit,name,comment,qq,zz,pbsb,id,*name,part,type,divisor/values,unit,comment\n"
+      "r,intern,one,first message,,08,b509,0d5000,temp,,d2c,,°C,outside\n"
+      "r,intern,two,second message,,08,b509,0d5100,temp,,d2c,,°C,inside\n";
+    size_t countBefore, poolBytesBefore, count, poolBytes, requestedBytes;
+    StringPool::resetRequestedBytes();
+    StringPool::getStats(&countBefore, &poolBytesBefore, &requestedBytes);
+    bool reset = requestedBytes == 0;
+    MessageMap* interned = new MessageMap(false, "", false);
+    istringstream stream(interndefs);
+    result_t result = interned->readFromStream(&stream, __FILE__, 0, false, nullptr, &errorDescription);
+    StringPool::getStats(&count, &poolBytes, &requestedBytes);
+    Message* one = interned->find("intern", "one", "", false);
+    Message* two = interned->find("intern", "two", "", false);
+    const string& unit = StringPool::intern("°C");
+    bool sameUnit = &StringPool::intern(string("°C")) == &unit;
+    StringPool::release(unit);
+    StringPool::release(unit);
+    if (result != RESULT_OK || !reset || requestedBytes == 0 || !one || !two
+        || &one->getCircuit() != &two->getCircuit() || one->getAttribute("comment") != "first message"
+        || two->getAttribute("comment") != "second message" || one->getAttribute("unknown") != "" || !sameUnit) {
+      cout << "intern: error " << getResultCode(result) << endl;
+      error = true;
+    } else {
+      cout << "intern: OK" << endl;
+    }
+    delete interned;
+    // the values no longer referenced by any definition are removed from the pool
+    size_t countAfter, poolBytesAfter;
+    StringPool::getStats(&countAfter, &poolBytesAfter, &requestedBytes);
+    if (count <= countBefore || countAfter != countBefore || poolBytesAfter != poolBytesBefore) {
+      cout << "intern release: error " << countBefore << " -> " << count << " -> " << countAfter << endl;
+      error = true;
+    } else {
+      cout << "intern release: OK" << endl;
+    }
+  }
+
+  // check the memory of deleted arena objects being reused
+  {
+    Arena arena, other;
+    AttributedItem* first;
+    AttributedItem* adopted;
+    {
+      ArenaScope scope(&arena);
+      first = new AttributedItem("first");
+    }
+    {
+      ArenaScope scope(&other);
+      adopted = new AttributedItem("adopted");
+    }
+    size_t bytes = arena.getBytes();
+    delete first;
+    bool freed = arena.getFreeBytes() > 0;
+    AttributedItem* second;
+    {
+      ArenaScope scope(&arena);
+      second = new AttributedItem("second");
+    }
+    bool reused = second == first && arena.getBytes() == bytes && arena.getFreeBytes() == 0;
+    arena.adopt(&other);
+    delete adopted;
+    bool forwarded = arena.getFreeBytes() > 0 && other.getFreeBytes() == 0;
+    delete second;
+    if (!freed || !reused || !forwarded) {
+      cout << "arena reuse: error " << freed << reused << forwarded << endl;
+      error = true;
+    } else {
+      cout << "arena reuse: OK" << endl;
+    }
+  }
+
   delete templates;
   delete messages;
   for (vector<MasterSymbolString*>::iterator it = mstrs.begin(); it != mstrs.end(); it++) {
@@ -18,6 +18,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <ctime>
 #include <string>
 #include <unordered_map>
 #include "lib/ebus/symbol.h"
@@ -119,6 +120,107 @@ int main(int argc, char** argv) {
     verify(false, "data size", "0427a90015a901", sstr.getDataSize() == 4, expectStr, gotStr);
   }
 
+  MasterSymbolString longStr;
+  for (size_t i = 0; i < SYMBOL_STRING_INLINE_SIZE+8; i++) {
+    longStr.push_back(static_cast<symbol_t>(i));
+  }
+  expectStr = longStr.getStr();
+  MasterSymbolString copyStr;
+  copyStr = longStr;
+  MasterSymbolString movedStr(std::move(longStr));
+  gotStr = movedStr.getStr();
+  verify(false, "move heap", expectStr, longStr.size() == 0 && copyStr == movedStr, expectStr, gotStr);
+  mstr.clear();
+  mstr.parseHex("10feb5050427a915aa");
+  MasterSymbolString movedInline(std::move(mstr));
+  gotStr = movedInline.getStr();
+  verify(false, "move inline", "10feb5050427a915aa", mstr.size() == 0, "10feb5050427a915aa", gotStr);
+
+  // check the span kernels against the symbol by symbol handling
+  bool spanOk = true;
+  for (size_t length = 0; length < 40 && spanOk; length++) {
+    symbol_t values[40], escaped[80], unescaped[80];
+    for (size_t pos = 0; pos < length; pos++) {
+      values[pos] = static_cast<symbol_t>((length * 31 + pos * 0x47) % 256);
+      if (pos % 7 == 3) {
+        values[pos] = pos % 2 ? ESC : SYN;
+      }
+    }
+    symbol_t expectCrc = 0, expectEscapedCrc = 0, gotCrc = 0, gotEscapedCrc = 0;
+    for (size_t pos = 0; pos < length; pos++) {
+      SymbolString::updateCrc(values[pos], &expectCrc);
+    }
+    SymbolString::updateCrc(values, length, &gotCrc);
+    size_t escapedLength = SymbolString::escape(values, length, escaped);
+    for (size_t pos = 0; pos < escapedLength; pos++) {
+      SymbolString::updateCrc(escaped[pos], &expectEscapedCrc);
+    }
+    SymbolString::updateCrcUnescaped(values, length, &gotEscapedCrc);
+    size_t unescapedLength = 0;
+    result = SymbolString::unescape(escaped, escapedLength, unescaped, &unescapedLength);
+    char hex[80], escapedHex[160];
+    SymbolString::formatHex(values, length, hex);
+    SymbolString::formatHex(escaped, escapedLength, escapedHex);
+    MasterSymbolString parsed;
+    result_t parsedResult = parsed.parseHexEscaped(string(escapedHex, 2 * escapedLength));
+    mstr.clear();
+    for (size_t pos = 0; pos < length; pos++) {
+      mstr.push_back(values[pos]);
+    }
+    spanOk = gotCrc == expectCrc && gotEscapedCrc == expectEscapedCrc && mstr.calcCrc() == expectEscapedCrc
+      && result == RESULT_OK && unescapedLength == length && memcmp(unescaped, values, length) == 0
+      && mstr.getStr() == string(hex, 2 * length) && parsedResult == RESULT_OK && parsed == mstr;
+  }
+  verify(false, "span kernels", "", spanOk, "", "");
+  symbol_t incomplete[] = {0x10, ESC}, invalid[] = {0x10, ESC, 0x02};
+  size_t written = 0;
+  verify(false, "unescape incomplete", "10a9",
+         SymbolString::unescape(incomplete, 2, incomplete, &written) == RESULT_CONTINUE && written == 1, "", "");
+  verify(false, "unescape invalid", "10a902",
+         SymbolString::unescape(invalid, 3, invalid, &written) == RESULT_ERR_ESC && written == 1, "", "");
+  mstr.clear();
+  verify(false, "parse escaped invalid", "10a9zz", mstr.parseHexEscaped("10a9zz") == RESULT_ERR_INVALID_NUM, "", "");
+  mstr.clear();
+  result = mstr.parseHexEscaped("10aa11");
+  verify(false, "parse escaped invalid", "10aa11", result == RESULT_ERR_ESC, "10", mstr.getStr());
+  mstr.clear();
+  result = mstr.parseHex("0A1b2");
+  verify(false, "parse mixed case", "0A1b2", result == RESULT_OK, "0a1b02", mstr.getStr());
+
+  // benchmark building, comparing, and keeping a typical telegram
+  const size_t iterations = 1000000;
+  MasterSymbolString lastMaster;
+  SlaveSymbolString lastSlave;
+  size_t changes = 0;
+  clock_t start = clock();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    MasterSymbolString master;
+    master.push_back(0x10);
+    master.push_back(0x08);
+    master.push_back(0xb5);
+    master.push_back(0x09);
+    master.push_back(0x03);
+    master.push_back(0x0d);
+    master.push_back(0x28);
+    master.push_back(static_cast<symbol_t>(iteration & 0x0f));
+    SlaveSymbolString slave;
+    for (symbol_t value = 0; value < 10; value++) {
+      slave.push_back(value);
+    }
+    slave.adjustHeader();
+    if (master.compareTo(lastMaster) != 0) {
+      lastMaster = master;
+      changes++;
+    }
+    if (slave != lastSlave) {
+      lastSlave = std::move(slave);
+    }
+  }
+  double elapsed = static_cast<double>(clock()-start)/CLOCKS_PER_SEC;
+  cout << "benchmark: " << dec << iterations << " telegrams (" << changes << " changes) in "
+       << static_cast<unsigned>(elapsed*1000) << " ms = "
+       << static_cast<unsigned>(elapsed*1000000000.0/static_cast<double>(iterations)) << " ns per telegram" << endl;
+
   int masterCnt = 0, slaveCnt = 0;
   for (int i=0; i<256; i++) {
     symbol_t address = static_cast<symbol_t>(i);
@@ -0,0 +1,85 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/utils/histogram.h"
+
+namespace ebusd {
+
+size_t Histogram::getBucket(unsigned int value) {
+  if (value < HISTOGRAM_LINEAR_BUCKETS) {
+    return value;
+  }
+  size_t bits = 3;  // highest set bit
+  while (bits < 31 && (value >> (bits+1)) != 0) {
+    bits++;
+  }
+  size_t bucket = HISTOGRAM_LINEAR_BUCKETS + (bits-3)*HISTOGRAM_SUB_BUCKETS
+      + ((value >> (bits-2)) & (HISTOGRAM_SUB_BUCKETS-1));
+  return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS-1;
+}
+
+unsigned int Histogram::getUpperBound(size_t bucket) {
+  if (bucket < HISTOGRAM_LINEAR_BUCKETS) {
+    return static_cast<unsigned int>(bucket);
+  }
+  size_t bits = 3 + (bucket-HISTOGRAM_LINEAR_BUCKETS)/HISTOGRAM_SUB_BUCKETS;
+  size_t sub = (bucket-HISTOGRAM_LINEAR_BUCKETS)%HISTOGRAM_SUB_BUCKETS;
+  return static_cast<unsigned int>(((HISTOGRAM_SUB_BUCKETS+sub+1) << (bits-2)) - 1);
+}
+
+void Histogram::add(unsigned int value) {
+  m_buckets[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  unsigned int max = m_max.load(std::memory_order_relaxed);
+  while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    // retry with updated max
+  }
+}
+
+void Histogram::reset() {
+  for (auto& bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  m_count.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+unsigned int Histogram::getPercentile(unsigned int percent) const {
+  uint64_t total = 0;
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    counts[bucket] = m_buckets[bucket].load(std::memory_order_relaxed);
+    total += counts[bucket];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t threshold = (total*percent+99)/100;
+  uint64_t sum = 0;
+  unsigned int max = getMax();
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    sum += counts[bucket];
+    if (sum >= threshold) {
+      unsigned int bound = getUpperBound(bucket);
+      return bound < max ? bound : max;
+    }
+  }
+  return max;
+}
+
+}  // namespace ebusd
@@ -0,0 +1,117 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_HISTOGRAM_H_
+#define LIB_UTILS_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace ebusd {
+
+/** \file lib/utils/histogram.h */
+
+using std::atomic;
+
+/** the number of exact buckets for the smallest values. */
+#define HISTOGRAM_LINEAR_BUCKETS 8
+
+/** the number of sub buckets per power of two above @a HISTOGRAM_LINEAR_BUCKETS. */
+#define HISTOGRAM_SUB_BUCKETS 4
+
+/** the total number of buckets (covering values up to 2^27-1). */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR_BUCKETS+24*HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Lock free histogram with fixed logarithmic buckets (precision of 25%) for determining percentiles.
+ */
+class Histogram {
+ public:
+  /**
+   * Constructor.
+   */
+  Histogram() : m_count(0), m_max(0) {
+    reset();
+  }
+
+  /**
+   * Add a value.
+   * @param value the value to add.
+   */
+  void add(unsigned int value);
+
+  /**
+   * Remove all values.
+   */
+  void reset();
+
+  /**
+   * Get the number of added values.
+   * @return the number of added values.
+   */
+  uint64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+
+  /**
+   * Get the maximum added value.
+   * @return the maximum added value, or 0.
+   */
+  unsigned int getMax() const { return m_max.load(std::memory_order_relaxed); }
+
+  /**
+   * Get the upper bound of the specified percentile.
+   * @param percent the percentile (1-100).
+   * @return the upper bound of the percentile, or 0 if no value was added.
+   */
+  unsigned int getPercentile(unsigned int percent) const;
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  Histogram(const Histogram& src);
+
+  /**
+   * Get the bucket index for the value.
+   * @param value the value.
+   * @return the bucket index.
+   */
+  static size_t getBucket(unsigned int value);
+
+  /**
+   * Get the largest value falling into the bucket.
+   * @param bucket the bucket index.
+   * @return the largest value falling into the bucket.
+   */
+  static unsigned int getUpperBound(size_t bucket);
+
+  /** the number of values per bucket. */
+  atomic<uint32_t> m_buckets[HISTOGRAM_BUCKETS];
+
+  /** the total number of added values. */
+  atomic<uint64_t> m_count;
+
+  /** the maximum added value. */
+  atomic<unsigned int> m_max;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_HISTOGRAM_H_
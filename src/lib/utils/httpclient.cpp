@@ -17,14 +17,20 @@
  */
 
 #include "lib/utils/httpclient.h"
+#include <sys/stat.h>
+#include <strings.h>
+#include <cerrno>
 #include <cstring>
 #include <cstdlib>
 #include <sstream>
+#include <fstream>
+#include <functional>
 
 namespace ebusd {
 
 using std::string;
 using std::ostringstream;
+using std::ofstream;
 using std::dec;
 using std::hex;
 
@@ -75,6 +81,7 @@ bool HttpClient::connect(const string& host, const uint16_t port, const string&
   if (!m_socket) {
     return false;
   }
+  m_connects++;
   m_host = host;
   m_port = port;
   m_timeout = timeout;
@@ -91,6 +98,7 @@ bool HttpClient::reconnect() {
   if (!m_socket) {
     return false;
   }
+  m_connects++;
   return true;
 }
 
@@ -123,17 +131,191 @@ const int indexToMonth[] = {
   -1, -1,  4, -1, -1, -1, -1, -1,  // 24-31
 };
 
+/**
+ * Parse an HTTP date string.
+ * @param str the date string, e.g. "Wed, 21 Oct 2015 07:28:00 GMT".
+ * @param time the variable in which to store the parsed time.
+ * @return true on success, false if the date string is invalid.
+ */
+static bool parseHttpDate(const string& str, time_t* time) {
+  if (str.length() < 29 || str.substr(25, 4) != " GMT") {
+    return false;
+  }
+  const char* hdrs = str.c_str();
+  struct tm t;
+  size_t pos = 5;
+  char* strEnd = nullptr;
+  t.tm_mday = static_cast<int>(strtol(hdrs + pos, &strEnd, 10));
+  if (strEnd != hdrs + pos + 2 || t.tm_mday < 1 || t.tm_mday > 31) {
+    t.tm_mday = -1;
+  }
+  t.tm_mon = indexToMonth[((hdrs[pos+4]&0x10)>>1) | (hdrs[pos+5]&0x17)] - 1;
+  strEnd = nullptr;
+  t.tm_year = static_cast<int>(strtol(hdrs + pos + 7, &strEnd, 10));
+  if (strEnd != hdrs + pos + 11 || t.tm_year < 1970 || t.tm_year >= 3000) {
+    t.tm_year = -1;
+  } else {
+    t.tm_year -= 1900;
+  }
+  strEnd = nullptr;
+  t.tm_hour = static_cast<int>(strtol(hdrs + pos + 12, &strEnd, 10));
+  if (strEnd != hdrs + pos + 14 || t.tm_hour > 23) {
+    t.tm_hour = -1;
+  }
+  strEnd = nullptr;
+  t.tm_min = static_cast<int>(strtol(hdrs + pos + 15, &strEnd, 10));
+  if (strEnd != hdrs + pos + 17 || t.tm_min > 59) {
+    t.tm_min = -1;
+  }
+  strEnd = nullptr;
+  t.tm_sec = static_cast<int>(strtol(hdrs + pos + 18, &strEnd, 10));
+  if (strEnd != hdrs + pos + 20 || t.tm_sec > 59) {
+    t.tm_sec = -1;
+  }
+  if (t.tm_mday > 0 && t.tm_mon >= 0 && t.tm_year >= 0 && t.tm_hour >= 0 && t.tm_min >=0 && t.tm_sec >= 0) {
+    *time = timegm(&t);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Find a header in the received HTTP headers.
+ * @param headers the received headers (each line terminated by CRLF).
+ * @param name the header name (case insensitive).
+ * @param value the variable in which to store the header value.
+ * @return true if the header was found.
+ */
+static bool findHeader(const string& headers, const string& name, string* value) {
+  size_t pos = 0;
+  while ((pos = headers.find("\r\n", pos)) != string::npos) {
+    pos += 2;
+    if (pos + name.length() + 1 > headers.length()) {
+      break;
+    }
+    if (headers[pos + name.length()] == ':' && strncasecmp(headers.c_str() + pos, name.c_str(), name.length()) == 0) {
+      size_t start = pos + name.length() + 1;
+      while (start < headers.length() && headers[start] == ' ') {
+        start++;
+      }
+      size_t end = headers.find("\r\n", start);
+      *value = headers.substr(start, end == string::npos ? end : end - start);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HttpClient::setCacheDir(const string& dir) {
+  m_cacheDir = dir;
+  if (dir.empty()) {
+    return true;
+  }
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    m_cacheDir = "";
+    return false;
+  }
+  return true;
+}
+
+string HttpClient::getCacheFile(const string& uri) const {
+  string key = m_host + ":" + std::to_string(m_port) + uri;
+  ostringstream ostr;
+  ostr << m_cacheDir << "/";
+  for (const auto ch : uri.substr(0, 64)) {
+    ostr << (isalnum(ch) || ch == '.' || ch == '-' ? ch : '_');
+  }
+  ostr << "-" << hex << std::hash<string>()(key) << ".cache";
+  return ostr.str();
+}
+
 bool HttpClient::request(const string& method, const string& uri, const string& body, string* response, time_t* time) {
+  bool useCache = !m_cacheDir.empty() && method == "GET" && body.empty();
+  string cacheFile, cachedHeaders, cachedBody, extraHeaders, value;
+  if (useCache) {
+    cacheFile = getCacheFile(uri);
+    ifstream cache(cacheFile.c_str(), std::ios::in | std::ios::binary);
+    if (cache.is_open()) {
+      ostringstream content;
+      content << cache.rdbuf();
+      cachedBody = content.str();
+      size_t pos = cachedBody.find("\r\n\r\n");
+      if (pos == string::npos) {
+        cachedBody.clear();
+      } else {
+        cachedHeaders = "\r\n" + cachedBody.substr(0, pos+2);
+        cachedBody.erase(0, pos+4);
+        if (findHeader(cachedHeaders, "ETag", &value)) {
+          extraHeaders += "If-None-Match: " + value + "\r\n";
+        }
+        if (findHeader(cachedHeaders, "Last-Modified", &value)) {
+          extraHeaders += "If-Modified-Since: " + value + "\r\n";
+        }
+      }
+    }
+  }
+  bool reused = m_socket && m_socket->isValid();
+  bool received = false;
+  string headers;
+  int status = exchange(method, uri, body, extraHeaders, &received, &headers, response);
+  if (status == 0 && reused && !received) {
+    // the kept alive connection was closed by the server in the meantime
+    disconnect();
+    status = exchange(method, uri, body, extraHeaders, &received, &headers, response);
+  }
+  if (status == 0) {
+    return false;
+  }
+  if (status == 304 && !cachedHeaders.empty()) {
+    m_notModified++;
+    *response = cachedBody;
+    headers = cachedHeaders;
+  } else if (status != 200) {
+    size_t endpos = headers.find("\r\n");
+    size_t pos = headers.find(' ');
+    *response = "receive error: " + headers.substr(pos+1, endpos == string::npos ? endpos : endpos-pos-1);
+    return false;
+  } else if (useCache) {
+    string store;
+    if (findHeader(headers, "ETag", &value)) {
+      store += "ETag: " + value + "\r\n";
+    }
+    if (findHeader(headers, "Last-Modified", &value)) {
+      store += "Last-Modified: " + value + "\r\n";
+    }
+    if (!store.empty()) {
+      string tmpFile = cacheFile + ".tmp";
+      ofstream cache(tmpFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (cache.is_open()) {
+        cache << store << "\r\n" << *response;
+        cache.close();
+        if (cache.fail() || rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+          unlink(tmpFile.c_str());
+        }
+      }
+    }
+  }
+  if (time && findHeader(headers, "Last-Modified", &value)) {
+    parseHttpDate(value, time);
+  }
+  return true;
+}
+
+int HttpClient::exchange(const string& method, const string& uri, const string& body, const string& extraHeaders,
+    bool* received, string* headers, string* response) {
+  *received = false;
   if (!ensureConnected()) {
     *response = "not connected";
-    return false;
+    return 0;
   }
   ostringstream ostr;
   ostr << method << " " << uri << " HTTP/1.0\r\n"
-       << "Host: " << m_host << "\r\n";
+       << "Host: " << m_host << "\r\n"
+       << "Connection: keep-alive\r\n";
   if (!m_userAgent.empty()) {
     ostr << "User-Agent: " << m_userAgent << "\r\n";
   }
+  ostr << extraHeaders;
   if (body.empty()) {
     ostr << "\r\n";
   } else {
@@ -145,91 +327,58 @@ bool HttpClient::request(const string& method, const string& uri, const string&
   string str = ostr.str();
   size_t len = str.size();
   const char* cstr = str.c_str();
+  m_requests++;
   for (size_t pos = 0; pos < len; ) {
     ssize_t sent = m_socket->send(cstr + pos, len - pos);
     if (sent < 0) {
       disconnect();
       *response = "send error";
-      return false;
+      return 0;
     }
     pos += sent;
   }
   string result;
   size_t pos = readUntil(" ", 4 * 1024, &result);  // max 4k headers
+  *received = !result.empty();
   if (pos == string::npos || pos > 8 || result.substr(0, 5) != "HTTP/") {
     disconnect();
     *response = "receive error (headers)";
-    return false;
-  }
-  if (result.substr(pos+1, 6) != "200 OK") {
-    disconnect();
-    size_t endpos = result.find("\r\n", pos+1);
-    *response = "receive error: " + result.substr(pos+1, endpos == string::npos ? endpos : endpos-pos-1);
-    return false;
+    return 0;
   }
+  int status = static_cast<int>(strtol(result.c_str() + pos + 1, nullptr, 10));
   pos = readUntil("\r\n\r\n", 4 * 1024, &result);  // max 4k headers
-  if (pos == string::npos) {
+  if (pos == string::npos || status <= 0) {
     disconnect();
     *response = "receive error (headers)";
-    return false;
+    return 0;
   }
-  string headers = result.substr(0, pos+2);  // including final \r\n
-  const char* hdrs = headers.c_str();
+  *headers = result.substr(0, pos+2);  // including final \r\n
   *response = result.substr(pos+4);
-  if (time) {
-    pos = headers.find("\r\nLast-Modified: ");
-    if (pos != string::npos && headers.substr(pos+42, 4) == " GMT") {
-      // Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT
-      struct tm t;
-      pos += strlen("\r\nLast-Modified: ") + 5;
-      char* strEnd = nullptr;
-      t.tm_mday = static_cast<int>(strtol(hdrs + pos, &strEnd, 10));
-      if (strEnd != hdrs + pos + 2 || t.tm_mday < 1 || t.tm_mday > 31) {
-        t.tm_mday = -1;
-      }
-      t.tm_mon = indexToMonth[((hdrs[pos+4]&0x10)>>1) | (hdrs[pos+5]&0x17)] - 1;
-      strEnd = nullptr;
-      t.tm_year = static_cast<int>(strtol(hdrs + pos + 7, &strEnd, 10));
-      if (strEnd != hdrs + pos + 11 || t.tm_year < 1970 || t.tm_year >= 3000) {
-        t.tm_year = -1;
-      } else {
-        t.tm_year -= 1900;
-      }
-      strEnd = nullptr;
-      t.tm_hour = static_cast<int>(strtol(hdrs + pos + 12, &strEnd, 10));
-      if (strEnd != hdrs + pos + 14 || t.tm_hour > 23) {
-        t.tm_hour = -1;
-      }
-      strEnd = nullptr;
-      t.tm_min = static_cast<int>(strtol(hdrs + pos + 15, &strEnd, 10));
-      if (strEnd != hdrs + pos + 17 || t.tm_min > 59) {
-        t.tm_min = -1;
-      }
-      strEnd = nullptr;
-      t.tm_sec = static_cast<int>(strtol(hdrs + pos + 18, &strEnd, 10));
-      if (strEnd != hdrs + pos + 20 || t.tm_sec > 59) {
-        t.tm_sec = -1;
-      }
-      if (t.tm_mday > 0 && t.tm_mon >= 0 && t.tm_year >= 0 && t.tm_hour >= 0 && t.tm_min >=0 && t.tm_sec >= 0) {
-        *time = timegm(&t);
-      }
+  string value;
+  bool keepAlive = findHeader(*headers, "Connection", &value) && strcasecmp(value.c_str(), "keep-alive") == 0;
+  if (status == 304 || status == 204) {
+    response->clear();  // no body
+  } else if (findHeader(*headers, "Content-Length", &value)) {
+    char* strEnd = nullptr;
+    unsigned long length = strtoul(value.c_str(), &strEnd, 10);
+    if (strEnd == nullptr || *strEnd != '\0') {
+      disconnect();
+      *response = "invalid content length ";
+      return 0;
     }
+    if (readUntil("", length, response) != length) {
+      disconnect();
+      *response = "receive error (body)";
+      return 0;
+    }
+  } else {
+    readUntil("", string::npos, response);  // read until closed by the server
+    keepAlive = false;
   }
-  pos = headers.find("\r\nContent-Length: ");
-  if (pos == string::npos) {
-    disconnect();
-    return true;
-  }
-  char* strEnd = nullptr;
-  unsigned long length = strtoul(hdrs + pos + strlen("\r\nContent-Length: "), &strEnd, 10);
-  if (strEnd == nullptr || *strEnd != '\r') {
+  if (!keepAlive) {
     disconnect();
-    *response = "invalid content length ";
-    return false;
   }
-  pos = readUntil("", length, response);
-  disconnect();
-  return pos == length;
+  return status;
 }
 
 size_t HttpClient::readUntil(const string& delim, const size_t length, string* result) {
@@ -43,7 +43,8 @@ class HttpClient {
   /**
    * Constructor.
    */
-  HttpClient() : m_port(0), m_timeout(0), m_socket(nullptr), m_bufferSize(0), m_buffer(nullptr) {}
+  HttpClient() : m_port(0), m_timeout(0), m_socket(nullptr), m_bufferSize(0), m_buffer(nullptr), m_requests(0),
+    m_connects(0), m_notModified(0) {}
 
   /**
    * Destructor.
@@ -94,6 +95,32 @@ class HttpClient {
    */
   void disconnect();
 
+  /**
+   * Set the directory for caching the responses of GET requests in order to revalidate them with the server via
+   * "If-None-Match"/"If-Modified-Since" and serve the cached content on "304 Not Modified".
+   * @param dir the directory to cache the responses in (created if necessary), or empty to disable caching.
+   * @return true on success, false if the directory is not available.
+   */
+  bool setCacheDir(const string& dir);
+
+  /**
+   * Get the number of requests sent to the server.
+   * @return the number of requests sent to the server.
+   */
+  unsigned int getRequests() const { return m_requests; }
+
+  /**
+   * Get the number of connections established to the server.
+   * @return the number of connections established to the server.
+   */
+  unsigned int getConnects() const { return m_connects; }
+
+  /**
+   * Get the number of GET requests served from the cache after revalidation with the server.
+   * @return the number of GET requests served from the cache after revalidation with the server.
+   */
+  unsigned int getNotModified() const { return m_notModified; }
+
   /**
    * Execute a GET request.
    * @param uri the URI string.
@@ -125,6 +152,27 @@ class HttpClient {
   bool request(const string& method, const string& uri, const string& body, string* response, time_t* time = nullptr);
 
  private:
+  /**
+   * Send a single request over the (possibly kept alive) connection and receive the response.
+   * @param method the method string.
+   * @param uri the URI string.
+   * @param body the optional body to send.
+   * @param extraHeaders additional request headers (each terminated by CRLF).
+   * @param received set to true when at least parts of the response were received.
+   * @param headers the received response headers (including the status line).
+   * @param response the response body from the server (or the error message).
+   * @return the HTTP status code, or 0 on error.
+   */
+  int exchange(const string& method, const string& uri, const string& body, const string& extraHeaders,
+      bool* received, string* headers, string* response);
+
+  /**
+   * Get the name of the cache file for the specified URI.
+   * @param uri the URI string.
+   * @return the name of the cache file.
+   */
+  string getCacheFile(const string& uri) const;
+
   /**
    * Read from the connected socket until the specified delimiter is found or the specified number of bytes was received.
    * @param delim the delimiter to find, or empty for reading the specified number of bytes.
@@ -158,6 +206,18 @@ class HttpClient {
 
   /** the buffer for preparing/receiving data. */
   char* m_buffer;
+
+  /** the directory for caching GET responses, or empty. */
+  string m_cacheDir;
+
+  /** the number of requests sent to the server. */
+  unsigned int m_requests;
+
+  /** the number of connections established to the server. */
+  unsigned int m_connects;
+
+  /** the number of GET requests served from the cache after revalidation. */
+  unsigned int m_notModified;
 };
 
 }  // namespace ebusd
@@ -27,10 +27,29 @@
 #include <sys/time.h>
 #include <stdarg.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include "lib/utils/clock.h"
+#include "lib/utils/ringbuffer.h"
+#include "lib/utils/thread.h"
 
 namespace ebusd {
 
+using std::vector;
+
+/** the maximum length of a facility name in a @a LogRecord (including the trailing zero). */
+#define LOG_FACILITY_SIZE 16
+
+/** the maximum length of a message stored directly in a @a LogRecord (including the trailing zero). */
+#define LOG_MESSAGE_SIZE 208
+
+/** the number of @a LogRecord instances preallocated per thread. */
+#define LOG_RING_SIZE 128
+
+/** the number of milliseconds between writing the pending @a LogRecord instances. */
+#define LOG_FLUSH_INTERVAL 50
+
 /** the name of each @a LogFacility. */
 static const char *facilityNames[] = {
   "main",
@@ -58,6 +77,98 @@ static LogLevel s_facilityLogLevel[] = { ll_notice, ll_notice, ll_notice, ll_not
 /** the current log FILE. */
 static FILE* s_logFile = stdout;
 
+/** A log message formatted for asynchronous writing. */
+struct LogRecord {
+  struct timespec time;  //!< the time of the message
+  char facility[LOG_FACILITY_SIZE];  //!< the facility name
+  const char* level;  //!< the level name
+  char message[LOG_MESSAGE_SIZE];  //!< the message if short enough
+  char* longMessage;  //!< the allocated message if too long for @a message, or nullptr
+};
+
+/** the @a RingBuffer instances of all threads (only accessed with @a s_asyncMutex held). */
+static vector<RingBuffer<LogRecord>*> s_asyncRecords;
+
+/** the @a Mutex for exclusive access to @a s_asyncRecords and for reading from each @a RingBuffer. */
+static Mutex s_asyncMutex;
+
+static void writeAsyncRecords();
+
+/**
+ * The per thread @a RingBuffer of @a LogRecord instances that is unregistered and freed when the thread exits.
+ */
+class ThreadRecords {
+ public:
+  /**
+   * Constructor.
+   */
+  ThreadRecords() : m_ring(nullptr) {}
+
+  /**
+   * Destructor.
+   */
+  ~ThreadRecords() {
+    if (m_ring == nullptr) {
+      return;
+    }
+    s_asyncMutex.lock();
+    writeAsyncRecords();
+    s_asyncRecords.erase(std::remove(s_asyncRecords.begin(), s_asyncRecords.end(), m_ring), s_asyncRecords.end());
+    s_asyncMutex.unlock();
+    delete m_ring;
+    m_ring = nullptr;
+  }
+
+  /**
+   * Get the @a RingBuffer and create and register it on first use.
+   * @return the @a RingBuffer of the current thread.
+   */
+  RingBuffer<LogRecord>* get() {
+    if (m_ring == nullptr) {
+      m_ring = new RingBuffer<LogRecord>(LOG_RING_SIZE);
+      s_asyncMutex.lock();
+      s_asyncRecords.push_back(m_ring);
+      s_asyncMutex.unlock();
+    }
+    return m_ring;
+  }
+
+
+ private:
+  /** the @a RingBuffer, or nullptr. */
+  RingBuffer<LogRecord>* m_ring;
+};
+
+/** the per thread @a RingBuffer of @a LogRecord instances for asynchronous logging. */
+static thread_local ThreadRecords s_threadRecords;
+
+/**
+ * Helper thread for writing the asynchronous @a LogRecord instances in batches.
+ */
+class LogWriter : public WaitThread {
+ public:
+  /**
+   * Constructor.
+   */
+  LogWriter() : WaitThread() {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~LogWriter() {}
+
+
+ protected:
+  // @copydoc
+  void run() override;
+};
+
+/** the @a LogWriter for asynchronous logging, or nullptr. */
+static LogWriter* s_logWriter = nullptr;
+
+/** whether asynchronous logging is enabled. */
+static std::atomic<bool> s_logAsync(false);
+
 LogFacility parseLogFacility(const char* facility) {
   if (!facility) {
     return lf_COUNT;
@@ -136,28 +247,150 @@ bool setLogFile(const char* filename) {
   if (newFile == nullptr) {
     return false;
   }
+  s_asyncMutex.lock();
   closeLogFile();
   s_logFile = newFile;
+  s_asyncMutex.unlock();
+  return true;
+}
+
+/**
+ * Write all pending asynchronous @a LogRecord instances to the log file (requires @a s_asyncMutex held).
+ */
+static void writeAsyncRecords() {
+  static vector<LogRecord> records;
+  records.clear();
+  LogRecord record;
+  for (auto ring : s_asyncRecords) {
+    while (ring->pop(&record)) {
+      records.push_back(record);
+    }
+  }
+  if (records.empty()) {
+    return;
+  }
+  if (s_asyncRecords.size() > 1) {
+    std::stable_sort(records.begin(), records.end(), [](const LogRecord& a, const LogRecord& b) {
+      return a.time.tv_sec < b.time.tv_sec || (a.time.tv_sec == b.time.tv_sec && a.time.tv_nsec < b.time.tv_nsec);
+    });
+  }
+  struct tm td;
+  for (auto& entry : records) {
+    if (s_logFile != nullptr) {
+      localtime_r(&entry.time.tv_sec, &td);
+      fprintf(s_logFile, "%04d-%02d-%02d %02d:%02d:%02d.%03ld [%s %s] %s\n",
+        td.tm_year+1900, td.tm_mon+1, td.tm_mday,
+        td.tm_hour, td.tm_min, td.tm_sec, entry.time.tv_nsec/1000000,
+        entry.facility, entry.level, entry.longMessage ? entry.longMessage : entry.message);
+    }
+    if (entry.longMessage) {
+      free(entry.longMessage);
+    }
+  }
+  if (s_logFile != nullptr) {
+    fflush(s_logFile);
+  }
+}
+
+void LogWriter::run() {
+  while (Wait(0, LOG_FLUSH_INTERVAL)) {
+    s_asyncMutex.lock();
+    writeAsyncRecords();
+    s_asyncMutex.unlock();
+  }
+}
+
+bool setLogAsync(bool async) {
+  if (async == s_logAsync) {
+    return false;
+  }
+  if (async) {
+    s_logWriter = new LogWriter();
+    if (!s_logWriter->start("logwriter")) {
+      delete s_logWriter;
+      s_logWriter = nullptr;
+      return false;
+    }
+    s_logAsync = true;
+    return true;
+  }
+  s_logAsync = false;
+  s_logWriter->stop();
+  s_logWriter->join();
+  delete s_logWriter;
+  s_logWriter = nullptr;
+  s_asyncMutex.lock();
+  writeAsyncRecords();
+  s_asyncMutex.unlock();
   return true;
 }
 
 void closeLogFile() {
+  s_asyncMutex.lock();
+  writeAsyncRecords();
   if (s_logFile != nullptr) {
     if (s_logFile != stdout) {
       fclose(s_logFile);
     }
     s_logFile = nullptr;
   }
+  s_asyncMutex.unlock();
 }
 
 bool needsLog(const LogFacility facility, const LogLevel level) {
   return s_facilityLogLevel[facility] >= level;
 }
 
+/**
+ * Add the message to the asynchronous @a LogRecord instances of the current thread.
+ * @param facility the facility name of the message to log.
+ * @param level the level name of the message to log.
+ * @param message the message to log.
+ * @param ap the variable arguments depending on the @a message.
+ */
+static void logWriteAsync(const char* facility, const char* level, const char* message, va_list ap) {
+  RingBuffer<LogRecord>* ring = s_threadRecords.get();
+  LogRecord record;
+  clockGettime(&record.time);
+  strncpy(record.facility, facility, LOG_FACILITY_SIZE-1);
+  record.facility[LOG_FACILITY_SIZE-1] = 0;
+  record.level = level;
+  record.longMessage = nullptr;
+  va_list aq;
+  va_copy(aq, ap);
+  int len = vsnprintf(record.message, LOG_MESSAGE_SIZE, message, aq);
+  va_end(aq);
+  if (len < 0) {
+    return;
+  }
+  if (len >= LOG_MESSAGE_SIZE && (vasprintf(&record.longMessage, message, ap) < 0 || !record.longMessage)) {
+    record.longMessage = nullptr;  // keep the truncated message
+  }
+  if (!ring->push(record)) {
+    // ring is full: write everything pending synchronously and retry
+    s_asyncMutex.lock();
+    writeAsyncRecords();
+    s_asyncMutex.unlock();
+    if (!ring->push(record) && record.longMessage) {
+      free(record.longMessage);
+    }
+  }
+  if (!s_logAsync) {
+    // asynchronous logging was switched off meanwhile and the final drain might have missed this record
+    s_asyncMutex.lock();
+    writeAsyncRecords();
+    s_asyncMutex.unlock();
+  }
+}
+
 void logWrite(const char* facility, const char* level, const char* message, va_list ap) {
   if (s_logFile == nullptr) {
     return;
   }
+  if (s_logAsync) {
+    logWriteAsync(facility, level, message, ap);
+    return;
+  }
   struct timespec ts;
   struct tm td;
   clockGettime(&ts);
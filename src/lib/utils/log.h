@@ -108,6 +108,16 @@ bool setLogFile(const char* filename);
  */
 void closeLogFile();
 
+/**
+ * Enable or disable asynchronous logging.
+ * When enabled, the log messages are formatted into per thread preallocated records and written to the log file
+ * in batches by a background thread.
+ * Note: this has to be called after forking the daemon process and before exiting.
+ * @param async true to enable asynchronous logging, false to write all pending messages and log synchronously again.
+ * @return true when the mode was changed.
+ */
+bool setLogAsync(bool async);
+
 /**
  * Return whether logging is needed for the specified facility and level.
  * @param facility the @a LogFacility of the message to check.
@@ -0,0 +1,105 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/utils/metrics.h"
+
+namespace ebusd {
+
+void MetricsWriter::family(const char* name, bool counter, const char* title) {
+  m_name = name;
+  m_title = title;
+  if (m_prometheus) {
+    *m_output << "# HELP " << name << " " << title << "\n"
+              << "# TYPE " << name << (counter ? " counter\n" : " gauge\n");
+  }
+}
+
+void MetricsWriter::writeKey(const char* labelName, const char* labelValue, const char* label2Name,
+    const char* label2Value) {
+  if (!m_prometheus) {
+    *m_output << "\n" << m_title;
+    if (labelName) {
+      *m_output << " " << labelValue;
+    }
+    if (label2Name) {
+      *m_output << " " << label2Value;
+    }
+    *m_output << ":";
+    return;
+  }
+  *m_output << m_name;
+  if (labelName) {
+    *m_output << "{" << labelName << "=\"" << labelValue << "\"";
+    if (label2Name) {
+      *m_output << "," << label2Name << "=\"" << label2Value << "\"";
+    }
+    *m_output << "}";
+  }
+}
+
+void MetricsWriter::sample(uint64_t value, const char* labelName, const char* labelValue, const char* label2Name,
+    const char* label2Value) {
+  writeKey(labelName, labelValue, label2Name, label2Value);
+  *m_output << " " << std::dec << value << (m_prometheus ? "\n" : "");
+}
+
+void MetricsWriter::sample(double value, const char* labelName, const char* labelValue) {
+  writeKey(labelName, labelValue, nullptr, nullptr);
+  *m_output << " " << std::dec << value << (m_prometheus ? "\n" : "");
+}
+
+const char* MemoryUsage::getKindName(MemoryKind kind) {
+  switch (kind) {
+  case mk_messages: return "messages";
+  case mk_fields: return "fields";
+  case mk_templates: return "templates";
+  case mk_conditions: return "conditions";
+  case mk_instructions: return "instructions";
+  case mk_strings: return "strings";
+  case mk_lastData: return "last_data";
+  case mk_grabbed: return "grabbed";
+  case mk_scanResults: return "scan_results";
+  case mk_connections: return "connections";
+  case mk_queues: return "queues";
+  case mk_history: return "history";
+  default: return "other";
+  }
+}
+
+void MemoryUsage::formatInfo(ostream* output) const {
+  size_t totalBytes = 0;
+  for (size_t kind = 0; kind < MEMORY_KINDS; kind++) {
+    *output << getKindName(static_cast<MemoryKind>(kind)) << ": " << m_objects[kind] << " objects, "
+            << m_bytes[kind] << " bytes\n";
+    totalBytes += m_bytes[kind];
+  }
+  *output << "total: " << totalBytes << " bytes";
+}
+
+void MemoryUsage::formatMetrics(MetricsWriter* writer) const {
+  writer->family("ebusd_memory_objects", false, "memory objects");
+  for (size_t kind = 0; kind < MEMORY_KINDS; kind++) {
+    writer->sample(static_cast<uint64_t>(m_objects[kind]), "kind", getKindName(static_cast<MemoryKind>(kind)));
+  }
+  writer->family("ebusd_memory_bytes", false, "memory bytes");
+  for (size_t kind = 0; kind < MEMORY_KINDS; kind++) {
+    writer->sample(static_cast<uint64_t>(m_bytes[kind]), "kind", getKindName(static_cast<MemoryKind>(kind)));
+  }
+}
+
+}  // namespace ebusd
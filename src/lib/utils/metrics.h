@@ -0,0 +1,370 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_METRICS_H_
+#define LIB_UTILS_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+
+namespace ebusd {
+
+/** \file lib/utils/metrics.h
+ * Cheap performance counters and their formatting for the "info" command and
+ * in Prometheus text format.
+ *
+ * A @a Counter is written by a single thread only (e.g. the bus thread), so
+ * that incrementing it is a plain relaxed load and store without any locked
+ * instruction. A @a SharedCounter is written by several threads and keeps one
+ * cache line per thread slot, so that concurrent writers do not contend.
+ * The counters are header only for being usable in the ebus library as well.
+ * A @a MemoryUsage collects the approximate heap usage of the configuration and runtime state by kind.
+ */
+
+using std::atomic;
+using std::ostream;
+using std::string;
+
+/** the number of thread slots of a @a SharedCounter. */
+#define COUNTER_SHARDS 8
+
+/** the assumed cache line size for separating the thread slots of a @a SharedCounter. */
+#define COUNTER_CACHE_LINE 64
+
+/** the approximate overhead of a node in a tree, list, or hash container. */
+#define MEMORY_NODE_OVERHEAD (4*sizeof(void*))
+
+/**
+ * A monotonic counter written by a single thread and readable by any thread.
+ */
+class Counter {
+ public:
+  /**
+   * Constructor.
+   */
+  Counter() : m_value(0) {}
+
+  /**
+   * Increase the counter (only called by the owning thread).
+   * @param value the value to add.
+   */
+  void add(uint64_t value = 1) {
+    m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the current value.
+   * @return the current value.
+   */
+  uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  Counter(const Counter& src);
+
+  /** the current value. */
+  atomic<uint64_t> m_value;
+};
+
+
+/**
+ * A monotonic counter written by any thread with a separate slot per thread.
+ */
+class SharedCounter {
+ public:
+  /**
+   * Constructor.
+   */
+  SharedCounter() {
+    for (auto& shard : m_shards) {
+      shard.m_value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Increase the counter.
+   * @param value the value to add.
+   */
+  void add(uint64_t value = 1) {
+    m_shards[getShard()].m_value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the current value (the sum of all thread slots).
+   * @return the current value.
+   */
+  uint64_t get() const {
+    uint64_t sum = 0;
+    for (const auto& shard : m_shards) {
+      sum += shard.m_value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  SharedCounter(const SharedCounter& src);
+
+  /**
+   * Get the slot index of the calling thread (assigned round robin on first use).
+   * @return the slot index of the calling thread.
+   */
+  static size_t getShard() {
+    static atomic<size_t> nextShard(0);
+    static thread_local size_t threadShard = nextShard.fetch_add(1, std::memory_order_relaxed) % COUNTER_SHARDS;
+    return threadShard;
+  }
+
+  /** a thread slot padded to the size of a cache line (so that no two values share a cache line). */
+  struct Shard {
+    /** the value of the slot. */
+    atomic<uint64_t> m_value;
+
+    /** the padding to the next slot. */
+    char m_padding[COUNTER_CACHE_LINE-sizeof(atomic<uint64_t>)];
+  };
+
+  /** the thread slots. */
+  Shard m_shards[COUNTER_SHARDS];
+};
+
+
+/**
+ * Measures the elapsed time of a scope and adds it to a @a SharedCounter in nanoseconds together with the call count.
+ */
+class ScopeTimer {
+ public:
+  /**
+   * Constructor.
+   * @param calls the @a SharedCounter for the number of calls.
+   * @param nanos the @a SharedCounter for the elapsed nanoseconds.
+   */
+  ScopeTimer(SharedCounter* calls, SharedCounter* nanos) : m_calls(calls), m_nanos(nanos), m_start(getNanos()) {}
+
+  /**
+   * Destructor.
+   */
+  ~ScopeTimer() {
+    m_calls->add();
+    m_nanos->add(getNanos() - m_start);
+  }
+
+  /**
+   * Get the monotonic clock time.
+   * @return the monotonic clock time in nanoseconds.
+   */
+  static uint64_t getNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec)*1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+  }
+
+
+ private:
+  /** the @a SharedCounter for the number of calls. */
+  SharedCounter* m_calls;
+
+  /** the @a SharedCounter for the elapsed nanoseconds. */
+  SharedCounter* m_nanos;
+
+  /** the monotonic clock time at construction in nanoseconds. */
+  uint64_t m_start;
+};
+
+
+/**
+ * Writes metric samples either in Prometheus text format or as lines for the "info" command.
+ */
+class MetricsWriter {
+ public:
+  /**
+   * Constructor.
+   * @param prometheus true for Prometheus text format, false for the lines of the "info" command.
+   * @param output the @a ostream to write to.
+   */
+  MetricsWriter(bool prometheus, ostream* output) : m_prometheus(prometheus), m_output(output),
+    m_name(nullptr), m_title(nullptr) {}
+
+  /**
+   * Start a metric family.
+   * @param name the metric name (with "ebusd_" prefix and "_total" suffix for counters as used by Prometheus).
+   * @param counter true for a counter, false for a gauge.
+   * @param title the title of the metric used as help text and in the "info" lines.
+   */
+  void family(const char* name, bool counter, const char* title);
+
+  /**
+   * Write a sample of the current family.
+   * @param value the value of the sample.
+   * @param labelName the optional name of a label.
+   * @param labelValue the value of the label.
+   * @param label2Name the optional name of a second label.
+   * @param label2Value the value of the second label.
+   */
+  void sample(uint64_t value, const char* labelName = nullptr, const char* labelValue = nullptr,
+      const char* label2Name = nullptr, const char* label2Value = nullptr);
+
+  /**
+   * Write a sample of the current family with a fractional value.
+   * @param value the value of the sample.
+   * @param labelName the optional name of a label.
+   * @param labelValue the value of the label.
+   */
+  void sample(double value, const char* labelName = nullptr, const char* labelValue = nullptr);
+
+  /**
+   * Return whether writing in Prometheus text format.
+   * @return true for Prometheus text format, false for the lines of the "info" command.
+   */
+  bool isPrometheus() const { return m_prometheus; }
+
+
+ private:
+  /**
+   * Write the name and labels of a sample.
+   * @param labelName the optional name of a label.
+   * @param labelValue the value of the label.
+   * @param label2Name the optional name of a second label.
+   * @param label2Value the value of the second label.
+   */
+  void writeKey(const char* labelName, const char* labelValue, const char* label2Name, const char* label2Value);
+
+  /** true for Prometheus text format, false for the lines of the "info" command. */
+  const bool m_prometheus;
+
+  /** the @a ostream to write to. */
+  ostream* m_output;
+
+  /** the name of the current family. */
+  const char* m_name;
+
+  /** the title of the current family. */
+  const char* m_title;
+};
+
+
+/** the kinds of memory reported by @a MemoryUsage. */
+enum MemoryKind {
+  mk_messages,  //!< the message instances and their indexes
+  mk_fields,  //!< the data fields of the messages
+  mk_templates,  //!< the data field templates
+  mk_conditions,  //!< the conditions
+  mk_instructions,  //!< the instructions
+  mk_strings,  //!< the interned strings
+  mk_lastData,  //!< the last seen data of the messages
+  mk_grabbed,  //!< the grabbed messages
+  mk_scanResults,  //!< the scan results
+  mk_connections,  //!< the network connections and their buffers
+  mk_queues,  //!< the queued requests
+  mk_history,  //!< the kept history of selected message fields
+};
+
+/** the number of @a MemoryKind values. */
+#define MEMORY_KINDS (mk_history+1)
+
+/**
+ * Collects the approximate number of objects and heap bytes by @a MemoryKind.
+ */
+class MemoryUsage {
+ public:
+  /**
+   * Constructor.
+   */
+  MemoryUsage() {
+    for (size_t kind = 0; kind < MEMORY_KINDS; kind++) {
+      m_objects[kind] = m_bytes[kind] = 0;
+    }
+  }
+
+  /**
+   * Add objects and their bytes.
+   * @param kind the @a MemoryKind.
+   * @param bytes the approximate number of bytes.
+   * @param objects the number of objects.
+   */
+  void add(MemoryKind kind, size_t bytes, size_t objects = 1) {
+    m_objects[kind] += objects;
+    m_bytes[kind] += bytes;
+  }
+
+  /**
+   * Get the number of objects.
+   * @param kind the @a MemoryKind.
+   * @return the number of objects.
+   */
+  size_t getObjects(MemoryKind kind) const { return m_objects[kind]; }
+
+  /**
+   * Get the approximate number of bytes.
+   * @param kind the @a MemoryKind.
+   * @return the approximate number of bytes.
+   */
+  size_t getBytes(MemoryKind kind) const { return m_bytes[kind]; }
+
+  /**
+   * Return the approximate number of heap bytes used by a string in addition to its own size.
+   * @param str the string.
+   * @return the approximate number of heap bytes (strings up to 15 characters are stored inline).
+   */
+  static size_t getHeapSize(const string& str) {
+    return str.capacity() > 15 ? str.capacity() + 1 : 0;
+  }
+
+  /**
+   * Get the name of a @a MemoryKind.
+   * @param kind the @a MemoryKind.
+   * @return the name of the @a MemoryKind.
+   */
+  static const char* getKindName(MemoryKind kind);
+
+  /**
+   * Format the collected usage as lines for the "info memory" command.
+   * @param output the @a ostream to write to.
+   */
+  void formatInfo(ostream* output) const;
+
+  /**
+   * Format the collected usage as metrics.
+   * @param writer the @a MetricsWriter to write to.
+   */
+  void formatMetrics(MetricsWriter* writer) const;
+
+
+ private:
+  /** the number of objects by @a MemoryKind. */
+  size_t m_objects[MEMORY_KINDS];
+
+  /** the approximate number of bytes by @a MemoryKind. */
+  size_t m_bytes[MEMORY_KINDS];
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_METRICS_H_
@@ -21,13 +21,17 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdint.h>
+#ifdef HAVE_EVENTFD
+#  include <sys/eventfd.h>
+#endif
 
 namespace ebusd {
 
 /** \file lib/utils/notify.h */
 
 /**
- * class to notify other thread per pipe.
+ * class to notify other thread per eventfd (if available) or pipe.
  */
 class Notify {
  public:
@@ -35,6 +39,12 @@ class Notify {
    * constructs a new instance and do notifying.
    */
   Notify() {
+#ifdef HAVE_EVENTFD
+    m_recvfd = m_sendfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_recvfd >= 0) {
+      return;
+    }
+#endif
     int pipefd[2];
     int ret = pipe(pipefd);
 
@@ -42,14 +52,22 @@ class Notify {
       m_recvfd = pipefd[0];
       m_sendfd = pipefd[1];
 
+      fcntl(m_recvfd, F_SETFL, O_NONBLOCK);
       fcntl(m_sendfd, F_SETFL, O_NONBLOCK);
+    } else {
+      m_recvfd = m_sendfd = -1;
     }
   }
 
   /**
    * destructor.
    */
-  ~Notify() { close(m_sendfd); close(m_recvfd); }
+  ~Notify() {
+    if (m_sendfd != m_recvfd) {
+      close(m_sendfd);
+    }
+    close(m_recvfd);
+  }
 
   /**
    * file descriptor to watch for notify event.
@@ -61,13 +79,36 @@ class Notify {
    * write notify event to file descriptor.
    * @return result of writing notification.
    */
-  ssize_t notify() const { return write(m_sendfd, "1", 1); }
+  ssize_t notify() const {
+    if (m_sendfd == m_recvfd) {
+      // eventfd: the counter is incremented, so that a single read consumes all pending notifications
+      uint64_t value = 1;
+      return write(m_sendfd, &value, sizeof(value));
+    }
+    return write(m_sendfd, "1", 1);
+  }
+
+  /**
+   * consume all pending notify events so that the file descriptor is no longer readable.
+   * @return whether at least one notify event was pending.
+   */
+  bool clear() const {
+    uint64_t buf[4];
+    bool pending = false;
+    while (read(m_recvfd, buf, m_sendfd == m_recvfd ? sizeof(buf[0]) : sizeof(buf)) > 0) {
+      pending = true;
+      if (m_sendfd == m_recvfd) {
+        break;
+      }
+    }
+    return pending;
+  }
 
  private:
   /** file descriptor to watch */
   int m_recvfd;
 
-  /** file descriptor to notify */
+  /** file descriptor to notify (same as @a m_recvfd for eventfd) */
   int m_sendfd;
 };
 
@@ -32,6 +32,8 @@ using std::list;
 
 /**
  * Thread safe template class for queuing items.
+ * A waiting consumer is only woken up when the queue turns non-empty, and a woken consumer leaving items behind
+ * passes the wakeup on to the next waiting one.
  * @param T the item type.
  */
 template <typename T>
@@ -40,9 +42,10 @@ class Queue {
   /**
    * Constructor.
    */
-  Queue() {
+  Queue() : m_waiting(0), m_removing(0) {
     pthread_mutex_init(&m_mutex, nullptr);
     pthread_cond_init(&m_cond, nullptr);
+    pthread_cond_init(&m_removeCond, nullptr);
   }
 
   /**
@@ -51,6 +54,7 @@ class Queue {
   ~Queue() {
     pthread_mutex_destroy(&m_mutex);
     pthread_cond_destroy(&m_cond);
+    pthread_cond_destroy(&m_removeCond);
   }
 
 
@@ -69,8 +73,14 @@ class Queue {
    */
   void push(T item) {
     pthread_mutex_lock(&m_mutex);
+    bool wasEmpty = m_queue.empty();
     m_queue.push_back(item);
-    pthread_cond_broadcast(&m_cond);
+    if (wasEmpty && m_waiting > 0) {
+      pthread_cond_signal(&m_cond);
+    }
+    if (m_removing > 0) {
+      pthread_cond_broadcast(&m_removeCond);  // each one waits for a particular item
+    }
     pthread_mutex_unlock(&m_mutex);
   }
 
@@ -82,26 +92,39 @@ class Queue {
   T pop(int timeout = 0) {
     T item;
     pthread_mutex_lock(&m_mutex);
-    if (timeout > 0) {
-      struct timespec t;
-      clockGettime(&t);
-      t.tv_sec += timeout;
-      while (m_queue.empty()) {
-        if (pthread_cond_timedwait(&m_cond, &m_mutex, &t) != 0) {
-          break;
-        }
-      }
+    if (timeout > 0 && m_queue.empty()) {
+      waitFilled(timeout);
     }
     if (m_queue.empty()) {
       item = nullptr;
     } else {
       item = m_queue.front();
       m_queue.pop_front();
+      if (!m_queue.empty() && m_waiting > 0) {
+        pthread_cond_signal(&m_cond);  // pass on the wakeup for the remaining items
+      }
     }
     pthread_mutex_unlock(&m_mutex);
     return item;
   }
 
+  /**
+   * Remove all items from the queue optionally waiting for the queue being non-empty.
+   * @param items the list to append the removed items to.
+   * @param timeout the maximum time in seconds to wait for the queue being filled, or 0 for no wait.
+   * @return the number of removed items.
+   */
+  size_t popAll(list<T>* items, int timeout = 0) {
+    pthread_mutex_lock(&m_mutex);
+    if (timeout > 0 && m_queue.empty()) {
+      waitFilled(timeout);
+    }
+    size_t count = m_queue.size();
+    items->splice(items->end(), m_queue);
+    pthread_mutex_unlock(&m_mutex);
+    return count;
+  }
+
   /**
    * Remove the specified item from the queue optionally waiting for it to appear in the queue.
    * @param item the item to remove and optionally wait for.
@@ -113,8 +136,6 @@ class Queue {
     pthread_mutex_lock(&m_mutex);
     struct timespec t;
     while (true) {
-      clockGettime(&t);
-      t.tv_sec++;  // check thread death every second
       size_t oldSize = m_queue.size();
       if (oldSize > 0) {
         m_queue.remove(item);
@@ -126,7 +147,11 @@ class Queue {
       if (!wait) {
         break;
       }
-      int ret = pthread_cond_timedwait(&m_cond, &m_mutex, &t);
+      clockGettime(&t);
+      t.tv_sec++;  // check thread death every second
+      m_removing++;
+      int ret = pthread_cond_timedwait(&m_removeCond, &m_mutex, &t);
+      m_removing--;
       if (ret != 0 && ret != ETIMEDOUT) {
         break;
       }
@@ -135,6 +160,17 @@ class Queue {
     return result;
   }
 
+  /**
+   * Return the number of queued items.
+   * @return the number of queued items.
+   */
+  size_t size() {
+    pthread_mutex_lock(&m_mutex);
+    size_t count = m_queue.size();
+    pthread_mutex_unlock(&m_mutex);
+    return count;
+  }
+
   /**
    * Return the first item in the queue without removing it.
    * @return the item, or nullptr if no item is available.
@@ -153,14 +189,40 @@ class Queue {
 
 
  private:
+  /**
+   * Wait for the queue being filled (only to be called while locked).
+   * @param timeout the maximum time in seconds to wait.
+   */
+  void waitFilled(int timeout) {
+    struct timespec t;
+    clockGettime(&t);
+    t.tv_sec += timeout;
+    m_waiting++;
+    while (m_queue.empty()) {
+      if (pthread_cond_timedwait(&m_cond, &m_mutex, &t) != 0) {
+        break;
+      }
+    }
+    m_waiting--;
+  }
+
   /** the queue itself */
   list<T> m_queue;
 
+  /** the number of consumers waiting in @a pop() or @a popAll(). */
+  unsigned int m_waiting;
+
+  /** the number of consumers waiting in @a remove(). */
+  unsigned int m_removing;
+
   /** mutex variable for exclusive lock */
   pthread_mutex_t m_mutex;
 
-  /** condition variable for exclusive lock */
+  /** condition variable for waiting in @a pop() or @a popAll() */
   pthread_cond_t m_cond;
+
+  /** condition variable for waiting in @a remove() */
+  pthread_cond_t m_removeCond;
 };
 
 }  // namespace ebusd
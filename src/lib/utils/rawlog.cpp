@@ -0,0 +1,362 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "lib/utils/rawlog.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+namespace ebusd {
+
+/** the size of the file header (magic and version). */
+#define RAWLOG_FILE_HEADER_SIZE (sizeof(RAWLOG_MAGIC)-1+sizeof(uint32_t))
+
+/** the size of a stored @a RawLogBlockHeader. */
+#define RAWLOG_BLOCK_HEADER_SIZE (2*sizeof(int64_t)+4*sizeof(uint32_t)+256/8)
+
+/** the maximum length of a single record (longer telegrams are truncated). */
+#define RAWLOG_MAX_RECORD 1024
+
+/**
+ * Append a value in host byte order to a string.
+ * @param value the value to append.
+ * @param output the string to append to.
+ */
+template<typename T>
+static void appendValue(T value, string* output) {
+  output->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * Extract a value in host byte order from a buffer.
+ * @param data the buffer to extract from.
+ * @param pos the position in the buffer, updated to the position after the value.
+ * @param value the variable in which to store the value.
+ */
+template<typename T>
+static void extractValue(const char* data, size_t* pos, T* value) {
+  memcpy(value, data+*pos, sizeof(T));
+  *pos += sizeof(T);
+}
+
+/**
+ * Append a signed value as zigzag encoded variable length integer.
+ * @param value the value to append.
+ * @param output the string to append to.
+ */
+static void appendVarInt(int64_t value, string* output) {
+  uint64_t encoded = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+  while (encoded >= 0x80) {
+    output->push_back(static_cast<char>((encoded & 0x7f) | 0x80));
+    encoded >>= 7;
+  }
+  output->push_back(static_cast<char>(encoded));
+}
+
+/**
+ * Extract a zigzag encoded variable length integer.
+ * @param data the string to extract from.
+ * @param pos the position in the string, updated to the position after the value.
+ * @param value the variable in which to store the value.
+ * @return true on success, false if not enough data is left.
+ */
+static bool extractVarInt(const string& data, size_t* pos, int64_t* value) {
+  uint64_t encoded = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    if (*pos >= data.size()) {
+      return false;
+    }
+    uint8_t ch = static_cast<uint8_t>(data[(*pos)++]);
+    encoded |= static_cast<uint64_t>(ch & 0x7f) << shift;
+    if ((ch & 0x80) == 0) {
+      *value = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+RawLogWriter::~RawLogWriter() {
+  setEnabled(false);
+}
+
+bool RawLogWriter::setEnabled(bool enabled) {
+  if (enabled == m_enabled) {
+    return false;
+  }
+  m_enabled = enabled;
+  if (m_stream) {
+    flush();
+    fclose(m_stream);
+    m_stream = nullptr;
+  }
+  if (enabled) {
+    openFile();
+  }
+  return true;
+}
+
+void RawLogWriter::openFile() {
+  m_stream = fopen(m_fileName.c_str(), "ab");
+  if (!m_stream) {
+    return;
+  }
+  fseek(m_stream, 0, SEEK_END);
+  long size = ftell(m_stream);
+  if (size > 0) {
+    m_fileSize = static_cast<uint64_t>(size);
+    return;
+  }
+  string header(RAWLOG_MAGIC);
+  appendValue(static_cast<uint32_t>(RAWLOG_VERSION), &header);
+  fwrite(header.data(), header.size(), 1, m_stream);
+  fflush(m_stream);
+  m_fileSize = header.size();
+}
+
+void RawLogWriter::clearBlock() {
+  memset(&m_header, 0, sizeof(m_header));
+  m_block.clear();
+}
+
+void RawLogWriter::write(const vector<uint8_t>& data, const vector<bool>& sent, const struct timespec& time) {
+  if (!m_enabled || !m_stream || data.empty()) {
+    return;
+  }
+  size_t length = data.size() > RAWLOG_MAX_RECORD ? RAWLOG_MAX_RECORD : data.size();
+  int64_t recordTime = toRawLogTime(time);
+  if (m_header.m_recordCount == 0) {
+    m_header.m_firstTime = m_header.m_lastTime = m_previousTime = recordTime;
+    m_blockStart = time.tv_sec;
+  }
+  // the signed delta to the previous record keeps the reader in sync even when the clock went backwards
+  appendVarInt(recordTime-m_previousTime, &m_block);
+  m_previousTime = recordTime;
+  appendVarInt(static_cast<int64_t>(length), &m_block);
+  m_block.append(reinterpret_cast<const char*>(data.data()), length);
+  uint8_t mask = 0;
+  for (size_t pos = 0; pos < length; pos++) {
+    if (pos < sent.size() && sent[pos]) {
+      mask = static_cast<uint8_t>(mask | (1 << (pos%8)));
+    }
+    if (pos%8 == 7 || pos+1 == length) {
+      m_block.push_back(static_cast<char>(mask));
+      mask = 0;
+    }
+  }
+  for (size_t pos = 0; pos < 2 && pos < length; pos++) {
+    m_header.m_addresses[data[pos]/8] = static_cast<uint8_t>(m_header.m_addresses[data[pos]/8] | (1 << (data[pos]%8)));
+  }
+  if (recordTime > m_header.m_lastTime) {
+    m_header.m_lastTime = recordTime;
+  }
+  m_header.m_recordCount++;
+  if (m_block.size() >= RAWLOG_BLOCK_SIZE) {
+    flush();
+  }
+}
+
+void RawLogWriter::checkFlush(const struct timespec& now) {
+  if (m_header.m_recordCount > 0 && now.tv_sec-m_blockStart >= RAWLOG_BLOCK_SECONDS) {
+    flush();
+  }
+}
+
+void RawLogWriter::flush() {
+  if (!m_stream || m_header.m_recordCount == 0) {
+    return;
+  }
+  m_header.m_rawLength = static_cast<uint32_t>(m_block.size());
+  string stored;
+#ifdef HAVE_ZLIB
+  uLongf compressedLength = compressBound(static_cast<uLong>(m_block.size()));
+  stored.resize(compressedLength);
+  if (compress2(reinterpret_cast<Bytef*>(&stored[0]), &compressedLength,
+      reinterpret_cast<const Bytef*>(m_block.data()), static_cast<uLong>(m_block.size()), Z_BEST_COMPRESSION) == Z_OK
+      && compressedLength < m_block.size()) {
+    stored.resize(compressedLength);
+    m_header.m_compressed = 1;
+  } else {
+    stored.clear();
+  }
+#endif
+  if (!m_header.m_compressed) {
+    stored.swap(m_block);
+  }
+  m_header.m_storedLength = static_cast<uint32_t>(stored.size());
+  string header;
+  header.reserve(RAWLOG_BLOCK_HEADER_SIZE);
+  appendValue(m_header.m_firstTime, &header);
+  appendValue(m_header.m_lastTime, &header);
+  appendValue(m_header.m_recordCount, &header);
+  appendValue(m_header.m_rawLength, &header);
+  appendValue(m_header.m_storedLength, &header);
+  appendValue(m_header.m_compressed, &header);
+  header.append(reinterpret_cast<const char*>(m_header.m_addresses), sizeof(m_header.m_addresses));
+  fwrite(header.data(), header.size(), 1, m_stream);
+  fwrite(stored.data(), stored.size(), 1, m_stream);
+  fflush(m_stream);
+  m_fileSize += header.size()+stored.size();
+  clearBlock();
+  if (m_maxSize > 0 && m_fileSize >= m_maxSize * 1024LL) {
+    string oldfile = string(m_fileName)+".old";
+    if (rename(m_fileName.c_str(), oldfile.c_str()) == 0) {
+      fclose(m_stream);
+      openFile();
+    }
+  }
+}
+
+
+RawLogReader::~RawLogReader() {
+  if (m_stream) {
+    fclose(m_stream);
+    m_stream = nullptr;
+  }
+}
+
+bool RawLogReader::open(const string& fileName) {
+  if (m_stream) {
+    fclose(m_stream);
+  }
+  m_block.clear();
+  m_blockPos = 0;
+  m_recordsLeft = 0;
+  m_stream = fopen(fileName.c_str(), "rb");
+  if (!m_stream) {
+    return false;
+  }
+  char header[RAWLOG_FILE_HEADER_SIZE];
+  uint32_t version;
+  size_t pos = sizeof(RAWLOG_MAGIC)-1;
+  if (fread(header, sizeof(header), 1, m_stream) != 1 || memcmp(header, RAWLOG_MAGIC, pos) != 0) {
+    return false;
+  }
+  extractValue(header, &pos, &version);
+  return version == RAWLOG_VERSION;
+}
+
+bool RawLogReader::nextBlock(const RawLogFilter& filter) {
+  char data[RAWLOG_BLOCK_HEADER_SIZE];
+  RawLogBlockHeader header;
+  while (m_stream && fread(data, sizeof(data), 1, m_stream) == 1) {
+    size_t pos = 0;
+    extractValue(data, &pos, &header.m_firstTime);
+    extractValue(data, &pos, &header.m_lastTime);
+    extractValue(data, &pos, &header.m_recordCount);
+    extractValue(data, &pos, &header.m_rawLength);
+    extractValue(data, &pos, &header.m_storedLength);
+    extractValue(data, &pos, &header.m_compressed);
+    memcpy(header.m_addresses, data+pos, sizeof(header.m_addresses));
+    if (header.m_lastTime < filter.m_since || header.m_firstTime > filter.m_until
+        || (filter.m_address >= 0
+        && (header.m_addresses[filter.m_address/8] & (1 << (filter.m_address%8))) == 0)) {
+      m_blocksSkipped++;
+      if (fseek(m_stream, static_cast<long>(header.m_storedLength), SEEK_CUR) != 0) {
+        return false;
+      }
+      continue;
+    }
+    string stored;
+    stored.resize(header.m_storedLength);
+    if (header.m_storedLength > 0 && fread(&stored[0], header.m_storedLength, 1, m_stream) != 1) {
+      return false;
+    }
+    if (header.m_compressed) {
+#ifdef HAVE_ZLIB
+      uLongf rawLength = header.m_rawLength;
+      m_block.resize(rawLength);
+      if (uncompress(reinterpret_cast<Bytef*>(&m_block[0]), &rawLength,
+          reinterpret_cast<const Bytef*>(stored.data()), static_cast<uLong>(stored.size())) != Z_OK
+          || rawLength != header.m_rawLength) {
+        return false;
+      }
+#else
+      return false;  // compressed blocks are not supported without zlib
+#endif
+    } else {
+      m_block.swap(stored);
+    }
+    m_blocksRead++;
+    m_blockPos = 0;
+    m_recordsLeft = header.m_recordCount;
+    m_time = header.m_firstTime;
+    return true;
+  }
+  return false;
+}
+
+bool RawLogReader::nextRecord(RawLogRecord* record) {
+  int64_t delta, length;
+  if (!extractVarInt(m_block, &m_blockPos, &delta) || !extractVarInt(m_block, &m_blockPos, &length)
+      || length < 0 || m_blockPos+static_cast<size_t>(length)+static_cast<size_t>((length+7)/8) > m_block.size()) {
+    return false;
+  }
+  m_recordsLeft--;
+  m_time += delta;
+  record->m_time = m_time;
+  size_t size = static_cast<size_t>(length);
+  record->m_data.resize(size);
+  record->m_sent.resize(size);
+  for (size_t pos = 0; pos < size; pos++) {
+    record->m_data[pos] = static_cast<uint8_t>(m_block[m_blockPos+pos]);
+  }
+  m_blockPos += size;
+  for (size_t pos = 0; pos < size; pos++) {
+    record->m_sent[pos] = (static_cast<uint8_t>(m_block[m_blockPos+pos/8]) & (1 << (pos%8))) != 0;
+  }
+  m_blockPos += (size+7)/8;
+  return true;
+}
+
+bool RawLogReader::read(const RawLogFilter& filter, RawLogRecord* record) {
+  while (true) {
+    if (m_recordsLeft == 0 && !nextBlock(filter)) {
+      return false;
+    }
+    if (!nextRecord(record)) {
+      m_recordsLeft = 0;  // skip the rest of an invalid block
+      continue;
+    }
+    if (record->m_time < filter.m_since || record->m_time > filter.m_until) {
+      continue;
+    }
+    if (filter.m_address >= 0 && (record->m_data.size() < 1
+        || (record->m_data[0] != filter.m_address && (record->m_data.size() < 2
+        || record->m_data[1] != filter.m_address)))) {
+      continue;
+    }
+    if (filter.m_idLength > 0) {
+      if (record->m_data.size() < 2+filter.m_idLength
+          || memcmp(record->m_data.data()+2, filter.m_id, filter.m_idLength) != 0) {
+        continue;
+      }
+    }
+    return true;
+  }
+}
+
+}  // namespace ebusd
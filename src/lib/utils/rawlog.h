@@ -0,0 +1,311 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_RAWLOG_H_
+#define LIB_UTILS_RAWLOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace ebusd {
+
+/** \file lib/utils/rawlog.h
+ * Binary raw log of the bus traffic with compressed blocks and a sparse time index.
+ *
+ * The file starts with @a RAWLOG_MAGIC and the format version followed by
+ * blocks of records. Each block starts with a @a RawLogBlockHeader containing
+ * the time range and the set of addresses seen in the records of the block,
+ * so that a reader only needs to read the block headers for skipping blocks
+ * outside of a time range or without a certain address.
+ * The records of a block are compressed with zlib (if available). Each record
+ * consists of the time delta to the previous record in microseconds, the
+ * symbols seen between two SYN symbols, and a bit mask of the sent symbols.
+ * All values are stored in host byte order.
+ */
+
+using std::string;
+using std::vector;
+
+/** the magic bytes at the start of a binary raw log file. */
+#define RAWLOG_MAGIC "ebusdraw"
+
+/** the version of the binary raw log format (to be increased with each format change). */
+#define RAWLOG_VERSION 1
+
+/** the uncompressed size of a block from which on it is written. */
+#define RAWLOG_BLOCK_SIZE (64*1024)
+
+/** the maximum age in seconds of the first record in a block until the block is written. */
+#define RAWLOG_BLOCK_SECONDS 60
+
+
+/**
+ * The header of a block of records in the binary raw log.
+ */
+struct RawLogBlockHeader {
+  /** the time of the first record in microseconds since the epoch. */
+  int64_t m_firstTime;
+
+  /** the time of the last record in microseconds since the epoch. */
+  int64_t m_lastTime;
+
+  /** the number of records. */
+  uint32_t m_recordCount;
+
+  /** the uncompressed length of the records. */
+  uint32_t m_rawLength;
+
+  /** the length of the stored (possibly compressed) records. */
+  uint32_t m_storedLength;
+
+  /** whether the stored records are compressed. */
+  uint32_t m_compressed;
+
+  /** the bit set of the addresses seen as first or second symbol of the records. */
+  uint8_t m_addresses[256/8];
+};
+
+
+/**
+ * A single record of the binary raw log.
+ */
+struct RawLogRecord {
+  /** the time of the record in microseconds since the epoch. */
+  int64_t m_time;
+
+  /** the symbols seen between two SYN symbols. */
+  vector<uint8_t> m_data;
+
+  /** whether the symbol at the same position in @a m_data was sent (true) or received (false). */
+  vector<bool> m_sent;
+};
+
+
+/**
+ * The filter for reading records from the binary raw log.
+ */
+struct RawLogFilter {
+  /** the minimum record time in microseconds since the epoch. */
+  int64_t m_since;
+
+  /** the maximum record time in microseconds since the epoch. */
+  int64_t m_until;
+
+  /** the address to match as first or second symbol, or -1 for any. */
+  int m_address;
+
+  /** the number of symbols in @a m_id to match after the addresses (0 for any). */
+  size_t m_idLength;
+
+  /** the symbols to match after the addresses (primary and secondary command byte). */
+  uint8_t m_id[2];
+};
+
+
+/**
+ * Convert a time to microseconds since the epoch.
+ * @param time the time to convert.
+ * @return the time in microseconds since the epoch.
+ */
+inline int64_t toRawLogTime(const struct timespec& time) {
+  return static_cast<int64_t>(time.tv_sec)*1000000LL + time.tv_nsec/1000;
+}
+
+
+/**
+ * Writes records to a binary raw log file with maximum size.
+ */
+class RawLogWriter {
+ public:
+  /**
+   * Construct a new instance.
+   * @param fileName the name of the file write to.
+   * @param maxSize the maximum size of the file to write to in kB.
+   */
+  RawLogWriter(const string fileName, const unsigned int maxSize)
+    : m_enabled(false), m_fileName(fileName), m_maxSize(maxSize), m_stream(nullptr), m_fileSize(0),
+      m_previousTime(0), m_blockStart(0) {
+    clearBlock();
+  }
+
+  /**
+   * Destructor.
+   */
+  virtual ~RawLogWriter();
+
+  /**
+   * Enable or disable writing to the file.
+   * @param enabled @p true to enable writing to the file, @p false to disable it.
+   * @return @p true when the state was changed, @p false otherwise.
+   */
+  bool setEnabled(bool enabled);
+
+  /**
+   * Return whether writing to the file is enabled.
+   * @return whether writing to the file is enabled.
+   */
+  bool isEnabled() { return m_enabled; }
+
+  /**
+   * Add a record to the current block and write the block when it is full.
+   * @param data the symbols seen between two SYN symbols.
+   * @param sent whether the symbol at the same position in @a data was sent (true) or received (false).
+   * @param time the time of the first symbol.
+   */
+  void write(const vector<uint8_t>& data, const vector<bool>& sent, const struct timespec& time);
+
+  /**
+   * Write the current block when its first record is older than @a RAWLOG_BLOCK_SECONDS.
+   * @param now the current time.
+   */
+  void checkFlush(const struct timespec& now);
+
+
+ private:
+  /**
+   * Open the file for appending and write the file header if the file is empty.
+   */
+  void openFile();
+
+  /**
+   * Write the current block to the file and start a new one.
+   */
+  void flush();
+
+  /**
+   * Reset the current block.
+   */
+  void clearBlock();
+
+  /** whether writing to the file is enabled. */
+  bool m_enabled;
+
+  /** the name of the file write to. */
+  const string m_fileName;
+
+  /** the maximum size of @a m_stream in kB, or 0 for infinite. */
+  const unsigned int m_maxSize;
+
+  /** the @a FILE to writing to. */
+  FILE* m_stream;
+
+  /** the number of bytes written to @a m_stream. */
+  uint64_t m_fileSize;
+
+  /** the header of the current block. */
+  RawLogBlockHeader m_header;
+
+  /** the uncompressed records of the current block. */
+  string m_block;
+
+  /** the time of the previous record in the current block in microseconds since the epoch (the delta base). */
+  int64_t m_previousTime;
+
+  /** the system time in seconds when the first record of the current block was added. */
+  time_t m_blockStart;
+};
+
+
+/**
+ * Reads records from a binary raw log file.
+ */
+class RawLogReader {
+ public:
+  /**
+   * Construct a new instance.
+   */
+  RawLogReader()
+    : m_stream(nullptr), m_blockPos(0), m_recordsLeft(0), m_time(0), m_blocksRead(0), m_blocksSkipped(0) {}
+
+  /**
+   * Destructor.
+   */
+  virtual ~RawLogReader();
+
+  /**
+   * Open a binary raw log file.
+   * @param fileName the name of the file to read.
+   * @return true on success, false if the file is not available or not in binary raw log format.
+   */
+  bool open(const string& fileName);
+
+  /**
+   * Read the next record matching the filter.
+   * Blocks not matching the time range or address of the filter are skipped without being decompressed.
+   * @param filter the @a RawLogFilter to apply.
+   * @param record the @a RawLogRecord to fill.
+   * @return true when a matching record was read, false at the end of the file or on invalid data.
+   */
+  bool read(const RawLogFilter& filter, RawLogRecord* record);
+
+  /**
+   * Get the number of blocks decompressed.
+   * @return the number of blocks decompressed.
+   */
+  uint64_t getBlocksRead() const { return m_blocksRead; }
+
+  /**
+   * Get the number of blocks skipped by the block header only.
+   * @return the number of blocks skipped.
+   */
+  uint64_t getBlocksSkipped() const { return m_blocksSkipped; }
+
+
+ private:
+  /**
+   * Read the next block header matching the filter and load the records of that block.
+   * @param filter the @a RawLogFilter to apply.
+   * @return true when a block was loaded, false at the end of the file or on invalid data.
+   */
+  bool nextBlock(const RawLogFilter& filter);
+
+  /**
+   * Decode the next record of the current block.
+   * @param record the @a RawLogRecord to fill.
+   * @return true on success, false on invalid data.
+   */
+  bool nextRecord(RawLogRecord* record);
+
+  /** the @a FILE to read from. */
+  FILE* m_stream;
+
+  /** the uncompressed records of the current block. */
+  string m_block;
+
+  /** the read position in @a m_block. */
+  size_t m_blockPos;
+
+  /** the number of records left in @a m_block. */
+  uint32_t m_recordsLeft;
+
+  /** the time of the last decoded record in microseconds since the epoch. */
+  int64_t m_time;
+
+  /** the number of blocks decompressed. */
+  uint64_t m_blocksRead;
+
+  /** the number of blocks skipped by the block header only. */
+  uint64_t m_blocksSkipped;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_RAWLOG_H_
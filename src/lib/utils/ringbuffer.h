@@ -0,0 +1,142 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2014-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_UTILS_RINGBUFFER_H_
+#define LIB_UTILS_RINGBUFFER_H_
+
+#include <stddef.h>
+#include <atomic>
+
+namespace ebusd {
+
+/** \file lib/utils/ringbuffer.h */
+
+using std::atomic;
+
+/**
+ * Lock free template class for passing items from a single producer thread to a single consumer thread.
+ * @param T the item type.
+ */
+template <typename T>
+class RingBuffer {
+ public:
+  /**
+   * Constructor.
+   * @param capacity the minimum number of items to hold (rounded up to the next power of two).
+   */
+  explicit RingBuffer(size_t capacity)
+    : m_capacity(roundUp(capacity)), m_items(new T[m_capacity]), m_head(0), m_tail(0), m_dropped(0) {}
+
+  /**
+   * Destructor.
+   */
+  ~RingBuffer() {
+    delete[] m_items;
+  }
+
+
+ private:
+  /**
+   * Hidden copy constructor.
+   * @param src the object to copy from.
+   */
+  RingBuffer(const RingBuffer& src);
+
+  /**
+   * Round up to the next power of two.
+   * @param value the value to round up.
+   * @return the next power of two.
+   */
+  static size_t roundUp(size_t value) {
+    size_t ret = 1;
+    while (ret < value) {
+      ret <<= 1;
+    }
+    return ret;
+  }
+
+
+ public:
+  /**
+   * Add an item to the end of the ring (only to be called by the producer thread).
+   * @param item the item to add.
+   * @return true on success, false if the ring is full and the item was dropped.
+   */
+  bool push(const T& item) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= m_capacity) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    m_items[head & (m_capacity-1)] = item;
+    m_head.store(head+1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Remove the first item from the ring (only to be called by the consumer thread).
+   * @param item the variable in which to store the item.
+   * @return true on success, false if the ring is empty.
+   */
+  bool pop(T* item) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = m_items[tail & (m_capacity-1)];
+    m_tail.store(tail+1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Return whether the ring is empty.
+   * @return whether the ring is empty.
+   */
+  bool empty() const {
+    return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Return the number of items dropped due to a full ring.
+   * @return the number of items dropped due to a full ring.
+   */
+  size_t getDropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+
+ private:
+  /** the capacity of the ring (power of two). */
+  const size_t m_capacity;
+
+  /** the items. */
+  T* m_items;
+
+  /** the total number of pushed items (only modified by the producer). */
+  atomic<size_t> m_head;
+
+  /** the total number of popped items (only modified by the consumer). */
+  atomic<size_t> m_tail;
+
+  /** the number of items dropped due to a full ring. */
+  atomic<size_t> m_dropped;
+};
+
+}  // namespace ebusd
+
+#endif  // LIB_UTILS_RINGBUFFER_H_
@@ -54,14 +54,19 @@ bool RotateFile::setEnabled(bool enabled) {
   return true;
 }
 
-void RotateFile::write(const unsigned char* value, const size_t size, const bool received, const bool bytes) {
+void RotateFile::write(const unsigned char* value, const size_t size, const bool received, const bool bytes,
+    const struct timespec* time) {
   if (!m_enabled || !m_stream) {
     return;
   }
   if (m_textMode) {
     struct timespec ts;
     struct tm td;
-    clockGettime(&ts);
+    if (time) {
+      ts = *time;
+    } else {
+      clockGettime(&ts);
+    }
     localtime_r(&ts.tv_sec, &td);
     fprintf(m_stream, "%04d-%02d-%02d %02d:%02d:%02d.%03ld ",
       td.tm_year+1900, td.tm_mon+1, td.tm_mday,
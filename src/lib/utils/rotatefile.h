@@ -21,6 +21,7 @@
 
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -72,9 +73,10 @@ class RotateFile {
    * @param size the number of bytes to write.
    * @param received @a true on reception, @a false on sending (only relevant in text mode).
    * @param bytes whether to log single bytes (only relevant in text mode).
+   * @param time the time of reception/sending to write, or nullptr for the current time (only relevant in text mode).
    */
   void write(const unsigned char* value, const size_t size, const bool received = true,
-      const bool bytes = true);
+      const bool bytes = true, const struct timespec* time = nullptr);
 
 
  private:
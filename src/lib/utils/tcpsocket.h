@@ -101,6 +101,13 @@ class TCPSocket {
    */
   bool isValid();
 
+  /**
+   * Switch the socket to non-blocking mode, so that @a send and @a recv return immediately with EAGAIN instead of
+   * waiting.
+   * @return true on success.
+   */
+  bool setNonBlocking();
+
   /**
    * Set the timeout for @a send and @a recv.
    * @param timeout the timeout in seconds.
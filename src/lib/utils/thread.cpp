@@ -21,6 +21,8 @@
 #endif
 
 #include "lib/utils/thread.h"
+#include <sched.h>
+#include <errno.h>
 #include "lib/utils/clock.h"
 
 namespace ebusd {
@@ -51,6 +53,29 @@ bool Thread::start(const char* name) {
   return false;
 }
 
+int Thread::setRealtime(bool roundRobin, int priority) {
+  if (!m_started) {
+    return ESRCH;
+  }
+  struct sched_param param;
+  param.sched_priority = priority;
+  return pthread_setschedparam(m_threadid, roundRobin ? SCHED_RR : SCHED_FIFO, &param);
+}
+
+int Thread::setAffinity(int cpu) {
+  if (!m_started) {
+    return ESRCH;
+  }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(m_threadid, sizeof(cpus), &cpus);
+#else
+  return ENOSYS;
+#endif
+}
+
 bool Thread::join() {
   int result = -1;
   if (m_started) {
@@ -95,10 +120,17 @@ bool WaitThread::join() {
   return Thread::join();
 }
 
-bool WaitThread::Wait(int seconds) {
+bool WaitThread::Wait(int seconds, int millis) {
   struct timespec t;
   clockGettime(&t);
   t.tv_sec += seconds;
+  if (millis > 0) {
+    t.tv_nsec += millis * 1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+      t.tv_sec += t.tv_nsec / 1000000000L;
+      t.tv_nsec %= 1000000000L;
+    }
+  }
   pthread_mutex_lock(&m_mutex);
   pthread_cond_timedwait(&m_cond, &m_mutex, &t);
   pthread_mutex_unlock(&m_mutex);
@@ -20,6 +20,7 @@
 #define LIB_UTILS_THREAD_H_
 
 #include <pthread.h>
+#include <atomic>
 
 namespace ebusd {
 
@@ -77,6 +78,21 @@ class Thread {
    */
   pthread_t self() { return m_threadid; }
 
+  /**
+   * Switch the started thread to real-time scheduling.
+   * @param roundRobin true for SCHED_RR, false for SCHED_FIFO.
+   * @param priority the real-time priority (1-99).
+   * @return 0 on success, or the error number.
+   */
+  int setRealtime(bool roundRobin, int priority);
+
+  /**
+   * Pin the started thread to a single CPU.
+   * @param cpu the CPU number.
+   * @return 0 on success, or the error number.
+   */
+  int setAffinity(int cpu);
+
 
  protected:
   /**
@@ -129,9 +145,10 @@ class WaitThread : public Thread {
   /**
    * Wait for the specified amount of time.
    * @param seconds the number of seconds to wait.
+   * @param millis the number of additional milliseconds to wait.
    * @return true if this @a WaitThread is still running and not yet stopped.
    */
-  bool Wait(int seconds);
+  bool Wait(int seconds, int millis = 0);
 
 
  private:
@@ -185,6 +202,109 @@ class Mutex {
   pthread_mutex_t m_mutex;
 };
 
+
+/**
+ * A reader/writer lock allowing several threads shared access at the same time and being recursive for the thread
+ * having exclusive access.
+ */
+class SharedMutex {
+ public:
+  /**
+   * Constructor.
+   */
+  inline SharedMutex() : m_owned(false), m_depth(0), m_contentions(0) {
+    pthread_rwlock_init(&m_rwlock, nullptr);
+  }
+
+  /**
+   * Destructor.
+   */
+  virtual inline ~SharedMutex() {
+    pthread_rwlock_destroy(&m_rwlock);
+  }
+
+  /**
+   * Lock this mutex for exclusive access.
+   */
+  void inline lock() {
+    if (!isOwner()) {
+      if (pthread_rwlock_trywrlock(&m_rwlock) != 0) {
+        m_contentions.fetch_add(1, std::memory_order_relaxed);
+        pthread_rwlock_wrlock(&m_rwlock);
+      }
+      m_owner = pthread_self();
+      m_owned.store(true, std::memory_order_release);
+    }
+    m_depth++;
+  }
+
+  /**
+   * Unlock this mutex from exclusive access.
+   */
+  void inline unlock() {
+    if (--m_depth > 0) {
+      return;
+    }
+    m_owned.store(false, std::memory_order_relaxed);
+    pthread_rwlock_unlock(&m_rwlock);
+  }
+
+  /**
+   * Lock this mutex for shared access (already given to the thread having exclusive access).
+   */
+  void inline lockShared() {
+    if (isOwner()) {
+      m_depth++;
+      return;
+    }
+    if (pthread_rwlock_tryrdlock(&m_rwlock) != 0) {
+      m_contentions.fetch_add(1, std::memory_order_relaxed);
+      pthread_rwlock_rdlock(&m_rwlock);
+    }
+  }
+
+  /**
+   * Unlock this mutex from shared access.
+   */
+  void inline unlockShared() {
+    if (isOwner()) {
+      unlock();
+      return;
+    }
+    pthread_rwlock_unlock(&m_rwlock);
+  }
+
+  /**
+   * Return the number of times a thread had to wait for getting access.
+   * @return the number of times a thread had to wait for getting access.
+   */
+  size_t getContentions() const { return m_contentions.load(std::memory_order_relaxed); }
+
+ private:
+  /**
+   * Return whether the calling thread has exclusive access.
+   * @return whether the calling thread has exclusive access.
+   */
+  bool inline isOwner() const {
+    return m_owned.load(std::memory_order_acquire) && pthread_equal(m_owner, pthread_self());
+  }
+
+  /** the reader/writer lock. */
+  pthread_rwlock_t m_rwlock;
+
+  /** whether a thread has exclusive access. */
+  std::atomic<bool> m_owned;
+
+  /** the thread having exclusive access (only valid when @a m_owned is set). */
+  pthread_t m_owner;
+
+  /** the number of nested locks of the thread having exclusive access. */
+  unsigned int m_depth;
+
+  /** the number of times a thread had to wait for getting access. */
+  std::atomic<size_t> m_contentions;
+};
+
 }  // namespace ebusd
 
 #endif  // LIB_UTILS_THREAD_H_
@@ -21,13 +21,16 @@
 #endif
 
 #include <argp.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef HAVE_PPOLL
 #  include <poll.h>
 #endif
 #include <cstdio>
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include "lib/utils/tcpsocket.h"
@@ -37,6 +40,7 @@ namespace ebusd {
 using std::ostringstream;
 using std::cin;
 using std::cout;
+using std::cerr;
 using std::string;
 using std::endl;
 
@@ -45,6 +49,8 @@ struct options {
   const char* server;     //!< ebusd server host (name or ip) [localhost]
   uint16_t port;          //!< ebusd server port [8888]
   uint16_t timeout;       //!< ebusd connect/send/receive timeout
+  const char* batchFile;  //!< file to read the commands from in batch mode ("-" for stdin), or nullptr
+  const char* separator;  //!< the line to print after each result in batch mode [""]
 
   char* const *args;      //!< arguments to pass to ebusd
   unsigned int argCount;  //!< number of arguments to pass to ebusd
@@ -55,6 +61,8 @@ static struct options opt = {
   "localhost",  // server
   8888,         // port
   0,            // timeout
+  nullptr,      // batchFile
+  "",           // separator
 
   nullptr,         // args
   0             // argCount
@@ -71,6 +79,9 @@ static const char argpdoc[] =
   "Client for acessing " PACKAGE " via TCP.\n"
   "\v"
   "If given, send COMMAND together with CMDOPT options to " PACKAGE ".\n"
+  "In batch mode, each line of the input is a COMMAND with CMDOPT options. Empty lines and lines starting with '#' "
+  "are ignored. Reading stops at a quit command. The batch mode can also serve as a long-lived coprocess, since "
+  "the result of each line is printed as soon as it is available.\n"
   "Use 'help' as COMMAND for help on available " PACKAGE " commands.";
 
 /** the description of the accepted arguments. */
@@ -82,6 +93,9 @@ static const struct argp_option argpoptions[] = {
   {"server",  's', "HOST",  0, "Connect to " PACKAGE " on HOST (name or IP) [localhost]", 0 },
   {"port",    'p', "PORT",  0, "Connect to " PACKAGE " on PORT [8888]", 0 },
   {"timeout", 't', "SECS",  0, "Timeout for connection to " PACKAGE ", 0 for none [0]", 0 },
+  {"batch",   'b', "FILE",  OPTION_ARG_OPTIONAL, "Read commands from FILE (stdin if omitted or \"-\"), send "
+      "them over a single connection without waiting for each answer, and print the results in order", 0 },
+  {"separator", 'S', "TEXT", 0, "Print TEXT as line after each result in batch mode [\"\"]", 0 },
 
   {nullptr,     0, nullptr, 0, nullptr, 0 },
 };
@@ -121,7 +135,17 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
     }
     opt->timeout = (uint16_t)value;
     break;
+  case 'b':  // --batch[=FILE]
+    opt->batchFile = arg == nullptr || arg[0] == 0 ? "-" : arg;
+    break;
+  case 'S':  // --separator=TEXT
+    opt->separator = arg;
+    break;
   case ARGP_KEY_ARGS:
+    if (opt->batchFile) {
+      argp_error(state, "batch mode does not accept a COMMAND");
+      return EINVAL;
+    }
     opt->args = state->argv + state->next;
     opt->argCount = state->argc - state->next;
     break;
@@ -243,6 +267,134 @@ string fetchData(ebusd::TCPSocket* socket, bool listening) {
   return ostream.str();
 }
 
+/** the maximum number of commands sent ahead in batch mode before waiting for the first result. */
+#define BATCH_WINDOW 64
+
+/**
+ * Send the commands read from a file descriptor over a single connection without waiting for each answer, and
+ * print the results in the order of the commands.
+ * @param socket the @a TCPSocket connected to ebusd.
+ * @param inputFd the file descriptor to read the commands from.
+ * @param separator the line to print after each result.
+ * @param timeout the maximum time in seconds to wait for a result, or 0 for no limit.
+ * @return true when all results were received.
+ */
+bool batch(TCPSocket* socket, int inputFd, const string& separator, int timeout) {
+  char data[1024];
+  string input, received, send;
+  size_t outstanding = 0;
+  bool inputEnd = false;
+  while (!inputEnd || !input.empty() || outstanding > 0) {
+    // send the complete lines read so far, but not too far ahead of the results
+    size_t pos;
+    while (outstanding < BATCH_WINDOW && (pos = input.find('\n')) != string::npos) {
+      string line = input.substr(0, pos);
+      input.erase(0, pos+1);
+      line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+      size_t start = line.find_first_not_of(" \t");
+      if (start == string::npos || line[start] == '#') {
+        continue;
+      }
+      string command = line.substr(start, line.find_first_of(" \t", start)-start);
+      if (strcasecmp(command.c_str(), "Q") == 0 || strcasecmp(command.c_str(), "QUIT") == 0
+      || strcasecmp(command.c_str(), "STOP") == 0) {
+        inputEnd = true;
+        input.clear();
+        break;
+      }
+      if (strcasecmp(command.c_str(), "L") == 0 || strcasecmp(command.c_str(), "LISTEN") == 0
+      || strcasecmp(command.c_str(), "DIRECT") == 0) {
+        cerr << "ignoring unsupported command in batch mode: " << line << endl;
+        continue;
+      }
+      send += line + '\n';
+      outstanding++;
+    }
+    if (!send.empty()) {
+      if (socket->send(send.c_str(), send.size()) < 0) {
+        perror("send");
+        return false;
+      }
+      send.clear();
+    }
+    if (inputEnd && input.empty() && outstanding == 0) {
+      break;
+    }
+    bool readInput = !inputEnd && outstanding < BATCH_WINDOW;
+    bool newInput = false, newData = false;
+    struct timespec tdiff;
+    tdiff.tv_sec = timeout > 0 ? timeout : 3600;
+    tdiff.tv_nsec = 0;
+    int ret = 0;
+#ifdef HAVE_PPOLL
+    struct pollfd fds[2];
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = socket->getFD();
+    fds[0].events = POLLIN;
+    fds[1].fd = inputFd;
+    fds[1].events = POLLIN;
+    ret = ppoll(fds, readInput ? 2 : 1, &tdiff, nullptr);
+    if (ret > 0) {
+      newData = fds[0].revents != 0;
+      newInput = readInput && fds[1].revents != 0;
+    }
+#else
+#ifdef HAVE_PSELECT
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(socket->getFD(), &readfds);
+    if (readInput) {
+      FD_SET(inputFd, &readfds);
+    }
+    ret = pselect((inputFd > socket->getFD() ? inputFd : socket->getFD()) + 1, &readfds, nullptr, nullptr, &tdiff,
+        nullptr);
+    if (ret > 0) {
+      newData = FD_ISSET(socket->getFD(), &readfds);
+      newInput = readInput && FD_ISSET(inputFd, &readfds);
+    }
+#endif
+#endif
+    if (ret < 0) {
+      perror("poll");
+      return false;
+    }
+    if (ret == 0 && outstanding > 0 && timeout > 0) {
+      cout << "ERR: timeout" << endl;
+      return false;
+    }
+    if (newInput) {
+      ssize_t datalen = read(inputFd, data, sizeof(data));
+      if (datalen <= 0) {
+        inputEnd = true;
+        if (!input.empty()) {
+          input += '\n';  // last line without newline
+        }
+      } else {
+        input.append(data, datalen);
+      }
+    }
+    if (newData) {
+      ssize_t datalen = socket->isValid() ? socket->recv(data, sizeof(data)) : 0;
+      if (datalen <= 0) {
+        if (datalen < 0) {
+          perror("recv");
+        }
+        break;
+      }
+      received.append(data, datalen);
+      while (outstanding > 0 && (pos = received.find("\n\n")) != string::npos) {
+        cout << received.substr(0, pos+1) << separator << endl;  // flushed for the coprocess use
+        received.erase(0, pos+2);
+        outstanding--;
+      }
+    }
+  }
+  if (!received.empty()) {
+    cout << received;
+  }
+  return outstanding == 0;
+}
+
 bool connect(const char* host, uint16_t port, int timeout, char* const *args, int argCount) {
   TCPClient* client = new TCPClient();
   TCPSocket* socket = client->connect(host, port, timeout);
@@ -319,7 +471,28 @@ int main(int argc, char* argv[]) {
   if (argp_parse(&argp, argc, argv, ARGP_IN_ORDER, nullptr, &opt) != 0) {
     return EINVAL;
   }
-  bool success = connect(opt.server, opt.port, opt.timeout, opt.args, opt.argCount);
+  bool success;
+  if (opt.batchFile) {
+    int inputFd = strcmp(opt.batchFile, "-") == 0 ? STDIN_FILENO : open(opt.batchFile, O_RDONLY);
+    if (inputFd < 0) {
+      perror(opt.batchFile);
+      return EXIT_FAILURE;
+    }
+    TCPClient client;
+    TCPSocket* socket = client.connect(opt.server, opt.port, opt.timeout);
+    success = socket != nullptr;
+    if (success) {
+      success = batch(socket, inputFd, opt.separator, opt.timeout);
+      delete socket;
+    } else {
+      cout << "error connecting to " << opt.server << ":" << opt.port << endl;
+    }
+    if (inputFd != STDIN_FILENO) {
+      close(inputFd);
+    }
+  } else {
+    success = connect(opt.server, opt.port, opt.timeout, opt.args, opt.argCount);
+  }
 
   exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -23,12 +23,17 @@
 #include <argp.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <csignal>
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
+#include <map>
+#include <string>
 #include "lib/ebus/device.h"
 #include "lib/ebus/result.h"
+#include "lib/utils/tcpsocket.h"
 
 namespace ebusd {
 
@@ -39,6 +44,9 @@ using std::endl;
 using std::setw;
 using std::setfill;
 using std::ios;
+using std::map;
+using std::string;
+using std::dec;
 using ebusd::result_t;
 using ebusd::Device;
 
@@ -46,6 +54,12 @@ using ebusd::Device;
 struct options {
   const char* device;  //!< device to write to [/dev/ttyUSB60]
   unsigned int time;  //!< delay between bytes in us [10000]
+  bool timed;  //!< read a timed dump file and use the recorded delays
+  double speed;  //!< speed factor for dividing the delays (0 for as fast as possible) [1]
+  unsigned int loop;  //!< number of times to feed the dump file (0 for endless) [1]
+  bool quiet;  //!< do not print each fed byte
+  const char* ebusdHost;  //!< host of ebusd to query for statistics, or nullptr
+  uint16_t ebusdPort;  //!< port of ebusd to query for statistics, or 0
 
   const char* dumpFile;  //!< dump file to read
 };
@@ -54,6 +68,12 @@ struct options {
 static struct options opt = {
   "/dev/ttyUSB60",  // device
   10000,  // time
+  false,  // timed
+  1,  // speed
+  1,  // loop
+  false,  // quiet
+  nullptr,  // ebusdHost
+  0,  // ebusdPort
 
   "/tmp/ebus_dump.bin",  // dumpFile
 };
@@ -76,7 +96,12 @@ static const char argpdoc[] =
   "     'ln -s /dev/pts/2 /dev/ttyUSB60'\n"
   "     'ln -s /dev/pts/3 /dev/ttyUSB20'\n"
   "  3. start " PACKAGE ": '" PACKAGE " -f -d /dev/ttyUSB20 --nodevicecheck'\n"
-  "  4. start ebusfeed: 'ebusfeed /path/to/ebus_dump.bin'\n";
+  "  4. start ebusfeed: 'ebusfeed /path/to/ebus_dump.bin'\n"
+  "\n"
+  "For replaying with the original timing, record the dump with '" PACKAGE " --dumptimed' and feed it with\n"
+  "'ebusfeed -T'. Use e.g. '-s 10 -l 0 -q -e 8888' for a benchmark of " PACKAGE " running at ten times the\n"
+  "original speed in an endless loop, which reports the achieved rates and the " PACKAGE " statistics when\n"
+  "interrupted with Ctrl-C.\n";
 
 /** the description of the accepted arguments. */
 static char argpargsdoc[] = "[DUMPFILE]";
@@ -85,6 +110,12 @@ static char argpargsdoc[] = "[DUMPFILE]";
 static const struct argp_option argpoptions[] = {
   {"device", 'd', "DEV",     0, "Write to DEV (serial device) [/dev/ttyUSB60]", 0 },
   {"time",   't', "USEC",    0, "Delay each byte by USEC us [10000]", 0 },
+  {"timed",  'T', nullptr,   0, "Read a timed DUMPFILE (from '" PACKAGE " --dumptimed') and use the recorded "
+      "delays", 0 },
+  {"speed",  's', "FACTOR",  0, "Divide the delays by FACTOR (0 for as fast as possible) [1]", 0 },
+  {"loop",   'l', "COUNT",   0, "Feed the DUMPFILE COUNT times (0 for endless) [1]", 0 },
+  {"quiet",  'q', nullptr,   0, "Do not print each fed byte", 0 },
+  {"ebusd",  'e', "[HOST:]PORT", 0, "Report statistics of " PACKAGE " listening on [HOST:]PORT", 0 },
 
   {nullptr,    0, nullptr,   0, nullptr, 0 },
 };
@@ -114,6 +145,48 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
       return EINVAL;
     }
     break;
+  case 'T':  // --timed
+    opt->timed = true;
+    break;
+  case 's':  // --speed=1
+    opt->speed = strtod(arg, &strEnd);
+    if (strEnd == nullptr || strEnd == arg || *strEnd != 0 || opt->speed < 0 || opt->speed > 1000000) {
+      argp_error(state, "invalid speed");
+      return EINVAL;
+    }
+    break;
+  case 'l':  // --loop=1
+    opt->loop = (unsigned int)strtoul(arg, &strEnd, 10);
+    if (strEnd == nullptr || strEnd == arg || *strEnd != 0) {
+      argp_error(state, "invalid loop");
+      return EINVAL;
+    }
+    break;
+  case 'q':  // --quiet
+    opt->quiet = true;
+    break;
+  case 'e': {  // --ebusd=localhost:8888
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid ebusd");
+      return EINVAL;
+    }
+    char* pos = strrchr(arg, ':');
+    const char* port = arg;
+    if (pos) {
+      *pos = 0;
+      opt->ebusdHost = arg;
+      port = pos+1;
+    } else {
+      opt->ebusdHost = "localhost";
+    }
+    unsigned long value = strtoul(port, &strEnd, 10);
+    if (strEnd == nullptr || strEnd == port || *strEnd != 0 || value < 1 || value > 65535 || !opt->ebusdHost[0]) {
+      argp_error(state, "invalid ebusd");
+      return EINVAL;
+    }
+    opt->ebusdPort = (uint16_t)value;
+    break;
+  }
   case ARGP_KEY_ARG:
     if (state->arg_num == 0) {
       if (arg == nullptr || arg[0] == 0 || strcmp("/", arg) == 0) {
@@ -132,6 +205,88 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
 }
 
 
+/** whether feeding was stopped by a signal. */
+static volatile sig_atomic_t s_stopped = 0;
+
+/**
+ * The signal handling function.
+ * @param sig the received signal.
+ */
+void signalHandler(int sig) {
+  if (sig == SIGINT || sig == SIGTERM) {
+    s_stopped = 1;
+  }
+}
+
+/**
+ * Query the "info" command of ebusd.
+ * @param values the map in which to store the reported values by name.
+ * @return true on success.
+ */
+bool queryEbusdInfo(map<string, string>* values) {
+  TCPClient client;
+  TCPSocket* socket = client.connect(opt.ebusdHost, opt.ebusdPort, 2);
+  if (socket == nullptr) {
+    return false;
+  }
+  socket->setTimeout(2);
+  string str;
+  bool ret = socket->send("info\n", 5) == 5;
+  while (ret && !(str.length() >= 2 && str[str.length()-2] == '\n' && str[str.length()-1] == '\n')) {
+    char data[1024];
+    ssize_t datalen = socket->recv(data, sizeof(data));
+    if (datalen <= 0) {
+      ret = false;
+      break;
+    }
+    str.append(data, datalen);
+  }
+  delete socket;
+  size_t start = 0;
+  while (ret && start < str.length()) {
+    size_t end = str.find('\n', start);
+    if (end == string::npos) {
+      end = str.length();
+    }
+    size_t pos = str.find(": ", start);
+    if (pos != string::npos && pos < end) {
+      (*values)[str.substr(start, pos-start)] = str.substr(pos+2, end-pos-2);
+    }
+    start = end+1;
+  }
+  return ret;
+}
+
+/**
+ * Return the difference of a numeric ebusd info value between two queries.
+ * @param before the values before feeding.
+ * @param after the values after feeding.
+ * @param name the name of the value.
+ * @return the difference.
+ */
+int64_t getInfoDiff(const map<string, string>& before, const map<string, string>& after, const string& name) {
+  auto itBefore = before.find(name);
+  auto itAfter = after.find(name);
+  if (itAfter == after.end()) {
+    return 0;
+  }
+  int64_t value = strtoll(itAfter->second.c_str(), nullptr, 10);
+  if (itBefore != before.end()) {
+    value -= strtoll(itBefore->second.c_str(), nullptr, 10);
+  }
+  return value;
+}
+
+/**
+ * Return the difference of two times in microseconds.
+ * @param from the earlier time.
+ * @param to the later time.
+ * @return the difference in microseconds.
+ */
+int64_t diffMicros(const struct timespec& from, const struct timespec& to) {
+  return (to.tv_sec-from.tv_sec)*1000000LL + (to.tv_nsec-from.tv_nsec)/1000;
+}
+
 /**
  * Main function.
  * @param argc the number of command line arguments.
@@ -144,6 +299,11 @@ int main(int argc, char* argv[]) {
   if (argp_parse(&argp, argc, argv, ARGP_IN_ORDER, nullptr, &opt) != 0) {
     return EINVAL;
   }
+  map<string, string> infoBefore, infoAfter;
+  if (opt.ebusdPort && !queryEbusdInfo(&infoBefore)) {
+    cout << "unable to query " PACKAGE " on " << opt.ebusdHost << ":" << opt.ebusdPort << endl;
+    return EINVAL;
+  }
   Device* device = Device::create(opt.device, false, false, false);
   if (device == nullptr) {
     cout << "unable to create device " << opt.device << endl;
@@ -153,22 +313,73 @@ int main(int argc, char* argv[]) {
   if (result != ebusd::RESULT_OK) {
     cout << "unable to open " << opt.device << ": " << getResultCode(result) << endl;
   }
+  // stop feeding on signals in order to still report the statistics (e.g. for an endless loop)
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+  uint64_t sent = 0, errors = 0;
+  int64_t maxLag = 0, elapsed = 0;
   if (!device->isValid()) {
     cout << "device " << opt.device << " not available" << endl;
   } else {
     cout << "device opened" << endl;
     fstream file(opt.dumpFile, ios::in | ios::binary);
     if (file.is_open()) {
-      while (true) {
-        symbol_t byte = (symbol_t)file.get();
-        if (file.eof()) {
-          break;
+      // the deadlines are absolute in order to not accumulate the time needed for sending
+      struct timespec start, deadline, now;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      deadline = start;
+      for (unsigned int round = 0; (opt.loop == 0 || round < opt.loop) && !s_stopped; round++) {
+        if (round > 0) {
+          file.clear();
+          file.seekg(0);
+        }
+        while (!s_stopped) {
+          symbol_t byte;
+          unsigned int delay = opt.time;
+          if (opt.timed) {
+            unsigned char record[TIMED_DUMP_RECORD_SIZE];
+            file.read(reinterpret_cast<char*>(record), TIMED_DUMP_RECORD_SIZE);
+            if (file.gcount() != TIMED_DUMP_RECORD_SIZE) {
+              break;
+            }
+            byte = decodeTimedDumpRecord(record, &delay);
+          } else {
+            byte = (symbol_t)file.get();
+            if (file.eof()) {
+              break;
+            }
+          }
+          if (opt.speed > 0 && delay > 0) {
+            int64_t nsec = deadline.tv_nsec + static_cast<int64_t>(delay*1000.0/opt.speed);
+            deadline.tv_sec += nsec/1000000000;
+            deadline.tv_nsec = nsec%1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+            if (s_stopped) {
+              break;
+            }
+          }
+          if (!opt.quiet) {
+            cout << hex << setw(2) << setfill('0')
+                 << static_cast<unsigned>(byte) << endl;
+          }
+          if (device->send(byte) != ebusd::RESULT_OK) {
+            errors++;
+          }
+          sent++;
+          if (opt.speed > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t lag = diffMicros(deadline, now);
+            if (lag > maxLag) {
+              maxLag = lag;
+            }
+          }
+        }
+        if (sent == 0) {
+          break;  // empty file
         }
-        cout << hex << setw(2) << setfill('0')
-             << static_cast<unsigned>(byte) << endl;
-        device->send(byte);
-        usleep(opt.time);
       }
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      elapsed = diffMicros(start, now);
       file.close();
     } else {
       cout << "error opening file " << opt.dumpFile << endl;
@@ -176,6 +387,26 @@ int main(int argc, char* argv[]) {
   }
 
   delete device;
+  if (sent > 0) {
+    cout << dec << "symbols sent: " << sent << "\n"
+         << "send errors: " << errors << "\n"
+         << "elapsed: " << elapsed/1000 << " ms\n"
+         << "symbol rate: " << (elapsed > 0 ? sent*1000000/elapsed : 0) << "\n"
+         << "max lag: " << maxLag << " us" << endl;
+  }
+  if (opt.ebusdPort) {
+    sleep(1);  // give ebusd the chance to process the last symbols
+    if (!queryEbusdInfo(&infoAfter)) {
+      cout << "unable to query " PACKAGE " on " << opt.ebusdHost << ":" << opt.ebusdPort << endl;
+    } else {
+      cout << PACKAGE " symbol rate: " << infoAfter["symbol rate"] << "\n"
+           << PACKAGE " max symbol rate: " << infoAfter["max symbol rate"] << "\n"
+           << PACKAGE " received symbols: " << getInfoDiff(infoBefore, infoAfter, "received symbols") << "\n"
+           << PACKAGE " interrupted telegrams: " << getInfoDiff(infoBefore, infoAfter, "interrupted telegrams") << "\n"
+           << PACKAGE " signal losses: " << getInfoDiff(infoBefore, infoAfter, "signal losses") << "\n"
+           << PACKAGE " dropped raw symbols: " << getInfoDiff(infoBefore, infoAfter, "dropped raw symbols") << endl;
+    }
+  }
   exit(EXIT_SUCCESS);
 }
 
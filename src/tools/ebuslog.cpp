@@ -0,0 +1,271 @@
+/*
+ * ebusd - daemon for communication with eBUS heating systems.
+ * Copyright (C) 2016-2018 John Baier <ebusd@ebusd.eu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <argp.h>
+#include <string.h>
+#include <time.h>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lib/utils/rawlog.h"
+
+namespace ebusd {
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+/** A structure holding all program options. */
+struct options {
+  int64_t since;  //!< the minimum time in microseconds since the epoch
+  int64_t until;  //!< the maximum time in microseconds since the epoch
+  int address;  //!< the address to match as source or destination, or -1 for any
+  size_t idLength;  //!< the number of command bytes in id to match
+  uint8_t id[2];  //!< the primary and secondary command byte to match
+  bool verbose;  //!< print the number of read and skipped blocks to stderr
+
+  vector<const char*> files;  //!< the raw log files to read
+};
+
+/** the program options. */
+static struct options opt = {
+  INT64_MIN,  // since
+  INT64_MAX,  // until
+  -1,  // address
+  0,  // idLength
+  {0, 0},  // id
+  false,  // verbose
+
+  {},  // files
+};
+
+/** the version string of the program. */
+const char *argp_program_version = "ebuslog of """ PACKAGE_STRING "";
+
+/** the report bugs to address of the program. */
+const char *argp_program_bug_address = "" PACKAGE_BUGREPORT "";
+
+/** the documentation of the program. */
+static const char argpdoc[] =
+  "Print the telegrams from binary raw log FILEs written by '" PACKAGE " --lograwdata=binary'.\n"
+  "\v"
+  "Each FILE is read in the given order, e.g. 'ebuslog ebusd_raw.bin.old ebusd_raw.bin'.\n"
+  "TIME is either 'YYYY-MM-DD[ HH:MM[:SS]]' or 'HH:MM[:SS]' (today) in local time, or seconds since the epoch.\n"
+  "Blocks outside of the time range or without the address are skipped without decompressing them.\n";
+
+/** the description of the accepted arguments. */
+static char argpargsdoc[] = "FILE...";
+
+/** the definition of the known program arguments. */
+static const struct argp_option argpoptions[] = {
+  {"since",   's', "TIME",   0, "Only print telegrams from TIME on", 0 },
+  {"until",   'u', "TIME",   0, "Only print telegrams until TIME", 0 },
+  {"address", 'a', "QQ",     0, "Only print telegrams with source or destination address QQ (hex)", 0 },
+  {"id",      'i', "PB[SB]", 0, "Only print telegrams with primary [and secondary] command byte (hex)", 0 },
+  {"verbose", 'v', nullptr,  0, "Print the number of read and skipped blocks", 0 },
+
+  {nullptr,     0, nullptr,  0, nullptr, 0 },
+};
+
+/**
+ * Parse a time argument.
+ * @param arg the argument to parse.
+ * @param value the variable in which to store the time in microseconds since the epoch.
+ * @return true on success.
+ */
+static bool parseTime(const char* arg, int64_t* value) {
+  char* strEnd = nullptr;
+  long long seconds = strtoll(arg, &strEnd, 10);
+  if (strEnd != nullptr && strEnd != arg && *strEnd == 0) {
+    *value = seconds*1000000LL;
+    return true;
+  }
+  static const char* formats[] = {
+    "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", "%H:%M:%S", "%H:%M",
+  };
+  for (const auto format : formats) {
+    time_t now = time(nullptr);
+    struct tm td;
+    localtime_r(&now, &td);
+    td.tm_hour = td.tm_min = td.tm_sec = 0;
+    const char* end = strptime(arg, format, &td);
+    if (end != nullptr && *end == 0) {
+      td.tm_isdst = -1;
+      *value = static_cast<int64_t>(mktime(&td))*1000000LL;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Parse a hex argument.
+ * @param arg the argument to parse.
+ * @param maxBytes the maximum number of bytes.
+ * @param bytes the array in which to store the bytes.
+ * @return the number of parsed bytes, or 0 on error.
+ */
+static size_t parseHex(const char* arg, size_t maxBytes, uint8_t* bytes) {
+  size_t length = strlen(arg);
+  if (length == 0 || length%2 != 0 || length/2 > maxBytes) {
+    return 0;
+  }
+  for (size_t pos = 0; pos < length; pos += 2) {
+    char str[3] = {arg[pos], arg[pos+1], 0};
+    char* strEnd = nullptr;
+    bytes[pos/2] = static_cast<uint8_t>(strtoul(str, &strEnd, 16));
+    if (strEnd == nullptr || *strEnd != 0) {
+      return 0;
+    }
+  }
+  return length/2;
+}
+
+/**
+ * The program argument parsing function.
+ * @param key the key from @a argpoptions.
+ * @param arg the option argument, or nullptr.
+ * @param state the parsing state.
+ */
+error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  struct options *opt = (struct options*)state->input;
+  switch (key) {
+  case 's':  // --since=2018-01-01 12:00
+    if (!parseTime(arg, &opt->since)) {
+      argp_error(state, "invalid since");
+      return EINVAL;
+    }
+    break;
+  case 'u':  // --until=2018-01-01 13:00
+    if (!parseTime(arg, &opt->until)) {
+      argp_error(state, "invalid until");
+      return EINVAL;
+    }
+    break;
+  case 'a': {  // --address=08
+    uint8_t address;
+    if (parseHex(arg, 1, &address) != 1) {
+      argp_error(state, "invalid address");
+      return EINVAL;
+    }
+    opt->address = address;
+    break;
+  }
+  case 'i':  // --id=b509
+    opt->idLength = parseHex(arg, 2, opt->id);
+    if (opt->idLength == 0) {
+      argp_error(state, "invalid id");
+      return EINVAL;
+    }
+    break;
+  case 'v':  // --verbose
+    opt->verbose = true;
+    break;
+  case ARGP_KEY_ARG:
+    if (arg == nullptr || arg[0] == 0) {
+      argp_error(state, "invalid file");
+      return EINVAL;
+    }
+    opt->files.push_back(arg);
+    break;
+  case ARGP_KEY_END:
+    if (opt->files.empty()) {
+      argp_error(state, "missing file");
+      return EINVAL;
+    }
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+/**
+ * Print a record in the format of the text raw log.
+ * @param record the @a RawLogRecord to print.
+ */
+static void printRecord(const RawLogRecord& record) {
+  time_t seconds = static_cast<time_t>(record.m_time/1000000);
+  struct tm td;
+  localtime_r(&seconds, &td);
+  printf("%04d-%02d-%02d %02d:%02d:%02d.%03d ", td.tm_year+1900, td.tm_mon+1, td.tm_mday, td.tm_hour, td.tm_min,
+      td.tm_sec, static_cast<int>((record.m_time%1000000)/1000));
+  for (size_t pos = 0; pos < record.m_data.size(); pos++) {
+    if (pos == 0 || record.m_sent[pos] != record.m_sent[pos-1]) {
+      putchar(record.m_sent[pos] ? '>' : '<');
+    }
+    printf("%2.2x", record.m_data[pos]);
+  }
+  putchar('\n');
+}
+
+/**
+ * Main function.
+ * @param argc the number of command line arguments.
+ * @param argv the command line arguments.
+ * @return the exit code.
+ */
+int main(int argc, char* argv[]) {
+  struct argp argp = { argpoptions, parse_opt, argpargsdoc, argpdoc, nullptr, nullptr, nullptr };
+  setenv("ARGP_HELP_FMT", "no-dup-args-note", 0);
+  if (argp_parse(&argp, argc, argv, ARGP_IN_ORDER, nullptr, &opt) != 0) {
+    return EINVAL;
+  }
+  RawLogFilter filter;
+  filter.m_since = opt.since;
+  filter.m_until = opt.until;
+  filter.m_address = opt.address;
+  filter.m_idLength = opt.idLength;
+  memcpy(filter.m_id, opt.id, sizeof(filter.m_id));
+  int ret = EXIT_SUCCESS;
+  uint64_t blocksRead = 0, blocksSkipped = 0, records = 0;
+  for (const auto file : opt.files) {
+    RawLogReader reader;
+    if (!reader.open(file)) {
+      cerr << "unable to read " << file << endl;
+      ret = EXIT_FAILURE;
+      continue;
+    }
+    RawLogRecord record;
+    while (reader.read(filter, &record)) {
+      printRecord(record);
+      records++;
+    }
+    blocksRead += reader.getBlocksRead();
+    blocksSkipped += reader.getBlocksSkipped();
+  }
+  fflush(stdout);
+  if (opt.verbose) {
+    cerr << "telegrams: " << records << ", blocks read: " << blocksRead << ", blocks skipped: " << blocksSkipped
+         << endl;
+  }
+  return ret;
+}
+
+}  // namespace ebusd
+
+int main(int argc, char* argv[]) {
+  return ebusd::main(argc, argv);
+}